@@ -0,0 +1,1758 @@
+/*
+** Benchmarks for upb's parsers and serializers.
+**
+** Every benchmark runs over tests/google_message1.dat and
+** tests/google_message2.dat, which are instances of benchmarks.SpeedMessage1
+** and benchmarks.SpeedMessage2 from tests/google_messages.proto, and over a
+** generated benchmarks.NumericMessage (benchmarks/numbers.proto) that is mostly
+** repeated numeric fields, and a generated benchmarks.MapMessage
+** (benchmarks/maps.proto) that is all map entries.  "ext_decode" and
+** "ext_reparse" run only over a generated benchmarks.ExtBatch
+** (benchmarks/extensions.proto), whose records carry extensions, and
+** "any_json_decode" and "any_json_encode" only over a generated
+** benchmarks.EventBatch (benchmarks/events.proto), whose events wrap their
+** payloads in google.protobuf.Any.  "def_freeze" times upb_def_freeze() on a generated graph of 100k message
+** defs.  Run from the top of the source tree:
+**
+**   benchmarks/benchmark benchmarks/benchmark.proto.pb [filter]
+**
+** or just "make benchmark".  If |filter| is given, only benchmarks whose name
+** contains it are run.
+**
+** Each benchmark is run twice: "cold" creates a fresh environment (and hence
+** arena) for every operation, "warm" reuses one environment whose arena is
+** upb_arena_reset() between operations.  We report throughput in MB/s of input
+** and the number of calls to the underlying allocator per operation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "upb/bindings/stdc++/string.h"
+#include "upb/decode.h"
+#include "upb/encode.h"
+#include "upb/json/decode.h"
+#include "upb/json/encode.h"
+#include "upb/json/parser.h"
+#include "upb/json/printer.h"
+#include "upb/json/transcode.h"
+#include "upb/msgfactory.h"
+#include "upb/pb/decoder.h"
+#include "upb/pb/delimited.h"
+#include "upb/pb/encoder.h"
+#include "upb/pb/glue.h"
+#include "upb/pb/textprinter.h"
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof(a[0]))
+
+/* Minimum running time of each benchmark, in seconds. */
+static const double kMinTime = 0.5;
+
+/* Counting allocator *********************************************************/
+
+static size_t allocs = 0;
+
+static void *CountingAlloc(upb_alloc *alloc, void *ptr, size_t oldsize,
+                           size_t size) {
+  if (size > 0) allocs++;
+  return upb_alloc_global.func(alloc, ptr, oldsize, size);
+}
+
+static upb::Allocator counting;
+
+/* An output sink that throws away its data ***********************************/
+
+class DiscardSink {
+ public:
+  DiscardSink() {
+    upb_byteshandler_init(&handler_);
+    upb_byteshandler_setstring(&handler_, &Discard, NULL);
+    sink_.Reset(&handler_, this);
+  }
+
+  upb::BytesSink* input() { return &sink_; }
+
+ private:
+  static size_t Discard(void *c, const void *hd, const char *buf, size_t n,
+                        const upb_bufhandle *h) {
+    UPB_UNUSED(c);
+    UPB_UNUSED(hd);
+    UPB_UNUSED(buf);
+    UPB_UNUSED(h);
+    return n;
+  }
+
+  upb::BytesHandler handler_;
+  upb::BytesSink sink_;
+};
+
+/* Benchmark inputs ***********************************************************/
+
+struct Input {
+  const char *name;
+  const char *msgname;
+  const char *filename;  /* If NULL, |pb| is built by |generate| instead. */
+  void (*generate)(std::string *pb);
+  bool maps;  /* Has map fields, which only the upb_msg benchmarks handle. */
+
+  std::string pb;
+  std::string json;
+  std::string delimited;  /* kDelimitedCount copies of |pb|, delimited. */
+
+  const upb::MessageDef *md;
+  upb_msgfactory *factory;
+  const upb_msglayout *layout;
+  upb_msg *msg;  /* Decoded from |pb|, for the encode benchmark. */
+  upb_msg *copy;  /* Decoded again, with its own strings, to compare to |msg|. */
+  const upb_json_transcoder *transcoder;
+
+  upb::reffed_ptr<const upb::Handlers> encoder_handlers;
+  upb::reffed_ptr<const upb::Handlers> json_handlers;
+  upb::reffed_ptr<const upb::Handlers> text_handlers;
+  upb::reffed_ptr<const upb::json::ParserMethod> json_method;
+
+  /* Decoder methods that push to the handlers above. */
+  const upb::pb::DecoderMethod *encoder_method;
+  const upb::pb::DecoderMethod *encoder_jit_method;
+  const upb::pb::DecoderMethod *encoder_utf8_method;
+  const upb::pb::DecoderMethod *json_decoder_method;
+  const upb::pb::DecoderMethod *text_decoder_method;
+};
+
+static bool ReadFile(const char *filename, std::string *out) {
+  FILE *f = fopen(filename, "rb");
+  char buf[4096];
+  size_t n;
+
+  if (!f) return false;
+  out->clear();
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out->append(buf, n);
+  }
+  fclose(f);
+  return true;
+}
+
+/* Generates a benchmarks.NumericMessage.  The values span many magnitudes so
+ * that number formatting isn't dominated by any one case. */
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t Random() {
+  /* xorshift64: deterministic across runs and platforms. */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static void PutVarint(uint64_t val, std::string *out) {
+  do {
+    char byte = val & 0x7f;
+    val >>= 7;
+    if (val) byte |= 0x80;
+    out->push_back(byte);
+  } while (val);
+}
+
+static void PutFixed(uint64_t val, int bytes, std::string *out) {
+  int i;
+  for (i = 0; i < bytes; i++) {
+    out->push_back((char)(val >> (i * 8)));
+  }
+}
+
+/* Returns a random value with up to ~16 significant digits and a random decimal
+ * exponent.  Every fourth value is rounded to three decimal places. */
+static double RandomDouble(int i) {
+  double d = (double)(Random() >> 11) / (double)(1ULL << 53);
+  int exp10 = (int)(Random() % 40) - 20;
+
+  while (exp10 > 0) { d *= 10; exp10--; }
+  while (exp10 < 0) { d /= 10; exp10++; }
+  if (i % 4 == 0 && d < 1e9) d = (double)(int64_t)(d * 1000) / 1000;
+  return i % 2 ? -d : d;
+}
+
+static uint64_t RandomVarint() {
+  return Random() >> (Random() % 64);
+}
+
+static void GenerateNumeric(std::string *pb) {
+  const int kCount = 2000;
+  int i;
+
+  /* Each field's values are contiguous, so that the printer emits one long
+   * array per field like it would for a real message. */
+  pb->clear();
+  for (i = 0; i < kCount; i++) {
+    double d = RandomDouble(i);
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_64BIT, pb);
+    PutFixed(bits, 8, pb);
+  }
+  for (i = 0; i < kCount; i++) {
+    float f = (float)RandomDouble(i);
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    PutVarint((2 << 3) | UPB_WIRE_TYPE_32BIT, pb);
+    PutFixed(bits, 4, pb);
+  }
+  for (i = 0; i < kCount; i++) {
+    PutVarint((3 << 3) | UPB_WIRE_TYPE_VARINT, pb);
+    PutVarint(RandomVarint(), pb);
+  }
+  for (i = 0; i < kCount; i++) {
+    PutVarint((4 << 3) | UPB_WIRE_TYPE_VARINT, pb);
+    PutVarint(RandomVarint(), pb);
+  }
+  for (i = 0; i < kCount; i++) {
+    PutVarint((5 << 3) | UPB_WIRE_TYPE_VARINT, pb);
+    PutVarint((uint64_t)(int64_t)(int32_t)RandomVarint(), pb);
+  }
+}
+
+static void PutString(const std::string &str, std::string *out) {
+  PutVarint(str.size(), out);
+  out->append(str);
+}
+
+/* Generates a benchmarks.MapMessage.  Keys are random, so the entries come
+ * out of upb's maps in an order unrelated to their keys. */
+static void GenerateMaps(std::string *pb) {
+  const int kCount = 1000;
+  int i;
+
+  pb->clear();
+  for (i = 0; i < kCount; i++) {
+    std::string entry, name;
+    uint64_t len = 4 + Random() % 20;
+    while (name.size() < len) name.push_back('a' + Random() % 26);
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_DELIMITED, &entry);
+    PutString(name, &entry);
+    PutVarint((2 << 3) | UPB_WIRE_TYPE_VARINT, &entry);
+    PutVarint(RandomVarint(), &entry);
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_DELIMITED, pb);
+    PutString(entry, pb);
+  }
+  for (i = 0; i < kCount; i++) {
+    std::string entry;
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_VARINT, &entry);
+    PutVarint(RandomVarint(), &entry);
+    PutVarint((2 << 3) | UPB_WIRE_TYPE_DELIMITED, &entry);
+    PutString("value", &entry);
+    PutVarint((2 << 3) | UPB_WIRE_TYPE_DELIMITED, pb);
+    PutString(entry, pb);
+  }
+  for (i = 0; i < kCount; i++) {
+    std::string entry;
+    double d = RandomDouble(i);
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_VARINT, &entry);
+    PutVarint(Random() % 65536, &entry);
+    PutVarint((2 << 3) | UPB_WIRE_TYPE_64BIT, &entry);
+    PutFixed(bits, 8, &entry);
+    PutVarint((3 << 3) | UPB_WIRE_TYPE_DELIMITED, pb);
+    PutString(entry, pb);
+  }
+}
+
+/* Generates a benchmarks.ExtBatch whose records all carry ExtRecord's
+ * extensions, except that every third one has no label. */
+static void GenerateExtensions(std::string *pb) {
+  const int kCount = 1000;
+  int i;
+
+  pb->clear();
+  for (i = 0; i < kCount; i++) {
+    std::string record, payload, tags, name;
+    uint64_t len = 4 + Random() % 20;
+    int j;
+
+    while (name.size() < len) name.push_back('a' + Random() % 26);
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_DELIMITED, &payload);
+    PutString(name, &payload);
+    PutVarint((2 << 3) | UPB_WIRE_TYPE_VARINT, &payload);
+    PutVarint(RandomVarint(), &payload);
+    for (j = 0; j < 4; j++) PutVarint(Random() % 1000, &tags);
+
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_VARINT, &record);
+    PutVarint(i, &record);
+    PutVarint((100 << 3) | UPB_WIRE_TYPE_DELIMITED, &record);
+    PutString(payload, &record);
+    PutVarint((101 << 3) | UPB_WIRE_TYPE_DELIMITED, &record);
+    PutString(tags, &record);
+    if (i % 3 != 0) {
+      PutVarint((102 << 3) | UPB_WIRE_TYPE_DELIMITED, &record);
+      PutString(name, &record);
+    }
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_DELIMITED, pb);
+    PutString(record, pb);
+  }
+}
+
+/* Generates a benchmarks.EventBatch whose events' Any payloads cycle through
+ * three message types.  Every value is non-zero, as proto3 would write it. */
+static void GenerateEvents(std::string *pb) {
+  static const char *const kUrls[] = {
+    "type.googleapis.com/benchmarks.LoginEvent",
+    "type.googleapis.com/benchmarks.ClickEvent",
+    "type.googleapis.com/benchmarks.MetricEvent",
+  };
+  const int kCount = 1000;
+  int i;
+
+  pb->clear();
+  for (i = 0; i < kCount; i++) {
+    std::string event, any, payload, name;
+    uint64_t len = 4 + Random() % 20;
+    double d = RandomDouble(i);
+    uint64_t bits;
+
+    while (name.size() < len) name.push_back('a' + Random() % 26);
+    switch (i % 3) {
+      case 0:
+        PutVarint((1 << 3) | UPB_WIRE_TYPE_DELIMITED, &payload);
+        PutString(name, &payload);
+        PutVarint((2 << 3) | UPB_WIRE_TYPE_VARINT, &payload);
+        PutVarint(1 + Random() % 2000000000, &payload);
+        break;
+      case 1:
+        PutVarint((1 << 3) | UPB_WIRE_TYPE_VARINT, &payload);
+        PutVarint(1 + Random() % 4000, &payload);
+        PutVarint((2 << 3) | UPB_WIRE_TYPE_VARINT, &payload);
+        PutVarint(1 + Random() % 4000, &payload);
+        PutVarint((3 << 3) | UPB_WIRE_TYPE_DELIMITED, &payload);
+        PutString(name, &payload);
+        break;
+      case 2:
+        if (d == 0) d = 1;
+        memcpy(&bits, &d, sizeof(bits));
+        PutVarint((1 << 3) | UPB_WIRE_TYPE_DELIMITED, &payload);
+        PutString(name, &payload);
+        PutVarint((2 << 3) | UPB_WIRE_TYPE_64BIT, &payload);
+        PutFixed(bits, 8, &payload);
+        PutVarint((3 << 3) | UPB_WIRE_TYPE_DELIMITED, &payload);
+        PutString("host", &payload);
+        PutVarint((3 << 3) | UPB_WIRE_TYPE_DELIMITED, &payload);
+        PutString(name, &payload);
+        break;
+    }
+
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_DELIMITED, &any);
+    PutString(kUrls[i % 3], &any);
+    PutVarint((2 << 3) | UPB_WIRE_TYPE_DELIMITED, &any);
+    PutString(payload, &any);
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_VARINT, &event);
+    PutVarint(i + 1, &event);
+    PutVarint((2 << 3) | UPB_WIRE_TYPE_DELIMITED, &event);
+    PutString(any, &event);
+    PutVarint((1 << 3) | UPB_WIRE_TYPE_DELIMITED, pb);
+    PutString(event, pb);
+  }
+}
+
+/* Benchmarks *****************************************************************/
+
+/* The delimited benchmarks read and write a stream of this many messages,
+ * which the reader is given in chunks of kDelimitedChunk bytes. */
+static const int kDelimitedCount = 64;
+static const size_t kDelimitedChunk = 65536;
+
+/* upb_decodestream is given its input in chunks of kStreamChunk bytes. */
+static const size_t kStreamChunk = 4096;
+
+typedef bool RunFunc(Input *in, upb::Environment *env);
+
+/* Decodes |in->pb| into |msg| with a upb_decodestream, |chunk| bytes at a
+ * time.  If |known_size|, the stream is told the size up front. */
+static bool DecodeStream(Input *in, upb_msg *msg, size_t chunk,
+                         bool known_size, int options) {
+  upb_decodestream *s = upb_decodestream_new(
+      msg, in->layout, NULL, options,
+      known_size ? in->pb.size() : UPB_DECODE_UNKNOWNSIZE);
+  size_t ofs;
+  upb_decodestatus status = UPB_DECODE_NEEDMORE;
+
+  if (!s) return false;
+  for (ofs = 0; ofs < in->pb.size(); ofs += chunk) {
+    size_t n = UPB_MIN(in->pb.size() - ofs, chunk);
+    size_t consumed;
+    status = upb_decodestream_put(s, in->pb.data() + ofs, n, &consumed);
+    if (status == UPB_DECODE_ERROR || consumed != n) return false;
+  }
+
+  return known_size ? status == UPB_DECODE_DONE
+                    : upb_decodestream_end(s) == UPB_DECODE_DONE;
+}
+
+static bool RunDecode(Input *in, upb::Environment *env) {
+  upb_msg *msg = upb_msg_new(in->layout, env->arena());
+  return msg && upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()),
+                           msg, in->layout);
+}
+
+static bool RunDecodeUtf8(Input *in, upb::Environment *env) {
+  upb_msg *msg = upb_msg_new(in->layout, env->arena());
+  return msg && upb_decode2(upb_stringview_make(in->pb.data(), in->pb.size()),
+                            msg, in->layout, UPB_DECODE_VALIDATEUTF8);
+}
+
+static bool RunDecodeRequired(Input *in, upb::Environment *env) {
+  upb_msg *msg = upb_msg_new(in->layout, env->arena());
+  return msg && upb_decode2(upb_stringview_make(in->pb.data(), in->pb.size()),
+                            msg, in->layout, UPB_DECODE_CHECKREQUIRED);
+}
+
+/* Decoding with the arena and decoder both counting, to see what that costs.
+ * The counts themselves go unused. */
+static upb_arenastats arena_stats;
+static upb_decodestats decode_stats;
+
+static bool RunDecodeStats(Input *in, upb::Environment *env) {
+  upb_msg *msg;
+  bool ok;
+
+  env->arena()->SetStats(&arena_stats);
+  msg = upb_msg_new(in->layout, env->arena());
+  ok = msg &&
+       upb_decode_withstats(upb_stringview_make(in->pb.data(), in->pb.size()),
+                            msg, in->layout, NULL, 0, &decode_stats);
+  env->arena()->SetStats(NULL);
+  return ok;
+}
+
+static bool RunDecodeStream(Input *in, upb::Environment *env) {
+  upb_msg *msg = upb_msg_new(in->layout, env->arena());
+  return msg && DecodeStream(in, msg, kStreamChunk, true, 0);
+}
+
+/* Only for inputs read from a file: decodes straight out of the file, which is
+ * in the page cache after the first run. */
+static bool RunDecodeFile(Input *in, upb::Environment *env) {
+  upb_msg *msg = upb_msg_new(in->layout, env->arena());
+  return msg && upb_decode_file(in->filename, msg, in->layout, 0, NULL);
+}
+
+static bool RunEncode(Input *in, upb::Environment *env) {
+  size_t size;
+  return upb_encode(in->msg, in->layout, env->arena(), &size) != NULL;
+}
+
+static bool RunEncodeDeterministic(Input *in, upb::Environment *env) {
+  size_t size;
+  return upb_encode2(in->msg, in->layout, env->arena(), &size,
+                     UPB_ENCODE_DETERMINISTIC) != NULL;
+}
+
+static bool RunMsgEqual(Input *in, upb::Environment *env) {
+  UPB_UNUSED(env);
+  return upb_msg_equal(in->msg, in->copy, in->layout);
+}
+
+/* What comparing messages took before upb_msg_equal(). */
+static bool RunMsgEqualEncoded(Input *in, upb::Environment *env) {
+  size_t size, copy_size;
+  char *pb = upb_encode(in->msg, in->layout, env->arena(), &size);
+  char *copy_pb = upb_encode(in->copy, in->layout, env->arena(), &copy_size);
+  return pb && copy_pb && size == copy_size &&
+         memcmp(pb, copy_pb, size) == 0;
+}
+
+static bool RunMsgHash(Input *in, upb::Environment *env) {
+  volatile uint64_t hash;
+  UPB_UNUSED(env);
+  hash = upb_msg_hash(in->msg, in->layout, 0);
+  UPB_UNUSED(hash);
+  return true;
+}
+
+static bool RunPbToPb(const upb::pb::DecoderMethod *method, Input *in,
+                      upb::Environment *env) {
+  DiscardSink out;
+  upb::pb::Encoder *encoder =
+      upb::pb::Encoder::Create(env, in->encoder_handlers.get(), out.input());
+  upb::pb::Decoder *decoder =
+      upb::pb::Decoder::Create(env, method, encoder->input());
+  return upb::BufferSource::PutBuffer(in->pb, decoder->input());
+}
+
+static bool RunPbDecoder(Input *in, upb::Environment *env) {
+  return RunPbToPb(in->encoder_method, in, env);
+}
+
+static bool RunPbDecoderJit(Input *in, upb::Environment *env) {
+  return RunPbToPb(in->encoder_jit_method, in, env);
+}
+
+static bool RunPbDecoderUtf8(Input *in, upb::Environment *env) {
+  return RunPbToPb(in->encoder_utf8_method, in, env);
+}
+
+static bool RunJsonPrint(Input *in, upb::Environment *env) {
+  DiscardSink out;
+  upb::json::Printer *printer =
+      upb::json::Printer::Create(env, in->json_handlers.get(), out.input());
+  upb::pb::Decoder *decoder = upb::pb::Decoder::Create(
+      env, in->json_decoder_method, printer->input());
+  return upb::BufferSource::PutBuffer(in->pb, decoder->input());
+}
+
+static bool RunJsonParse(Input *in, upb::Environment *env) {
+  DiscardSink out;
+  upb::pb::Encoder *encoder =
+      upb::pb::Encoder::Create(env, in->encoder_handlers.get(), out.input());
+  upb::json::Parser *parser = upb::json::Parser::Create(
+      env, in->json_method.get(), encoder->input(), false);
+  return upb::BufferSource::PutBuffer(in->json, parser->input());
+}
+
+static bool RunJsonDecode(Input *in, upb::Environment *env) {
+  upb_msg *msg = upb_msg_new(in->layout, env->arena());
+  return msg && upb_json_decode(upb_stringview_make(in->json.data(),
+                                                    in->json.size()),
+                                msg, in->md, in->factory, 0, NULL);
+}
+
+static bool RunJsonEncode(Input *in, upb::Environment *env) {
+  size_t size;
+  return upb_json_encode(in->msg, in->layout, in->md, env->arena(), 0,
+                         &size) != NULL;
+}
+
+static bool RunJsonEncodeAny(Input *in, upb::Environment *env) {
+  size_t size;
+  return upb_json_encode2(in->msg, in->layout, in->md, in->factory,
+                          env->arena(), 0, &size) != NULL;
+}
+
+static bool RunJsonTranscode(Input *in, upb::Environment *env) {
+  size_t size;
+  return upb_json_transcoder_tojson(
+             in->transcoder, upb_stringview_make(in->pb.data(), in->pb.size()),
+             env->arena(), &size, NULL) != NULL;
+}
+
+static bool RunJsonTranscodeToPb(Input *in, upb::Environment *env) {
+  size_t size;
+  return upb_json_transcoder_topb(
+             in->transcoder,
+             upb_stringview_make(in->json.data(), in->json.size()),
+             env->arena(), 0, &size, NULL) != NULL;
+}
+
+static bool RunTextPrint(Input *in, upb::Environment *env) {
+  DiscardSink out;
+  upb::pb::TextPrinter *printer =
+      upb::pb::TextPrinter::Create(env, in->text_handlers.get(), out.input());
+  upb::pb::Decoder *decoder = upb::pb::Decoder::Create(
+      env, in->text_decoder_method, printer->input());
+  return upb::BufferSource::PutBuffer(in->pb, decoder->input());
+}
+
+static bool CountMessage(void *closure, upb_msg *msg) {
+  UPB_UNUSED(msg);
+  (*static_cast<int*>(closure))++;
+  return true;
+}
+
+static bool RunDelimitedRead(Input *in, upb::Environment *env) {
+  int count = 0;
+  upb_delimreader *r =
+      upb_delimreader_create(env, in->layout, 0, &CountMessage, &count);
+  upb::BytesSink *sink = upb_delimreader_input(r);
+  const char *buf = in->delimited.data();
+  size_t len = in->delimited.size();
+  size_t ofs;
+  void *subc;
+
+  if (!sink->Start(len, &subc)) return false;
+  for (ofs = 0; ofs < len; ofs += kDelimitedChunk) {
+    size_t n = UPB_MIN(len - ofs, kDelimitedChunk);
+    if (sink->PutBuffer(subc, buf + ofs, n, NULL) != n) return false;
+  }
+  return sink->End() && count == kDelimitedCount;
+}
+
+static bool RunDelimitedWrite(Input *in, upb::Environment *env) {
+  DiscardSink out;
+  upb_delimwriter *w = upb_delimwriter_create(env, out.input());
+  int i;
+
+  for (i = 0; i < kDelimitedCount; i++) {
+    if (!upb_delimwriter_put(w, in->msg, in->layout)) return false;
+  }
+  return upb_delimwriter_end(w);
+}
+
+/* Which of an Input's encodings a benchmark consumes or produces. */
+typedef enum {
+  PB_INPUT,
+  JSON_INPUT,
+  DELIMITED_INPUT
+} InputKind;
+
+struct Benchmark {
+  const char *name;
+  RunFunc *run;
+  InputKind input;
+};
+
+static const Benchmark kBenchmarks[] = {
+  {"upb_decode", &RunDecode, PB_INPUT},
+  {"upb_decode_utf8", &RunDecodeUtf8, PB_INPUT},
+  {"upb_decode_required", &RunDecodeRequired, PB_INPUT},
+  {"upb_decode_file", &RunDecodeFile, PB_INPUT},
+  {"upb_decode_stats", &RunDecodeStats, PB_INPUT},
+  {"upb_decodestream", &RunDecodeStream, PB_INPUT},
+  {"upb_encode", &RunEncode, PB_INPUT},
+  {"upb_encode_det", &RunEncodeDeterministic, PB_INPUT},
+  {"msg_equal", &RunMsgEqual, PB_INPUT},
+  {"msg_equal_encoded", &RunMsgEqualEncoded, PB_INPUT},
+  {"msg_hash", &RunMsgHash, PB_INPUT},
+  {"pbdecoder", &RunPbDecoder, PB_INPUT},
+  {"pbdecoder_jit", &RunPbDecoderJit, PB_INPUT},
+  {"pbdecoder_utf8", &RunPbDecoderUtf8, PB_INPUT},
+  {"json_print", &RunJsonPrint, PB_INPUT},
+  {"json_parse", &RunJsonParse, JSON_INPUT},
+  {"json_decode", &RunJsonDecode, JSON_INPUT},
+  {"json_encode", &RunJsonEncode, PB_INPUT},
+  {"json_transcode", &RunJsonTranscode, PB_INPUT},
+  {"json_transcode_topb", &RunJsonTranscodeToPb, JSON_INPUT},
+  {"textprint", &RunTextPrint, PB_INPUT},
+  {"delimited_read", &RunDelimitedRead, DELIMITED_INPUT},
+  {"delimited_write", &RunDelimitedWrite, DELIMITED_INPUT},
+};
+
+/* Runs one benchmark until kMinTime has elapsed and prints the results. */
+static bool RunBenchmark(const Benchmark *b, Input *in, bool warm) {
+  size_t bytes = b->input == JSON_INPUT        ? in->json.size()
+                 : b->input == DELIMITED_INPUT ? in->delimited.size()
+                                               : in->pb.size();
+  upb::Environment *warm_env = NULL;
+  long iters = 0;
+  long batch = 1;
+  double elapsed;
+  clock_t start;
+
+  if (warm) {
+    warm_env = new upb::Environment(NULL, 0, &counting);
+    warm_env->arena()->SetMaxRetained(1 << 24);
+  }
+
+  allocs = 0;
+  start = clock();
+
+  do {
+    long i;
+    for (i = 0; i < batch; i++) {
+      bool ok;
+      if (warm) {
+        upb_arena_reset(warm_env->arena());
+        ok = b->run(in, warm_env);
+      } else {
+        upb::Environment env(NULL, 0, &counting);
+        ok = b->run(in, &env);
+      }
+      if (!ok) {
+        fprintf(stderr, "%s failed on %s\n", b->name, in->name);
+        delete warm_env;
+        return false;
+      }
+    }
+    iters += batch;
+    batch *= 2;
+    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+  } while (elapsed < kMinTime);
+
+  delete warm_env;
+
+  printf("%-16s %-16s %-5s %9.1f MB/s %9.2f allocs/op\n", b->name, in->name,
+         warm ? "warm" : "cold", (double)bytes * iters / elapsed / 1e6,
+         (double)allocs / iters);
+  return true;
+}
+
+/* Freezing a large def graph *************************************************/
+
+/* The graph has kFreezeDefs messages in kFreezeLayers layers.  Every message
+ * refers to itself, to a partner in its own layer (so there are cycles, as in
+ * real schemas) and to two random messages in the next layer.  Keeping the
+ * cycles within a layer bounds the depth of the graph, which upb_def_freeze()
+ * limits. */
+static const int kFreezeDefs = 100000;
+static const int kFreezeLayers = 24;
+static const int kFreezeRuns = 3;
+
+static bool AddMessageField(upb_msgdef *m, const char *name, uint32_t number,
+                            const upb_msgdef *subdef) {
+  upb_fielddef *f = upb_fielddef_new(&f);
+  upb::Status status;
+  upb_fielddef_setlabel(f, UPB_LABEL_OPTIONAL);
+  if (subdef) {
+    upb_fielddef_settype(f, UPB_TYPE_MESSAGE);
+  } else {
+    upb_fielddef_settype(f, UPB_TYPE_INT32);
+  }
+  return f && upb_fielddef_setname(f, name, &status) &&
+         upb_fielddef_setnumber(f, number, &status) &&
+         (!subdef || upb_fielddef_setmsgsubdef(f, subdef, &status)) &&
+         upb_msgdef_addfield(m, f, &f, &status);
+}
+
+static bool BuildDefGraph(std::vector<upb_def*> *defs) {
+  int per_layer = kFreezeDefs / kFreezeLayers;
+  int n = per_layer * kFreezeLayers;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    char name[32];
+    upb_msgdef *m = upb_msgdef_new(defs);
+    sprintf(name, "bench.M%d", i);
+    if (!m || !upb_msgdef_setfullname(m, name, NULL)) return false;
+    defs->push_back(upb_msgdef_upcast_mutable(m));
+  }
+
+  for (i = 0; i < n; i++) {
+    upb_msgdef *m = upb_downcast_msgdef_mutable((*defs)[i]);
+    int layer = i / per_layer;
+    const upb_msgdef *partner = upb_downcast_msgdef((*defs)[i ^ 1]);
+    const upb_msgdef *next1 = NULL;
+    const upb_msgdef *next2 = NULL;
+
+    if (layer + 1 < kFreezeLayers) {
+      int base = (layer + 1) * per_layer;
+      next1 = upb_downcast_msgdef((*defs)[base + Random() % per_layer]);
+      next2 = upb_downcast_msgdef((*defs)[base + Random() % per_layer]);
+    }
+
+    if (!AddMessageField(m, "self", 1, m) ||
+        !AddMessageField(m, "partner", 2, partner) ||
+        !AddMessageField(m, "next1", 3, next1) ||
+        !AddMessageField(m, "next2", 4, next2)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool RunFreezeBenchmark() {
+  double best = 0;
+  size_t n = 0;
+  int run;
+
+  for (run = 0; run < kFreezeRuns; run++) {
+    std::vector<upb_def*> defs;
+    upb::Status status;
+    double elapsed;
+    clock_t start;
+    size_t i;
+    bool ok;
+
+    if (!BuildDefGraph(&defs)) {
+      fprintf(stderr, "Couldn't build def graph\n");
+      return false;
+    }
+
+    start = clock();
+    ok = upb_def_freeze(&defs[0], defs.size(), &status);
+    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    for (i = 0; i < defs.size(); i++) {
+      upb_def_unref(defs[i], &defs);
+    }
+
+    if (!ok) {
+      fprintf(stderr, "upb_def_freeze() failed: %s\n",
+              status.error_message());
+      return false;
+    }
+
+    if (run == 0 || elapsed < best) best = elapsed;
+    n = defs.size();
+  }
+
+  printf("%-16s %-16s %-5s %9.1f ms   %9.1f Kdefs/s\n", "def_freeze",
+         "synthetic", "cold", best * 1e3, n / best / 1e3);
+  return true;
+}
+
+/* Extensions *****************************************************************/
+
+/* ExtRecord's extensions, which benchmarks/extensions.proto can't declare
+ * (see there), and the layouts and field indexes that reading them takes. */
+static struct {
+  upb_msglayout_ext payload, tags, label;
+  upb_extreg *registry;
+  const upb_msglayout *view, *payload_layout;
+  int records, view_payload, view_tags, view_label, payload_name,
+      payload_value;
+} ext;
+
+/* Sums the values of one record's extensions, as a stand-in for a reader that
+ * uses them.  Missing values count as zero. */
+static uint64_t SumExtensions(upb_msgval payload, upb_msgval tags,
+                              upb_msgval label) {
+  const upb_msg *p = upb_msgval_getmsg(payload);
+  const upb_array *arr = upb_msgval_getarr(tags);
+  uint64_t sum = upb_msgval_getstr(label).size;
+  size_t i;
+
+  if (p) {
+    sum += upb_msg_get(p, ext.payload_name, ext.payload_layout).str.size;
+    sum += upb_msg_get(p, ext.payload_value, ext.payload_layout).i64;
+  }
+  for (i = 0; arr && i < upb_array_size(arr); i++) {
+    sum += upb_array_get(arr, i).i32;
+  }
+  return sum;
+}
+
+/* Decodes the batch with the registry and sums its records' extensions. */
+static bool SumWithRegistry(Input *in, upb_arena *arena, int options,
+                            uint64_t *sum) {
+  upb_msg *batch = upb_msg_new(in->layout, arena);
+  const upb_array *records;
+  size_t i;
+
+  if (!batch || !upb_decode_ext(upb_stringview_make(in->pb.data(),
+                                                    in->pb.size()),
+                                batch, in->layout, ext.registry, options)) {
+    return false;
+  }
+
+  records = upb_msg_get(batch, ext.records, in->layout).arr;
+  *sum = 0;
+  for (i = 0; records && i < upb_array_size(records); i++) {
+    const upb_msg *record = upb_array_get(records, i).msg;
+    *sum += SumExtensions(upb_msg_getext(record, &ext.payload),
+                          upb_msg_getext(record, &ext.tags),
+                          upb_msg_getext(record, &ext.label));
+  }
+  return true;
+}
+
+/* Parses the unknown fields of |record| as an ExtRecordView and returns its
+ * field |index|, which is how an extension is read without a registry. */
+static bool ReparseExtension(const upb_msg *record, int index,
+                             upb_arena *arena, upb_msgval *val) {
+  upb_msg *view = upb_msg_new(ext.view, arena);
+  const upb_stringview *spans;
+  size_t i, n;
+
+  if (!view) return false;
+  spans = upb_msg_getunknownspans(record, &n);
+  for (i = 0; i < n; i++) {
+    if (!upb_decode(spans[i], view, ext.view)) return false;
+  }
+  *val = upb_msg_get(view, index, ext.view);
+  return true;
+}
+
+/* What reading extensions took before upb_decode_ext(): decode the batch
+ * without them, then parse each record's unknown fields again for every
+ * extension read. */
+static bool SumByReparse(Input *in, upb_arena *arena, uint64_t *sum) {
+  upb_msg *batch = upb_msg_new(in->layout, arena);
+  const upb_array *records;
+  size_t i;
+
+  if (!batch || !upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()),
+                            batch, in->layout)) {
+    return false;
+  }
+
+  records = upb_msg_get(batch, ext.records, in->layout).arr;
+  *sum = 0;
+  for (i = 0; records && i < upb_array_size(records); i++) {
+    const upb_msg *record = upb_array_get(records, i).msg;
+    upb_msgval payload, tags, label;
+
+    if (!ReparseExtension(record, ext.view_payload, arena, &payload) ||
+        !ReparseExtension(record, ext.view_tags, arena, &tags) ||
+        !ReparseExtension(record, ext.view_label, arena, &label)) {
+      return false;
+    }
+    *sum += SumExtensions(payload, tags, label);
+  }
+  return true;
+}
+
+static bool RunExtDecode(Input *in, upb::Environment *env) {
+  volatile uint64_t sum;
+  uint64_t s;
+  bool ok = SumWithRegistry(in, env->arena(), 0, &s);
+  sum = s;
+  UPB_UNUSED(sum);
+  return ok;
+}
+
+static bool RunExtReparse(Input *in, upb::Environment *env) {
+  volatile uint64_t sum;
+  uint64_t s;
+  bool ok = SumByReparse(in, env->arena(), &s);
+  sum = s;
+  UPB_UNUSED(sum);
+  return ok;
+}
+
+/* These run only on the generated benchmarks.ExtBatch. */
+static const Benchmark kExtBenchmarks[] = {
+  {"ext_decode", &RunExtDecode, PB_INPUT},
+  {"ext_reparse", &RunExtReparse, PB_INPUT},
+};
+
+/* These run only on the generated benchmarks.EventBatch. */
+static const Benchmark kAnyBenchmarks[] = {
+  {"any_json_decode", &RunJsonDecode, JSON_INPUT},
+  {"any_json_encode", &RunJsonEncodeAny, PB_INPUT},
+};
+
+/* Whether |b| can run on an input with maps (see Input.maps). */
+static bool HandlesMaps(const Benchmark *b) {
+  return b->run == &RunDecode || b->run == &RunDecodeUtf8 ||
+         b->run == &RunDecodeStats || b->run == &RunEncode ||
+         b->run == &RunEncodeDeterministic || b->run == &RunMsgEqual ||
+         b->run == &RunMsgEqualEncoded || b->run == &RunMsgHash;
+}
+
+/* Setup **********************************************************************/
+
+static bool SetupInput(Input *in, const upb::SymbolTable *symtab,
+                       upb_msgfactory *factory, upb::Arena *arena,
+                       upb::pb::CodeCache *interp, upb::pb::CodeCache *jit) {
+  upb::Status status;
+
+  if (in->generate) {
+    in->generate(&in->pb);
+  } else if (!ReadFile(in->filename, &in->pb)) {
+    fprintf(stderr, "Couldn't read %s\n", in->filename);
+    return false;
+  }
+
+  in->md = symtab->LookupMessage(in->msgname);
+  if (!in->md) {
+    fprintf(stderr, "Message %s not in descriptor\n", in->msgname);
+    return false;
+  }
+
+  in->factory = factory;
+  in->layout = upb_msgfactory_getlayout(factory, in->md);
+  in->msg = upb_msg_new(in->layout, arena);
+  if (!in->msg ||
+      !upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()), in->msg,
+                  in->layout)) {
+    fprintf(stderr, "upb_decode() failed on %s\n", in->name);
+    return false;
+  }
+
+  in->copy = upb_msg_new(in->layout, arena);
+  if (!in->copy ||
+      !upb_decode2(upb_stringview_make(in->pb.data(), in->pb.size()), in->copy,
+                   in->layout, UPB_DECODE_COPYSTRINGS)) {
+    fprintf(stderr, "upb_decode2() failed on %s\n", in->name);
+    return false;
+  }
+
+  /* Check that UPB_DECODE_CHECKREQUIRED accepts the input, which has all of
+   * its required fields, and that it names the first one the top-level
+   * message lacks once that field is cleared. */
+  {
+    upb::Environment env;
+    upb_stringview pb = upb_stringview_make(in->pb.data(), in->pb.size());
+    upb_msg *msg = upb_msg_new(in->layout, env.arena());
+    upb_msg *missing = upb_msg_new(in->layout, env.arena());
+    int i;
+
+    if (!msg || !missing ||
+        !upb_decode_withstatus(pb, msg, in->layout, UPB_DECODE_CHECKREQUIRED,
+                               &status)) {
+      fprintf(stderr, "UPB_DECODE_CHECKREQUIRED failed on %s: %s\n",
+              in->name, status.error_message());
+      return false;
+    }
+
+    for (i = 0; i < in->layout->field_count; i++) {
+      if (in->layout->fields[i].label == UPB_LABEL_REQUIRED) break;
+    }
+
+    if (i < in->layout->field_count) {
+      char expected[64];
+      size_t size;
+
+      upb_msg_clearfield(msg, i, in->layout);
+      pb.data = upb_encode(msg, in->layout, env.arena(), &size);
+      pb.size = size;
+      snprintf(expected, sizeof(expected), "Missing required field %u",
+               (unsigned)in->layout->fields[i].number);
+      if (!pb.data || !upb_decode2(pb, missing, in->layout, 0) ||
+          upb_decode_withstatus(pb, missing, in->layout,
+                                UPB_DECODE_CHECKREQUIRED, &status) ||
+          strcmp(status.error_message(), expected) != 0) {
+        fprintf(stderr, "UPB_DECODE_CHECKREQUIRED missed a field on %s\n",
+                in->name);
+        return false;
+      }
+    }
+  }
+
+  /* Check that upb_msg_equal() and upb_msg_hash() agree that the same input
+   * decoded different ways gives the same message, and a cleared one
+   * doesn't. */
+  {
+    upb::Environment env;
+    upb_msg *lazy = upb_msg_new(in->layout, env.arena());
+    upb_msg *cleared = upb_msg_new(in->layout, env.arena());
+    uint64_t hash = upb_msg_hash(in->msg, in->layout, 0);
+
+    if (!lazy || !upb_decode2(upb_stringview_make(in->pb.data(),
+                                                  in->pb.size()),
+                              lazy, in->layout, UPB_DECODE_LAZY)) {
+      fprintf(stderr, "upb_decode2() failed on %s\n", in->name);
+      return false;
+    }
+
+    if (!upb_msg_equal(in->msg, in->copy, in->layout) ||
+        upb_msg_hash(in->copy, in->layout, 0) != hash ||
+        upb_msg_hash(lazy, in->layout, 0) != hash ||
+        !upb_msg_equal(lazy, in->msg, in->layout) ||
+        !upb_msg_equal(upb_msg_deepcopy(in->msg, in->layout, env.arena()),
+                       in->msg, in->layout) ||
+        !cleared ||
+        upb_msg_equal(cleared, in->msg, in->layout) != in->pb.empty()) {
+      fprintf(stderr, "upb_msg_equal() or upb_msg_hash() wrong on %s\n",
+              in->name);
+      return false;
+    }
+  }
+
+  /* Check that UPB_ENCODE_DETERMINISTIC writes the same bytes for a message
+   * whose maps were filled in a different order (sorted, the second time),
+   * and that those bytes mean the same message. */
+  {
+    upb::Environment env;
+    upb_msg *msg = upb_msg_new(in->layout, env.arena());
+    size_t size, expected_size;
+    char *pb, *expected;
+
+    expected = upb_encode2(in->msg, in->layout, env.arena(), &expected_size,
+                           UPB_ENCODE_DETERMINISTIC);
+    if (!msg || !expected ||
+        !upb_decode(upb_stringview_make(expected, expected_size), msg,
+                    in->layout) ||
+        !upb_msg_equal(msg, in->msg, in->layout)) {
+      fprintf(stderr, "UPB_ENCODE_DETERMINISTIC output differs on %s\n",
+              in->name);
+      return false;
+    }
+
+    pb = upb_encode2(msg, in->layout, env.arena(), &size,
+                     UPB_ENCODE_DETERMINISTIC);
+    if (!pb || size != expected_size || memcmp(pb, expected, size) != 0) {
+      fprintf(stderr, "UPB_ENCODE_DETERMINISTIC isn't on %s\n", in->name);
+      return false;
+    }
+  }
+
+  /* Nothing below supports maps yet. */
+  if (in->maps) return true;
+
+  in->encoder_handlers = upb::pb::Encoder::NewHandlers(in->md);
+  in->json_handlers = upb::json::Printer::NewHandlers(in->md, false);
+  in->text_handlers = upb::pb::TextPrinter::NewHandlers(in->md);
+  in->json_method = upb::json::ParserMethod::New(in->md);
+
+  in->encoder_method = interp->GetDecoderMethod(
+      upb::pb::DecoderMethodOptions(in->encoder_handlers.get()));
+  in->encoder_jit_method = jit->GetDecoderMethod(
+      upb::pb::DecoderMethodOptions(in->encoder_handlers.get()));
+  {
+    upb::pb::DecoderMethodOptions opts(in->encoder_handlers.get());
+    opts.set_validate_utf8(true);
+    in->encoder_utf8_method = interp->GetDecoderMethod(opts);
+  }
+  in->json_decoder_method = interp->GetDecoderMethod(
+      upb::pb::DecoderMethodOptions(in->json_handlers.get()));
+  in->text_decoder_method = interp->GetDecoderMethod(
+      upb::pb::DecoderMethodOptions(in->text_handlers.get()));
+
+  /* The JSON parser benchmark parses what the printer produces. */
+  {
+    upb::Environment env;
+    upb::StringSink json_sink(&in->json);
+    upb::json::Printer *printer = upb::json::Printer::Create(
+        &env, in->json_handlers.get(), json_sink.input());
+    upb::pb::Decoder *decoder = upb::pb::Decoder::Create(
+        &env, in->json_decoder_method, printer->input());
+    if (!upb::BufferSource::PutBuffer(in->pb, decoder->input())) {
+      fprintf(stderr, "Couldn't convert %s to JSON\n", in->name);
+      return false;
+    }
+  }
+
+  /* Check that upb_json_decode() gets the same message back. */
+  {
+    upb::Environment env;
+    upb_msg *msg = upb_msg_new(in->layout, env.arena());
+    size_t size, expected_size;
+    char *pb, *expected;
+
+    if (!msg || !upb_json_decode(upb_stringview_make(in->json.data(),
+                                                     in->json.size()),
+                                 msg, in->md, factory, 0, &status)) {
+      fprintf(stderr, "upb_json_decode() failed on %s: %s\n", in->name,
+              status.error_message());
+      return false;
+    }
+
+    pb = upb_encode(msg, in->layout, env.arena(), &size);
+    expected = upb_encode(in->msg, in->layout, env.arena(), &expected_size);
+    if (!pb || !expected || size != expected_size ||
+        memcmp(pb, expected, size) != 0) {
+      fprintf(stderr, "upb_json_decode() result differs on %s\n", in->name);
+      return false;
+    }
+  }
+
+  /* Check that upb_json_encode() output parses back to the same message.  The
+   * field order may differ from the printer's, so we can't compare the JSON
+   * directly. */
+  {
+    upb::Environment env;
+    upb_msg *msg = upb_msg_new(in->layout, env.arena());
+    size_t json_size, size, expected_size;
+    char *json, *pb, *expected;
+
+    json = upb_json_encode(in->msg, in->layout, in->md, env.arena(), 0,
+                           &json_size);
+    if (!json) {
+      fprintf(stderr, "upb_json_encode() failed on %s\n", in->name);
+      return false;
+    }
+
+    if (!msg || !upb_json_decode(upb_stringview_make(json, json_size), msg,
+                                 in->md, factory, 0, &status)) {
+      fprintf(stderr, "upb_json_decode() of upb_json_encode() failed on %s: "
+              "%s\n", in->name, status.error_message());
+      return false;
+    }
+
+    pb = upb_encode(msg, in->layout, env.arena(), &size);
+    expected = upb_encode(in->msg, in->layout, env.arena(), &expected_size);
+    if (!pb || !expected || size != expected_size ||
+        memcmp(pb, expected, size) != 0) {
+      fprintf(stderr, "upb_json_encode() result differs on %s\n", in->name);
+      return false;
+    }
+  }
+
+  /* Check that the transcoder prints what the printer does, and that its
+   * output converts back to the same message.  Input with every field twice
+   * must be re-encoded first, which upb_json_encode() also sees merged. */
+  in->transcoder = upb_json_transcoder_new(in->md, factory, 0, arena);
+  if (!in->transcoder) {
+    fprintf(stderr, "upb_json_transcoder_new() failed on %s\n", in->name);
+    return false;
+  }
+
+  {
+    upb::Environment env;
+    upb_msg *msg = upb_msg_new(in->layout, env.arena());
+    std::string twice = in->pb + in->pb;
+    size_t json_size, size, expected_size;
+    char *json, *pb, *expected;
+
+    json = upb_json_transcoder_tojson(
+        in->transcoder, upb_stringview_make(in->pb.data(), in->pb.size()),
+        env.arena(), &json_size, &status);
+    if (!json || json_size != in->json.size() ||
+        memcmp(json, in->json.data(), json_size) != 0) {
+      fprintf(stderr, "upb_json_transcoder_tojson() result differs on %s: "
+              "%s\n", in->name, status.error_message());
+      return false;
+    }
+
+    pb = upb_json_transcoder_topb(
+        in->transcoder, upb_stringview_make(json, json_size), env.arena(), 0,
+        &size, &status);
+    expected = upb_encode(in->msg, in->layout, env.arena(), &expected_size);
+    if (!pb || !expected || size != expected_size ||
+        memcmp(pb, expected, size) != 0) {
+      fprintf(stderr, "upb_json_transcoder_topb() result differs on %s: "
+              "%s\n", in->name, status.error_message());
+      return false;
+    }
+
+    if (!msg || !upb_decode(upb_stringview_make(twice.data(), twice.size()),
+                            msg, in->layout)) {
+      fprintf(stderr, "upb_decode() of doubled input failed on %s\n",
+              in->name);
+      return false;
+    }
+    json = upb_json_transcoder_tojson(
+        in->transcoder, upb_stringview_make(twice.data(), twice.size()),
+        env.arena(), &json_size, &status);
+    expected = upb_json_encode(msg, in->layout, in->md, env.arena(), 0,
+                               &expected_size);
+    if (!json || !expected || json_size != expected_size ||
+        memcmp(json, expected, json_size) != 0) {
+      fprintf(stderr, "upb_json_transcoder_tojson() of doubled input differs "
+              "on %s: %s\n", in->name, status.error_message());
+      return false;
+    }
+  }
+
+  /* Check that the counts upb_decode_withstats() and the arena keep add up,
+   * and that instrumenting doesn't change the result. */
+  {
+    upb_arenastats astats;
+    upb_decodestats dstats;
+    size_t size, expected_size;
+    char *pb, *expected;
+
+    memset(&astats, 0, sizeof(astats));
+    memset(&dstats, 0, sizeof(dstats));
+
+    {
+      upb::Environment env;
+      upb_msg *msg;
+      size_t before;
+      bool ok;
+
+      env.arena()->SetStats(&astats);
+      msg = upb_msg_new(in->layout, env.arena());
+      before = upb_arena_bytesallocated(env.arena());
+      ok = msg && upb_decode_withstats(
+                      upb_stringview_make(in->pb.data(), in->pb.size()), msg,
+                      in->layout, NULL, 0, &dstats);
+
+      pb = ok ? upb_encode(msg, in->layout, arena, &size) : NULL;
+      expected = upb_encode(in->msg, in->layout, arena, &expected_size);
+      if (!pb || !expected || size != expected_size ||
+          memcmp(pb, expected, size) != 0) {
+        fprintf(stderr, "upb_decode_withstats() result differs on %s\n",
+                in->name);
+        return false;
+      }
+
+      if (dstats.msgs != 1 || dstats.errors != 0 ||
+          dstats.bytes != in->pb.size() ||
+          dstats.arena_bytes !=
+              upb_arena_bytesallocated(env.arena()) - before ||
+          astats.bytes_requested + astats.bytes_wasted <
+              upb_arena_bytesallocated(env.arena()) ||
+          astats.peak_bytes_allocated !=
+              upb_arena_bytesallocated(env.arena()) ||
+          astats.block_bytes == 0 || astats.blocks == 0) {
+        fprintf(stderr, "Decode stats don't add up on %s\n", in->name);
+        return false;
+      }
+    }
+
+    /* Once the arena is gone, it holds no blocks. */
+    if (astats.block_bytes != 0 ||
+        astats.peak_block_bytes < astats.peak_bytes_allocated) {
+      fprintf(stderr, "Arena stats don't add up on %s\n", in->name);
+      return false;
+    }
+  }
+
+  /* The delimited stream is written by upb_delimwriter, so check that it is
+   * what it should be: upb_encode()'s output, with prefixes. */
+  {
+    upb::Environment env;
+    upb::StringSink sink(&in->delimited);
+    upb_delimwriter *w = upb_delimwriter_create(&env, sink.input());
+    size_t size;
+    char *pb = upb_encode(in->msg, in->layout, env.arena(), &size);
+    std::string expected;
+    int i;
+
+    for (i = 0; i < kDelimitedCount; i++) {
+      if (!pb || !upb_delimwriter_put(w, in->msg, in->layout)) break;
+      PutVarint(size, &expected);
+      expected.append(pb, size);
+    }
+
+    if (!upb_delimwriter_end(w) || in->delimited != expected) {
+      fprintf(stderr, "upb_delimwriter output differs on %s\n", in->name);
+      return false;
+    }
+  }
+
+  /* Check that upb_decodestream gets the same message however the input is
+   * split up, and whether or not it knows the size.  Messages that span
+   * buffers must still be found to have their required fields. */
+  {
+    static const size_t chunks[] = {1, 3, 64, kStreamChunk};
+    upb::Environment env;
+    size_t expected_size;
+    char *expected = upb_encode(in->msg, in->layout, env.arena(),
+                                &expected_size);
+    size_t i;
+
+    for (i = 0; i < ARRAYSIZE(chunks) * 2; i++) {
+      upb_msg *msg = upb_msg_new(in->layout, env.arena());
+      size_t size;
+      char *pb;
+
+      if (!msg || !DecodeStream(in, msg, chunks[i / 2], i % 2 == 0,
+                                UPB_DECODE_CHECKREQUIRED)) {
+        fprintf(stderr, "upb_decodestream failed on %s\n", in->name);
+        return false;
+      }
+
+      pb = upb_encode(msg, in->layout, env.arena(), &size);
+      if (!pb || !expected || size != expected_size ||
+          memcmp(pb, expected, size) != 0) {
+        fprintf(stderr, "upb_decodestream result differs on %s\n", in->name);
+        return false;
+      }
+    }
+
+    /* Losing the last byte cuts off the last field. */
+    {
+      upb_msg *msg = upb_msg_new(in->layout, env.arena());
+      upb_decodestream *s = upb_decodestream_new(msg, in->layout, NULL, 0,
+                                                 UPB_DECODE_UNKNOWNSIZE);
+      if (upb_decodestream_put(s, in->pb.data(), in->pb.size() - 1, NULL) !=
+              UPB_DECODE_NEEDMORE ||
+          upb_decodestream_end(s) != UPB_DECODE_ERROR) {
+        fprintf(stderr, "upb_decodestream accepted truncated %s\n", in->name);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/* Sets *index to the index of field |name| of |md|. */
+static bool FindField(const upb_msgdef *md, const char *name, int *index) {
+  const upb_fielddef *f = md ? upb_msgdef_ntofz(md, name) : NULL;
+  if (!f) {
+    fprintf(stderr, "Field %s not in descriptor\n", name);
+    return false;
+  }
+  *index = upb_fielddef_index(f);
+  return true;
+}
+
+/* Sets up |in| and |ext| for the extension benchmarks.  Must run before
+ * anything creates the layout of benchmarks.ExtRecord. */
+static bool SetupExtensions(Input *in, const upb::SymbolTable *symtab,
+                            upb_msgfactory *factory, upb::Arena *arena) {
+  const upb_msgdef *record = symtab->LookupMessage("benchmarks.ExtRecord");
+  const upb_msgdef *view = symtab->LookupMessage("benchmarks.ExtRecordView");
+  const upb_msgdef *payload = symtab->LookupMessage("benchmarks.ExtPayload");
+  const upb_msglayout_ext *exts[3];
+  const upb_msglayout *record_layout;
+
+  in->generate(&in->pb);
+  in->md = symtab->LookupMessage(in->msgname);
+  if (!in->md || !record || !view || !payload) {
+    fprintf(stderr, "Extension messages not in descriptor\n");
+    return false;
+  }
+
+  if (!upb_msgfactory_setextendable(factory, record)) {
+    fprintf(stderr, "upb_msgfactory_setextendable() failed\n");
+    return false;
+  }
+
+  in->factory = factory;
+  in->layout = upb_msgfactory_getlayout(factory, in->md);
+  record_layout = upb_msgfactory_getlayout(factory, record);
+  ext.view = upb_msgfactory_getlayout(factory, view);
+  ext.payload_layout = upb_msgfactory_getlayout(factory, payload);
+  if (!FindField(in->md, "records", &ext.records) ||
+      !FindField(view, "payload", &ext.view_payload) ||
+      !FindField(view, "tags", &ext.view_tags) ||
+      !FindField(view, "label", &ext.view_label) ||
+      !FindField(payload, "name", &ext.payload_name) ||
+      !FindField(payload, "value", &ext.payload_value)) {
+    return false;
+  }
+
+  memset(&ext.payload, 0, sizeof(ext.payload));
+  ext.payload.extendee = record_layout;
+  ext.payload.field.number = 100;
+  ext.payload.field.descriptortype = UPB_DESCRIPTOR_TYPE_MESSAGE;
+  ext.payload.field.label = UPB_LABEL_OPTIONAL;
+  ext.payload.submsg = ext.payload_layout;
+  ext.tags = ext.payload;
+  ext.tags.field.number = 101;
+  ext.tags.field.descriptortype = UPB_DESCRIPTOR_TYPE_INT32;
+  ext.tags.field.label = UPB_LABEL_REPEATED;
+  ext.tags.submsg = NULL;
+  ext.label = ext.tags;
+  ext.label.field.number = 102;
+  ext.label.field.descriptortype = UPB_DESCRIPTOR_TYPE_STRING;
+  ext.label.field.label = UPB_LABEL_OPTIONAL;
+
+  exts[0] = &ext.payload;
+  exts[1] = &ext.tags;
+  exts[2] = &ext.label;
+  ext.registry = upb_extreg_new(arena);
+  if (!ext.registry || !upb_extreg_add(ext.registry, exts, 3) ||
+      upb_extreg_add(ext.registry, exts, 1)) {
+    fprintf(stderr, "upb_extreg_add() failed\n");
+    return false;
+  }
+
+  in->msg = upb_msg_new(in->layout, arena);
+  in->copy = upb_msg_new(in->layout, arena);
+  if (!in->msg || !in->copy ||
+      !upb_decode_ext(upb_stringview_make(in->pb.data(), in->pb.size()),
+                      in->msg, in->layout, ext.registry, 0) ||
+      !upb_decode_ext(upb_stringview_make(in->pb.data(), in->pb.size()),
+                      in->copy, in->layout, ext.registry,
+                      UPB_DECODE_COPYSTRINGS)) {
+    fprintf(stderr, "upb_decode_ext() failed on %s\n", in->name);
+    return false;
+  }
+
+  /* Check that the extensions were all found, and say the same as the
+   * fields of an ExtRecordView, whether or not they were parsed lazily. */
+  {
+    upb::Environment env;
+    const upb_array *records = upb_msg_get(in->msg, ext.records,
+                                           in->layout).arr;
+    uint64_t sum, reparsed_sum, lazy_sum;
+    size_t i, labels = 0;
+
+    for (i = 0; records && i < upb_array_size(records); i++) {
+      const upb_msg *r = upb_array_get(records, i).msg;
+      if (!upb_msg_hasext(r, &ext.payload) || !upb_msg_hasext(r, &ext.tags) ||
+          upb_msg_unknownsize(r) != 0) {
+        break;
+      }
+      if (upb_msg_hasext(r, &ext.label)) labels++;
+    }
+
+    if (!records || i != upb_array_size(records) || labels == 0 ||
+        labels == i ||
+        !SumWithRegistry(in, env.arena(), 0, &sum) ||
+        !SumWithRegistry(in, env.arena(), UPB_DECODE_LAZY, &lazy_sum) ||
+        !SumByReparse(in, env.arena(), &reparsed_sum) ||
+        sum != reparsed_sum || sum != lazy_sum) {
+      fprintf(stderr, "Extensions missing or wrong on %s\n", in->name);
+      return false;
+    }
+  }
+
+  /* Check that upb_decode() allocated the first records together, in order,
+   * rather than each next to the previous one's extensions. */
+  {
+    const upb_array *records = upb_msg_get(in->msg, ext.records,
+                                           in->layout).arr;
+    const char *first = (const char*)upb_array_get(records, 0).msg;
+    const char *second = (const char*)upb_array_get(records, 1).msg;
+    size_t i;
+
+    for (i = 2; second > first && i < 8; i++) {
+      const char *r = (const char*)upb_array_get(records, i).msg;
+      if (r != first + i * (second - first)) break;
+    }
+
+    if (second <= first || i != 8) {
+      fprintf(stderr, "Records not allocated together on %s\n", in->name);
+      return false;
+    }
+  }
+
+  /* Check that extensions survive encoding, copying, comparing and hashing,
+   * and that without the registry they stay unknown fields. */
+  {
+    upb::Environment env;
+    upb_msg *plain = upb_msg_new(in->layout, env.arena());
+    upb_msg *reparsed = upb_msg_new(in->layout, env.arena());
+    upb_msg *copy = upb_msg_deepcopy(in->msg, in->layout, env.arena());
+    size_t size;
+    char *pb = upb_encode2(in->msg, in->layout, env.arena(), &size,
+                           UPB_ENCODE_DETERMINISTIC);
+    upb_msg *record;
+
+    if (!pb || size != in->pb.size() ||
+        memcmp(pb, in->pb.data(), size) != 0 || !reparsed ||
+        !upb_decode_ext(upb_stringview_make(pb, size), reparsed, in->layout,
+                        ext.registry, 0) ||
+        !upb_msg_equal(reparsed, in->msg, in->layout) ||
+        !upb_msg_equal(in->copy, in->msg, in->layout) ||
+        upb_msg_hash(in->copy, in->layout, 0) !=
+            upb_msg_hash(in->msg, in->layout, 0) ||
+        !copy || !upb_msg_equal(copy, in->msg, in->layout) || !plain ||
+        !upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()), plain,
+                    in->layout) ||
+        upb_msg_equal(plain, in->msg, in->layout)) {
+      fprintf(stderr, "Extensions not kept on %s\n", in->name);
+      return false;
+    }
+
+    record = (upb_msg*)upb_array_get(
+        upb_msg_get(copy, ext.records, in->layout).arr, 0).msg;
+    upb_msg_clearext(record, &ext.tags);
+    if (upb_msg_hasext(record, &ext.tags) ||
+        upb_msg_equal(copy, in->msg, in->layout) ||
+        !(pb = upb_encode(copy, in->layout, env.arena(), &size)) ||
+        size >= in->pb.size()) {
+      fprintf(stderr, "upb_msg_clearext() failed on %s\n", in->name);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Decodes |json| as a |in->md| and returns it printed by upb_json_encode2(),
+ * or "" on failure. */
+static std::string ReprintJson(Input *in, const char *json) {
+  upb::Environment env;
+  upb_msg *msg = upb_msg_new(in->layout, env.arena());
+  size_t size;
+  char *out;
+
+  if (!msg || !upb_json_decode(upb_stringview_make(json, strlen(json)), msg,
+                               in->md, in->factory, 0, NULL)) {
+    return "";
+  }
+  out = upb_json_encode2(msg, in->layout, in->md, in->factory, env.arena(), 0,
+                         &size);
+  return out ? std::string(out, size) : "";
+}
+
+/* Sets up |in| for the Any benchmarks. */
+static bool SetupAny(Input *in, const upb::SymbolTable *symtab,
+                     upb_msgfactory *factory, upb::Arena *arena) {
+  static const char kClickUrl[] = "type.googleapis.com/benchmarks.ClickEvent";
+  const upb_msglayout *click_layout, *l;
+  const upb_msgdef *click;
+  upb::Status status;
+  char *json;
+  size_t size;
+
+  in->generate(&in->pb);
+  in->md = symtab->LookupMessage(in->msgname);
+  click = symtab->LookupMessage("benchmarks.ClickEvent");
+  if (!in->md || !click) {
+    fprintf(stderr, "Event messages not in descriptor\n");
+    return false;
+  }
+
+  in->factory = factory;
+  in->layout = upb_msgfactory_getlayout(factory, in->md);
+  click_layout = upb_msgfactory_getlayout(factory, click);
+  in->msg = upb_msg_new(in->layout, arena);
+  if (!in->msg ||
+      !upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()), in->msg,
+                  in->layout)) {
+    fprintf(stderr, "upb_decode() failed on %s\n", in->name);
+    return false;
+  }
+
+  /* Check that type URLs resolve, from the cache the second time. */
+  if (upb_msgfactory_getanytype(factory, kClickUrl, strlen(kClickUrl), &l) !=
+          click || l != click_layout ||
+      upb_msgfactory_getanytype(factory, kClickUrl, strlen(kClickUrl), &l) !=
+          click || l != click_layout ||
+      upb_msgfactory_getanytype(factory, "benchmarks.ClickEvent", 21, &l) !=
+          click ||
+      upb_msgfactory_getanytype(factory, kClickUrl, strlen(kClickUrl) - 1,
+                                &l)) {
+    fprintf(stderr, "upb_msgfactory_getanytype() failed\n");
+    return false;
+  }
+
+  /* Only upb_json_encode2() can print an Any. */
+  if (upb_json_encode(in->msg, in->layout, in->md, arena, 0, &size) ||
+      !(json = upb_json_encode2(in->msg, in->layout, in->md, factory, arena, 0,
+                                &size))) {
+    fprintf(stderr, "upb_json_encode2() failed on %s\n", in->name);
+    return false;
+  }
+  in->json.assign(json, size);
+
+  /* Check that upb_json_decode() gets the same message back. */
+  {
+    upb::Environment env;
+    upb_msg *msg = upb_msg_new(in->layout, env.arena());
+    size_t expected_size;
+    char *pb, *expected;
+
+    if (!msg || !upb_json_decode(upb_stringview_make(in->json.data(),
+                                                     in->json.size()),
+                                 msg, in->md, factory, 0, &status)) {
+      fprintf(stderr, "upb_json_decode() failed on %s: %s\n", in->name,
+              status.error_message());
+      return false;
+    }
+
+    pb = upb_encode(msg, in->layout, env.arena(), &size);
+    expected = upb_encode(in->msg, in->layout, env.arena(), &expected_size);
+    if (!pb || !expected || size != expected_size ||
+        memcmp(pb, expected, size) != 0) {
+      fprintf(stderr, "upb_json_decode() result differs on %s\n", in->name);
+      return false;
+    }
+  }
+
+  /* "@type" may come anywhere in the object, an empty Any has none, and
+   * otherwise it must name a known, plain message. */
+  if (ReprintJson(in, "{\"events\":[{\"payload\":{\"x\":3,\"@type\":"
+                      "\"type.googleapis.com/benchmarks.ClickEvent\"}}]}") !=
+          "{\"events\":[{\"payload\":{\"@type\":"
+          "\"type.googleapis.com/benchmarks.ClickEvent\",\"x\":3}}]}" ||
+      ReprintJson(in, "{\"events\":[{\"payload\":{}}]}") !=
+          "{\"events\":[{\"payload\":{}}]}" ||
+      ReprintJson(in, "{\"events\":[{\"payload\":{\"x\":3}}]}") != "" ||
+      ReprintJson(in, "{\"events\":[{\"payload\":{\"@type\":"
+                      "\"type.googleapis.com/benchmarks.Nope\"}}]}") != "" ||
+      ReprintJson(in, "{\"events\":[{\"payload\":{\"@type\":"
+                      "\"type.googleapis.com/google.protobuf.Any\"}}]}") !=
+          "") {
+    fprintf(stderr, "Any JSON mapping wrong on %s\n", in->name);
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  Input inputs[4];
+  Input extensions;
+  Input events;
+  std::string descriptor;
+  std::vector<upb::reffed_ptr<upb::FileDef> > files;
+  upb::Status status;
+  upb::SymbolTable *symtab;
+  upb_msgfactory *factory;
+  const char *filter = argc > 2 ? argv[2] : NULL;
+  int ret = 0;
+  size_t i, j;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: benchmark <benchmark.proto.pb> [filter]\n");
+    return 1;
+  }
+
+  counting.func = &CountingAlloc;
+
+  if (!ReadFile(argv[1], &descriptor) ||
+      !upb::LoadDescriptor(descriptor, &status, &files)) {
+    fprintf(stderr, "Couldn't load descriptor %s: %s\n", argv[1],
+            status.error_message());
+    return 1;
+  }
+
+  symtab = upb::SymbolTable::New();
+  for (i = 0; i < files.size(); i++) {
+    if (!symtab->AddFile(files[i].get(), &status)) {
+      fprintf(stderr, "Couldn't add file: %s\n", status.error_message());
+      return 1;
+    }
+  }
+
+  factory = upb_msgfactory_new(symtab);
+
+  {
+    upb::Arena arena;
+    upb::pb::CodeCache interp;
+    upb::pb::CodeCache jit;
+    interp.set_allow_jit(false);
+
+    inputs[0].name = "google_message1";
+    inputs[0].msgname = "benchmarks.SpeedMessage1";
+    inputs[0].filename = "tests/google_message1.dat";
+    inputs[0].maps = false;
+    inputs[0].generate = NULL;
+    inputs[1].name = "google_message2";
+    inputs[1].msgname = "benchmarks.SpeedMessage2";
+    inputs[1].filename = "tests/google_message2.dat";
+    inputs[1].maps = false;
+    inputs[1].generate = NULL;
+    inputs[2].name = "numeric";
+    inputs[2].msgname = "benchmarks.NumericMessage";
+    inputs[2].filename = NULL;
+    inputs[2].maps = false;
+    inputs[2].generate = &GenerateNumeric;
+    inputs[3].name = "maps";
+    inputs[3].msgname = "benchmarks.MapMessage";
+    inputs[3].filename = NULL;
+    inputs[3].generate = &GenerateMaps;
+    inputs[3].maps = true;
+    extensions.name = "extensions";
+    extensions.msgname = "benchmarks.ExtBatch";
+    extensions.filename = NULL;
+    extensions.generate = &GenerateExtensions;
+    extensions.maps = false;
+    events.name = "events";
+    events.msgname = "benchmarks.EventBatch";
+    events.filename = NULL;
+    events.generate = &GenerateEvents;
+    events.maps = false;
+
+    if (!SetupExtensions(&extensions, symtab, factory, &arena)) return 1;
+    if (!SetupAny(&events, symtab, factory, &arena)) return 1;
+    for (j = 0; j < ARRAYSIZE(inputs); j++) {
+      if (!SetupInput(&inputs[j], symtab, factory, &arena, &interp, &jit)) {
+        return 1;
+      }
+    }
+
+    for (i = 0; i < ARRAYSIZE(kBenchmarks); i++) {
+      const Benchmark *b = &kBenchmarks[i];
+
+      if (filter && !strstr(b->name, filter)) continue;
+
+      if (b->run == &RunPbDecoderJit &&
+          !inputs[0].encoder_jit_method->is_native()) {
+        printf("%-16s skipped (built without the JIT)\n", b->name);
+        continue;
+      }
+
+      for (j = 0; j < ARRAYSIZE(inputs); j++) {
+        if (b->run == &RunDecodeFile && !inputs[j].filename) continue;
+        if (inputs[j].maps && !HandlesMaps(b)) continue;
+        if (!RunBenchmark(b, &inputs[j], false) ||
+            !RunBenchmark(b, &inputs[j], true)) {
+          ret = 1;
+        }
+      }
+    }
+
+    for (i = 0; i < ARRAYSIZE(kExtBenchmarks); i++) {
+      const Benchmark *b = &kExtBenchmarks[i];
+
+      if (filter && !strstr(b->name, filter)) continue;
+      if (!RunBenchmark(b, &extensions, false) ||
+          !RunBenchmark(b, &extensions, true)) {
+        ret = 1;
+      }
+    }
+
+    for (i = 0; i < ARRAYSIZE(kAnyBenchmarks); i++) {
+      const Benchmark *b = &kAnyBenchmarks[i];
+
+      if (filter && !strstr(b->name, filter)) continue;
+      if (!RunBenchmark(b, &events, false) ||
+          !RunBenchmark(b, &events, true)) {
+        ret = 1;
+      }
+    }
+  }
+
+  if (!filter || strstr("def_freeze", filter)) {
+    if (!RunFreezeBenchmark()) ret = 1;
+  }
+
+  upb_msgfactory_free(factory);
+  upb::SymbolTable::Free(symtab);
+  return ret;
+}
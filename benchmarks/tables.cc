@@ -0,0 +1,665 @@
+/*
+** Benchmarks for upb_inttable and upb_strtable, compared with
+** std::unordered_map.  Run from the top of the source tree:
+**
+**   benchmarks/tables [filter]
+**
+** or just "make benchmark_tables".  If |filter| is given, only the rows whose
+** table, keys or operation contain it are run.
+**
+** Every table is run over several sets of keys at several sizes:
+**
+**   dense      1..n, which upb_inttable_compact2() moves to the array part
+**   mixed      half dense, half spread out above 64k
+**   sparse     random 32-bit keys
+**   pointers   16-byte aligned addresses in a 64-bit range, as for
+**              upb_inttable_insertptr()
+**   names      dotted identifiers like the full names of message fields
+**   short      random strings of 4 to 8 letters
+**   long       random strings of 64 letters
+**
+** Operations:
+**   insert       build the table from empty, one key at a time, and free it
+**   hit          look up every key, in random order
+**   miss         look up as many keys that aren't in the table
+**   iterate      visit every entry
+**   compact      upb_inttable_compact2() or upb_strtable_compact2()
+**   hit_compact  "hit" on the compacted table
+**   miss_compact "miss" on the compacted table
+**
+** Times are per key, or per entry for "iterate" and "compact".  The memory
+** column is what the table holds allocated per entry once built (the
+** compacted one for the *compact rows), counting the copies of string keys
+** that each table keeps.  std::unordered_map has no compaction, so it has no
+** *compact rows.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "upb/table.int.h"
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof(a[0]))
+
+/* Minimum running time of each row, in seconds.  There are a few hundred
+ * rows, so this is shorter than in benchmarks/benchmark.cc. */
+static const double kMinTime = 0.2;
+
+static const size_t kSizes[] = {16, 256, 4096, 65536};
+
+static const char *filter = NULL;
+
+/* Every operation adds what it looked up here, so that it can't be optimized
+ * out. */
+static volatile uintptr_t sink;
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t Random() {
+  /* xorshift64: deterministic across runs and platforms. */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+template <class T> static void Shuffle(std::vector<T> *v) {
+  size_t i;
+  for (i = v->size(); i > 1; i--) {
+    std::swap((*v)[i - 1], (*v)[Random() % i]);
+  }
+}
+
+/* Measuring memory ***********************************************************/
+
+/* upb_free() doesn't pass the size of what it frees, so we remember the size
+ * of every live block. */
+static std::unordered_map<void*, size_t> live_blocks;
+static size_t live_bytes = 0;
+
+static void *TrackingAlloc(upb_alloc *alloc, void *ptr, size_t oldsize,
+                           size_t size) {
+  void *ret;
+  UPB_UNUSED(alloc);
+  UPB_UNUSED(oldsize);
+
+  if (size == 0) {
+    if (ptr) {
+      live_bytes -= live_blocks[ptr];
+      live_blocks.erase(ptr);
+    }
+    free(ptr);
+    return NULL;
+  }
+
+  ret = realloc(ptr, size);
+  if (!ret) return NULL;
+
+  if (ptr) {
+    live_bytes -= live_blocks[ptr];
+    live_blocks.erase(ptr);
+  }
+  live_blocks[ret] = size;
+  live_bytes += size;
+  return ret;
+}
+
+static upb::Allocator tracking;
+
+/* For std::unordered_map, whose allocator is told the size of what it
+ * frees. */
+static size_t std_live_bytes = 0;
+
+template <class T> struct TrackingAllocator {
+  typedef T value_type;
+
+  TrackingAllocator() {}
+  template <class U> TrackingAllocator(const TrackingAllocator<U>&) {}
+
+  T *allocate(size_t n) {
+    std_live_bytes += n * sizeof(T);
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *p, size_t n) {
+    std_live_bytes -= n * sizeof(T);
+    ::operator delete(p);
+  }
+};
+
+template <class T, class U>
+bool operator==(const TrackingAllocator<T>&, const TrackingAllocator<U>&) {
+  return true;
+}
+
+template <class T, class U>
+bool operator!=(const TrackingAllocator<T>&, const TrackingAllocator<U>&) {
+  return false;
+}
+
+/* Keys ***********************************************************************/
+
+/* Fills |keys| with |n| distinct keys and |misses| with |n| more that are
+ * none of them. */
+typedef void IntKeysFunc(size_t n, std::vector<uintptr_t> *keys,
+                         std::vector<uintptr_t> *misses);
+typedef void StrKeysFunc(size_t n, std::vector<std::string> *keys,
+                         std::vector<std::string> *misses);
+
+static void DenseKeys(size_t n, std::vector<uintptr_t> *keys,
+                      std::vector<uintptr_t> *misses) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    keys->push_back(i + 1);
+    misses->push_back(n + i + 1);
+  }
+}
+
+static void MixedKeys(size_t n, std::vector<uintptr_t> *keys,
+                      std::vector<uintptr_t> *misses) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    if (i < n / 2) {
+      keys->push_back(i + 1);
+    } else {
+      keys->push_back(65536 + i * 7);
+    }
+    misses->push_back(65536 + i * 7 + 3);
+  }
+}
+
+/* Draws |n| keys and |n| misses from |draw|, skipping repeats. */
+template <class T>
+static void RandomKeys(size_t n, T (*draw)(), std::vector<T> *keys,
+                       std::vector<T> *misses) {
+  std::set<T> seen;
+  while (keys->size() < n || misses->size() < n) {
+    T key = draw();
+    if (!seen.insert(key).second) continue;
+    if (keys->size() < n) {
+      keys->push_back(key);
+    } else {
+      misses->push_back(key);
+    }
+  }
+}
+
+static uintptr_t DrawSparse() { return (uint32_t)Random() | 1; }
+
+static uintptr_t DrawPointer() {
+  return (uintptr_t)0x7f0000000000ULL + (Random() % (1 << 24)) * 16;
+}
+
+static void SparseKeys(size_t n, std::vector<uintptr_t> *keys,
+                       std::vector<uintptr_t> *misses) {
+  RandomKeys(n, &DrawSparse, keys, misses);
+}
+
+static void PointerKeys(size_t n, std::vector<uintptr_t> *keys,
+                        std::vector<uintptr_t> *misses) {
+  if (sizeof(uintptr_t) < 8) {
+    SparseKeys(n, keys, misses);
+    return;
+  }
+  RandomKeys(n, &DrawPointer, keys, misses);
+}
+
+static std::string RandomLetters(size_t len) {
+  std::string ret;
+  while (ret.size() < len) ret.push_back('a' + Random() % 26);
+  return ret;
+}
+
+static std::string DrawName() {
+  static const char *const kParts[] = {
+    "google", "protobuf", "benchmarks", "Message", "Options", "field", "value",
+    "name", "id", "payload", "record", "entry", "type", "Descriptor"
+  };
+  char buf[16];
+  std::string ret = kParts[Random() % 3];
+  int parts = 2 + Random() % 3;
+  int i;
+  for (i = 0; i < parts; i++) {
+    ret += '.';
+    ret += kParts[Random() % ARRAYSIZE(kParts)];
+  }
+  sprintf(buf, "_%u", (unsigned)(Random() % 1000));
+  return ret + buf;
+}
+
+static std::string DrawShort() { return RandomLetters(4 + Random() % 5); }
+static std::string DrawLong() { return RandomLetters(64); }
+
+static void NameKeys(size_t n, std::vector<std::string> *keys,
+                     std::vector<std::string> *misses) {
+  RandomKeys(n, &DrawName, keys, misses);
+}
+
+static void ShortKeys(size_t n, std::vector<std::string> *keys,
+                      std::vector<std::string> *misses) {
+  RandomKeys(n, &DrawShort, keys, misses);
+}
+
+static void LongKeys(size_t n, std::vector<std::string> *keys,
+                     std::vector<std::string> *misses) {
+  RandomKeys(n, &DrawLong, keys, misses);
+}
+
+/* Running and reporting ******************************************************/
+
+/* Runs |op| until kMinTime has elapsed and returns nanoseconds per key.  Each
+ * call of |op| does |keys| keys' worth of work. */
+template <class State>
+static double Time(void (*op)(State *s), State *s, size_t keys) {
+  long iters = 0;
+  long batch = 1;
+  double elapsed;
+  clock_t start = clock();
+
+  do {
+    long i;
+    for (i = 0; i < batch; i++) op(s);
+    iters += batch;
+    batch *= 2;
+    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+  } while (elapsed < kMinTime);
+
+  return elapsed * 1e9 / iters / keys;
+}
+
+static bool Selected(const char *table, const char *keys, const char *op) {
+  return !filter || strstr(table, filter) || strstr(keys, filter) ||
+         strstr(op, filter);
+}
+
+static void Report(const char *table, const char *keys, size_t n,
+                   const char *op, double ns, double bytes) {
+  printf("%-14s %-8s %6lu  %-13s %8.1f ns/op %8.1f bytes/entry\n", table,
+         keys, (unsigned long)n, op, ns, bytes);
+}
+
+/* upb_inttable and std::unordered_map<uintptr_t, ...> ************************/
+
+typedef std::unordered_map<
+    uintptr_t, uintptr_t, std::hash<uintptr_t>, std::equal_to<uintptr_t>,
+    TrackingAllocator<std::pair<const uintptr_t, uintptr_t> > > IntMap;
+
+struct IntState {
+  std::vector<uintptr_t> keys;     /* In insertion order. */
+  std::vector<uintptr_t> lookups;  /* |keys| in random order. */
+  std::vector<uintptr_t> misses;
+  upb_inttable table;
+  upb_inttable compacted;          /* Recompacted by each "compact" call. */
+  IntMap map;
+};
+
+static void IntInsert(IntState *s) {
+  upb_inttable t;
+  size_t i;
+  upb_inttable_init(&t, UPB_CTYPE_UINT64);
+  for (i = 0; i < s->keys.size(); i++) {
+    upb_inttable_insert(&t, s->keys[i], upb_value_uint64(i));
+  }
+  sink += upb_inttable_count(&t);
+  upb_inttable_uninit(&t);
+}
+
+static void IntLookups(const upb_inttable *t,
+                       const std::vector<uintptr_t> &keys) {
+  size_t i;
+  uintptr_t sum = 0;
+  for (i = 0; i < keys.size(); i++) {
+    upb_value v;
+    if (upb_inttable_lookup(t, keys[i], &v)) sum += upb_value_getuint64(v);
+  }
+  sink += sum;
+}
+
+static void IntHit(IntState *s) { IntLookups(&s->table, s->lookups); }
+static void IntMiss(IntState *s) { IntLookups(&s->table, s->misses); }
+
+static void IntHitCompact(IntState *s) {
+  IntLookups(&s->compacted, s->lookups);
+}
+
+static void IntMissCompact(IntState *s) {
+  IntLookups(&s->compacted, s->misses);
+}
+
+static void IntIterate(IntState *s) {
+  upb_inttable_iter i;
+  uintptr_t sum = 0;
+  upb_inttable_begin(&i, &s->table);
+  for (; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    sum += upb_value_getuint64(upb_inttable_iter_value(&i));
+  }
+  sink += sum;
+}
+
+static void IntCompact(IntState *s) { upb_inttable_compact(&s->compacted); }
+
+static void MapInsert(IntState *s) {
+  IntMap m;
+  size_t i;
+  for (i = 0; i < s->keys.size(); i++) {
+    m.insert(std::make_pair(s->keys[i], (uintptr_t)i));
+  }
+  sink += m.size();
+}
+
+static void MapLookups(IntState *s, const std::vector<uintptr_t> &keys) {
+  size_t i;
+  uintptr_t sum = 0;
+  for (i = 0; i < keys.size(); i++) {
+    IntMap::const_iterator it = s->map.find(keys[i]);
+    if (it != s->map.end()) sum += it->second;
+  }
+  sink += sum;
+}
+
+static void MapHit(IntState *s) { MapLookups(s, s->lookups); }
+static void MapMiss(IntState *s) { MapLookups(s, s->misses); }
+
+static void MapIterate(IntState *s) {
+  IntMap::const_iterator it;
+  uintptr_t sum = 0;
+  for (it = s->map.begin(); it != s->map.end(); ++it) sum += it->second;
+  sink += sum;
+}
+
+static void RunIntTables(const char *name, IntKeysFunc *generate, size_t n) {
+  static const struct {
+    const char *name;
+    void (*op)(IntState *s);
+    bool compacted;
+  } kUpbOps[] = {
+    {"insert", &IntInsert, false},
+    {"hit", &IntHit, false},
+    {"miss", &IntMiss, false},
+    {"iterate", &IntIterate, false},
+    {"compact", &IntCompact, true},
+    {"hit_compact", &IntHitCompact, true},
+    {"miss_compact", &IntMissCompact, true},
+  }, kMapOps[] = {
+    {"insert", &MapInsert, false},
+    {"hit", &MapHit, false},
+    {"miss", &MapMiss, false},
+    {"iterate", &MapIterate, false},
+  };
+  IntState s;
+  double bytes, compacted_bytes, map_bytes;
+  size_t i;
+
+  generate(n, &s.keys, &s.misses);
+  s.lookups = s.keys;
+  Shuffle(&s.lookups);
+
+  /* Measure memory on copies built with the tracking allocators; the tables
+   * that are timed use the usual ones. */
+  {
+    upb_inttable t;
+    upb_inttable_init2(&t, UPB_CTYPE_UINT64, &tracking);
+    for (i = 0; i < n; i++) {
+      upb_inttable_insert2(&t, s.keys[i], upb_value_uint64(i), &tracking);
+    }
+    bytes = (double)live_bytes / n;
+    upb_inttable_compact2(&t, &tracking);
+    compacted_bytes = (double)live_bytes / n;
+    upb_inttable_uninit2(&t, &tracking);
+  }
+
+  upb_inttable_init(&s.table, UPB_CTYPE_UINT64);
+  for (i = 0; i < n; i++) {
+    upb_inttable_insert(&s.table, s.keys[i], upb_value_uint64(i));
+    s.map.insert(std::make_pair(s.keys[i], (uintptr_t)i));
+  }
+  map_bytes = (double)std_live_bytes / n;
+
+  upb_inttable_init(&s.compacted, UPB_CTYPE_UINT64);
+  for (i = 0; i < n; i++) {
+    upb_inttable_insert(&s.compacted, s.keys[i], upb_value_uint64(i));
+  }
+  upb_inttable_compact(&s.compacted);
+
+  for (i = 0; i < ARRAYSIZE(kUpbOps); i++) {
+    if (!Selected("upb_inttable", name, kUpbOps[i].name)) continue;
+    Report("upb_inttable", name, n, kUpbOps[i].name,
+           Time(kUpbOps[i].op, &s, n),
+           kUpbOps[i].compacted ? compacted_bytes : bytes);
+  }
+
+  for (i = 0; i < ARRAYSIZE(kMapOps); i++) {
+    if (!Selected("unordered_map", name, kMapOps[i].name)) continue;
+    Report("unordered_map", name, n, kMapOps[i].name,
+           Time(kMapOps[i].op, &s, n), map_bytes);
+  }
+
+  upb_inttable_uninit(&s.table);
+  upb_inttable_uninit(&s.compacted);
+}
+
+/* upb_strtable and std::unordered_map<std::string, ...> **********************/
+
+typedef std::unordered_map<
+    std::string, uintptr_t, std::hash<std::string>,
+    std::equal_to<std::string>,
+    TrackingAllocator<std::pair<const std::string, uintptr_t> > > StrMap;
+
+struct StrState {
+  std::vector<std::string> keys;
+  std::vector<std::string> lookups;
+  std::vector<std::string> misses;
+  upb_strtable table;
+  upb_strtable compacted;
+  StrMap map;
+};
+
+static void StrInsert(StrState *s) {
+  upb_strtable t;
+  size_t i;
+  upb_strtable_init(&t, UPB_CTYPE_UINT64);
+  for (i = 0; i < s->keys.size(); i++) {
+    upb_strtable_insert2(&t, s->keys[i].data(), s->keys[i].size(),
+                         upb_value_uint64(i));
+  }
+  sink += upb_strtable_count(&t);
+  upb_strtable_uninit(&t);
+}
+
+static void StrLookups(const upb_strtable *t,
+                       const std::vector<std::string> &keys) {
+  size_t i;
+  uintptr_t sum = 0;
+  for (i = 0; i < keys.size(); i++) {
+    upb_value v;
+    if (upb_strtable_lookup2(t, keys[i].data(), keys[i].size(), &v)) {
+      sum += upb_value_getuint64(v);
+    }
+  }
+  sink += sum;
+}
+
+static void StrHit(StrState *s) { StrLookups(&s->table, s->lookups); }
+static void StrMiss(StrState *s) { StrLookups(&s->table, s->misses); }
+
+static void StrHitCompact(StrState *s) {
+  StrLookups(&s->compacted, s->lookups);
+}
+
+static void StrMissCompact(StrState *s) {
+  StrLookups(&s->compacted, s->misses);
+}
+
+static void StrIterate(StrState *s) {
+  upb_strtable_iter i;
+  uintptr_t sum = 0;
+  upb_strtable_begin(&i, &s->table);
+  for (; !upb_strtable_done(&i); upb_strtable_next(&i)) {
+    sum += upb_value_getuint64(upb_strtable_iter_value(&i));
+  }
+  sink += sum;
+}
+
+static void StrCompact(StrState *s) { upb_strtable_compact(&s->compacted); }
+
+static void StrMapInsert(StrState *s) {
+  StrMap m;
+  size_t i;
+  for (i = 0; i < s->keys.size(); i++) {
+    m.insert(std::make_pair(s->keys[i], (uintptr_t)i));
+  }
+  sink += m.size();
+}
+
+static void StrMapLookups(StrState *s, const std::vector<std::string> &keys) {
+  size_t i;
+  uintptr_t sum = 0;
+  for (i = 0; i < keys.size(); i++) {
+    StrMap::const_iterator it = s->map.find(keys[i]);
+    if (it != s->map.end()) sum += it->second;
+  }
+  sink += sum;
+}
+
+static void StrMapHit(StrState *s) { StrMapLookups(s, s->lookups); }
+static void StrMapMiss(StrState *s) { StrMapLookups(s, s->misses); }
+
+static void StrMapIterate(StrState *s) {
+  StrMap::const_iterator it;
+  uintptr_t sum = 0;
+  for (it = s->map.begin(); it != s->map.end(); ++it) sum += it->second;
+  sink += sum;
+}
+
+static void RunStrTables(const char *name, StrKeysFunc *generate, size_t n) {
+  static const struct {
+    const char *name;
+    void (*op)(StrState *s);
+    bool compacted;
+  } kUpbOps[] = {
+    {"insert", &StrInsert, false},
+    {"hit", &StrHit, false},
+    {"miss", &StrMiss, false},
+    {"iterate", &StrIterate, false},
+    {"compact", &StrCompact, true},
+    {"hit_compact", &StrHitCompact, true},
+    {"miss_compact", &StrMissCompact, true},
+  }, kMapOps[] = {
+    {"insert", &StrMapInsert, false},
+    {"hit", &StrMapHit, false},
+    {"miss", &StrMapMiss, false},
+    {"iterate", &StrMapIterate, false},
+  };
+  StrState s;
+  double bytes, compacted_bytes, map_bytes;
+  size_t i;
+
+  generate(n, &s.keys, &s.misses);
+  s.lookups = s.keys;
+  Shuffle(&s.lookups);
+
+  {
+    upb_strtable t;
+    upb_strtable_init2(&t, UPB_CTYPE_UINT64, &tracking);
+    for (i = 0; i < n; i++) {
+      upb_strtable_insert3(&t, s.keys[i].data(), s.keys[i].size(),
+                           upb_value_uint64(i), &tracking);
+    }
+    bytes = (double)live_bytes / n;
+    upb_strtable_compact2(&t, &tracking);
+    compacted_bytes = (double)live_bytes / n;
+    upb_strtable_uninit2(&t, &tracking);
+  }
+
+  upb_strtable_init(&s.table, UPB_CTYPE_UINT64);
+  upb_strtable_init(&s.compacted, UPB_CTYPE_UINT64);
+  for (i = 0; i < n; i++) {
+    upb_strtable_insert2(&s.table, s.keys[i].data(), s.keys[i].size(),
+                         upb_value_uint64(i));
+    upb_strtable_insert2(&s.compacted, s.keys[i].data(), s.keys[i].size(),
+                         upb_value_uint64(i));
+    s.map.insert(std::make_pair(s.keys[i], (uintptr_t)i));
+  }
+  upb_strtable_compact(&s.compacted);
+
+  /* The map's keys are std::strings, which hold short keys inline and
+   * allocate longer ones outside the allocator. */
+  {
+    size_t key_bytes = 0;
+    StrMap::const_iterator it;
+    for (it = s.map.begin(); it != s.map.end(); ++it) {
+      const std::string &key = it->first;
+      const char *obj = reinterpret_cast<const char*>(&key);
+      if (key.data() < obj || key.data() >= obj + sizeof(key)) {
+        key_bytes += key.capacity() + 1;
+      }
+    }
+    map_bytes = (double)(std_live_bytes + key_bytes) / n;
+  }
+
+  for (i = 0; i < ARRAYSIZE(kUpbOps); i++) {
+    if (!Selected("upb_strtable", name, kUpbOps[i].name)) continue;
+    Report("upb_strtable", name, n, kUpbOps[i].name,
+           Time(kUpbOps[i].op, &s, n),
+           kUpbOps[i].compacted ? compacted_bytes : bytes);
+  }
+
+  for (i = 0; i < ARRAYSIZE(kMapOps); i++) {
+    if (!Selected("unordered_map", name, kMapOps[i].name)) continue;
+    Report("unordered_map", name, n, kMapOps[i].name,
+           Time(kMapOps[i].op, &s, n), map_bytes);
+  }
+
+  upb_strtable_uninit(&s.table);
+  upb_strtable_uninit(&s.compacted);
+}
+
+int main(int argc, char *argv[]) {
+  static const struct {
+    const char *name;
+    IntKeysFunc *generate;
+  } kIntKeys[] = {
+    {"dense", &DenseKeys},
+    {"mixed", &MixedKeys},
+    {"sparse", &SparseKeys},
+    {"pointers", &PointerKeys},
+  };
+  static const struct {
+    const char *name;
+    StrKeysFunc *generate;
+  } kStrKeys[] = {
+    {"names", &NameKeys},
+    {"short", &ShortKeys},
+    {"long", &LongKeys},
+  };
+  size_t i, j;
+
+  tracking.func = &TrackingAlloc;
+
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [filter]\n", argv[0]);
+    return 1;
+  }
+  if (argc == 2) filter = argv[1];
+
+  for (i = 0; i < ARRAYSIZE(kIntKeys); i++) {
+    for (j = 0; j < ARRAYSIZE(kSizes); j++) {
+      RunIntTables(kIntKeys[i].name, kIntKeys[i].generate, kSizes[j]);
+    }
+  }
+
+  for (i = 0; i < ARRAYSIZE(kStrKeys); i++) {
+    for (j = 0; j < ARRAYSIZE(kSizes); j++) {
+      RunStrTables(kStrKeys[i].name, kStrKeys[i].generate, kSizes[j]);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,646 @@
+/*
+** Benchmarks comparing upb with the official protobuf library (proto2).
+**
+** Like tests/bindings/googlepb/test_vs_proto2.cc this runs both libraries over
+** tests/google_message1.dat and tests/google_message2.dat.  On the proto2
+** side we use a DynamicMessage built from the same descriptor upb loads, so
+** no generated code (and no googlepb bridge) is required.  Run from the top of
+** the source tree:
+**
+**   benchmarks/vs_proto2 benchmarks/benchmark.proto.pb [filter]
+**
+** or just "make benchmark_vs_proto2".  If |filter| is given, only benchmarks
+** whose name or library contains it are run.
+**
+** Operations:
+**   parse      binary protobuf -> message
+**   serialize  message -> binary protobuf
+**   json_print message -> JSON
+**   json_parse JSON (as printed by the same library) -> message
+**   reflect    read every set field of the message through reflection
+**
+** "upb" uses upb_decode()/upb_encode() and a msgfactory layout, "pbdecoder"
+** and "pbdecoder_jit" run the streaming decoder with no handlers, so they
+** measure parsing alone without building a message.  Every operation reuses
+** its state: upb resets one arena, proto2 Clear()s one message.
+**
+** proto2 is measured through reflection on a DynamicMessage, which parses and
+** serializes more slowly than generated classes do.  Its numbers are what
+** code that loads schemas at runtime should expect, as upb's are.
+**
+** Throughput is always in MB/s of the binary payload, even for JSON, so the
+** numbers are comparable between libraries whose JSON differs in size.  Each
+** benchmark runs in a child process of its own that does only that
+** library's setup, so the peak RSS reported (from getrusage()) is what a
+** process doing just that work needs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor.pb.h>
+#include <google/protobuf/dynamic_message.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/util/json_util.h>
+
+#include "upb/decode.h"
+#include "upb/encode.h"
+#include "upb/json/decode.h"
+#include "upb/json/encode.h"
+#include "upb/msgfactory.h"
+#include "upb/pb/decoder.h"
+#include "upb/pb/glue.h"
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof(a[0]))
+
+namespace gpb = google::protobuf;
+
+/* Minimum running time of each benchmark, in seconds. */
+static const double kMinTime = 0.5;
+
+struct Input {
+  const char *name;
+  const char *msgname;
+  const char *filename;
+  std::string pb;
+};
+
+static bool ReadFile(const char *filename, std::string *out) {
+  FILE *f = fopen(filename, "rb");
+  char buf[4096];
+  size_t n;
+
+  if (!f) return false;
+  out->clear();
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out->append(buf, n);
+  }
+  fclose(f);
+  return true;
+}
+
+/* Folds a value into a checksum, so that reads can't be optimized away and
+ * the two libraries' reflection results can be compared.  Each field is
+ * hashed on its own and the results are added, so the order in which a
+ * library visits fields doesn't matter. */
+static uint64_t Mix(uint64_t sum, uint64_t val) {
+  return (sum ^ val) * 0x100000001b3ULL;
+}
+
+static uint64_t DoubleBits(double d) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  return bits;
+}
+
+static uint64_t FloatBits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+/* upb ************************************************************************/
+
+struct Upb {
+  upb::SymbolTable *symtab;
+  upb_msgfactory *factory;
+  const upb::MessageDef *md;
+  const upb_msglayout *layout;
+  upb::Environment *env;  /* Reset before every operation. */
+  upb::Arena arena;       /* Holds |msg| and |json|. */
+  upb_msg *msg;
+  upb_stringview json;
+
+  upb::pb::CodeCache interp;
+  upb::pb::CodeCache jit;
+  upb::reffed_ptr<const upb::Handlers> handlers;
+  const upb::pb::DecoderMethod *method;
+  const upb::pb::DecoderMethod *jit_method;
+};
+
+static void NoHandlers(const void *closure, upb::Handlers *h) {
+  UPB_UNUSED(closure);
+  UPB_UNUSED(h);
+}
+
+static bool SetupUpb(Upb *u, const std::string& descriptor, const Input *in) {
+  std::vector<upb::reffed_ptr<upb::FileDef> > files;
+  upb::Status status;
+  size_t i;
+
+  if (!upb::LoadDescriptor(descriptor, &status, &files)) {
+    fprintf(stderr, "upb couldn't load descriptor: %s\n",
+            status.error_message());
+    return false;
+  }
+
+  u->symtab = upb::SymbolTable::New();
+  for (i = 0; i < files.size(); i++) {
+    if (!u->symtab->AddFile(files[i].get(), &status)) {
+      fprintf(stderr, "upb couldn't add file: %s\n", status.error_message());
+      return false;
+    }
+  }
+
+  u->factory = upb_msgfactory_new(u->symtab);
+  u->md = u->symtab->LookupMessage(in->msgname);
+  if (!u->md) {
+    fprintf(stderr, "Message %s not in descriptor\n", in->msgname);
+    return false;
+  }
+  u->layout = upb_msgfactory_getlayout(u->factory, u->md);
+  u->env = new upb::Environment;
+  u->env->arena()->SetMaxRetained(1 << 24);
+
+  u->msg = upb_msg_new(u->layout, &u->arena);
+  if (!u->msg ||
+      !upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()), u->msg,
+                  u->layout)) {
+    fprintf(stderr, "upb_decode() failed on %s\n", in->name);
+    return false;
+  }
+
+  u->json.data = upb_json_encode(u->msg, u->layout, u->md, &u->arena, 0,
+                                 &u->json.size);
+  if (!u->json.data) {
+    fprintf(stderr, "upb_json_encode() failed on %s\n", in->name);
+    return false;
+  }
+
+  u->interp.set_allow_jit(false);
+  u->handlers = upb::Handlers::NewFrozen(u->md, &NoHandlers, NULL);
+  u->method = u->interp.GetDecoderMethod(
+      upb::pb::DecoderMethodOptions(u->handlers.get()));
+  u->jit_method = u->jit.GetDecoderMethod(
+      upb::pb::DecoderMethodOptions(u->handlers.get()));
+  return u->method && u->jit_method;
+}
+
+static uint64_t VisitUpb(const upb_msg *msg, const upb_msgdef *m,
+                         upb_msgfactory *factory);
+
+static uint64_t VisitUpbValue(uint64_t sum, upb_msgval v,
+                              const upb_fielddef *f, upb_msgfactory *factory) {
+  switch (upb_fielddef_type(f)) {
+    case UPB_TYPE_BOOL: return Mix(sum, v.b);
+    case UPB_TYPE_FLOAT: return Mix(sum, FloatBits(v.flt));
+    case UPB_TYPE_DOUBLE: return Mix(sum, DoubleBits(v.dbl));
+    case UPB_TYPE_INT32:
+    case UPB_TYPE_ENUM: return Mix(sum, (uint64_t)(int64_t)v.i32);
+    case UPB_TYPE_UINT32: return Mix(sum, v.u32);
+    case UPB_TYPE_INT64: return Mix(sum, (uint64_t)v.i64);
+    case UPB_TYPE_UINT64: return Mix(sum, v.u64);
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      return Mix(sum, v.str.size ? (uint8_t)v.str.data[0] + v.str.size : 0);
+    case UPB_TYPE_MESSAGE:
+      return Mix(sum, v.msg ? VisitUpb(v.msg, upb_fielddef_msgsubdef(f),
+                                       factory)
+                            : 0);
+  }
+  return sum;
+}
+
+static uint64_t VisitUpb(const upb_msg *msg, const upb_msgdef *m,
+                         upb_msgfactory *factory) {
+  const upb_msglayout *l = upb_msgfactory_getlayout(factory, m);
+  upb_msg_field_iter i;
+  uint64_t sum = 0;
+
+  for (upb_msg_field_begin(&i, m); !upb_msg_field_done(&i);
+       upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    int index = upb_fielddef_index(f);
+    uint64_t h = upb_fielddef_number(f);
+
+    if (upb_fielddef_ismap(f)) {
+      continue;  /* The benchmark messages have none. */
+    } else if (upb_fielddef_isseq(f)) {
+      const upb_array *arr = upb_msgval_getarr(upb_msg_get(msg, index, l));
+      size_t n = arr ? upb_array_size(arr) : 0;
+      size_t j;
+      for (j = 0; j < n; j++) {
+        h = VisitUpbValue(h, upb_array_get(arr, j), f, factory);
+      }
+      sum += h;
+    } else if (!upb_fielddef_haspresence(f) || upb_msg_has(msg, index, l)) {
+      sum += VisitUpbValue(h, upb_msg_get(msg, index, l), f, factory);
+    }
+  }
+
+  return sum;
+}
+
+static bool RunUpbParse(Upb *u, const Input *in) {
+  upb_msg *msg = upb_msg_new(u->layout, u->env->arena());
+  return msg && upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()),
+                           msg, u->layout);
+}
+
+static bool RunPbDecoderWith(const upb::pb::DecoderMethod *method, Upb *u,
+                             const Input *in) {
+  int closure;
+  upb::Sink sink(u->handlers.get(), &closure);
+  upb::pb::Decoder *decoder =
+      upb::pb::Decoder::Create(u->env, method, &sink);
+  return decoder && upb::BufferSource::PutBuffer(in->pb, decoder->input());
+}
+
+static bool RunPbDecoder(Upb *u, const Input *in) {
+  return RunPbDecoderWith(u->method, u, in);
+}
+
+static bool RunPbDecoderJit(Upb *u, const Input *in) {
+  return RunPbDecoderWith(u->jit_method, u, in);
+}
+
+static bool RunUpbSerialize(Upb *u, const Input *in) {
+  size_t size;
+  UPB_UNUSED(in);
+  return upb_encode(u->msg, u->layout, u->env->arena(), &size) != NULL;
+}
+
+static bool RunUpbJsonPrint(Upb *u, const Input *in) {
+  size_t size;
+  UPB_UNUSED(in);
+  return upb_json_encode(u->msg, u->layout, u->md, u->env->arena(), 0,
+                         &size) != NULL;
+}
+
+static bool RunUpbJsonParse(Upb *u, const Input *in) {
+  upb_msg *msg = upb_msg_new(u->layout, u->env->arena());
+  UPB_UNUSED(in);
+  return msg &&
+         upb_json_decode(u->json, msg, u->md, u->factory, 0, NULL);
+}
+
+static uint64_t reflect_sum;
+
+static bool RunUpbReflect(Upb *u, const Input *in) {
+  UPB_UNUSED(in);
+  reflect_sum = VisitUpb(u->msg, u->md, u->factory);
+  return true;
+}
+
+/* proto2 *********************************************************************/
+
+struct Proto2 {
+  gpb::DescriptorPool pool;
+  gpb::DynamicMessageFactory *factory;
+  const gpb::Message *prototype;
+  gpb::Message *msg;      /* Parsed from the input. */
+  gpb::Message *scratch;  /* Cleared and reused by every operation. */
+  std::string out;        /* Reused by every operation. */
+  std::string json;
+};
+
+static bool SetupProto2(Proto2 *p, const std::string& descriptor,
+                        const Input *in) {
+  gpb::FileDescriptorSet set;
+  const gpb::Descriptor *d;
+  int i;
+
+  if (!set.ParseFromString(descriptor)) {
+    fprintf(stderr, "proto2 couldn't parse descriptor\n");
+    return false;
+  }
+
+  for (i = 0; i < set.file_size(); i++) {
+    if (!p->pool.BuildFile(set.file(i))) {
+      fprintf(stderr, "proto2 couldn't build %s\n", set.file(i).name().c_str());
+      return false;
+    }
+  }
+
+  d = p->pool.FindMessageTypeByName(in->msgname);
+  if (!d) {
+    fprintf(stderr, "Message %s not in descriptor\n", in->msgname);
+    return false;
+  }
+
+  p->factory = new gpb::DynamicMessageFactory(&p->pool);
+  p->prototype = p->factory->GetPrototype(d);
+  p->msg = p->prototype->New();
+  p->scratch = p->prototype->New();
+
+  if (!p->msg->ParseFromString(in->pb)) {
+    fprintf(stderr, "proto2 failed to parse %s\n", in->name);
+    return false;
+  }
+
+  if (!gpb::util::MessageToJsonString(*p->msg, &p->json).ok()) {
+    fprintf(stderr, "proto2 failed to print %s as JSON\n", in->name);
+    return false;
+  }
+
+  return true;
+}
+
+static uint64_t VisitProto2(const gpb::Message& msg);
+
+static uint64_t VisitProto2Value(uint64_t sum, const gpb::Message& msg,
+                                 const gpb::FieldDescriptor *f, int i) {
+  const gpb::Reflection *r = msg.GetReflection();
+  const bool rep = f->is_repeated();
+
+  switch (f->cpp_type()) {
+    case gpb::FieldDescriptor::CPPTYPE_BOOL:
+      return Mix(sum, rep ? r->GetRepeatedBool(msg, f, i) : r->GetBool(msg, f));
+    case gpb::FieldDescriptor::CPPTYPE_FLOAT:
+      return Mix(sum, FloatBits(rep ? r->GetRepeatedFloat(msg, f, i)
+                                    : r->GetFloat(msg, f)));
+    case gpb::FieldDescriptor::CPPTYPE_DOUBLE:
+      return Mix(sum, DoubleBits(rep ? r->GetRepeatedDouble(msg, f, i)
+                                     : r->GetDouble(msg, f)));
+    case gpb::FieldDescriptor::CPPTYPE_INT32:
+      return Mix(sum, (uint64_t)(int64_t)(rep ? r->GetRepeatedInt32(msg, f, i)
+                                               : r->GetInt32(msg, f)));
+    case gpb::FieldDescriptor::CPPTYPE_ENUM:
+      return Mix(sum, (uint64_t)(int64_t)(
+                          rep ? r->GetRepeatedEnumValue(msg, f, i)
+                              : r->GetEnumValue(msg, f)));
+    case gpb::FieldDescriptor::CPPTYPE_UINT32:
+      return Mix(sum, rep ? r->GetRepeatedUInt32(msg, f, i)
+                          : r->GetUInt32(msg, f));
+    case gpb::FieldDescriptor::CPPTYPE_INT64:
+      return Mix(sum, (uint64_t)(rep ? r->GetRepeatedInt64(msg, f, i)
+                                     : r->GetInt64(msg, f)));
+    case gpb::FieldDescriptor::CPPTYPE_UINT64:
+      return Mix(sum, rep ? r->GetRepeatedUInt64(msg, f, i)
+                          : r->GetUInt64(msg, f));
+    case gpb::FieldDescriptor::CPPTYPE_STRING: {
+      std::string scratch;
+      const std::string& s =
+          rep ? r->GetRepeatedStringReference(msg, f, i, &scratch)
+              : r->GetStringReference(msg, f, &scratch);
+      return Mix(sum, s.size() ? (uint8_t)s[0] + s.size() : 0);
+    }
+    case gpb::FieldDescriptor::CPPTYPE_MESSAGE:
+      return Mix(sum, VisitProto2(rep ? r->GetRepeatedMessage(msg, f, i)
+                                      : r->GetMessage(msg, f)));
+  }
+  return sum;
+}
+
+static uint64_t VisitProto2(const gpb::Message& msg) {
+  const gpb::Reflection *r = msg.GetReflection();
+  const gpb::Descriptor *d = msg.GetDescriptor();
+  uint64_t sum = 0;
+  int i;
+
+  for (i = 0; i < d->field_count(); i++) {
+    const gpb::FieldDescriptor *f = d->field(i);
+    uint64_t h = f->number();
+    if (f->is_map()) {
+      continue;
+    } else if (f->is_repeated()) {
+      int n = r->FieldSize(msg, f);
+      int j;
+      for (j = 0; j < n; j++) {
+        h = VisitProto2Value(h, msg, f, j);
+      }
+      sum += h;
+    } else if (r->HasField(msg, f)) {
+      sum += VisitProto2Value(h, msg, f, -1);
+    }
+  }
+
+  return sum;
+}
+
+static bool RunProto2Parse(Proto2 *p, const Input *in) {
+  p->scratch->Clear();
+  return p->scratch->ParseFromString(in->pb);
+}
+
+static bool RunProto2Serialize(Proto2 *p, const Input *in) {
+  UPB_UNUSED(in);
+  p->out.clear();
+  return p->msg->SerializeToString(&p->out);
+}
+
+static bool RunProto2JsonPrint(Proto2 *p, const Input *in) {
+  UPB_UNUSED(in);
+  p->out.clear();
+  return gpb::util::MessageToJsonString(*p->msg, &p->out).ok();
+}
+
+static bool RunProto2JsonParse(Proto2 *p, const Input *in) {
+  UPB_UNUSED(in);
+  p->scratch->Clear();
+  return gpb::util::JsonStringToMessage(p->json, p->scratch).ok();
+}
+
+static bool RunProto2Reflect(Proto2 *p, const Input *in) {
+  UPB_UNUSED(in);
+  reflect_sum = VisitProto2(*p->msg);
+  return true;
+}
+
+/* Running benchmarks *********************************************************/
+
+typedef bool UpbRunFunc(Upb *u, const Input *in);
+typedef bool Proto2RunFunc(Proto2 *p, const Input *in);
+
+struct Benchmark {
+  const char *name;
+  const char *lib;
+  UpbRunFunc *upb_run;        /* Exactly one of these is set. */
+  Proto2RunFunc *proto2_run;
+};
+
+static const Benchmark kBenchmarks[] = {
+  {"parse", "upb", &RunUpbParse, NULL},
+  {"parse", "pbdecoder", &RunPbDecoder, NULL},
+  {"parse", "pbdecoder_jit", &RunPbDecoderJit, NULL},
+  {"parse", "proto2", NULL, &RunProto2Parse},
+  {"serialize", "upb", &RunUpbSerialize, NULL},
+  {"serialize", "proto2", NULL, &RunProto2Serialize},
+  {"json_print", "upb", &RunUpbJsonPrint, NULL},
+  {"json_print", "proto2", NULL, &RunProto2JsonPrint},
+  {"json_parse", "upb", &RunUpbJsonParse, NULL},
+  {"json_parse", "proto2", NULL, &RunProto2JsonParse},
+  {"reflect", "upb", &RunUpbReflect, NULL},
+  {"reflect", "proto2", NULL, &RunProto2Reflect},
+};
+
+/* Runs |b| on |in| until kMinTime has elapsed and prints the results.  Called
+ * in a child process. */
+static bool RunBenchmark(const Benchmark *b, const std::string& descriptor,
+                         const Input *in) {
+  Upb *u = NULL;
+  Proto2 *p = NULL;
+  struct rusage usage;
+  long iters = 0;
+  long batch = 1;
+  double elapsed;
+  clock_t start;
+
+  if (b->upb_run) {
+    u = new Upb;
+    if (!SetupUpb(u, descriptor, in)) return false;
+    if (b->upb_run == &RunPbDecoderJit && !u->jit_method->is_native()) {
+      printf("%-10s %-13s %-16s skipped (built without the JIT)\n", b->name,
+             b->lib, in->name);
+      return true;
+    }
+  } else {
+    p = new Proto2;
+    if (!SetupProto2(p, descriptor, in)) return false;
+  }
+
+  start = clock();
+
+  do {
+    long i;
+    for (i = 0; i < batch; i++) {
+      bool ok;
+      if (u) {
+        upb_arena_reset(u->env->arena());
+        ok = b->upb_run(u, in);
+      } else {
+        ok = b->proto2_run(p, in);
+      }
+      if (!ok) {
+        fprintf(stderr, "%s/%s failed on %s\n", b->name, b->lib, in->name);
+        return false;
+      }
+    }
+    iters += batch;
+    batch *= 2;
+    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+  } while (elapsed < kMinTime);
+
+  getrusage(RUSAGE_SELF, &usage);
+  printf("%-10s %-13s %-16s %9.1f MB/s %9ld KB peak RSS\n", b->name, b->lib,
+         in->name, (double)in->pb.size() * iters / elapsed / 1e6,
+         (long)usage.ru_maxrss);
+
+  /* The process exits next, so |u| and |p| are not freed. */
+  return true;
+}
+
+/* Checks that both libraries parse |in| to the same message, and that
+ * reflection sees the same values in it. */
+static bool Check(const std::string& descriptor, const Input *in) {
+  Upb *u = new Upb;
+  Proto2 *p = new Proto2;
+  uint64_t upb_sum;
+  size_t size;
+  char *pb;
+
+  if (!SetupUpb(u, descriptor, in) || !SetupProto2(p, descriptor, in)) {
+    return false;
+  }
+
+  /* upb may write fields in a different order, so we compare proto2's
+   * serialization of the two. */
+  pb = upb_encode(u->msg, u->layout, &u->arena, &size);
+  p->scratch->Clear();
+  if (!pb || !p->scratch->ParseFromArray(pb, size) ||
+      p->scratch->SerializeAsString() != p->msg->SerializeAsString()) {
+    fprintf(stderr, "upb and proto2 serialize %s differently\n", in->name);
+    return false;
+  }
+
+  RunUpbReflect(u, in);
+  upb_sum = reflect_sum;
+  RunProto2Reflect(p, in);
+  if (upb_sum != reflect_sum) {
+    fprintf(stderr, "upb and proto2 reflection disagree on %s\n", in->name);
+    return false;
+  }
+
+  /* upb parses proto2's JSON.  We don't check the reverse: proto2's JSON
+   * parser rejects groups, which google_message2 has. */
+  {
+    upb_msg *msg = upb_msg_new(u->layout, &u->arena);
+    upb_stringview json = upb_stringview_make(p->json.data(), p->json.size());
+    upb::Status status;
+    if (!msg ||
+        !upb_json_decode(json, msg, u->md, u->factory, 0, &status)) {
+      fprintf(stderr, "upb can't parse proto2's JSON for %s: %s\n", in->name,
+              status.error_message());
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Runs |b| (or the check, if |b| is NULL) in a child process, so that each
+ * gets a peak RSS of its own. */
+static bool RunInChild(const Benchmark *b, const std::string& descriptor,
+                       const Input *in) {
+  pid_t pid;
+  int status;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  } else if (pid == 0) {
+    bool ok = b ? RunBenchmark(b, descriptor, in) : Check(descriptor, in);
+    fflush(stdout);
+    _exit(ok ? 0 : 1);
+  }
+
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  Input inputs[2];
+  std::string descriptor;
+  const char *filter = argc > 2 ? argv[2] : NULL;
+  int ret = 0;
+  size_t i, j;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: vs_proto2 <benchmark.proto.pb> [filter]\n");
+    return 1;
+  }
+
+  inputs[0].name = "google_message1";
+  inputs[0].msgname = "benchmarks.SpeedMessage1";
+  inputs[0].filename = "tests/google_message1.dat";
+  inputs[1].name = "google_message2";
+  inputs[1].msgname = "benchmarks.SpeedMessage2";
+  inputs[1].filename = "tests/google_message2.dat";
+
+  if (!ReadFile(argv[1], &descriptor)) {
+    fprintf(stderr, "Couldn't read descriptor %s\n", argv[1]);
+    return 1;
+  }
+
+  for (j = 0; j < ARRAYSIZE(inputs); j++) {
+    if (!ReadFile(inputs[j].filename, &inputs[j].pb)) {
+      fprintf(stderr, "Couldn't read %s\n", inputs[j].filename);
+      return 1;
+    }
+    if (!RunInChild(NULL, descriptor, &inputs[j])) return 1;
+  }
+
+  for (i = 0; i < ARRAYSIZE(kBenchmarks); i++) {
+    const Benchmark *b = &kBenchmarks[i];
+
+    if (filter && !strstr(b->name, filter) && !strstr(b->lib, filter)) {
+      continue;
+    }
+
+    for (j = 0; j < ARRAYSIZE(inputs); j++) {
+      if (!RunInChild(b, descriptor, &inputs[j])) ret = 1;
+    }
+  }
+
+  return ret;
+}
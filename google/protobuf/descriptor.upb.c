@@ -20,10 +20,18 @@ static const upb_msglayout_field google_protobuf_FileDescriptorSet__fields[1] =
   {1, UPB_SIZE(0, 0), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_FileDescriptorSet__dense[2] = {
+  0, 1,
+};
+
 const upb_msglayout google_protobuf_FileDescriptorSet_msginit = {
   &google_protobuf_FileDescriptorSet_submsgs[0],
   &google_protobuf_FileDescriptorSet__fields[0],
   UPB_SIZE(4, 8), 1, false,
+  2, &google_protobuf_FileDescriptorSet__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_FileDescriptorProto_submsgs[6] = {
@@ -50,10 +58,18 @@ static const upb_msglayout_field google_protobuf_FileDescriptorProto__fields[12]
   {12, UPB_SIZE(24, 48), 3, 0, 9, 1},
 };
 
+static const uint16_t google_protobuf_FileDescriptorProto__dense[13] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+};
+
 const upb_msglayout google_protobuf_FileDescriptorProto_msginit = {
   &google_protobuf_FileDescriptorProto_submsgs[0],
   &google_protobuf_FileDescriptorProto__fields[0],
   UPB_SIZE(72, 144), 12, false,
+  13, &google_protobuf_FileDescriptorProto__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_DescriptorProto_submsgs[8] = {
@@ -79,10 +95,18 @@ static const upb_msglayout_field google_protobuf_DescriptorProto__fields[10] = {
   {10, UPB_SIZE(48, 96), 0, 0, 9, 3},
 };
 
+static const uint16_t google_protobuf_DescriptorProto__dense[11] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+};
+
 const upb_msglayout google_protobuf_DescriptorProto_msginit = {
   &google_protobuf_DescriptorProto_submsgs[0],
   &google_protobuf_DescriptorProto__fields[0],
   UPB_SIZE(56, 112), 10, false,
+  11, &google_protobuf_DescriptorProto__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_DescriptorProto_ExtensionRange_submsgs[1] = {
@@ -95,10 +119,18 @@ static const upb_msglayout_field google_protobuf_DescriptorProto_ExtensionRange_
   {3, UPB_SIZE(12, 16), 3, 0, 11, 1},
 };
 
+static const uint16_t google_protobuf_DescriptorProto_ExtensionRange__dense[4] = {
+  0, 1, 2, 3,
+};
+
 const upb_msglayout google_protobuf_DescriptorProto_ExtensionRange_msginit = {
   &google_protobuf_DescriptorProto_ExtensionRange_submsgs[0],
   &google_protobuf_DescriptorProto_ExtensionRange__fields[0],
   UPB_SIZE(16, 24), 3, false,
+  4, &google_protobuf_DescriptorProto_ExtensionRange__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout_field google_protobuf_DescriptorProto_ReservedRange__fields[2] = {
@@ -106,10 +138,18 @@ static const upb_msglayout_field google_protobuf_DescriptorProto_ReservedRange__
   {2, UPB_SIZE(8, 8), 2, 0, 5, 1},
 };
 
+static const uint16_t google_protobuf_DescriptorProto_ReservedRange__dense[3] = {
+  0, 1, 2,
+};
+
 const upb_msglayout google_protobuf_DescriptorProto_ReservedRange_msginit = {
   NULL,
   &google_protobuf_DescriptorProto_ReservedRange__fields[0],
   UPB_SIZE(12, 12), 2, false,
+  3, &google_protobuf_DescriptorProto_ReservedRange__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_ExtensionRangeOptions_submsgs[1] = {
@@ -124,7 +164,122 @@ const upb_msglayout google_protobuf_ExtensionRangeOptions_msginit = {
   &google_protobuf_ExtensionRangeOptions_submsgs[0],
   &google_protobuf_ExtensionRangeOptions__fields[0],
   UPB_SIZE(4, 8), 1, false,
-};
+  0, NULL,
+  false,
+  NULL,
+  0, NULL,
+};
+
+static bool google_protobuf_FieldDescriptorProto_parse(const char **ptr, const char *limit, upb_msg *msg,
+    int options) {
+  const char *p = *ptr;
+  const char *field_start;
+  uint64_t tag;
+  uint64_t val;
+
+  while (p < limit) {
+    field_start = p;
+    if (!_upb_decode_varint(&p, limit, &tag)) return false;
+    switch (tag) {
+      case 10:
+        if (options & (UPB_DECODE_COPYSTRINGS | UPB_DECODE_VALIDATEUTF8)) goto fallback;
+        if (!_upb_decode_string(&p, limit, &UPB_FIELD_AT(msg, upb_stringview, UPB_SIZE(32, 32)))) return false;
+        UPB_SET_HASBIT(msg, 5);
+        if (limit - p >= 1 && (uint8_t)p[0] == 18) {
+          field_start = p;
+          p += 1;
+          goto field2;
+        }
+        continue;
+      case 18:
+      field2:
+        if (options & (UPB_DECODE_COPYSTRINGS | UPB_DECODE_VALIDATEUTF8)) goto fallback;
+        if (!_upb_decode_string(&p, limit, &UPB_FIELD_AT(msg, upb_stringview, UPB_SIZE(40, 48)))) return false;
+        UPB_SET_HASBIT(msg, 6);
+        if (limit - p >= 1 && (uint8_t)p[0] == 24) {
+          field_start = p;
+          p += 1;
+          goto field3;
+        }
+        continue;
+      case 24:
+      field3:
+        if (!_upb_decode_varint(&p, limit, &val)) return false;
+        UPB_FIELD_AT(msg, int32_t, UPB_SIZE(24, 24)) = (int32_t)val;
+        UPB_SET_HASBIT(msg, 3);
+        if (limit - p >= 1 && (uint8_t)p[0] == 32) {
+          field_start = p;
+          p += 1;
+          goto field4;
+        }
+        continue;
+      case 32:
+      field4:
+        if (!_upb_decode_varint(&p, limit, &val)) return false;
+        UPB_FIELD_AT(msg, int32_t, UPB_SIZE(8, 8)) = (int32_t)val;
+        UPB_SET_HASBIT(msg, 1);
+        if (limit - p >= 1 && (uint8_t)p[0] == 40) {
+          field_start = p;
+          p += 1;
+          goto field5;
+        }
+        continue;
+      case 40:
+      field5:
+        if (!_upb_decode_varint(&p, limit, &val)) return false;
+        UPB_FIELD_AT(msg, int32_t, UPB_SIZE(16, 16)) = (int32_t)val;
+        UPB_SET_HASBIT(msg, 2);
+        if (limit - p >= 1 && (uint8_t)p[0] == 50) {
+          field_start = p;
+          p += 1;
+          goto field6;
+        }
+        continue;
+      case 50:
+      field6:
+        if (options & (UPB_DECODE_COPYSTRINGS | UPB_DECODE_VALIDATEUTF8)) goto fallback;
+        if (!_upb_decode_string(&p, limit, &UPB_FIELD_AT(msg, upb_stringview, UPB_SIZE(48, 64)))) return false;
+        UPB_SET_HASBIT(msg, 7);
+        if (limit - p >= 1 && (uint8_t)p[0] == 58) {
+          field_start = p;
+          p += 1;
+          goto field7;
+        }
+        continue;
+      case 58:
+      field7:
+        if (options & (UPB_DECODE_COPYSTRINGS | UPB_DECODE_VALIDATEUTF8)) goto fallback;
+        if (!_upb_decode_string(&p, limit, &UPB_FIELD_AT(msg, upb_stringview, UPB_SIZE(56, 80)))) return false;
+        UPB_SET_HASBIT(msg, 8);
+        continue;
+      case 72:
+        if (!_upb_decode_varint(&p, limit, &val)) return false;
+        UPB_FIELD_AT(msg, int32_t, UPB_SIZE(28, 28)) = (int32_t)val;
+        UPB_SET_HASBIT(msg, 4);
+        if (limit - p >= 1 && (uint8_t)p[0] == 82) {
+          field_start = p;
+          p += 1;
+          goto field10;
+        }
+        continue;
+      case 82:
+      field10:
+        if (options & (UPB_DECODE_COPYSTRINGS | UPB_DECODE_VALIDATEUTF8)) goto fallback;
+        if (!_upb_decode_string(&p, limit, &UPB_FIELD_AT(msg, upb_stringview, UPB_SIZE(64, 96)))) return false;
+        UPB_SET_HASBIT(msg, 9);
+        continue;
+      default:
+        goto fallback;
+    }
+  }
+
+  *ptr = p;
+  return true;
+
+fallback:
+  *ptr = field_start;
+  return true;
+}
 
 static const upb_msglayout *const google_protobuf_FieldDescriptorProto_submsgs[1] = {
   &google_protobuf_FieldOptions_msginit,
@@ -143,10 +298,18 @@ static const upb_msglayout_field google_protobuf_FieldDescriptorProto__fields[10
   {10, UPB_SIZE(64, 96), 9, 0, 9, 1},
 };
 
+static const uint16_t google_protobuf_FieldDescriptorProto__dense[11] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+};
+
 const upb_msglayout google_protobuf_FieldDescriptorProto_msginit = {
   &google_protobuf_FieldDescriptorProto_submsgs[0],
   &google_protobuf_FieldDescriptorProto__fields[0],
   UPB_SIZE(80, 128), 10, false,
+  11, &google_protobuf_FieldDescriptorProto__dense[0],
+  false,
+  google_protobuf_FieldDescriptorProto_parse,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_OneofDescriptorProto_submsgs[1] = {
@@ -158,10 +321,18 @@ static const upb_msglayout_field google_protobuf_OneofDescriptorProto__fields[2]
   {2, UPB_SIZE(16, 32), 2, 0, 11, 1},
 };
 
+static const uint16_t google_protobuf_OneofDescriptorProto__dense[3] = {
+  0, 1, 2,
+};
+
 const upb_msglayout google_protobuf_OneofDescriptorProto_msginit = {
   &google_protobuf_OneofDescriptorProto_submsgs[0],
   &google_protobuf_OneofDescriptorProto__fields[0],
   UPB_SIZE(24, 48), 2, false,
+  3, &google_protobuf_OneofDescriptorProto__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_EnumDescriptorProto_submsgs[3] = {
@@ -178,10 +349,18 @@ static const upb_msglayout_field google_protobuf_EnumDescriptorProto__fields[5]
   {5, UPB_SIZE(28, 56), 0, 0, 9, 3},
 };
 
+static const uint16_t google_protobuf_EnumDescriptorProto__dense[6] = {
+  0, 1, 2, 3, 4, 5,
+};
+
 const upb_msglayout google_protobuf_EnumDescriptorProto_msginit = {
   &google_protobuf_EnumDescriptorProto_submsgs[0],
   &google_protobuf_EnumDescriptorProto__fields[0],
   UPB_SIZE(32, 64), 5, false,
+  6, &google_protobuf_EnumDescriptorProto__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout_field google_protobuf_EnumDescriptorProto_EnumReservedRange__fields[2] = {
@@ -189,10 +368,18 @@ static const upb_msglayout_field google_protobuf_EnumDescriptorProto_EnumReserve
   {2, UPB_SIZE(8, 8), 2, 0, 5, 1},
 };
 
+static const uint16_t google_protobuf_EnumDescriptorProto_EnumReservedRange__dense[3] = {
+  0, 1, 2,
+};
+
 const upb_msglayout google_protobuf_EnumDescriptorProto_EnumReservedRange_msginit = {
   NULL,
   &google_protobuf_EnumDescriptorProto_EnumReservedRange__fields[0],
   UPB_SIZE(12, 12), 2, false,
+  3, &google_protobuf_EnumDescriptorProto_EnumReservedRange__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_EnumValueDescriptorProto_submsgs[1] = {
@@ -205,10 +392,18 @@ static const upb_msglayout_field google_protobuf_EnumValueDescriptorProto__field
   {3, UPB_SIZE(16, 32), 3, 0, 11, 1},
 };
 
+static const uint16_t google_protobuf_EnumValueDescriptorProto__dense[4] = {
+  0, 1, 2, 3,
+};
+
 const upb_msglayout google_protobuf_EnumValueDescriptorProto_msginit = {
   &google_protobuf_EnumValueDescriptorProto_submsgs[0],
   &google_protobuf_EnumValueDescriptorProto__fields[0],
   UPB_SIZE(24, 48), 3, false,
+  4, &google_protobuf_EnumValueDescriptorProto__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_ServiceDescriptorProto_submsgs[2] = {
@@ -222,10 +417,18 @@ static const upb_msglayout_field google_protobuf_ServiceDescriptorProto__fields[
   {3, UPB_SIZE(16, 32), 2, 1, 11, 1},
 };
 
+static const uint16_t google_protobuf_ServiceDescriptorProto__dense[4] = {
+  0, 1, 2, 3,
+};
+
 const upb_msglayout google_protobuf_ServiceDescriptorProto_msginit = {
   &google_protobuf_ServiceDescriptorProto_submsgs[0],
   &google_protobuf_ServiceDescriptorProto__fields[0],
   UPB_SIZE(24, 48), 3, false,
+  4, &google_protobuf_ServiceDescriptorProto__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_MethodDescriptorProto_submsgs[1] = {
@@ -241,10 +444,18 @@ static const upb_msglayout_field google_protobuf_MethodDescriptorProto__fields[6
   {6, UPB_SIZE(2, 2), 2, 0, 8, 1},
 };
 
+static const uint16_t google_protobuf_MethodDescriptorProto__dense[7] = {
+  0, 1, 2, 3, 4, 5, 6,
+};
+
 const upb_msglayout google_protobuf_MethodDescriptorProto_msginit = {
   &google_protobuf_MethodDescriptorProto_submsgs[0],
   &google_protobuf_MethodDescriptorProto__fields[0],
   UPB_SIZE(40, 80), 6, false,
+  7, &google_protobuf_MethodDescriptorProto__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_FileOptions_submsgs[1] = {
@@ -273,10 +484,20 @@ static const upb_msglayout_field google_protobuf_FileOptions__fields[19] = {
   {999, UPB_SIZE(96, 160), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_FileOptions__dense[43] = {
+  0, 1, 0, 0, 0, 0, 0, 0, 2, 3, 4, 5, 0, 0, 0, 0,
+  6, 7, 8, 0, 9, 0, 0, 10, 0, 0, 0, 11, 0, 0, 0, 12,
+  0, 0, 0, 0, 13, 14, 0, 15, 16, 17, 18,
+};
+
 const upb_msglayout google_protobuf_FileOptions_msginit = {
   &google_protobuf_FileOptions_submsgs[0],
   &google_protobuf_FileOptions__fields[0],
   UPB_SIZE(104, 176), 19, false,
+  43, &google_protobuf_FileOptions__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_MessageOptions_submsgs[1] = {
@@ -291,10 +512,18 @@ static const upb_msglayout_field google_protobuf_MessageOptions__fields[5] = {
   {999, UPB_SIZE(8, 8), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_MessageOptions__dense[8] = {
+  0, 1, 2, 3, 0, 0, 0, 4,
+};
+
 const upb_msglayout google_protobuf_MessageOptions_msginit = {
   &google_protobuf_MessageOptions_submsgs[0],
   &google_protobuf_MessageOptions__fields[0],
   UPB_SIZE(12, 16), 5, false,
+  8, &google_protobuf_MessageOptions__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_FieldOptions_submsgs[1] = {
@@ -311,10 +540,18 @@ static const upb_msglayout_field google_protobuf_FieldOptions__fields[7] = {
   {999, UPB_SIZE(28, 32), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_FieldOptions__dense[11] = {
+  0, 1, 2, 3, 0, 4, 5, 0, 0, 0, 6,
+};
+
 const upb_msglayout google_protobuf_FieldOptions_msginit = {
   &google_protobuf_FieldOptions_submsgs[0],
   &google_protobuf_FieldOptions__fields[0],
   UPB_SIZE(32, 40), 7, false,
+  11, &google_protobuf_FieldOptions__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_OneofOptions_submsgs[1] = {
@@ -329,6 +566,10 @@ const upb_msglayout google_protobuf_OneofOptions_msginit = {
   &google_protobuf_OneofOptions_submsgs[0],
   &google_protobuf_OneofOptions__fields[0],
   UPB_SIZE(4, 8), 1, false,
+  0, NULL,
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_EnumOptions_submsgs[1] = {
@@ -341,10 +582,18 @@ static const upb_msglayout_field google_protobuf_EnumOptions__fields[3] = {
   {999, UPB_SIZE(4, 8), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_EnumOptions__dense[4] = {
+  0, 0, 1, 2,
+};
+
 const upb_msglayout google_protobuf_EnumOptions_msginit = {
   &google_protobuf_EnumOptions_submsgs[0],
   &google_protobuf_EnumOptions__fields[0],
   UPB_SIZE(8, 16), 3, false,
+  4, &google_protobuf_EnumOptions__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_EnumValueOptions_submsgs[1] = {
@@ -356,10 +605,18 @@ static const upb_msglayout_field google_protobuf_EnumValueOptions__fields[2] = {
   {999, UPB_SIZE(4, 8), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_EnumValueOptions__dense[2] = {
+  0, 1,
+};
+
 const upb_msglayout google_protobuf_EnumValueOptions_msginit = {
   &google_protobuf_EnumValueOptions_submsgs[0],
   &google_protobuf_EnumValueOptions__fields[0],
   UPB_SIZE(8, 16), 2, false,
+  2, &google_protobuf_EnumValueOptions__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_ServiceOptions_submsgs[1] = {
@@ -371,10 +628,20 @@ static const upb_msglayout_field google_protobuf_ServiceOptions__fields[2] = {
   {999, UPB_SIZE(4, 8), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_ServiceOptions__dense[34] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 1,
+};
+
 const upb_msglayout google_protobuf_ServiceOptions_msginit = {
   &google_protobuf_ServiceOptions_submsgs[0],
   &google_protobuf_ServiceOptions__fields[0],
   UPB_SIZE(8, 16), 2, false,
+  34, &google_protobuf_ServiceOptions__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_MethodOptions_submsgs[1] = {
@@ -387,10 +654,20 @@ static const upb_msglayout_field google_protobuf_MethodOptions__fields[3] = {
   {999, UPB_SIZE(20, 24), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_MethodOptions__dense[35] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 1, 2,
+};
+
 const upb_msglayout google_protobuf_MethodOptions_msginit = {
   &google_protobuf_MethodOptions_submsgs[0],
   &google_protobuf_MethodOptions__fields[0],
   UPB_SIZE(24, 32), 3, false,
+  35, &google_protobuf_MethodOptions__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_UninterpretedOption_submsgs[1] = {
@@ -407,10 +684,18 @@ static const upb_msglayout_field google_protobuf_UninterpretedOption__fields[7]
   {8, UPB_SIZE(48, 64), 6, 0, 9, 1},
 };
 
+static const uint16_t google_protobuf_UninterpretedOption__dense[9] = {
+  0, 0, 1, 2, 3, 4, 5, 6, 7,
+};
+
 const upb_msglayout google_protobuf_UninterpretedOption_msginit = {
   &google_protobuf_UninterpretedOption_submsgs[0],
   &google_protobuf_UninterpretedOption__fields[0],
   UPB_SIZE(64, 96), 7, false,
+  9, &google_protobuf_UninterpretedOption__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout_field google_protobuf_UninterpretedOption_NamePart__fields[2] = {
@@ -418,10 +703,20 @@ static const upb_msglayout_field google_protobuf_UninterpretedOption_NamePart__f
   {2, UPB_SIZE(1, 1), 1, 0, 8, 2},
 };
 
+static const uint16_t google_protobuf_UninterpretedOption_NamePart__dense[3] = {
+  0, 1, 2,
+};
+
+static const uint8_t google_protobuf_UninterpretedOption_NamePart__required[1] = {0x06};
+
 const upb_msglayout google_protobuf_UninterpretedOption_NamePart_msginit = {
   NULL,
   &google_protobuf_UninterpretedOption_NamePart__fields[0],
   UPB_SIZE(16, 32), 2, false,
+  3, &google_protobuf_UninterpretedOption_NamePart__dense[0],
+  false,
+  NULL,
+  1, &google_protobuf_UninterpretedOption_NamePart__required[0],
 };
 
 static const upb_msglayout *const google_protobuf_SourceCodeInfo_submsgs[1] = {
@@ -432,10 +727,18 @@ static const upb_msglayout_field google_protobuf_SourceCodeInfo__fields[1] = {
   {1, UPB_SIZE(0, 0), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_SourceCodeInfo__dense[2] = {
+  0, 1,
+};
+
 const upb_msglayout google_protobuf_SourceCodeInfo_msginit = {
   &google_protobuf_SourceCodeInfo_submsgs[0],
   &google_protobuf_SourceCodeInfo__fields[0],
   UPB_SIZE(4, 8), 1, false,
+  2, &google_protobuf_SourceCodeInfo__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout_field google_protobuf_SourceCodeInfo_Location__fields[5] = {
@@ -446,10 +749,18 @@ static const upb_msglayout_field google_protobuf_SourceCodeInfo_Location__fields
   {6, UPB_SIZE(32, 64), 0, 0, 9, 3},
 };
 
+static const uint16_t google_protobuf_SourceCodeInfo_Location__dense[7] = {
+  0, 1, 2, 3, 4, 0, 5,
+};
+
 const upb_msglayout google_protobuf_SourceCodeInfo_Location_msginit = {
   NULL,
   &google_protobuf_SourceCodeInfo_Location__fields[0],
   UPB_SIZE(40, 80), 5, false,
+  7, &google_protobuf_SourceCodeInfo_Location__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout *const google_protobuf_GeneratedCodeInfo_submsgs[1] = {
@@ -460,10 +771,18 @@ static const upb_msglayout_field google_protobuf_GeneratedCodeInfo__fields[1] =
   {1, UPB_SIZE(0, 0), 0, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_GeneratedCodeInfo__dense[2] = {
+  0, 1,
+};
+
 const upb_msglayout google_protobuf_GeneratedCodeInfo_msginit = {
   &google_protobuf_GeneratedCodeInfo_submsgs[0],
   &google_protobuf_GeneratedCodeInfo__fields[0],
   UPB_SIZE(4, 8), 1, false,
+  2, &google_protobuf_GeneratedCodeInfo__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 static const upb_msglayout_field google_protobuf_GeneratedCodeInfo_Annotation__fields[4] = {
@@ -473,10 +792,18 @@ static const upb_msglayout_field google_protobuf_GeneratedCodeInfo_Annotation__f
   {4, UPB_SIZE(8, 8), 2, 0, 5, 1},
 };
 
+static const uint16_t google_protobuf_GeneratedCodeInfo_Annotation__dense[5] = {
+  0, 1, 2, 3, 4,
+};
+
 const upb_msglayout google_protobuf_GeneratedCodeInfo_Annotation_msginit = {
   NULL,
   &google_protobuf_GeneratedCodeInfo_Annotation__fields[0],
   UPB_SIZE(32, 48), 4, false,
+  5, &google_protobuf_GeneratedCodeInfo_Annotation__dense[0],
+  false,
+  NULL,
+  0, NULL,
 };
 
 #include "upb/port_undef.inc"
@@ -73,6 +73,29 @@ function test_parse_string()
 end
 
 
+function test_encode_to_buffer()
+  local arena = upb.Arena()
+  local msg = TestMessage(arena)
+  msg.i32 = 5
+  msg.dbl = 1.5
+
+  local buf = pb.Buffer()
+  assert_equal(buf, pb.encode(msg, buf))
+  assert_equal(pb.encode(msg), tostring(buf))
+  assert_equal(#pb.encode(msg), #buf)
+
+  -- Reusing the buffer for a smaller message.
+  local msg2 = TestMessage(arena)
+  msg2.bool = true
+  pb.encode(msg2, buf)
+  assert_equal(pb.encode(msg2), buf:tostring())
+
+  local msg3 = TestMessage(arena)
+  pb.decode(msg3, buf:tostring())
+  assert_equal(true, msg3.bool)
+  assert_equal(0, msg3.i32)
+end
+
 local stats = lunit.main()
 
 if stats.failed > 0 or stats.errors > 0 then
@@ -6,12 +6,20 @@
 #include "tests/json/test.upbdefs.h"
 #include "tests/test_util.h"
 #include "tests/upb_test.h"
+#include "upb/decode.h"
 #include "upb/handlers.h"
+#include "upb/json/decode.h"
+#include "upb/json/encode.h"
+#include "upb/json/number.int.h"
 #include "upb/json/parser.h"
 #include "upb/json/printer.h"
+#include "upb/json/transcode.h"
+#include "upb/pb/glue.h"
 #include "upb/upb.h"
 
+#include <stdio.h>
 #include <string>
+#include <time.h>
 
 // Macros for readability in test case list: allows us to give TEST("...") /
 // EXPECT("...") pairs.
@@ -47,6 +55,32 @@ static TestCase kTestRoundtripMessages[] = {
            "\"optionalBool\":true,\"repeatedMsg\":[{\"foo\":1},"
            "{\"foo\":2}]}")
   },
+  // Test integer limits, and integers written as quoted strings or doubles.
+  {
+    TEST("{\"optionalInt64\":-9223372036854775808,"
+         "\"optionalUint64\":9223372036854775807,"
+         "\"repeatedUint64\":[0,18446744073709551615]}"),
+    EXPECT_SAME
+  },
+  {
+    TEST("{\"optionalInt32\":\"-42\",\"optionalInt64\":\"007\","
+         "\"repeatedInt32\":[1e3,-2.5e1,0.0,2147483647,-2147483648]}"),
+    EXPECT("{\"optionalInt32\":-42,\"optionalInt64\":7,"
+           "\"repeatedInt32\":[1000,-25,0,2147483647,-2147483648]}")
+  },
+  // Test base64 for bytes, with each kind of padding, and long enough that
+  // both are done in bulk.
+  {
+    TEST("{\"optionalBytes\":\"AAEC/w==\","
+         "\"repeatedBytes\":[\"QQ==\",\"QUI=\",\"QUJD\","
+         "\"VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRvZy4=\"]}"),
+    EXPECT_SAME
+  },
+  // Base64 may contain escapes like any other string.
+  {
+    TEST("{\"optionalBytes\":\"\\u0051UJD\\u0051Q==\"}"),
+    EXPECT("{\"optionalBytes\":\"QUJDQQ==\"}")
+  },
   // Test special escapes in strings.
   {
     TEST("{\"repeatedString\":[\"\\b\",\"\\r\",\"\\n\",\"\\f\",\"\\t\","
@@ -241,11 +275,442 @@ void test_json_roundtrip() {
   }
 }
 
+static const char* kInvalidUtf8Messages[] = {
+  "{\"optionalString\":\"\xff\"}",
+  "{\"optionalString\":\"ab\xe2\x82\"}",
+  "{\"optionalString\":\"\xc0\x80\"}",
+  "{\"repeatedString\":[\"x\",\"\xed\xa0\x80\"]}",
+  // Escapes are checked once they are converted to UTF-8.
+  "{\"optionalString\":\"\\ud800\"}",
+  NULL
+};
+
+void test_json_validate_utf8_message(
+    const char* json_src, bool expect_ok,
+    const upb::Handlers* serialize_handlers,
+    const upb::json::ParserMethod* parser_method, int seam) {
+  VerboseParserEnvironment env(verbose);
+  StringSink data_sink;
+  upb::json::Printer* printer = upb::json::Printer::Create(
+      env.env(), serialize_handlers, data_sink.Sink());
+  upb::json::Parser* parser =
+      upb::json::Parser::Create(
+          env.env(), parser_method, printer->input(), false);
+  parser->set_validate_utf8(true);
+  env.ResetBytesSink(parser->input());
+  env.Reset(json_src, strlen(json_src), false, !expect_ok);
+
+  bool ok = env.Start() &&
+            env.ParseBuffer(seam) &&
+            env.ParseBuffer(-1) &&
+            env.End();
+
+  ASSERT(ok == expect_ok);
+  ASSERT(env.CheckConsistency());
+}
+
+// With UTF-8 validation on, valid strings (at every buffer seam, so that
+// characters are split) still parse and invalid ones are rejected.
+void test_json_validate_utf8() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb::reffed_ptr<const upb::Handlers> serialize_handlers(
+      upb::json::Printer::NewHandlers(md.get(), false));
+  upb::reffed_ptr<const upb::json::ParserMethod> parser_method(
+      upb::json::ParserMethod::New(md.get()));
+
+  for (const TestCase* test_case = kTestRoundtripMessages;
+       test_case->input != NULL; test_case++) {
+    for (size_t i = 0; i < strlen(test_case->input); i++) {
+      test_json_validate_utf8_message(test_case->input, true,
+                                      serialize_handlers.get(),
+                                      parser_method.get(), i);
+    }
+  }
+
+  for (const char** json_src = kInvalidUtf8Messages; *json_src != NULL;
+       json_src++) {
+    for (size_t i = 0; i < strlen(*json_src); i++) {
+      test_json_validate_utf8_message(*json_src, false,
+                                      serialize_handlers.get(),
+                                      parser_method.get(), i);
+    }
+  }
+}
+
+static bool parse_json(upb::BytesSink* sink, const char* json, size_t len) {
+  void* subc;
+  return sink->Start(len, &subc) &&
+         sink->PutBuffer(subc, json, len, NULL) == len &&
+         sink->End();
+}
+
+// A parser and printer can be reused for any number of messages, including
+// after one was abandoned halfway, without allocating again.
+void test_json_reset() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb::reffed_ptr<const upb::Handlers> serialize_handlers(
+      upb::json::Printer::NewHandlers(md.get(), false));
+  upb::reffed_ptr<const upb::json::ParserMethod> parser_method(
+      upb::json::ParserMethod::New(md.get()));
+  const char* json = kTestRoundtripMessages[0].input;
+  size_t len = strlen(json);
+
+  upb::InlinedEnvironment<8192> env;
+  StringSink data_sink;
+  upb::json::Printer* printer = upb::json::Printer::Create(
+      &env, serialize_handlers.get(), data_sink.Sink());
+  upb::json::Parser* parser = upb::json::Parser::Create(
+      &env, parser_method.get(), printer->input(), false);
+  upb::BytesSink* sink = parser->input();
+  void* subc;
+
+  ASSERT(parse_json(sink, json, len));
+  ASSERT(data_sink.Data() == json);
+  size_t allocated = upb_env_bytesallocated(&env);
+
+  // Stop inside "optionalMsg".
+  size_t n = strstr(json, "42}") - json;
+  parser->Reset();
+  ASSERT(sink->Start(n, &subc));
+  ASSERT(sink->PutBuffer(subc, json, n, NULL) == n);
+  parser->Reset();
+  printer->Reset();
+
+  size_t start = data_sink.Data().size();
+  ASSERT(parse_json(sink, json, len));
+  ASSERT(data_sink.Data().substr(start) == json);
+  ASSERT(upb_env_bytesallocated(&env) == allocated);
+}
+
+static std::string fmt_timestamp(int64_t seconds, int32_t nanos) {
+  char buf[31];
+  size_t n = upb_json_fmttimestamp(seconds, nanos, buf, sizeof(buf));
+  ASSERT(n <= sizeof(buf));
+  return std::string(buf, n);
+}
+
+static std::string fmt_duration(int64_t seconds, int32_t nanos) {
+  char buf[32];
+  size_t n = upb_json_fmtduration(seconds, nanos, buf, sizeof(buf));
+  ASSERT(n <= sizeof(buf));
+  return std::string(buf, n);
+}
+
+static bool parse_datetime(const char* str, int64_t* seconds) {
+  return upb_json_parsedatetime(str, strlen(str), seconds);
+}
+
+// Timestamps and durations are converted without libc's time functions.
+void test_json_time() {
+  int64_t seconds;
+  char buf[31];
+
+  ASSERT(fmt_timestamp(0, 0) == "1970-01-01T00:00:00Z");
+  ASSERT(fmt_timestamp(-1, 0) == "1969-12-31T23:59:59Z");
+  ASSERT(fmt_timestamp(951782400, 5000000) == "2000-02-29T00:00:00.005Z");
+  ASSERT(fmt_timestamp(-62135596800LL, 0) == "0001-01-01T00:00:00Z");
+  ASSERT(fmt_timestamp(253402300799LL, 999999999) ==
+         "9999-12-31T23:59:59.999999999Z");
+  ASSERT(upb_json_fmttimestamp(0, 0, buf, 19) == (size_t)-1);
+  ASSERT(upb_json_fmttimestamp(0, 0, buf, 20) == 20);
+
+  ASSERT(fmt_duration(0, 0) == "0s");
+  ASSERT(fmt_duration(-1, -500000000) == "-1.5s");
+  ASSERT(fmt_duration(0, -3) == "-0.000000003s");
+  ASSERT(fmt_duration(315576000000LL, 999999999) ==
+         "315576000000.999999999s");
+
+  ASSERT(parse_datetime("1970-01-01T00:00:00", &seconds) && seconds == 0);
+  ASSERT(parse_datetime("2000-02-29T00:00:00", &seconds) &&
+         seconds == 951782400);
+  ASSERT(parse_datetime("0001-01-01T00:00:00", &seconds) &&
+         seconds == -62135596800LL);
+  ASSERT(parse_datetime("9999-12-31T23:59:59", &seconds) &&
+         seconds == 253402300799LL);
+  ASSERT(!parse_datetime("1900-02-29T00:00:00", &seconds));
+  ASSERT(!parse_datetime("2001-02-29T00:00:00", &seconds));
+  ASSERT(!parse_datetime("2001-04-31T00:00:00", &seconds));
+  ASSERT(!parse_datetime("2001-13-01T00:00:00", &seconds));
+  ASSERT(!parse_datetime("2001-01-01T24:00:00", &seconds));
+  ASSERT(!parse_datetime("2001-01-01T00:60:00", &seconds));
+  ASSERT(!parse_datetime("2001-01-01 00:00:00", &seconds));
+  ASSERT(!parse_datetime("2001-01-01T00:00:0", &seconds));
+  ASSERT(!parse_datetime("2001-01-01T00:00:0x", &seconds));
+
+  // Check both directions against gmtime() across the whole range, where
+  // time_t can hold it.
+  if (sizeof(time_t) < 8) return;
+  for (int64_t t = -62135596800LL; t <= 253402300799LL; t += 3196801) {
+    time_t tt = (time_t)t;
+    const struct tm* tm = gmtime(&tt);
+    char expected[32];
+    ASSERT(tm);
+    snprintf(expected, sizeof(expected), "%04d-%02d-%02dT%02d:%02d:%02dZ",
+             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour,
+             tm->tm_min, tm->tm_sec);
+    ASSERT(fmt_timestamp(t, 0) == expected);
+    ASSERT(upb_json_parsedatetime(expected, 19, &seconds) && seconds == t);
+  }
+}
+
+// The tests below use upb_json_decode() and upb_json_encode(), which need
+// defs from a symtab (for the upb_msgfactory) rather than the static ones.
+static upb_symtab* symtab;
+static upb_msgfactory* factory;
+static const upb_msgdef* test_md;
+static const upb_msglayout* test_l;
+static const upb_msgdef* any_md;
+
+// google.protobuf.Any isn't in test.proto, so it is built by hand.
+static void add_any(upb_status* status) {
+  upb_msgdef* m = upb_msgdef_new(&m);
+  upb_fielddef* type_url = upb_fielddef_new(&type_url);
+  upb_fielddef* value = upb_fielddef_new(&value);
+  ASSERT_STATUS(upb_msgdef_setfullname(m, "google.protobuf.Any", status),
+                status);
+  upb_msgdef_setsyntax(m, UPB_SYNTAX_PROTO3);
+  ASSERT_STATUS(upb_fielddef_setname(type_url, "type_url", status), status);
+  ASSERT_STATUS(upb_fielddef_setnumber(type_url, 1, status), status);
+  upb_fielddef_setlabel(type_url, UPB_LABEL_OPTIONAL);
+  upb_fielddef_settype(type_url, UPB_TYPE_STRING);
+  ASSERT_STATUS(upb_msgdef_addfield(m, type_url, &type_url, status), status);
+  ASSERT_STATUS(upb_fielddef_setname(value, "value", status), status);
+  ASSERT_STATUS(upb_fielddef_setnumber(value, 2, status), status);
+  upb_fielddef_setlabel(value, UPB_LABEL_OPTIONAL);
+  upb_fielddef_settype(value, UPB_TYPE_BYTES);
+  ASSERT_STATUS(upb_msgdef_addfield(m, value, &value, status), status);
+  ASSERT_STATUS(upb_symtab_add(symtab, (upb_def**)&m, 1, &m, status), status);
+}
+
+static void load_test_proto() {
+  upb_status status;
+  size_t len;
+  char* data = upb_readfile("tests/json/test.proto.pb", &len);
+  upb_filedef** files;
+  ASSERT(data);
+  files = upb_loaddescriptor(data, len, &files, &status);
+  ASSERT(files);
+  free(data);
+
+  symtab = upb_symtab_new();
+  for (upb_filedef** files_ptr = files; *files_ptr; files_ptr++) {
+    bool ok = upb_symtab_addfile(symtab, *files_ptr, &status);
+    ASSERT_STATUS(ok, &status);
+    upb_filedef_unref(*files_ptr, &files);
+  }
+  upb_gfree(files);
+  add_any(&status);
+
+  factory = upb_msgfactory_new(symtab);
+  test_md = upb_symtab_lookupmsg(symtab, "upb.test.json.TestMessage");
+  ASSERT(test_md);
+  test_l = upb_msgfactory_getlayout(factory, test_md);
+  ASSERT(test_l);
+  any_md = upb_symtab_lookupmsg(symtab, "google.protobuf.Any");
+  ASSERT(any_md);
+}
+
+static upb_msg* json_decode(const char* json, const upb_msgdef* m,
+                            upb_arena* arena) {
+  upb_status status;
+  const upb_msglayout* l = upb_msgfactory_getlayout(factory, m);
+  upb_msg* msg = upb_msg_new(l, arena);
+  bool ok = upb_json_decode(upb_stringview_make(json, strlen(json)), msg, m,
+                            factory, 0, &status);
+  ASSERT_STATUS(ok, &status);
+  return msg;
+}
+
+static bool json_decodes(const char* json) {
+  upb_arena arena;
+  upb_arena_init(&arena);
+  upb_msg* msg = upb_msg_new(test_l, &arena);
+  bool ok = upb_json_decode(upb_stringview_make(json, strlen(json)), msg,
+                            test_md, factory, 0, NULL);
+  upb_arena_uninit(&arena);
+  return ok;
+}
+
+static bool streq(upb_stringview str, const char* expected) {
+  return std::string(str.data, str.size) == expected;
+}
+
+static std::string json_encode(const upb_msg* msg, const upb_msgdef* m,
+                               upb_arena* arena) {
+  const upb_msglayout* l = upb_msgfactory_getlayout(factory, m);
+  size_t size;
+  char* buf = upb_json_encode2(msg, l, m, factory, arena, 0, &size);
+  ASSERT(buf);
+  return std::string(buf, size);
+}
+
+// upb_json_decode() followed by upb_json_encode() gives back an equal
+// message.  Fields come out in layout order and map entries in hash order, so
+// the text only matches the input for messages with a single field (and at
+// most one map entry).
+void test_json_decode_encode() {
+  upb_arena arena;
+  upb_arena_init(&arena);
+
+  for (const TestCase* test_case = kTestRoundtripMessages;
+       test_case->input != NULL; test_case++) {
+    upb_msg* msg = json_decode(test_case->input, test_md, &arena);
+    std::string json = json_encode(msg, test_md, &arena);
+    upb_msg* msg2 = json_decode(json.c_str(), test_md, &arena);
+    ASSERT(upb_msg_equal(msg, msg2, test_l));
+    if (test_case->expected != EXPECT_SAME) {
+      msg2 = json_decode(test_case->expected, test_md, &arena);
+      ASSERT(upb_msg_equal(msg, msg2, test_l));
+    }
+  }
+
+  static const char* kExact[] = {
+    "{\"optionalInt32\":-42}",
+    "{\"repeatedString\":[\"a\",\"b\"]}",
+    "{\"mapStringString\":{\"a\\u0001\":\"b\"}}",
+    "{\"mapInt32String\":{\"-1\":\"x\"}}",
+    "{\"mapInt32String\":{\"0\":\"zero\"}}",
+    "{\"mapBoolString\":{\"false\":\"f\"}}",
+    "{\"mapStringMsg\":{\"k\":{\"foo\":1}}}",
+    "{\"mapStringMsg\":{\"k\":{}}}",
+    NULL
+  };
+  for (const char** json = kExact; *json; json++) {
+    upb_msg* msg = json_decode(*json, test_md, &arena);
+    ASSERT(json_encode(msg, test_md, &arena) == *json);
+  }
+
+  // Decoding merges into a map, and a later value for a key replaces an
+  // earlier one.
+  upb_msg* msg = json_decode("{\"mapInt32String\":{\"1\":\"a\",\"2\":\"b\"}}",
+                             test_md, &arena);
+  upb_status status;
+  const char* more = "{\"mapInt32String\":{\"0\":\"c\",\"1\":\"d\"}}";
+  ASSERT_STATUS(upb_json_decode(upb_stringview_make(more, strlen(more)), msg,
+                                test_md, factory, 0, &status),
+                &status);
+  const upb_map* map = upb_msg_get(
+      msg, upb_fielddef_index(upb_msgdef_ntofz(test_md, "map_int32_string")),
+      test_l).map;
+  upb_msgval val;
+  ASSERT(upb_map_size(map) == 3);
+  ASSERT(upb_map_get(map, upb_msgval_int32(0), &val));
+  ASSERT(streq(val.str, "c"));
+  ASSERT(upb_map_get(map, upb_msgval_int32(1), &val));
+  ASSERT(streq(val.str, "d"));
+  ASSERT(upb_map_get(map, upb_msgval_int32(2), &val));
+  ASSERT(streq(val.str, "b"));
+
+  ASSERT(!json_decodes("{\"mapInt32String\":{\"x\":\"a\"}}"));
+  ASSERT(!json_decodes("{\"mapInt32String\":{\"1.5\":\"a\"}}"));
+  ASSERT(!json_decodes("{\"mapInt32String\":{1:\"a\"}}"));
+  ASSERT(!json_decodes("{\"mapBoolString\":{\"yes\":\"a\"}}"));
+  ASSERT(!json_decodes("{\"mapStringInt32\":{\"a\":\"b\"}}"));
+  ASSERT(!json_decodes("{\"mapStringMsg\":{\"a\":1}}"));
+
+  upb_arena_uninit(&arena);
+}
+
+// The transcoder gives the same messages as upb_json_decode() and
+// upb_encode(), in both directions.
+void test_json_transcoder() {
+  upb_arena arena;
+  upb_arena_init(&arena);
+  upb_json_transcoder* t = upb_json_transcoder_new(test_md, factory, 0, &arena);
+  ASSERT(t);
+
+  for (const TestCase* test_case = kTestRoundtripMessages;
+       test_case->input != NULL; test_case++) {
+    upb_status status;
+    upb_stringview json =
+        upb_stringview_make(test_case->input, strlen(test_case->input));
+    upb_msg* msg = json_decode(test_case->input, test_md, &arena);
+    size_t size;
+
+    char* pb = upb_json_transcoder_topb(t, json, &arena, 0, &size, &status);
+    ASSERT_STATUS(pb, &status);
+    upb_msg* msg2 = upb_msg_new(test_l, &arena);
+    ASSERT(upb_decode(upb_stringview_make(pb, size), msg2, test_l));
+    ASSERT(upb_msg_equal(msg, msg2, test_l));
+
+    char* out = upb_json_transcoder_tojson(
+        t, upb_stringview_make(pb, size), &arena, &size, &status);
+    ASSERT_STATUS(out, &status);
+    std::string text(out, size);
+    msg2 = json_decode(text.c_str(), test_md, &arena);
+    ASSERT(upb_msg_equal(msg, msg2, test_l));
+  }
+
+  upb_arena_uninit(&arena);
+}
+
+// Any type URLs resolve by the name after the last '/', and resolve the same
+// way again from the cache, including past UPB_MSGFACTORY_MAXANYTYPES.
+void test_json_any() {
+  const char* kUrl = "type.googleapis.com/upb.test.json.SubMessage";
+  const upb_msgdef* sub_md =
+      upb_symtab_lookupmsg(symtab, "upb.test.json.SubMessage");
+  const upb_msglayout* sub_l = upb_msgfactory_getlayout(factory, sub_md);
+  const upb_msglayout* l = NULL;
+  upb_arena arena;
+  upb_arena_init(&arena);
+
+  ASSERT(upb_msgfactory_getanytype(factory, kUrl, strlen(kUrl), &l) ==
+         sub_md);
+  ASSERT(l == sub_l);
+  l = NULL;
+  ASSERT(upb_msgfactory_getanytype(factory, kUrl, strlen(kUrl), &l) ==
+         sub_md);
+  ASSERT(l == sub_l);
+  ASSERT(upb_msgfactory_getanytype(factory, "upb.test.json.SubMessage", 24,
+                                   &l) == sub_md);
+  ASSERT(!upb_msgfactory_getanytype(factory, "x/upb.test.json.Nope", 20, &l));
+  ASSERT(!upb_msgfactory_getanytype(factory, "x/", 2, &l));
+
+  for (int i = 0; i < UPB_MSGFACTORY_MAXANYTYPES + 10; i++) {
+    char url[64];
+    int len = snprintf(url, sizeof(url), "t%d/upb.test.json.SubMessage", i);
+    for (int j = 0; j < 2; j++) {
+      l = NULL;
+      ASSERT(upb_msgfactory_getanytype(factory, url, len, &l) == sub_md);
+      ASSERT(l == sub_l);
+    }
+  }
+  ASSERT(upb_msgfactory_getanytype(factory, kUrl, strlen(kUrl), &l) ==
+         sub_md);
+
+  // "@type" may come after the fields.
+  const char* json =
+      "{\"@type\":\"type.googleapis.com/upb.test.json.SubMessage\","
+      "\"foo\":42}";
+  upb_msg* msg = json_decode(json, any_md, &arena);
+  ASSERT(json_encode(msg, any_md, &arena) == json);
+  msg = json_decode(
+      "{\"foo\":42,"
+      "\"@type\":\"type.googleapis.com/upb.test.json.SubMessage\"}",
+      any_md, &arena);
+  ASSERT(json_encode(msg, any_md, &arena) == json);
+
+  upb_arena_uninit(&arena);
+}
+
 extern "C" {
 int run_tests(int argc, char *argv[]) {
   UPB_UNUSED(argc);
   UPB_UNUSED(argv);
   test_json_roundtrip();
+  test_json_validate_utf8();
+  test_json_reset();
+  test_json_time();
+
+  load_test_proto();
+  test_json_decode_encode();
+  test_json_transcoder();
+  test_json_any();
+  upb_msgfactory_free(factory);
+  upb_symtab_free(symtab);
   return 0;
 }
 }
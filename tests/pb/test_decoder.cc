@@ -270,6 +270,30 @@ bool value_bool(int* depth, const uint32_t* num, bool val) {
   return true;
 }
 
+// Array handlers print each value just like the value handlers, so the output
+// is the same whichever of the two the decoder uses.
+size_t array_calls;
+
+#define NUMERIC_ARRAY_HANDLER(member, ctype)                              \
+  bool array_##member(void* closure, const void* hd, const ctype* vals,  \
+                      size_t n) {                                         \
+    ASSERT(n > 0);                                                        \
+    array_calls++;                                                        \
+    for (size_t i = 0; i < n; i++) {                                      \
+      value_##member(static_cast<int*>(closure),                          \
+                     static_cast<const uint32_t*>(hd), vals[i]);          \
+    }                                                                     \
+    return true;                                                          \
+  }
+
+NUMERIC_ARRAY_HANDLER(uint32, uint32_t)
+NUMERIC_ARRAY_HANDLER(uint64, uint64_t)
+NUMERIC_ARRAY_HANDLER(int32,  int32_t)
+NUMERIC_ARRAY_HANDLER(int64,  int64_t)
+NUMERIC_ARRAY_HANDLER(float,  float)
+NUMERIC_ARRAY_HANDLER(double, double)
+NUMERIC_ARRAY_HANDLER(bool,   bool)
+
 int* startstr(int* depth, const uint32_t* num, size_t size_hint) {
   check_stack_alignment();
   indentbuf(&output, *depth);
@@ -375,6 +399,20 @@ void reg(upb_handlers *h, upb_descriptortype_t type) {
   doreg<T, F>(h, rep_fn(type));
 }
 
+template <class F>
+void regarray(upb_handlers *h, upb_descriptortype_t type,
+              bool set(upb_handlers*, const upb_fielddef*, F*,
+                       upb_handlerattr*),
+              F* func) {
+  uint32_t* num = new uint32_t(rep_fn(type));
+  const upb_fielddef *f = upb_msgdef_itof(upb_handlers_msgdef(h), *num);
+  upb::HandlerAttributes attr;
+  ASSERT(f);
+  ASSERT(upb_handlers_addcleanup(h, num, free_uint32));
+  ASSERT(attr.SetHandlerData(num));
+  ASSERT(set(h, f, func, &attr));
+}
+
 void regseq(upb::Handlers* h, const upb::FieldDef* f, uint32_t num) {
   ASSERT(h->SetStartSequenceHandler(f, UpbBind(startseq, new uint32_t(num))));
   ASSERT(h->SetEndSequenceHandler(f, UpbBind(endseq, new uint32_t(num))));
@@ -499,7 +537,8 @@ upb::reffed_ptr<const upb::MessageDef> NewMessageDef() {
   return md;
 }
 
-upb::reffed_ptr<const upb::Handlers> NewHandlers(TestMode mode) {
+upb::reffed_ptr<const upb::Handlers> NewHandlers(TestMode mode,
+                                                 bool arrays = false) {
   upb::reffed_ptr<upb::Handlers> h(upb::Handlers::New(NewMessageDef().get()));
 
   if (mode == ALL_HANDLERS) {
@@ -522,6 +561,38 @@ upb::reffed_ptr<const upb::Handlers> NewHandlers(TestMode mode) {
     reg<int32_t,  value_int32> (h.get(), UPB_DESCRIPTOR_TYPE_SINT32);
     reg<int64_t,  value_int64> (h.get(), UPB_DESCRIPTOR_TYPE_SINT64);
 
+    if (arrays) {
+      upb_handlers* c = h.get();
+      regarray(c, UPB_DESCRIPTOR_TYPE_DOUBLE, upb_handlers_setdoublearray,
+               array_double);
+      regarray(c, UPB_DESCRIPTOR_TYPE_FLOAT, upb_handlers_setfloatarray,
+               array_float);
+      regarray(c, UPB_DESCRIPTOR_TYPE_INT64, upb_handlers_setint64array,
+               array_int64);
+      regarray(c, UPB_DESCRIPTOR_TYPE_UINT64, upb_handlers_setuint64array,
+               array_uint64);
+      regarray(c, UPB_DESCRIPTOR_TYPE_INT32, upb_handlers_setint32array,
+               array_int32);
+      regarray(c, UPB_DESCRIPTOR_TYPE_FIXED64, upb_handlers_setuint64array,
+               array_uint64);
+      regarray(c, UPB_DESCRIPTOR_TYPE_FIXED32, upb_handlers_setuint32array,
+               array_uint32);
+      regarray(c, UPB_DESCRIPTOR_TYPE_BOOL, upb_handlers_setboolarray,
+               array_bool);
+      regarray(c, UPB_DESCRIPTOR_TYPE_UINT32, upb_handlers_setuint32array,
+               array_uint32);
+      regarray(c, UPB_DESCRIPTOR_TYPE_ENUM, upb_handlers_setint32array,
+               array_int32);
+      regarray(c, UPB_DESCRIPTOR_TYPE_SFIXED32, upb_handlers_setint32array,
+               array_int32);
+      regarray(c, UPB_DESCRIPTOR_TYPE_SFIXED64, upb_handlers_setint64array,
+               array_int64);
+      regarray(c, UPB_DESCRIPTOR_TYPE_SINT32, upb_handlers_setint32array,
+               array_int32);
+      regarray(c, UPB_DESCRIPTOR_TYPE_SINT64, upb_handlers_setint64array,
+               array_int64);
+    }
+
     reg_str(h.get(), UPB_DESCRIPTOR_TYPE_STRING);
     reg_str(h.get(), UPB_DESCRIPTOR_TYPE_BYTES);
     reg_str(h.get(), rep_fn(UPB_DESCRIPTOR_TYPE_STRING));
@@ -1274,6 +1345,412 @@ upb::reffed_ptr<const upb::pb::DecoderMethod> method =
   }
 }
 
+void test_validate_utf8() {
+  upb::pb::DecoderMethodOptions opts(global_handlers);
+  opts.set_validate_utf8(true);
+  upb::pb::CodeCache cache;
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      cache.GetDecoderMethod(opts));
+  const upb::pb::DecoderMethod* saved_method = global_method;
+  global_method = method.get();
+
+  // The JIT can't validate, so this is always bytecode.
+  ASSERT(!global_method->is_native());
+
+  // run_decoder() tries many buffer seams, so this also checks characters
+  // that are split across buffers.
+  uint32_t str_fn = UPB_DESCRIPTOR_TYPE_STRING;
+  uint32_t bytes_fn = UPB_DESCRIPTOR_TYPE_BYTES;
+  assert_successful_parse(
+      cat( tag(str_fn, UPB_WIRE_TYPE_DELIMITED),
+           delim(string("\xc3\xa9t\xe2\x82\xac\xf0\x9f\x98\x80")) ),
+      LINE("<")
+      LINE("%u:(10)\"\xc3\xa9t\xe2\x82\xac\xf0\x9f\x98\x80")
+      LINE("%u:\"")
+      LINE(">"), str_fn, str_fn);
+
+  // Invalid byte, truncated character, overlong encoding, surrogate.
+  const char* bad[] = {"ab\xff", "ab\xe2\x82", "\xc0\x80", "\xed\xa0\x80"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    assert_does_not_parse(
+        cat( tag(str_fn, UPB_WIRE_TYPE_DELIMITED), delim(string(bad[i])) ));
+    assert_does_not_parse(
+        cat( tag(rep_fn(str_fn), UPB_WIRE_TYPE_DELIMITED),
+             delim(string(bad[i])) ));
+  }
+
+  // Bytes fields are not checked.
+  assert_successful_parse(
+      cat( tag(bytes_fn, UPB_WIRE_TYPE_DELIMITED), delim(string("ab\xff")) ),
+      LINE("<")
+      LINE("%u:(3)\"ab\xff")
+      LINE("%u:\"")
+      LINE(">"), bytes_fn, bytes_fn);
+
+  global_method = saved_method;
+}
+
+void test_codecache() {
+  upb::pb::CodeCache cache;
+  upb::pb::DecoderMethodOptions opts(global_handlers);
+  const upb::pb::DecoderMethod* method = cache.GetDecoderMethod(opts);
+  ASSERT(method);
+  ASSERT(method->dest_handlers() == global_handlers);
+
+  // The method is compiled once and then served from the cache.
+  ASSERT(cache.GetDecoderMethod(opts) == method);
+
+  // Different options need different code.
+  upb::pb::DecoderMethodOptions lazy_opts(global_handlers);
+  lazy_opts.set_lazy(true);
+  const upb::pb::DecoderMethod* lazy_method = cache.GetDecoderMethod(lazy_opts);
+  ASSERT(lazy_method);
+  ASSERT(lazy_method != method);
+  ASSERT(cache.GetDecoderMethod(lazy_opts) == lazy_method);
+  ASSERT(cache.GetDecoderMethod(opts) == method);
+
+  // Once code is cached, the JIT setting can no longer change.
+  ASSERT(!cache.set_allow_jit(false));
+}
+
+void test_serialized_code() {
+  upb::pb::DecoderMethodOptions opts(global_handlers);
+  upb::Arena arena;
+  size_t size;
+  char* buf = upb::pb::CodeCache::Serialize(opts, &arena, &size);
+  ASSERT(buf);
+
+  upb::pb::CodeCache cache;
+  cache.set_allow_jit(false);
+  upb::Status status;
+  ASSERT(cache.Load(opts, buf, size, &status));
+  ASSERT(status.ok());
+
+  // Once loaded, the cache has nothing left to compile, so the loaded code is
+  // what runs the whole suite.
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      cache.GetDecoderMethod(opts));
+  ASSERT(method.get());
+  ASSERT(method->dest_handlers() == global_handlers);
+  ASSERT(cache.GetDecoderMethod(opts) == method.get());
+  const upb::pb::DecoderMethod* saved_method = global_method;
+  global_method = method.get();
+  test_invalid();
+  test_valid();
+  global_method = saved_method;
+
+  // Loading the same code twice keeps the first copy.
+  ASSERT(cache.Load(opts, buf, size, &status));
+  ASSERT(cache.GetDecoderMethod(opts) == method.get());
+
+  // Code for other options or other handlers is rejected.
+  upb::pb::CodeCache cache2;
+  upb::pb::DecoderMethodOptions lazy_opts(global_handlers);
+  lazy_opts.set_lazy(true);
+  ASSERT(!cache2.Load(lazy_opts, buf, size, &status));
+  upb::reffed_ptr<const upb::Handlers> other_handlers =
+      NewHandlers(test_mode == ALL_HANDLERS ? NO_HANDLERS : ALL_HANDLERS);
+  upb::pb::DecoderMethodOptions other_opts(other_handlers.get());
+  ASSERT(!cache2.Load(other_opts, buf, size, &status));
+
+  // So is code that was truncated or damaged.
+  ASSERT(!cache2.Load(opts, buf, size - 4, &status));
+  buf[size - 1] ^= 1;
+  ASSERT(!cache2.Load(opts, buf, size, &status));
+  buf[size - 1] ^= 1;
+  ASSERT(cache2.Load(opts, buf, size, &status));
+}
+
+void test_profile() {
+  upb::pb::CodeProfile profile;
+  upb::pb::DecoderMethodOptions opts(global_handlers);
+  opts.set_profile(&profile);
+  upb::pb::CodeCache cache;
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      cache.GetDecoderMethod(opts));
+  ASSERT(method.get());
+  ASSERT(!method->is_native());
+
+  // Fields arrive in the opposite of field number order.
+  uint32_t first_fn = UPB_DESCRIPTOR_TYPE_INT32;
+  uint32_t second_fn = UPB_DESCRIPTOR_TYPE_DOUBLE;
+  string proto = cat( tag(first_fn, UPB_WIRE_TYPE_VARINT), varint(5),
+                      tag(second_fn, UPB_WIRE_TYPE_64BIT), string(8, '\0') );
+  for (int i = 0; i < 3; i++) {
+    upb::Status status;
+    upb::Environment env;
+    env.ReportErrorsTo(&status);
+    upb::Sink sink(global_handlers, &closures[0]);
+    upb::pb::Decoder* decoder = CreateDecoder(&env, method.get(), &sink);
+    ASSERT(upb::BufferSource::PutBuffer(proto, decoder->input()));
+    ASSERT(status.ok());
+  }
+
+  const upb::MessageDef* md = global_handlers->message_def();
+  ASSERT(profile.field_count(md->FindFieldByNumber(first_fn)) == 3);
+  ASSERT(profile.field_count(md->FindFieldByNumber(second_fn)) == 3);
+  ASSERT(profile.field_count(
+             md->FindFieldByNumber(UPB_DESCRIPTOR_TYPE_STRING)) == 0);
+
+  // Profiling and profile-ordered code both decode everything correctly.
+  const upb::pb::DecoderMethod* saved_method = global_method;
+  global_method = method.get();
+  test_invalid();
+  test_valid();
+
+  upb::pb::DecoderMethodOptions ordered_opts(global_handlers);
+  ordered_opts.set_field_order(&profile);
+  upb::reffed_ptr<const upb::pb::DecoderMethod> ordered_method(
+      cache.GetDecoderMethod(ordered_opts));
+  ASSERT(ordered_method.get());
+  ASSERT(ordered_method.get() != method.get());
+  global_method = ordered_method.get();
+  test_invalid();
+  test_valid();
+  global_method = saved_method;
+}
+
+void test_stats() {
+  upb::pb::DecoderMethodOptions opts(global_handlers);
+  upb::pb::CodeCache cache;
+  cache.set_allow_jit(false);
+  const upb::pb::DecoderMethod* method = cache.GetDecoderMethod(opts);
+
+  // Fields in the order the code expects, an unknown field, and a value split
+  // across two buffers.
+  uint32_t fn = UPB_DESCRIPTOR_TYPE_INT32;
+  uint32_t next_fn = UPB_DESCRIPTOR_TYPE_FIXED64;
+  string proto = cat( tag(fn, UPB_WIRE_TYPE_VARINT), varint(300),
+                      tag(next_fn, UPB_WIRE_TYPE_64BIT), string(8, '\0'),
+                      tag(12345, UPB_WIRE_TYPE_VARINT), varint(1),
+                      tag(fn, UPB_WIRE_TYPE_VARINT), varint(1 << 20) );
+  size_t split = proto.size() - 2;
+
+  upb_pbdecoderstats global_before;
+  upb::pb::Decoder::GetGlobalStats(&global_before);
+  upb_pbdecoderstats stats;
+  {
+    upb::Status status;
+    upb::Environment env;
+    env.ReportErrorsTo(&status);
+    upb::Sink sink(global_handlers, &closures[0]);
+    upb::pb::Decoder* decoder = CreateDecoder(&env, method, &sink);
+    upb::BytesSink* input = decoder->input();
+    void* sub;
+    ASSERT(input->Start(proto.size(), &sub));
+    ASSERT(input->PutBuffer(sub, proto.data(), split, NULL) == split);
+    ASSERT(input->PutBuffer(sub, proto.data() + split, proto.size() - split,
+                            NULL) == proto.size() - split);
+    ASSERT(input->End());
+    ASSERT(status.ok());
+    decoder->GetStats(&stats);
+  }
+  upb_pbdecoderstats global_after;
+  upb::pb::Decoder::GetGlobalStats(&global_after);
+
+#ifdef UPB_PBDECODER_STATS
+  ASSERT(stats.tag_hits >= 1);
+  ASSERT(stats.dispatches >= 1);
+  ASSERT(stats.unknown_fields == 1);
+  ASSERT(stats.slow_varints >= 1);
+  ASSERT(stats.residual_saves == 1);
+  ASSERT(stats.residual_bytes == 1);
+  // Destroying the environment added the decoder's counters to the global
+  // ones.
+  ASSERT(global_after.unknown_fields - global_before.unknown_fields == 1);
+#else
+  const upb_pbdecoderstats zero = {0, 0, 0, 0, 0, 0, 0};
+  ASSERT(memcmp(&stats, &zero, sizeof(stats)) == 0);
+  ASSERT(memcmp(&global_after, &zero, sizeof(stats)) == 0);
+#endif
+}
+
+void test_skip_string() {
+  // Without a string handler, a string that runs past the end of the buffer
+  // is skipped whole: the long byte count covers the rest of the string, so
+  // the caller can pass NULL for it.
+  if (test_mode != NO_HANDLERS || global_method->is_native()) return;
+
+  string body(5000, 'x');
+  string proto = cat( tag(UPB_DESCRIPTOR_TYPE_STRING, UPB_WIRE_TYPE_DELIMITED),
+                      delim(body) );
+  size_t first = 1500;
+
+  upb::Status status;
+  upb::Environment env;
+  env.ReportErrorsTo(&status);
+  upb::Sink sink(global_handlers, &closures[0]);
+  upb::pb::Decoder* decoder = CreateDecoder(&env, global_method, &sink);
+  upb::BytesSink* input = decoder->input();
+  void* sub;
+  ASSERT(input->Start(proto.size(), &sub));
+  ASSERT(input->PutBuffer(sub, proto.data(), first, NULL) == proto.size());
+  ASSERT(input->PutBuffer(sub, NULL, proto.size() - first, NULL) ==
+         proto.size() - first);
+  ASSERT(input->End());
+  ASSERT(status.ok());
+}
+
+struct ScalarMsg {
+  uint8_t hasbits[2];
+  int32_t i32;
+  int64_t s64;
+  uint32_t f32;
+  double d;
+  bool b;
+  ScalarMsg* sub;
+};
+
+void* start_scalarsub(void* closure, const void* hd) {
+  UPB_UNUSED(hd);
+  return static_cast<ScalarMsg*>(closure)->sub;
+}
+
+void parse_scalars(const upb::pb::DecoderMethod* method, const string& proto,
+                   ScalarMsg* msg) {
+  upb::Status status;
+  upb::Environment env;
+  env.ReportErrorsTo(&status);
+  upb::Sink sink(method->dest_handlers(), msg);
+  upb::pb::Decoder* decoder = CreateDecoder(&env, method, &sink);
+  ASSERT(upb::BufferSource::PutBuffer(proto, decoder->input()));
+  ASSERT(status.ok());
+}
+
+void test_scalar_store(bool use_jit) {
+  // Handlers that only store into a struct are run by the decoder itself,
+  // without calling them; the result must be the same as if it did.
+  if (test_mode != ALL_HANDLERS) return;
+
+  upb::reffed_ptr<upb::MessageDef> md = upb::MessageDef::New();
+  ASSERT(md->set_full_name("ScalarMsg", NULL));
+  AddField(UPB_DESCRIPTOR_TYPE_INT32, "i32", 1, false, md.get());
+  AddField(UPB_DESCRIPTOR_TYPE_SINT64, "s64", 2, false, md.get());
+  AddField(UPB_DESCRIPTOR_TYPE_FIXED32, "f32", 3, false, md.get());
+  AddField(UPB_DESCRIPTOR_TYPE_DOUBLE, "d", 4, false, md.get());
+  AddField(UPB_DESCRIPTOR_TYPE_BOOL, "b", 5, false, md.get());
+  upb::reffed_ptr<upb::FieldDef> f = upb::FieldDef::New();
+  ASSERT(f->set_name("sub", NULL));
+  ASSERT(f->set_number(6, NULL));
+  f->set_descriptor_type(UPB_DESCRIPTOR_TYPE_MESSAGE);
+  ASSERT(f->set_message_subdef(md.get(), NULL));
+  ASSERT(md->AddField(f.get(), NULL));
+  ASSERT(md->Freeze(NULL));
+
+  upb::reffed_ptr<upb::Handlers> h(upb::Handlers::New(md.get()));
+  ASSERT(upb_msg_setscalarhandler(h.get(), md->FindFieldByNumber(1),
+                                  offsetof(ScalarMsg, i32), 1));
+  ASSERT(upb_msg_setscalarhandler(h.get(), md->FindFieldByNumber(2),
+                                  offsetof(ScalarMsg, s64), 2));
+  ASSERT(upb_msg_setscalarhandler(h.get(), md->FindFieldByNumber(3),
+                                  offsetof(ScalarMsg, f32), -1));
+  ASSERT(upb_msg_setscalarhandler(h.get(), md->FindFieldByNumber(4),
+                                  offsetof(ScalarMsg, d), 9));
+  ASSERT(upb_msg_setscalarhandler(h.get(), md->FindFieldByNumber(5),
+                                  offsetof(ScalarMsg, b), 10));
+  ASSERT(upb_handlers_setstartsubmsg(h.get(), md->FindFieldByNumber(6),
+                                     start_scalarsub, NULL));
+  ASSERT(h->SetSubHandlers(md->FindFieldByNumber(6), h.get()));
+  ASSERT(h->Freeze(NULL));
+
+  uint32_t f32 = 0xdeadbeef;
+  string proto = cat( tag(1, UPB_WIRE_TYPE_VARINT), varint(-7),
+                      tag(2, UPB_WIRE_TYPE_VARINT), zz64(-1234567890123LL),
+                      tag(3, UPB_WIRE_TYPE_32BIT), fixed32(&f32),
+                      tag(4, UPB_WIRE_TYPE_64BIT), dbl(2.5),
+                      tag(5, UPB_WIRE_TYPE_VARINT), varint(1),
+                      tag(6, UPB_WIRE_TYPE_DELIMITED),
+                      delim(cat( tag(1, UPB_WIRE_TYPE_VARINT), varint(99) )));
+
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method =
+      NewMethod(h.get(), use_jit);
+  ASSERT(method.get());
+
+  // The same checks again for code that went through serialization, which
+  // must be specialized anew when it is loaded.
+  upb::pb::DecoderMethodOptions opts(h.get());
+  upb::Arena arena;
+  size_t size;
+  char* buf = upb::pb::CodeCache::Serialize(opts, &arena, &size);
+  ASSERT(buf);
+  upb::pb::CodeCache cache;
+  cache.set_allow_jit(use_jit);
+  upb::Status status;
+  ASSERT(cache.Load(opts, buf, size, &status));
+  const upb::pb::DecoderMethod* methods[] = {
+    method.get(), cache.GetDecoderMethod(opts)
+  };
+
+  for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+    ScalarMsg sub;
+    ScalarMsg msg;
+    memset(&sub, 0, sizeof(sub));
+    memset(&msg, 0, sizeof(msg));
+    msg.sub = &sub;
+    parse_scalars(methods[i], proto, &msg);
+    ASSERT(msg.hasbits[0] == ((1 << 1) | (1 << 2)));
+    ASSERT(msg.hasbits[1] == ((1 << 1) | (1 << 2)));
+    ASSERT(msg.i32 == -7);
+    ASSERT(msg.s64 == -1234567890123LL);
+    ASSERT(msg.f32 == 0xdeadbeef);
+    ASSERT(msg.d == 2.5);
+    ASSERT(msg.b);
+    ASSERT(sub.hasbits[0] == (1 << 1));
+    ASSERT(sub.i32 == 99);
+    ASSERT(sub.s64 == 0);
+  }
+}
+
+void test_array_handlers() {
+  // With array handlers, packed runs go to them a chunk at a time.  The
+  // output must be the same, for every way of splitting the input.
+  if (test_mode != ALL_HANDLERS) return;
+
+  upb::reffed_ptr<const upb::Handlers> handlers =
+      NewHandlers(ALL_HANDLERS, true);
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method =
+      NewMethod(handlers.get(), true);
+  ASSERT(method.get());
+  // The JIT has no array op.
+  ASSERT(!method->is_native());
+
+  const upb::Handlers* saved_handlers = global_handlers;
+  const upb::pb::DecoderMethod* saved_method = global_method;
+  global_handlers = handlers.get();
+  global_method = method.get();
+  test_valid();
+
+  // A long run takes one call per chunk rather than one per value.
+  uint32_t fn = rep_fn(UPB_DESCRIPTOR_TYPE_INT32);
+  string values;
+  string expected = cat(LINE("<"), num2string(fn), LINE(":["));
+  for (int i = 0; i < 300; i++) {
+    values.append(varint(i * 1000));
+    appendf(&expected, "  %u:%d\n", fn, i * 1000);
+  }
+  expected.append(cat(LINE("]"), LINE(">")));
+  string proto = cat( tag(fn, UPB_WIRE_TYPE_DELIMITED), delim(values) );
+  run_decoder(proto, &expected);
+
+  VerboseParserEnvironment env(filter_hash != 0);
+  upb::Sink sink(global_handlers, &closures[0]);
+  upb::pb::Decoder* decoder = CreateDecoder(env.env(), global_method, &sink);
+  env.ResetBytesSink(decoder->input());
+  env.Reset(proto.data(), proto.size(), false, false);
+  output.clear();
+  array_calls = 0;
+  ASSERT(env.Start());
+  ASSERT(env.ParseBuffer(-1));
+  ASSERT(env.End());
+  ASSERT(output == expected);
+  // Values too near the end of the buffer to decode without a bounds check go
+  // one at a time.
+  ASSERT(array_calls < 10);
+
+  global_handlers = saved_handlers;
+  global_method = saved_method;
+}
+
 void run_tests(bool use_jit) {
   upb::reffed_ptr<const upb::pb::DecoderMethod> method;
   upb::reffed_ptr<const upb::Handlers> handlers;
@@ -1290,6 +1767,14 @@ void run_tests(bool use_jit) {
   test_valid();
 
   test_emptyhandlers(use_jit);
+  test_validate_utf8();
+  test_codecache();
+  test_serialized_code();
+  test_profile();
+  test_stats();
+  test_skip_string();
+  test_scalar_store(use_jit);
+  test_array_handlers();
 }
 
 void run_test_suite() {
@@ -40,11 +40,136 @@ void test_pb_roundtrip() {
   ASSERT(input == output);
 }
 
+void test_pb_measure() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::google::protobuf::FileDescriptorSet::get());
+  upb::reffed_ptr<const upb::Handlers> encoder_handlers(
+      upb::pb::Encoder::NewHandlers(md.get()));
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      upb::pb::DecoderMethod::New(
+          upb::pb::DecoderMethodOptions(encoder_handlers.get())));
+
+  upb::InlinedEnvironment<512> env;
+  std::string input = read_string("upb/descriptor/descriptor.pb");
+  std::string output;
+  upb::StringSink string_sink(&output);
+  upb::pb::Encoder* encoder =
+      upb::pb::Encoder::Create(&env, encoder_handlers.get(),
+                               string_sink.input());
+  upb::pb::Decoder* decoder =
+      upb::pb::Decoder::Create(&env, method.get(), encoder->input());
+
+  // The measuring pass writes nothing; the second pass streams the same
+  // bytes that buffering would have produced.
+  encoder->Measure();
+  ASSERT(upb::BufferSource::PutBuffer(input, decoder->input()));
+  ASSERT(output.empty());
+  decoder->Reset();
+  ASSERT(upb::BufferSource::PutBuffer(input, decoder->input()));
+  ASSERT(input == output);
+
+  // Afterwards the encoder buffers again.
+  output.clear();
+  decoder->Reset();
+  ASSERT(upb::BufferSource::PutBuffer(input, decoder->input()));
+  ASSERT(input == output);
+
+  // Streaming a different message than the one measured fails.
+  encoder->Measure();
+  decoder->Reset();
+  ASSERT(upb::BufferSource::PutBuffer(input, decoder->input()));
+  decoder->Reset();
+  ASSERT(!upb::BufferSource::PutBuffer(std::string(), decoder->input()));
+}
+
+// One encoder and decoder can be used for any number of messages, including
+// after one was abandoned halfway.
+void test_pb_reset() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::google::protobuf::FileDescriptorSet::get());
+  upb::reffed_ptr<const upb::Handlers> encoder_handlers(
+      upb::pb::Encoder::NewHandlers(md.get()));
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      upb::pb::DecoderMethod::New(
+          upb::pb::DecoderMethodOptions(encoder_handlers.get())));
+
+  upb::InlinedEnvironment<512> env;
+  std::string input = read_string("upb/descriptor/descriptor.pb");
+  std::string output;
+  upb::StringSink string_sink(&output);
+  upb::pb::Encoder* encoder =
+      upb::pb::Encoder::Create(&env, encoder_handlers.get(),
+                               string_sink.input());
+  upb::pb::Decoder* decoder =
+      upb::pb::Decoder::Create(&env, method.get(), encoder->input());
+  upb::BytesSink* sink = decoder->input();
+  void* subc;
+
+  ASSERT(upb::BufferSource::PutBuffer(input, sink));
+  ASSERT(input == output);
+  size_t allocated = upb_env_bytesallocated(&env);
+
+  // Stop in the middle of a submessage.
+  ASSERT(sink->Start(input.size(), &subc));
+  ASSERT(sink->PutBuffer(subc, input.data(), input.size() / 2, NULL));
+  decoder->Reset();
+  encoder->Reset();
+
+  output.clear();
+  ASSERT(upb::BufferSource::PutBuffer(input, sink));
+  ASSERT(input == output);
+  ASSERT(upb_env_bytesallocated(&env) == allocated);
+}
+
 extern "C" {
+void test_pb_arenastring() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::google::protobuf::FileDescriptorSet::get());
+  upb::reffed_ptr<const upb::Handlers> encoder_handlers(
+      upb::pb::Encoder::NewHandlers(md.get()));
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      upb::pb::DecoderMethod::New(
+          upb::pb::DecoderMethodOptions(encoder_handlers.get())));
+
+  upb::InlinedEnvironment<512> env;
+  upb::Arena arena;
+  std::string input = read_string("upb/descriptor/descriptor.pb");
+  upb::ArenaString output(&arena);
+  upb::StringSink string_sink(&output);
+  upb::pb::Encoder* encoder =
+      upb::pb::Encoder::Create(&env, encoder_handlers.get(),
+                               string_sink.input());
+  upb::pb::Decoder* decoder =
+      upb::pb::Decoder::Create(&env, method.get(), encoder->input());
+
+  for (int i = 0; i < 2; i++) {
+    bool ok = upb::BufferSource::PutBuffer(input, decoder->input());
+    ASSERT(ok);
+    ASSERT(output.size() == input.size());
+    ASSERT(memcmp(output.view().data, input.data(), input.size()) == 0);
+    ASSERT(output.ToString() == input);
+    decoder->Reset();
+    encoder->Reset();
+  }
+
+  // Appending grows the string within the arena.
+  upb::ArenaString str(&arena);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT(str.append("abc", 3));
+  }
+  ASSERT(str.size() == 3000);
+  ASSERT(memcmp(str.data() + 2997, "abc", 3) == 0);
+  str.clear();
+  ASSERT(str.empty());
+}
+
 int run_tests(int argc, char *argv[]) {
   UPB_UNUSED(argc);
   UPB_UNUSED(argv);
   test_pb_roundtrip();
+  test_pb_measure();
+  test_pb_reset();
+  test_pb_arenastring();
   return 0;
 }
 }
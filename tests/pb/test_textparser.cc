@@ -0,0 +1,254 @@
+/*
+ *
+ * Tests for the text-format parser.  Each message is parsed and printed
+ * again with upb::pb::TextPrinter in single-line mode, with the input split
+ * into two buffers at every possible seam.
+ */
+
+#include "tests/json/test.upbdefs.h"
+#include "tests/test_util.h"
+#include "tests/upb_test.h"
+#include "upb/handlers.h"
+#include "upb/pb/textparser.h"
+#include "upb/pb/textprinter.h"
+#include "upb/upb.h"
+
+#include <string>
+
+#define TEST(x)     x
+#define EXPECT_SAME NULL
+#define EXPECT(x)   x
+#define TEST_SENTINEL { NULL, NULL }
+
+struct TestCase {
+  const char* input;
+  const char* expected;
+};
+
+bool verbose = false;
+
+static TestCase kTestRoundtripMessages[] = {
+  {
+    TEST("optional_int32: -42 optional_string: \"Test\\001Message\" "
+         "optional_msg { foo: 42 } optional_bool: true "
+         "repeated_msg { foo: 1 } repeated_msg { foo: 2 } "),
+    EXPECT_SAME
+  },
+  // Separators, angle brackets, lists, comments, hex and octal.
+  {
+    TEST("optional_int32:-42;optional_msg<foo:42>,"
+         "repeated_int32:[1, 0x10,010] # A comment.\n"
+         "optional_enum: B\toptional_bool: t\n"),
+    EXPECT("optional_int32: -42 optional_msg { foo: 42 } "
+           "repeated_int32: 1 repeated_int32: 16 repeated_int32: 8 "
+           "optional_enum: B optional_bool: true ")
+  },
+  // Adjacent literals are one string.
+  {
+    TEST("optional_string: \"a\" 'b\"' # c\n \"\\x41\\u00e9\\n\\'\" "
+         "optional_bytes: '\\377\\0\\1x'"),
+    EXPECT("optional_string: \"ab\\\"A\xc3\xa9\\n\\'\" "
+           "optional_bytes: \"\\377\\000\\001x\" ")
+  },
+  {
+    TEST("optional_int64: -9223372036854775808 "
+         "optional_uint64: 9223372036854775807 "
+         "repeated_uint64: [0, 18446744073709551615] "
+         "repeated_uint32: 4294967295 "),
+    EXPECT("optional_int64: -9223372036854775808 "
+           "optional_uint64: 9223372036854775807 "
+           "repeated_uint64: 0 repeated_uint64: 18446744073709551615 "
+           "repeated_uint32: 4294967295 ")
+  },
+  // Repeated fields need not be adjacent.
+  {
+    TEST("repeated_int32: 1 optional_int32: 2 repeated_int32: 3 "
+         "repeated_enum: [A, 2] repeated_bool: [] "),
+    EXPECT("repeated_int32: 1 optional_int32: 2 repeated_int32: 3 "
+           "repeated_enum: A repeated_enum: C ")
+  },
+  {
+    TEST("map_string_string { key: \"a\" value: \"b\" } "
+         "map_int32_string [{key: -1 value: \"x\"}, <key:2>] "
+         "map_string_msg { key: \"k\" value { foo: 1 } } "),
+    EXPECT("map_string_string { key: \"a\" value: \"b\" } "
+           "map_int32_string { key: -1 value: \"x\" } "
+           "map_int32_string { key: 2 } "
+           "map_string_msg { key: \"k\" value { foo: 1 } } ")
+  },
+  {
+    TEST(""),
+    EXPECT_SAME
+  },
+  {
+    TEST("  # Only a comment"),
+    EXPECT("")
+  },
+  TEST_SENTINEL
+};
+
+static const char* kInvalidMessages[] = {
+  "no_such_field: 1",
+  "optional_int32: 2147483648",
+  "optional_int32: -2147483649",
+  "repeated_uint32: -1",
+  "optional_int32 1",
+  "optional_int32: \"1\"",
+  "optional_int32: [1]",
+  "optional_int32: 1x",
+  "optional_int32: - - 1",
+  "optional_bool: maybe",
+  "optional_enum: D",
+  "optional_string: 1",
+  "optional_string: \"abc",
+  "optional_string: \"\\q\"",
+  "optional_string: \"\\u12\"",
+  "optional_msg: 1",
+  "optional_msg { foo: 1",
+  "optional_msg { foo: 1 > ",
+  "optional_msg { } }",
+  "[upb.test.ext]: 1",
+  "optional_int32:",
+  NULL
+};
+
+class StringSink {
+ public:
+  StringSink() {
+    upb_byteshandler_init(&byteshandler_);
+    upb_byteshandler_setstring(&byteshandler_, &str_handler, NULL);
+    upb_bytessink_reset(&bytessink_, &byteshandler_, &s_);
+  }
+
+  upb_bytessink* Sink() { return &bytessink_; }
+
+  const std::string& Data() { return s_; }
+
+ private:
+  static size_t str_handler(void* _closure, const void* hd,
+                            const char* data, size_t len,
+                            const upb_bufhandle* handle) {
+    UPB_UNUSED(hd);
+    UPB_UNUSED(handle);
+    std::string* s = static_cast<std::string*>(_closure);
+    s->append(data, len);
+    return len;
+  }
+
+  upb_byteshandler byteshandler_;
+  upb_bytessink bytessink_;
+  std::string s_;
+};
+
+void test_textparser_message(const char* src, const char* expected,
+                             const upb::Handlers* print_handlers, int seam) {
+  VerboseParserEnvironment env(verbose);
+  StringSink data_sink;
+  upb::pb::TextPrinter* printer = upb::pb::TextPrinter::Create(
+      env.env(), print_handlers, data_sink.Sink());
+  printer->SetSingleLineMode(true);
+  upb::pb::TextParser* parser =
+      upb::pb::TextParser::Create(env.env(), printer->input());
+  env.ResetBytesSink(parser->input());
+  env.Reset(src, strlen(src), false, expected == NULL);
+
+  bool ok = env.Start() &&
+            env.ParseBuffer(seam) &&
+            env.ParseBuffer(-1) &&
+            env.End();
+
+  ASSERT(ok == (expected != NULL));
+  ASSERT(env.CheckConsistency());
+
+  if (expected && data_sink.Data() != expected) {
+    fprintf(stderr,
+            "Text parse/print roundtrip result differs:\n"
+            "Original:\n%s\nParsed/Printed:\n%s\n",
+            src, data_sink.Data().c_str());
+    abort();
+  }
+}
+
+void test_textparser() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb::reffed_ptr<const upb::Handlers> print_handlers(
+      upb::pb::TextPrinter::NewHandlers(md.get()));
+
+  for (const TestCase* test_case = kTestRoundtripMessages;
+       test_case->input != NULL; test_case++) {
+    const char *expected =
+        (test_case->expected == EXPECT_SAME) ?
+        test_case->input :
+        test_case->expected;
+
+    for (size_t i = 0; i <= strlen(test_case->input); i++) {
+      test_textparser_message(test_case->input, expected,
+                              print_handlers.get(), i);
+    }
+  }
+
+  for (const char** src = kInvalidMessages; *src != NULL; src++) {
+    for (size_t i = 0; i <= strlen(*src); i++) {
+      test_textparser_message(*src, NULL, print_handlers.get(), i);
+    }
+  }
+}
+
+static bool parse_text(upb::BytesSink* sink, const char* text, size_t len) {
+  void* subc;
+  return sink->Start(len, &subc) &&
+         sink->PutBuffer(subc, text, len, NULL) == len &&
+         sink->End();
+}
+
+// A parser can be reused for any number of messages, including after one was
+// abandoned halfway, without allocating again.
+void test_textparser_reset() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb::reffed_ptr<const upb::Handlers> print_handlers(
+      upb::pb::TextPrinter::NewHandlers(md.get()));
+  const char* text = kTestRoundtripMessages[0].input;
+  size_t len = strlen(text);
+
+  upb::InlinedEnvironment<16384> env;
+  StringSink data_sink;
+  upb::pb::TextPrinter* printer = upb::pb::TextPrinter::Create(
+      &env, print_handlers.get(), data_sink.Sink());
+  printer->SetSingleLineMode(true);
+  upb::pb::TextParser* parser =
+      upb::pb::TextParser::Create(&env, printer->input());
+  upb::BytesSink* sink = parser->input();
+  void* subc;
+
+  ASSERT(parse_text(sink, text, len));
+  ASSERT(data_sink.Data() == text);
+  size_t allocated = upb_env_bytesallocated(&env);
+
+  // A finished message leaves the parser ready for the next.
+  ASSERT(parse_text(sink, text, len));
+  ASSERT(data_sink.Data().substr(len) == text);
+
+  // Stop inside "optional_msg".
+  size_t n = strstr(text, "42 }") - text;
+  ASSERT(sink->Start(n, &subc));
+  ASSERT(sink->PutBuffer(subc, text, n, NULL) == n);
+  parser->Reset();
+  printer->Reset();
+
+  size_t start = data_sink.Data().size();
+  ASSERT(parse_text(sink, text, len));
+  ASSERT(data_sink.Data().substr(start) == text);
+  ASSERT(upb_env_bytesallocated(&env) == allocated);
+}
+
+extern "C" {
+int run_tests(int argc, char *argv[]) {
+  UPB_UNUSED(argc);
+  UPB_UNUSED(argv);
+  test_textparser();
+  test_textparser_reset();
+  return 0;
+}
+}
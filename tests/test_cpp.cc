@@ -1123,6 +1123,144 @@ void TestHandlerDataDestruction() {
   ASSERT(x == 0);
 }
 
+static void CountCleanup(void *ud) {
+  ++*static_cast<int*>(ud);
+}
+
+void TestArenaReset() {
+  upb::Arena arena;
+  int cleanups = 0;
+  arena.SetMaxRetained(1 << 20);
+  ASSERT(arena.AddCleanup(&CountCleanup, &cleanups));
+  for (int i = 0; i < 100; i++) {
+    ASSERT(upb_malloc(arena.allocator(), 1000));
+  }
+  arena.Reset();
+  ASSERT(cleanups == 1);
+  ASSERT(arena.BytesAllocated() == 0);
+  ASSERT(arena.BytesFreed() == 0);
+  size_t retained = arena.BytesRetained();
+  ASSERT(retained > 100 * 1000);
+
+  /* Allocations are now served from the retained blocks. */
+  for (int i = 0; i < 100; i++) {
+    ASSERT(upb_malloc(arena.allocator(), 1000));
+  }
+  ASSERT(arena.BytesRetained() < retained);
+
+  /* With no cap, Reset() returns every block. */
+  arena.SetMaxRetained(0);
+  arena.Reset();
+  ASSERT(cleanups == 1);
+  ASSERT(arena.BytesRetained() == 0);
+  ASSERT(arena.BytesFreed() > 0);
+}
+
+static int allocs = 0;
+
+static void *CountingAlloc(upb_alloc *alloc, void *ptr, size_t oldsize,
+                           size_t size) {
+  if (size > 0) allocs++;
+  return upb_alloc_global.func(alloc, ptr, oldsize, size);
+}
+
+void TestArenaRealloc() {
+  upb::Arena arena;
+  upb::Allocator* alloc = arena.allocator();
+  char* p = static_cast<char*>(upb_malloc(alloc, 16));
+  memset(p, 'x', 16);
+
+  /* Growing the last allocation happens in place while there is room. */
+  char* p2 = static_cast<char*>(upb_realloc(alloc, p, 16, 64));
+  ASSERT(p2 == p);
+  ASSERT(p2[15] == 'x');
+  ASSERT(arena.BytesAllocated() == 64);
+
+  /* After another allocation it must move, preserving the contents. */
+  ASSERT(upb_malloc(alloc, 16));
+  char* p3 = static_cast<char*>(upb_realloc(alloc, p2, 64, 128));
+  ASSERT(p3 != p2);
+  ASSERT(p3[15] == 'x');
+}
+
+void TestArenaFuse() {
+  upb::Allocator counting;
+  counting.func = &CountingAlloc;
+  upb::ArenaPool pool(&counting);
+  int cleanups = 0;
+  {
+    upb::Arena arena(NULL, 0, pool.allocator());
+    char *str;
+    {
+      upb::Arena temp(NULL, 0, pool.allocator());
+      str = static_cast<char*>(upb_malloc(temp.allocator(), 10000));
+      ASSERT(str);
+      strcpy(str, "fused");
+      ASSERT(temp.AddCleanup(&CountCleanup, &cleanups));
+      ASSERT(arena.Fuse(&temp));
+      ASSERT(temp.BytesAllocated() == 0);
+    }
+    ASSERT(cleanups == 0);
+    ASSERT(strcmp(str, "fused") == 0);
+
+    /* Arenas with a different block allocator cannot be fused. */
+    upb::Arena other;
+    ASSERT(!arena.Fuse(&other));
+  }
+  ASSERT(cleanups == 1);
+
+  /* The next arena reuses the blocks returned to the pool. */
+  int before = allocs;
+  {
+    upb::Arena arena(NULL, 0, pool.allocator());
+    ASSERT(upb_malloc(arena.allocator(), 10000));
+  }
+  ASSERT(allocs == before);
+}
+
+void TestHugePool() {
+  upb::Allocator counting;
+  counting.func = &CountingAlloc;
+  upb::HugePool pool(&counting);
+  int before = allocs;
+  {
+    upb::Arena arena(NULL, 0, pool.allocator());
+    arena.SetNextBlockSize(UPB_HUGEPOOL_ARENABLOCK);
+    arena.SetMaxBlockSize(UPB_HUGEPOOL_ARENABLOCK);
+    char* p = static_cast<char*>(upb_malloc(arena.allocator(), 1000000));
+    ASSERT(p);
+    memset(p, 'x', 1000000);
+    ASSERT(upb_malloc(arena.allocator(), 1000000));
+  }
+#ifdef __linux__
+  /* Each arena block filled exactly one huge page, now cached for reuse. */
+  ASSERT(allocs == before);
+  ASSERT(pool.BytesMapped() == UPB_HUGEPAGE_SIZE);
+  ASSERT(pool.BytesCached() == UPB_HUGEPAGE_SIZE);
+
+  /* Larger requests take several pages, which are unmapped when freed. */
+  void* big = upb_malloc(pool.allocator(), 3 * UPB_HUGEPAGE_SIZE);
+  ASSERT(big);
+  ASSERT(pool.BytesMapped() == 5 * UPB_HUGEPAGE_SIZE);
+  upb_free(pool.allocator(), big);
+  ASSERT(pool.BytesMapped() == UPB_HUGEPAGE_SIZE);
+#endif
+
+  /* Small requests go to the fallback allocator. */
+  before = allocs;
+  void* small = upb_malloc(pool.allocator(), 100);
+  ASSERT(small);
+  ASSERT(allocs == before + 1);
+  upb_free(pool.allocator(), small);
+
+  pool.SetMaxCached(0);
+  {
+    upb::Arena arena(NULL, 0, pool.allocator());
+    arena.SetNextBlockSize(UPB_HUGEPOOL_ARENABLOCK);
+    ASSERT(upb_malloc(arena.allocator(), 100));
+  }
+}
+
 void TestOneofs() {
   upb::Status status;
   upb::reffed_ptr<upb::MessageDef> md(upb::MessageDef::New());
@@ -1278,6 +1416,11 @@ int run_tests(int argc, char *argv[]) {
 
   TestOneofs();
 
+  TestArenaReset();
+  TestArenaRealloc();
+  TestArenaFuse();
+  TestHugePool();
+
   return 0;
 }
 
@@ -233,6 +233,51 @@ static void test_replacement_fails() {
   upb_symtab_free(s);
 }
 
+static void test_addfiles() {
+  upb_status s = UPB_STATUS_INIT;
+  upb_filedef *files[2];
+  upb_msgdef *m1;
+  upb_msgdef *m2;
+  upb_fielddef *f;
+  const upb_msgdef *m;
+
+  upb_symtab *symtab = upb_symtab_new();
+  ASSERT(symtab);
+
+  /* files[0] is "b.proto", whose message B refers to message A from
+   * files[1], "a.proto".  Files added together may come in any order. */
+  files[0] = upb_filedef_new(&files);
+  files[1] = upb_filedef_new(&files);
+  ASSERT_STATUS(upb_filedef_setname(files[0], "b.proto", &s), &s);
+  ASSERT_STATUS(upb_filedef_setname(files[1], "a.proto", &s), &s);
+
+  m1 = upb_msgdef_newnamed("A", &m1);
+  ASSERT_STATUS(upb_filedef_addmsg(files[1], m1, &m1, &s), &s);
+
+  m2 = upb_msgdef_newnamed("B", &m2);
+  f = upb_fielddef_new(&f);
+  ASSERT_STATUS(upb_fielddef_setname(f, "a", &s), &s);
+  ASSERT_STATUS(upb_fielddef_setnumber(f, 1, &s), &s);
+  upb_fielddef_setlabel(f, UPB_LABEL_OPTIONAL);
+  upb_fielddef_settype(f, UPB_TYPE_MESSAGE);
+  ASSERT_STATUS(upb_fielddef_setsubdefname(f, ".A", &s), &s);
+  ASSERT_STATUS(upb_msgdef_addfield(m2, f, &f, &s), &s);
+  ASSERT_STATUS(upb_filedef_addmsg(files[0], m2, &m2, &s), &s);
+
+  ASSERT_STATUS(upb_symtab_addfiles(symtab, files, 2, &s), &s);
+  ASSERT(upb_filedef_isfrozen(files[0]));
+  ASSERT(upb_filedef_isfrozen(files[1]));
+
+  m = upb_symtab_lookupmsg(symtab, "B");
+  ASSERT(m);
+  ASSERT(upb_fielddef_msgsubdef(upb_msgdef_itof(m, 1)) ==
+         upb_symtab_lookupmsg(symtab, "A"));
+
+  upb_filedef_unref(files[0], &files);
+  upb_filedef_unref(files[1], &files);
+  upb_symtab_free(symtab);
+}
+
 static void test_freeze_free() {
   bool ok;
 
@@ -443,6 +488,7 @@ int run_tests(int argc, char *argv[]) {
   test_fielddef();
   test_fielddef_unref();
   test_replacement_fails();
+  test_addfiles();
   test_freeze_free();
   test_partial_freeze();
   test_noreftracking();
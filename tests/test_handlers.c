@@ -1,5 +1,6 @@
 
 #include "upb/handlers.h"
+#include "upb/sink.h"
 #include "upb/descriptor/descriptor.upbdefs.h"
 #include "upb_test.h"
 #include <stdlib.h>
@@ -33,9 +34,107 @@ static void test_error() {
   upb_handlers_unref(h, &h);
 }
 
+static int callbacks;
+
+static void sethandlers(const void *closure, upb_handlers *h) {
+  ASSERT(closure == &callbacks);
+  callbacks++;
+  upb_handlers_setstartmsg(h, &startmsg, NULL);
+}
+
+static void test_cache() {
+  const upb_msgdef *m = upbdefs_google_protobuf_DescriptorProto_get(&m);
+  const upb_msgdef *field_m =
+      upbdefs_google_protobuf_FieldDescriptorProto_get(&field_m);
+  const upb_fielddef *f = upb_msgdef_ntofz(m, "field");
+  upb_handlercache *cache = upb_handlercache_new(&sethandlers, &callbacks);
+  const upb_handlers *h;
+  int built;
+
+  h = upb_handlercache_get(cache, m);
+  ASSERT(h);
+  ASSERT(upb_handlers_isfrozen(h));
+  ASSERT(upb_handlers_msgdef(h) == m);
+  built = callbacks;
+  ASSERT(built > 0);
+
+  /* Both the handlers asked for and the ones they reach are served from the
+   * cache without calling back again. */
+  ASSERT(upb_handlercache_get(cache, m) == h);
+  ASSERT(upb_handlercache_get(cache, field_m) ==
+         upb_handlers_getsubhandlers(h, f));
+  ASSERT(callbacks == built);
+
+  upb_handlercache_free(cache);
+  upb_msgdef_unref(field_m, &field_m);
+  upb_msgdef_unref(m, &m);
+}
+
+static int32_t array_sum;
+static size_t array_calls;
+
+static bool putarray(void *c, const void *hd, const int32_t *vals, size_t n) {
+  size_t i;
+  ASSERT(c == &array_calls);
+  ASSERT(hd == NULL);
+  array_calls++;
+  for (i = 0; i < n; i++) {
+    array_sum += vals[i];
+  }
+  return true;
+}
+
+static bool putint32(void *c, const void *hd, int32_t val) {
+  UPB_UNUSED(c);
+  UPB_UNUSED(hd);
+  UPB_UNUSED(val);
+  return true;
+}
+
+static void test_array() {
+  const upb_msgdef *m = upbdefs_google_protobuf_FileDescriptorProto_get(&m);
+  const upb_fielddef *public_dep = upb_msgdef_ntofz(m, "public_dependency");
+  const upb_fielddef *weak_dep = upb_msgdef_ntofz(m, "weak_dependency");
+  const upb_fielddef *name = upb_msgdef_ntofz(m, "name");
+  upb_handlers *h = upb_handlers_new(m, &h);
+  upb_selector_t sel;
+  upb_sink sink;
+  upb_msgdef_unref(m, &m);
+
+  /* Array handlers only exist for repeated primitive fields of their type. */
+  ASSERT(!upb_handlers_getselector(public_dep, UPB_HANDLER_INT64ARRAY, &sel));
+  ASSERT(!upb_handlers_setint32array(h, name, &putarray, NULL));
+  upb_handlers_clearerr(h);
+
+  /* On its own, an array handler also receives single values. */
+  ASSERT(upb_handlers_setint32array(h, public_dep, &putarray, NULL));
+  ASSERT(upb_handlers_getselector(public_dep, UPB_HANDLER_INT32ARRAY, &sel));
+  ASSERT(upb_handlers_gethandler(h, sel) == (upb_func*)&putarray);
+  ASSERT(upb_handlers_getselector(public_dep, UPB_HANDLER_INT32, &sel));
+  ASSERT(upb_handlers_gethandler(h, sel) != NULL);
+
+  /* A value handler of its own replaces the one that forwards. */
+  ASSERT(upb_handlers_setint32array(h, weak_dep, &putarray, NULL));
+  ASSERT(upb_handlers_setint32(h, weak_dep, &putint32, NULL));
+  ASSERT(upb_handlers_getselector(weak_dep, UPB_HANDLER_INT32, &sel));
+  ASSERT(upb_handlers_gethandler(h, sel) == (upb_func*)&putint32);
+  ASSERT(upb_handlers_freeze(&h, 1, NULL));
+
+  upb_sink_reset(&sink, h, &array_calls);
+  ASSERT(upb_handlers_getselector(public_dep, UPB_HANDLER_INT32, &sel));
+  ASSERT(upb_sink_putint32(&sink, sel, 5));
+  ASSERT(upb_sink_putint32(&sink, sel, 7));
+  ASSERT(array_calls == 2);
+  ASSERT(array_sum == 12);
+
+  upb_handlers_unref(h, &h);
+}
+
 int run_tests(int argc, char *argv[]) {
   UPB_UNUSED(argc);
   UPB_UNUSED(argv);
   test_error();
+  test_cache();
+  test_array();
   return 0;
 }
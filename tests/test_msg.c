@@ -0,0 +1,1895 @@
+/*
+** Tests of upb_msg and of upb_decode()/upb_encode(), on layouts built from
+** tests/test_msg.proto by upb_msgfactory.
+*/
+
+#include "google/protobuf/descriptor.upb.h"
+#include "tests/test_util.h"
+#include "upb/decode.h"
+#include "upb/encode.h"
+#include "upb/json/decode.h"
+#include "upb/msgfactory.h"
+#include "upb/pb/delimited.h"
+#include "upb/pb/glue.h"
+#include "upb/structs.int.h"
+#include "upb_test.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static upb_symtab *symtab;
+static upb_msgfactory *factory;
+
+static const upb_msgdef *node_md;
+static const upb_msglayout *node_l;
+static const upb_msgdef *req_md;
+static const upb_msglayout *req_l;
+
+/* Input with embedded NULs, as a buffer and its length. */
+#define BUF(s) upb_stringview_make(s, sizeof(s) - 1)
+
+static void load_test_proto() {
+  upb_status status = UPB_STATUS_INIT;
+  size_t len;
+  char *data = upb_readfile("tests/test_msg.proto.pb", &len);
+  upb_filedef **files, **files_ptr;
+  ASSERT(data);
+  files = upb_loaddescriptor(data, len, &files, &status);
+  ASSERT(files);
+  free(data);
+
+  symtab = upb_symtab_new();
+  for (files_ptr = files; *files_ptr; files_ptr++) {
+    bool ok = upb_symtab_addfile(symtab, *files_ptr, &status);
+    ASSERT_STATUS(ok, &status);
+    upb_filedef_unref(*files_ptr, &files);
+  }
+  upb_gfree(files);
+
+  factory = upb_msgfactory_new(symtab);
+  node_md = upb_symtab_lookupmsg(symtab, "upb_test.Node");
+  ASSERT(node_md);
+  ASSERT(upb_msgfactory_setextendable(factory, node_md));
+  node_l = upb_msgfactory_getlayout(factory, node_md);
+  ASSERT(node_l);
+  req_md = upb_symtab_lookupmsg(symtab, "upb_test.Required");
+  ASSERT(req_md);
+  req_l = upb_msgfactory_getlayout(factory, req_md);
+  ASSERT(req_l);
+}
+
+/* Returns the index of field |name| of |m|, for upb_msg_get(). */
+static int field(const upb_msgdef *m, const char *name) {
+  const upb_fielddef *f = upb_msgdef_ntofz(m, name);
+  ASSERT(f);
+  return upb_fielddef_index(f);
+}
+
+/* Encodes |msg| and checks that it comes out as |expected|. */
+static void check_encode(const upb_msg *msg, const upb_msglayout *l,
+                         upb_stringview expected, upb_arena *arena) {
+  size_t size;
+  char *buf = upb_encode(msg, l, arena, &size);
+  ASSERT(buf);
+  ASSERT(size == expected.size);
+  ASSERT(memcmp(buf, expected.data, size) == 0);
+}
+
+static void test_unknown_group() {
+  /* Field 100 is not in Node, so its groups are kept as unknown fields. */
+  static const char group[] = "\xa3\x06\xa4\x06";
+  static const char nested[] = "\xa3\x06\x08\x01\xa3\x06\xa4\x06\xa4\x06";
+  static const char in_child[] = "\x1a\x04\xa3\x06\xa4\x06";
+  upb_arena arena;
+  upb_msg *msg;
+  upb_msg *child;
+
+  upb_arena_init(&arena);
+
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(group), msg, node_l));
+  ASSERT(upb_msg_unknownsize(msg) == 4);
+  check_encode(msg, node_l, BUF(group), &arena);
+
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode2(BUF(nested), msg, node_l, UPB_DECODE_COPYSTRINGS));
+  ASSERT(upb_msg_unknownsize(msg) == 10);
+  check_encode(msg, node_l, BUF(nested), &arena);
+
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(in_child), msg, node_l));
+  child = (upb_msg*)upb_msg_get(msg, field(node_md, "child"), node_l).msg;
+  ASSERT(child);
+  ASSERT(upb_msg_unknownsize(child) == 4);
+  check_encode(msg, node_l, BUF(in_child), &arena);
+
+  /* A group that ends with the wrong number. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\xa3\x06\xac\x06"), msg, node_l));
+
+  upb_arena_uninit(&arena);
+}
+
+static void test_end_group() {
+  static const char group[] = "\x2b\x3a\x02\x08\x02\x30\x01\x2c";
+  upb_arena arena;
+  upb_msg *msg;
+
+  upb_arena_init(&arena);
+
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(group), msg, node_l));
+  check_encode(msg, node_l, BUF(group), &arena);
+
+  /* Field 0 is never valid, not even to end a group. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\x04\xff\xff\xff"), msg, node_l));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\x1a\x01\x04"), msg, node_l));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\x2b\x04\x2c"), msg, node_l));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\xa3\x06\x04\xa4\x06"), msg, node_l));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\xa3\x06\x03\x04\xa4\x06"), msg, node_l));
+
+  /* A group's end doesn't end a message inside it. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\x2b\x3a\x01\x2c\x2c"), msg, node_l));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\x2b\x3a\x02\xa4\x06\x2c"), msg, node_l));
+
+  upb_arena_uninit(&arena);
+}
+
+/* Looks up string key |key| in map field "counts", which must hold it. */
+static int32_t get_count(const upb_msg *msg, const char *key) {
+  const upb_map *map =
+      upb_msg_get(msg, field(node_md, "counts"), node_l).map;
+  upb_msgval val;
+  ASSERT(map);
+  ASSERT(upb_map_get(map, upb_msgval_makestr(key, strlen(key)), &val));
+  return val.i32;
+}
+
+static void test_map_entry() {
+  /* The entry's key is the last byte of the buffer, which the decoder
+   * aliases; the map must not read past it. */
+  static const char at_end[] = "\x42\x05\x10\x07\x0a\x01\x61";
+  char *buf = malloc(sizeof(at_end) - 1);
+  upb_arena arena;
+  upb_msg *msg;
+
+  upb_arena_init(&arena);
+
+  /* An entry with no key has key "". */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF("\x42\x02\x10\x03"), msg, node_l));
+  ASSERT(get_count(msg, "") == 3);
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF("\x42\x00"), msg, node_l));
+  ASSERT(get_count(msg, "") == 0);
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF("\x42\x04\x0a\x00\x10\x05"), msg, node_l));
+  ASSERT(get_count(msg, "") == 5);
+
+  ASSERT(buf);
+  memcpy(buf, at_end, sizeof(at_end) - 1);
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(upb_stringview_make(buf, sizeof(at_end) - 1), msg,
+                    node_l));
+  ASSERT(get_count(msg, "a") == 7);
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode2(upb_stringview_make(buf, sizeof(at_end) - 1), msg,
+                     node_l, UPB_DECODE_COPYSTRINGS));
+  free(buf);
+  ASSERT(get_count(msg, "a") == 7);
+
+  /* Entries are not groups, and field 0 is invalid in them too. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\x42\x01\x04"), msg, node_l));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\x42\x03\x0c\x10\x01"), msg, node_l));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(BUF("\x42\x02\x00\x01"), msg, node_l));
+
+  upb_arena_uninit(&arena);
+}
+
+/* A Node using every kind of field, and some unknown ones. */
+static const char node_pb[] =
+    "\x08\x96\x01"                          /* id */
+    "\x12\x03\x61\x62\x63"                    /* name */
+    "\x1a\x09\x08\x01\x12\x01\x78\x1a\x02\x08\x07" /* child */
+    "\x22\x02\x08\x02\x22\x00"                /* children */
+    "\x2b\x3a\x02\x08\x04\x30\x03\x2c"          /* group */
+    "\x42\x05\x0a\x01\x6b\x10\x09"              /* counts */
+    "\x4a\x06\x08\x05\x12\x02\x08\x06"          /* nodes */
+    "\x52\x02\x01\x02"                        /* nums */
+    "\xa3\x06\x08\x01\xa4\x06\xf8\x06\x07";     /* unknown */
+
+/* Feeds |buf| to a new upb_decodestream for |msg|, which has layout |l|,
+ * |chunk| bytes at a time, and returns how the stream ended. */
+static upb_decodestatus stream2(upb_msg *msg, const upb_msglayout *l,
+                                int options, upb_stringview buf, size_t chunk,
+                                bool known_size) {
+  upb_decodestream *s = upb_decodestream_new(
+      msg, l, NULL, options, known_size ? buf.size : UPB_DECODE_UNKNOWNSIZE);
+  upb_decodestatus status = UPB_DECODE_NEEDMORE;
+  size_t ofs;
+
+  ASSERT(s);
+  for (ofs = 0; ofs < buf.size && status == UPB_DECODE_NEEDMORE;
+       ofs += chunk) {
+    size_t n = UPB_MIN(chunk, buf.size - ofs);
+    size_t consumed;
+    status = upb_decodestream_put(s, buf.data + ofs, n, &consumed);
+    ASSERT(status == UPB_DECODE_ERROR || consumed == n);
+  }
+
+  if (status == UPB_DECODE_NEEDMORE) status = upb_decodestream_end(s);
+  return status;
+}
+
+static upb_decodestatus stream(upb_msg *msg, upb_stringview buf,
+                               size_t chunk, bool known_size) {
+  return stream2(msg, node_l, 0, buf, chunk, known_size);
+}
+
+static void test_decodestream() {
+  upb_arena arena;
+  upb_msg *whole;
+  size_t size;
+  char *expected;
+  size_t chunk;
+
+  upb_arena_init(&arena);
+
+  whole = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(node_pb), whole, node_l));
+  expected = upb_encode(whole, node_l, &arena, &size);
+  ASSERT(expected);
+  ASSERT(size == sizeof(node_pb) - 1);
+
+  /* However the input is split, the stream decodes what upb_decode() does. */
+  for (chunk = 1; chunk <= sizeof(node_pb) - 1; chunk++) {
+    upb_msg *msg = upb_msg_new(node_l, &arena);
+    ASSERT(stream(msg, BUF(node_pb), chunk, true) == UPB_DECODE_DONE);
+    ASSERT(upb_msg_equal(msg, whole, node_l));
+    check_encode(msg, node_l, upb_stringview_make(expected, size), &arena);
+
+    msg = upb_msg_new(node_l, &arena);
+    ASSERT(stream(msg, BUF(node_pb), chunk, false) == UPB_DECODE_DONE);
+    check_encode(msg, node_l, upb_stringview_make(expected, size), &arena);
+  }
+
+  /* Malformed tags fail however they arrive. */
+  for (chunk = 1; chunk <= 3; chunk++) {
+    upb_msg *msg = upb_msg_new(node_l, &arena);
+    ASSERT(stream(msg, BUF("\x04\x28\x01"), chunk, false) ==
+           UPB_DECODE_ERROR);
+    msg = upb_msg_new(node_l, &arena);
+    ASSERT(stream(msg, BUF("\x00\x01"), chunk, false) == UPB_DECODE_ERROR);
+    msg = upb_msg_new(node_l, &arena);
+    ASSERT(stream(msg, BUF("\x2c\x08\x01"), chunk, false) ==
+           UPB_DECODE_ERROR);
+    msg = upb_msg_new(node_l, &arena);
+    ASSERT(stream(msg, BUF("\x1a\x01\x04"), chunk, false) ==
+           UPB_DECODE_ERROR);
+    msg = upb_msg_new(node_l, &arena);
+    ASSERT(stream(msg, BUF("\x2b\x04\x2c"), chunk, false) ==
+           UPB_DECODE_ERROR);
+    msg = upb_msg_new(node_l, &arena);
+    ASSERT(stream(msg, BUF("\x2b\x3a\x01\x2c\x2c"), chunk, false) ==
+           UPB_DECODE_ERROR);
+    msg = upb_msg_new(node_l, &arena);
+    ASSERT(stream(msg, BUF("\x2b\x2c\x2c"), chunk, false) ==
+           UPB_DECODE_ERROR);
+  }
+
+  upb_arena_uninit(&arena);
+}
+
+/* Writes a Node |depth| levels deep, each level but the last holding the
+ * next in its child field, at the end of the |size| bytes at |buf|. */
+static upb_stringview nested_children(char *buf, size_t size, int depth) {
+  char *p = buf + size;
+  int i;
+
+  for (i = 1; i < depth; i++) {
+    size_t len = buf + size - p;
+    char varint[10];
+    int n = 0;
+
+    do {
+      varint[n++] = (len & 0x7f) | (len > 0x7f ? 0x80 : 0);
+      len >>= 7;
+    } while (len);
+
+    ASSERT(p - buf >= n + 1);
+    p -= n;
+    memcpy(p, varint, n);
+    *--p = 0x1a;
+  }
+
+  return upb_stringview_make(p, buf + size - p);
+}
+
+/* Writes a Node holding unknown group 100 nested |groups| deep. */
+static upb_stringview nested_groups(char *buf, size_t size, int groups) {
+  int i;
+  ASSERT(size >= (size_t)groups * 4);
+  for (i = 0; i < groups; i++) {
+    memcpy(buf + i * 2, "\xa3\x06", 2);
+    memcpy(buf + (groups + i) * 2, "\xa4\x06", 2);
+  }
+  return upb_stringview_make(buf, groups * 4);
+}
+
+/* Follows the child fields of |msg| down |levels| times.  Returns false if a
+ * lazy child fails to parse on the way. */
+static bool walk_children(const upb_msg *msg, int levels) {
+  int child = field(node_md, "child");
+  int i;
+
+  for (i = 0; i < levels; i++) {
+    ASSERT(upb_msg_has(msg, child, node_l));
+    msg = upb_msg_get(msg, child, node_l).msg;
+    if (!msg) return false;
+  }
+
+  return true;
+}
+
+static void test_nesting_limit() {
+  /* The limit counts the top-level message as the first level. */
+  const int max = UPB_DECODE_MAX_NESTING;
+  static char buf[1024];
+  upb_arena arena;
+  upb_msg *msg;
+
+  upb_arena_init(&arena);
+
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(nested_children(buf, sizeof(buf), max), msg, node_l));
+  ASSERT(walk_children(msg, max - 1));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(nested_children(buf, sizeof(buf), max + 1), msg,
+                     node_l));
+
+  /* Unknown groups take a level each as well. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(nested_groups(buf, sizeof(buf), max - 1), msg, node_l));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode(nested_groups(buf, sizeof(buf), max), msg, node_l));
+
+  /* Lazy submessages are held to what was left of the limit when they were
+   * skipped over. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode2(nested_children(buf, sizeof(buf), max), msg, node_l,
+                     UPB_DECODE_LAZY));
+  ASSERT(walk_children(msg, max - 1));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode2(nested_children(buf, sizeof(buf), max + 1), msg, node_l,
+                     UPB_DECODE_LAZY));
+  ASSERT(!walk_children(msg, max));
+
+  /* Other limits, including ones whose frames don't fit on the C stack. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode_withmaxnesting(nested_children(buf, sizeof(buf), 10),
+                                   msg, node_l, NULL, 0, 10));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode_withmaxnesting(nested_children(buf, sizeof(buf), 11),
+                                    msg, node_l, NULL, 0, 10));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode_withmaxnesting(nested_children(buf, sizeof(buf), 200),
+                                   msg, node_l, NULL, 0, 200));
+  ASSERT(walk_children(msg, 199));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode_withmaxnesting(nested_children(buf, sizeof(buf), 201),
+                                    msg, node_l, NULL, 0, 200));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode_withmaxnesting(nested_groups(buf, sizeof(buf), 199),
+                                   msg, node_l, NULL, 0, 200));
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(!upb_decode_withmaxnesting(nested_groups(buf, sizeof(buf), 200),
+                                    msg, node_l, NULL, 0, 200));
+
+  /* upb_decodestream has the same limit. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(stream(msg, nested_children(buf, sizeof(buf), max), 7, false) ==
+         UPB_DECODE_DONE);
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(stream(msg, nested_children(buf, sizeof(buf), max + 1), 7, false) ==
+         UPB_DECODE_ERROR);
+
+  upb_arena_uninit(&arena);
+}
+
+/* Decodes |buf| as a Required with UPB_DECODE_CHECKREQUIRED.  Returns the
+ * number of the missing field the status gives, 0 if the decode succeeded,
+ * or -1 if it failed for another reason. */
+static int check_required(upb_stringview buf, int options) {
+  upb_arena arena;
+  upb_status status = UPB_STATUS_INIT;
+  upb_msg *msg;
+  unsigned missing;
+  int ret = 0;
+
+  upb_arena_init(&arena);
+  msg = upb_msg_new(req_l, &arena);
+  if (!upb_decode_withstatus(buf, msg, req_l,
+                             options | UPB_DECODE_CHECKREQUIRED, &status)) {
+    ASSERT(!upb_ok(&status));
+    ret = sscanf(upb_status_errmsg(&status), "Missing required field %u",
+                 &missing) == 1 ? (int)missing : -1;
+  }
+  upb_arena_uninit(&arena);
+  return ret;
+}
+
+static void test_check_required() {
+  int lazy = UPB_DECODE_LAZY | UPB_DECODE_CHECKREQUIRED;
+  upb_arena arena;
+  upb_msg *msg;
+  size_t chunk;
+
+  ASSERT(check_required(BUF("\x08\x01"), 0) == 0);
+  ASSERT(check_required(BUF("\x08\x01\x12\x02\x08\x02"), 0) == 0);
+  ASSERT(check_required(BUF("\x08\x01\x1b\x20\x05\x1c"), 0) == 0);
+
+  /* At the top level, in a submessage, and in a group. */
+  ASSERT(check_required(BUF(""), 0) == 1);
+  ASSERT(check_required(BUF("\x28\x01"), 0) == 1);
+  ASSERT(check_required(BUF("\x08\x01\x12\x00"), 0) == 1);
+  ASSERT(check_required(BUF("\x08\x01\x12\x02\x28\x01"), 0) == 1);
+  ASSERT(check_required(BUF("\x08\x01\x1b\x1c"), 0) == 4);
+  ASSERT(check_required(BUF("\x08\x01\x12\x04\x08\x01\x1b\x1c"), 0) ==
+         4);
+  ASSERT(check_required(BUF("\x08\x01\x12\x01"), 0) == -1);
+
+  upb_arena_init(&arena);
+
+  /* Without the option nothing is checked. */
+  msg = upb_msg_new(req_l, &arena);
+  ASSERT(upb_decode(BUF("\x12\x00\x1b\x1c"), msg, req_l));
+
+  /* Lazy submessages are checked when they are parsed. */
+  msg = upb_msg_new(req_l, &arena);
+  ASSERT(upb_decode2(BUF("\x08\x01\x12\x00"), msg, req_l, lazy));
+  ASSERT(!upb_msg_get(msg, upb_fielddef_index(upb_msgdef_itof(req_md, 2)),
+                      req_l).msg);
+  msg = upb_msg_new(req_l, &arena);
+  ASSERT(upb_decode2(BUF("\x08\x01\x12\x02\x08\x02"), msg, req_l, lazy));
+  ASSERT(upb_msg_get(msg, upb_fielddef_index(upb_msgdef_itof(req_md, 2)),
+                     req_l).msg);
+
+  /* upb_decodestream checks too, however the input is split. */
+  for (chunk = 1; chunk <= 4; chunk++) {
+    int opts = UPB_DECODE_CHECKREQUIRED;
+    msg = upb_msg_new(req_l, &arena);
+    ASSERT(stream2(msg, req_l, opts, BUF("\x08\x01\x12\x02\x08\x02"),
+                   chunk, false) == UPB_DECODE_DONE);
+    msg = upb_msg_new(req_l, &arena);
+    ASSERT(stream2(msg, req_l, opts, BUF("\x28\x01"), chunk, false) ==
+           UPB_DECODE_ERROR);
+    msg = upb_msg_new(req_l, &arena);
+    ASSERT(stream2(msg, req_l, opts, BUF("\x08\x01\x12\x02\x28\x01"),
+                   chunk, true) == UPB_DECODE_ERROR);
+    msg = upb_msg_new(req_l, &arena);
+    ASSERT(stream2(msg, req_l, opts, BUF("\x08\x01\x1b\x1c"), chunk,
+                   false) == UPB_DECODE_ERROR);
+  }
+
+  upb_arena_uninit(&arena);
+}
+
+/* Decodes |node_pb| keeping only the |n| |paths|, and checks that the result
+ * equals |expected| decoded in full. */
+static void check_mask(const char *const *paths, size_t n,
+                       upb_stringview expected, int options) {
+  upb_arena arena;
+  upb_status status = UPB_STATUS_INIT;
+  const upb_decodemask *mask;
+  upb_msg *msg;
+  upb_msg *full;
+
+  upb_arena_init(&arena);
+  mask = upb_decodemask_new(node_md, factory, paths, n, &arena, &status);
+  ASSERT_STATUS(mask, &status);
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode_masked(BUF(node_pb), msg, node_l, mask, options));
+  full = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(expected, full, node_l));
+  ASSERT(upb_msg_equal(msg, full, node_l));
+  /* Unknown fields are dropped with the rest. */
+  ASSERT(upb_msg_unknownsize(msg) == 0);
+  upb_arena_uninit(&arena);
+}
+
+static void test_decodemask() {
+  static const char *const header[] = {"id", "child.name"};
+  static const char *const child[] = {"child"};
+  static const char *const elements[] = {"children.id", "nodes.value.id"};
+  static const char *const group[] = {"group.nodes"};
+  static const char *const bad[] = {"id", "nope"};
+  static const char *const through_scalar[] = {"id.nope"};
+  static const char *const required[] = {"c"};
+  upb_arena arena;
+  upb_status status = UPB_STATUS_INIT;
+  const upb_decodemask *mask;
+  upb_msg *msg;
+
+  check_mask(header, 2, BUF("\x08\x96\x01\x1a\x03\x12\x01\x78"), 0);
+  check_mask(header, 2, BUF("\x08\x96\x01\x1a\x03\x12\x01\x78"),
+             UPB_DECODE_LAZY);
+  check_mask(child, 1,
+             BUF("\x1a\x09\x08\x01\x12\x01\x78\x1a\x02\x08\x07"), 0);
+  check_mask(elements, 2,
+             BUF("\x22\x02\x08\x02\x22\x00\x4a\x06\x08\x05\x12\x02\x08"
+                 "\x06"),
+             0);
+  check_mask(group, 1, BUF("\x2b\x3a\x02\x08\x04\x2c"), 0);
+  check_mask(NULL, 0, BUF(""), 0);
+
+  upb_arena_init(&arena);
+
+  ASSERT(!upb_decodemask_new(node_md, factory, bad, 2, &arena, &status));
+  ASSERT(!upb_ok(&status));
+  upb_status_clear(&status);
+  ASSERT(!upb_decodemask_new(node_md, factory, through_scalar, 1, &arena,
+                             &status));
+  ASSERT(!upb_ok(&status));
+
+  /* Required fields may be masked out, so they aren't checked. */
+  mask = upb_decodemask_new(req_md, factory, required, 1, &arena, &status);
+  ASSERT(mask);
+  msg = upb_msg_new(req_l, &arena);
+  ASSERT(upb_decode_masked(BUF("\x28\x01"), msg, req_l, mask,
+                           UPB_DECODE_CHECKREQUIRED));
+
+  upb_arena_uninit(&arena);
+}
+
+/* Returns the concatenation of |count| |segs|, allocated from |arena|. */
+static upb_stringview join(const upb_stringview *segs, size_t count,
+                           upb_arena *arena) {
+  size_t size = 0;
+  size_t i;
+  char *buf;
+  char *p;
+
+  for (i = 0; i < count; i++) size += segs[i].size;
+  buf = upb_malloc(upb_arena_alloc(arena), size + 1);
+  ASSERT(buf);
+  for (p = buf, i = 0; i < count; i++) {
+    memcpy(p, segs[i].data, segs[i].size);
+    p += segs[i].size;
+  }
+  return upb_stringview_make(buf, size);
+}
+
+static bool within(const char *p, const char *buf, size_t size) {
+  return p >= buf && p < buf + size;
+}
+
+static void test_unknown_spans() {
+  /* node_pb ends with its unknown fields. */
+  static const char unknown[] = "\xa3\x06\x08\x01\xa4\x06\xf8\x06\x07";
+  const char *unknown_in_pb = node_pb + sizeof(node_pb) - sizeof(unknown);
+  const upb_stringview *spans;
+  upb_stringview *segs;
+  upb_stringview joined;
+  upb_arena arena;
+  upb_msg *msg;
+  size_t count;
+  size_t size;
+  char *encoded;
+  const char *flat;
+  bool aliased;
+  int i;
+
+  upb_arena_init(&arena);
+
+  /* Unknown fields alias the input, and adjacent ones share a span. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(node_pb), msg, node_l));
+  spans = upb_msg_getunknownspans(msg, &count);
+  ASSERT(count == 1);
+  ASSERT(spans[0].data == unknown_in_pb);
+  ASSERT(spans[0].size == sizeof(unknown) - 1);
+  ASSERT(upb_msg_unknownsize(msg) == sizeof(unknown) - 1);
+
+  /* upb_encode_segments() writes aliased spans as segments of their own. */
+  encoded = upb_encode(msg, node_l, &arena, &size);
+  ASSERT(encoded);
+  segs = upb_encode_segments(msg, node_l, sizeof(unknown) - 1, &arena, &count);
+  ASSERT(segs);
+  joined = join(segs, count, &arena);
+  ASSERT(joined.size == size && memcmp(joined.data, encoded, size) == 0);
+  for (aliased = false, i = 0; i < (int)count; i++) {
+    if (segs[i].data == unknown_in_pb) aliased = true;
+    ASSERT(segs[i].data == unknown_in_pb ||
+           !within(segs[i].data, node_pb, sizeof(node_pb)));
+  }
+  ASSERT(aliased);
+  segs = upb_encode_segments(msg, node_l, 0, &arena, &count);
+  ASSERT(segs && count == 1);
+  ASSERT(segs[0].size == size && memcmp(segs[0].data, encoded, size) == 0);
+
+  /* Copied, they don't. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode2(BUF(node_pb), msg, node_l, UPB_DECODE_COPYSTRINGS));
+  spans = upb_msg_getunknownspans(msg, &count);
+  joined = join(spans, count, &arena);
+  for (i = 0; i < (int)count; i++) {
+    ASSERT(!within(spans[i].data, node_pb, sizeof(node_pb)));
+  }
+  ASSERT(joined.size == sizeof(unknown) - 1);
+  ASSERT(memcmp(joined.data, unknown, joined.size) == 0);
+
+  /* Copies and aliases can be mixed, and keep their order. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_msg_addunknown(msg, "\x08\x01", 2));
+  ASSERT(upb_msg_addunknown_alias(msg, unknown, sizeof(unknown) - 1));
+  ASSERT(upb_msg_addunknown(msg, "\x18\x03", 2));
+  spans = upb_msg_getunknownspans(msg, &count);
+  ASSERT(count == 3);
+  ASSERT(spans[1].data == unknown);
+  joined = join(spans, count, &arena);
+  ASSERT(joined.size == 13);
+  ASSERT(memcmp(joined.data, "\x08\x01", 2) == 0);
+  ASSERT(memcmp(joined.data + 2, unknown, 9) == 0);
+  ASSERT(memcmp(joined.data + 11, "\x18\x03", 2) == 0);
+  check_encode(msg, node_l, joined, &arena);
+  flat = upb_msg_getunknown(msg, &size);
+  ASSERT(flat && size == joined.size);
+  ASSERT(memcmp(flat, joined.data, size) == 0);
+
+  /* Small copies are packed into chunks rather than a span each. */
+  msg = upb_msg_new(node_l, &arena);
+  for (i = 0; i < 1000; i++) {
+    ASSERT(upb_msg_addunknown(msg, "\x08\x01", 2));
+  }
+  spans = upb_msg_getunknownspans(msg, &count);
+  ASSERT(count < 100);
+  ASSERT(upb_msg_unknownsize(msg) == 2000);
+
+  upb_arena_uninit(&arena);
+}
+
+/* Sets up |e| as an extension of Node. */
+static void init_ext(upb_msglayout_ext *e, uint32_t number, int type,
+                     int label) {
+  memset(e, 0, sizeof(*e));
+  e->extendee = node_l;
+  e->field.number = number;
+  e->field.descriptortype = type;
+  e->field.label = label;
+  e->submsg = type == UPB_DESCRIPTOR_TYPE_MESSAGE ? node_l : NULL;
+}
+
+static void test_extensions() {
+  /* id = 1, then ext_int = 7, ext_node = {id: 5} and ext_nums = [1, 2], as
+   * upb_encode() writes them. */
+  static const char exts_pb[] =
+      "\x08\x01\x90\x03\x07\x9a\x03\x02\x08\x05\xa2\x03\x02\x01\x02";
+  /* The same, with the fields mixed up and ext_nums unpacked. */
+  static const char mixed_pb[] =
+      "\x90\x03\x07\xa0\x03\x01\x08\x01\x9a\x03\x02\x08\x05\xa0\x03\x02";
+  upb_msglayout_ext ext_int, ext_node, ext_nums;
+  const upb_msglayout_ext *exts[3];
+  const upb_array *nums;
+  const upb_msg *sub;
+  int id = field(node_md, "id");
+  int name = field(node_md, "name");
+  upb_extreg *reg;
+  upb_arena arena;
+  upb_msg *msg;
+  upb_msg *copy;
+  upb_msg *dst;
+
+  init_ext(&ext_int, 50, UPB_DESCRIPTOR_TYPE_INT32, UPB_LABEL_OPTIONAL);
+  init_ext(&ext_node, 51, UPB_DESCRIPTOR_TYPE_MESSAGE, UPB_LABEL_OPTIONAL);
+  init_ext(&ext_nums, 52, UPB_DESCRIPTOR_TYPE_INT32, UPB_LABEL_REPEATED);
+  exts[0] = &ext_int;
+  exts[1] = &ext_node;
+  exts[2] = &ext_nums;
+
+  upb_arena_init(&arena);
+  reg = upb_extreg_new(&arena);
+  ASSERT(reg);
+  ASSERT(upb_extreg_add(reg, exts, 3));
+  ASSERT(!upb_extreg_add(reg, exts + 1, 1));
+  ASSERT(upb_extreg_get(reg, node_l, 51) == &ext_node);
+  ASSERT(upb_extreg_get(reg, node_l, 53) == NULL);
+  ASSERT(upb_extreg_get(reg, req_l, 51) == NULL);
+
+  /* Without the registry they are unknown fields. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(exts_pb), msg, node_l));
+  ASSERT(!upb_msg_hasext(msg, &ext_int));
+  ASSERT(upb_msg_unknownsize(msg) == sizeof(exts_pb) - 3);
+
+  /* With it, they are parsed, lazily or not. */
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode_ext(BUF(exts_pb), msg, node_l, reg, UPB_DECODE_LAZY));
+  ASSERT(upb_msg_unknownsize(msg) == 0);
+  ASSERT(upb_msg_get(msg, id, node_l).i32 == 1);
+  ASSERT(upb_msg_hasext(msg, &ext_int));
+  ASSERT(upb_msg_getext(msg, &ext_int).i32 == 7);
+  sub = upb_msg_getext(msg, &ext_node).msg;
+  ASSERT(sub && upb_msg_get(sub, id, node_l).i32 == 5);
+  nums = upb_msg_getext(msg, &ext_nums).arr;
+  ASSERT(nums && upb_array_size(nums) == 2);
+  ASSERT(upb_array_get(nums, 0).i32 == 1 && upb_array_get(nums, 1).i32 == 2);
+
+  /* They are written out after the fields, in order. */
+  check_encode(msg, node_l, BUF(exts_pb), &arena);
+  copy = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode_ext(BUF(mixed_pb), copy, node_l, reg, 0));
+  ASSERT(upb_msg_equal(msg, copy, node_l));
+  ASSERT(upb_msg_hash(msg, node_l, 1) == upb_msg_hash(copy, node_l, 1));
+  check_encode(copy, node_l, BUF(exts_pb), &arena);
+
+  /* Copying, comparing and hashing include them. */
+  copy = upb_msg_deepcopy(msg, node_l, &arena);
+  ASSERT(copy);
+  ASSERT(upb_msg_equal(msg, copy, node_l));
+  ASSERT(upb_msg_hash(msg, node_l, 1) == upb_msg_hash(copy, node_l, 1));
+  ASSERT(upb_msg_setext(copy, &ext_int, upb_msgval_int32(8)));
+  ASSERT(upb_msg_getext(copy, &ext_int).i32 == 8);
+  ASSERT(upb_msg_getext(msg, &ext_int).i32 == 7);
+  ASSERT(!upb_msg_equal(msg, copy, node_l));
+  upb_msg_clearext(copy, &ext_int);
+  ASSERT(!upb_msg_hasext(copy, &ext_int));
+  ASSERT(!upb_msg_equal(msg, copy, node_l));
+
+  /* Merging does what parsing both into one message would. */
+  dst = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode_ext(BUF("\x9a\x03\x03\x12\x01\x6e\xa0\x03\x03"),
+                        dst, node_l, reg, 0));
+  ASSERT(upb_msg_merge(dst, msg, node_l));
+  sub = upb_msg_getext(dst, &ext_node).msg;
+  ASSERT(sub && upb_msg_get(sub, id, node_l).i32 == 5);
+  ASSERT(upb_msg_get(sub, name, node_l).str.size == 1);
+  nums = upb_msg_getext(dst, &ext_nums).arr;
+  ASSERT(nums && upb_array_size(nums) == 3);
+  ASSERT(upb_array_get(nums, 0).i32 == 3);
+  ASSERT(upb_msg_getext(dst, &ext_int).i32 == 7);
+
+  upb_arena_uninit(&arena);
+}
+
+/* Decodes |count| empty elements of field |tag|, a repeated Node, into a
+ * new Node.  Returns the bytes the arena allocated. */
+static size_t decode_run(const char *tag, size_t count,
+                         const upb_extreg *reg) {
+  size_t taglen = strlen(tag);
+  size_t len = count * (taglen + 1);
+  char *buf = malloc(len);
+  upb_arena arena;
+  upb_msg *msg;
+  size_t bytes;
+  size_t i;
+
+  ASSERT(buf);
+  for (i = 0; i < count; i++) {
+    memcpy(buf + i * (taglen + 1), tag, taglen);
+    buf[i * (taglen + 1) + taglen] = 0;
+  }
+
+  upb_arena_init(&arena);
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode_ext(upb_stringview_make(buf, len), msg, node_l, reg, 0));
+  bytes = upb_arena_bytesallocated(&arena);
+  upb_arena_uninit(&arena);
+  free(buf);
+  return bytes;
+}
+
+static void test_extension_run() {
+  upb_msglayout_ext ext_nodes;
+  const upb_msglayout_ext *exts[1];
+  upb_extreg *reg;
+  upb_arena arena;
+  size_t children;
+  size_t ext;
+
+  init_ext(&ext_nodes, 53, UPB_DESCRIPTOR_TYPE_MESSAGE, UPB_LABEL_REPEATED);
+  exts[0] = &ext_nodes;
+  upb_arena_init(&arena);
+  reg = upb_extreg_new(&arena);
+  ASSERT(reg);
+  ASSERT(upb_extreg_add(reg, exts, 1));
+
+  /* A repeated message extension takes no more memory than a repeated
+   * field with the same elements, not memory for a whole run per element. */
+  children = decode_run("\x22", 2000, reg);
+  ext = decode_run("\xaa\x03", 2000, reg);
+  ASSERT(ext < children + children / 4);
+
+  upb_arena_uninit(&arena);
+}
+
+static void test_merge_equal_hash() {
+  static const char ab[] = "\x42\x05\x0a\x01\x61\x10\x01"
+                           "\x42\x05\x0a\x01\x62\x10\x02";
+  static const char ba[] = "\x42\x05\x0a\x01\x62\x10\x02"
+                           "\x42\x05\x0a\x01\x61\x10\x01";
+  /* Parsing |src| after |dst| gives |merged|. */
+  static const char dst_pb[] = "\x08\x01\x1a\x02\x08\x02\x52\x01\x01"
+                               "\x42\x05\x0a\x01\x61\x10\x01";
+  static const char src_pb[] = "\x08\x03\x1a\x03\x12\x01\x78\x52\x01\x02"
+                               "\x42\x05\x0a\x01\x61\x10\x05";
+  static const char merged_pb[] =
+      "\x08\x03\x1a\x05\x08\x02\x12\x01\x78\x52\x02\x01\x02"
+      "\x42\x05\x0a\x01\x61\x10\x05";
+  upb_arena arena;
+  upb_msg *a;
+  upb_msg *b;
+
+  upb_arena_init(&arena);
+
+  /* Map entries may be in any order. */
+  a = upb_msg_new(node_l, &arena);
+  b = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(ab), a, node_l));
+  ASSERT(upb_decode(BUF(ba), b, node_l));
+  ASSERT(upb_msg_equal(a, b, node_l));
+  ASSERT(upb_msg_hash(a, node_l, 7) == upb_msg_hash(b, node_l, 7));
+  ASSERT(get_count(a, "b") == 2);
+
+  /* Unknown fields count unless ignored. */
+  ASSERT(upb_msg_addunknown(b, "\xf8\x06\x07", 3));
+  ASSERT(!upb_msg_equal(a, b, node_l));
+  ASSERT(upb_msg_equal2(a, b, node_l, UPB_MSG_IGNOREUNKNOWN));
+  ASSERT(upb_msg_hash2(a, node_l, 7, UPB_MSG_IGNOREUNKNOWN) ==
+         upb_msg_hash2(b, node_l, 7, UPB_MSG_IGNOREUNKNOWN));
+
+  a = upb_msg_new(node_l, &arena);
+  b = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(dst_pb), a, node_l));
+  ASSERT(upb_decode(BUF(src_pb), b, node_l));
+  ASSERT(upb_msg_merge(a, b, node_l));
+  b = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(merged_pb), b, node_l));
+  ASSERT(upb_msg_equal(a, b, node_l));
+  a = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(dst_pb), a, node_l));
+  ASSERT(upb_decode(BUF(src_pb), a, node_l));
+  ASSERT(upb_msg_equal(a, b, node_l));
+
+  upb_arena_uninit(&arena);
+}
+
+/* Encodes |msg| with UPB_ENCODE_CACHESIZE and checks that it comes out the
+ * same as it does without. */
+static void check_cached(const upb_msg *msg, upb_arena *arena) {
+  size_t size;
+  size_t cached_size;
+  char *buf = upb_encode(msg, node_l, arena, &size);
+  char *cached =
+      upb_encode2(msg, node_l, arena, &cached_size, UPB_ENCODE_CACHESIZE);
+  ASSERT(buf && cached);
+  ASSERT(cached_size == size);
+  ASSERT(memcmp(cached, buf, size) == 0);
+}
+
+/* Parses |json| into |msg|. */
+static void json_decode(const char *json, upb_msg *msg) {
+  upb_status status = UPB_STATUS_INIT;
+  bool ok = upb_json_decode(upb_stringview_make(json, strlen(json)), msg,
+                            node_md, factory, 0, &status);
+  ASSERT_STATUS(ok, &status);
+}
+
+static void test_cachesize() {
+  int id = field(node_md, "id");
+  upb_arena arena;
+  upb_msg *msg;
+  upb_msg *child;
+  upb_array *nums;
+  upb_map *counts;
+
+  upb_arena_init(&arena);
+
+  /* Changes through the upb_msg, upb_array and upb_map functions. */
+  msg = upb_msg_new(node_l, &arena);
+  check_cached(msg, &arena);
+  upb_msg_set(msg, id, upb_msgval_int32(5), node_l);
+  check_cached(msg, &arena);
+  child = upb_msg_new(node_l, &arena);
+  upb_msg_set(msg, field(node_md, "child"), upb_msgval_msg(child), node_l);
+  check_cached(msg, &arena);
+  upb_msg_set(child, id, upb_msgval_int32(300), node_l);
+  check_cached(msg, &arena);
+  nums = upb_array_new(UPB_TYPE_INT32, &arena);
+  ASSERT(nums);
+  upb_msg_set(msg, field(node_md, "nums"), upb_msgval_arr(nums), node_l);
+  check_cached(msg, &arena);
+  ASSERT(upb_array_set(nums, 0, upb_msgval_int32(1)));
+  check_cached(msg, &arena);
+  ASSERT(upb_array_set(nums, 0, upb_msgval_int32(1000)));
+  check_cached(msg, &arena);
+  counts = upb_map_new(UPB_TYPE_STRING, UPB_TYPE_INT32, &arena);
+  ASSERT(counts);
+  upb_msg_set(msg, field(node_md, "counts"), upb_msgval_map(counts), node_l);
+  check_cached(msg, &arena);
+  ASSERT(upb_map_set(counts, upb_msgval_makestr("a", 1), upb_msgval_int32(1),
+                     NULL));
+  check_cached(msg, &arena);
+
+  /* Parsing into the message, or into a submessage of it. */
+  ASSERT(upb_decode(BUF("\x52\x02\x02\x03"), msg, node_l));
+  check_cached(msg, &arena);
+  ASSERT(upb_decode(BUF("\x1a\x03\x12\x01\x78"), msg, node_l));
+  check_cached(msg, &arena);
+  ASSERT(upb_decode(BUF("\x42\x05\x0a\x01\x62\x10\x02"), msg, node_l));
+  check_cached(msg, &arena);
+
+  /* The same with JSON. */
+  msg = upb_msg_new(node_l, &arena);
+  check_cached(msg, &arena);
+  json_decode("{\"id\":5,\"nums\":[1,2,3]}", msg);
+  check_cached(msg, &arena);
+  json_decode("{\"nums\":[4]}", msg);
+  check_cached(msg, &arena);
+  json_decode("{\"child\":{\"id\":7}}", msg);
+  check_cached(msg, &arena);
+  json_decode("{\"child\":{\"name\":\"x\"}}", msg);
+  check_cached(msg, &arena);
+
+  upb_arena_uninit(&arena);
+}
+
+static void test_json_arrays() {
+  static const char json[] =
+      "{\"nums\":[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19],"
+      "\"children\":[{\"id\":0},{\"id\":1},{\"id\":2},{\"id\":3},"
+      "{\"id\":4},{\"id\":5},{\"id\":6},{\"id\":7},{\"id\":8},"
+      "{\"id\":9}]}";
+  int id = field(node_md, "id");
+  const upb_array *arr;
+  upb_arena arena;
+  upb_msg *msg;
+  int i;
+
+  upb_arena_init(&arena);
+
+  /* Both arrays outgrow their inline storage, the children while other
+   * allocations (their messages) come between the array and its growth. */
+  msg = upb_msg_new(node_l, &arena);
+  json_decode(json, msg);
+  arr = upb_msg_get(msg, field(node_md, "nums"), node_l).arr;
+  ASSERT(arr && upb_array_size(arr) == 20);
+  for (i = 0; i < 20; i++) {
+    ASSERT(upb_array_get(arr, i).i32 == i);
+  }
+  arr = upb_msg_get(msg, field(node_md, "children"), node_l).arr;
+  ASSERT(arr && upb_array_size(arr) == 10);
+  for (i = 0; i < 10; i++) {
+    ASSERT(upb_msg_get(upb_array_get(arr, i).msg, id, node_l).i32 == i);
+  }
+
+  upb_arena_uninit(&arena);
+}
+
+/* Sets |count| entries of each map of |msg|, inserted in the order of
+ * |order|, a permutation of 0..count-1.  Every map gets keys 0 and
+ * false. */
+static void fill_maps(upb_msg *msg, const int *order, int count,
+                      upb_arena *arena) {
+  static const char *const names[] = {"", "a", "b", "ab", "ba", "aa", "bb",
+                                      "abc", "c", "ca", "zzz", "z"};
+  upb_map *counts = upb_map_new(UPB_TYPE_STRING, UPB_TYPE_INT32, arena);
+  upb_map *nodes = upb_map_new(UPB_TYPE_INT32, UPB_TYPE_MESSAGE, arena);
+  upb_map *flags = upb_map_new(UPB_TYPE_BOOL, UPB_TYPE_INT32, arena);
+  int i;
+
+  ASSERT(counts && nodes && flags && count <= 12);
+  for (i = 0; i < count; i++) {
+    int k = order[i];
+    upb_msg *node = upb_msg_new(node_l, arena);
+    ASSERT(node);
+    upb_msg_set(node, field(node_md, "id"), upb_msgval_int32(k), node_l);
+    ASSERT(upb_map_set(counts, upb_msgval_makestr(names[k], strlen(names[k])),
+                       upb_msgval_int32(k), NULL));
+    /* Negative keys are the largest varints. */
+    ASSERT(upb_map_set(nodes, upb_msgval_int32(k % 2 ? -k : k * 1000),
+                       upb_msgval_msg(node), NULL));
+    if (k < 2) {
+      ASSERT(upb_map_set(flags, upb_msgval_bool(k == 1), upb_msgval_int32(k),
+                         NULL));
+    }
+  }
+
+  upb_msg_set(msg, field(node_md, "counts"), upb_msgval_map(counts), node_l);
+  upb_msg_set(msg, field(node_md, "nodes"), upb_msgval_map(nodes), node_l);
+  upb_msg_set(msg, field(node_md, "flags"), upb_msgval_map(flags), node_l);
+}
+
+static void test_deterministic() {
+  static const int up[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+  static const int down[] = {11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
+  static const int mixed[] = {5, 0, 11, 3, 8, 1, 10, 6, 2, 9, 4, 7};
+  /* flags = {false: 0, true: 1}, in key order. */
+  static const char flags_pb[] = "\x5a\x04\x08\x00\x10\x00"
+                                 "\x5a\x04\x08\x01\x10\x01";
+  const int *const orders[] = {up, down, mixed};
+  upb_stringview first;
+  upb_arena arena;
+  upb_msg *msg;
+  size_t i;
+
+  upb_arena_init(&arena);
+
+  /* The same entries in any order encode to the same bytes. */
+  for (i = 0; i < 3; i++) {
+    upb_stringview pb;
+    upb_msg *copy;
+    msg = upb_msg_new(node_l, &arena);
+    fill_maps(msg, orders[i], 12, &arena);
+    pb.data = upb_encode2(msg, node_l, &arena, &pb.size,
+                          UPB_ENCODE_DETERMINISTIC);
+    ASSERT(pb.data && pb.size > 0);
+    copy = upb_msg_new(node_l, &arena);
+    ASSERT(upb_decode(pb, copy, node_l));
+    ASSERT(upb_msg_equal(msg, copy, node_l));
+    if (i == 0) {
+      first = pb;
+    } else {
+      ASSERT(pb.size == first.size);
+      ASSERT(memcmp(pb.data, first.data, pb.size) == 0);
+    }
+  }
+
+  /* Bool keys come false first. */
+  msg = upb_msg_new(node_l, &arena);
+  fill_maps(msg, down + 10, 2, &arena);
+  upb_msg_set(msg, field(node_md, "counts"), upb_msgval_map(NULL), node_l);
+  upb_msg_set(msg, field(node_md, "nodes"), upb_msgval_map(NULL), node_l);
+  first.data = upb_encode2(msg, node_l, &arena, &first.size,
+                           UPB_ENCODE_DETERMINISTIC);
+  ASSERT(first.data);
+  ASSERT(first.size == sizeof(flags_pb) - 1);
+  ASSERT(memcmp(first.data, flags_pb, first.size) == 0);
+
+  upb_arena_uninit(&arena);
+}
+
+/* The bundle checksum, as upb_msgfactory_serialize() computes it, for
+ * forging bundles that get past it. */
+static uint64_t bundle_checksum(const char *p, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i;
+  for (i = 0; i < len; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, sizeof(w));
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+  }
+  return h;
+}
+
+/* Returns an 8-aligned copy of |size| bytes of |data|, to be freed. */
+static char *aligned_copy(const char *data, size_t size) {
+  char *ret = malloc(size);
+  ASSERT(ret && (uintptr_t)ret % 8 == 0);
+  memcpy(ret, data, size);
+  return ret;
+}
+
+/* Loads a copy of bundle |data| that must fail to load with |msg|. */
+static void check_badbundle(const char *data, size_t size, const char *msg) {
+  upb_status status = UPB_STATUS_INIT;
+  char *buf = aligned_copy(data, size);
+  ASSERT(!upb_msglayoutbundle_load(buf, size, &status));
+  ASSERT(strcmp(upb_status_errmsg(&status), msg) == 0);
+  /* Failing leaves the buffer as it was. */
+  ASSERT(memcmp(buf, data, size) == 0);
+  free(buf);
+}
+
+static void test_bundle() {
+  /* The header is four uint32_t and the checksum, then the layouts. */
+  const size_t header = 4 * sizeof(uint32_t) + sizeof(uint64_t);
+  const upb_msgdef *msgs[2];
+  const upb_msglayoutbundle *b;
+  const upb_msglayout *l;
+  upb_status status = UPB_STATUS_INIT;
+  upb_stringview pb;
+  upb_stringview expected;
+  upb_arena arena;
+  upb_msg *msg;
+  upb_msglayout *first;
+  uint64_t checksum;
+  size_t size;
+  char *data;
+  char *buf;
+
+  upb_arena_init(&arena);
+  msgs[0] = node_md;
+  msgs[1] = req_md;
+  data = upb_msgfactory_serialize(factory, msgs, 2, &arena, &size);
+  ASSERT(data);
+
+  /* Round trip: the loaded layouts decode and encode like the originals. */
+  buf = aligned_copy(data, size);
+  b = upb_msglayoutbundle_load(buf, size, &status);
+  ASSERT_STATUS(b, &status);
+  /* Node, its group and three map entries, and Required and its group. */
+  ASSERT(upb_msglayoutbundle_count(b) == 7);
+  ASSERT(upb_msglayoutbundle_lookup(b, "upb_test.Required"));
+  ASSERT(!upb_msglayoutbundle_lookup(b, "upb_test.Missing"));
+  l = upb_msglayoutbundle_lookup(b, "upb_test.Node");
+  ASSERT(l);
+  ASSERT(l->size == node_l->size && l->field_count == node_l->field_count);
+  msg = upb_msg_new(l, &arena);
+  ASSERT(upb_decode(BUF(node_pb), msg, l));
+  pb.data = upb_encode2(msg, l, &arena, &pb.size, UPB_ENCODE_DETERMINISTIC);
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(upb_decode(BUF(node_pb), msg, node_l));
+  expected.data = upb_encode2(msg, node_l, &arena, &expected.size,
+                              UPB_ENCODE_DETERMINISTIC);
+  ASSERT(pb.data && expected.data && pb.size == expected.size);
+  ASSERT(memcmp(pb.data, expected.data, pb.size) == 0);
+
+  /* A loaded buffer can't be loaded again. */
+  ASSERT(!upb_msglayoutbundle_load(buf, size, &status));
+  ASSERT(strcmp(upb_status_errmsg(&status),
+                "Layout bundle is already loaded.") == 0);
+  ASSERT(upb_msglayoutbundle_lookup(b, "upb_test.Node") == l);
+  free(buf);
+
+  /* Damage is caught by the checksum. */
+  buf = aligned_copy(data, size);
+  buf[size - 1] ^= 1;
+  check_badbundle(buf, size, "Layout bundle is corrupt.");
+  check_badbundle(buf, size - 8, "Layout bundle is corrupt.");
+  memcpy(buf, "abcd", 4);
+  check_badbundle(buf, size, "Not a layout bundle.");
+  free(buf);
+
+  /* A forged checksum doesn't get a message too small for its fields past
+   * the checks. */
+  buf = aligned_copy(data, size);
+  first = (upb_msglayout*)(buf + header);
+  first->size = 8;
+  checksum = bundle_checksum(buf + header, size - header);
+  memcpy(buf + header - sizeof(checksum), &checksum, sizeof(checksum));
+  check_badbundle(buf, size, "Layout bundle is corrupt.");
+  free(buf);
+
+  upb_arena_uninit(&arena);
+}
+
+/* A block allocator that counts its calls. */
+typedef struct {
+  upb_alloc alloc;
+  size_t calls;
+} counting_alloc;
+
+static void *counting_allocfunc(upb_alloc *alloc, void *ptr, size_t oldsize,
+                                size_t size) {
+  counting_alloc *a = (counting_alloc*)alloc;
+  a->calls++;
+  return upb_alloc_global.func(&upb_alloc_global, ptr, oldsize, size);
+}
+
+/* Decodes |buf| into a new Node in |arena| with a upb_decodebatch for its
+ * children, and checks it against upb_decode().  Returns the number of calls
+ * made to |counter| while the chunks ran. */
+static size_t decode_batch(upb_arena *arena, upb_stringview buf,
+                           counting_alloc *counter) {
+  upb_msg *msg = upb_msg_new(node_l, arena);
+  upb_msg *expected = upb_msg_new(node_l, arena);
+  upb_decodebatch *b;
+  size_t calls;
+  size_t i;
+
+  ASSERT(msg && expected);
+  ASSERT(upb_decode(buf, expected, node_l));
+  b = upb_decodebatch_new(buf, msg, node_l, 4, 3, 0);
+  ASSERT(b);
+  ASSERT(upb_decodebatch_chunks(b) == 3);
+  calls = counter->calls;
+  for (i = 0; i < upb_decodebatch_chunks(b); i++) {
+    ASSERT(upb_decodebatch_run(b, i));
+  }
+  calls = counter->calls - calls;
+  ASSERT(upb_decodebatch_finish(b));
+  ASSERT(upb_msg_equal(msg, expected, node_l));
+  return calls;
+}
+
+static void test_decodebatch() {
+  char buf[200];
+  size_t len;
+  counting_alloc counter;
+  upb_arena arena;
+  int i;
+
+  /* id = 1, then 40 children with ids 0 to 39. */
+  memcpy(buf, "\x08\x01", 2);
+  len = 2;
+  for (i = 0; i < 40; i++) {
+    memcpy(buf + len, "\x22\x02\x08", 3);
+    buf[len + 3] = (char)i;
+    len += 4;
+  }
+
+  counter.alloc.func = &counting_allocfunc;
+  counter.calls = 0;
+
+  /* Chunks may run concurrently, so they never use the message's block
+   * allocator, which need not be thread-safe. */
+  upb_arena_init2(&arena, NULL, 0, &counter.alloc);
+  ASSERT(decode_batch(&arena, upb_stringview_make(buf, len), &counter) == 0);
+  upb_arena_uninit(&arena);
+
+  /* The global allocator, which the chunks share, is fine. */
+  upb_arena_init(&arena);
+  decode_batch(&arena, upb_stringview_make(buf, len), &counter);
+  upb_arena_uninit(&arena);
+}
+
+/* Decodes every prefix of |buf| as a FieldDescriptorProto, whose generated
+ * layout has a specialized parser, and checks that it gives the same result
+ * as upb_decode() does on its own with every combination of options. */
+static void check_fieldparser(upb_stringview buf) {
+  const upb_msglayout *l = &google_protobuf_FieldDescriptorProto_msginit;
+  upb_msglayout generic = *l;
+  size_t len;
+  int options;
+
+  generic.parse = NULL;
+  for (len = 0; len <= buf.size; len++) {
+    upb_stringview prefix = upb_stringview_make(buf.data, len);
+    for (options = 0; options < 16; options++) {
+      upb_arena arena;
+      upb_msg *msg;
+      upb_msg *expected;
+      bool ok;
+
+      upb_arena_init(&arena);
+      msg = upb_msg_new(l, &arena);
+      expected = upb_msg_new(l, &arena);
+      ok = upb_decode2(prefix, msg, l, options);
+      ASSERT(ok == upb_decode2(prefix, expected, &generic, options));
+      ASSERT(!ok || upb_msg_equal(msg, expected, l));
+      upb_arena_uninit(&arena);
+    }
+  }
+}
+
+/* Runs check_fieldparser() on each FieldDescriptorProto inside the
+ * serialized FileDescriptorSet (0), FileDescriptorProto (1) or
+ * DescriptorProto (2) from |p| to |end|, and returns how many there were. */
+static int walk_descriptor(const char *p, const char *end, int kind) {
+  int count = 0;
+
+  while (p < end) {
+    uint64_t tag;
+    uint64_t val;
+    int number;
+
+    ASSERT(_upb_decode_varint(&p, end, &tag));
+    number = (int)(tag >> 3);
+    switch (tag & 7) {
+      case UPB_WIRE_TYPE_VARINT:
+        ASSERT(_upb_decode_varint(&p, end, &val));
+        break;
+      case UPB_WIRE_TYPE_64BIT:
+        ASSERT(_upb_decode_fixed(&p, end, &val, 8));
+        break;
+      case UPB_WIRE_TYPE_32BIT:
+        ASSERT(_upb_decode_fixed(&p, end, &val, 4));
+        break;
+      case UPB_WIRE_TYPE_DELIMITED: {
+        upb_stringview sub;
+        ASSERT(_upb_decode_string(&p, end, &sub));
+        if ((kind == 1 && number == 7) ||
+            (kind == 2 && (number == 2 || number == 6))) {
+          check_fieldparser(sub);
+          count++;
+        } else if ((kind == 0 && number == 1) || (kind == 1 && number == 4) ||
+                   (kind == 2 && number == 3)) {
+          count += walk_descriptor(sub.data, sub.data + sub.size,
+                                   kind == 0 ? 1 : 2);
+        }
+        break;
+      }
+      default:
+        ASSERT(false);
+    }
+  }
+
+  return count;
+}
+
+static void test_generated_parser() {
+  static const char *const files[] = {
+    "tests/test_msg.proto.pb", "tests/json/test.proto.pb"
+  };
+  size_t i;
+
+  ASSERT(google_protobuf_FieldDescriptorProto_msginit.parse);
+
+  for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    size_t len;
+    char *data = upb_readfile(files[i], &len);
+    ASSERT(data);
+    ASSERT(walk_descriptor(data, data + len, 0) > 10);
+    free(data);
+  }
+
+  /* Fields out of number order, repeated, unknown, or mixed with options,
+   * which the parser leaves to upb_decode(). */
+  check_fieldparser(BUF("\x52\x01j\x48\x02\x3a\x01x\x0a\x01n\x0a\x01m"));
+  check_fieldparser(BUF("\x0a\x01n\x42\x02\x08\x01\x12\x01e\xa0\x06\x05"
+                        "\x18\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01"));
+  check_fieldparser(BUF("\x20\x03\x28\x0b\x32\x04.a.B\x20\x02"));
+  check_fieldparser(BUF("\x0a\x02\xc0\x80\x12\x00"));
+}
+
+/* A upb_bytessink that appends to a growing buffer. */
+typedef struct {
+  upb_byteshandler handler;
+  upb_bytessink sink;
+  char *data;
+  size_t len;
+} string_sink;
+
+static size_t string_sink_put(void *closure, const void *hd, const char *buf,
+                              size_t len, const upb_bufhandle *handle) {
+  string_sink *s = closure;
+  UPB_UNUSED(hd);
+  UPB_UNUSED(handle);
+  s->data = realloc(s->data, s->len + len);
+  ASSERT(s->data);
+  memcpy(s->data + s->len, buf, len);
+  s->len += len;
+  return len;
+}
+
+static void string_sink_init(string_sink *s) {
+  upb_byteshandler_init(&s->handler);
+  upb_byteshandler_setstring(&s->handler, string_sink_put, NULL);
+  upb_bytessink_reset(&s->sink, &s->handler, s);
+  s->data = NULL;
+  s->len = 0;
+}
+
+/* The messages a upb_delimreader should see, in order. */
+typedef struct {
+  upb_msg **msgs;
+  size_t count;
+  size_t seen;
+  size_t stop_after;
+} delim_expect;
+
+static bool delim_check(void *closure, upb_msg *msg) {
+  delim_expect *e = closure;
+  ASSERT(e->seen < e->count);
+  ASSERT(upb_msg_equal(msg, e->msgs[e->seen], node_l));
+  return ++e->seen != e->stop_after;
+}
+
+/* Pushes |len| bytes at |data| to |r|, |chunk| bytes at a time, and ends the
+ * stream.  Returns whether the whole stream was accepted. */
+static bool delim_push(upb_delimreader *r, const char *data, size_t len,
+                       size_t chunk) {
+  upb_bytessink *sink = upb_delimreader_input(r);
+  void *subc;
+  size_t ofs;
+
+  ASSERT(upb_bytessink_start(sink, len, &subc));
+  for (ofs = 0; ofs < len; ofs += chunk) {
+    size_t n = UPB_MIN(chunk, len - ofs);
+    if (upb_bytessink_putbuf(sink, subc, data + ofs, n, NULL) != n) {
+      return false;
+    }
+  }
+  return upb_bytessink_end(sink);
+}
+
+/* Feeds |len| bytes at |data| to a new reader, and checks that it fails with
+ * |err| after consuming |consumed| bytes, without passing on a message. */
+static void check_delim_error(const char *data, size_t len, size_t max_size,
+                              size_t consumed, const char *err) {
+  upb_env env;
+  upb_status status = UPB_STATUS_INIT;
+  upb_arena arena;
+  upb_msg *empty;
+  delim_expect expect;
+  upb_delimreader *r;
+  upb_bytessink *sink;
+  void *subc;
+
+  upb_arena_init(&arena);
+  empty = upb_msg_new(node_l, &arena);
+  expect.msgs = &empty;
+  expect.count = 1;
+  expect.seen = 0;
+  expect.stop_after = 0;
+
+  upb_env_init(&env);
+  upb_env_reporterrorsto(&env, &status);
+  r = upb_delimreader_create(&env, node_l, 0, delim_check, &expect);
+  ASSERT(r);
+  upb_delimreader_setmaxsize(r, max_size);
+  sink = upb_delimreader_input(r);
+  ASSERT(upb_bytessink_start(sink, len, &subc));
+  ASSERT(upb_bytessink_putbuf(sink, subc, data, len, NULL) == consumed);
+  ASSERT(!upb_bytessink_end(sink));
+  ASSERT(strcmp(upb_status_errmsg(&status), err) == 0);
+  ASSERT(expect.seen == 0);
+
+  /* A reset reader takes a new stream. */
+  upb_delimreader_reset(r);
+  ASSERT(delim_push(r, "\x00", 1, 1));
+  ASSERT(expect.seen == 1);
+  upb_env_uninit(&env);
+  upb_arena_uninit(&arena);
+}
+
+/* Appends |size| to |buf| as a varint and returns its length. */
+static size_t put_varint(char *buf, uint64_t size) {
+  size_t n = 0;
+  do {
+    buf[n++] = (char)((size & 0x7f) | (size > 0x7f ? 0x80 : 0));
+    size >>= 7;
+  } while (size);
+  return n;
+}
+
+static void test_delimited() {
+  char big4[4003];
+  char big5[5003];
+  upb_stringview inputs[6];
+  upb_msg *msgs[6];
+  upb_arena arena;
+  upb_env env;
+  string_sink out;
+  upb_delimwriter *w;
+  upb_delimreader *r;
+  delim_expect expect;
+  char *expected;
+  size_t expected_len = 0;
+  size_t first_len = 0;
+  size_t i;
+
+  /* Nodes whose names are 4000 and 5000 bytes long. */
+  memset(big4, 'x', sizeof(big4));
+  memcpy(big4, "\x12\xa0\x1f", 3);
+  inputs[4] = upb_stringview_make(big4, sizeof(big4));
+  memset(big5, 'x', sizeof(big5));
+  memcpy(big5, "\x12\x88\x27", 3);
+  inputs[5] = upb_stringview_make(big5, sizeof(big5));
+  inputs[0] = inputs[2] = BUF(node_pb);
+  inputs[1] = inputs[3] = upb_stringview_make("", 0);
+
+  /* The writer's buffer holds UPB_BYTESBUF_DEFAULTSIZE bytes, which is room
+   * for the first four messages.  The fifth only fits after a flush and the
+   * sixth goes around the buffer. */
+  upb_arena_init(&arena);
+  expected = malloc(10000 + 6 * 10 + 2 * sizeof(node_pb));
+  ASSERT(expected);
+  for (i = 0; i < 6; i++) {
+    size_t size;
+    char *pb;
+    msgs[i] = upb_msg_new(node_l, &arena);
+    ASSERT(upb_decode(inputs[i], msgs[i], node_l));
+    pb = upb_encode(msgs[i], node_l, &arena, &size);
+    ASSERT(pb);
+    expected_len += put_varint(expected + expected_len, size);
+    memcpy(expected + expected_len, pb, size);
+    expected_len += size;
+    if (i == 0) first_len = expected_len;
+  }
+
+  /* Writing gives upb_encode() output with the prefixes added. */
+  upb_env_init(&env);
+  string_sink_init(&out);
+  w = upb_delimwriter_create(&env, &out.sink);
+  ASSERT(w);
+  for (i = 0; i < 6; i++) {
+    ASSERT(upb_delimwriter_put(w, msgs[i], node_l));
+  }
+  ASSERT(upb_delimwriter_end(w));
+  ASSERT(out.len == expected_len);
+  ASSERT(memcmp(out.data, expected, expected_len) == 0);
+  upb_env_uninit(&env);
+
+  /* Reading it back, in one buffer and in pieces that split the prefixes
+   * and the messages. */
+  for (i = 1; i <= expected_len; i = i < 8 ? i + 1 : i * 3) {
+    upb_env_init(&env);
+    expect.msgs = msgs;
+    expect.count = 6;
+    expect.seen = 0;
+    expect.stop_after = 0;
+    r = upb_delimreader_create(&env, node_l, 0, delim_check, &expect);
+    ASSERT(r);
+    ASSERT(delim_push(r, out.data, out.len, i));
+    ASSERT(expect.seen == 6);
+    upb_env_uninit(&env);
+  }
+
+  /* A callback that returns false stops the reader after its message, and
+   * the rest can be pushed afterwards. */
+  upb_env_init(&env);
+  expect.seen = 0;
+  expect.stop_after = 1;
+  r = upb_delimreader_create(&env, node_l, 0, delim_check, &expect);
+  ASSERT(r);
+  {
+    upb_bytessink *sink = upb_delimreader_input(r);
+    void *subc;
+    ASSERT(upb_bytessink_start(sink, out.len, &subc));
+    ASSERT(upb_bytessink_putbuf(sink, subc, out.data, out.len, NULL) ==
+           first_len);
+    ASSERT(expect.seen == 1);
+    ASSERT(upb_bytessink_putbuf(sink, subc, out.data + first_len,
+                                out.len - first_len, NULL) ==
+           out.len - first_len);
+    ASSERT(upb_bytessink_end(sink));
+    ASSERT(expect.seen == 6);
+  }
+  upb_env_uninit(&env);
+
+  free(out.data);
+  free(expected);
+  upb_arena_uninit(&arena);
+
+  /* Streams that end inside a length prefix or a message. */
+  check_delim_error("\x80", 1, INT32_MAX, 1,
+                    "Stream ended in the middle of a message.");
+  check_delim_error("\x05\x08\x01", 3, INT32_MAX, 3,
+                    "Stream ended in the middle of a message.");
+
+  /* Sizes over the maximum are rejected as soon as the prefix is read, before
+   * any of the message is buffered. */
+  check_delim_error("\x0b\x08\x01", 3, 10, 1,
+                    "Message larger than the maximum size.");
+  check_delim_error("\x80\x80\x80\x80\x08", 5, INT32_MAX, 5,
+                    "Message larger than the maximum size.");
+  check_delim_error("\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x01", 11,
+                    INT32_MAX, 11, "Malformed length prefix.");
+
+  check_delim_error("\x01\x08", 2, INT32_MAX, 1, "Failed to parse message.");
+}
+
+static const char *const kTmpFile = "tests/test_msg.tmp";
+
+static void write_file(const char *path, const char *data, size_t len) {
+  FILE *f = fopen(path, "wb");
+  ASSERT(f);
+  ASSERT(fwrite(data, 1, len, f) == len);
+  ASSERT(fclose(f) == 0);
+}
+
+/* Writes |len| bytes at |data| to a file and decodes it with
+ * upb_decode_file().  On success, checks the result against upb_decode() of
+ * the same bytes.  Returns whether it decoded, with the error in |status|. */
+static bool decode_file(const char *data, size_t len, int options,
+                        upb_status *status) {
+  upb_arena arena;
+  upb_msg *msg;
+  upb_msg *expected;
+  bool ok;
+
+  write_file(kTmpFile, data, len);
+  upb_arena_init(&arena);
+  msg = upb_msg_new(node_l, &arena);
+  expected = upb_msg_new(node_l, &arena);
+  upb_status_clear(status);
+  ok = upb_decode_file(kTmpFile, msg, node_l, options, status);
+  ASSERT(ok == upb_decode(upb_stringview_make(data, len), expected, node_l));
+  ASSERT(!ok || upb_msg_equal(msg, expected, node_l));
+  upb_arena_uninit(&arena);
+  remove(kTmpFile);
+  return ok;
+}
+
+static void test_decode_file() {
+  /* Big enough to be mapped rather than read: a Node with a long name. */
+  size_t big_len = 4 + 99999;
+  char *big = malloc(big_len);
+  upb_status status;
+  upb_arena arena;
+  upb_msg *msg;
+  int options;
+
+  ASSERT(big);
+  memset(big, 'x', big_len);
+  memcpy(big, "\x12\x9f\x8d\x06", 4);  /* name, 99999 bytes */
+
+  for (options = 0; options <= UPB_DECODE_COPYSTRINGS; options++) {
+    ASSERT(decode_file(node_pb, sizeof(node_pb) - 1, options, &status));
+    ASSERT(decode_file(big, big_len, options, &status));
+    ASSERT(decode_file("", 0, options, &status));
+
+    /* Truncated files, read and mapped. */
+    ASSERT(!decode_file(node_pb, sizeof(node_pb) - 2, options, &status));
+    ASSERT(strncmp(upb_status_errmsg(&status),
+                   "Failed to parse file: tests/test_msg.tmp: ", 42) == 0);
+    ASSERT(!decode_file(big, big_len - 1, options, &status));
+    ASSERT(strncmp(upb_status_errmsg(&status),
+                   "Failed to parse file: tests/test_msg.tmp: ", 42) == 0);
+  }
+  free(big);
+
+  upb_arena_init(&arena);
+  msg = upb_msg_new(node_l, &arena);
+  upb_status_clear(&status);
+  ASSERT(!upb_decode_file("tests/no_such_file", msg, node_l, 0, &status));
+  ASSERT(strcmp(upb_status_errmsg(&status),
+                "Couldn't open file: tests/no_such_file") == 0);
+  ASSERT(!upb_decode_file("tests/no_such_file", msg, node_l, 0, NULL));
+  upb_arena_uninit(&arena);
+}
+
+/* upb_decode_withstats() and upb_arena_setstats() count exactly the
+ * allocations a known decode makes. */
+static void test_stats() {
+  /* nums (packed), with 20 elements of one byte each. */
+  static const char nums[] = "\x52\x14\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01"
+                             "\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01";
+  const size_t array_bytes = UPB_ARRAY_HEADERSIZE + UPB_ARRAY_INLINEBYTES;
+  upb_arenastats arenastats;
+  upb_arenastats before;
+  upb_decodestats stats;
+  upb_arena arena;
+  upb_msg *msg;
+  size_t allocated;
+
+  memset(&arenastats, 0, sizeof(arenastats));
+  memset(&stats, 0, sizeof(stats));
+  upb_arena_init(&arena);
+  upb_arena_setnextblocksize(&arena, 4096);
+  upb_arena_setstats(&arena, &arenastats);
+  ASSERT(upb_arena_stats(&arena) == &arenastats);
+  msg = upb_msg_new(node_l, &arena);
+  ASSERT(msg);
+  before = arenastats;
+  allocated = upb_arena_bytesallocated(&arena);
+
+  /* The array and its inline storage, then 32 elements once the 20 don't
+   * fit inline. */
+  ASSERT(upb_decode_withstats(BUF(nums), msg, node_l, NULL, 0, &stats));
+  ASSERT(stats.msgs == 1);
+  ASSERT(stats.errors == 0);
+  ASSERT(stats.bytes == sizeof(nums) - 1);
+  ASSERT(stats.arena_bytes == upb_arena_bytesallocated(&arena) - allocated);
+  ASSERT(stats.arrays_grown == 1);
+  ASSERT(stats.array_bytes == 32 * sizeof(int32_t));
+
+  ASSERT(arenastats.allocs == before.allocs + 2);
+  ASSERT(arenastats.reallocs == before.reallocs);
+  ASSERT(arenastats.bytes_requested ==
+         before.bytes_requested + array_bytes + 32 * sizeof(int32_t));
+  /* Everything fit in the first block, so only padding is wasted. */
+  ASSERT(arenastats.bytes_requested - before.bytes_requested +
+         arenastats.bytes_wasted - before.bytes_wasted == stats.arena_bytes);
+
+  /* Merging 20 more grows the storage to 64 elements, in place since it was
+   * the last allocation. */
+  before = arenastats;
+  allocated = upb_arena_bytesallocated(&arena);
+  ASSERT(upb_decode_withstats(BUF(nums), msg, node_l, NULL, 0, &stats));
+  ASSERT(stats.msgs == 2);
+  ASSERT(stats.bytes == 2 * (sizeof(nums) - 1));
+  ASSERT(stats.arrays_grown == 2);
+  ASSERT(stats.array_bytes == (32 + 64) * sizeof(int32_t));
+  ASSERT(upb_arena_bytesallocated(&arena) - allocated ==
+         32 * sizeof(int32_t));
+  ASSERT(arenastats.allocs == before.allocs);
+  ASSERT(arenastats.reallocs == before.reallocs + 1);
+  ASSERT(arenastats.bytes_requested ==
+         before.bytes_requested + 32 * sizeof(int32_t));
+  ASSERT(arenastats.bytes_wasted == before.bytes_wasted);
+
+  /* A failed parse still counts. */
+  ASSERT(!upb_decode_withstats(BUF("\x52\x05\x01"), msg, node_l, NULL, 0,
+                               &stats));
+  ASSERT(stats.msgs == 3);
+  ASSERT(stats.errors == 1);
+  ASSERT(stats.bytes == 2 * (sizeof(nums) - 1) + 3);
+
+  ASSERT(arenastats.blocks == 1);
+  ASSERT(arenastats.blocks_reused == 0);
+  ASSERT(arenastats.block_bytes >= 4096);
+  ASSERT(arenastats.peak_block_bytes == arenastats.block_bytes);
+  ASSERT(arenastats.peak_bytes_allocated ==
+         upb_arena_bytesallocated(&arena));
+  ASSERT(arenastats.cleanups == 0);
+  ASSERT(arenastats.resets == 0);
+
+  /* A reset keeps the block for reuse, and the next message takes it. */
+  upb_arena_reset(&arena);
+  ASSERT(arenastats.resets == 1);
+  ASSERT(upb_msg_new(node_l, &arena));
+  ASSERT(arenastats.blocks == 1);
+  ASSERT(arenastats.blocks_reused == 1);
+  ASSERT(arenastats.peak_block_bytes == arenastats.block_bytes);
+
+  upb_arena_uninit(&arena);
+  ASSERT(arenastats.block_bytes == 0);
+}
+
+/* Returns true if every field of |l| numbered in |hot| comes before every
+ * other field, both in the message and in the hasbits. */
+static bool hot_fields_first(const upb_msglayout *l, const uint32_t *hot,
+                             size_t n) {
+  uint32_t max_offset = 0;
+  uint32_t min_offset = UINT32_MAX;
+  int max_hasbit = 0;
+  int min_hasbit = INT_MAX;
+  size_t i;
+  size_t j;
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *f = &l->fields[i];
+    bool is_hot = false;
+    for (j = 0; j < n; j++) {
+      is_hot = is_hot || f->number == hot[j];
+    }
+    if (is_hot) {
+      max_offset = UPB_MAX(max_offset, f->offset);
+      if (f->presence > 0) max_hasbit = UPB_MAX(max_hasbit, f->presence);
+    } else {
+      min_offset = UPB_MIN(min_offset, f->offset);
+      if (f->presence > 0) min_hasbit = UPB_MIN(min_hasbit, f->presence);
+    }
+  }
+
+  return max_offset < min_offset && max_hasbit < min_hasbit;
+}
+
+static void test_hotfields() {
+  /* id is the least aligned field, so left to itself it goes last; 999 is
+   * not a field and is ignored. */
+  static const uint32_t hot[] = {1, 3, 999};
+  static const uint32_t other[] = {2};
+  upb_msgfactory *f = upb_msgfactory_new(symtab);
+  const upb_msglayout *l;
+  upb_msglayout_field before[64];
+
+  ASSERT(!hot_fields_first(node_l, hot, 2));
+  ASSERT(upb_msgfactory_sethotfields(f, node_md, other, 1));
+  /* A second call replaces the first. */
+  ASSERT(upb_msgfactory_sethotfields(f, node_md, hot, 3));
+  l = upb_msgfactory_getlayout(f, node_md);
+  ASSERT(l);
+  ASSERT(hot_fields_first(l, hot, 2));
+  ASSERT(l->size == node_l->size);
+
+  /* Once the layout exists, hints are refused and change nothing. */
+  ASSERT(l->field_count <= 64);
+  memcpy(before, l->fields, l->field_count * sizeof(*before));
+  ASSERT(!upb_msgfactory_sethotfields(f, node_md, other, 1));
+  ASSERT(upb_msgfactory_getlayout(f, node_md) == l);
+  ASSERT(memcmp(before, l->fields, l->field_count * sizeof(*before)) == 0);
+  ASSERT(!upb_msgfactory_setextendable(f, node_md));
+  ASSERT(!l->extendable);
+
+  upb_msgfactory_free(f);
+}
+
+/* Looks up |n| keys in |map|, whose values are int32, with
+ * upb_map_getbatch() and checks each result against upb_map_get().  Returns
+ * how many were found. */
+static size_t check_getbatch(const upb_map *map, const upb_msgval *keys,
+                             size_t n) {
+  upb_msgval vals[64];
+  bool found[64];
+  size_t count = 0;
+  size_t ret;
+  size_t i;
+
+  ASSERT(n <= 64);
+  memset(found, 0, sizeof(found));
+  ret = upb_map_getbatch(map, keys, n, vals, found);
+  for (i = 0; i < n; i++) {
+    upb_msgval val;
+    bool present = upb_map_get(map, keys[i], &val);
+    ASSERT(found[i] == present);
+    if (present) {
+      ASSERT(vals[i].i32 == val.i32);
+      count++;
+    }
+  }
+  ASSERT(ret == count);
+  return ret;
+}
+
+static void test_map_getbatch() {
+  upb_arena arena;
+  upb_map *ints;
+  upb_map *strs;
+  upb_map *bools;
+  upb_msgval keys[40];
+  int32_t i;
+
+  upb_arena_init(&arena);
+  ints = upb_map_new(UPB_TYPE_INT32, UPB_TYPE_INT32, &arena);
+  strs = upb_map_new(UPB_TYPE_STRING, UPB_TYPE_INT32, &arena);
+  bools = upb_map_new(UPB_TYPE_BOOL, UPB_TYPE_INT32, &arena);
+  ASSERT(ints && strs && bools);
+
+  /* Key 0 is kept apart from the other integer keys, so look it up both
+   * before and after it is set, and among other keys in the same batch. */
+  keys[0] = upb_msgval_int32(0);
+  ASSERT(check_getbatch(ints, keys, 1) == 0);
+  ASSERT(check_getbatch(ints, keys, 0) == 0);
+
+  /* Even keys from -18 to 20, including 0; more than one batch's worth. */
+  for (i = -9; i <= 10; i++) {
+    ASSERT(upb_map_set(ints, upb_msgval_int32(i * 2), upb_msgval_int32(i),
+                       NULL));
+  }
+  for (i = 0; i < 40; i++) {
+    keys[i] = upb_msgval_int32(i - 19);
+  }
+  ASSERT(check_getbatch(ints, keys, 40) == 20);
+  ASSERT(check_getbatch(ints, keys + 19, 1) == 1);
+  ASSERT(upb_map_del(ints, upb_msgval_int32(0)));
+  ASSERT(check_getbatch(ints, keys, 40) == 19);
+
+  /* String keys, with the empty string as a key. */
+  ASSERT(upb_map_set(strs, upb_msgval_makestr("", 0), upb_msgval_int32(1),
+                     NULL));
+  ASSERT(upb_map_set(strs, upb_msgval_makestr("a", 1), upb_msgval_int32(2),
+                     NULL));
+  keys[0] = upb_msgval_makestr("a", 1);
+  keys[1] = upb_msgval_makestr("b", 1);
+  keys[2] = upb_msgval_makestr("", 0);
+  keys[3] = upb_msgval_makestr("a\0", 2);
+  ASSERT(check_getbatch(strs, keys, 4) == 2);
+
+  /* false is the bool key stored apart. */
+  keys[0] = upb_msgval_bool(false);
+  keys[1] = upb_msgval_bool(true);
+  ASSERT(check_getbatch(bools, keys, 2) == 0);
+  ASSERT(upb_map_set(bools, upb_msgval_bool(false), upb_msgval_int32(3),
+                     NULL));
+  ASSERT(check_getbatch(bools, keys, 2) == 1);
+  ASSERT(upb_map_set(bools, upb_msgval_bool(true), upb_msgval_int32(4),
+                     NULL));
+  ASSERT(check_getbatch(bools, keys, 2) == 2);
+
+  upb_arena_uninit(&arena);
+}
+
+int run_tests(int argc, char *argv[]) {
+  UPB_UNUSED(argc);
+  UPB_UNUSED(argv);
+  load_test_proto();
+  test_unknown_group();
+  test_end_group();
+  test_map_entry();
+  test_decodestream();
+  test_nesting_limit();
+  test_check_required();
+  test_decodemask();
+  test_unknown_spans();
+  test_extensions();
+  test_extension_run();
+  test_merge_equal_hash();
+  test_cachesize();
+  test_json_arrays();
+  test_deterministic();
+  test_bundle();
+  test_decodebatch();
+  test_generated_parser();
+  test_delimited();
+  test_decode_file();
+  test_stats();
+  test_hotfields();
+  test_map_getbatch();
+  upb_msgfactory_free(factory);
+  upb_symtab_free(symtab);
+  return 0;
+}
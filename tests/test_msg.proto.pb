@@ -0,0 +1,37 @@
+
+
+tests/test_msg.protoupb_test"
+Node
+id (Rid
+name (	Rname$
+child (2.upb_test.NodeRchild*
+children (2.upb_test.NodeRchildren*
+group (
+2.upb_test.Node.GroupRgroup2
+counts (2.upb_test.Node.CountsEntryRcounts/
+nodes	 (2.upb_test.Node.NodesEntryRnodes
+nums
+ (Rnums/
+flags (2.upb_test.Node.FlagsEntryRflags;
+Group
+a (Ra$
+nodes (2.upb_test.NodeRnodes9
+CountsEntry
+key (	Rkey
+value (Rvalue:8H
+
+NodesEntry
+key (Rkey$
+value (2.upb_test.NodeRvalue:88
+
+FlagsEntry
+key (Rkey
+value (Rvalue:8*2d"
+Required
+a (Ra(
+child (2.upb_test.RequiredRchild.
+group (
+2.upb_test.Required.GroupRgroup
+c (Rc
+Group
+b (Rb
\ No newline at end of file
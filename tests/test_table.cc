@@ -5,7 +5,6 @@
 
 #include <limits.h>
 #include <string.h>
-#include <sys/resource.h>
 #include <ext/hash_map>
 #include <iostream>
 #include <map>
@@ -327,17 +326,8 @@ template <class T> class TypedIntTable {
 
 }
 
-bool benchmark = false;
-#define CPU_TIME_PER_TEST 0.5
-
 using std::vector;
 
-double get_usertime() {
-  struct rusage usage;
-  getrusage(RUSAGE_SELF, &usage);
-  return usage.ru_utime.tv_sec + (usage.ru_utime.tv_usec/1000000.0);
-}
-
 /* num_entries must be a power of 2. */
 void test_strtable(const vector<std::string>& keys, uint32_t num_to_insert) {
   /* Initialize structures. */
@@ -391,7 +381,7 @@ void test_strtable(const vector<std::string>& keys, uint32_t num_to_insert) {
 }
 
 /* num_entries must be a power of 2. */
-void test_inttable(int32_t *keys, uint16_t num_entries, const char *desc) {
+void test_inttable(int32_t *keys, uint16_t num_entries) {
   /* Initialize structures. */
   typedef upb::TypedIntTable<uint32_t> Table;
   Table table;
@@ -467,108 +457,6 @@ void test_inttable(int32_t *keys, uint16_t num_entries, const char *desc) {
       ASSERT(!found.first);
     }
   }
-
-  if(!benchmark) {
-    return;
-  }
-
-  printf("%s\n", desc);
-
-  /* Test performance. We only test lookups for keys that are known to exist. */
-  uint16_t *rand_order = new uint16_t[num_entries];
-  for(uint16_t i = 0; i < num_entries; i++) {
-    rand_order[i] = i;
-  }
-  for(uint16_t i = num_entries - 1; i >= 1; i--) {
-    uint16_t rand_i = (random() / (double)RAND_MAX) * i;
-    ASSERT(rand_i <= i);
-    uint16_t tmp = rand_order[rand_i];
-    rand_order[rand_i] = rand_order[i];
-    rand_order[i] = tmp;
-  }
-
-  uintptr_t x = 0;
-  const int mask = num_entries - 1;
-  int time_mask = 0xffff;
-
-  printf("upb_inttable(seq): ");
-  fflush(stdout);
-  double before = get_usertime();
-  unsigned int i;
-
-#define MAYBE_BREAK \
-    if ((i & time_mask) == 0 && (get_usertime() - before) > CPU_TIME_PER_TEST) \
-      break;
-  for(i = 0; true; i++) {
-    MAYBE_BREAK;
-    int32_t key = keys[i & mask];
-    upb_value v;
-    bool ok = upb_inttable_lookup32(&table.table_.table_, key, &v);
-    x += (uintptr_t)ok;
-  }
-  double total = get_usertime() - before;
-  printf("%ld/s\n", (long)(i/total));
-  double upb_seq_i = i / 100;  // For later percentage calcuation.
-
-  printf("upb_inttable(rand): ");
-  fflush(stdout);
-  before = get_usertime();
-  for(i = 0; true; i++) {
-    MAYBE_BREAK;
-    int32_t key = keys[rand_order[i & mask]];
-    upb_value v;
-    bool ok = upb_inttable_lookup32(&table.table_.table_, key, &v);
-    x += (uintptr_t)ok;
-  }
-  total = get_usertime() - before;
-  printf("%ld/s\n", (long)(i/total));
-  double upb_rand_i = i / 100;  // For later percentage calculation.
-
-  printf("std::map<int32_t, int32_t>(seq): ");
-  fflush(stdout);
-  before = get_usertime();
-  for(i = 0; true; i++) {
-    MAYBE_BREAK;
-    int32_t key = keys[i & mask];
-    x += m[key];
-  }
-  total = get_usertime() - before;
-  printf("%ld/s (%0.1f%% of upb)\n", (long)(i/total), i / upb_seq_i);
-
-  printf("std::map<int32_t, int32_t>(rand): ");
-  fflush(stdout);
-  before = get_usertime();
-  for(i = 0; true; i++) {
-    MAYBE_BREAK;
-    int32_t key = keys[rand_order[i & mask]];
-    x += m[key];
-  }
-  total = get_usertime() - before;
-  printf("%ld/s (%0.1f%% of upb)\n", (long)(i/total), i / upb_rand_i);
-
-  printf("__gnu_cxx::hash_map<uint32_t, uint32_t>(seq): ");
-  fflush(stdout);
-  before = get_usertime();
-  for(i = 0; true; i++) {
-    MAYBE_BREAK;
-    int32_t key = keys[rand_order[i & mask]];
-    x += hm[key];
-  }
-  total = get_usertime() - before;
-  printf("%ld/s (%0.1f%% of upb)\n", (long)(i/total), i / upb_seq_i);
-
-  printf("__gnu_cxx::hash_map<uint32_t, uint32_t>(rand): ");
-  fflush(stdout);
-  before = get_usertime();
-  for(i = 0; true; i++) {
-    MAYBE_BREAK;
-    int32_t key = keys[rand_order[i & mask]];
-    x += hm[key];
-  }
-  total = get_usertime() - before;
-  if (x == INT_MAX) abort();
-  printf("%ld/s (%0.1f%% of upb)\n\n", (long)(i/total), i / upb_rand_i);
-  delete[] rand_order;
 }
 
 /*
@@ -614,12 +502,231 @@ void test_delete() {
   upb_inttable_uninit(&t);
 }
 
+/* Keys of every length up to and past the hash's 16-byte short-key path. */
+void test_strtable_keylengths() {
+  const std::string str = "abcdefghijklmnopqrstuvwxyz0123456789ABCDEF";
+  upb_strtable t;
+  upb_strtable_init(&t, UPB_CTYPE_INT32);
+  for (size_t i = 0; i <= str.size(); i++) {
+    ASSERT(upb_strtable_insert2(&t, str.c_str(), i, upb_value_int32(i)));
+  }
+  for (size_t i = 0; i <= str.size(); i++) {
+    upb_value v;
+    std::string key = str.substr(0, i);
+    ASSERT(upb_strtable_lookup2(&t, key.c_str(), i, &v));
+    ASSERT(upb_value_getint32(v) == (int32_t)i);
+    if (i > 0) {
+      key[i - 1] ^= 1;
+      ASSERT(!upb_strtable_lookup2(&t, key.c_str(), i, &v));
+    }
+  }
+  ASSERT(upb_strtable_count(&t) == str.size() + 1);
+  upb_strtable_uninit(&t);
+}
+
+void test_strtable_compact(const vector<std::string>& keys) {
+  upb_strtable t;
+  upb_strtable_init(&t, UPB_CTYPE_INT32);
+  for (size_t i = 0; i < keys.size(); i++) {
+    upb_strtable_insert(&t, keys[i].c_str(), upb_value_int32(i));
+  }
+  upb_strtable_compact(&t);
+  ASSERT(upb_strtable_count(&t) == keys.size());
+
+  /* This few keys always find a seed that puts each in a slot of its own. */
+  for (size_t i = 0; i < upb_table_size(&t.t); i++) {
+    ASSERT(t.t.entries[i].next == NULL);
+  }
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    upb_value v;
+    ASSERT(upb_strtable_lookup(&t, keys[i].c_str(), &v));
+    ASSERT(upb_value_getint32(v) == (int32_t)i);
+  }
+  ASSERT(!upb_strtable_lookup(&t, "google.protobuf.Empty", NULL));
+
+  /* Still an ordinary table afterwards. */
+  ASSERT(upb_strtable_insert(&t, "google.protobuf.Empty", upb_value_int32(-1)));
+  ASSERT(upb_strtable_remove(&t, keys[0].c_str(), NULL));
+  ASSERT(upb_strtable_lookup(&t, "google.protobuf.Empty", NULL));
+  ASSERT(!upb_strtable_lookup(&t, keys[0].c_str(), NULL));
+  upb_strtable_uninit(&t);
+}
+
+void test_strtable_clear(const vector<std::string>& keys) {
+  upb_strtable t;
+  upb_strtable_init(&t, UPB_CTYPE_INT32);
+  for (size_t i = 0; i < keys.size(); i++) {
+    upb_strtable_insert(&t, keys[i].c_str(), upb_value_int32(i));
+  }
+  size_t size_lg2 = t.t.size_lg2;
+
+  upb_strtable_clear(&t, &upb_alloc_global);
+  ASSERT(upb_strtable_count(&t) == 0);
+  ASSERT(t.t.size_lg2 == size_lg2);
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT(!upb_strtable_lookup(&t, keys[i].c_str(), NULL));
+  }
+  upb_strtable_iter iter;
+  upb_strtable_begin(&iter, &t);
+  ASSERT(upb_strtable_done(&iter));
+
+  /* Refilling it doesn't need to grow it. */
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT(upb_strtable_insert(&t, keys[i].c_str(), upb_value_int32(-i)));
+  }
+  ASSERT(t.t.size_lg2 == size_lg2);
+  for (size_t i = 0; i < keys.size(); i++) {
+    upb_value v;
+    ASSERT(upb_strtable_lookup(&t, keys[i].c_str(), &v));
+    ASSERT(upb_value_getint32(v) == -(int32_t)i);
+  }
+  upb_strtable_uninit(&t);
+}
+
+void test_lookupbatch(const vector<std::string>& keys) {
+  upb_strtable st;
+  upb_inttable it;
+  upb_strtable_init(&st, UPB_CTYPE_INT32);
+  upb_inttable_init(&it, UPB_CTYPE_INT32);
+
+  /* Every other key, so half the lookups miss.  The int keys span both the
+   * array part and the hash part. */
+  for (size_t i = 0; i < keys.size(); i += 2) {
+    upb_strtable_insert(&st, keys[i].c_str(), upb_value_int32(i));
+    upb_inttable_insert(&it, i, upb_value_int32(i));
+    if (i > 0) upb_inttable_insert(&it, i * 1000, upb_value_int32(i));
+  }
+  upb_inttable_compact(&it);
+
+  /* More than one batch's worth of lookups. */
+  vector<const char*> strs;
+  vector<size_t> lens;
+  vector<uintptr_t> ints;
+  for (size_t n = 0; n < 3; n++) {
+    for (size_t i = 1; i < keys.size(); i++) {
+      strs.push_back(keys[i].c_str());
+      lens.push_back(keys[i].size());
+      ints.push_back(i);
+      ints.push_back(i * 1000);
+    }
+  }
+
+  vector<upb_value> vals(ints.size());
+  bool *found = new bool[ints.size()];
+  size_t expected = 0;
+
+  size_t hits = upb_strtable_lookupbatch(&st, &strs[0], &lens[0], strs.size(),
+                                         &vals[0], found);
+  for (size_t i = 0; i < strs.size(); i++) {
+    int32_t key = (i % (keys.size() - 1)) + 1;
+    ASSERT(found[i] == (key % 2 == 0));
+    if (found[i]) {
+      ASSERT(upb_value_getint32(vals[i]) == key);
+      expected++;
+    }
+  }
+  ASSERT(hits == expected);
+
+  hits = upb_inttable_lookupbatch(&it, &ints[0], ints.size(), &vals[0], found);
+  for (size_t i = 0; i < ints.size(); i++) {
+    int32_t key = (i / 2 % (keys.size() - 1)) + 1;
+    ASSERT(found[i] == (key % 2 == 0));
+    if (found[i]) ASSERT(upb_value_getint32(vals[i]) == key);
+  }
+  ASSERT(hits == expected * 2);
+
+  delete[] found;
+  upb_strtable_uninit(&st);
+  upb_inttable_uninit(&it);
+}
+
+void test_inttable_entries32() {
+  upb_inttable t;
+  upb_inttable_init(&t, UPB_CTYPE_INT32);
+
+  /* Sparse enough that most keys end up in the hash part. */
+  for (int32_t i = 1; i <= 100; i++) {
+    upb_inttable_insert(&t, i * 1009, upb_value_int32(i));
+  }
+  upb_inttable_compact(&t);
+  ASSERT(t.entries32 == (sizeof(upb_tabent32) < sizeof(upb_tabent)));
+
+  for (int32_t i = 1; i <= 100; i++) {
+    upb_value v;
+    ASSERT(upb_inttable_lookup(&t, i * 1009, &v));
+    ASSERT(upb_value_getint32(v) == i);
+    ASSERT(upb_inttable_lookup32(&t, i * 1009, &v));
+    ASSERT(upb_value_getint32(v) == i);
+    ASSERT(!upb_inttable_lookup(&t, i * 1009 + 1, NULL));
+  }
+
+  size_t count = 0;
+  upb_inttable_iter iter;
+  for (upb_inttable_begin(&iter, &t); !upb_inttable_done(&iter);
+       upb_inttable_next(&iter), count++) {
+    uintptr_t key = upb_inttable_iter_key(&iter);
+    ASSERT(key % 1009 == 0);
+    ASSERT(upb_value_getint32(upb_inttable_iter_value(&iter)) ==
+           (int32_t)(key / 1009));
+  }
+  ASSERT(count == 100);
+
+  /* Removing keeps the compact entries; inserting goes back to upb_tabent. */
+  for (int32_t i = 1; i <= 100; i += 2) {
+    upb_value v;
+    ASSERT(upb_inttable_remove(&t, i * 1009, &v));
+    ASSERT(upb_value_getint32(v) == i);
+    ASSERT(!upb_inttable_remove(&t, i * 1009, NULL));
+  }
+  ASSERT(t.entries32 == (sizeof(upb_tabent32) < sizeof(upb_tabent)));
+  ASSERT(upb_inttable_insert(&t, 7, upb_value_int32(-7)));
+  ASSERT(upb_inttable_insert(&t, 1009 * 1009, upb_value_int32(1009)));
+  ASSERT(!t.entries32);
+
+  for (int32_t i = 1; i <= 100; i++) {
+    ASSERT(upb_inttable_lookup(&t, i * 1009, NULL) == (i % 2 == 0));
+  }
+  ASSERT(upb_inttable_lookup(&t, 1009 * 1009, NULL));
+  ASSERT(upb_inttable_count(&t) == 52);
+  upb_inttable_uninit(&t);
+}
+
+void test_inttable_compact_largekeys() {
+  upb_inttable t;
+  upb_inttable_init(&t, UPB_CTYPE_UINT32);
+
+  /* Dense keys, then more keys above the largest possible array part than
+   * its density threshold, and enough of them to need a hash part of more
+   * than 64k entries. */
+  for (uint32_t i = 1; i <= 1000; i++) {
+    upb_inttable_insert(&t, i, upb_value_uint32(i));
+  }
+  for (uint32_t i = 1; i <= 70000; i++) {
+    upb_inttable_insert(&t, 65536 + i * 60000, upb_value_uint32(i));
+  }
+  upb_inttable_compact(&t);
+  ASSERT(t.array_size == 1001);
+
+  for (uint32_t i = 1; i <= 1000; i++) {
+    upb_value v;
+    ASSERT(upb_inttable_lookup(&t, i, &v));
+    ASSERT(upb_value_getuint32(v) == i);
+  }
+  for (uint32_t i = 1; i <= 70000; i++) {
+    upb_value v;
+    ASSERT(upb_inttable_lookup(&t, 65536 + i * 60000, &v));
+    ASSERT(upb_value_getuint32(v) == i);
+    ASSERT(!upb_inttable_lookup(&t, 65536 + i * 60000 + 1, NULL));
+  }
+  upb_inttable_uninit(&t);
+}
+
 extern "C" {
 
 int run_tests(int argc, char *argv[]) {
-  for (int i = 1; i < argc; i++) {
-    if (strcmp(argv[i], "benchmark") == 0) benchmark = true;
-  }
+  UPB_UNUSED(argc);
+  UPB_UNUSED(argv);
 
   vector<std::string> keys;
   keys.push_back("google.protobuf.FileDescriptorSet");
@@ -644,17 +751,21 @@ int run_tests(int argc, char *argv[]) {
   for (int i = 0; i < 10; i++) {
     test_strtable(keys, 18);
   }
+  test_strtable_keylengths();
+  test_strtable_compact(keys);
+  test_strtable_clear(keys);
+  test_lookupbatch(keys);
 
   int32_t *keys1 = get_contiguous_keys(8);
-  test_inttable(keys1, 8, "Table size: 8, keys: 1-8 ====");
+  test_inttable(keys1, 8);
   delete[] keys1;
 
   int32_t *keys2 = get_contiguous_keys(64);
-  test_inttable(keys2, 64, "Table size: 64, keys: 1-64 ====\n");
+  test_inttable(keys2, 64);
   delete[] keys2;
 
   int32_t *keys3 = get_contiguous_keys(512);
-  test_inttable(keys3, 512, "Table size: 512, keys: 1-512 ====\n");
+  test_inttable(keys3, 512);
   delete[] keys3;
 
   int32_t *keys4 = new int32_t[64];
@@ -664,10 +775,12 @@ int run_tests(int argc, char *argv[]) {
     else
       keys4[i] = 10101+i;
   }
-  test_inttable(keys4, 64, "Table size: 64, keys: 1-32 and 10133-10164 ====\n");
+  test_inttable(keys4, 64);
   delete[] keys4;
 
   test_delete();
+  test_inttable_entries32();
+  test_inttable_compact_largekeys();
   test_int64_max_value();
 
   return 0;
@@ -262,11 +262,11 @@ end
 -- Dumps an initializer for the given strtable/inttable (respectively).  Its
 -- entries must have previously been added to the linktable.
 function Dumper:strtable(t)
-  -- UPB_STRTABLE_INIT(count, mask, type, size_lg2, entries)
+  -- UPB_STRTABLE_INIT2(count, mask, type, size_lg2, entries, seed)
   return string.format(
-      "UPB_STRTABLE_INIT(%d, %d, %s, %d, %s)",
+      "UPB_STRTABLE_INIT2(%d, %d, %s, %d, %s, %d)",
       t.count, t.mask, const(t, "ctype", upbtable) , t.size_lg2,
-      self.linktab:addr(t.entries[1].ptr))
+      self.linktab:addr(t.entries[1].ptr), t.seed)
 end
 
 function Dumper:inttable(t)
@@ -117,16 +117,52 @@ local function field_default(field)
   end
 end
 
-local function ctype(field, const)
+-- upb_msgval accessor suffix and upb_fieldtype_t for each field type, used by
+-- the accessors that go through upb_array and upb_map.
+local msgvalmap = {
+  [upb.TYPE_BOOL]     = "bool",
+  [upb.TYPE_FLOAT]    = "float",
+  [upb.TYPE_INT32]    = "int32",
+  [upb.TYPE_UINT32]   = "uint32",
+  [upb.TYPE_ENUM]     = "int32",
+  [upb.TYPE_DOUBLE]   = "double",
+  [upb.TYPE_INT64]    = "int64",
+  [upb.TYPE_UINT64]   = "uint64",
+  [upb.TYPE_STRING]   = "str",
+  [upb.TYPE_BYTES]    = "str",
+  [upb.TYPE_MESSAGE]  = "msg",
+}
+
+local fieldtypemap = {
+  [upb.TYPE_BOOL]     = "UPB_TYPE_BOOL",
+  [upb.TYPE_FLOAT]    = "UPB_TYPE_FLOAT",
+  [upb.TYPE_INT32]    = "UPB_TYPE_INT32",
+  [upb.TYPE_UINT32]   = "UPB_TYPE_UINT32",
+  [upb.TYPE_ENUM]     = "UPB_TYPE_ENUM",
+  [upb.TYPE_DOUBLE]   = "UPB_TYPE_DOUBLE",
+  [upb.TYPE_INT64]    = "UPB_TYPE_INT64",
+  [upb.TYPE_UINT64]   = "UPB_TYPE_UINT64",
+  [upb.TYPE_STRING]   = "UPB_TYPE_STRING",
+  [upb.TYPE_BYTES]    = "UPB_TYPE_BYTES",
+  [upb.TYPE_MESSAGE]  = "UPB_TYPE_MESSAGE",
+}
+
+local function is_map(field)
+  return field:label() == upb.LABEL_REPEATED and
+         field:type() == upb.TYPE_MESSAGE and
+         field:subdef():_map_entry()
+end
+
+-- The C type of a single value of this field: the field itself if it is
+-- singular, or one element if it is repeated.
+local function elemtype(field, const)
   if const then
     const = "const "
   else
     const = ""
   end
 
-  if field:label() == upb.LABEL_REPEATED then
-    return const .. "upb_array*"
-  elseif field:type() == upb.TYPE_MESSAGE then
+  if field:type() == upb.TYPE_MESSAGE then
     if field:containing_type():file() == field:subdef():file() then
       return const .. to_cident(field:subdef():full_name()) .. "*"
     else
@@ -139,6 +175,50 @@ local function ctype(field, const)
   end
 end
 
+local function ctype(field, const)
+  if is_map(field) then
+    return (const and "const " or "") .. "upb_map*"
+  elseif field:label() == upb.LABEL_REPEATED then
+    return (const and "const " or "") .. "upb_array*"
+  else
+    return elemtype(field, const)
+  end
+end
+
+-- Converts the upb_msgval expression |val| to a value of this field.
+local function from_msgval(field, val)
+  local ret = string.format("upb_msgval_get%s(%s)", msgvalmap[field:type()], val)
+  if field:type() == upb.TYPE_MESSAGE or field:type() == upb.TYPE_ENUM then
+    ret = string.format("(%s)%s", elemtype(field, true), ret)
+  end
+  return ret
+end
+
+local function to_msgval(field, val)
+  return string.format("upb_msgval_%s(%s)", msgvalmap[field:type()], val)
+end
+
+-- The default of a singular field with a hasbit, if it is something other
+-- than the zero that an unset field holds; nil otherwise.
+local function nonzero_default(field)
+  local default = field:default()
+  if field:type() == upb.TYPE_MESSAGE or default == nil then
+    return nil
+  elseif field:type() == upb.TYPE_STRING or field:type() == upb.TYPE_BYTES then
+    return default ~= "" and field_default(field) or nil
+  elseif field:type() == upb.TYPE_ENUM then
+    if type(default) == "string" then
+      default = field:subdef():value(default)
+    end
+    if default == 0 then return nil end
+    return enum_value_symbol(field:subdef(), field:subdef():value(default))
+  elseif field:type() == upb.TYPE_BOOL then
+    return default and "true" or nil
+  else
+    return default ~= 0 and tostring(default) or nil
+  end
+end
+
 local function emit_file_warning(filedef, append)
   append('/* This file was generated by upbc (the upb compiler) from the input\n')
   append(' * file:\n')
@@ -282,8 +362,12 @@ local function get_message_layout(msg)
     end
   end
 
-  -- Place hasbits at the beginning.
-  local offset = math.ceil(hasbit_count / 8)
+  -- Place hasbits at the beginning.  Hasbit numbers start at 1 (see
+  -- write_c_file()), so bit 0 is never used.
+  local offset = 0
+  if hasbit_count > 0 then
+    offset = math.ceil((hasbit_count + 1) / 8)
+  end
   offset = {offset, offset}  -- 32, 64 bit
   local offsets = {}
 
@@ -309,10 +393,8 @@ local function get_message_layout(msg)
     offsets[oneof] = case
 
     -- Place oneof fields.
-    for oneof in msg:oneofs() do
-      for field in oneof:fields() do
-        offsets[field] = data
-      end
+    for field in oneof:fields() do
+      offsets[field] = data
     end
   end
 
@@ -351,13 +433,19 @@ local function write_h_file(filedef, append)
     append('typedef struct %s %s;\n', msgname, msgname)
   end
 
+  for msg in filedef:defs(upb.DEF_MSG) do
+    append('extern const upb_msglayout %s_msginit;\n', to_cident(msg:full_name()))
+  end
+
   -- Forward-declare types not in this file, but used as submessages.
   for msg in filedef:defs(upb.DEF_MSG) do
     for field in msg:fields() do
       if field:type() == upb.TYPE_MESSAGE and
           field:subdef():file() ~= filedef then
         -- Forward declaration for message type declared in another file.
-        append('struct %s;\n', to_cident(field:subdef():full_name()))
+        local subname = to_cident(field:subdef():full_name())
+        append('struct %s;\n', subname)
+        append('extern const upb_msglayout %s_msginit;\n', subname)
       end
     end
   end
@@ -378,7 +466,6 @@ local function write_h_file(filedef, append)
     append("/* %s */\n\n", msg:full_name())
 
     local msgname = to_cident(msg:full_name())
-    append('extern const upb_msglayout %s_msginit;\n', msgname)
     append('UPB_INLINE %s *%s_new(upb_arena *arena) {\n', msgname, msgname)
     append('  return upb_msg_new(&%s_msginit, arena);\n', msgname)
     append('}\n')
@@ -409,18 +496,63 @@ local function write_h_file(filedef, append)
     end
 
     for field in msg:fields() do
-      append('UPB_INLINE %s %s_%s(const %s *msg) {',
-             ctype(field, true), msgname, field:name(), msgname)
+      local fieldname = msgname .. "_" .. field:name()
+      if has_hasbit(field) then
+        append('UPB_INLINE bool %s_has_%s(const %s *msg) { ' ..
+               'return UPB_HASBIT_AT(msg, %s); }\n',
+               msgname, field:name(), msgname, hasbit_indexes[field] + 1)
+      elseif field:containing_oneof() then
+        append('UPB_INLINE bool %s_has_%s(const %s *msg) { ' ..
+               'return UPB_HAS_ONEOF(msg, %s, %s); }\n',
+               msgname, field:name(), msgname,
+               get_sizeinit(offsets[field:containing_oneof()]), field:number())
+      end
+
+      append('UPB_INLINE %s %s(const %s *msg) {',
+             ctype(field, true), fieldname, msgname)
       if field:containing_oneof() then
         local data_offset = offsets[field]
         local case_offset = offsets[field:containing_oneof()]
         append(' return UPB_READ_ONEOF(msg, %s, %s, %s, %s, %s); }\n',
                ctype(field, true), get_sizeinit(data_offset),
                get_sizeinit(case_offset), field:number(), field_default(field))
+      elseif has_hasbit(field) and nonzero_default(field) then
+        append(' return UPB_HASBIT_AT(msg, %s) ? ' ..
+               'UPB_FIELD_AT(msg, %s, %s) : %s; }\n',
+               hasbit_indexes[field] + 1, ctype(field, true),
+               get_sizeinit(offsets[field]), nonzero_default(field))
       else
         append(' return UPB_FIELD_AT(msg, %s, %s); }\n',
                ctype(field, true), get_sizeinit(offsets[field]))
       end
+
+      if is_map(field) then
+        local key = field:subdef():field(1)
+        local val = field:subdef():field(2)
+        append('UPB_INLINE size_t %s_size(const %s *msg) {\n', fieldname, msgname)
+        append('  const upb_map *map = %s(msg);\n', fieldname)
+        append('  return map ? upb_map_size(map) : 0;\n')
+        append('}\n')
+        append('UPB_INLINE bool %s_get(const %s *msg, %s key, %s *val) {\n',
+               fieldname, msgname, elemtype(key, true), elemtype(val, true))
+        append('  const upb_map *map = %s(msg);\n', fieldname)
+        append('  upb_msgval v;\n')
+        append('  if (!map || !upb_map_get(map, %s, &v)) return false;\n',
+               to_msgval(key, "key"))
+        append('  *val = %s;\n', from_msgval(val, "v"))
+        append('  return true;\n')
+        append('}\n')
+      elseif field:label() == upb.LABEL_REPEATED then
+        append('UPB_INLINE size_t %s_size(const %s *msg) {\n', fieldname, msgname)
+        append('  const upb_array *arr = %s(msg);\n', fieldname)
+        append('  return arr ? upb_array_size(arr) : 0;\n')
+        append('}\n')
+        append('UPB_INLINE %s %s_at(const %s *msg, size_t i) {',
+               elemtype(field, true), fieldname, msgname)
+        append(' return %s; }\n',
+               from_msgval(field, string.format("upb_array_get(%s(msg), i)",
+                                                fieldname)))
+      end
     end
 
     append('\n')
@@ -434,12 +566,68 @@ local function write_h_file(filedef, append)
         append('UPB_WRITE_ONEOF(msg, %s, %s, value, %s, %s); }\n',
                ctype(field), get_sizeinit(data_offset), get_sizeinit(case_offset),
                field:number())
+      elseif has_hasbit(field) then
+        append('UPB_SET_HASBIT(msg, %s); UPB_FIELD_AT(msg, %s, %s) = value; }\n',
+               hasbit_indexes[field] + 1, ctype(field),
+               get_sizeinit(offsets[field]))
       else
         append('UPB_FIELD_AT(msg, %s, %s) = value; }\n',
                ctype(field), get_sizeinit(offsets[field]))
       end
     end
 
+    for field in msg:fields() do
+      local fieldname = msgname .. "_" .. field:name()
+      local offset = get_sizeinit(offsets[field])
+      if is_map(field) then
+        local key = field:subdef():field(1)
+        local val = field:subdef():field(2)
+        append('UPB_INLINE bool %s_set(%s *msg, %s key, %s val, upb_arena *arena) {\n',
+               fieldname, msgname, elemtype(key), elemtype(val))
+        append('  upb_map *map = _upb_msg_mutmap(msg, %s, %s, %s, arena);\n',
+               offset, fieldtypemap[key:type()], fieldtypemap[val:type()])
+        append('  return map && upb_map_set(map, %s, %s, NULL);\n',
+               to_msgval(key, "key"), to_msgval(val, "val"))
+        append('}\n')
+        append('UPB_INLINE bool %s_delete(%s *msg, %s key) {\n',
+               fieldname, msgname, elemtype(key))
+        append('  upb_map *map = UPB_FIELD_AT(msg, upb_map*, %s);\n', offset)
+        append('  return map && upb_map_del(map, %s);\n', to_msgval(key, "key"))
+        append('}\n')
+      elseif field:label() == upb.LABEL_REPEATED and
+             field:type() == upb.TYPE_MESSAGE then
+        local subtype = elemtype(field)
+        append('UPB_INLINE %s %s_add_%s(%s *msg, upb_arena *arena) {\n',
+               subtype, msgname, field:name(), msgname)
+        append('  upb_array *arr = _upb_msg_mutarray(msg, %s, UPB_TYPE_MESSAGE, arena);\n',
+               offset)
+        append('  %s sub = (%s)upb_msg_new(&%s_msginit, arena);\n',
+               subtype, subtype, to_cident(field:subdef():full_name()))
+        append('  return (sub && _upb_array_append(arr, upb_msgval_msg(sub))) ? sub : NULL;\n')
+        append('}\n')
+      elseif field:label() == upb.LABEL_REPEATED then
+        append('UPB_INLINE bool %s_add_%s(%s *msg, %s value, upb_arena *arena) {\n',
+               msgname, field:name(), msgname, elemtype(field))
+        append('  upb_array *arr = _upb_msg_mutarray(msg, %s, %s, arena);\n',
+               offset, fieldtypemap[field:type()])
+        append('  return _upb_array_append(arr, %s);\n', to_msgval(field, "value"))
+        append('}\n')
+      elseif field:type() == upb.TYPE_MESSAGE then
+        local subtype = elemtype(field)
+        append('UPB_INLINE %s %s_mutable_%s(%s *msg, upb_arena *arena) {\n',
+               subtype, msgname, field:name(), msgname)
+        append('  %s sub = (%s)%s(msg);\n', subtype, subtype, fieldname)
+        append('  if (!sub) {\n')
+        append('    sub = (%s)upb_msg_new(&%s_msginit, arena);\n',
+               subtype, to_cident(field:subdef():full_name()))
+        append('    if (!sub) return NULL;\n')
+        append('    %s_set_%s(msg, sub);\n', msgname, field:name())
+        append('  }\n')
+        append('  return sub;\n')
+        append('}\n')
+      end
+    end
+
     append('\n\n')
   end
 
@@ -452,7 +640,214 @@ local function write_h_file(filedef, append)
   append('#endif  /* %s_UPB_H_ */\n', basename_preproc)
 end
 
-local function write_c_file(filedef, hfilename, append)
+-- How a specialized parser reads each type of field: the C type it stores,
+-- and either the size of a fixed-width value or, for varints, the conversion
+-- from the uint64_t |val|.
+local parsemap = {
+  [upb.DESCRIPTOR_TYPE_DOUBLE]   = {"double", fixed = 8},
+  [upb.DESCRIPTOR_TYPE_FLOAT]    = {"float", fixed = 4},
+  [upb.DESCRIPTOR_TYPE_INT64]    = {"int64_t", "(int64_t)val"},
+  [upb.DESCRIPTOR_TYPE_UINT64]   = {"uint64_t", "val"},
+  [upb.DESCRIPTOR_TYPE_INT32]    = {"int32_t", "(int32_t)val"},
+  [upb.DESCRIPTOR_TYPE_FIXED64]  = {"uint64_t", fixed = 8},
+  [upb.DESCRIPTOR_TYPE_FIXED32]  = {"uint32_t", fixed = 4},
+  [upb.DESCRIPTOR_TYPE_BOOL]     = {"bool", "val != 0"},
+  [upb.DESCRIPTOR_TYPE_STRING]   = {"upb_stringview", string = true},
+  [upb.DESCRIPTOR_TYPE_BYTES]    = {"upb_stringview", string = true},
+  [upb.DESCRIPTOR_TYPE_UINT32]   = {"uint32_t", "(uint32_t)val"},
+  [upb.DESCRIPTOR_TYPE_ENUM]     = {"int32_t", "(int32_t)val"},
+  [upb.DESCRIPTOR_TYPE_SFIXED32] = {"int32_t", fixed = 4},
+  [upb.DESCRIPTOR_TYPE_SFIXED64] = {"int64_t", fixed = 8},
+  [upb.DESCRIPTOR_TYPE_SINT32]   =
+      {"int32_t", "(int32_t)((uint32_t)val >> 1) ^ -(int32_t)(val & 1)"},
+  [upb.DESCRIPTOR_TYPE_SINT64]   =
+      {"int64_t", "(int64_t)(val >> 1) ^ -(int64_t)(val & 1)"},
+}
+
+-- The fields a specialized parser handles itself: singular scalars and
+-- strings.  Submessages, groups, repeated fields and maps are left to
+-- upb_decode().
+local function parser_handles(field)
+  return field:label() ~= upb.LABEL_REPEATED and
+         parsemap[field:descriptor_type()] ~= nil
+end
+
+local function wire_type(field)
+  local entry = parsemap[field:descriptor_type()]
+  if entry.string then
+    return 2
+  elseif entry.fixed == 8 then
+    return 1
+  elseif entry.fixed == 4 then
+    return 5
+  else
+    return 0
+  end
+end
+
+local function tag_value(field)
+  return field:number() * 8 + wire_type(field)
+end
+
+-- The tag of |field| as it appears on the wire: a list of bytes.
+local function tag_bytes(field)
+  local n = tag_value(field)
+  local ret = {}
+  repeat
+    local byte = n % 128
+    n = math.floor(n / 128)
+    if n > 0 then byte = byte + 128 end
+    table.insert(ret, byte)
+  until n == 0
+  return ret
+end
+
+-- Writes a upb_msglayout_parsefunc for |msg| (see upb_msglayout.parse) and
+-- returns its name, or nil if it would handle none of the fields.
+--
+-- A switch() on the tag finds the code for each field, which decodes the
+-- value and stores it at the field's constant offset.  Fields tend to come
+-- in field number order, so after each field we check for the tag of the next
+-- one and jump straight to its code if it is there.  Anything we don't handle
+-- is handed back to upb_decode(), which calls us again after that field.
+local function write_parser(msg, append)
+  local msgname = to_cident(msg:full_name())
+  local hasbit_indexes, offsets, size = get_message_layout(msg)
+  local fields = {}
+  local has_varint = false
+  local has_string = false
+
+  if msg:_map_entry() then return nil end
+
+  local all = {}
+  for field in msg:fields() do
+    table.insert(all, field)
+    if parser_handles(field) then
+      table.insert(fields, field)
+      local entry = parsemap[field:descriptor_type()]
+      if entry.string then
+        has_string = true
+      elseif not entry.fixed then
+        has_varint = true
+      end
+    end
+  end
+
+  if #fields == 0 then return nil end
+
+  local by_number = function(a, b) return a:number() < b:number() end
+  table.sort(fields, by_number)
+  table.sort(all, by_number)
+
+  -- Which fields are jumped to from the one before: those that directly
+  -- follow it in the message, with a tag short enough to check in line.
+  local successor = {}
+  for i = 2, #all do
+    successor[all[i - 1]] = all[i]
+  end
+  local predicted = {}
+  for i = 2, #fields do
+    if successor[fields[i - 1]] == fields[i] and #tag_bytes(fields[i]) <= 2 then
+      predicted[i] = true
+    end
+  end
+
+  local parsename = msgname .. "_parse"
+  append('static bool %s(const char **ptr, const char *limit, upb_msg *msg,\n',
+         parsename)
+  append('    int options) {\n')
+  append('  const char *p = *ptr;\n')
+  append('  const char *field_start;\n')
+  append('  uint64_t tag;\n')
+  if has_varint then
+    append('  uint64_t val;\n')
+  end
+  if not has_string then
+    append('  UPB_UNUSED(options);\n')
+  end
+  append('\n')
+  append('  while (p < limit) {\n')
+  append('    field_start = p;\n')
+  append('    if (!_upb_decode_varint(&p, limit, &tag)) return false;\n')
+  append('    switch (tag) {\n')
+
+  for i, field in ipairs(fields) do
+    local entry = parsemap[field:descriptor_type()]
+    local ctype = entry[1]
+    local slot = string.format("UPB_FIELD_AT(msg, %s, %s)",
+                               ctype, get_sizeinit(offsets[field]))
+
+    append('      case %d:\n', tag_value(field))
+    if predicted[i] then
+      append('      field%d:\n', field:number())
+    end
+
+    if entry.string then
+      -- Strings that have to be copied or checked are upb_decode()'s job.
+      local opts = "UPB_DECODE_COPYSTRINGS"
+      if field:descriptor_type() == upb.DESCRIPTOR_TYPE_STRING then
+        opts = "(UPB_DECODE_COPYSTRINGS | UPB_DECODE_VALIDATEUTF8)"
+      end
+      append('        if (options & %s) goto fallback;\n', opts)
+      append('        if (!_upb_decode_string(&p, limit, &%s)) return false;\n',
+             slot)
+    elseif entry.fixed then
+      append('        if (!_upb_decode_fixed(&p, limit, &%s, %d)) return false;\n',
+             slot, entry.fixed)
+    else
+      append('        if (!_upb_decode_varint(&p, limit, &val)) return false;\n')
+      append('        %s = %s;\n', slot, entry[2])
+    end
+
+    if has_hasbit(field) then
+      append('        UPB_SET_HASBIT(msg, %s);\n', hasbit_indexes[field] + 1)
+    elseif field:containing_oneof() then
+      append('        UPB_FIELD_AT(msg, int, %s) = %d;\n',
+             get_sizeinit(offsets[field:containing_oneof()]), field:number())
+    end
+
+    if predicted[i + 1] then
+      local next = fields[i + 1]
+      local bytes = tag_bytes(next)
+      local cond = {string.format("limit - p >= %d", #bytes)}
+      for j, byte in ipairs(bytes) do
+        table.insert(cond, string.format("(uint8_t)p[%d] == %d", j - 1, byte))
+      end
+      append('        if (%s) {\n', table.concat(cond, " && "))
+      append('          field_start = p;\n')
+      append('          p += %d;\n', #bytes)
+      append('          goto field%d;\n', next:number())
+      append('        }\n')
+    end
+    append('        continue;\n')
+  end
+
+  append('      default:\n')
+  append('        goto fallback;\n')
+  append('    }\n')
+  append('  }\n')
+  append('\n')
+  append('  *ptr = p;\n')
+  append('  return true;\n')
+  append('\n')
+  append('fallback:\n')
+  append('  *ptr = field_start;\n')
+  append('  return true;\n')
+  append('}\n\n')
+
+  return parsename
+end
+
+-- Whether |options| asks for a specialized parser for |msg|.
+local function want_parser(msg, options)
+  local parsers = options and options.parsers
+  if parsers == true then
+    return true
+  end
+  return parsers ~= nil and parsers[msg:full_name()] ~= nil
+end
+
+local function write_c_file(filedef, hfilename, append, options)
   emit_file_warning(filedef, append)
 
   append('#include <stddef.h>\n')
@@ -471,6 +866,11 @@ local function write_c_file(filedef, hfilename, append)
   for msg in filedef:defs(upb.DEF_MSG) do
     local msgname = to_cident(msg:full_name())
 
+    local parser_ref = "NULL"
+    if want_parser(msg, options) then
+      parser_ref = write_parser(msg, append) or "NULL"
+    end
+
     local fields_array_ref = "NULL"
     local submsgs_array_ref = "NULL"
     local oneofs_array_ref = "NULL"
@@ -551,6 +951,57 @@ local function write_c_file(filedef, hfilename, append)
       append('};\n\n')
     end
 
+    -- Dense field number -> field index table; see UPB_MSGLAYOUT_DENSEMAX.
+    local dense_max = math.max(64, field_count * 4)
+    local dense_count = 0
+    local dense_array_ref = "NULL"
+    local dense_indexes = {}
+    for i, field in ipairs(fields_number_order) do
+      if field:number() <= dense_max then
+        dense_indexes[field:number()] = i
+        dense_count = field:number() + 1
+      end
+    end
+
+    if dense_count > 0 then
+      local dense_array_name = msgname .. "__dense"
+      dense_array_ref = "&" .. dense_array_name .. "[0]"
+      append('static const uint16_t %s[%s] = {\n', dense_array_name, dense_count)
+      for i = 0, dense_count - 1, 16 do
+        local row = {}
+        for j = i, math.min(i + 15, dense_count - 1) do
+          table.insert(row, tostring(dense_indexes[j] or 0))
+        end
+        append('  %s,\n', table.concat(row, ', '))
+      end
+      append('};\n\n')
+    end
+
+    -- Mask of the required fields' hasbits; see upb_msglayout.required.
+    local required = {}
+    local required_size = 0
+    local required_array_ref = "NULL"
+    for field in msg:fields() do
+      if field:label() == upb.LABEL_REQUIRED and has_hasbit(field) then
+        local bit = hasbit_indexes[field] + 1
+        local byte = math.floor(bit / 8)
+        -- Hasbits are distinct, so adding sets each bit once.
+        required[byte] = (required[byte] or 0) + 2 ^ (bit % 8)
+        required_size = math.max(required_size, byte + 1)
+      end
+    end
+
+    if required_size > 0 then
+      local required_array_name = msgname .. "__required"
+      required_array_ref = "&" .. required_array_name .. "[0]"
+      local row = {}
+      for i = 0, required_size - 1 do
+        table.insert(row, string.format("0x%02x", required[i] or 0))
+      end
+      append('static const uint8_t %s[%s] = {%s};\n\n', required_array_name,
+             required_size, table.concat(row, ', '))
+    end
+
     append('const upb_msglayout %s_msginit = {\n', msgname)
     append('  %s,\n', submsgs_array_ref)
     append('  %s,\n', fields_array_ref)
@@ -558,6 +1009,10 @@ local function write_c_file(filedef, hfilename, append)
            get_sizeinit(size), field_count,
            'false' -- TODO: extendable
           )
+    append('  %s, %s,\n', dense_count, dense_array_ref)
+    append('  %s,\n', msg:_map_entry() and 'true' or 'false')
+    append('  %s,\n', parser_ref)
+    append('  %s, %s,\n', required_size, required_array_ref)
 
     append('};\n\n')
   end
@@ -566,9 +1021,12 @@ local function write_c_file(filedef, hfilename, append)
   append('\n')
 end
 
-function export.write_gencode(filedef, hfilename, append_h, append_c)
+-- |options| may be nil, or a table with:
+--   parsers: true to write a specialized parser for every message, or a set
+--            of message full names to write one for.
+function export.write_gencode(filedef, hfilename, append_h, append_c, options)
   write_h_file(filedef, append_h)
-  write_c_file(filedef, hfilename, append_c)
+  write_c_file(filedef, hfilename, append_c, options)
 end
 
 return export
@@ -3,7 +3,9 @@
   The upb compiler.  It can write two different kinds of output
   files:
 
-  - generated code for a C API (foo.upb.h, foo.upb.c)
+  - generated code for a C API (foo.upb.h, foo.upb.c), optionally with
+    parsers specialized for some or all of the messages
+    (--generate-parsers)
   - (obsolete): definitions of upb defs. (foo.upbdefs.h, foo.upbdefs.c)
 
 --]]
@@ -13,11 +15,22 @@ local make_c_api = require "make_c_api"
 local upb = require "upb"
 
 local generate_upbdefs = false
+local gencode_options = {}
 
 for _, argument in ipairs(arg) do
   if argument.sub(argument, 1, 2) == "--" then
     if argument == "--generate-upbdefs" then
       generate_upbdefs = true
+    elseif argument == "--generate-parsers" then
+      -- A specialized parser for every message.
+      gencode_options.parsers = true
+    elseif argument.sub(argument, 1, 19) == "--generate-parsers=" then
+      -- A specialized parser for each message named, eg.
+      -- --generate-parsers=foo.Bar,foo.Baz
+      gencode_options.parsers = {}
+      for name in string.gmatch(argument.sub(argument, 20), "[^,]+") do
+        gencode_options.parsers[name] = true
+      end
     else
       print("Unknown flag: " .. argument)
       return 1
@@ -32,7 +45,8 @@ for _, argument in ipairs(arg) do
 end
 
 if not src then
-  print("Usage: upbc [--generate-upbdefs] <binary descriptor>")
+  print("Usage: upbc [--generate-upbdefs] [--generate-parsers[=Msg,...]] " ..
+        "<binary descriptor>")
   return 1
 end
 
@@ -96,7 +110,8 @@ for _, file in ipairs(files) do
     local happend = dump_cinit.file_appender(hfile)
     local cappend = dump_cinit.file_appender(cfile)
 
-    make_c_api.write_gencode(file, hfilename, happend, cappend)
+    make_c_api.write_gencode(file, hfilename, happend, cappend,
+                             gencode_options)
 
     hfile:close()
     cfile:close()
@@ -1406,6 +1406,13 @@ void lupb_def_registertypes(lua_State *L) {
   lupb_setfieldi(L, "HANDLER_ENDSUBMSG",   UPB_HANDLER_ENDSUBMSG);
   lupb_setfieldi(L, "HANDLER_STARTSEQ",    UPB_HANDLER_STARTSEQ);
   lupb_setfieldi(L, "HANDLER_ENDSEQ",      UPB_HANDLER_ENDSEQ);
+  lupb_setfieldi(L, "HANDLER_INT32ARRAY",  UPB_HANDLER_INT32ARRAY);
+  lupb_setfieldi(L, "HANDLER_INT64ARRAY",  UPB_HANDLER_INT64ARRAY);
+  lupb_setfieldi(L, "HANDLER_UINT32ARRAY", UPB_HANDLER_UINT32ARRAY);
+  lupb_setfieldi(L, "HANDLER_UINT64ARRAY", UPB_HANDLER_UINT64ARRAY);
+  lupb_setfieldi(L, "HANDLER_FLOATARRAY",  UPB_HANDLER_FLOATARRAY);
+  lupb_setfieldi(L, "HANDLER_DOUBLEARRAY", UPB_HANDLER_DOUBLEARRAY);
+  lupb_setfieldi(L, "HANDLER_BOOLARRAY",   UPB_HANDLER_BOOLARRAY);
 
   lupb_setfieldi(L, "SYNTAX_PROTO2",  UPB_SYNTAX_PROTO2);
   lupb_setfieldi(L, "SYNTAX_PROTO3",  UPB_SYNTAX_PROTO3);
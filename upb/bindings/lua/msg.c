@@ -174,6 +174,9 @@ static lupb_msgfactory *lupb_msgfactory_check(lua_State *L, int narg) {
 
 static void lupb_msgfactory_pushmsgclass(lua_State *L, int narg,
                                          const upb_msgdef *md) {
+  /* We push values before using |narg| again. */
+  if (narg < 0) narg = lua_gettop(L) + narg + 1;
+
   lupb_getuservalue(L, narg);
   lua_pushlightuserdata(L, (void*)md);
   lua_rawget(L, -2);
@@ -259,15 +262,34 @@ static const struct luaL_Reg lupb_msgfactory_mm[] = {
 
 /* Userval contains a map of:
  *   [1] -> MessageFactory (to keep GC-reachable)
+ *   [2] -> field table: [field name] -> [lightuserdata lupb_fieldinfo*]
  *   [const upb_msgdef*] -> [lupb_msgclass userdata]
+ *
+ * The field table lets field access find a field with one lookup of a Lua
+ * string, which Lua has already hashed, rather than hashing the name again
+ * in upb_msgdef_ntof().  Every message of the class refers to the same
+ * table.
  */
 
 #define LUPB_MSGCLASS_FACTORY 1
+#define LUPB_MSGCLASS_FIELDS 2
+
+/* What field access needs to know about a field, worked out once per class
+ * instead of on every access. */
+typedef struct {
+  const upb_fielddef *f;
+  upb_fieldtype_t type;
+  int index;        /* For upb_msg_get()/upb_msg_set(). */
+  int userval;      /* Index in the message's userval, or 0 if not kept. */
+} lupb_fieldinfo;
 
 struct lupb_msgclass {
   const upb_msglayout *layout;
   const upb_msgdef *msgdef;
   const lupb_msgfactory *lfactory;
+
+  /* One per field, in the same userdata. */
+  lupb_fieldinfo *fields;
 };
 
 /* Type-checks for assigning to a message field. */
@@ -339,15 +361,40 @@ static const lupb_msgclass *lupb_msgclass_getsubmsgclass(lua_State *L, int narg,
   return lupb_msgclass_msgclassfor(L, narg, upb_fielddef_msgsubdef(f));
 }
 
+static bool in_userval(const upb_fielddef *f);
+int lupb_fieldindex(const upb_fielddef *f);
+
 static int lupb_msgclass_pushnew(lua_State *L, int factory,
                                  const upb_msgdef *md) {
   const lupb_msgfactory *lfactory = lupb_msgfactory_check(L, factory);
-  lupb_msgclass *lmc = lupb_newuserdata(L, sizeof(*lmc), LUPB_MSGCLASS);
+  int n = upb_msgdef_numfields(md);
+  lupb_msgclass *lmc = lupb_newuserdata(
+      L, sizeof(*lmc) + n * sizeof(lupb_fieldinfo), LUPB_MSGCLASS);
+  upb_msg_field_iter i;
+  int j = 0;
 
   lupb_uservalseti(L, -1, LUPB_MSGCLASS_FACTORY, factory);
   lmc->layout = upb_msgfactory_getlayout(lfactory->factory, md);
   lmc->lfactory = lfactory;
   lmc->msgdef = md;
+  lmc->fields = (lupb_fieldinfo*)(lmc + 1);
+
+  lupb_getuservalue(L, -1);
+  lua_newtable(L);
+  for (upb_msg_field_begin(&i, md);
+       !upb_msg_field_done(&i);
+       upb_msg_field_next(&i), j++) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    lupb_fieldinfo *info = &lmc->fields[j];
+    info->f = f;
+    info->type = upb_fielddef_type(f);
+    info->index = upb_fielddef_index(f);
+    info->userval = in_userval(f) ? lupb_fieldindex(f) : 0;
+    lua_pushlightuserdata(L, info);
+    lua_setfield(L, -2, upb_fielddef_name(f));
+  }
+  lua_rawseti(L, -2, LUPB_MSGCLASS_FIELDS);
+  lua_pop(L, 1);  /* Userval. */
 
   return 1;
 }
@@ -359,8 +406,11 @@ static int lupb_msgclass_pushnew(lua_State *L, int factory,
  *
  * Handles:
  *   msg = MessageClass()
+ *   msg = MessageClass(arena)
  *
- * Creates a new message from the given MessageClass.
+ * Creates a new message from the given MessageClass, in |arena| (from
+ * upb.Arena()) if given.  Everything later parsed into the message is
+ * allocated from the same arena.
  */
 static int lupb_msgclass_call(lua_State *L) {
   lupb_msg_pushnew(L, 1);
@@ -468,6 +518,9 @@ typedef struct {
 
 #define ARRAY_MSGCLASS_INDEX 0
 
+/* For an array that belongs to a message, the message (to keep GC-reachable). */
+#define ARRAY_OWNER_INDEX -1
+
 static lupb_array *lupb_array_check(lua_State *L, int narg) {
   return luaL_checkudata(L, narg, LUPB_ARRAY);
 }
@@ -599,10 +652,13 @@ typedef struct {
 
 #define MAP_MSGCLASS_INDEX 0
 
+/* For a map that belongs to a message, the message (to keep GC-reachable). */
+#define MAP_OWNER_INDEX -1
+
 /* lupb_map internal functions */
 
 static lupb_map *lupb_map_check(lua_State *L, int narg) {
-  return luaL_checkudata(L, narg, LUPB_ARRAY);
+  return luaL_checkudata(L, narg, LUPB_MAP);
 }
 
 /**
@@ -824,13 +880,21 @@ static const struct luaL_Reg lupb_map_mm[] = {
  * Our userval contains:
  *
  * - [0] -> our message class
+ * - [-1] -> what keeps our upb_msg alive: its arena, or the message it is a
+ *   submessage of
+ * - [-2] -> our message class's field table
+ * - [-3] -> set of values the upb_msg points into (see lupb_msg_retain())
  * - [lupb_fieldindex(f)] -> [lupb_{string,array,map,msg} userdata]
  *
- * Fields with scalar number/bool types don't go in the userval.
+ * Fields with scalar number/bool types don't go in the userval.  The others
+ * are wrapped the first time they are read, and the wrapper is kept for later
+ * reads.
  */
 
 #define LUPB_MSG_MSGCLASSINDEX 0
 #define LUPB_MSG_ARENA -1
+#define LUPB_MSG_FIELDS -2
+#define LUPB_MSG_RETAINED -3
 
 int lupb_fieldindex(const upb_fielddef *f) {
   return upb_fielddef_index(f) + 1;  /* 1-based Lua arrays. */
@@ -873,21 +937,27 @@ const upb_msgdef *lupb_msg_checkdef(lua_State *L, int narg) {
   return lupb_msg_check(L, narg)->lmsgclass->msgdef;
 }
 
-static const upb_fielddef *lupb_msg_checkfield(lua_State *L,
-                                               const lupb_msg *msg,
-                                               int fieldarg) {
-  size_t len;
-  const char *fieldname = luaL_checklstring(L, fieldarg, &len);
-  const upb_msgdef *msgdef = msg->lmsgclass->msgdef;
-  const upb_fielddef *f = upb_msgdef_ntof(msgdef, fieldname, len);
-
-  if (!f) {
-    const char *msg = lua_pushfstring(L, "no such field: %s", fieldname);
-    luaL_argerror(L, fieldarg, msg);
+/* Looks up the field named by |fieldarg| in the field table of the message
+ * at |msg|, and leaves the message's userval on the stack. */
+static const lupb_fieldinfo *lupb_msg_checkfield(lua_State *L, int msg,
+                                                 int fieldarg) {
+  const char *fieldname = luaL_checkstring(L, fieldarg);
+  const lupb_fieldinfo *info;
+
+  lupb_getuservalue(L, msg);
+  lua_rawgeti(L, -1, LUPB_MSG_FIELDS);
+  lua_pushvalue(L, fieldarg);
+  lua_rawget(L, -2);
+  info = lua_touserdata(L, -1);
+  lua_pop(L, 2);  /* Field info, field table. */
+
+  if (!info) {
+    const char *errmsg = lua_pushfstring(L, "no such field: %s", fieldname);
+    luaL_argerror(L, fieldarg, errmsg);
     return NULL;  /* Never reached. */
   }
 
-  return f;
+  return info;
 }
 
 static const lupb_msgclass *lupb_msg_msgclassfor(lua_State *L, int narg,
@@ -902,19 +972,89 @@ static const lupb_msgclass *lupb_msg_getsubmsgclass(lua_State *L, int narg,
   return lupb_msgclass_getsubmsgclass(L, -1, f);
 }
 
+/* Sets the message class entries of the userval of the new message on top of
+ * the stack.  |msgclass| must be an absolute index. */
+static void lupb_msg_setclass(lua_State *L, int msgclass) {
+  lupb_uservalseti(L, -1, LUPB_MSG_MSGCLASSINDEX, msgclass);
+  lupb_getuservalue(L, -1);
+  lupb_uservalgeti(L, msgclass, LUPB_MSGCLASS_FIELDS);
+  lua_rawseti(L, -2, LUPB_MSG_FIELDS);
+  lua_pop(L, 1);  /* Userval. */
+}
+
+/* Pushes a message wrapping |msg|, which is kept alive by the value on top of
+ * the stack. */
 int lupb_msg_pushref(lua_State *L, int msgclass, upb_msg *msg) {
   const lupb_msgclass *lmsgclass = lupb_msgclass_check(L, msgclass);
+  int owner = lua_gettop(L);
   lupb_msg *lmsg = lupb_newuserdata(L, sizeof(lupb_msg), LUPB_MSG);
 
   lmsg->lmsgclass = lmsgclass;
   lmsg->msg = msg;
 
-  lupb_uservalseti(L, -1, LUPB_MSG_MSGCLASSINDEX, msgclass);
-  lupb_uservalseti(L, -1, LUPB_MSG_ARENA, -2);
+  lupb_uservalseti(L, -1, LUPB_MSG_ARENA, owner);
+  lupb_msg_setclass(L, msgclass);
 
   return 1;
 }
 
+/* Pushes a wrapper for the submessage, array or map in field |info| of the
+ * message at |msg| (an absolute index), or nil if the field has none.  The
+ * wrapper keeps the message, and so the data, alive. */
+static void lupb_msg_pushwrapper(lua_State *L, int msg,
+                                 const lupb_fieldinfo *info) {
+  lupb_msg *lmsg = lupb_msg_check(L, msg);
+  upb_msgval val = upb_msg_get(lmsg->msg, info->index, lmsg->lmsgclass->layout);
+  const upb_fielddef *f = info->f;
+  int wrapper = lua_gettop(L) + 1;
+
+  /* The msgclass lookups leave values on the stack; we trim it at the end. */
+  if (upb_fielddef_ismap(f)) {
+    const upb_fielddef *value_field =
+        upb_msgdef_itof(upb_fielddef_msgsubdef(f), UPB_MAPENTRY_VALUE);
+    lupb_map *lmap;
+    if (!upb_msgval_getmap(val)) {
+      lua_pushnil(L);
+      return;
+    }
+    lmap = lupb_newuserdata(L, sizeof(*lmap), LUPB_MAP);
+    lmap->map = (upb_map*)upb_msgval_getmap(val);
+    lmap->value_lmsgclass = NULL;
+    lupb_uservalseti(L, wrapper, MAP_OWNER_INDEX, msg);
+    if (upb_fielddef_type(value_field) == UPB_TYPE_MESSAGE) {
+      lmap->value_lmsgclass =
+          lupb_msg_msgclassfor(L, msg, upb_fielddef_msgsubdef(value_field));
+      lupb_uservalseti(L, wrapper, MAP_MSGCLASS_INDEX, lua_gettop(L));
+    }
+  } else if (upb_fielddef_isseq(f)) {
+    lupb_array *larray;
+    if (!upb_msgval_getarr(val)) {
+      lua_pushnil(L);
+      return;
+    }
+    larray = lupb_newuserdata(L, sizeof(*larray), LUPB_ARRAY);
+    larray->arr = (upb_array*)upb_msgval_getarr(val);
+    larray->lmsgclass = NULL;
+    lupb_uservalseti(L, wrapper, ARRAY_OWNER_INDEX, msg);
+    if (info->type == UPB_TYPE_MESSAGE) {
+      larray->lmsgclass = lupb_msg_getsubmsgclass(L, msg, f);
+      lupb_uservalseti(L, wrapper, ARRAY_MSGCLASS_INDEX, lua_gettop(L));
+    }
+  } else {
+    UPB_ASSERT(upb_fielddef_issubmsg(f));
+    if (!upb_msgval_getmsg(val)) {
+      lua_pushnil(L);
+      return;
+    }
+    lupb_msg_getsubmsgclass(L, msg, f);
+    lua_pushvalue(L, msg);
+    lupb_msg_pushref(L, lua_gettop(L) - 1, (upb_msg*)upb_msgval_getmsg(val));
+    lua_replace(L, wrapper);
+  }
+
+  lua_settop(L, wrapper);
+}
+
 /* lupb_msg Public API */
 
 /**
@@ -925,16 +1065,45 @@ int lupb_msg_pushref(lua_State *L, int msgclass, upb_msg *msg) {
  */
 static int lupb_msg_pushnew(lua_State *L, int narg) {
   const lupb_msgclass *lmsgclass = lupb_msgclass_check(L, narg);
+  bool hasarena = !lua_isnoneornil(L, narg + 1);
+  upb_arena *arena =
+      hasarena ? lupb_arena_check(L, narg + 1) : lupb_arena_get(L);
   lupb_msg *lmsg = lupb_newuserdata(L, sizeof(lupb_msg), LUPB_MSG);
 
   lmsg->lmsgclass = lmsgclass;
-  lmsg->msg = upb_msg_new(lmsgclass->layout, lupb_arena_get(L));
+  lmsg->msg = upb_msg_new(lmsgclass->layout, arena);
 
-  lupb_uservalseti(L, -1, LUPB_MSG_MSGCLASSINDEX, narg);
+  if (hasarena) {
+    lupb_uservalseti(L, -1, LUPB_MSG_ARENA, narg + 1);
+  }
+  lupb_msg_setclass(L, narg);
 
   return 1;
 }
 
+/* Keeps the value at |narg| alive for as long as the message at |msg|: for
+ * a string that a parse left the message pointing into, for example. */
+void lupb_msg_retain(lua_State *L, int msg, int narg) {
+  if (msg < 0) msg = lua_gettop(L) + msg + 1;
+  if (narg < 0) narg = lua_gettop(L) + narg + 1;
+
+  lupb_msg_check(L, msg);
+  lupb_getuservalue(L, msg);
+  lua_rawgeti(L, -1, LUPB_MSG_RETAINED);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, LUPB_MSG_RETAINED);
+  }
+
+  /* A set, so parsing the same string again doesn't grow it. */
+  lua_pushvalue(L, narg);
+  lua_pushboolean(L, 1);
+  lua_rawset(L, -3);
+  lua_pop(L, 2);  /* Set, userval. */
+}
+
 /**
  * lupb_msg_index
  *
@@ -945,32 +1114,35 @@ static int lupb_msg_pushnew(lua_State *L, int narg) {
  */
 static int lupb_msg_index(lua_State *L) {
   lupb_msg *lmsg = lupb_msg_check(L, 1);
-  const upb_fielddef *f = lupb_msg_checkfield(L, lmsg, 2);
+  const lupb_fieldinfo *info = lupb_msg_checkfield(L, 1, 2);
   const upb_msglayout *l = lmsg->lmsgclass->layout;
-  int field_index = upb_fielddef_index(f);
 
-  if (in_userval(f)) {
-    lupb_uservalgeti(L, 1, lupb_fieldindex(f));
+  if (info->userval) {
+    /* lupb_msg_checkfield() left our userval on top of the stack. */
+    int userval = lua_gettop(L);
+    lua_rawgeti(L, userval, info->userval);
 
     if (lua_isnil(L, -1)) {
-      /* Check if we need to lazily create wrapper. */
-      if (upb_fielddef_isseq(f)) {
-        /* TODO(haberman) */
-      } else if (upb_fielddef_issubmsg(f)) {
-        /* TODO(haberman) */
-      } else {
-        UPB_ASSERT(upb_fielddef_isstring(f));
-        if (upb_msg_has(lmsg->msg, field_index, l)) {
-          upb_msgval val = upb_msg_get(lmsg->msg, field_index, l);
-          lua_pop(L, 1);
-          lua_pushlstring(L, val.str.data, val.str.size);
-          lupb_uservalseti(L, 1, lupb_fieldindex(f), -1);
+      /* Lazily create the wrapper, and keep it for next time. */
+      lua_pop(L, 1);
+      if (upb_fielddef_isstring(info->f) && !upb_fielddef_isseq(info->f)) {
+        upb_msgval val;
+        if (!upb_msg_has(lmsg->msg, info->index, l)) {
+          lua_pushnil(L);
+          return 1;
         }
+        val = upb_msg_get(lmsg->msg, info->index, l);
+        lua_pushlstring(L, val.str.data, val.str.size);
+      } else {
+        lupb_msg_pushwrapper(L, 1, info);
+        if (lua_isnil(L, -1)) return 1;
       }
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, userval, info->userval);
     }
   } else {
-    upb_msgval val = upb_msg_get(lmsg->msg, field_index, l);
-    lupb_pushmsgval(L, upb_fielddef_type(f), val);
+    upb_msgval val = upb_msg_get(lmsg->msg, info->index, l);
+    lupb_pushmsgval(L, info->type, val);
   }
 
   return 1;
@@ -986,9 +1158,9 @@ static int lupb_msg_index(lua_State *L) {
  */
 static int lupb_msg_newindex(lua_State *L) {
   lupb_msg *lmsg = lupb_msg_check(L, 1);
-  const upb_fielddef *f = lupb_msg_checkfield(L, lmsg, 2);
-  upb_fieldtype_t type = upb_fielddef_type(f);
-  int field_index = upb_fielddef_index(f);
+  const lupb_fieldinfo *info = lupb_msg_checkfield(L, 1, 2);
+  const upb_fielddef *f = info->f;
+  upb_fieldtype_t type = info->type;
   upb_msgval msgval;
 
   /* Typecheck and get msgval. */
@@ -1009,10 +1181,10 @@ static int lupb_msg_newindex(lua_State *L) {
 
   /* Set in upb_msg and userval (if necessary). */
 
-  upb_msg_set(lmsg->msg, field_index, msgval, lmsg->lmsgclass->layout);
+  upb_msg_set(lmsg->msg, info->index, msgval, lmsg->lmsgclass->layout);
 
-  if (in_userval(f)) {
-    lupb_uservalseti(L, 1, lupb_fieldindex(f), 3);
+  if (info->userval) {
+    lupb_uservalseti(L, 1, info->userval, 3);
   }
 
   return 0;  /* 1 for chained assignments? */
@@ -1028,6 +1200,7 @@ static const struct luaL_Reg lupb_msg_mm[] = {
 /* lupb_msg toplevel **********************************************************/
 
 static const struct luaL_Reg lupb_msg_toplevel_m[] = {
+  {"Arena", lupb_arena_new},
   {"Array", lupb_array_new},
   {"Map", lupb_map_new},
   {"MessageFactory", lupb_msgfactory_new},
@@ -10,20 +10,141 @@
 #include "upb/encode.h"
 
 #define LUPB_PBDECODERMETHOD "lupb.pb.decodermethod"
+#define LUPB_PBBUFFER "lupb.pb.buffer"
 
+
+/* lupb_pbbuffer **************************************************************/
+
+/* A buffer that upb.pb.encode() can write into, so that encoding one message
+ * after another reuses the same memory instead of creating a Lua string for
+ * each.  It only grows. */
+typedef struct {
+  char *data;
+  size_t size;  /* Allocated bytes. */
+  size_t len;   /* Bytes of the last message encoded into it. */
+} lupb_pbbuffer;
+
+static lupb_pbbuffer *lupb_pbbuffer_check(lua_State *L, int narg) {
+  return luaL_checkudata(L, narg, LUPB_PBBUFFER);
+}
+
+/**
+ * lupb_pbbuffer_new()
+ *
+ * Handles:
+ *   buf = upb.pb.Buffer()
+ */
+static int lupb_pbbuffer_new(lua_State *L) {
+  lupb_pbbuffer *buf = lua_newuserdata(L, sizeof(*buf));
+  buf->data = NULL;
+  buf->size = 0;
+  buf->len = 0;
+  luaL_getmetatable(L, LUPB_PBBUFFER);
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+static int lupb_pbbuffer_gc(lua_State *L) {
+  lupb_pbbuffer *buf = lupb_pbbuffer_check(L, 1);
+  upb_gfree(buf->data);
+  buf->data = NULL;
+  return 0;
+}
+
+/**
+ * lupb_pbbuffer_len()
+ *
+ * Handles:
+ *   len = #buf
+ */
+static int lupb_pbbuffer_len(lua_State *L) {
+  lua_pushnumber(L, lupb_pbbuffer_check(L, 1)->len);
+  return 1;
+}
+
+/**
+ * lupb_pbbuffer_tostring()
+ *
+ * Handles:
+ *   str = buf:tostring()
+ *   str = tostring(buf)
+ *
+ * Copies the encoded message into a Lua string.
+ */
+static int lupb_pbbuffer_tostring(lua_State *L) {
+  lupb_pbbuffer *buf = lupb_pbbuffer_check(L, 1);
+  lua_pushlstring(L, buf->data, buf->len);
+  return 1;
+}
+
+/**
+ * lupb_pbbuffer_ptr()
+ *
+ * Handles:
+ *   ptr = buf:ptr()
+ *
+ * Returns the encoded message's bytes as a light userdata, for handing to C
+ * (through the LuaJIT FFI, say) without a copy.  The pointer is only valid
+ * until the buffer is encoded into again or collected.
+ */
+static int lupb_pbbuffer_ptr(lua_State *L) {
+  lua_pushlightuserdata(L, lupb_pbbuffer_check(L, 1)->data);
+  return 1;
+}
+
+static const struct luaL_Reg lupb_pbbuffer_m[] = {
+  {"ptr", lupb_pbbuffer_ptr},
+  {"tostring", lupb_pbbuffer_tostring},
+  {NULL, NULL}
+};
+
+static const struct luaL_Reg lupb_pbbuffer_mm[] = {
+  {"__gc", lupb_pbbuffer_gc},
+  {"__len", lupb_pbbuffer_len},
+  {"__tostring", lupb_pbbuffer_tostring},
+  {NULL, NULL}
+};
+
+
+/* Functions ******************************************************************/
+
+/**
+ * lupb_pb_decode()
+ *
+ * Handles:
+ *   upb.pb.decode(msg, str)
+ *
+ * Parses |str| into |msg|.  String and bytes fields point into |str| rather
+ * than copying it, and |msg| keeps |str| alive for as long as it needs it.
+ * Everything else is allocated from the message's arena.
+ */
 static int lupb_pb_decode(lua_State *L) {
   size_t len;
   const upb_msglayout *layout;
   upb_msg *msg = lupb_msg_checkmsg2(L, 1, &layout);
-  const char *pb = lua_tolstring(L, 2, &len);
+  const char *pb = lupb_checkstring(L, 2, &len);
   upb_stringview buf = upb_stringview_make(pb, len);
 
-  upb_decode(buf, msg, layout);
-  /* TODO(haberman): check for error. */
+  lupb_msg_retain(L, 1, 2);
+
+  if (!upb_decode(buf, msg, layout)) {
+    luaL_error(L, "Error decoding protobuf.");
+  }
 
   return 0;
 }
 
+/**
+ * lupb_pb_encode()
+ *
+ * Handles:
+ *   str = upb.pb.encode(msg)
+ *   buf = upb.pb.encode(msg, buf)
+ *
+ * Serializes |msg|, into a new string or into |buf| (from upb.pb.Buffer()),
+ * which is returned.  A buffer is grown as needed and then reused, so
+ * encoding into one does not allocate once it is big enough.
+ */
 static int lupb_pb_encode(lua_State *L) {
   const upb_msglayout *layout;
   const upb_msg *msg = lupb_msg_checkmsg2(L, 1, &layout);
@@ -31,6 +152,25 @@ static int lupb_pb_encode(lua_State *L) {
   size_t size;
   char *result;
 
+  if (!lua_isnoneornil(L, 2)) {
+    lupb_pbbuffer *buf = lupb_pbbuffer_check(L, 2);
+    size = upb_encode_tobuf(msg, layout, buf->data, buf->size);
+
+    if (size > buf->size) {
+      char *data = upb_grealloc(buf->data, buf->size, size);
+      if (!data) {
+        luaL_error(L, "Out of memory.");
+      }
+      buf->data = data;
+      buf->size = size;
+      size = upb_encode_tobuf(msg, layout, buf->data, buf->size);
+    }
+
+    buf->len = size;
+    lua_pushvalue(L, 2);
+    return 1;
+  }
+
   upb_arena_init(&arena);
 
   result = upb_encode(msg, (const void*)layout, &arena, &size);
@@ -44,6 +184,7 @@ static int lupb_pb_encode(lua_State *L) {
 }
 
 static const struct luaL_Reg toplevel_m[] = {
+  {"Buffer", lupb_pbbuffer_new},
   {"decode", lupb_pb_decode},
   {"encode", lupb_pb_encode},
   {NULL, NULL}
@@ -55,5 +196,7 @@ int luaopen_upb_pb_c(lua_State *L) {
     return 1;
   }
 
+  lupb_register_type(L, LUPB_PBBUFFER, lupb_pbbuffer_m, lupb_pbbuffer_mm);
+
   return 1;
 }
@@ -78,8 +78,26 @@ static void lupbtable_pushent(lua_State *L, const upb_tabent *e,
   lupbtable_setmetafields(L, ctype, e);
 }
 
+/* Like lupbtable_pushent(), for an inttable's compact entries.  They come out
+ * looking like upb_tabent entries, with the same chains. */
+static void lupbtable_pushent32(lua_State *L, const upb_tabent32 *ents,
+                                size_t i, int ctype) {
+  const upb_tabent32 *e = &ents[i];
+  lua_newtable(L);
+  if (e->key != 0) {
+    lua_pushnumber(L, e->key);
+    lua_setfield(L, -2, "key");
+    lupbtable_pushval(L, e->val, ctype);
+    lua_setfield(L, -2, "value");
+  }
+  lua_pushlightuserdata(L, e->next ? (void*)&ents[e->next - 1] : NULL);
+  lua_setfield(L, -2, "next");
+  lupbtable_setmetafields(L, ctype, e);
+}
+
 /* Dumps the shared part of upb_table into a Lua table. */
-static void lupbtable_pushtable(lua_State *L, const upb_table *t, bool inttab) {
+static void lupbtable_pushtable(lua_State *L, const upb_table *t, bool inttab,
+                                bool entries32) {
   size_t i;
 
   lua_newtable(L);
@@ -90,7 +108,11 @@ static void lupbtable_pushtable(lua_State *L, const upb_table *t, bool inttab) {
 
   lua_newtable(L);
   for (i = 0; i < upb_table_size(t); i++) {
-    lupbtable_pushent(L, &t->entries[i], inttab, t->ctype);
+    if (entries32) {
+      lupbtable_pushent32(L, (const upb_tabent32*)t->entries, i, t->ctype);
+    } else {
+      lupbtable_pushent(L, &t->entries[i], inttab, t->ctype);
+    }
     lua_rawseti(L, -2, i + 1);
   }
   lua_setfield(L, -2, "entries");
@@ -100,7 +122,7 @@ static void lupbtable_pushtable(lua_State *L, const upb_table *t, bool inttab) {
 static void lupbtable_pushinttable(lua_State *L, const upb_inttable *t) {
   size_t i;
 
-  lupbtable_pushtable(L, &t->t, true);
+  lupbtable_pushtable(L, &t->t, true, t->entries32);
   lupbtable_setnum(L, -1, "array_size", t->array_size);
   lupbtable_setnum(L, -1, "array_count", t->array_count);
 
@@ -118,7 +140,8 @@ static void lupbtable_pushinttable(lua_State *L, const upb_inttable *t) {
 }
 
 static void lupbtable_pushstrtable(lua_State *L, const upb_strtable *t) {
-  lupbtable_pushtable(L, &t->t, false);
+  lupbtable_pushtable(L, &t->t, false, false);
+  lupbtable_setnum(L, -1, "seed", t->seed);
 }
 
 static int lupbtable_msgdef_itof(lua_State *L) {
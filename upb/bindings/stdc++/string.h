@@ -2,6 +2,11 @@
 #ifndef UPB_STDCPP_H_
 #define UPB_STDCPP_H_
 
+#include <string.h>
+
+#include <string>
+
+#include "upb/msg.h"
 #include "upb/sink.h"
 
 namespace upb {
@@ -42,6 +47,85 @@ class FillStringHandler {
   }
 };
 
+// A string whose bytes live in a upb::Arena, for filling many string fields
+// without one heap allocation each.  Growth reallocates within the arena,
+// which extends the buffer in place when it was the arena's last allocation,
+// and nothing is ever freed before the arena is.  The arena must outlive the
+// string.
+class ArenaString {
+ public:
+  explicit ArenaString(Arena* arena)
+      : arena_(arena), data_(NULL), size_(0), capacity_(0) {}
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // A view of the current contents, valid until the next append.
+  upb_stringview view() const { return upb_stringview_make(data_, size_); }
+  std::string ToString() const { return std::string(data_, size_); }
+
+  void clear() { size_ = 0; }
+
+  // Makes room for at least |n| bytes in total.  Returns false if the arena
+  // is out of memory.
+  bool reserve(size_t n) {
+    if (n <= capacity_) return true;
+    if (n < capacity_ * 2) n = capacity_ * 2;
+    void* p = upb_realloc(arena_->allocator(), data_, capacity_, n);
+    if (!p) return false;
+    data_ = static_cast<char*>(p);
+    capacity_ = n;
+    return true;
+  }
+
+  // Returns false if the arena is out of memory.
+  bool append(const char* buf, size_t n) {
+    if (!reserve(size_ + n)) return false;
+    memcpy(data_ + size_, buf, n);
+    size_ += n;
+    return true;
+  }
+
+ private:
+  Arena* arena_;
+  char* data_;
+  size_t size_;
+  size_t capacity_;
+
+  UPB_DISALLOW_COPY_AND_ASSIGN(ArenaString)
+};
+
+// ArenaString reports running out of memory by return value rather than by
+// throwing, and uses the size hint to allocate the whole string up front.
+template <>
+class FillStringHandler<ArenaString> {
+ public:
+  static void SetHandler(BytesHandler* handler) {
+    upb_byteshandler_setstartstr(handler, &FillStringHandler::StartString,
+                                 NULL);
+    upb_byteshandler_setstring(handler, &FillStringHandler::StringBuf, NULL);
+  }
+
+ private:
+  static void* StartString(void *c, const void *hd, size_t size) {
+    UPB_UNUSED(hd);
+
+    ArenaString* str = static_cast<ArenaString*>(c);
+    str->clear();
+    return str->reserve(size) ? c : NULL;
+  }
+
+  static size_t StringBuf(void* c, const void* hd, const char* buf, size_t n,
+                          const BufferHandle* h) {
+    UPB_UNUSED(hd);
+    UPB_UNUSED(h);
+
+    ArenaString* str = static_cast<ArenaString*>(c);
+    return str->append(buf, n) ? n : 0;
+  }
+};
+
 class StringSink {
  public:
   template <class T>
@@ -2,6 +2,7 @@
 #include "upb/upb.h"
 #include "upb/decode.h"
 #include "upb/structs.int.h"
+#include "upb/utf8.int.h"
 
 /* Maps descriptor type -> upb field type.  */
 const uint8_t upb_desctype_to_fieldtype[] = {
@@ -26,12 +27,28 @@ const uint8_t upb_desctype_to_fieldtype[] = {
   UPB_TYPE_INT64,           /* SINT64 */
 };
 
-/* Data pertaining to the parse. */
-typedef struct {
-  /* Current decoding pointer.  Points to the beginning of a field until we
-   * have finished decoding the whole field. */
-  const char *ptr;
-} upb_decstate;
+/* Maps descriptor type -> wire type, for fields that are not packed. */
+static const uint8_t upb_desctype_to_wiretype[] = {
+  UPB_WIRE_TYPE_END_GROUP,    /* ENDGROUP */
+  UPB_WIRE_TYPE_64BIT,        /* DOUBLE */
+  UPB_WIRE_TYPE_32BIT,        /* FLOAT */
+  UPB_WIRE_TYPE_VARINT,       /* INT64 */
+  UPB_WIRE_TYPE_VARINT,       /* UINT64 */
+  UPB_WIRE_TYPE_VARINT,       /* INT32 */
+  UPB_WIRE_TYPE_64BIT,        /* FIXED64 */
+  UPB_WIRE_TYPE_32BIT,        /* FIXED32 */
+  UPB_WIRE_TYPE_VARINT,       /* BOOL */
+  UPB_WIRE_TYPE_DELIMITED,    /* STRING */
+  UPB_WIRE_TYPE_START_GROUP,  /* GROUP */
+  UPB_WIRE_TYPE_DELIMITED,    /* MESSAGE */
+  UPB_WIRE_TYPE_DELIMITED,    /* BYTES */
+  UPB_WIRE_TYPE_VARINT,       /* UINT32 */
+  UPB_WIRE_TYPE_VARINT,       /* ENUM */
+  UPB_WIRE_TYPE_32BIT,        /* SFIXED32 */
+  UPB_WIRE_TYPE_64BIT,        /* SFIXED64 */
+  UPB_WIRE_TYPE_VARINT,       /* SINT32 */
+  UPB_WIRE_TYPE_VARINT,       /* SINT64 */
+};
 
 /* Data pertaining to a single message frame. */
 typedef struct {
@@ -41,21 +58,129 @@ typedef struct {
   /* These members are unset for an unknown group frame. */
   char *msg;
   const upb_msglayout *m;
+  const upb_decodemask *mask;  /* NULL to decode every field. */
+
+  /* If non-NULL, where parsing continues once this frame ends.  Used for map
+   * values, which may be followed by more of their entry. */
+  const char *resume;
+
+  /* Memory for the elements of |run_arr| that come next, allocated as one
+   * block when the first of a run of them is reached; see
+   * upb_decode_runslot().  Unset unless |run_arr| is non-NULL. */
+  upb_array *run_arr;
+  char *run;
+  char *run_end;
 } upb_decframe;
 
+/* Data pertaining to the parse. */
+typedef struct {
+  /* Current decoding pointer.  Points to the beginning of a field until we
+   * have finished decoding the whole field. */
+  const char *ptr;
+
+  /* Bitwise OR of upb_decodeopt values. */
+  int options;
+
+  /* When pre-scanning for a batch, its field's elements are handed to the
+   * batch instead of being parsed. */
+  upb_decodebatch *batch;
+
+  /* If non-NULL, where to count what we do. */
+  upb_decodestats *stats;
+
+  /* If non-NULL, the extensions to parse fields of extendable messages as. */
+  const upb_extreg *extreg;
+
+  /* The bottom frame holds only some of its message's fields, so it isn't
+   * checked for required fields when it ends (see upb_decodestream). */
+  bool partial;
+
+  /* If a missing required field failed the parse, its number. */
+  uint32_t missing;
+
+  /* The frames of the messages being parsed, outermost first.  |top| is the
+   * current one; no frame may be pushed at or past |limit|. */
+  upb_decframe *stack;
+  upb_decframe *top;
+  upb_decframe *limit;
+} upb_decstate;
+
+/* A contiguous run of a batch's elements, decoded into an arena of its own. */
+typedef struct {
+  upb_arena arena;
+  size_t begin;     /* Index of the first element in the batch. */
+  size_t end;
+  void **msgs;      /* The decoded elements, in order. */
+  bool done;        /* Set once every element is decoded. */
+} upb_decodechunk;
+
+struct upb_decodebatch {
+  char *msg;
+  const upb_msglayout *m;
+  const upb_msglayout_field *field;
+  int options;
+
+  /* The encoded elements, in order, and their total size. */
+  upb_stringview *elems;
+  size_t len;
+  size_t size;
+  size_t bytes;
+
+  upb_decodechunk *chunks;
+  size_t chunk_count;
+};
+
+#define UPB_PB_VARINT_MAX_LEN 10
 #define CHK(x) if (!(x)) { return false; }
 
 static bool upb_skip_unknowngroup(upb_decstate *d, int field_number,
                                   const char *limit);
-static bool upb_decode_message(upb_decstate *d, const char *limit,
-                               int group_number, char *msg,
-                               const upb_msglayout *l);
+static bool upb_decode_push(upb_decstate *d, const char *limit,
+                            int group_number, char *msg,
+                            const upb_msglayout *l,
+                            const upb_decodemask *mask);
+
+/* Decodes a varint without any bounds checks.  This may read up to
+ * UPB_PB_VARINT_MAX_LEN bytes, so it must only be used when at least that many
+ * bytes remain in the buffer.  Returns NULL if the varint is unterminated. */
+static const char *upb_decode_varint_fast(const char *ptr, uint64_t *val) {
+  const uint8_t *p = (const uint8_t*)ptr;
+  uint64_t b;
+  uint64_t v;
+
+#define BYTE(i)                                   \
+  b = p[i];                                       \
+  v |= (b & 0x7fU) << (7 * i);                    \
+  if (!(b & 0x80)) { *val = v; return ptr + i + 1; }
+
+  v = p[0] & 0x7fU;
+  BYTE(1) BYTE(2) BYTE(3) BYTE(4) BYTE(5) BYTE(6) BYTE(7) BYTE(8) BYTE(9)
+#undef BYTE
+
+  return NULL;
+}
 
 static bool upb_decode_varint(const char **ptr, const char *limit,
                               uint64_t *val) {
   uint8_t byte;
   int bitpos = 0;
   const char *p = *ptr;
+
+  /* Common case: one-byte varint. */
+  if (UPB_LIKELY(p < limit && !(*p & 0x80))) {
+    *val = (uint8_t)*p;
+    *ptr = p + 1;
+    return true;
+  }
+
+  if (UPB_LIKELY(limit - p >= UPB_PB_VARINT_MAX_LEN)) {
+    p = upb_decode_varint_fast(p, val);
+    CHK(p);
+    *ptr = p;
+    return true;
+  }
+
+  /* Slow path near the end of the buffer: check the limit on every byte. */
   *val = 0;
 
   do {
@@ -124,14 +249,35 @@ static bool upb_decode_string(const char **ptr, const char *limit,
   return true;
 }
 
+/* Validates string data if requested and, unless the input is being aliased,
+ * moves it into the message's arena. */
+static bool upb_decode_ownstring(upb_decstate *d, upb_decframe *frame,
+                                 const upb_msglayout_field *field,
+                                 upb_stringview *val) {
+  if ((d->options & UPB_DECODE_VALIDATEUTF8) &&
+      field->descriptortype == UPB_DESCRIPTOR_TYPE_STRING) {
+    CHK(upb_utf8_isvalid(val->data, val->size));
+  }
+  if ((d->options & UPB_DECODE_COPYSTRINGS) && val->size > 0) {
+    upb_alloc *alloc = upb_arena_alloc(upb_msg_arena(frame->msg));
+    char *copy = upb_malloc(alloc, val->size);
+    CHK(copy);
+    memcpy(copy, val->data, val->size);
+    *val = upb_stringview_make(copy, val->size);
+  }
+  return true;
+}
+
 static void upb_set32(void *msg, size_t ofs, uint32_t val) {
   memcpy((char*)msg + ofs, &val, sizeof(val));
 }
 
 static bool upb_append_unknown(upb_decstate *d, upb_decframe *frame,
                                const char *start) {
-  upb_msg_addunknown(frame->msg, start, d->ptr - start);
-  return true;
+  if (d->options & UPB_DECODE_COPYSTRINGS) {
+    return upb_msg_addunknown(frame->msg, start, d->ptr - start);
+  }
+  return upb_msg_addunknown_alias(frame->msg, start, d->ptr - start);
 }
 
 static bool upb_skip_unknownfielddata(upb_decstate *d, upb_decframe *frame,
@@ -156,44 +302,43 @@ static bool upb_skip_unknownfielddata(upb_decstate *d, upb_decframe *frame,
     case UPB_WIRE_TYPE_START_GROUP:
       return upb_skip_unknowngroup(d, field_number, frame->limit);
     case UPB_WIRE_TYPE_END_GROUP:
-      CHK(field_number == frame->group_number);
+      CHK(frame->group_number != 0 && field_number == frame->group_number);
       frame->limit = d->ptr;
       return true;
   }
   return false;
 }
 
-static bool upb_array_grow(upb_array *arr, size_t elements) {
+static bool upb_array_grow(upb_decstate *d, upb_array *arr, size_t elements) {
   size_t needed = arr->len + elements;
   size_t new_size = UPB_MAX(arr->size, 8);
-  size_t new_bytes;
-  size_t old_bytes;
-  void *new_data;
-  upb_alloc *alloc = upb_arena_alloc(arr->arena);
 
   while (new_size < needed) {
     new_size *= 2;
   }
 
-  old_bytes = arr->len * arr->element_size;
-  new_bytes = new_size * arr->element_size;
-  new_data = upb_realloc(alloc, arr->data, old_bytes, new_bytes);
-  CHK(new_data);
+  CHK(upb_array_realloc(arr, new_size));
+
+  if (d && d->stats) {
+    d->stats->arrays_grown++;
+    d->stats->array_bytes += new_size * arr->element_size;
+  }
 
-  arr->data = new_data;
-  arr->size = new_size;
   return true;
 }
 
-static void *upb_array_reserve(upb_array *arr, size_t elements) {
+/* |d| is NULL when there is no parse to count against. */
+static void *upb_array_reserve(upb_decstate *d, upb_array *arr,
+                               size_t elements) {
   if (arr->size - arr->len < elements) {
-    CHK(upb_array_grow(arr, elements));
+    CHK(upb_array_grow(d, arr, elements));
   }
   return (char*)arr->data + (arr->len * arr->element_size);
 }
 
-static void *upb_array_add(upb_array *arr, size_t elements) {
-  void *ret = upb_array_reserve(arr, elements);
+static void *upb_array_add(upb_decstate *d, upb_array *arr,
+                           size_t elements) {
+  void *ret = upb_array_reserve(d, arr, elements);
   arr->len += elements;
   return ret;
 }
@@ -217,6 +362,8 @@ static upb_array *upb_getorcreatearr(upb_decframe *frame,
     *(upb_array**)&frame->msg[field->offset] = arr;
   }
 
+  /* Every caller adds to it. */
+  arr->dirty = true;
   return arr;
 }
 
@@ -233,14 +380,14 @@ static void upb_setoneofcase(upb_decframe *frame,
   upb_set32(frame->msg, ~field->presence, field->number);
 }
 
-static char *upb_decode_prepareslot(upb_decframe *frame,
+static char *upb_decode_prepareslot(upb_decstate *d, upb_decframe *frame,
                                     const upb_msglayout_field *field) {
   char *field_mem = frame->msg + field->offset;
   upb_array *arr;
 
   if (field->label == UPB_LABEL_REPEATED) {
     arr = upb_getorcreatearr(frame, field);
-    field_mem = upb_array_reserve(arr, 1);
+    field_mem = upb_array_reserve(d, arr, 1);
   }
 
   return field_mem;
@@ -259,25 +406,109 @@ static void upb_decode_setpresent(upb_decframe *frame,
   }
 }
 
-static bool upb_decode_submsg(upb_decstate *d, upb_decframe *frame,
-                              const char *limit,
-                              const upb_msglayout_field *field,
-                              int group_number) {
-  char *submsg_slot = upb_decode_prepareslot(frame, field);
-  char *submsg = *(void **)submsg_slot;
+/* Returns the mask for the submessages of |field|, which the frame keeps. */
+static const upb_decodemask *upb_decode_submask(
+    const upb_decframe *frame, const upb_msglayout_field *field) {
+  const upb_decodemask *mask = frame->mask;
+  if (!mask || !mask->submasks) return NULL;
+  return mask->submasks[field - frame->m->fields];
+}
+
+/* Returns the submessage already stored in |field|'s singular slot, or NULL.
+ * The slot of a oneof member is only meaningful when the oneof holds it. */
+static void *upb_decode_getsubmsg(upb_decframe *frame,
+                                  const upb_msglayout_field *field) {
+  if (field->presence < 0 &&
+      *(uint32_t*)&frame->msg[~field->presence] != field->number) {
+    return NULL;
+  }
+  return *(void**)&frame->msg[field->offset];
+}
+
+/* Returns the submessage of |field| to merge the next occurrence into,
+ * creating it if need be, or NULL if out of memory.  The caller marks the
+ * field present once it is done. */
+static char *upb_decode_preparesubmsg(upb_decstate *d, upb_decframe *frame,
+                                      const upb_msglayout_field *field) {
+  char *submsg_slot = upb_decode_prepareslot(d, frame, field);
+  char *submsg;
   const upb_msglayout *subm;
 
+  CHK(submsg_slot);
   subm = frame->m->submsgs[field->submsg_index];
   UPB_ASSERT(subm);
 
+  /* A freshly reserved array slot is uninitialized memory. */
+  submsg = field->label == UPB_LABEL_REPEATED ?
+      NULL : upb_decode_getsubmsg(frame, field);
+
+  if (submsg && upb_islazymsg(submsg)) {
+    /* Merging into a submessage that is still lazy: parse it first. */
+    submsg = upb_decode_lazy((void**)submsg_slot, subm);
+    CHK(submsg);
+  }
+
   if (!submsg) {
     submsg = upb_msg_new(subm, upb_msg_arena(frame->msg));
     CHK(submsg);
     *(void**)submsg_slot = submsg;
   }
 
-  upb_decode_message(d, limit, group_number, submsg, subm);
+  return submsg;
+}
 
+static bool upb_decode_submsg(upb_decstate *d, upb_decframe *frame,
+                              const char *limit,
+                              const upb_msglayout_field *field,
+                              int group_number) {
+  char *submsg = upb_decode_preparesubmsg(d, frame, field);
+  CHK(submsg);
+  return upb_decode_push(d, limit, group_number, submsg,
+                         frame->m->submsgs[field->submsg_index],
+                         upb_decode_submask(frame, field));
+}
+
+/* Records the bytes |val| of a singular submessage for upb_decode_lazy() to
+ * parse later. */
+static bool upb_decode_lazysubmsg(upb_decstate *d, upb_decframe *frame,
+                                  const upb_msglayout_field *field,
+                                  upb_stringview val) {
+  upb_arena *arena = upb_msg_arena(frame->msg);
+  upb_alloc *alloc = upb_arena_alloc(arena);
+  void *prev = upb_decode_getsubmsg(frame, field);
+  upb_lazymsg *lazy;
+
+  if (prev && !upb_islazymsg(prev)) {
+    /* The field occurred before, and the occurrences must be merged. */
+    d->ptr -= val.size;
+    return upb_decode_submsg(d, frame, val.data + val.size, field, 0);
+  }
+
+  lazy = upb_malloc(alloc, sizeof(*lazy));
+  CHK(lazy);
+
+  if (prev) {
+    /* Merging two unparsed occurrences is concatenating them.  Parsing the
+     * first one here instead would need a second decoder on the C stack. */
+    upb_stringview first = upb_getlazymsg(prev)->data;
+    char *data = upb_malloc(alloc, first.size + val.size);
+    CHK(data);
+    memcpy(data, first.data, first.size);
+    memcpy(data + first.size, val.data, val.size);
+    val = upb_stringview_make(data, first.size + val.size);
+  } else {
+    CHK(upb_decode_ownstring(d, frame, field, &val));
+  }
+
+  lazy->data = val;
+  lazy->arena = arena;
+  /* Any copy was made above; strings inside can alias it. */
+  lazy->options = d->options & ~UPB_DECODE_COPYSTRINGS;
+  lazy->mask = upb_decode_submask(frame, field);
+  lazy->extreg = d->extreg;
+  /* The frames that pushing the submessage would have left. */
+  lazy->max_nesting = d->limit - d->top - 1;
+  *(void**)&frame->msg[field->offset] = (char*)lazy + 1;
   return true;
 }
 
@@ -287,7 +518,7 @@ static bool upb_decode_varintfield(upb_decstate *d, upb_decframe *frame,
   uint64_t val;
   void *field_mem;
 
-  field_mem = upb_decode_prepareslot(frame, field);
+  field_mem = upb_decode_prepareslot(d, frame, field);
   CHK(field_mem);
   CHK(upb_decode_varint(&d->ptr, frame->limit, &val));
 
@@ -332,7 +563,7 @@ static bool upb_decode_64bitfield(upb_decstate *d, upb_decframe *frame,
   void *field_mem;
   uint64_t val;
 
-  field_mem = upb_decode_prepareslot(frame, field);
+  field_mem = upb_decode_prepareslot(d, frame, field);
   CHK(field_mem);
   CHK(upb_decode_64bit(&d->ptr, frame->limit, &val));
 
@@ -356,7 +587,7 @@ static bool upb_decode_32bitfield(upb_decstate *d, upb_decframe *frame,
   void *field_mem;
   uint32_t val;
 
-  field_mem = upb_decode_prepareslot(frame, field);
+  field_mem = upb_decode_prepareslot(d, frame, field);
   CHK(field_mem);
   CHK(upb_decode_32bit(&d->ptr, frame->limit, &val));
 
@@ -374,44 +605,167 @@ static bool upb_decode_32bitfield(upb_decstate *d, upb_decframe *frame,
   return true;
 }
 
-static bool upb_decode_fixedpacked(upb_array *arr, upb_stringview data,
-                                   int elem_size) {
-  int elements = data.size / elem_size;
-  void *field_mem;
+static bool upb_decode_fixedpacked(upb_decstate *d, upb_array *arr,
+                                   upb_stringview data, int elem_size) {
+  size_t elements = data.size / elem_size;
+  char *field_mem;
 
-  CHK((size_t)(elements * elem_size) == data.size);
-  field_mem = upb_array_add(arr, elements);
+  CHK(elements * elem_size == data.size);
+  field_mem = upb_array_add(d, arr, elements);
   CHK(field_mem);
+#ifdef UPB_BIG_ENDIAN
+  {
+    /* The wire format is little-endian: byte-swap each element. */
+    size_t i;
+    int j;
+    for (i = 0; i < data.size; i += elem_size) {
+      for (j = 0; j < elem_size; j++) {
+        field_mem[i + j] = data.data[i + elem_size - 1 - j];
+      }
+    }
+  }
+#else
   memcpy(field_mem, data.data, data.size);
+#endif
+  return true;
+}
+
+/* Returns the number of varints in [ptr, limit), ie. the number of bytes
+ * without a continuation bit.  Checks eight bytes at a time. */
+static size_t upb_decode_countvarints(const char *ptr, const char *limit) {
+  const uint64_t high_bits = 0x8080808080808080ULL;
+  size_t count = 0;
+
+  while (limit - ptr >= 8) {
+    uint64_t word;
+    memcpy(&word, ptr, 8);
+    /* Move each byte's terminator flag to bit 0 of that byte, then sum the
+     * flags by multiplication; the total lands in the top byte. */
+    word = (~word & high_bits) >> 7;
+    count += (word * 0x0101010101010101ULL) >> 56;
+    ptr += 8;
+  }
+
+  while (ptr < limit) {
+    count += !(*ptr & 0x80);
+    ptr++;
+  }
+
+  return count;
+}
+
+/* Records element |val| of a batch's field for upb_decodebatch_run(). */
+static bool upb_decodebatch_addelem(upb_decodebatch *b, upb_arena *arena,
+                                    upb_stringview val) {
+  if (b->len == b->size) {
+    size_t new_size = UPB_MAX(b->size * 2, 64);
+    void *new_elems = upb_realloc(upb_arena_alloc(arena), b->elems,
+                                  b->size * sizeof(*b->elems),
+                                  new_size * sizeof(*b->elems));
+    CHK(new_elems);
+    b->elems = new_elems;
+    b->size = new_size;
+  }
+
+  b->elems[b->len++] = val;
+  b->bytes += val.size;
   return true;
 }
 
+/* The most elements of a repeated message field that one lookahead allocates
+ * for at once. */
+#define UPB_DECODE_MAXRUN 256
+
+/* Returns how many elements of |field| follow the one just read (at most
+ * |max|), counting only those that come right after it and each other. */
+static size_t upb_decode_countrun(const char *ptr, const char *limit,
+                                  const upb_msglayout_field *field,
+                                  size_t max) {
+  uint32_t expected = (field->number << 3) | UPB_WIRE_TYPE_DELIMITED;
+  size_t count = 0;
+
+  while (count < max && ptr < limit) {
+    uint32_t tag;
+    upb_stringview val;
+    if (!upb_decode_varint32(&ptr, limit, &tag) || tag != expected ||
+        !upb_decode_string(&ptr, limit, &val)) {
+      break;
+    }
+    count++;
+  }
+
+  return count;
+}
+
+/* Returns memory for the next element of repeated message |field|, which is
+ * turned into a message with upb_msg_init().  Sibling elements are usually
+ * read together once decoded, but allocating each on its own puts all of the
+ * previous element's strings, arrays and submessages between them.  So when
+ * an element is followed by more of the same field, we count them and
+ * allocate the whole run in one block, reserve room for it in the array, and
+ * hand out the block's slots in order, prefetching each one a slot ahead. */
+static void *upb_decode_runslot(upb_decstate *d, upb_decframe *frame,
+                                const upb_msglayout_field *field,
+                                const upb_msglayout *subm, upb_array *arr) {
+  upb_alloc *alloc = upb_arena_alloc(upb_msg_arena(frame->msg));
+  size_t stride = upb_msg_stride(subm);
+  size_t n;
+  char *ret;
+
+  if (frame->run_arr == arr && frame->run != frame->run_end) {
+    ret = frame->run;
+    frame->run += stride;
+    if (frame->run != frame->run_end) UPB_PREFETCH(frame->run);
+    return ret;
+  }
+
+  n = upb_decode_countrun(d->ptr, frame->limit, field, UPB_DECODE_MAXRUN - 1);
+  ret = upb_malloc(alloc, (n + 1) * stride);
+  CHK(ret);
+
+  if (n > 0) {
+    CHK(upb_array_reserve(d, arr, n + 1));
+    frame->run_arr = arr;
+    frame->run = ret + stride;
+    frame->run_end = ret + (n + 1) * stride;
+    UPB_PREFETCH(frame->run);
+  }
+
+  return ret;
+}
+
 static bool upb_decode_toarray(upb_decstate *d, upb_decframe *frame,
                                const char *field_start,
                                const upb_msglayout_field *field,
                                upb_stringview val) {
   upb_array *arr = upb_getorcreatearr(frame, field);
 
+  /* Packed varints: count the elements up front so the array grows at most
+   * once, then decode straight into the reserved space.  The count is exact
+   * for well-formed input; a trailing unterminated varint is rejected by
+   * upb_decode_varint(). */
 #define VARINT_CASE(ctype, decode) { \
   const char *ptr = val.data; \
   const char *limit = ptr + val.size; \
+  size_t elements = upb_decode_countvarints(ptr, limit); \
+  ctype *out = upb_array_reserve(d, arr, elements); \
+  ctype *end = out + elements; \
+  CHK(out || elements == 0); \
   while (ptr < limit) { \
     uint64_t val; \
-    void *field_mem; \
-    ctype decoded; \
-    CHK(upb_decode_varint(&ptr, limit, &val)); \
-    decoded = (decode)(val); \
-    field_mem = upb_array_add(arr, 1); \
-    CHK(field_mem); \
-    memcpy(field_mem, &decoded, sizeof(ctype)); \
+    CHK(out < end && upb_decode_varint(&ptr, limit, &val)); \
+    *out++ = (decode)(val); \
   } \
+  arr->len += elements; \
   return true; \
 }
 
   switch ((upb_descriptortype_t)field->descriptortype) {
     case UPB_DESCRIPTOR_TYPE_STRING:
     case UPB_DESCRIPTOR_TYPE_BYTES: {
-      void *field_mem = upb_array_add(arr, 1);
+      void *field_mem;
+      CHK(upb_decode_ownstring(d, frame, field, &val));
+      field_mem = upb_array_add(d, arr, 1);
       CHK(field_mem);
       memcpy(field_mem, &val, sizeof(val));
       return true;
@@ -419,11 +773,11 @@ static bool upb_decode_toarray(upb_decstate *d, upb_decframe *frame,
     case UPB_DESCRIPTOR_TYPE_FLOAT:
     case UPB_DESCRIPTOR_TYPE_FIXED32:
     case UPB_DESCRIPTOR_TYPE_SFIXED32:
-      return upb_decode_fixedpacked(arr, val, sizeof(int32_t));
+      return upb_decode_fixedpacked(d, arr, val, sizeof(int32_t));
     case UPB_DESCRIPTOR_TYPE_DOUBLE:
     case UPB_DESCRIPTOR_TYPE_FIXED64:
     case UPB_DESCRIPTOR_TYPE_SFIXED64:
-      return upb_decode_fixedpacked(arr, val, sizeof(int64_t));
+      return upb_decode_fixedpacked(d, arr, val, sizeof(int64_t));
     case UPB_DESCRIPTOR_TYPE_INT32:
     case UPB_DESCRIPTOR_TYPE_UINT32:
     case UPB_DESCRIPTOR_TYPE_ENUM:
@@ -441,24 +795,32 @@ static bool upb_decode_toarray(upb_decstate *d, upb_decframe *frame,
     case UPB_DESCRIPTOR_TYPE_MESSAGE: {
       const upb_msglayout *subm;
       char *submsg;
+      void *mem;
       void *field_mem;
 
       CHK(val.size <= (size_t)(frame->limit - val.data));
-      d->ptr -= val.size;
+
+      if (d->batch && d->batch->msg == frame->msg &&
+          d->batch->field == field) {
+        return upb_decodebatch_addelem(d->batch, upb_msg_arena(frame->msg),
+                                       val);
+      }
 
       /* Create elemente message. */
       subm = frame->m->submsgs[field->submsg_index];
       UPB_ASSERT(subm);
 
-      submsg = upb_msg_new(subm, upb_msg_arena(frame->msg));
-      CHK(submsg);
+      mem = upb_decode_runslot(d, frame, field, subm, arr);
+      CHK(mem);
+      submsg = upb_msg_init(mem, subm, upb_msg_arena(frame->msg));
+      d->ptr -= val.size;
 
-      field_mem = upb_array_add(arr, 1);
+      field_mem = upb_array_add(d, arr, 1);
       CHK(field_mem);
       *(void**)field_mem = submsg;
 
-      return upb_decode_message(
-          d, val.data + val.size, frame->group_number, submsg, subm);
+      return upb_decode_push(d, val.data + val.size, 0, submsg, subm,
+                             upb_decode_submask(frame, field));
     }
     case UPB_DESCRIPTOR_TYPE_GROUP:
       return upb_append_unknown(d, frame, field_start);
@@ -467,6 +829,169 @@ static bool upb_decode_toarray(upb_decstate *d, upb_decframe *frame,
   UPB_UNREACHABLE();
 }
 
+static upb_map *upb_getorcreatemap(upb_decframe *frame,
+                                   const upb_msglayout_field *field,
+                                   const upb_msglayout_field *key_field,
+                                   const upb_msglayout_field *val_field) {
+  upb_map **slot = (upb_map**)&frame->msg[field->offset];
+
+  if (!*slot) {
+    *slot = upb_map_new(upb_desctype_to_fieldtype[key_field->descriptortype],
+                        upb_desctype_to_fieldtype[val_field->descriptortype],
+                        upb_msg_arena(frame->msg));
+  }
+
+  return *slot;
+}
+
+/* Decodes the key or a non-message value of a map entry into |out|.  The
+ * wire type has been checked already. */
+static bool upb_decode_mapscalar(upb_decstate *d, upb_decframe *frame,
+                                 const upb_msglayout_field *f,
+                                 const char *limit, bool is_key,
+                                 upb_msgval *out) {
+  uint64_t u64;
+  uint32_t u32;
+
+  switch ((upb_descriptortype_t)f->descriptortype) {
+    case UPB_DESCRIPTOR_TYPE_DOUBLE:
+    case UPB_DESCRIPTOR_TYPE_FIXED64:
+    case UPB_DESCRIPTOR_TYPE_SFIXED64:
+      CHK(upb_decode_64bit(&d->ptr, limit, &u64));
+      memcpy(out, &u64, sizeof(u64));
+      return true;
+    case UPB_DESCRIPTOR_TYPE_FLOAT:
+    case UPB_DESCRIPTOR_TYPE_FIXED32:
+    case UPB_DESCRIPTOR_TYPE_SFIXED32:
+      CHK(upb_decode_32bit(&d->ptr, limit, &u32));
+      memcpy(out, &u32, sizeof(u32));
+      return true;
+    case UPB_DESCRIPTOR_TYPE_STRING:
+    case UPB_DESCRIPTOR_TYPE_BYTES:
+      CHK(upb_decode_string(&d->ptr, limit, &out->str));
+      if (is_key) {
+        /* The map copies string keys itself. */
+        return !(d->options & UPB_DECODE_VALIDATEUTF8) ||
+               f->descriptortype != UPB_DESCRIPTOR_TYPE_STRING ||
+               upb_utf8_isvalid(out->str.data, out->str.size);
+      }
+      return upb_decode_ownstring(d, frame, f, &out->str);
+    case UPB_DESCRIPTOR_TYPE_GROUP:
+    case UPB_DESCRIPTOR_TYPE_MESSAGE:
+      UPB_UNREACHABLE();
+    default:
+      break;
+  }
+
+  CHK(upb_decode_varint(&d->ptr, limit, &u64));
+
+  switch ((upb_descriptortype_t)f->descriptortype) {
+    case UPB_DESCRIPTOR_TYPE_BOOL:
+      out->b = u64 != 0;
+      break;
+    case UPB_DESCRIPTOR_TYPE_SINT32:
+      out->i32 = upb_zzdecode_32(u64);
+      break;
+    case UPB_DESCRIPTOR_TYPE_SINT64:
+      out->i64 = upb_zzdecode_64(u64);
+      break;
+    case UPB_DESCRIPTOR_TYPE_INT32:
+    case UPB_DESCRIPTOR_TYPE_UINT32:
+    case UPB_DESCRIPTOR_TYPE_ENUM:
+      out->u32 = (uint32_t)u64;
+      break;
+    default:
+      out->u64 = u64;
+      break;
+  }
+
+  return true;
+}
+
+/* Inserts map entry |val| straight into the field's upb_map, without making a
+ * message for the entry.  A message value is created here and parsed by a
+ * frame of its own.  Missing keys and values take their default, and if the
+ * value occurs more than once, the last one is used. */
+static bool upb_decode_mapentry(upb_decstate *d, upb_decframe *frame,
+                                const upb_msglayout_field *field,
+                                upb_stringview val) {
+  const upb_msglayout *entry = frame->m->submsgs[field->submsg_index];
+  const upb_msglayout_field *key_field;
+  const upb_msglayout_field *val_field;
+  upb_stringview submsg = upb_stringview_make(NULL, 0);
+  upb_decframe entry_frame;
+  upb_msgval key;
+  upb_msgval value;
+  upb_map *map;
+
+  upb_mapentry_fields(entry, &key_field, &val_field);
+  map = upb_getorcreatemap(frame, field, key_field, val_field);
+  CHK(map);
+
+  memset(&key, 0, sizeof(key));
+  memset(&value, 0, sizeof(value));
+  if (key_field->descriptortype == UPB_DESCRIPTOR_TYPE_STRING ||
+      key_field->descriptortype == UPB_DESCRIPTOR_TYPE_BYTES) {
+    key = upb_msgval_makestr("", 0);
+  }
+  entry_frame.limit = val.data + val.size;
+  entry_frame.group_number = 0;
+  entry_frame.msg = NULL;
+  entry_frame.m = NULL;
+  entry_frame.mask = NULL;
+  d->ptr = val.data;
+
+  while (d->ptr < entry_frame.limit) {
+    const upb_msglayout_field *f = NULL;
+    int field_number;
+    int wire_type;
+
+    CHK(upb_decode_tag(&d->ptr, entry_frame.limit, &field_number,
+                       &wire_type));
+    /* An entry is not a group, so nothing in it may end one. */
+    CHK(field_number != 0 && wire_type != UPB_WIRE_TYPE_END_GROUP);
+
+    if (field_number == 1) {
+      f = key_field;
+    } else if (field_number == 2) {
+      f = val_field;
+    }
+
+    if (!f || wire_type != upb_desctype_to_wiretype[f->descriptortype]) {
+      CHK(upb_skip_unknownfielddata(d, &entry_frame, field_number,
+                                    wire_type));
+    } else if (f->descriptortype == UPB_DESCRIPTOR_TYPE_MESSAGE) {
+      CHK(upb_decode_string(&d->ptr, entry_frame.limit, &submsg));
+    } else {
+      CHK(upb_decode_mapscalar(d, frame, f, entry_frame.limit, f == key_field,
+                               f == key_field ? &key : &value));
+    }
+  }
+
+  if (val_field->descriptortype == UPB_DESCRIPTOR_TYPE_MESSAGE) {
+    const upb_msglayout *subm = entry->submsgs[val_field->submsg_index];
+    const upb_decodemask *mask = upb_decode_submask(frame, field);
+    void *msg = upb_msg_new(subm, upb_msg_arena(frame->msg));
+
+    CHK(msg);
+    value.msg = msg;
+    CHK(upb_map_set(map, key, value, NULL));
+
+    if (submsg.data) {
+      d->ptr = submsg.data;
+      CHK(upb_decode_push(
+          d, submsg.data + submsg.size, 0, msg, subm,
+          mask && mask->submasks ?
+              mask->submasks[val_field - entry->fields] : NULL));
+      d->top->resume = entry_frame.limit;
+    }
+
+    return true;
+  }
+
+  return upb_map_set(map, key, value, NULL);
+}
+
 static bool upb_decode_delimitedfield(upb_decstate *d, upb_decframe *frame,
                                       const char *field_start,
                                       const upb_msglayout_field *field) {
@@ -475,18 +1000,26 @@ static bool upb_decode_delimitedfield(upb_decstate *d, upb_decframe *frame,
   CHK(upb_decode_string(&d->ptr, frame->limit, &val));
 
   if (field->label == UPB_LABEL_REPEATED) {
+    if (upb_msglayout_ismap(frame->m, field)) {
+      return upb_decode_mapentry(d, frame, field, val);
+    }
     return upb_decode_toarray(d, frame, field_start, field, val);
   } else {
     switch ((upb_descriptortype_t)field->descriptortype) {
       case UPB_DESCRIPTOR_TYPE_STRING:
       case UPB_DESCRIPTOR_TYPE_BYTES: {
-        void *field_mem = upb_decode_prepareslot(frame, field);
+        void *field_mem = upb_decode_prepareslot(d, frame, field);
         CHK(field_mem);
+        CHK(upb_decode_ownstring(d, frame, field, &val));
         memcpy(field_mem, &val, sizeof(val));
         break;
       }
       case UPB_DESCRIPTOR_TYPE_MESSAGE:
         CHK(val.size <= (size_t)(frame->limit - val.data));
+        if (d->options & UPB_DECODE_LAZY) {
+          CHK(upb_decode_lazysubmsg(d, frame, field, val));
+          break;
+        }
         d->ptr -= val.size;
         CHK(upb_decode_submsg(d, frame, val.data + val.size, field, 0));
         break;
@@ -501,8 +1034,14 @@ static bool upb_decode_delimitedfield(upb_decstate *d, upb_decframe *frame,
 
 static const upb_msglayout_field *upb_find_field(const upb_msglayout *l,
                                                  uint32_t field_number) {
-  /* Lots of optimization opportunities here. */
   int i;
+
+  if (UPB_LIKELY(field_number < l->dense_count)) {
+    uint16_t idx = l->dense[field_number];
+    return idx ? &l->fields[idx - 1] : NULL;
+  }
+
+  /* Sparse fallback for field numbers beyond the dense table. */
   for (i = 0; i < l->field_count; i++) {
     if (l->fields[i].number == field_number) {
       return &l->fields[i];
@@ -512,6 +1051,60 @@ static const upb_msglayout_field *upb_find_field(const upb_msglayout *l,
   return NULL;  /* Unknown field. */
 }
 
+static bool upb_decode_knownfield(upb_decstate *d, upb_decframe *frame,
+                                  const char *field_start,
+                                  const upb_msglayout_field *field,
+                                  int wire_type) {
+  switch (wire_type) {
+    case UPB_WIRE_TYPE_VARINT:
+      return upb_decode_varintfield(d, frame, field_start, field);
+    case UPB_WIRE_TYPE_32BIT:
+      return upb_decode_32bitfield(d, frame, field_start, field);
+    case UPB_WIRE_TYPE_64BIT:
+      return upb_decode_64bitfield(d, frame, field_start, field);
+    case UPB_WIRE_TYPE_DELIMITED:
+      return upb_decode_delimitedfield(d, frame, field_start, field);
+    case UPB_WIRE_TYPE_START_GROUP:
+      CHK(field->descriptortype == UPB_DESCRIPTOR_TYPE_GROUP);
+      CHK(upb_decode_submsg(d, frame, frame->limit, field, field->number));
+      upb_decode_setpresent(frame, field);
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* Decodes a field that is extension |e| of the frame's message into the
+ * extension's holder (see structs.int.h), which stands in for the message
+ * while the one field is parsed.  The holder's frame lasts for just this
+ * field, so it borrows the message frame's run: otherwise each element of a
+ * repeated message extension would allocate a run for all of the ones after
+ * it. */
+static bool upb_decode_extfield(upb_decstate *d, upb_decframe *frame,
+                                const char *field_start,
+                                const upb_msglayout_ext *e, int wire_type) {
+  upb_extholderlayout hl;
+  upb_decframe holder;
+
+  holder.msg = upb_msg_extholder(frame->msg, e);
+  CHK(holder.msg);
+  upb_msg_invalidatesize(holder.msg);
+  upb_extholder_layout(e, &hl);
+  holder.limit = frame->limit;
+  holder.group_number = frame->group_number;
+  holder.m = &hl.layout;
+  holder.mask = NULL;
+  holder.resume = NULL;
+  holder.run_arr = frame->run_arr;
+  holder.run = frame->run;
+  holder.run_end = frame->run_end;
+  CHK(upb_decode_knownfield(d, &holder, field_start, &hl.field, wire_type));
+  frame->run_arr = holder.run_arr;
+  frame->run = holder.run;
+  frame->run_end = holder.run_end;
+  return true;
+}
+
 static bool upb_decode_field(upb_decstate *d, upb_decframe *frame) {
   int field_number;
   int wire_type;
@@ -519,76 +1112,904 @@ static bool upb_decode_field(upb_decstate *d, upb_decframe *frame) {
   const upb_msglayout_field *field;
 
   CHK(upb_decode_tag(&d->ptr, frame->limit, &field_number, &wire_type));
+  CHK(field_number != 0);
+
+  if (wire_type == UPB_WIRE_TYPE_END_GROUP) {
+    /* The number is the group's own field number, which can't be looked up
+     * in the group's layout (or kept as an unknown field).  Frames that
+     * aren't groups have number 0, so this never matches for them. */
+    CHK(frame->group_number == field_number);
+    frame->limit = d->ptr;
+    return true;
+  }
+
   field = upb_find_field(frame->m, field_number);
 
+  if (frame->mask &&
+      (!field ||
+       !upb_decodemask_keeps(frame->mask, field - frame->m->fields))) {
+    /* Not requested, so not kept as an unknown field either. */
+    return upb_skip_unknownfielddata(d, frame, field_number, wire_type);
+  }
+
+  if (field && wire_type != UPB_WIRE_TYPE_DELIMITED &&
+      upb_msglayout_ismap(frame->m, field)) {
+    /* A map's slot holds no upb_array to add this to. */
+    field = NULL;
+  }
+
   if (field) {
-    switch (wire_type) {
-      case UPB_WIRE_TYPE_VARINT:
-        return upb_decode_varintfield(d, frame, field_start, field);
-      case UPB_WIRE_TYPE_32BIT:
-        return upb_decode_32bitfield(d, frame, field_start, field);
-      case UPB_WIRE_TYPE_64BIT:
-        return upb_decode_64bitfield(d, frame, field_start, field);
-      case UPB_WIRE_TYPE_DELIMITED:
-        return upb_decode_delimitedfield(d, frame, field_start, field);
-      case UPB_WIRE_TYPE_START_GROUP:
-        CHK(field->descriptortype == UPB_DESCRIPTOR_TYPE_GROUP);
-        return upb_decode_submsg(d, frame, frame->limit, field, field_number);
-      case UPB_WIRE_TYPE_END_GROUP:
-        CHK(frame->group_number == field_number)
-        frame->limit = d->ptr;
-        return true;
-      default:
-        return false;
-    }
+    return upb_decode_knownfield(d, frame, field_start, field, wire_type);
   } else {
-    CHK(field_number != 0);
+    if (d->extreg && frame->m->extendable) {
+      const upb_msglayout_ext *e =
+          upb_extreg_get(d->extreg, frame->m, field_number);
+      if (e) return upb_decode_extfield(d, frame, field_start, e, wire_type);
+    }
     CHK(upb_skip_unknownfielddata(d, frame, field_number, wire_type));
     CHK(upb_append_unknown(d, frame, field_start));
     return true;
   }
 }
 
+/* Starts parsing a submessage or group, which the caller has set up in its
+ * parent.  It is parsed by upb_decode_run() once the caller returns. */
+static bool upb_decode_push(upb_decstate *d, const char *limit,
+                            int group_number, char *msg,
+                            const upb_msglayout *l,
+                            const upb_decodemask *mask) {
+  upb_decframe *frame = d->top + 1;
+  CHK(frame < d->limit);
+  frame->limit = limit;
+  frame->group_number = group_number;
+  frame->msg = msg;
+  frame->m = l;
+  frame->mask = mask;
+  frame->resume = NULL;
+  frame->run_arr = NULL;
+  d->top = frame;
+  if (msg) {
+    /* Unknown groups are pushed without a message. */
+    upb_msg_invalidatesize(msg);
+  }
+  return true;
+}
+
+/* Skips a group that isn't in the layout.  Groups nested in it are pushed on
+ * the stack like any other, so they count towards the nesting limit. */
 static bool upb_skip_unknowngroup(upb_decstate *d, int field_number,
                                   const char *limit) {
-  upb_decframe frame;
-  frame.msg = NULL;
-  frame.m = NULL;
-  frame.group_number = field_number;
-  frame.limit = limit;
+  upb_decframe *parent = d->top;
+
+  CHK(upb_decode_push(d, limit, field_number, NULL, NULL, NULL));
 
-  while (d->ptr < frame.limit) {
+  while (d->top != parent) {
+    upb_decframe *frame = d->top;
     int wire_type;
-    int field_number;
 
-    CHK(upb_decode_tag(&d->ptr, frame.limit, &field_number, &wire_type));
-    CHK(upb_skip_unknownfielddata(d, &frame, field_number, wire_type));
+    if (d->ptr >= frame->limit) {
+      d->top--;
+      continue;
+    }
+
+    CHK(upb_decode_tag(&d->ptr, frame->limit, &field_number, &wire_type));
+    CHK(field_number != 0);
+
+    if (wire_type == UPB_WIRE_TYPE_START_GROUP) {
+      CHK(upb_decode_push(d, frame->limit, field_number, NULL, NULL, NULL));
+    } else {
+      CHK(upb_skip_unknownfielddata(d, frame, field_number, wire_type));
+    }
   }
 
   return true;
 }
 
-static bool upb_decode_message(upb_decstate *d, const char *limit,
-                               int group_number, char *msg,
-                               const upb_msglayout *l) {
-  upb_decframe frame;
-  frame.group_number = group_number;
-  frame.limit = limit;
-  frame.msg = msg;
-  frame.m = l;
+/* The number of the first required field of |l| that |msg| lacks, or 0.
+ * Only called once the hasbits have been found wanting. */
+static uint32_t upb_decode_findmissing(const char *msg,
+                                       const upb_msglayout *l) {
+  int i;
 
-  while (d->ptr < frame.limit) {
-    CHK(upb_decode_field(d, &frame));
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *f = &l->fields[i];
+    if (f->label == UPB_LABEL_REQUIRED && f->presence > 0 &&
+        !(msg[f->presence / 8] & (1 << (f->presence % 8)))) {
+      return f->number;
+    }
   }
 
-  return true;
+  UPB_ASSERT(false);
+  return 0;
+}
+
+/* If |options| ask for it, checks that a message that has ended has all of
+ * its required fields.  Returns the number of one that is missing, or 0. */
+UPB_FORCEINLINE static uint32_t upb_decode_missing(int options,
+                                                   const char *msg,
+                                                   const upb_msglayout *l,
+                                                   const upb_decodemask *mask) {
+  size_t i;
+
+  if (!(options & UPB_DECODE_CHECKREQUIRED) || mask) return 0;
+
+  for (i = 0; i < l->required_size; i++) {
+    if ((msg[i] & l->required[i]) != l->required[i]) {
+      return upb_decode_findmissing(msg, l);
+    }
+  }
+
+  return 0;
+}
+
+static bool upb_decode_checkrequired(upb_decstate *d,
+                                     const upb_decframe *frame) {
+  d->missing = upb_decode_missing(d->options, frame->msg, frame->m,
+                                  frame->mask);
+  return d->missing == 0;
+}
+
+/* Parses fields into the top frame until it, and every frame pushed above it,
+ * is finished.  A message with a generated parser gets to parse each run of
+ * fields first; we only see the fields it stops at. */
+static bool upb_decode_run(upb_decstate *d) {
+  upb_decframe *base = d->top;
+
+  while (true) {
+    upb_decframe *frame = d->top;
+
+    if (d->ptr < frame->limit) {
+      if (frame->m->parse && !frame->mask) {
+        CHK(frame->m->parse(&d->ptr, frame->limit, frame->msg, d->options));
+        if (d->ptr == frame->limit) continue;
+      }
+      CHK(upb_decode_field(d, frame));
+    } else if (frame == base) {
+      return d->partial || upb_decode_checkrequired(d, frame);
+    } else {
+      CHK(upb_decode_checkrequired(d, frame));
+      if (frame->resume) d->ptr = frame->resume;
+      d->top--;
+    }
+  }
+}
+
+/* Parses all of |buf| into |msg|.  Up to UPB_DECODE_MAX_NESTING frames live on
+ * the C stack, so that the usual limit needs no allocation. */
+static bool upb_decode_start(upb_decstate *d, upb_stringview buf, char *msg,
+                             const upb_msglayout *l,
+                             const upb_decodemask *mask, size_t max_nesting) {
+  upb_decframe stack[UPB_DECODE_MAX_NESTING];
+  bool ok;
+
+  CHK(max_nesting > 0);
+
+  if (max_nesting <= UPB_DECODE_MAX_NESTING) {
+    d->stack = stack;
+  } else {
+    CHK(max_nesting <= SIZE_MAX / sizeof(*stack));
+    d->stack = upb_gmalloc(max_nesting * sizeof(*stack));
+    CHK(d->stack);
+  }
+
+  d->ptr = buf.data;
+  d->top = d->stack;
+  d->limit = d->stack + max_nesting;
+  d->top->limit = buf.data + buf.size;
+  d->top->group_number = 0;
+  d->top->msg = msg;
+  d->top->m = l;
+  d->top->mask = mask;
+  d->top->resume = NULL;
+  d->top->run_arr = NULL;
+  upb_msg_invalidatesize(msg);
+
+  ok = upb_decode_run(d);
+
+  if (d->stack != stack) {
+    upb_gfree(d->stack);
+  }
+
+  return ok;
+}
+
+static bool upb_decode_withext(upb_stringview buf, void *msg,
+                               const upb_msglayout *l,
+                               const upb_decodemask *mask,
+                               const upb_extreg *extreg, int options,
+                               size_t max_nesting) {
+  upb_decstate state;
+  UPB_ASSERT(!mask || mask->layout == l);
+  state.options = options;
+  state.batch = NULL;
+  state.stats = NULL;
+  state.extreg = extreg;
+  state.partial = false;
+  state.missing = 0;
+
+  return upb_decode_start(&state, buf, msg, l, mask, max_nesting);
+}
+
+bool upb_decode_withmaxnesting(upb_stringview buf, void *msg,
+                               const upb_msglayout *l,
+                               const upb_decodemask *mask, int options,
+                               size_t max_nesting) {
+  return upb_decode_withext(buf, msg, l, mask, NULL, options, max_nesting);
+}
+
+bool upb_decode_ext(upb_stringview buf, void *msg, const upb_msglayout *l,
+                    const upb_extreg *extreg, int options) {
+  return upb_decode_withext(buf, msg, l, NULL, extreg, options,
+                            UPB_DECODE_MAX_NESTING);
+}
+
+bool upb_decode_withstats(upb_stringview buf, void *msg,
+                          const upb_msglayout *l, const upb_decodemask *mask,
+                          int options, upb_decodestats *stats) {
+  upb_arena *arena = upb_msg_arena(msg);
+  size_t before = upb_arena_bytesallocated(arena);
+  upb_decstate state;
+  bool ok;
+  UPB_ASSERT(!mask || mask->layout == l);
+  state.options = options;
+  state.batch = NULL;
+  state.stats = stats;
+  state.extreg = NULL;
+  state.partial = false;
+  state.missing = 0;
+
+  ok = upb_decode_start(&state, buf, msg, l, mask, UPB_DECODE_MAX_NESTING);
+
+  stats->msgs++;
+  stats->errors += !ok;
+  stats->bytes += buf.size;
+  stats->arena_bytes += upb_arena_bytesallocated(arena) - before;
+  return ok;
+}
+
+bool upb_decode_withstatus(upb_stringview buf, void *msg,
+                           const upb_msglayout *l, int options,
+                           upb_status *status) {
+  upb_decstate state;
+  state.options = options;
+  state.batch = NULL;
+  state.stats = NULL;
+  state.extreg = NULL;
+  state.partial = false;
+  state.missing = 0;
+
+  if (upb_decode_start(&state, buf, msg, l, NULL, UPB_DECODE_MAX_NESTING)) {
+    return true;
+  } else if (state.missing) {
+    upb_status_seterrf(status, "Missing required field %u",
+                       (unsigned)state.missing);
+  } else {
+    upb_status_seterrmsg(status, "Failed to parse input");
+  }
+  return false;
+}
+
+bool upb_decode_masked(upb_stringview buf, void *msg, const upb_msglayout *l,
+                       const upb_decodemask *mask, int options) {
+  return upb_decode_withmaxnesting(buf, msg, l, mask, options,
+                                   UPB_DECODE_MAX_NESTING);
+}
+
+bool upb_decode2(upb_stringview buf, void *msg, const upb_msglayout *l,
+                 int options) {
+  return upb_decode_masked(buf, msg, l, NULL, options);
 }
 
 bool upb_decode(upb_stringview buf, void *msg, const upb_msglayout *l) {
+  return upb_decode2(buf, msg, l, UPB_DECODE_ALIASINPUT);
+}
+
+bool upb_decode_lazyinto(const upb_lazymsg *lazy, upb_msg *msg,
+                         const upb_msglayout *l, int options) {
+  return upb_decode_withext(lazy->data, msg, l, lazy->mask, lazy->extreg,
+                            options, lazy->max_nesting);
+}
+
+void *upb_decode_lazy(void **slot, const upb_msglayout *l) {
+  const upb_lazymsg *lazy = upb_getlazymsg(*slot);
+  upb_msg *msg = upb_msg_new(l, lazy->arena);
+
+  if (!msg || !upb_decode_lazyinto(lazy, msg, l, lazy->options)) {
+    return NULL;
+  }
+
+  *slot = msg;
+  return msg;
+}
+
+
+/* upb_decodebatch ************************************************************/
+
+static void upb_decodebatch_freechunk(void *ud) {
+  upb_arena_uninit(ud);
+}
+
+/* Splits the elements into |n| runs of about the same number of bytes, each
+ * holding at least one element.  Requires 0 < n <= b->len. */
+static void upb_decodebatch_split(upb_decodebatch *b, size_t n) {
+  size_t per_chunk = b->bytes / n;
+  size_t elem = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    upb_decodechunk *c = &b->chunks[i];
+    size_t bytes = 0;
+    size_t last = b->len - (n - i - 1);  /* Leave one for each later chunk. */
+
+    c->begin = elem;
+    do {
+      bytes += b->elems[elem++].size;
+    } while (elem < last && (bytes < per_chunk || i == n - 1));
+    c->end = elem;
+  }
+
+  UPB_ASSERT(elem == b->len);
+}
+
+upb_decodebatch *upb_decodebatch_new(upb_stringview buf, void *msg,
+                                     const upb_msglayout *l,
+                                     uint32_t field_number, size_t chunks,
+                                     int options) {
+  upb_arena *arena = upb_msg_arena(msg);
+  upb_alloc *alloc = upb_arena_alloc(arena);
+  const upb_msglayout_field *field = upb_find_field(l, field_number);
+  upb_decodebatch *b;
   upb_decstate state;
-  state.ptr = buf.data;
+  size_t i;
+
+  UPB_ASSERT(chunks > 0);
+
+  if (!field || field->label != UPB_LABEL_REPEATED ||
+      field->descriptortype != UPB_DESCRIPTOR_TYPE_MESSAGE ||
+      upb_msglayout_ismap(l, field)) {
+    return NULL;
+  }
+
+  b = upb_malloc(alloc, sizeof(*b));
+  CHK(b);
+  b->msg = msg;
+  b->m = l;
+  b->field = field;
+  b->options = options;
+  b->elems = NULL;
+  b->len = 0;
+  b->size = 0;
+  b->bytes = 0;
+
+  state.options = options;
+  state.batch = b;
+  state.stats = NULL;
+  state.extreg = NULL;
+  state.partial = false;
+  state.missing = 0;
+  CHK(upb_decode_start(&state, buf, msg, l, NULL, UPB_DECODE_MAX_NESTING));
+
+  b->chunk_count = UPB_MIN(chunks, b->len);
+  b->chunks = upb_malloc(alloc, b->chunk_count * sizeof(*b->chunks));
+  CHK(b->chunks || b->chunk_count == 0);
+
+  for (i = 0; i < b->chunk_count; i++) {
+    upb_decodechunk *c = &b->chunks[i];
+    /* Chunks may run on different threads at once, so they can't share
+     * |arena|'s block allocator, which need not be thread-safe (an ArenaPool
+     * isn't).  Each takes its blocks from upb_alloc_global instead.  With no
+     * initial block, the chunk can be fused into |arena| later if that uses
+     * upb_alloc_global too; otherwise the cleanup frees it with |arena|. */
+    upb_arena_init2(&c->arena, NULL, 0, &upb_alloc_global);
+    c->msgs = NULL;
+    c->done = false;
+    if (!upb_arena_addcleanup(arena, upb_decodebatch_freechunk, &c->arena)) {
+      upb_arena_uninit(&c->arena);
+      return NULL;
+    }
+  }
+
+  if (b->chunk_count > 0) {
+    upb_decodebatch_split(b, b->chunk_count);
+  }
+
+  return b;
+}
+
+size_t upb_decodebatch_chunks(const upb_decodebatch *b) {
+  return b->chunk_count;
+}
+
+bool upb_decodebatch_run(upb_decodebatch *b, size_t i) {
+  upb_decodechunk *c = &b->chunks[i];
+  const upb_msglayout *subm = b->m->submsgs[b->field->submsg_index];
+  upb_decstate state;
+  size_t j;
+
+  UPB_ASSERT(i < b->chunk_count && !c->done);
+
+  c->msgs = upb_malloc(upb_arena_alloc(&c->arena),
+                       (c->end - c->begin) * sizeof(*c->msgs));
+  CHK(c->msgs);
+  state.options = b->options;
+  state.batch = NULL;
+  state.stats = NULL;
+  state.extreg = NULL;
+  state.partial = false;
+  state.missing = 0;
+
+  for (j = c->begin; j < c->end; j++) {
+    void *submsg = upb_msg_new(subm, &c->arena);
+    CHK(submsg);
+    /* The elements are one level below the top-level message. */
+    CHK(upb_decode_start(&state, b->elems[j], submsg, subm, NULL,
+                         UPB_DECODE_MAX_NESTING - 1));
+    c->msgs[j - c->begin] = submsg;
+  }
+
+  c->done = true;
+  return true;
+}
+
+bool upb_decodebatch_finish(upb_decodebatch *b) {
+  upb_arena *arena = upb_msg_arena(b->msg);
+  upb_decframe frame;
+  upb_array *arr;
+  void **out;
+  size_t i;
+
+  for (i = 0; i < b->chunk_count; i++) {
+    CHK(b->chunks[i].done);
+  }
+
+  frame.msg = b->msg;
+  frame.m = b->m;
+  arr = upb_getorcreatearr(&frame, b->field);
+  CHK(arr);
+  out = upb_array_reserve(NULL, arr, b->len);
+  CHK(out || b->len == 0);
+
+  for (i = 0; i < b->chunk_count; i++) {
+    upb_decodechunk *c = &b->chunks[i];
+    size_t n = c->end - c->begin;
+    memcpy(out, c->msgs, n * sizeof(*out));
+    out += n;
+    if (arena->block_alloc == c->arena.block_alloc) {
+      CHK(upb_arena_fuse(arena, &c->arena));
+    }
+  }
+
+  arr->len += b->len;
+  upb_msg_invalidatesize(b->msg);
+  return true;
+}
+
+
+/* upb_decodestream ***********************************************************/
+
+/* A stream only stops between fields.  Whole fields in an input buffer are
+ * handed to upb_decode_start() in runs, as many at a time as possible.  A
+ * submessage or group that doesn't fit in the buffer gets a frame of its own,
+ * so that its fields can be decoded as they arrive.  Any other field that is
+ * cut off by the end of a buffer is copied aside until the rest of it comes. */
+
+typedef enum {
+  UPB_SCAN_FIELD,     /* A whole field of |len| bytes. */
+  UPB_SCAN_ENTER,     /* A submessage or group with a |len| byte header. */
+  UPB_SCAN_ENDGROUP,  /* The end tag of the current group, |len| bytes. */
+  UPB_SCAN_PARTIAL,   /* Part of a field, which will be |len| bytes if that
+                       * is known yet, or else 0. */
+  UPB_SCAN_ERROR
+} upb_scanresult;
+
+/* A submessage or group that has not all arrived yet. */
+typedef struct {
+  char *msg;
+  const upb_msglayout *m;
+  const upb_decodemask *mask;
+  size_t end;            /* Stream offset where it ends, at the latest. */
+  int32_t group_number;  /* 0 if not a group. */
+} upb_streamframe;
+
+struct upb_decodestream {
+  int options;
+  bool error;
+  size_t pos;  /* Stream offset of the next byte to decode. */
+
+  /* stack[0] is the message being decoded. */
+  upb_streamframe *stack;
+  upb_streamframe *top;
+  upb_streamframe *limit;
+
+  /* The start of a field that was cut off by the end of a buffer. */
+  char *pending;
+  size_t pending_len;
+  size_t pending_size;
+};
+
+/* Reads a varint from the |n| bytes at |p|.  Returns its length, 0 if it
+ * doesn't end within |n| bytes, or -1 if it is too long. */
+static int upb_stream_varint(const char *p, size_t n, uint64_t *val) {
+  size_t i;
+
+  *val = 0;
+  for (i = 0; i < n && i < UPB_PB_VARINT_MAX_LEN; i++) {
+    *val |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+    if (!(p[i] & 0x80)) return i + 1;
+  }
+
+  return i == UPB_PB_VARINT_MAX_LEN ? -1 : 0;
+}
+
+/* Finds the size of the field at |p|, reading at most |n| bytes.  Sets |*hdr|
+ * to the size of its tag and any length prefix, and |*size| to the size of the
+ * whole field, which for a group is just its start tag.  Returns 0 if |n|
+ * bytes are not enough to tell, or -1 if the field is malformed. */
+static int upb_stream_fieldsize(const char *p, size_t n, uint64_t *tag,
+                                size_t *hdr, size_t *size) {
+  uint64_t val;
+  int t = upb_stream_varint(p, n, tag);
+  int v;
+
+  if (t <= 0) return t;
+  if (*tag > UINT32_MAX) return -1;
+  *hdr = t;
+
+  switch (*tag & 7) {
+    case UPB_WIRE_TYPE_VARINT:
+      v = upb_stream_varint(p + t, n - t, &val);
+      if (v <= 0) return v;
+      *size = t + v;
+      return 1;
+    case UPB_WIRE_TYPE_64BIT:
+      *size = t + 8;
+      return 1;
+    case UPB_WIRE_TYPE_32BIT:
+      *size = t + 4;
+      return 1;
+    case UPB_WIRE_TYPE_DELIMITED:
+      v = upb_stream_varint(p + t, n - t, &val);
+      if (v <= 0) return v;
+      if (val >= INT32_MAX) return -1;
+      *hdr = t + v;
+      *size = t + v + val;
+      return 1;
+    case UPB_WIRE_TYPE_START_GROUP:
+    case UPB_WIRE_TYPE_END_GROUP:
+      *size = t;
+      return 1;
+    default:
+      return -1;
+  }
+}
+
+/* Returns field |field_number| of |frame| if it is a submessage or group (as
+ * |descriptortype| says) that can be entered, or else NULL. */
+static const upb_msglayout_field *upb_stream_submsgfield(
+    const upb_streamframe *frame, uint32_t field_number, int descriptortype) {
+  const upb_msglayout_field *field = upb_find_field(frame->m, field_number);
+
+  if (!field || field->descriptortype != descriptortype ||
+      upb_msglayout_ismap(frame->m, field)) {
+    return NULL;
+  }
+
+  if (frame->mask &&
+      !upb_decodemask_keeps(frame->mask, field - frame->m->fields)) {
+    return NULL;
+  }
+
+  return field;
+}
+
+/* Classifies the field at |p|, of which |n| bytes have arrived.  |room| is
+ * how much of the current frame is left; a field that needs more is an error.
+ * For UPB_SCAN_ENTER, sets |*field| and, for a submessage, |*body| to the
+ * size of its contents. */
+static upb_scanresult upb_stream_scan(const upb_streamframe *frame,
+                                      const char *p, size_t n, size_t room,
+                                      size_t *len, size_t *body,
+                                      const upb_msglayout_field **field) {
+  uint64_t tag;
+  size_t hdr;
+  size_t size;
+  size_t ofs = 0;
+  int depth = 0;
+
+  *len = 0;
+
+  /* A group we don't enter is part of the field: we go through it field by
+   * field until we are back at depth 0. */
+  do {
+    int r = upb_stream_fieldsize(p + ofs, n - ofs, &tag, &hdr, &size);
+
+    if (r < 0) return UPB_SCAN_ERROR;
+    if (r == 0) return n < room ? UPB_SCAN_PARTIAL : UPB_SCAN_ERROR;
+    if ((tag >> 3) == 0) return UPB_SCAN_ERROR;
+
+    if (depth == 0) {
+      switch (tag & 7) {
+        case UPB_WIRE_TYPE_DELIMITED:
+          if (size > n && size <= room) {
+            *field = upb_stream_submsgfield(frame, tag >> 3,
+                                            UPB_DESCRIPTOR_TYPE_MESSAGE);
+            if (*field) {
+              *len = hdr;
+              *body = size - hdr;
+              return UPB_SCAN_ENTER;
+            }
+          }
+          break;
+        case UPB_WIRE_TYPE_START_GROUP:
+          *field = upb_stream_submsgfield(frame, tag >> 3,
+                                          UPB_DESCRIPTOR_TYPE_GROUP);
+          if (*field) {
+            *len = hdr;
+            return UPB_SCAN_ENTER;
+          }
+          break;
+        case UPB_WIRE_TYPE_END_GROUP:
+          /* Only a group may end here: the top-level message and
+           * submessages have group number 0, which no tag has. */
+          if (frame->group_number == 0 ||
+              (int32_t)(tag >> 3) != frame->group_number) {
+            return UPB_SCAN_ERROR;
+          }
+          *len = hdr;
+          return UPB_SCAN_ENDGROUP;
+      }
+    }
+
+    if (size > room - ofs) return UPB_SCAN_ERROR;
+    if (size > n - ofs) {
+      if (depth == 0) *len = size;
+      return UPB_SCAN_PARTIAL;
+    }
+    ofs += size;
+
+    if ((tag & 7) == UPB_WIRE_TYPE_START_GROUP) {
+      depth++;
+    } else if ((tag & 7) == UPB_WIRE_TYPE_END_GROUP) {
+      depth--;
+    }
+  } while (depth > 0);
+
+  *len = ofs;
+  return UPB_SCAN_FIELD;
+}
+
+/* Decodes the |n| bytes at |p|, which are whole fields, into the top frame. */
+static bool upb_stream_decode(upb_decodestream *s, const char *p, size_t n) {
+  upb_streamframe *frame = s->top;
+  upb_decstate d;
+
+  d.options = s->options;
+  d.batch = NULL;
+  d.stats = NULL;
+  d.extreg = NULL;
+  d.partial = true;
+  d.missing = 0;
+  CHK(upb_decode_start(&d, upb_stringview_make(p, n), frame->msg, frame->m,
+                       frame->mask, s->limit - frame));
+  s->pos += n;
+  return true;
+}
+
+/* Acts on what upb_stream_scan() found at |p|, unless it is partial. */
+static bool upb_stream_field(upb_decodestream *s, upb_scanresult r,
+                             const char *p, size_t len, size_t body,
+                             const upb_msglayout_field *field) {
+  upb_streamframe *frame = s->top;
+  upb_streamframe *sub = frame + 1;
+  upb_decframe parent;
+
+  switch (r) {
+    case UPB_SCAN_FIELD:
+      return upb_stream_decode(s, p, len);
+    case UPB_SCAN_ENDGROUP:
+      CHK(frame->group_number != 0);
+      CHK(!upb_decode_missing(s->options, frame->msg, frame->m, frame->mask));
+      s->pos += len;
+      s->top--;
+      return true;
+    case UPB_SCAN_ENTER:
+      break;
+    default:
+      return false;
+  }
+
+  CHK(sub < s->limit);
+  parent.msg = frame->msg;
+  parent.m = frame->m;
+  parent.mask = frame->mask;
+  sub->msg = upb_decode_preparesubmsg(NULL, &parent, field);
+  CHK(sub->msg);
+  upb_decode_setpresent(&parent, field);
+  upb_msg_invalidatesize(sub->msg);
+
+  sub->m = frame->m->submsgs[field->submsg_index];
+  sub->mask = upb_decode_submask(&parent, field);
+  s->pos += len;
+  if (field->descriptortype == UPB_DESCRIPTOR_TYPE_GROUP) {
+    /* It ends at its end tag, which must come before its parent ends. */
+    sub->group_number = field->number;
+    sub->end = frame->end;
+  } else {
+    sub->group_number = 0;
+    sub->end = s->pos + body;
+  }
+  s->top = sub;
+  return true;
+}
+
+static bool upb_stream_append(upb_decodestream *s, const char *p, size_t n) {
+  if (n > s->pending_size - s->pending_len) {
+    size_t size = UPB_MAX(s->pending_len + n, s->pending_size * 2);
+    char *mem = upb_grealloc(s->pending, s->pending_size, size);
+    CHK(mem);
+    s->pending = mem;
+    s->pending_size = size;
+  }
+
+  memcpy(s->pending + s->pending_len, p, n);
+  s->pending_len += n;
+  return true;
+}
+
+/* Adds bytes from |*p| to the field that was cut off until it is whole, and
+ * then acts on it.  Stops early if the bytes run out. */
+static bool upb_stream_finishpending(upb_decodestream *s, const char **p,
+                                     const char *end) {
+  while (true) {
+    const upb_msglayout_field *field;
+    size_t room = s->top->end - s->pos;
+    size_t len, body, take;
+    upb_scanresult r = upb_stream_scan(s->top, s->pending, s->pending_len,
+                                       room, &len, &body, &field);
+
+    if (r == UPB_SCAN_ERROR) return false;
+
+    if (r != UPB_SCAN_PARTIAL) {
+      /* Everything that was pending before this call belonged to the field,
+       * so anything past it came from this buffer. */
+      *p -= s->pending_len - len;
+      s->pending_len = 0;
+      return upb_stream_field(s, r, s->pending, len, body, field);
+    }
+
+    if (*p == end) return true;
+
+    /* Take what the field still needs if we know, or else a bit more. */
+    take = len ? len - s->pending_len : UPB_MAX(s->pending_len, 16);
+    take = UPB_MIN(take, (size_t)(end - *p));
+    CHK(upb_stream_append(s, *p, take));
+    *p += take;
+  }
+}
+
+static upb_decodestatus upb_stream_parse(upb_decodestream *s, const char **p,
+                                         const char *end) {
+  while (true) {
+    upb_streamframe *frame = s->top;
+    size_t room = frame->end - s->pos;
+    size_t avail = end - *p;
+    const upb_msglayout_field *field = NULL;
+    size_t len = 0;
+    size_t body = 0;
+    const char *q;
+    upb_scanresult r;
+
+    if (room == 0) {
+      if (frame->group_number ||
+          upb_decode_missing(s->options, frame->msg, frame->m, frame->mask)) {
+        return UPB_DECODE_ERROR;
+      }
+      if (frame == s->stack) return UPB_DECODE_DONE;
+      s->top--;
+      continue;
+    }
+
+    if (avail == 0) return UPB_DECODE_NEEDMORE;
+
+    if (avail >= room && !frame->group_number) {
+      /* The rest of the frame is here: decode it in one go. */
+      if (!upb_stream_decode(s, *p, room)) return UPB_DECODE_ERROR;
+      *p += room;
+      continue;
+    }
+
+    q = *p;
+    do {
+      r = upb_stream_scan(frame, q, end - q, room - (q - *p), &len, &body,
+                          &field);
+      if (r == UPB_SCAN_FIELD) q += len;
+    } while (r == UPB_SCAN_FIELD && q < end);
+
+    if (q > *p) {
+      if (!upb_stream_decode(s, *p, q - *p)) return UPB_DECODE_ERROR;
+      *p = q;
+    }
+
+    if (r == UPB_SCAN_FIELD) continue;
+
+    if (r == UPB_SCAN_PARTIAL) {
+      if (!upb_stream_append(s, q, end - q)) return UPB_DECODE_ERROR;
+      *p = end;
+      return UPB_DECODE_NEEDMORE;
+    }
+
+    if (!upb_stream_field(s, r, q, len, body, field)) return UPB_DECODE_ERROR;
+    *p += len;
+  }
+}
+
+static void upb_decodestream_free(void *ud) {
+  upb_decodestream *s = ud;
+  upb_gfree(s->pending);
+}
+
+upb_decodestream *upb_decodestream_new(upb_msg *msg, const upb_msglayout *l,
+                                       const upb_decodemask *mask,
+                                       int options, size_t size) {
+  upb_arena *arena = upb_msg_arena(msg);
+  upb_alloc *alloc = upb_arena_alloc(arena);
+  upb_decodestream *s = upb_malloc(alloc, sizeof(*s));
+
+  UPB_ASSERT(!mask || mask->layout == l);
+  CHK(s);
+  s->stack = upb_malloc(alloc, UPB_DECODE_MAX_NESTING * sizeof(*s->stack));
+  CHK(s->stack);
+  s->pending = NULL;
+  s->pending_len = 0;
+  s->pending_size = 0;
+  CHK(upb_arena_addcleanup(arena, upb_decodestream_free, s));
+
+  /* The input buffers are gone by the time the message is used. */
+  s->options = options | UPB_DECODE_COPYSTRINGS;
+  s->error = false;
+  s->pos = 0;
+  s->top = s->stack;
+  s->limit = s->stack + UPB_DECODE_MAX_NESTING;
+  s->top->msg = msg;
+  s->top->m = l;
+  s->top->mask = mask;
+  s->top->end = size;
+  s->top->group_number = 0;
+  upb_msg_invalidatesize(msg);
+  return s;
+}
+
+upb_decodestatus upb_decodestream_put(upb_decodestream *s, const char *buf,
+                                      size_t len, size_t *consumed) {
+  const char *p = buf;
+  upb_decodestatus ret;
+
+  if (s->error) {
+    ret = UPB_DECODE_ERROR;
+  } else if (s->pending_len > 0 &&
+             !upb_stream_finishpending(s, &p, buf + len)) {
+    ret = UPB_DECODE_ERROR;
+  } else if (s->pending_len > 0) {
+    ret = UPB_DECODE_NEEDMORE;
+  } else {
+    ret = upb_stream_parse(s, &p, buf + len);
+  }
+
+  if (ret == UPB_DECODE_ERROR) s->error = true;
+  if (consumed) *consumed = p - buf;
+  return ret;
+}
+
+upb_decodestatus upb_decodestream_end(upb_decodestream *s) {
+  upb_streamframe *top = s->top;
+  if (!s->error && s->pending_len == 0 && top == s->stack &&
+      (top->end == UPB_DECODE_UNKNOWNSIZE || s->pos == top->end) &&
+      !upb_decode_missing(s->options, top->msg, top->m, top->mask)) {
+    return UPB_DECODE_DONE;
+  }
 
-  return upb_decode_message(&state, buf.data + buf.size, 0, msg, l);
+  s->error = true;
+  return UPB_DECODE_ERROR;
 }
 
 #undef CHK
@@ -5,12 +5,282 @@
 #ifndef UPB_DECODE_H_
 #define UPB_DECODE_H_
 
+#include <string.h>
+
 #include "upb/msg.h"
 
 UPB_BEGIN_EXTERN_C
 
+/* Options for upb_decode2(), which may be OR'd together. */
+typedef enum {
+  /* String and bytes fields point directly into the input buffer, so no
+   * string data is copied.  The caller must keep the buffer alive (and
+   * unmodified) for as long as the message is in use.  Unknown fields are
+   * referenced the same way.  This is the default, and is what upb_decode()
+   * does. */
+  UPB_DECODE_ALIASINPUT = 0,
+
+  /* String and bytes fields are copied into the message's arena, so the input
+   * buffer may be freed or reused as soon as decoding returns.  Unknown fields
+   * are copied too; by default they also alias the buffer. */
+  UPB_DECODE_COPYSTRINGS = 1 << 0,
+
+  /* Fields of type string (not bytes) must hold valid UTF-8, as proto3
+   * requires; decoding fails if one doesn't.  The check is done as each
+   * string is decoded, so there is no need for a separate pass over the
+   * message. */
+  UPB_DECODE_VALIDATEUTF8 = 1 << 1,
+
+  /* Singular submessage fields (not groups) are not parsed.  Their bytes are
+   * recorded instead, and upb_msg_get() parses them the first time the field
+   * is read; upb_encode() writes them back out unchanged if they were never
+   * read.  This saves the work for submessages that are never looked at.
+   *
+   * The recorded bytes alias |buf| unless UPB_DECODE_COPYSTRINGS is also
+   * given.  Errors inside a lazy submessage, including invalid UTF-8, are
+   * only found when it is parsed: upb_msg_get() then returns NULL for it.
+   * Lazy fields must be read with upb_msg_get(), not generated accessors, and
+   * reading one is a mutation, so it is not safe concurrently with other
+   * reads of the same message. */
+  UPB_DECODE_LAZY = 1 << 2,
+
+  /* Every message must have all of its proto2 required fields; decoding
+   * fails if one doesn't.  Each message is checked as it ends, with one
+   * masked compare of its hasbits (see upb_msglayout.required), so there is
+   * no need for a separate pass over the message.  upb_decode_withstatus()
+   * says which field was missing.  Lazy submessages are checked when they are
+   * parsed, and messages decoded through a upb_decodemask are not checked at
+   * all, since the mask may leave their required fields out. */
+  UPB_DECODE_CHECKREQUIRED = 1 << 3
+} upb_decodeopt;
+
+/* A upb_decodemask restricts decoding to a set of field paths.  Fields
+ * outside the mask are skipped without being stored, or even being kept as
+ * unknown fields.  Unknown fields are dropped as well.  Masks are built from
+ * defs, by upb_decodemask_new() in upb/msgfactory.h. */
+typedef struct upb_decodemask upb_decodemask;
+
+
+/* Parses |buf| into |msg|, which must have layout |l|.  Equivalent to
+ * upb_decode2() with UPB_DECODE_ALIASINPUT: string and bytes fields in the
+ * resulting message alias |buf|. */
 bool upb_decode(upb_stringview buf, upb_msg *msg, const upb_msglayout *l);
 
+/* Like upb_decode(), but with options from upb_decodeopt. */
+bool upb_decode2(upb_stringview buf, upb_msg *msg, const upb_msglayout *l,
+                 int options);
+
+/* Like upb_decode2(), but only decodes the fields in |mask|, which must have
+ * been compiled for layout |l|.  A NULL |mask| decodes every field.  With
+ * UPB_DECODE_LAZY, lazy submessages keep a pointer to their part of |mask|,
+ * so it must outlive |msg|. */
+bool upb_decode_masked(upb_stringview buf, upb_msg *msg,
+                       const upb_msglayout *l, const upb_decodemask *mask,
+                       int options);
+
+/* Like upb_decode2(), but fields of extendable messages that are extensions
+ * in |extreg| are parsed into the message's extensions (see upb_msg_getext())
+ * rather than kept as unknown fields.  So are those in lazy submessages,
+ * which keep a pointer to |extreg|, so it must outlive |msg|. */
+bool upb_decode_ext(upb_stringview buf, upb_msg *msg, const upb_msglayout *l,
+                    const upb_extreg *extreg, int options);
+
+/* Like upb_decode2(), but on failure sets |status| (if non-NULL).  If
+ * UPB_DECODE_CHECKREQUIRED found a message without one of its required
+ * fields, the error gives the number of the first such field in that
+ * message. */
+bool upb_decode_withstatus(upb_stringview buf, upb_msg *msg,
+                           const upb_msglayout *l, int options,
+                           upb_status *status);
+
+/* Parses the file at |path| into |msg|, which must have layout |l|, with
+ * upb_decode2() |options|.  Where the platform supports it, a file of 64KB or
+ * more is mmap()ed rather than read, so with UPB_DECODE_ALIASINPUT its string
+ * data is never copied at all; the mapping stays until the message's arena is
+ * freed or reset.  Other files are read into the arena.  On failure returns false
+ * and sets |status| (if non-NULL). */
+bool upb_decode_file(const char *path, upb_msg *msg, const upb_msglayout *l,
+                     int options, upb_status *status);
+
+/* How deeply upb_decode() and friends let submessages and groups nest,
+ * counting the top-level message.  Input nested any deeper fails to parse.
+ * The decoder does not recurse: it keeps a frame per level, and for this many
+ * levels the frames (a few KB) are on the C stack. */
+#define UPB_DECODE_MAX_NESTING 64
+
+/* Like upb_decode_masked(), but with a nesting limit of |max_nesting|
+ * instead of UPB_DECODE_MAX_NESTING.  A limit above UPB_DECODE_MAX_NESTING
+ * allocates its frames with upb_gmalloc() for the duration of the call.  Lazy
+ * submessages remember how much of the limit was left for them. */
+bool upb_decode_withmaxnesting(upb_stringview buf, upb_msg *msg,
+                               const upb_msglayout *l,
+                               const upb_decodemask *mask, int options,
+                               size_t max_nesting);
+
+/* Counters for upb_decode_withstats() to add to.  Keeping one per message
+ * type shows what decoding each type costs.  Zero it before first use. */
+typedef struct {
+  size_t msgs;          /* Messages decoded. */
+  size_t errors;        /* How many of those failed to parse. */
+  size_t bytes;         /* Bytes of input. */
+  size_t arena_bytes;   /* Bytes allocated from the messages' arenas. */
+  size_t arrays_grown;  /* Times storage for a repeated field was allocated. */
+  size_t array_bytes;   /* The size of that storage, added up. */
+} upb_decodestats;
+
+/* Like upb_decode_masked(), but also counts the work done in |stats|.  Lazy
+ * submessages are not counted when they are parsed later.  For the arena's
+ * side of this, including memory that was wasted, see upb_arena_setstats(). */
+bool upb_decode_withstats(upb_stringview buf, upb_msg *msg,
+                          const upb_msglayout *l, const upb_decodemask *mask,
+                          int options, upb_decodestats *stats);
+
+/* A upb_decodebatch decodes a message whose bulk is one repeated submessage
+ * field (a long list of records, say) in independent chunks, which the caller
+ * may hand to as many threads as it likes.  upb itself never starts threads.
+ *
+ *   upb_decodebatch *b = upb_decodebatch_new(buf, msg, l, 1, nthreads, 0);
+ *   // On each thread i in [0, upb_decodebatch_chunks(b)):
+ *   upb_decodebatch_run(b, i);
+ *   // Once every run has returned:
+ *   upb_decodebatch_finish(b);
+ *
+ * Each chunk decodes its elements into an arena of its own, so chunks share
+ * no mutable state.  The chunk arenas take their blocks from
+ * upb_alloc_global, whatever the message's arena uses, since that allocator
+ * need not be safe to call from several threads.  upb_decodebatch_finish()
+ * appends the elements to the field in their original order, and fuses the
+ * chunk arenas into the message's arena if it uses upb_alloc_global too (so
+ * their blocks count towards its size).  The element messages keep using
+ * their chunk's arena for any later allocation (unknown fields, growing a
+ * repeated field); that arena is freed along with the message's arena. */
+typedef struct upb_decodebatch upb_decodebatch;
+
+/* Parses |buf| into |msg| like upb_decode2(), except that the elements of
+ * field |field_number|, which must be a repeated message field other than a
+ * map, are only located, not parsed.  They are split into at most |chunks|
+ * batches of roughly equal size for upb_decodebatch_run().  The batch is
+ * allocated from the message's arena.  Returns NULL if the field is not a
+ * repeated message field, if the rest of the message fails to parse, or if
+ * out of memory. */
+upb_decodebatch *upb_decodebatch_new(upb_stringview buf, upb_msg *msg,
+                                     const upb_msglayout *l,
+                                     uint32_t field_number, size_t chunks,
+                                     int options);
+
+/* Returns the number of chunks to run.  This is less than requested if there
+ * are fewer elements than chunks; it is zero if there are none. */
+size_t upb_decodebatch_chunks(const upb_decodebatch *b);
+
+/* Decodes chunk |i|.  Different chunks of one batch may run concurrently;
+ * each chunk must be run exactly once.  Returns false if one of its elements
+ * fails to parse. */
+bool upb_decodebatch_run(upb_decodebatch *b, size_t i);
+
+/* Adds the decoded elements to the message.  Must be called once, after every
+ * chunk has been run, and not concurrently with anything else using the
+ * message's arena.  Returns false if any chunk failed, in which case none of
+ * the elements are added. */
+bool upb_decodebatch_finish(upb_decodebatch *b);
+
+/* A upb_decodestream decodes a message whose bytes arrive in pieces, as from
+ * a non-blocking socket, without waiting for all of them:
+ *
+ *   upb_decodestream *s = upb_decodestream_new(msg, l, NULL, 0, size);
+ *   // As each buffer arrives:
+ *   switch (upb_decodestream_put(s, buf, len, &consumed)) {
+ *     case UPB_DECODE_NEEDMORE: // Wait for the next buffer.
+ *     case UPB_DECODE_DONE:     // |msg| is ready; buf[consumed] on is not ours.
+ *     case UPB_DECODE_ERROR:    // Give up.
+ *   }
+ *
+ * Decoding stops between fields, so all the state kept between buffers is a
+ * frame for each submessage that is still arriving, and a copy of a field that
+ * was cut off by the end of a buffer.  String data is always copied into the
+ * message, as if UPB_DECODE_COPYSTRINGS were given, so buffers may be reused
+ * as soon as upb_decodestream_put() returns.  The stream is allocated from the
+ * message's arena, and lasts as long as it does. */
+typedef struct upb_decodestream upb_decodestream;
+
+typedef enum {
+  UPB_DECODE_NEEDMORE,  /* All input so far is decoded; more may follow. */
+  UPB_DECODE_DONE,      /* The message is complete. */
+  UPB_DECODE_ERROR      /* The input is malformed, or we ran out of memory. */
+} upb_decodestatus;
+
+/* For a stream whose size is not known in advance: it ends at
+ * upb_decodestream_end(). */
+#define UPB_DECODE_UNKNOWNSIZE SIZE_MAX
+
+/* Starts decoding into |msg|, which has layout |l|, a message of |size|
+ * bytes.  |mask| and |options| are as for upb_decode_masked().  Returns NULL
+ * if out of memory. */
+upb_decodestream *upb_decodestream_new(upb_msg *msg, const upb_msglayout *l,
+                                       const upb_decodemask *mask,
+                                       int options, size_t size);
+
+/* Decodes as much of the |len| bytes at |buf| as belongs to the message.  Sets
+ * |*consumed| (if non-NULL) to the number of bytes used, which is |len| unless
+ * the message is done.  Once the stream returns UPB_DECODE_DONE or
+ * UPB_DECODE_ERROR, it returns the same from then on. */
+upb_decodestatus upb_decodestream_put(upb_decodestream *s, const char *buf,
+                                      size_t len, size_t *consumed);
+
+/* Says that no more input is coming.  Returns UPB_DECODE_DONE if the input
+ * ended between two fields of the message, and as many bytes as the size
+ * given to upb_decodestream_new() were seen, if it wasn't
+ * UPB_DECODE_UNKNOWNSIZE.  Otherwise returns UPB_DECODE_ERROR. */
+upb_decodestatus upb_decodestream_end(upb_decodestream *s);
+
+
+/** Interfaces for generated code *********************************************/
+
+/* These back the parsers that upbc --generate-parsers emits (see
+ * upb_msglayout.parse); they are not meant to be called directly.  Each reads
+ * one value at |*ptr|, never reading at or past |limit|, and advances |*ptr|
+ * past it.  They return false if the value is cut off or malformed. */
+
+UPB_INLINE bool _upb_decode_varint(const char **ptr, const char *limit,
+                                   uint64_t *val) {
+  const char *p = *ptr;
+  uint64_t ret = 0;
+  int bitpos;
+
+  for (bitpos = 0; bitpos < 70 && p < limit; bitpos += 7) {
+    uint8_t byte = *p++;
+    ret |= (uint64_t)(byte & 0x7f) << bitpos;
+    if (!(byte & 0x80)) {
+      *ptr = p;
+      *val = ret;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Copies the |size| bytes of a fixed32 or fixed64 value to |val|. */
+UPB_INLINE bool _upb_decode_fixed(const char **ptr, const char *limit,
+                                  void *val, size_t size) {
+  if ((size_t)(limit - *ptr) < size) return false;
+  memcpy(val, *ptr, size);
+  *ptr += size;
+  return true;
+}
+
+/* Sets |val| to the string data, which is left where it is in the input. */
+UPB_INLINE bool _upb_decode_string(const char **ptr, const char *limit,
+                                   upb_stringview *val) {
+  uint64_t len;
+  if (!_upb_decode_varint(ptr, limit, &len) ||
+      len > (uint64_t)(limit - *ptr) || len >= INT32_MAX) {
+    return false;
+  }
+  *val = upb_stringview_make(*ptr, len);
+  *ptr += len;
+  return true;
+}
+
 UPB_END_EXTERN_C
 
 #endif  /* UPB_DECODE_H_ */
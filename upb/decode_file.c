@@ -0,0 +1,155 @@
+/*
+** upb_decode_file(): upb_decode2() straight out of a memory-mapped file.
+**
+** On Unix-like systems the file is mmap()ed read-only and decoded where it
+** lies, so by default strings alias the page cache and nothing is copied.
+** Elsewhere, or for files that can't be mapped (pipes, say), the file is read
+** into the message's arena instead.
+*/
+
+#if defined(__unix__) || defined(__APPLE__)
+#define UPB_DECODE_FILE_MMAP
+/* mmap() and friends are POSIX, not C89. */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+#endif
+
+#include <stdio.h>
+
+#ifdef UPB_DECODE_FILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "upb/decode.h"
+
+/* Files smaller than this are read rather than mapped: for them, the system
+ * calls and page faults of mapping cost more than the copy they save. */
+#define UPB_DECODE_FILE_MMAPMIN 65536
+
+#ifdef UPB_DECODE_FILE_MMAP
+
+typedef struct {
+  void *addr;
+  size_t len;
+} upb_filemap;
+
+static void upb_filemap_unmap(void *ud) {
+  upb_filemap *map = ud;
+  munmap(map->addr, map->len);
+}
+
+/* Maps all |len| bytes of |fd|.  The mapping is unmapped when |a| is freed or
+ * reset.  Returns false if the file can't be mapped, in which case the caller
+ * should read it instead. */
+static bool upb_filemap_map(int fd, size_t len, upb_arena *a,
+                            upb_stringview *buf) {
+  upb_filemap *map;
+  void *addr;
+
+  addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) return false;
+
+  map = upb_malloc(upb_arena_alloc(a), sizeof(*map));
+  if (!map) {
+    munmap(addr, len);
+    return false;
+  }
+  map->addr = addr;
+  map->len = len;
+  if (!upb_arena_addcleanup(a, upb_filemap_unmap, map)) {
+    munmap(addr, len);
+    return false;
+  }
+
+  /* The decoder reads front to back exactly once: ask for aggressive
+   * readahead, and let the kernel drop pages behind us. */
+#ifdef POSIX_MADV_SEQUENTIAL
+  posix_madvise(addr, len, POSIX_MADV_SEQUENTIAL);
+#endif
+
+  *buf = upb_stringview_make(addr, len);
+  return true;
+}
+
+/* Returns the size of |fd| if it is a regular file, or else 0. */
+static size_t upb_filesize(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+      (off_t)(size_t)st.st_size != st.st_size) {
+    return 0;
+  }
+  return st.st_size;
+}
+
+#endif  /* UPB_DECODE_FILE_MMAP */
+
+/* Reads the rest of |f| into a buffer from |a|.  |size| is a guess at how
+ * much there is. */
+static bool upb_readfile(FILE *f, size_t size, upb_arena *a,
+                         upb_stringview *buf) {
+  upb_alloc *alloc = upb_arena_alloc(a);
+  size_t len = 0;
+  char *data;
+
+  /* One byte more than expected, so that reading the whole file leaves room
+   * to see EOF without growing the buffer. */
+  size = UPB_MAX(size, 4095) + 1;
+  data = upb_malloc(alloc, size);
+  if (!data) return false;
+
+  for (;;) {
+    len += fread(data + len, 1, size - len, f);
+    if (len < size) break;
+    data = upb_realloc(alloc, data, size, size * 2);
+    if (!data) return false;
+    size *= 2;
+  }
+
+  if (ferror(f)) return false;
+  *buf = upb_stringview_make(data, len);
+  return true;
+}
+
+bool upb_decode_file(const char *path, upb_msg *msg, const upb_msglayout *l,
+                     int options, upb_status *status) {
+  upb_arena *a = upb_msg_arena(msg);
+  upb_stringview buf;
+  upb_status parse;
+  size_t size = 0;
+  FILE *f;
+  bool ok;
+
+  f = fopen(path, "rb");
+  if (!f) {
+    upb_status_seterrf(status, "Couldn't open file: %s", path);
+    return false;
+  }
+
+#ifdef UPB_DECODE_FILE_MMAP
+  size = upb_filesize(fileno(f));
+  ok = (size >= UPB_DECODE_FILE_MMAPMIN &&
+        upb_filemap_map(fileno(f), size, a, &buf)) ||
+       upb_readfile(f, size, a, &buf);
+#else
+  ok = upb_readfile(f, size, a, &buf);
+#endif
+  fclose(f);
+
+  if (!ok) {
+    upb_status_seterrf(status, "Couldn't read file: %s", path);
+    return false;
+  }
+
+  upb_status_clear(&parse);
+  if (!upb_decode_withstatus(buf, msg, l, options, &parse)) {
+    upb_status_seterrf(status, "Failed to parse file: %s: %s", path,
+                       upb_status_errmsg(&parse));
+    return false;
+  }
+
+  return true;
+}
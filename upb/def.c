@@ -2,6 +2,7 @@
 #include "upb/def.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include "upb/structdefs.int.h"
@@ -115,8 +116,9 @@ bool upb_def_setfullname(upb_def *def, const char *fullname, upb_status *s) {
     return false;
   }
 
-  upb_gfree((void*)def->fullname);
+  if (!def->name_interned) upb_gfree((void*)def->fullname);
   def->fullname = fullname;
+  def->name_interned = false;
   return true;
 }
 
@@ -129,12 +131,13 @@ static bool upb_def_init(upb_def *def, upb_deftype_t type,
   def->type = type;
   def->fullname = NULL;
   def->came_from_user = false;
+  def->name_interned = false;
   def->file = NULL;
   return true;
 }
 
 static void upb_def_uninit(upb_def *def) {
-  upb_gfree((void*)def->fullname);
+  if (!def->name_interned) upb_gfree((void*)def->fullname);
 }
 
 static const char *msgdef_name(const upb_msgdef *m) {
@@ -348,6 +351,13 @@ static bool assign_msg_indices(upb_msgdef *m, upb_status *s) {
       TRY(UPB_HANDLER_ENDSUBMSG)
       TRY(UPB_HANDLER_STARTSEQ)
       TRY(UPB_HANDLER_ENDSEQ)
+      TRY(UPB_HANDLER_INT32ARRAY)
+      TRY(UPB_HANDLER_INT64ARRAY)
+      TRY(UPB_HANDLER_UINT32ARRAY)
+      TRY(UPB_HANDLER_UINT64ARRAY)
+      TRY(UPB_HANDLER_FLOATARRAY)
+      TRY(UPB_HANDLER_DOUBLEARRAY)
+      TRY(UPB_HANDLER_BOOLARRAY)
     }
     upb_inttable_uninit(&t);
   }
@@ -359,6 +369,7 @@ static bool assign_msg_indices(upb_msgdef *m, upb_status *s) {
       upb_msg_oneof_next(&k), i++) {
     upb_oneofdef *o = upb_msg_iter_oneof(&k);
     o->index = i;
+    upb_strtable_compact(&o->ntof);
   }
 
   upb_gfree(fields);
@@ -401,8 +412,10 @@ bool _upb_def_validate(upb_def *const*defs, size_t n, upb_status *s) {
       if (!assign_msg_indices(m, s)) {
         goto err;
       }
+      upb_strtable_compact(&m->ntof);
     } else if (e) {
       upb_inttable_compact(&e->iton);
+      upb_strtable_compact(&e->ntoi);
     }
   }
 
@@ -1685,7 +1698,7 @@ static void freeoneof(upb_refcounted *r) {
   upb_oneofdef *o = (upb_oneofdef*)r;
   upb_strtable_uninit(&o->ntof);
   upb_inttable_uninit(&o->itof);
-  upb_gfree((void*)o->name);
+  if (!o->name_interned) upb_gfree((void*)o->name);
   upb_gfree(o);
 }
 
@@ -1700,6 +1713,7 @@ upb_oneofdef *upb_oneofdef_new(const void *owner) {
 
   o->parent = NULL;
   o->name = NULL;
+  o->name_interned = false;
 
   if (!upb_refcounted_init(upb_oneofdef_upcast_mutable(o), &upb_oneofdef_vtbl,
                            owner)) {
@@ -1737,8 +1751,9 @@ bool upb_oneofdef_setname(upb_oneofdef *o, const char *name, upb_status *s) {
     return false;
   }
 
-  upb_gfree((void*)o->name);
+  if (!o->name_interned) upb_gfree((void*)o->name);
   o->name = name;
+  o->name_interned = false;
   return true;
 }
 
@@ -1888,6 +1903,7 @@ static void freefiledef(upb_refcounted *r) {
   upb_gfree((void*)f->package);
   upb_gfree((void*)f->phpprefix);
   upb_gfree((void*)f->phpnamespace);
+  upb_gfree(f->names);
   upb_gfree(f);
 }
 
@@ -1905,6 +1921,7 @@ upb_filedef *upb_filedef_new(const void *owner) {
   f->phpprefix = NULL;
   f->phpnamespace = NULL;
   f->syntax = UPB_SYNTAX_PROTO2;
+  f->names = NULL;
 
   if (!upb_refcounted_init(upb_filedef_upcast_mutable(f), &upb_filedef_vtbl,
                            owner)) {
@@ -2155,7 +2172,8 @@ const upb_def *upb_symtab_resolve(const upb_symtab *s, const char *base,
 
 /* TODO(haberman): we need a lot more testing of error conditions. */
 static bool symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
-                       void *ref_donor, upb_refcounted *freeze_also,
+                       void *ref_donor, upb_refcounted *const*freeze_also,
+                       size_t freeze_also_n, int maxdepth,
                        upb_status *status) {
   size_t i;
   size_t add_n;
@@ -2166,7 +2184,7 @@ static bool symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
   size_t add_objs_size;
   upb_strtable addtab;
 
-  if (n == 0 && !freeze_also) {
+  if (n == 0 && freeze_also_n == 0) {
     return true;
   }
 
@@ -2261,10 +2279,7 @@ static bool symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
 
   /* We need an array of the defs in addtab, for passing to
    * upb_refcounted_freeze(). */
-  add_objs_size = upb_strtable_count(&addtab);
-  if (freeze_also) {
-    add_objs_size++;
-  }
+  add_objs_size = upb_strtable_count(&addtab) + freeze_also_n;
 
   add_defs = upb_gmalloc(sizeof(void*) * add_objs_size);
   if (add_defs == NULL) goto oom_err;
@@ -2283,12 +2298,11 @@ static bool symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
   add_objs = (upb_refcounted**)add_defs;
 
   freeze_n = add_n;
-  if (freeze_also) {
-    add_objs[freeze_n++] = freeze_also;
+  for (i = 0; i < freeze_also_n; i++) {
+    add_objs[freeze_n++] = freeze_also[i];
   }
 
-  if (!upb_refcounted_freeze(add_objs, freeze_n, status,
-                             UPB_MAX_MESSAGE_DEPTH * 2)) {
+  if (!upb_refcounted_freeze(add_objs, freeze_n, status, maxdepth)) {
     goto err;
   }
 
@@ -2326,33 +2340,156 @@ err: {
 
 bool upb_symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
                     void *ref_donor, upb_status *status) {
-  return symtab_add(s, defs, n, ref_donor, NULL, status);
+  return symtab_add(s, defs, n, ref_donor, NULL, 0, UPB_MAX_MESSAGE_DEPTH * 2,
+                    status);
 }
 
 bool upb_symtab_addfile(upb_symtab *s, upb_filedef *file, upb_status *status) {
-  size_t n;
+  return upb_symtab_addfiles(s, &file, 1, status);
+}
+
+/* Interns |*name| into f->names, at the offset |t| gives for it.  While
+ * f->names is NULL, only assigns offsets, and adds to |*size| the space that
+ * the names need. */
+static bool filedef_internname(upb_filedef *f, upb_strtable *t, size_t *size,
+                               const char **name, bool *interned) {
+  upb_value v;
+  size_t len;
+
+  if (!*name || *interned) {
+    return true;
+  }
+
+  len = strlen(*name) + 1;
+  if (!f->names) {
+    if (upb_strtable_lookup(t, *name, NULL)) return true;
+    if (!upb_strtable_insert(t, *name, upb_value_uint64(*size))) return false;
+    *size += len;
+  } else {
+    bool ok = upb_strtable_lookup(t, *name, &v);
+    char *copy = f->names + upb_value_getuint64(v);
+    UPB_ASSERT(ok);
+    memcpy(copy, *name, len);
+    upb_gfree((void*)*name);
+    *name = copy;
+    *interned = true;
+  }
+
+  return true;
+}
+
+/* Moves the names of f's defs, and of their fields and oneofs, into the one
+ * buffer f->names, where equal names are stored only once: the messages of a
+ * file tend to repeat the same few field names.  The names then live as long
+ * as the file, which is fine since a file, its defs and their fields and
+ * oneofs all hold ref2s on one another, and so are always freed together.
+ *
+ * Takes two passes, one to size the buffer and one to fill it. */
+static bool filedef_internnames(upb_filedef *f, upb_status *s) {
+  upb_strtable t;
+  size_t size = 0;
+  int pass;
+  bool ok = true;
+
+  if (f->names) {
+    /* Names set since stay where they are. */
+    return true;
+  }
+
+  if (!upb_strtable_init(&t, UPB_CTYPE_UINT64)) goto oom;
+
+  for (pass = 0; ok && pass < 2; pass++) {
+    size_t i;
+
+    if (pass == 1) {
+      f->names = upb_gmalloc(UPB_MAX(size, 1));
+      if (!f->names) break;
+    }
+
+    for (i = 0; ok && i < upb_filedef_defcount(f); i++) {
+      upb_def *def = upb_filedef_mutabledef(f, i);
+      upb_msgdef *m = upb_dyncast_msgdef_mutable(def);
+      upb_msg_field_iter fit;
+      upb_msg_oneof_iter oit;
+
+      ok = filedef_internname(f, &t, &size, &def->fullname,
+                              &def->name_interned);
+      if (!m) continue;
+
+      for (upb_msg_field_begin(&fit, m); ok && !upb_msg_field_done(&fit);
+           upb_msg_field_next(&fit)) {
+        upb_def *fdef = upb_fielddef_upcast_mutable(upb_msg_iter_field(&fit));
+        ok = filedef_internname(f, &t, &size, &fdef->fullname,
+                                &fdef->name_interned);
+      }
+
+      for (upb_msg_oneof_begin(&oit, m); ok && !upb_msg_oneof_done(&oit);
+           upb_msg_oneof_next(&oit)) {
+        upb_oneofdef *o = upb_msg_iter_oneof(&oit);
+        ok = filedef_internname(f, &t, &size, &o->name, &o->name_interned);
+      }
+    }
+  }
+
+  upb_strtable_uninit(&t);
+  if (ok && f->names) return true;
+
+oom:
+  upb_upberr_setoom(s);
+  return false;
+}
+
+bool upb_symtab_addfiles(upb_symtab *s, upb_filedef *const*files, size_t n,
+                         upb_status *status) {
+  size_t defcount = 0;
   size_t i;
+  size_t j;
   upb_def **defs;
+  upb_refcounted **objs;
+  int maxdepth;
   bool ret;
 
-  n = upb_filedef_defcount(file);
-  if (n == 0) {
+  for (i = 0; i < n; i++) {
+    defcount += upb_filedef_defcount(files[i]);
+  }
+  if (defcount == 0) {
     return true;
   }
-  defs = upb_gmalloc(sizeof(*defs) * n);
 
-  if (defs == NULL) {
+  defs = upb_gmalloc(sizeof(*defs) * defcount);
+  objs = upb_gmalloc(sizeof(*objs) * n);
+
+  if (defs == NULL || objs == NULL) {
+    upb_gfree(defs);
+    upb_gfree(objs);
     upb_status_seterrmsg(status, "Out of memory");
     return false;
   }
 
+  defcount = 0;
   for (i = 0; i < n; i++) {
-    defs[i] = upb_filedef_mutabledef(file, i);
+    if (!upb_filedef_isfrozen(files[i]) &&
+        !filedef_internnames(files[i], status)) {
+      upb_gfree(defs);
+      upb_gfree(objs);
+      return false;
+    }
+    for (j = 0; j < upb_filedef_defcount(files[i]); j++) {
+      defs[defcount++] = upb_filedef_mutabledef(files[i], j);
+    }
+    objs[i] = upb_filedef_upcast_mutable(files[i]);
   }
 
-  ret = symtab_add(s, defs, n, NULL, upb_filedef_upcast_mutable(file), status);
+  /* Adding the files one at a time would allow each of them a graph this
+   * deep, so allow the batch as much in total. */
+  maxdepth = n > INT_MAX / (UPB_MAX_MESSAGE_DEPTH * 2)
+                 ? INT_MAX
+                 : (int)n * UPB_MAX_MESSAGE_DEPTH * 2;
+
+  ret = symtab_add(s, defs, defcount, NULL, objs, n, maxdepth, status);
 
   upb_gfree(defs);
+  upb_gfree(objs);
   return ret;
 }
 
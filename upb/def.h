@@ -216,33 +216,8 @@ UPB_DECLARE_DEF_TYPE(upb::EnumDef, enumdef, ENUM)
 
 /* upb::FieldDef **************************************************************/
 
-/* The types a field can have.  Note that this list is not identical to the
- * types defined in descriptor.proto, which gives INT32 and SINT32 separate
- * types (we distinguish the two with the "integer encoding" enum below). */
-typedef enum {
-  /* Types stored in 1 byte. */
-  UPB_TYPE_BOOL     = 1,
-  /* Types stored in 4 bytes. */
-  UPB_TYPE_FLOAT    = 2,
-  UPB_TYPE_INT32    = 3,
-  UPB_TYPE_UINT32   = 4,
-  UPB_TYPE_ENUM     = 5,  /* Enum values are int32. */
-  /* Types stored as pointers (probably 4 or 8 bytes). */
-  UPB_TYPE_STRING   = 6,
-  UPB_TYPE_BYTES    = 7,
-  UPB_TYPE_MESSAGE  = 8,
-  /* Types stored as 8 bytes. */
-  UPB_TYPE_DOUBLE   = 9,
-  UPB_TYPE_INT64    = 10,
-  UPB_TYPE_UINT64   = 11
-} upb_fieldtype_t;
-
-/* The repeated-ness of each field; this matches descriptor.proto. */
-typedef enum {
-  UPB_LABEL_OPTIONAL = 1,
-  UPB_LABEL_REQUIRED = 2,
-  UPB_LABEL_REPEATED = 3
-} upb_label_t;
+/* upb_fieldtype_t, upb_label_t and upb_descriptortype_t are in upb/upb.h, so
+ * that code using only generated layouts needn't include this header. */
 
 /* How integers should be encoded in serializations that offer multiple
  * integer encoding methods. */
@@ -252,36 +227,11 @@ typedef enum {
   UPB_INTFMT_ZIGZAG = 3   /* Only for signed types (INT32/INT64). */
 } upb_intfmt_t;
 
-/* Descriptor types, as defined in descriptor.proto. */
-typedef enum {
-  UPB_DESCRIPTOR_TYPE_DOUBLE   = 1,
-  UPB_DESCRIPTOR_TYPE_FLOAT    = 2,
-  UPB_DESCRIPTOR_TYPE_INT64    = 3,
-  UPB_DESCRIPTOR_TYPE_UINT64   = 4,
-  UPB_DESCRIPTOR_TYPE_INT32    = 5,
-  UPB_DESCRIPTOR_TYPE_FIXED64  = 6,
-  UPB_DESCRIPTOR_TYPE_FIXED32  = 7,
-  UPB_DESCRIPTOR_TYPE_BOOL     = 8,
-  UPB_DESCRIPTOR_TYPE_STRING   = 9,
-  UPB_DESCRIPTOR_TYPE_GROUP    = 10,
-  UPB_DESCRIPTOR_TYPE_MESSAGE  = 11,
-  UPB_DESCRIPTOR_TYPE_BYTES    = 12,
-  UPB_DESCRIPTOR_TYPE_UINT32   = 13,
-  UPB_DESCRIPTOR_TYPE_ENUM     = 14,
-  UPB_DESCRIPTOR_TYPE_SFIXED32 = 15,
-  UPB_DESCRIPTOR_TYPE_SFIXED64 = 16,
-  UPB_DESCRIPTOR_TYPE_SINT32   = 17,
-  UPB_DESCRIPTOR_TYPE_SINT64   = 18
-} upb_descriptortype_t;
-
 typedef enum {
   UPB_SYNTAX_PROTO2 = 2,
   UPB_SYNTAX_PROTO3 = 3
 } upb_syntax_t;
 
-/* Maps descriptor type -> upb field type.  */
-extern const uint8_t upb_desctype_to_fieldtype[];
-
 /* Maximum field number allowed for FieldDefs.  This is an inherent limit of the
  * protobuf wire format. */
 #define UPB_MAX_FIELDNUMBER ((1 << 29) - 1)
@@ -1513,6 +1463,13 @@ class upb::SymbolTable {
    * (replacing any existing ones with the same names). */
   bool AddFile(FileDef* file, Status* s);
 
+  /* Like AddFile(), but for |n| files at once.  The files may refer to each
+   * other's symbols in any order, so they need not be sorted by dependency.
+   * All of their symbols are resolved against a single table and the files
+   * are validated and frozen together, which is much cheaper than adding
+   * thousands of files one by one.  On failure nothing is added. */
+  bool AddFiles(FileDef* const* files, size_t n, Status* s);
+
  private:
   UPB_DISALLOW_POD_OPS(SymbolTable, upb::SymbolTable)
 };
@@ -1533,6 +1490,8 @@ const upb_enumdef *upb_symtab_lookupenum(const upb_symtab *s, const char *sym);
 bool upb_symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
                     void *ref_donor, upb_status *status);
 bool upb_symtab_addfile(upb_symtab *s, upb_filedef *file, upb_status* status);
+bool upb_symtab_addfiles(upb_symtab *s, upb_filedef *const*files, size_t n,
+                         upb_status *status);
 
 /* upb_symtab_iter i;
  * for(upb_symtab_begin(&i, s, type); !upb_symtab_done(&i);
@@ -1578,6 +1537,9 @@ inline bool SymbolTable::Add(
 inline bool SymbolTable::AddFile(FileDef* file, Status* s) {
   return upb_symtab_addfile(this, file, s);
 }
+inline bool SymbolTable::AddFiles(FileDef* const* files, size_t n, Status* s) {
+  return upb_symtab_addfiles(this, (upb_filedef*const*)files, n, s);
+}
 }  /* namespace upb */
 #endif
 
@@ -1,4 +1,6 @@
-/* We encode backwards, to avoid pre-computing lengths (one-pass encode). */
+/* We encode backwards, so that the length of each submessage is known by the
+ * time its length prefix is written.  The total size is computed up front
+ * only to allocate the output buffer once. */
 
 #include "upb/upb.h"
 #include "upb/encode.h"
@@ -47,10 +49,58 @@ static uint32_t upb_zzencode_32(int32_t n) { return (n << 1) ^ (n >> 31); }
 static uint64_t upb_zzencode_64(int64_t n) { return (n << 1) ^ (n >> 63); }
 
 typedef struct {
-  upb_alloc *alloc;
+  upb_alloc *alloc;  /* NULL when encoding into a fixed caller buffer. */
   char *buf, *ptr, *limit;
+
+  /* Scatter-gather output, only used by upb_encode_segments().  Strings of at
+   * least alias_min bytes (if nonzero) are referenced rather than copied.
+   * Because we encode backwards, segments are recorded in reverse order.
+   * Segments of the encoding buffer are recorded with a NULL data pointer
+   * and are fixed up at the end, so they are unaffected by
+   * upb_encode_growbuffer(). */
+  size_t alias_min;
+  upb_stringview *segs;
+  size_t seg_count, seg_size;
+  size_t seg_start;  /* Offset from e->limit where the open segment ends. */
+  size_t aliased;    /* Total bytes emitted as aliased segments. */
+
+  /* With UPB_ENCODE_DETERMINISTIC, map entries are sorted here, two slots
+   * per entry (the radix sort needs a second buffer).  Maps inside map values
+   * are sorted while the outer map is being written, so this is used like a
+   * stack: |sorted_used| slots belong to maps we are in the middle of.  It
+   * is scratch space, so it comes from upb_gmalloc() rather than the arena,
+   * and is freed when encoding ends; growing it may move it. */
+  bool deterministic;
+  struct upb_sortedent *sorted;
+  size_t sorted_used, sorted_size;
 } upb_encstate;
 
+static void upb_encstate_init(upb_encstate *e, upb_alloc *alloc) {
+  e->alloc = alloc;
+  e->buf = NULL;
+  e->ptr = NULL;
+  e->limit = NULL;
+  e->alias_min = 0;
+  e->segs = NULL;
+  e->seg_count = 0;
+  e->seg_size = 0;
+  e->seg_start = 0;
+  e->aliased = 0;
+  e->deterministic = false;
+  e->sorted = NULL;
+  e->sorted_used = 0;
+  e->sorted_size = 0;
+}
+
+/* Total number of bytes encoded so far, including aliased strings. */
+static size_t upb_encode_written(const upb_encstate *e) {
+  return (e->limit - e->ptr) + e->aliased;
+}
+
+static bool upb_encode_aliased(size_t alias_min, size_t len) {
+  return alias_min > 0 && len >= alias_min;
+}
+
 static size_t upb_roundup_pow2(size_t bytes) {
   size_t ret = 128;
   while (ret < bytes) {
@@ -62,7 +112,10 @@ static size_t upb_roundup_pow2(size_t bytes) {
 static bool upb_encode_growbuffer(upb_encstate *e, size_t bytes) {
   size_t old_size = e->limit - e->buf;
   size_t new_size = upb_roundup_pow2(bytes + (e->limit - e->ptr));
-  char *new_buf = upb_realloc(e->alloc, e->buf, old_size, new_size);
+  char *new_buf;
+
+  CHK(e->alloc);  /* Fixed caller-supplied buffers cannot grow. */
+  new_buf = upb_realloc(e->alloc, e->buf, old_size, new_size);
   CHK(new_buf);
 
   /* We want previous data at the end, realloc() put it at the beginning. */
@@ -91,6 +144,43 @@ static bool upb_put_bytes(upb_encstate *e, const void *data, size_t len) {
   return true;
 }
 
+/* Appends a segment to the (reversed) scatter-gather list. */
+static bool upb_encode_addseg(upb_encstate *e, const char *data, size_t len) {
+  if (e->seg_count == e->seg_size) {
+    size_t new_size = UPB_MAX(e->seg_size * 2, 8);
+    upb_stringview *new_segs =
+        upb_realloc(e->alloc, e->segs, e->seg_size * sizeof(*e->segs),
+                    new_size * sizeof(*e->segs));
+    CHK(new_segs);
+    e->segs = new_segs;
+    e->seg_size = new_size;
+  }
+  e->segs[e->seg_count++] = upb_stringview_make(data, len);
+  return true;
+}
+
+/* Ends the buffer segment that is currently being written, if it is not empty.
+ * Its data pointer is filled in by upb_encode_segments() once encoding is
+ * done. */
+static bool upb_encode_closeseg(upb_encstate *e) {
+  size_t ofs = e->limit - e->ptr;
+  if (ofs > e->seg_start) {
+    CHK(upb_encode_addseg(e, NULL, ofs - e->seg_start));
+    e->seg_start = ofs;
+  }
+  return true;
+}
+
+/* Writes string or bytes field data, which is referenced instead of copied
+ * when producing scatter-gather output for a large enough string. */
+static bool upb_put_string(upb_encstate *e, const char *data, size_t len) {
+  if (upb_encode_aliased(e->alias_min, len)) {
+    e->aliased += len;
+    return upb_encode_closeseg(e) && upb_encode_addseg(e, data, len);
+  }
+  return upb_put_bytes(e, data, len);
+}
+
 static bool upb_put_fixed64(upb_encstate *e, uint64_t val) {
   /* TODO(haberman): byte-swap for big endian. */
   return upb_put_bytes(e, &val, sizeof(uint64_t));
@@ -102,14 +192,9 @@ static bool upb_put_fixed32(upb_encstate *e, uint32_t val) {
 }
 
 static bool upb_put_varint(upb_encstate *e, uint64_t val) {
-  size_t len;
-  char *start;
-  CHK(upb_encode_reserve(e, UPB_PB_VARINT_MAX_LEN));
-  len = upb_encode_varint(val, e->ptr);
-  start = e->ptr + UPB_PB_VARINT_MAX_LEN - len;
-  memmove(start, e->ptr, len);
-  e->ptr = start;
-  return true;
+  char buf[UPB_PB_VARINT_MAX_LEN];
+  size_t len = upb_encode_varint(val, buf);
+  return upb_put_bytes(e, buf, len);
 }
 
 static bool upb_put_double(upb_encstate *e, double d) {
@@ -143,6 +228,25 @@ static bool upb_put_tag(upb_encstate *e, int field_number, int wire_type) {
   return upb_put_varint(e, (field_number << 3) | wire_type);
 }
 
+/* Returns false if field |f| is not present in |msg| and should not be
+ * encoded at all.  Otherwise sets |*skip_zero_value| to whether a zero value
+ * should be omitted (proto3 fields, which have no presence). */
+static bool upb_encode_hasfield(const char *msg, const upb_msglayout_field *f,
+                                bool *skip_zero_value) {
+  *skip_zero_value = false;
+  if (f->presence == 0) {
+    /* Proto3 presence. */
+    *skip_zero_value = true;
+    return true;
+  } else if (f->presence > 0) {
+    /* Proto2 presence: hasbit. */
+    return upb_readhasbit(msg, f);
+  } else {
+    /* Field is in a oneof. */
+    return upb_readcase(msg, f) == f->number;
+  }
+}
+
 static bool upb_put_fixedarray(upb_encstate *e, const upb_array *arr,
                                size_t size) {
   size_t bytes = arr->len * size;
@@ -211,7 +315,7 @@ do { ; } while(0)
       upb_stringview *ptr = start + arr->len;
       do {
         ptr--;
-        CHK(upb_put_bytes(e, ptr->data, ptr->size) &&
+        CHK(upb_put_string(e, ptr->data, ptr->size) &&
             upb_put_varint(e, ptr->size) &&
             upb_put_tag(e, f->number, UPB_WIRE_TYPE_DELIMITED));
       } while (ptr != start);
@@ -296,7 +400,7 @@ static bool upb_encode_scalarfield(upb_encstate *e, const char *field_mem,
       if (skip_zero_value && view.size == 0) {
         return true;
       }
-      return upb_put_bytes(e, view.data, view.size) &&
+      return upb_put_string(e, view.data, view.size) &&
           upb_put_varint(e, view.size) &&
           upb_put_tag(e, f->number, UPB_WIRE_TYPE_DELIMITED);
     }
@@ -318,6 +422,13 @@ static bool upb_encode_scalarfield(upb_encstate *e, const char *field_mem,
       if (submsg == NULL) {
         return true;
       }
+      if (upb_islazymsg(submsg)) {
+        /* Never parsed, so its original encoding is still correct. */
+        upb_stringview data = upb_getlazymsg(submsg)->data;
+        return upb_put_string(e, data.data, data.size) &&
+            upb_put_varint(e, data.size) &&
+            upb_put_tag(e, f->number, UPB_WIRE_TYPE_DELIMITED);
+      }
       return upb_encode_message(e, submsg, subm, &size) &&
           upb_put_varint(e, size) &&
           upb_put_tag(e, f->number, UPB_WIRE_TYPE_DELIMITED);
@@ -327,70 +438,936 @@ static bool upb_encode_scalarfield(upb_encstate *e, const char *field_mem,
   UPB_UNREACHABLE();
 }
 
+/* Deterministic map order ****************************************************/
+
+/* With UPB_ENCODE_DETERMINISTIC, map entries are written in order of their
+ * keys: numerically for integer and bool keys, and for string keys by length,
+ * then by memcmp().  (Shorter strings first is not the usual string order, but
+ * any fixed order will do, and it lets us sort string keys like integers.)
+ *
+ * Every key is turned into a 64-bit sort key whose unsigned order agrees with
+ * the key order, and the entries are radix sorted on that.  A string's sort
+ * key is its length and first six bytes, so strings that tie on it (rare, for
+ * real keys) are then put in order by comparing them in full. */
+
+typedef struct upb_sortedent {
+  uint64_t sortkey;
+  upb_msgval key;
+  upb_msgval val;
+} upb_sortedent;
+
+/* Below this many entries, insertion sort beats setting up the radix sort. */
+#define UPB_ENCODE_RADIXMIN 32
+
+/* Strings this long or longer get the same length in their sort key. */
+#define UPB_ENCODE_LONGKEY 0xffff
+
+static uint64_t upb_encode_sortkey(upb_fieldtype_t type, upb_msgval key) {
+  switch (type) {
+    case UPB_TYPE_BOOL: return key.b;
+    case UPB_TYPE_INT32: return (uint32_t)key.i32 ^ 0x80000000U;
+    case UPB_TYPE_UINT32: return key.u32;
+    case UPB_TYPE_INT64: return (uint64_t)key.i64 ^ 0x8000000000000000ULL;
+    case UPB_TYPE_UINT64: return key.u64;
+    case UPB_TYPE_STRING: {
+      uint64_t ret;
+      size_t i;
+      if (key.str.size >= UPB_ENCODE_LONGKEY) {
+        /* Leave the bytes out too, or they would override the lengths. */
+        return (uint64_t)UPB_ENCODE_LONGKEY << 48;
+      }
+      ret = (uint64_t)key.str.size << 48;
+      for (i = 0; i < 6 && i < key.str.size; i++) {
+        ret |= (uint64_t)(unsigned char)key.str.data[i] << (40 - 8 * i);
+      }
+      return ret;
+    }
+    default:
+      UPB_UNREACHABLE();
+  }
+}
+
+/* Orders entries with string keys. */
+static bool upb_encode_strless(const upb_sortedent *a,
+                               const upb_sortedent *b) {
+  if (a->sortkey != b->sortkey) return a->sortkey < b->sortkey;
+  if (a->key.str.size != b->key.str.size) {
+    return a->key.str.size < b->key.str.size;
+  }
+  return memcmp(a->key.str.data, b->key.str.data, a->key.str.size) < 0;
+}
+
+static void upb_encode_insertionsort(upb_sortedent *ents, size_t n,
+                                     bool strkeys) {
+  size_t i, j;
+
+  for (i = 1; i < n; i++) {
+    upb_sortedent ent = ents[i];
+    for (j = i; j > 0; j--) {
+      if (strkeys ? !upb_encode_strless(&ent, &ents[j - 1])
+                  : ents[j - 1].sortkey <= ent.sortkey) {
+        break;
+      }
+      ents[j] = ents[j - 1];
+    }
+    ents[j] = ent;
+  }
+}
+
+/* Sorts |ents| by sortkey, a byte at a time from the lowest, using |tmp| (of
+ * the same size) as the other buffer.  The counts for every byte are taken in
+ * one pass, and bytes that are the same in every key are skipped, so small
+ * keys take only as many passes as they have bytes.  Returns whichever of the
+ * two buffers holds the result. */
+static upb_sortedent *upb_encode_radixsort(upb_sortedent *ents,
+                                           upb_sortedent *tmp, size_t n) {
+  uint32_t count[8][256];
+  uint64_t all_ones = ~(uint64_t)0, any_ones = 0;
+  size_t i;
+  int byte;
+
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < n; i++) {
+    uint64_t key = ents[i].sortkey;
+    all_ones &= key;
+    any_ones |= key;
+    for (byte = 0; byte < 8; byte++) {
+      count[byte][key >> (8 * byte) & 0xff]++;
+    }
+  }
+
+  for (byte = 0; byte < 8; byte++) {
+    int shift = 8 * byte;
+    uint32_t *c = count[byte];
+    uint32_t pos = 0;
+    upb_sortedent *swap;
+
+    if (((all_ones ^ any_ones) >> shift & 0xff) == 0) continue;
+
+    for (i = 0; i < 256; i++) {
+      uint32_t this_count = c[i];
+      c[i] = pos;
+      pos += this_count;
+    }
+    /* Copied a member at a time: at -Os a struct assignment this size becomes
+     * a string move, which is several times slower here. */
+    for (i = 0; i < n; i++) {
+      const upb_sortedent *src = &ents[i];
+      upb_sortedent *dst = &tmp[c[src->sortkey >> shift & 0xff]++];
+      dst->sortkey = src->sortkey;
+      dst->key = src->key;
+      dst->val = src->val;
+    }
+
+    swap = ents;
+    ents = tmp;
+    tmp = swap;
+  }
+
+  return ents;
+}
+
+/* Puts the entries of |map| in key order in e->sorted, after the
+ * |e->sorted_used| slots already in use, and returns the index of the first
+ * one, or -1 if out of memory.  The caller must add the 2 * upb_map_size(map)
+ * slots this uses to |e->sorted_used| while it needs them. */
+UPB_NOINLINE static long upb_encode_sortmap(upb_encstate *e,
+                                           const upb_map *map) {
+  upb_fieldtype_t key_type = upb_map_keytype(map);
+  bool strkeys = key_type == UPB_TYPE_STRING;
+  size_t n = upb_map_size(map);
+  upb_sortedent *ents, *ent;
+  upb_mapiter i;
+
+  if (e->sorted_size - e->sorted_used < 2 * n) {
+    size_t new_size = UPB_MAX(e->sorted_used + 2 * n, 64);
+    upb_sortedent *sorted = upb_grealloc(e->sorted,
+                                         e->sorted_size * sizeof(*sorted),
+                                         new_size * sizeof(*sorted));
+    if (!sorted) return -1;
+    e->sorted = sorted;
+    e->sorted_size = new_size;
+  }
+
+  ents = e->sorted + e->sorted_used;
+  ent = ents;
+  for (upb_mapiter_begin(&i, map); !upb_mapiter_done(&i);
+       upb_mapiter_next(&i), ent++) {
+    ent->key = upb_mapiter_key(&i);
+    ent->val = upb_mapiter_value(&i);
+    ent->sortkey = upb_encode_sortkey(key_type, ent->key);
+  }
+
+  if (n < UPB_ENCODE_RADIXMIN) {
+    upb_encode_insertionsort(ents, n, strkeys);
+  } else {
+    ents = upb_encode_radixsort(ents, ents + n, n);
+    if (strkeys) {
+      /* Only runs of equal sort keys can be out of order now. */
+      size_t start, end;
+      for (start = 0; start < n; start = end) {
+        for (end = start + 1;
+             end < n && ents[end].sortkey == ents[start].sortkey; end++) {
+        }
+        if (end - start > 1) {
+          upb_encode_insertionsort(ents + start, end - start, true);
+        }
+      }
+    }
+  }
+
+  return ents - e->sorted;
+}
+
+/* Encodes one entry of map field |f| as a message with the key and value,
+ * which are written even if they have their default value. */
+static bool upb_encode_mapentry(upb_encstate *e, upb_msgval key,
+                                upb_msgval val, const upb_msglayout *entry,
+                                const upb_msglayout_field *key_field,
+                                const upb_msglayout_field *val_field,
+                                const upb_msglayout_field *f) {
+  size_t pre_len = upb_encode_written(e);
+
+  /* Each member of upb_msgval starts at its beginning, so it can stand in
+   * for the field's memory. */
+  CHK(upb_encode_scalarfield(e, (const char*)&val, entry, val_field, false));
+  CHK(upb_encode_scalarfield(e, (const char*)&key, entry, key_field, false));
+  CHK(upb_put_varint(e, upb_encode_written(e) - pre_len));
+  CHK(upb_put_tag(e, f->number, UPB_WIRE_TYPE_DELIMITED));
+  return true;
+}
+
+static bool upb_encode_map(upb_encstate *e, const char *field_mem,
+                           const upb_msglayout *m,
+                           const upb_msglayout_field *f) {
+  const upb_map *map = *(const upb_map**)field_mem;
+  const upb_msglayout *entry = m->submsgs[f->submsg_index];
+  const upb_msglayout_field *key_field;
+  const upb_msglayout_field *val_field;
+  upb_mapiter i;
+
+  if (map == NULL) {
+    return true;
+  }
+
+  upb_mapentry_fields(entry, &key_field, &val_field);
+
+  if (e->deterministic && upb_map_size(map) > 1) {
+    size_t n = upb_map_size(map);
+    long first = upb_encode_sortmap(e, map);
+    CHK(first >= 0);
+    e->sorted_used += 2 * n;
+
+    /* We encode backwards, so the last entry goes first.  Encoding a value
+     * may move e->sorted, so we index it afresh each time. */
+    while (n > 0) {
+      upb_sortedent ent = e->sorted[first + --n];
+      CHK(upb_encode_mapentry(e, ent.key, ent.val, entry, key_field,
+                              val_field, f));
+    }
+
+    e->sorted_used -= 2 * upb_map_size(map);
+    return true;
+  }
+
+  for (upb_mapiter_begin(&i, map); !upb_mapiter_done(&i);
+       upb_mapiter_next(&i)) {
+    CHK(upb_encode_mapentry(e, upb_mapiter_key(&i), upb_mapiter_value(&i),
+                            entry, key_field, val_field, f));
+  }
+
+  return true;
+}
+
+/* Encodes the extension in |holder| (see structs.int.h), which is just the
+ * holder's one field. */
+static bool upb_encode_extholder(upb_encstate *e, const upb_msg *holder) {
+  upb_extholderlayout hl;
+  size_t size;
+  upb_extholder_layout(upb_extholder_ext(holder), &hl);
+  return upb_encode_message(e, holder, &hl.layout, &size);
+}
+
+/* Encodes the extensions of |msg|, which has extendable layout |m|, in field
+ * number order. */
+static bool upb_encode_exts(upb_encstate *e, const char *msg,
+                            const upb_msglayout *m) {
+  const upb_msgexts *exts = upb_msg_exts(msg, m);
+  uint32_t i = exts ? exts->len : 0;
+
+  while (i > 0) {
+    CHK(upb_encode_extholder(e, exts->ents[--i].holder));
+  }
+
+  return true;
+}
+
 bool upb_encode_message(upb_encstate *e, const char *msg,
                         const upb_msglayout *m, size_t *size) {
   int i;
-  size_t pre_len = e->limit - e->ptr;
-  const char *unknown;
-  size_t unknown_size;
+  size_t pre_len = upb_encode_written(e);
+  const upb_stringview *unknown;
+  size_t unknown_count;
+
+  /* Extensions go after the fields, so we write them first. */
+  if (m->extendable) {
+    CHK(upb_encode_exts(e, msg, m));
+  }
 
   for (i = m->field_count - 1; i >= 0; i--) {
     const upb_msglayout_field *f = &m->fields[i];
 
-    if (f->label == UPB_LABEL_REPEATED) {
+    if (upb_msglayout_ismap(m, f)) {
+      CHK(upb_encode_map(e, msg + f->offset, m, f));
+    } else if (f->label == UPB_LABEL_REPEATED) {
       CHK(upb_encode_array(e, msg + f->offset, m, f));
     } else {
-      bool skip_empty = false;
-      if (f->presence == 0) {
-        /* Proto3 presence. */
-        skip_empty = true;
-      } else if (f->presence > 0) {
-        /* Proto2 presence: hasbit. */
-        if (!upb_readhasbit(msg, f)) {
-          continue;
-        }
-      } else {
-        /* Field is in a oneof. */
-        if (upb_readcase(msg, f) != f->number) {
-          continue;
-        }
+      bool skip_empty;
+      if (upb_encode_hasfield(msg, f, &skip_empty)) {
+        CHK(upb_encode_scalarfield(e, msg + f->offset, m, f, skip_empty));
       }
-      CHK(upb_encode_scalarfield(e, msg + f->offset, m, f, skip_empty));
     }
   }
 
-  unknown = upb_msg_getunknown(msg, &unknown_size);
-
-  if (unknown) {
-    upb_put_bytes(e, unknown, unknown_size);
+  /* Unknown fields are written like strings, so large spans are referenced
+   * rather than copied in scatter-gather output. */
+  unknown = upb_msg_getunknownspans(msg, &unknown_count);
+  while (unknown_count > 0) {
+    unknown_count--;
+    CHK(upb_put_string(e, unknown[unknown_count].data,
+                       unknown[unknown_count].size));
   }
 
-  *size = (e->limit - e->ptr) - pre_len;
+  *size = upb_encode_written(e) - pre_len;
   return true;
 }
 
-char *upb_encode(const void *msg, const upb_msglayout *m, upb_arena *arena,
-                 size_t *size) {
+
+/* Size precomputation ********************************************************/
+
+/* These mirror the encoding functions above exactly, so that upb_encode() can
+ * allocate its output buffer once.  Submessage sizes are computed on the way
+ * down and are not needed again, since we encode backwards. */
+
+static size_t upb_encode_varintsize(uint64_t val) {
+  size_t ret = 1;
+  while (val >= 128) {
+    val >>= 7;
+    ret++;
+  }
+  return ret;
+}
+
+static size_t upb_tag_size(int field_number) {
+  return upb_encode_varintsize(field_number << 3);
+}
+
+static size_t upb_encode_messagesize(const char *msg, const upb_msglayout *m,
+                                     size_t alias_min);
+
+/* Returns the number of bytes of a string that end up in the encoding
+ * buffer. */
+static size_t upb_encode_bufferedsize(size_t alias_min, size_t len) {
+  return upb_encode_aliased(alias_min, len) ? 0 : len;
+}
+
+static size_t upb_encode_arraysize(const char *field_mem,
+                                   const upb_msglayout *m,
+                                   const upb_msglayout_field *f,
+                                   size_t alias_min) {
+  const upb_array *arr = *(const upb_array**)field_mem;
+  size_t tag_size = upb_tag_size(f->number);
+  size_t ret = 0;
+
+  if (arr == NULL || arr->len == 0) {
+    return 0;
+  }
+
+#define FIXED_CASE(ctype) \
+  ret = arr->len * sizeof(ctype); \
+  break;
+
+#define VARINT_CASE(ctype, encode) { \
+  const ctype *ptr = arr->data; \
+  const ctype *end = ptr + arr->len; \
+  for (; ptr < end; ptr++) { \
+    ret += upb_encode_varintsize(encode); \
+  } \
+} \
+break;
+
+  switch (f->descriptortype) {
+    case UPB_DESCRIPTOR_TYPE_DOUBLE:
+      FIXED_CASE(double);
+    case UPB_DESCRIPTOR_TYPE_FLOAT:
+      FIXED_CASE(float);
+    case UPB_DESCRIPTOR_TYPE_SFIXED64:
+    case UPB_DESCRIPTOR_TYPE_FIXED64:
+      FIXED_CASE(uint64_t);
+    case UPB_DESCRIPTOR_TYPE_FIXED32:
+    case UPB_DESCRIPTOR_TYPE_SFIXED32:
+      FIXED_CASE(uint32_t);
+    case UPB_DESCRIPTOR_TYPE_INT64:
+    case UPB_DESCRIPTOR_TYPE_UINT64:
+      VARINT_CASE(uint64_t, *ptr);
+    case UPB_DESCRIPTOR_TYPE_UINT32:
+      VARINT_CASE(uint32_t, *ptr);
+    case UPB_DESCRIPTOR_TYPE_INT32:
+    case UPB_DESCRIPTOR_TYPE_ENUM:
+      VARINT_CASE(int32_t, (int64_t)*ptr);
+    case UPB_DESCRIPTOR_TYPE_BOOL:
+      VARINT_CASE(bool, *ptr);
+    case UPB_DESCRIPTOR_TYPE_SINT32:
+      VARINT_CASE(int32_t, upb_zzencode_32(*ptr));
+    case UPB_DESCRIPTOR_TYPE_SINT64:
+      VARINT_CASE(int64_t, upb_zzencode_64(*ptr));
+    case UPB_DESCRIPTOR_TYPE_STRING:
+    case UPB_DESCRIPTOR_TYPE_BYTES: {
+      const upb_stringview *ptr = arr->data;
+      const upb_stringview *end = ptr + arr->len;
+      for (; ptr < end; ptr++) {
+        ret += tag_size + upb_encode_varintsize(ptr->size) +
+               upb_encode_bufferedsize(alias_min, ptr->size);
+      }
+      return ret;
+    }
+    case UPB_DESCRIPTOR_TYPE_GROUP: {
+      void *const *ptr = arr->data;
+      void *const *end = ptr + arr->len;
+      const upb_msglayout *subm = m->submsgs[f->submsg_index];
+      for (; ptr < end; ptr++) {
+        ret += 2 * tag_size + upb_encode_messagesize(*ptr, subm, alias_min);
+      }
+      return ret;
+    }
+    case UPB_DESCRIPTOR_TYPE_MESSAGE: {
+      void *const *ptr = arr->data;
+      void *const *end = ptr + arr->len;
+      const upb_msglayout *subm = m->submsgs[f->submsg_index];
+      for (; ptr < end; ptr++) {
+        size_t size = upb_encode_messagesize(*ptr, subm, alias_min);
+        ret += tag_size + upb_encode_varintsize(size) + size;
+      }
+      return ret;
+    }
+  }
+#undef FIXED_CASE
+#undef VARINT_CASE
+
+  /* Primitive arrays are always packed. */
+  return tag_size + upb_encode_varintsize(ret) + ret;
+}
+
+static size_t upb_encode_scalarsize(const char *field_mem,
+                                    const upb_msglayout *m,
+                                    const upb_msglayout_field *f,
+                                    bool skip_zero_value, size_t alias_min) {
+  size_t tag_size = upb_tag_size(f->number);
+
+#define CASE(ctype, valsize) do { \
+  ctype val = *(ctype*)field_mem; \
+  if (skip_zero_value && val == 0) { \
+    return 0; \
+  } \
+  return tag_size + (valsize); \
+} while(0)
+
+  switch (f->descriptortype) {
+    case UPB_DESCRIPTOR_TYPE_DOUBLE:
+      CASE(double, sizeof(double));
+    case UPB_DESCRIPTOR_TYPE_FLOAT:
+      CASE(float, sizeof(float));
+    case UPB_DESCRIPTOR_TYPE_INT64:
+    case UPB_DESCRIPTOR_TYPE_UINT64:
+      CASE(uint64_t, upb_encode_varintsize(val));
+    case UPB_DESCRIPTOR_TYPE_UINT32:
+      CASE(uint32_t, upb_encode_varintsize(val));
+    case UPB_DESCRIPTOR_TYPE_INT32:
+    case UPB_DESCRIPTOR_TYPE_ENUM:
+      CASE(int32_t, upb_encode_varintsize((int64_t)val));
+    case UPB_DESCRIPTOR_TYPE_SFIXED64:
+    case UPB_DESCRIPTOR_TYPE_FIXED64:
+      CASE(uint64_t, sizeof(uint64_t));
+    case UPB_DESCRIPTOR_TYPE_FIXED32:
+    case UPB_DESCRIPTOR_TYPE_SFIXED32:
+      CASE(uint32_t, sizeof(uint32_t));
+    case UPB_DESCRIPTOR_TYPE_BOOL:
+      CASE(bool, 1);
+    case UPB_DESCRIPTOR_TYPE_SINT32:
+      CASE(int32_t, upb_encode_varintsize(upb_zzencode_32(val)));
+    case UPB_DESCRIPTOR_TYPE_SINT64:
+      CASE(int64_t, upb_encode_varintsize(upb_zzencode_64(val)));
+    case UPB_DESCRIPTOR_TYPE_STRING:
+    case UPB_DESCRIPTOR_TYPE_BYTES: {
+      upb_stringview view = *(upb_stringview*)field_mem;
+      if (skip_zero_value && view.size == 0) {
+        return 0;
+      }
+      return tag_size + upb_encode_varintsize(view.size) +
+          upb_encode_bufferedsize(alias_min, view.size);
+    }
+    case UPB_DESCRIPTOR_TYPE_GROUP: {
+      void *submsg = *(void **)field_mem;
+      if (submsg == NULL) {
+        return 0;
+      }
+      return 2 * tag_size + upb_encode_messagesize(
+          submsg, m->submsgs[f->submsg_index], alias_min);
+    }
+    case UPB_DESCRIPTOR_TYPE_MESSAGE: {
+      size_t size;
+      void *submsg = *(void **)field_mem;
+      if (submsg == NULL) {
+        return 0;
+      }
+      if (upb_islazymsg(submsg)) {
+        size = upb_getlazymsg(submsg)->data.size;
+        return tag_size + upb_encode_varintsize(size) +
+            upb_encode_bufferedsize(alias_min, size);
+      }
+      size = upb_encode_messagesize(submsg, m->submsgs[f->submsg_index],
+                                    alias_min);
+      return tag_size + upb_encode_varintsize(size) + size;
+    }
+  }
+#undef CASE
+  UPB_UNREACHABLE();
+}
+
+static size_t upb_encode_mapsize(const char *field_mem,
+                                 const upb_msglayout *m,
+                                 const upb_msglayout_field *f,
+                                 size_t alias_min) {
+  const upb_map *map = *(const upb_map**)field_mem;
+  const upb_msglayout *entry = m->submsgs[f->submsg_index];
+  const upb_msglayout_field *key_field;
+  const upb_msglayout_field *val_field;
+  size_t tag_size = upb_tag_size(f->number);
+  size_t ret = 0;
+  upb_mapiter i;
+
+  if (map == NULL) {
+    return 0;
+  }
+
+  upb_mapentry_fields(entry, &key_field, &val_field);
+
+  for (upb_mapiter_begin(&i, map); !upb_mapiter_done(&i);
+       upb_mapiter_next(&i)) {
+    upb_msgval key = upb_mapiter_key(&i);
+    upb_msgval val = upb_mapiter_value(&i);
+    size_t size =
+        upb_encode_scalarsize((const char*)&key, entry, key_field, false,
+                              alias_min) +
+        upb_encode_scalarsize((const char*)&val, entry, val_field, false,
+                              alias_min);
+    ret += tag_size + upb_encode_varintsize(size) + size;
+  }
+
+  return ret;
+}
+
+static size_t upb_encode_messagesize(const char *msg, const upb_msglayout *m,
+                                     size_t alias_min) {
+  int i;
+  size_t ret = 0;
+  const upb_stringview *unknown;
+  size_t unknown_count;
+
+  for (i = 0; i < m->field_count; i++) {
+    const upb_msglayout_field *f = &m->fields[i];
+
+    if (upb_msglayout_ismap(m, f)) {
+      ret += upb_encode_mapsize(msg + f->offset, m, f, alias_min);
+    } else if (f->label == UPB_LABEL_REPEATED) {
+      ret += upb_encode_arraysize(msg + f->offset, m, f, alias_min);
+    } else {
+      bool skip_empty;
+      if (upb_encode_hasfield(msg, f, &skip_empty)) {
+        ret += upb_encode_scalarsize(msg + f->offset, m, f, skip_empty,
+                                     alias_min);
+      }
+    }
+  }
+
+  if (m->extendable) {
+    const upb_msgexts *exts = upb_msg_exts(msg, m);
+    uint32_t j;
+    for (j = 0; exts && j < exts->len; j++) {
+      const upb_msg *holder = exts->ents[j].holder;
+      upb_extholderlayout hl;
+      upb_extholder_layout(upb_extholder_ext(holder), &hl);
+      ret += upb_encode_messagesize(holder, &hl.layout, alias_min);
+    }
+  }
+
+  unknown = upb_msg_getunknownspans(msg, &unknown_count);
+  for (i = 0; i < (int)unknown_count; i++) {
+    ret += upb_encode_bufferedsize(alias_min, unknown[i].size);
+  }
+
+  return ret;
+}
+
+/* Cached sizes ***************************************************************/
+
+/* With UPB_ENCODE_CACHESIZE, each message's size is stored in the message.  A
+ * message's cache can be reused if nothing changed it (which resets the cache)
+ * and if every submessage's cache can be reused too, so checking it still
+ * means visiting every submessage, but all other fields are only looked at in
+ * messages that changed.  Maps and arrays have a dirty flag of their own,
+ * since changing one doesn't reset the cache of the message holding it.
+ *
+ * The caches are not part of the message's value, so we fill them in even
+ * though the message is const. */
+
+static size_t upb_encode_cachedsize(const char *msg, const upb_msglayout *m,
+                                    bool *clean);
+
+/* Whether field |f| of |m| holds submessages, whose sizes come from their own
+ * caches. */
+static bool upb_encode_hassubmsgs(const upb_msglayout *m,
+                                  const upb_msglayout_field *f) {
+  if (upb_msglayout_ismap(m, f)) {
+    const upb_msglayout_field *key_field;
+    const upb_msglayout_field *val_field;
+    upb_mapentry_fields(m->submsgs[f->submsg_index], &key_field, &val_field);
+    return val_field->descriptortype == UPB_DESCRIPTOR_TYPE_MESSAGE;
+  }
+  return f->descriptortype == UPB_DESCRIPTOR_TYPE_MESSAGE ||
+         f->descriptortype == UPB_DESCRIPTOR_TYPE_GROUP;
+}
+
+/* Whether the array or map of repeated field |f| changed since |msg|'s size
+ * was cached.  Clears the flag if |clear| is true. */
+static bool upb_encode_containerdirty(const char *msg, const upb_msglayout *m,
+                                      const upb_msglayout_field *f,
+                                      bool clear) {
+  void *container = *(void**)(msg + f->offset);
+  bool ret;
+
+  if (container == NULL) {
+    return false;
+  } else if (upb_msglayout_ismap(m, f)) {
+    upb_map *map = container;
+    ret = map->dirty;
+    if (clear) map->dirty = false;
+  } else {
+    upb_array *arr = container;
+    ret = arr->dirty;
+    if (clear) arr->dirty = false;
+  }
+
+  return ret;
+}
+
+/* Like upb_encode_scalarsize() for a message value, but with the size of the
+ * submessage coming from its cache. */
+static size_t upb_encode_cachedsubmsgsize(const void *submsg,
+                                          const upb_msglayout *m,
+                                          const upb_msglayout_field *f,
+                                          bool *clean) {
+  size_t tag_size = upb_tag_size(f->number);
+  size_t size;
+
+  if (submsg == NULL) {
+    return 0;
+  } else if (upb_islazymsg(submsg)) {
+    /* Its size is that of its bytes, which never change. */
+    return upb_encode_scalarsize((const char*)&submsg, m, f, false, 0);
+  }
+
+  size = upb_encode_cachedsize(submsg, m->submsgs[f->submsg_index], clean);
+  if (f->descriptortype == UPB_DESCRIPTOR_TYPE_GROUP) {
+    return 2 * tag_size + size;
+  } else {
+    return tag_size + upb_encode_varintsize(size) + size;
+  }
+}
+
+/* Returns the size of field |f| of |m|, for which upb_encode_hassubmsgs() is
+ * true. */
+static size_t upb_encode_cachedfieldsize(const char *field_mem,
+                                         const upb_msglayout *m,
+                                         const upb_msglayout_field *f,
+                                         bool *clean) {
+  size_t ret = 0;
+
+  if (upb_msglayout_ismap(m, f)) {
+    const upb_map *map = *(const upb_map**)field_mem;
+    const upb_msglayout *entry = m->submsgs[f->submsg_index];
+    const upb_msglayout_field *key_field;
+    const upb_msglayout_field *val_field;
+    size_t tag_size = upb_tag_size(f->number);
+    upb_mapiter i;
+
+    if (map == NULL) {
+      return 0;
+    }
+
+    upb_mapentry_fields(entry, &key_field, &val_field);
+
+    for (upb_mapiter_begin(&i, map); !upb_mapiter_done(&i);
+         upb_mapiter_next(&i)) {
+      upb_msgval key = upb_mapiter_key(&i);
+      upb_msgval val = upb_mapiter_value(&i);
+      size_t size =
+          upb_encode_scalarsize((const char*)&key, entry, key_field, false,
+                                0) +
+          upb_encode_cachedsubmsgsize(val.msg, entry, val_field, clean);
+      ret += tag_size + upb_encode_varintsize(size) + size;
+    }
+  } else if (f->label == UPB_LABEL_REPEATED) {
+    const upb_array *arr = *(const upb_array**)field_mem;
+    void *const *ptr;
+    void *const *end;
+
+    if (arr == NULL) {
+      return 0;
+    }
+
+    ptr = arr->data;
+    end = ptr + arr->len;
+    for (; ptr < end; ptr++) {
+      ret += upb_encode_cachedsubmsgsize(*ptr, m, f, clean);
+    }
+  } else {
+    ret = upb_encode_cachedsubmsgsize(*(void *const *)field_mem, m, f, clean);
+  }
+
+  return ret;
+}
+
+/* Returns the size of |msg|, reusing its cache if possible.  Otherwise
+ * recomputes and caches it, and clears |*clean|. */
+static size_t upb_encode_cachedsize(const char *msg, const upb_msglayout *m,
+                                    bool *clean) {
+  int i;
+  size_t cache = upb_msg_sizecache(msg);
+  bool subclean = true;
+  size_t ret = 0;
+
+  /* Submessages first, since they decide whether our cache is still good. */
+  for (i = 0; i < m->field_count; i++) {
+    const upb_msglayout_field *f = &m->fields[i];
+    bool skip_empty;
+
+    if (f->label == UPB_LABEL_REPEATED) {
+      if (upb_encode_containerdirty(msg, m, f, false)) {
+        subclean = false;
+      }
+    } else if (!upb_encode_hasfield(msg, f, &skip_empty)) {
+      continue;
+    }
+
+    if (upb_encode_hassubmsgs(m, f)) {
+      ret += upb_encode_cachedfieldsize(msg + f->offset, m, f, &subclean);
+    }
+  }
+
+  /* Extension holders are messages with caches of their own. */
+  if (m->extendable) {
+    const upb_msgexts *exts = upb_msg_exts(msg, m);
+    uint32_t j;
+    for (j = 0; exts && j < exts->len; j++) {
+      const upb_msg *holder = exts->ents[j].holder;
+      upb_extholderlayout hl;
+      upb_extholder_layout(upb_extholder_ext(holder), &hl);
+      ret += upb_encode_cachedsize(holder, &hl.layout, &subclean);
+    }
+  }
+
+  if (cache != 0 && subclean) {
+    return cache - 1;
+  }
+
+  for (i = 0; i < m->field_count; i++) {
+    const upb_msglayout_field *f = &m->fields[i];
+
+    if (f->label == UPB_LABEL_REPEATED) {
+      upb_encode_containerdirty(msg, m, f, true);
+    }
+
+    if (upb_encode_hassubmsgs(m, f)) {
+      continue;
+    } else if (upb_msglayout_ismap(m, f)) {
+      ret += upb_encode_mapsize(msg + f->offset, m, f, 0);
+    } else if (f->label == UPB_LABEL_REPEATED) {
+      ret += upb_encode_arraysize(msg + f->offset, m, f, 0);
+    } else {
+      bool skip_empty;
+      if (upb_encode_hasfield(msg, f, &skip_empty)) {
+        ret += upb_encode_scalarsize(msg + f->offset, m, f, skip_empty, 0);
+      }
+    }
+  }
+
+  ret += upb_msg_unknownsize(msg);
+
+  upb_msg_setsizecache((upb_msg*)msg, ret + 1);
+  *clean = false;
+  return ret;
+}
+
+size_t upb_encode_size2(const void *msg, const upb_msglayout *m,
+                        int options) {
+  if (options & UPB_ENCODE_CACHESIZE) {
+    bool clean;
+    return upb_encode_cachedsize(msg, m, &clean);
+  }
+  return upb_encode_messagesize(msg, m, 0);
+}
+
+size_t upb_encode_size(const void *msg, const upb_msglayout *m) {
+  return upb_encode_size2(msg, m, 0);
+}
+
+char *upb_encode2(const void *msg, const upb_msglayout *m, upb_arena *arena,
+                  size_t *size, int options) {
   upb_encstate e;
-  e.alloc = upb_arena_alloc(arena);
-  e.buf = NULL;
-  e.limit = NULL;
-  e.ptr = NULL;
+  size_t bytes = upb_encode_size2(msg, m, options);
+  bool ok;
 
-  if (!upb_encode_message(&e, msg, m, size)) {
+  if (bytes == 0) {
+    static char ch;
+    /* A stale cache would otherwise go unnoticed here. */
+    UPB_ASSERT(upb_encode_messagesize(msg, m, 0) == 0);
+    *size = 0;
+    return &ch;
+  }
+
+  /* Allocate the exact output size up front, so the encoder never needs to
+   * grow (and copy) its buffer. */
+  upb_encstate_init(&e, upb_arena_alloc(arena));
+  e.deterministic = (options & UPB_ENCODE_DETERMINISTIC) != 0;
+  e.buf = upb_malloc(e.alloc, bytes);
+  e.limit = e.buf ? e.buf + bytes : NULL;
+  e.ptr = e.limit;
+
+  ok = e.buf && upb_encode_message(&e, msg, m, size);
+  upb_gfree(e.sorted);
+
+  if (!ok) {
     *size = 0;
     return NULL;
   }
 
   *size = e.limit - e.ptr;
+  UPB_ASSERT(*size == bytes);
+  return e.ptr;
+}
 
-  if (*size == 0) {
-    static char ch;
-    return &ch;
-  } else {
-    UPB_ASSERT(e.ptr);
-    return e.ptr;
+char *upb_encode(const void *msg, const upb_msglayout *m, upb_arena *arena,
+                 size_t *size) {
+  return upb_encode2(msg, m, arena, size, 0);
+}
+
+size_t upb_encode_tobuf(const void *msg, const upb_msglayout *m, char *buf,
+                        size_t bufsize) {
+  upb_encstate e;
+  size_t size;
+  size_t bytes = upb_encode_size(msg, m);
+
+  if (bytes > bufsize) {
+    return bytes;
   }
+
+  /* Encode backwards from buf + bytes, so the output starts at buf. */
+  upb_encstate_init(&e, NULL);
+  e.buf = buf;
+  e.limit = buf + bytes;
+  e.ptr = e.limit;
+
+  if (!upb_encode_message(&e, msg, m, &size)) {
+    UPB_ASSERT(false);  /* Can only fail by running out of buffer. */
+    return 0;
+  }
+
+  UPB_ASSERT(e.ptr == buf);
+  return bytes;
+}
+
+size_t upb_encode_delimited_tobuf(const void *msg, const upb_msglayout *m,
+                                  char *buf, size_t bufsize) {
+  upb_encstate e;
+  size_t size;
+  size_t bytes = upb_encode_size(msg, m);
+  size_t prefix = upb_encode_varintsize(bytes);
+
+  if (prefix + bytes > bufsize) {
+    return prefix + bytes;
+  }
+
+  upb_encode_varint(bytes, buf);
+
+  upb_encstate_init(&e, NULL);
+  e.buf = buf + prefix;
+  e.limit = e.buf + bytes;
+  e.ptr = e.limit;
+
+  if (!upb_encode_message(&e, msg, m, &size)) {
+    UPB_ASSERT(false);  /* Can only fail by running out of buffer. */
+    return 0;
+  }
+
+  UPB_ASSERT(e.ptr == e.buf);
+  return prefix + bytes;
+}
+
+upb_stringview *upb_encode_segments(const void *msg, const upb_msglayout *m,
+                                    size_t alias_min, upb_arena *arena,
+                                    size_t *count) {
+  upb_encstate e;
+  size_t size;
+  size_t i;
+  size_t bytes = upb_encode_messagesize(msg, m, alias_min);
+
+  upb_encstate_init(&e, upb_arena_alloc(arena));
+  e.alias_min = alias_min;
+
+  if (bytes > 0) {
+    e.buf = upb_malloc(e.alloc, bytes);
+    if (!e.buf) {
+      return NULL;
+    }
+    e.limit = e.buf + bytes;
+    e.ptr = e.limit;
+  }
+
+  if (!upb_encode_message(&e, msg, m, &size) || !upb_encode_closeseg(&e)) {
+    return NULL;
+  }
+
+  if (e.seg_count == 0) {
+    /* Return a valid pointer even for an empty message. */
+    static upb_stringview empty;
+    *count = 0;
+    return &empty;
+  }
+
+  /* Buffer segments were recorded back-to-front, so each one immediately
+   * precedes the previous one in the buffer. */
+  {
+    const char *end = e.limit;
+    for (i = 0; i < e.seg_count; i++) {
+      upb_stringview *seg = &e.segs[i];
+      if (seg->data == NULL) {
+        end -= seg->size;
+        seg->data = end;
+      }
+    }
+    UPB_ASSERT(end == e.ptr);
+  }
+
+  /* Put segments in output order. */
+  for (i = 0; i < e.seg_count / 2; i++) {
+    upb_stringview tmp = e.segs[i];
+    e.segs[i] = e.segs[e.seg_count - 1 - i];
+    e.segs[e.seg_count - 1 - i] = tmp;
+  }
+
+  *count = e.seg_count;
+  return e.segs;
 }
 
 #undef CHK
@@ -9,9 +9,76 @@
 
 UPB_BEGIN_EXTERN_C
 
+/* Serializes |msg| into a buffer allocated from |arena|, returning the buffer
+ * and its length in |*size|, or NULL on failure.  The exact length is computed
+ * first (see upb_encode_size()) so the buffer is allocated only once. */
 char *upb_encode(const void *msg, const upb_msglayout *l, upb_arena *arena,
                  size_t *size);
 
+/* Returns the exact number of bytes upb_encode() will produce for |msg|. */
+size_t upb_encode_size(const void *msg, const upb_msglayout *l);
+
+/* Options for upb_encode2(), which may be OR'd together. */
+typedef enum {
+  /* Stores the size of each message in the message, and reuses it the next
+   * time the message is encoded with this option if nothing in it changed.
+   * This is for messages that are encoded over and over with small changes in
+   * between: the size pass then only looks at the fields of messages that
+   * changed (and visits, but does not measure, all the other submessages).
+   *
+   * Changes made through the upb_msg, upb_array and upb_map functions, or by
+   * parsing into the message with upb_decode() or upb_json_decode() (and
+   * everything built on them), are noticed.  After writing a message any
+   * other way (with generated setters, or upb_msg_setscalarhandler()
+   * handlers, say) call upb_msg_invalidatesize() on it.
+   * Since encoding writes the caches, it is not safe to encode one message
+   * with this option on several threads at once. */
+  UPB_ENCODE_CACHESIZE = 1 << 0,
+
+  /* Map entries are written in order of their keys, so that messages that
+   * upb_msg_equal() considers equal serialize to the same bytes (as long as
+   * their unknown fields are the same).  Integer and bool keys are in numeric
+   * order.  String keys are ordered by length and then by memcmp(), which is
+   * cheaper than, and different from, the lexicographic order some other
+   * protobuf implementations use.  Sorting takes a scratch buffer from
+   * upb_gmalloc() rather than the arena, and frees it before returning. */
+  UPB_ENCODE_DETERMINISTIC = 1 << 1
+} upb_encodeopt;
+
+/* Like upb_encode(), but with options from upb_encodeopt. */
+char *upb_encode2(const void *msg, const upb_msglayout *l, upb_arena *arena,
+                  size_t *size, int options);
+
+/* Like upb_encode_size(), but with options from upb_encodeopt.  With
+ * UPB_ENCODE_CACHESIZE this fills in the caches for upb_encode2(). */
+size_t upb_encode_size2(const void *msg, const upb_msglayout *l, int options);
+
+/* Serializes |msg| into the caller's buffer |buf| of |bufsize| bytes, without
+ * allocating.  Returns the size of the encoded message.  If that is larger
+ * than |bufsize| the message did not fit and nothing was written; the caller
+ * can retry with a buffer of (at least) the returned size. */
+size_t upb_encode_tobuf(const void *msg, const upb_msglayout *l, char *buf,
+                        size_t bufsize);
+
+/* Like upb_encode_tobuf(), but writes the size of the encoded message as a
+ * varint before it, as in a stream of length-delimited messages.  The
+ * returned size includes the prefix. */
+size_t upb_encode_delimited_tobuf(const void *msg, const upb_msglayout *l,
+                                  char *buf, size_t bufsize);
+
+/* Serializes |msg| as a list of segments whose concatenation is the encoded
+ * message, suitable for writev() or a send ring.  String and bytes fields of
+ * at least |alias_min| bytes are not copied: their segments point at the field
+ * data itself, which must outlive the segments.  If |alias_min| is zero,
+ * nothing is aliased.  Everything else is encoded into a single buffer from
+ * |arena|.
+ *
+ * Returns an array of |*count| segments allocated from |arena|, or NULL on
+ * failure. */
+upb_stringview *upb_encode_segments(const void *msg, const upb_msglayout *l,
+                                    size_t alias_min, upb_arena *arena,
+                                    size_t *count);
+
 UPB_END_EXTERN_C
 
 #endif  /* UPB_ENCODE_H_ */
@@ -1007,6 +1007,16 @@ inline reffed_ptr<const Handlers> Handlers::NewFrozen(
   const upb_handlers *h = upb_handlers_newfrozen(m, &h, callback, closure);
   return reffed_ptr<const Handlers>(h, &h);
 }
+inline HandlerCache* HandlerCache::New(upb_handlers_callback *callback,
+                                      const void *closure) {
+  return upb_handlercache_new(callback, closure);
+}
+inline void HandlerCache::Free(HandlerCache* cache) {
+  upb_handlercache_free(cache);
+}
+inline const Handlers* HandlerCache::Get(const MessageDef* md) {
+  return upb_handlercache_get(this, md);
+}
 inline const Status* Handlers::status() {
   return upb_handlers_status(this);
 }
@@ -142,6 +142,36 @@ static const void **returntype(upb_handlers *h, const upb_fielddef *f,
   return &h->table[handlers_getsel(h, f, type)].attr.return_closure_type_;
 }
 
+/* Single-value handlers for fields that only have an array handler.  Their
+ * handler data is the array handler's table entry. */
+#define ARRAYADAPTOR(type, ctype)                                          \
+  static bool arrayadaptor_ ## type(void *c, const void *hd, ctype val) {  \
+    const upb_handlers_tabent *e = hd;                                     \
+    upb_ ## type ## array_handlerfunc *func =                              \
+        (upb_ ## type ## array_handlerfunc*)e->func;                       \
+    return func(c, upb_handlerattr_handlerdata(&e->attr), &val, 1);        \
+  }
+
+ARRAYADAPTOR(int32,  int32_t)
+ARRAYADAPTOR(int64,  int64_t)
+ARRAYADAPTOR(uint32, uint32_t)
+ARRAYADAPTOR(uint64, uint64_t)
+ARRAYADAPTOR(float,  float)
+ARRAYADAPTOR(double, double)
+ARRAYADAPTOR(bool,   bool)
+
+#undef ARRAYADAPTOR
+
+static bool isarrayadaptor(upb_func *func) {
+  return func == (upb_func*)arrayadaptor_int32 ||
+         func == (upb_func*)arrayadaptor_int64 ||
+         func == (upb_func*)arrayadaptor_uint32 ||
+         func == (upb_func*)arrayadaptor_uint64 ||
+         func == (upb_func*)arrayadaptor_float ||
+         func == (upb_func*)arrayadaptor_double ||
+         func == (upb_func*)arrayadaptor_bool;
+}
+
 static bool doset(upb_handlers *h, int32_t sel, const upb_fielddef *f,
                   upb_handlertype_t type, upb_func *func,
                   upb_handlerattr *attr) {
@@ -157,7 +187,7 @@ static bool doset(upb_handlers *h, int32_t sel, const upb_fielddef *f,
     return false;
   }
 
-  if (h->table[sel].func) {
+  if (h->table[sel].func && !isarrayadaptor(h->table[sel].func)) {
     upb_status_seterrmsg(&h->status_,
                          "cannot change handler once it has been set.");
     return false;
@@ -372,6 +402,36 @@ SETTER(endseq,      upb_endfield_handlerfunc*,    UPB_HANDLER_ENDSEQ)
 
 #undef SETTER
 
+/* Sets the array handler, and points the single-value handler at it unless
+ * one of its own has been set. */
+#define ARRAYSETTER(name, handlertype)                                        \
+  bool upb_handlers_set ## name ## array(                                     \
+      upb_handlers *h, const upb_fielddef *f,                                 \
+      upb_ ## name ## array_handlerfunc *func, upb_handlerattr *attr) {       \
+    int32_t sel = trygetsel(h, f, handlertype ## ARRAY);                      \
+    upb_handlerattr adaptor_attr;                                             \
+    upb_selector_t valsel;                                                    \
+    if (!doset(h, sel, f, handlertype ## ARRAY, (upb_func*)func, attr)) {     \
+      return false;                                                           \
+    }                                                                         \
+    valsel = handlers_getsel(h, f, handlertype);                              \
+    if (h->table[valsel].func) return true;                                   \
+    adaptor_attr = h->table[sel].attr;                                        \
+    upb_handlerattr_sethandlerdata(&adaptor_attr, &h->table[sel]);            \
+    return doset(h, valsel, f, handlertype,                                   \
+                 (upb_func*)arrayadaptor_ ## name, &adaptor_attr);            \
+  }
+
+ARRAYSETTER(int32,  UPB_HANDLER_INT32)
+ARRAYSETTER(int64,  UPB_HANDLER_INT64)
+ARRAYSETTER(uint32, UPB_HANDLER_UINT32)
+ARRAYSETTER(uint64, UPB_HANDLER_UINT64)
+ARRAYSETTER(float,  UPB_HANDLER_FLOAT)
+ARRAYSETTER(double, UPB_HANDLER_DOUBLE)
+ARRAYSETTER(bool,   UPB_HANDLER_BOOL)
+
+#undef ARRAYSETTER
+
 bool upb_handlers_setunknown(upb_handlers *h, upb_unknown_handlerfunc *func,
                              upb_handlerattr *attr) {
   return doset(h, UPB_UNKNOWN_SELECTOR, NULL, UPB_HANDLER_INT32,
@@ -596,6 +656,20 @@ bool upb_handlers_getselector(const upb_fielddef *f, upb_handlertype_t type,
       if (!upb_fielddef_issubmsg(f)) return false;
       *s = f->selector_base;
       break;
+    case UPB_HANDLER_INT32ARRAY:
+    case UPB_HANDLER_INT64ARRAY:
+    case UPB_HANDLER_UINT32ARRAY:
+    case UPB_HANDLER_UINT64ARRAY:
+    case UPB_HANDLER_FLOATARRAY:
+    case UPB_HANDLER_DOUBLEARRAY:
+    case UPB_HANDLER_BOOLARRAY:
+      if (!upb_fielddef_isseq(f) || !upb_fielddef_isprimitive(f) ||
+          upb_handlers_getprimitivehandlertype(f) !=
+              type - UPB_HANDLER_INT32ARRAY + UPB_HANDLER_INT32) {
+        return false;
+      }
+      *s = f->selector_base + 1;
+      break;
   }
   UPB_ASSERT((size_t)*s < upb_fielddef_containingtype(f)->selector_count);
   return true;
@@ -609,6 +683,9 @@ uint32_t upb_handlers_selectorcount(const upb_fielddef *f) {
   uint32_t ret = 1;
   if (upb_fielddef_isseq(f)) ret += 2;    /* STARTSEQ/ENDSEQ */
   if (upb_fielddef_isstring(f)) ret += 2; /* [STRING]/STARTSTR/ENDSTR */
+  if (upb_fielddef_isseq(f) && upb_fielddef_isprimitive(f)) {
+    ret += 1;  /* [TYPE]ARRAY */
+  }
   if (upb_fielddef_issubmsg(f)) {
     /* ENDSUBMSG (STARTSUBMSG is at table beginning) */
     ret += 0;
@@ -665,6 +742,185 @@ bool upb_handlerattr_alwaysok(const upb_handlerattr *attr) {
   return attr->alwaysok_;
 }
 
+/* upb_handlercache ***********************************************************/
+
+/* The cache is a list of frozen handlers trees, newest first, each with a
+ * table of every handlers object in the tree by msgdef.  As with
+ * upb_pbcodecache, entries are only ever prepended and never change once
+ * published, so lookups walk the list without taking the lock, which is only
+ * held to build and publish a new entry. */
+typedef struct handlercache_entry {
+  const upb_handlers *root;  /* We own a ref. */
+  upb_inttable bymsg;        /* upb_msgdef* -> const upb_handlers*. */
+  struct handlercache_entry *next;
+} handlercache_entry;
+
+struct upb_handlercache {
+  upb_handlers_callback *callback;
+  const void *closure;
+  void *entries;
+  int lock;
+};
+
+#ifdef UPB_THREAD_UNSAFE /*---------------------------------------------------*/
+
+static void *hcache_head(void *const*head) { return *head; }
+static void hcache_publish(void **head, void *e) { *head = e; }
+static void hcache_lock(int *lock) { UPB_UNUSED(lock); }
+static void hcache_unlock(int *lock) { UPB_UNUSED(lock); }
+
+#elif defined(__GNUC__) || defined(__clang__) /*------------------------------*/
+
+static void *hcache_head(void *const*head) {
+  void *ret = *(void *const volatile *)head;
+  __sync_synchronize();  /* Don't read the entry before it is published. */
+  return ret;
+}
+
+static void hcache_publish(void **head, void *e) {
+  /* Only called with the lock held, so the swap always succeeds. */
+  bool ok = __sync_bool_compare_and_swap(head, *head, e);
+  UPB_ASSERT(ok);
+}
+
+static void hcache_lock(int *lock) {
+  while (__sync_lock_test_and_set(lock, 1)) {
+    while (*(volatile int *)lock) {}
+  }
+}
+
+static void hcache_unlock(int *lock) { __sync_lock_release(lock); }
+
+#elif defined(WIN32) /*-------------------------------------------------------*/
+
+#include <Windows.h>
+
+static void *hcache_head(void *const*head) {
+  void *ret = *(void *const volatile *)head;
+  MemoryBarrier();
+  return ret;
+}
+
+static void hcache_publish(void **head, void *e) {
+  InterlockedExchangePointer(head, e);
+}
+
+static void hcache_lock(int *lock) {
+  while (InterlockedExchange((volatile LONG *)lock, 1)) {
+    while (*(volatile int *)lock) {}
+  }
+}
+
+static void hcache_unlock(int *lock) {
+  InterlockedExchange((volatile LONG *)lock, 0);
+}
+
+#else
+#error Atomic primitives not defined for your platform/CPU.  \
+       Implement them or compile with UPB_THREAD_UNSAFE.
+#endif
+
+/* Returns the handlers for |m| if an entry from |e| up to (but not including)
+ * |end| has them, otherwise NULL. */
+static const upb_handlers *hcache_find(const handlercache_entry *e,
+                                       const handlercache_entry *end,
+                                       const upb_msgdef *m) {
+  for (; e != end; e = e->next) {
+    upb_value v;
+    if (upb_inttable_lookupptr(&e->bymsg, m, &v)) {
+      return upb_value_getconstptr(v);
+    }
+  }
+  return NULL;
+}
+
+/* Adds |h| and everything reachable from it to e->bymsg. */
+static bool hcache_index(handlercache_entry *e, const upb_handlers *h) {
+  const upb_msgdef *m = upb_handlers_msgdef(h);
+  upb_msg_field_iter i;
+
+  if (upb_inttable_lookupptr(&e->bymsg, m, NULL)) return true;
+  if (!upb_inttable_insertptr(&e->bymsg, m, upb_value_constptr(h))) {
+    return false;
+  }
+
+  for(upb_msg_field_begin(&i, m);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    const upb_handlers *sub;
+    if (!upb_fielddef_issubmsg(f)) continue;
+    sub = upb_handlers_getsubhandlers(h, f);
+    if (sub && !hcache_index(e, sub)) return false;
+  }
+
+  return true;
+}
+
+upb_handlercache *upb_handlercache_new(upb_handlers_callback *callback,
+                                       const void *closure) {
+  upb_handlercache *c = upb_gmalloc(sizeof(*c));
+  if (!c) return NULL;
+  c->callback = callback;
+  c->closure = closure;
+  c->entries = NULL;
+  c->lock = 0;
+  return c;
+}
+
+void upb_handlercache_free(upb_handlercache *c) {
+  handlercache_entry *e = c->entries;
+  while (e) {
+    handlercache_entry *next = e->next;
+    upb_inttable_uninit(&e->bymsg);
+    upb_handlers_unref(e->root, e);
+    upb_gfree(e);
+    e = next;
+  }
+  upb_gfree(c);
+}
+
+const upb_handlers *upb_handlercache_get(upb_handlercache *c,
+                                         const upb_msgdef *m) {
+  const upb_handlers *ret;
+  handlercache_entry *head;
+  handlercache_entry *e;
+
+  /* Fast path: handlers for |m| are in the cache, either because they were
+   * asked for before or because some earlier tree reaches |m|. */
+  head = hcache_head(&c->entries);
+  ret = hcache_find(head, NULL, m);
+  if (ret) return ret;
+
+  hcache_lock(&c->lock);
+
+  /* Another thread may have built them while we waited; only the entries it
+   * added need to be checked. */
+  ret = hcache_find(c->entries, head, m);
+
+  if (!ret && (e = upb_gmalloc(sizeof(*e))) != NULL) {
+    if (!upb_inttable_init(&e->bymsg, UPB_CTYPE_CONSTPTR)) {
+      upb_gfree(e);
+    } else if ((e->root = upb_handlers_newfrozen(m, e, c->callback,
+                                                 c->closure)) == NULL) {
+      upb_inttable_uninit(&e->bymsg);
+      upb_gfree(e);
+    } else if (!hcache_index(e, e->root)) {
+      upb_inttable_uninit(&e->bymsg);
+      upb_handlers_unref(e->root, e);
+      upb_gfree(e);
+    } else {
+      upb_inttable_compact(&e->bymsg);
+      e->next = c->entries;
+      ret = e->root;
+      hcache_publish(&c->entries, e);
+    }
+  }
+
+  hcache_unlock(&c->lock);
+  return ret;
+}
+
 /* upb_bufhandle **************************************************************/
 
 size_t upb_bufhandle_objofs(const upb_bufhandle *h) {
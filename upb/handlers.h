@@ -27,6 +27,7 @@ namespace upb {
 class BufferHandle;
 class BytesHandler;
 class HandlerAttributes;
+class HandlerCache;
 class Handlers;
 template <class T> class Handler;
 template <class T> struct CanonicalType;
@@ -36,6 +37,7 @@ template <class T> struct CanonicalType;
 UPB_DECLARE_TYPE(upb::BufferHandle, upb_bufhandle)
 UPB_DECLARE_TYPE(upb::BytesHandler, upb_byteshandler)
 UPB_DECLARE_TYPE(upb::HandlerAttributes, upb_handlerattr)
+UPB_DECLARE_TYPE(upb::HandlerCache, upb_handlercache)
 UPB_DECLARE_DERIVED_TYPE(upb::Handlers, upb::RefCounted,
                          upb_handlers, upb_refcounted)
 
@@ -64,10 +66,19 @@ typedef enum {
   UPB_HANDLER_STARTSUBMSG,
   UPB_HANDLER_ENDSUBMSG,
   UPB_HANDLER_STARTSEQ,
-  UPB_HANDLER_ENDSEQ
+  UPB_HANDLER_ENDSEQ,
+  /* Handlers that receive many values of a repeated field at once.  These are
+   * in the same order as the single-value types above. */
+  UPB_HANDLER_INT32ARRAY,
+  UPB_HANDLER_INT64ARRAY,
+  UPB_HANDLER_UINT32ARRAY,
+  UPB_HANDLER_UINT64ARRAY,
+  UPB_HANDLER_FLOATARRAY,
+  UPB_HANDLER_DOUBLEARRAY,
+  UPB_HANDLER_BOOLARRAY
 } upb_handlertype_t;
 
-#define UPB_HANDLER_MAX (UPB_HANDLER_ENDSEQ+1)
+#define UPB_HANDLER_MAX (UPB_HANDLER_BOOLARRAY+1)
 
 #define UPB_BREAK NULL
 
@@ -651,6 +662,20 @@ typedef void *upb_startstr_handlerfunc(void *c, const void *hd,
                                        size_t size_hint);
 typedef size_t upb_string_handlerfunc(void *c, const void *hd, const char *buf,
                                       size_t n, const upb_bufhandle* handle);
+typedef bool upb_int32array_handlerfunc(void *c, const void *hd,
+                                        const int32_t *vals, size_t n);
+typedef bool upb_int64array_handlerfunc(void *c, const void *hd,
+                                        const int64_t *vals, size_t n);
+typedef bool upb_uint32array_handlerfunc(void *c, const void *hd,
+                                         const uint32_t *vals, size_t n);
+typedef bool upb_uint64array_handlerfunc(void *c, const void *hd,
+                                         const uint64_t *vals, size_t n);
+typedef bool upb_floatarray_handlerfunc(void *c, const void *hd,
+                                        const float *vals, size_t n);
+typedef bool upb_doublearray_handlerfunc(void *c, const void *hd,
+                                         const double *vals, size_t n);
+typedef bool upb_boolarray_handlerfunc(void *c, const void *hd,
+                                       const bool *vals, size_t n);
 
 /* upb_bufhandle */
 size_t upb_bufhandle_objofs(const upb_bufhandle *h);
@@ -736,6 +761,41 @@ bool upb_handlers_setendseq(upb_handlers *h, const upb_fielddef *f,
                             upb_endfield_handlerfunc *func,
                             upb_handlerattr *attr);
 
+/* Array handlers, for repeated fields of primitive type.  An array handler
+ * receives a run of consecutive values of the field in one call, so a
+ * producer that has many values at hand (like the protobuf decoder with a
+ * packed field) makes one call per run instead of one per value.  A long run
+ * may arrive in several calls.  Values still arrive between the STARTSEQ and
+ * ENDSEQ handlers.
+ *
+ * A field with an array handler but no single-value handler gets a
+ * single-value handler that calls the array handler with one value, so
+ * producers that deliver values one at a time reach it too.  Setting a
+ * single-value handler of one's own (before or after) replaces that one, in
+ * which case a producer may deliver any value of the field through either of
+ * the two. */
+bool upb_handlers_setint32array(upb_handlers *h, const upb_fielddef *f,
+                                upb_int32array_handlerfunc *func,
+                                upb_handlerattr *attr);
+bool upb_handlers_setint64array(upb_handlers *h, const upb_fielddef *f,
+                                upb_int64array_handlerfunc *func,
+                                upb_handlerattr *attr);
+bool upb_handlers_setuint32array(upb_handlers *h, const upb_fielddef *f,
+                                 upb_uint32array_handlerfunc *func,
+                                 upb_handlerattr *attr);
+bool upb_handlers_setuint64array(upb_handlers *h, const upb_fielddef *f,
+                                 upb_uint64array_handlerfunc *func,
+                                 upb_handlerattr *attr);
+bool upb_handlers_setfloatarray(upb_handlers *h, const upb_fielddef *f,
+                                upb_floatarray_handlerfunc *func,
+                                upb_handlerattr *attr);
+bool upb_handlers_setdoublearray(upb_handlers *h, const upb_fielddef *f,
+                                 upb_doublearray_handlerfunc *func,
+                                 upb_handlerattr *attr);
+bool upb_handlers_setboolarray(upb_handlers *h, const upb_fielddef *f,
+                               upb_boolarray_handlerfunc *func,
+                               upb_handlerattr *attr);
+
 bool upb_handlers_setsubhandlers(upb_handlers *h, const upb_fielddef *f,
                                  const upb_handlers *sub);
 const upb_handlers *upb_handlers_getsubhandlers(const upb_handlers *h,
@@ -758,6 +818,41 @@ UPB_INLINE const void *upb_handlers_gethandlerdata(const upb_handlers *h,
 
 #ifdef __cplusplus
 
+/* A cache of frozen handlers, built by one callback (and closure) for any
+ * number of msgdefs.  The first Get() for a msgdef builds its handlers with
+ * Handlers::NewFrozen(); later ones, and Get()s for any message those handlers
+ * reach, return the same object.  So a cache that lives as long as a process
+ * makes handlers for a type cost nothing after the first time.
+ *
+ * Get() is thread-safe and takes no locks for handlers that are already
+ * cached; the handlers it returns may be used and ref'd from any thread.  The
+ * cache refs every msgdef it has built handlers for.  New() and Free() are not
+ * thread-safe. */
+class upb::HandlerCache {
+ public:
+  /* |closure| must outlive the cache. */
+  static HandlerCache* New(upb_handlers_callback *callback,
+                           const void *closure);
+  static void Free(HandlerCache* cache);
+
+  /* Returns the handlers for |md|, which are owned by the cache, or NULL if out
+   * of memory. */
+  const Handlers* Get(const MessageDef* md);
+
+ private:
+  UPB_DISALLOW_POD_OPS(HandlerCache, upb::HandlerCache)
+};
+
+#endif
+
+upb_handlercache *upb_handlercache_new(upb_handlers_callback *callback,
+                                       const void *closure);
+void upb_handlercache_free(upb_handlercache *c);
+const upb_handlers *upb_handlercache_get(upb_handlercache *c,
+                                         const upb_msgdef *md);
+
+#ifdef __cplusplus
+
 /* Handler types for single fields.
  * Right now we only have one for TYPE_BYTES but ones for other types
  * should follow.
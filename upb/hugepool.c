@@ -0,0 +1,309 @@
+/*
+** upb_hugepool: arena blocks on huge pages from the local NUMA node.
+**
+** On Linux, each block is an anonymous mapping of whole 2MB pages, which we
+** try first to get from the reserved huge page pool (MAP_HUGETLB) and
+** otherwise map 2MB-aligned and madvise() for transparent huge pages.  Fresh
+** mappings are bound (preferred, not strict) to the node of the allocating
+** thread, and freed single-page blocks go back to that node's cache.
+** Elsewhere every request goes to the fallback allocator.
+*/
+
+#if defined(__linux__)
+/* MAP_ANONYMOUS, MAP_HUGETLB, madvise() and syscall() are not C89. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+/* A strictly conforming amalgamation may still hide these; we then fall back
+ * to plain allocation. */
+#ifdef MAP_ANONYMOUS
+#define UPB_HUGEPOOL_MMAP
+#endif
+#endif
+
+#include "upb/upb.h"
+
+/* Every block starts with this header, within UPB_HUGEPOOL_OVERHEAD bytes. */
+typedef struct hugepool_block {
+  struct hugepool_block *next;  /* While cached. */
+  size_t len;                   /* Bytes mapped, or 0 if from the fallback. */
+  unsigned node;
+} hugepool_block;
+
+#if defined(UPB_THREAD_UNSAFE) || !defined(UPB_HUGEPOOL_MMAP)
+
+static void hugepool_lock(int *lock) { UPB_UNUSED(lock); }
+static void hugepool_unlock(int *lock) { UPB_UNUSED(lock); }
+
+#else
+
+/* Held only to push or pop one page, so spinning beats sleeping. */
+static void hugepool_lock(int *lock) {
+  while (__sync_lock_test_and_set(lock, 1)) {
+    while (*(volatile int*)lock) {}
+  }
+}
+
+static void hugepool_unlock(int *lock) { __sync_lock_release(lock); }
+
+#endif
+
+static upb_hugepool_node *hugepool_node(upb_hugepool *p, unsigned node) {
+  return &p->nodes[node % UPB_HUGEPOOL_NODES];
+}
+
+#ifdef UPB_HUGEPOOL_MMAP
+
+/* From <numaif.h>, which comes with libnuma rather than libc. */
+#define HUGEPOOL_MPOL_PREFERRED 1
+
+static unsigned hugepool_curnode(void) {
+#ifdef SYS_getcpu
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+    return node;
+  }
+#endif
+  return 0;
+}
+
+static void *hugepool_map(size_t len, unsigned node) {
+  void *mem = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+    /* Ask for 2MB pages even if the system default is 1GB. */
+    flags |= 21 << MAP_HUGE_SHIFT;
+#endif
+    /* Fails unless huge pages are reserved; cheap next to filling 2MB. */
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+  }
+#endif
+
+  if (mem == MAP_FAILED) {
+    /* Transparent huge pages only back 2MB-aligned ranges, so over-map and
+     * trim to alignment. */
+    char *raw = mmap(NULL, len + UPB_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *aligned;
+    size_t head;
+
+    if (raw == MAP_FAILED) {
+      return NULL;
+    }
+
+    head = (UPB_HUGEPAGE_SIZE - (uintptr_t)raw % UPB_HUGEPAGE_SIZE) %
+           UPB_HUGEPAGE_SIZE;
+    aligned = raw + head;
+    if (head > 0) {
+      munmap(raw, head);
+    }
+    munmap(aligned + len, UPB_HUGEPAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+    mem = aligned;
+  }
+
+#ifdef SYS_mbind
+  /* Pages are placed at first touch, which may come after the thread has
+   * moved; pin the preference now.  Failure (no NUMA) is harmless. */
+  if (node < sizeof(unsigned long) * 8) {
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, mem, len, HUGEPOOL_MPOL_PREFERRED, &mask,
+            sizeof(mask) * 8, 0);
+  }
+#endif
+
+  return mem;
+}
+
+static hugepool_block *hugepool_getpages(upb_hugepool *p, size_t total) {
+  size_t len = (total + UPB_HUGEPAGE_SIZE - 1) & ~(UPB_HUGEPAGE_SIZE - 1);
+  unsigned node = hugepool_curnode();
+  upb_hugepool_node *n = hugepool_node(p, node);
+  hugepool_block *b = NULL;
+
+  if (len < total) {
+    return NULL;  /* Overflow. */
+  }
+
+  if (len == UPB_HUGEPAGE_SIZE) {
+    hugepool_lock(&n->lock);
+    b = n->free;
+    if (b) {
+      n->free = b->next;
+      n->bytes_cached -= len;
+    }
+    hugepool_unlock(&n->lock);
+    if (b) {
+      return b;
+    }
+  }
+
+  b = hugepool_map(len, node);
+  if (!b) {
+    return NULL;
+  }
+
+  b->len = len;
+  b->node = node;
+  hugepool_lock(&n->lock);
+  n->bytes_mapped += len;
+  hugepool_unlock(&n->lock);
+  return b;
+}
+
+#endif  /* UPB_HUGEPOOL_MMAP */
+
+static void *hugepool_get(upb_hugepool *p, size_t size) {
+  size_t total = size + UPB_HUGEPOOL_OVERHEAD;
+  hugepool_block *b = NULL;
+
+  if (total < size) {
+    return NULL;
+  }
+
+#ifdef UPB_HUGEPOOL_MMAP
+  if (total >= p->min_size) {
+    b = hugepool_getpages(p, total);
+  }
+#endif
+
+  if (!b) {
+    b = upb_malloc(p->fallback, total);
+    if (!b) {
+      return NULL;
+    }
+    b->len = 0;
+  }
+
+  return (char*)b + UPB_HUGEPOOL_OVERHEAD;
+}
+
+static void hugepool_put(upb_hugepool *p, hugepool_block *b) {
+  upb_hugepool_node *n;
+
+  if (b->len == 0) {
+    upb_free(p->fallback, b);
+    return;
+  }
+
+  n = hugepool_node(p, b->node);
+  hugepool_lock(&n->lock);
+  if (b->len == UPB_HUGEPAGE_SIZE &&
+      n->bytes_cached + b->len <= p->max_cached) {
+    b->next = n->free;
+    n->free = b;
+    n->bytes_cached += b->len;
+    b = NULL;
+  } else {
+    n->bytes_mapped -= b->len;
+  }
+  hugepool_unlock(&n->lock);
+
+#ifdef UPB_HUGEPOOL_MMAP
+  if (b) {
+    munmap(b, b->len);
+  }
+#endif
+}
+
+static void *upb_hugepool_doalloc(upb_alloc *alloc, void *ptr,
+                                  size_t oldsize, size_t size) {
+  upb_hugepool *p = (upb_hugepool*)alloc;  /* upb_alloc is initial member. */
+  void *ret = NULL;
+
+  if (size > 0) {
+    ret = hugepool_get(p, size);
+    if (!ret) {
+      return NULL;
+    }
+    if (ptr) {
+      memcpy(ret, ptr, UPB_MIN(oldsize, size));
+    }
+  }
+
+  if (ptr) {
+    hugepool_put(p, (hugepool_block*)((char*)ptr - UPB_HUGEPOOL_OVERHEAD));
+  }
+
+  return ret;
+}
+
+void upb_hugepool_init(upb_hugepool *p, upb_alloc *fallback) {
+  size_t i;
+  UPB_ASSERT(sizeof(hugepool_block) <= UPB_HUGEPOOL_OVERHEAD);
+  p->alloc.func = &upb_hugepool_doalloc;
+  p->fallback = fallback ? fallback : &upb_alloc_global;
+  p->min_size = UPB_HUGEPAGE_SIZE / 2;
+  p->max_cached = 64 * UPB_HUGEPAGE_SIZE;
+
+  for (i = 0; i < UPB_HUGEPOOL_NODES; i++) {
+    upb_hugepool_node *n = &p->nodes[i];
+    n->free = NULL;
+    n->bytes_cached = 0;
+    n->bytes_mapped = 0;
+    n->lock = 0;
+  }
+}
+
+void upb_hugepool_uninit(upb_hugepool *p) {
+  size_t i;
+
+  for (i = 0; i < UPB_HUGEPOOL_NODES; i++) {
+    upb_hugepool_node *n = &p->nodes[i];
+    hugepool_block *b = n->free;
+    while (b) {
+      hugepool_block *next = b->next;
+      n->bytes_mapped -= b->len;
+#ifdef UPB_HUGEPOOL_MMAP
+      munmap(b, b->len);
+#endif
+      b = next;
+    }
+    n->free = NULL;
+    n->bytes_cached = 0;
+  }
+}
+
+void upb_hugepool_setminsize(upb_hugepool *p, size_t size) {
+  p->min_size = size;
+}
+
+void upb_hugepool_setmaxcached(upb_hugepool *p, size_t size) {
+  p->max_cached = size;
+}
+
+size_t upb_hugepool_bytesmapped(upb_hugepool *p) {
+  size_t i, ret = 0;
+  for (i = 0; i < UPB_HUGEPOOL_NODES; i++) {
+    upb_hugepool_node *n = &p->nodes[i];
+    hugepool_lock(&n->lock);
+    ret += n->bytes_mapped;
+    hugepool_unlock(&n->lock);
+  }
+  return ret;
+}
+
+size_t upb_hugepool_bytescached(upb_hugepool *p) {
+  size_t i, ret = 0;
+  for (i = 0; i < UPB_HUGEPOOL_NODES; i++) {
+    upb_hugepool_node *n = &p->nodes[i];
+    hugepool_lock(&n->lock);
+    ret += n->bytes_cached;
+    hugepool_unlock(&n->lock);
+  }
+  return ret;
+}
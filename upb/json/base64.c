@@ -0,0 +1,229 @@
+/*
+** Base64 encoding and decoding for JSON.  See base64.int.h.
+*/
+
+#include "upb/json/base64.int.h"
+
+#include <string.h>
+
+/* SSSE3 kernels.  If the compiler isn't already targeting SSSE3 we build them
+ * with a target attribute and pick them at runtime. */
+#if defined(__SSSE3__)
+#define UPB_B64_SSSE3
+#define UPB_B64_TARGET
+#define UPB_B64_HAVE_SSSE3() 1
+#elif (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) ||                             \
+     (defined(__GNUC__) &&                             \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define UPB_B64_SSSE3
+#define UPB_B64_TARGET __attribute__((target("ssse3")))
+#define UPB_B64_HAVE_SSSE3() __builtin_cpu_supports("ssse3")
+#endif
+
+#ifdef UPB_B64_SSSE3
+#include <tmmintrin.h>
+#endif
+
+static const char kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+const signed char upb_json_b64table[256] = {
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      62/*+*/, -1,      -1,      -1,      63/*/ */,
+  52/*0*/, 53/*1*/, 54/*2*/, 55/*3*/, 56/*4*/, 57/*5*/, 58/*6*/, 59/*7*/,
+  60/*8*/, 61/*9*/, -1,      -1,      -1,      -1,      -1,      -1,
+  -1,       0/*A*/,  1/*B*/,  2/*C*/,  3/*D*/,  4/*E*/,  5/*F*/,  6/*G*/,
+  07/*H*/,  8/*I*/,  9/*J*/, 10/*K*/, 11/*L*/, 12/*M*/, 13/*N*/, 14/*O*/,
+  15/*P*/, 16/*Q*/, 17/*R*/, 18/*S*/, 19/*T*/, 20/*U*/, 21/*V*/, 22/*W*/,
+  23/*X*/, 24/*Y*/, 25/*Z*/, -1,      -1,      -1,      -1,      -1,
+  -1,      26/*a*/, 27/*b*/, 28/*c*/, 29/*d*/, 30/*e*/, 31/*f*/, 32/*g*/,
+  33/*h*/, 34/*i*/, 35/*j*/, 36/*k*/, 37/*l*/, 38/*m*/, 39/*n*/, 40/*o*/,
+  41/*p*/, 42/*q*/, 43/*r*/, 44/*s*/, 45/*t*/, 46/*u*/, 47/*v*/, 48/*w*/,
+  49/*x*/, 50/*y*/, 51/*z*/, -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1
+};
+
+
+/* Encoding *******************************************************************/
+
+#ifdef UPB_B64_SSSE3
+
+/* These follow Wojciech Mula and Daniel Lemire, "Faster Base64 Encoding and
+ * Decoding Using AVX2 Instructions" (2018), at SSE width. */
+
+/* Encodes 12 bytes from each 16 loaded, returning the number consumed. */
+UPB_B64_TARGET
+static size_t encode_ssse3(const unsigned char *from, size_t len, char *to) {
+  const unsigned char *start = from;
+
+  while (len - (from - start) >= 16) {
+    __m128i in = _mm_loadu_si128((const __m128i*)from);
+    __m128i t0, t1, t2, t3, indices, mask;
+
+    /* Spread the 12 bytes into four 6-bit fields per 32-bit lane. */
+    in = _mm_shuffle_epi8(
+        in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    in = _mm_or_si128(t1, t3);
+
+    /* Map each 6-bit value to its character by adding an offset that depends
+     * on which range of the alphabet it falls into. */
+    indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    mask = _mm_cmpgt_epi8(in, _mm_set1_epi8(25));
+    indices = _mm_sub_epi8(indices, mask);
+    in = _mm_add_epi8(
+        in, _mm_shuffle_epi8(_mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4,
+                                           -4, -4, -4, -19, -16, 0, 0),
+                             indices));
+
+    _mm_storeu_si128((__m128i*)to, in);
+    from += 12;
+    to += 16;
+  }
+
+  return from - start;
+}
+
+/* Decodes 16 characters at a time to 12 bytes, returning the number of
+ * characters consumed. */
+UPB_B64_TARGET
+static size_t decode_ssse3(const char *from, size_t len, char *to) {
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                       0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                       0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                       0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0,
+                                         0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+  const char *start = from;
+
+  /* Each iteration stores 16 bytes of which 12 are output, so stop while there
+   * is still room for the extra 4. */
+  while (len - (from - start) >= 24) {
+    __m128i in = _mm_loadu_si128((const __m128i*)from);
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    __m128i eq_2f = _mm_cmpeq_epi8(in, mask_2f);
+
+    /* Every character outside the alphabet has a bit set in both. */
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+                                         _mm_setzero_si128()))) {
+      break;
+    }
+
+    /* Characters to 6-bit values, then pack four of those into three bytes. */
+    in = _mm_add_epi8(
+        in, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+    in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                            13, 12, -1, -1, -1, -1));
+
+    _mm_storeu_si128((__m128i*)to, in);
+    from += 16;
+    to += 12;
+  }
+
+  return from - start;
+}
+
+#endif  /* UPB_B64_SSSE3 */
+
+size_t upb_json_b64encode(const char *from, size_t len, char *to) {
+  const unsigned char *in = (const unsigned char*)from;
+  const unsigned char *end = in + len;
+  char *start = to;
+
+#ifdef UPB_B64_SSSE3
+  if (UPB_B64_HAVE_SSSE3()) {
+    size_t n = encode_ssse3(in, len, to);
+    in += n;
+    to += n / 3 * 4;
+  }
+#endif
+
+  while (end - in > 2) {
+    to[0] = kAlphabet[in[0] >> 2];
+    to[1] = kAlphabet[((in[0] & 0x3) << 4) | (in[1] >> 4)];
+    to[2] = kAlphabet[((in[1] & 0xf) << 2) | (in[2] >> 6)];
+    to[3] = kAlphabet[in[2] & 0x3f];
+    in += 3;
+    to += 4;
+  }
+
+  switch (end - in) {
+    case 2:
+      to[0] = kAlphabet[in[0] >> 2];
+      to[1] = kAlphabet[((in[0] & 0x3) << 4) | (in[1] >> 4)];
+      to[2] = kAlphabet[(in[1] & 0xf) << 2];
+      to[3] = '=';
+      to += 4;
+      break;
+    case 1:
+      to[0] = kAlphabet[in[0] >> 2];
+      to[1] = kAlphabet[((in[0] & 0x3) << 4)];
+      to[2] = '=';
+      to[3] = '=';
+      to += 4;
+      break;
+  }
+
+  return to - start;
+}
+
+/* Decoding *******************************************************************/
+
+size_t upb_json_b64decode(const char *from, size_t len, char *to) {
+  const char *start = from;
+  const char *end = from + (len & ~(size_t)3);
+
+#ifdef UPB_B64_SSSE3
+  if (UPB_B64_HAVE_SSSE3()) {
+    size_t n = decode_ssse3(from, len, to);
+    from += n;
+    to += n / 4 * 3;
+  }
+#endif
+
+  for (; from < end; from += 4, to += 3) {
+    /* Sign-extended, so an invalid character sets the upper bit. */
+    uint32_t val =
+        (uint32_t)(int32_t)upb_json_b64table[(unsigned char)from[0]] << 18 |
+        (uint32_t)(int32_t)upb_json_b64table[(unsigned char)from[1]] << 12 |
+        (uint32_t)(int32_t)upb_json_b64table[(unsigned char)from[2]] << 6 |
+        (uint32_t)(int32_t)upb_json_b64table[(unsigned char)from[3]];
+    if (val & 0x80000000) break;
+    to[0] = (char)(val >> 16);
+    to[1] = (char)(val >> 8);
+    to[2] = (char)val;
+  }
+
+  return from - start;
+}
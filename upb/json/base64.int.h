@@ -0,0 +1,44 @@
+/*
+** Base64 encoding and decoding for JSON bytes fields, shared by the parser and
+** printer.  This is the regular base64 alphabet, not the "web-safe" one.
+**
+** Where the CPU supports it these use SSSE3 to process 12 bytes (16 base64
+** characters) at a time.
+*/
+
+#ifndef UPB_JSON_BASE64_H_
+#define UPB_JSON_BASE64_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "upb/upb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maps each character to its 6-bit value, or -1 if it is not in the base64
+ * alphabet (this includes the padding character '='). */
+extern const signed char upb_json_b64table[256];
+
+/* Encodes |len| bytes at |from| to |to|, with padding, and returns the number
+ * of characters written: exactly upb_json_b64encodedsize(len). */
+size_t upb_json_b64encode(const char *from, size_t len, char *to);
+
+UPB_INLINE size_t upb_json_b64encodedsize(size_t len) {
+  return (len + 2) / 3 * 4;
+}
+
+/* Decodes complete, unpadded groups of four characters from the |len| at
+ * |from|, stopping at the first group that contains padding or an invalid
+ * character, or that is incomplete.  Returns the number of characters
+ * consumed (a multiple of four) and writes three bytes per group to |to|.
+ * May write garbage to |to| past the decoded output, but never more than
+ * len / 4 * 3 bytes in total. */
+size_t upb_json_b64decode(const char *from, size_t len, char *to);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_JSON_BASE64_H_ */
@@ -0,0 +1,891 @@
+/*
+** upb_json_decode: a recursive-descent JSON parser that writes straight into
+** a upb_msg.  The structure follows upb/decode.c: values are written into the
+** slot given by the field's upb_msglayout entry and then marked present.
+**
+** Field names are looked up in the name table from upb_msgfactory.  Number
+** and base64 conversion are shared with the handlers-based parser, so the two
+** accept the same values.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include "upb/encode.h"
+#include "upb/json/base64.int.h"
+#include "upb/json/decode.h"
+#include "upb/json/number.int.h"
+#include "upb/json/scan.int.h"
+#include "upb/json/wellknown.int.h"
+#include "upb/structs.int.h"
+#include "upb/utf8.int.h"
+
+/* Objects and arrays may nest this deeply. */
+#define UPB_JSON_DECODE_MAXDEPTH 64
+
+#define CHK(x) if (!(x)) { return false; }
+
+typedef struct {
+  const char *ptr;
+  const char *end;
+  upb_msgfactory *factory;
+  upb_alloc *alloc;  /* The message's arena. */
+  int options;
+  int depth;
+  upb_status *status;
+} upb_jsondec;
+
+static bool upb_jsondec_object(upb_jsondec *d, char *msg, const upb_msgdef *m,
+                               const upb_msglayout *l, bool inany);
+static bool upb_jsondec_any(upb_jsondec *d, char *msg, const upb_msgdef *m,
+                            const upb_msglayout *l);
+static bool upb_jsondec_skipvalue(upb_jsondec *d);
+
+static bool upb_jsondec_err(upb_jsondec *d, const char *msg) {
+  upb_status_seterrmsg(d->status, msg);
+  return false;
+}
+
+static bool upb_jsondec_oom(upb_jsondec *d) {
+  return upb_jsondec_err(d, "Out of memory");
+}
+
+static void upb_jsondec_skipws(upb_jsondec *d) {
+  while (d->ptr < d->end) {
+    switch (*d->ptr) {
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+        d->ptr++;
+        break;
+      default:
+        return;
+    }
+  }
+}
+
+/* Skips whitespace and returns the next character without consuming it, or
+ * -1 at the end of input. */
+static int upb_jsondec_peek(upb_jsondec *d) {
+  upb_jsondec_skipws(d);
+  return d->ptr < d->end ? (unsigned char)*d->ptr : -1;
+}
+
+static bool upb_jsondec_consume(upb_jsondec *d, char c) {
+  if (upb_jsondec_peek(d) != (unsigned char)c) {
+    upb_status_seterrf(d->status, "Expected '%c'", c);
+    return false;
+  }
+  d->ptr++;
+  return true;
+}
+
+/* Consumes the comma between members or elements, if there is one. */
+static bool upb_jsondec_more(upb_jsondec *d) {
+  if (upb_jsondec_peek(d) == ',') {
+    d->ptr++;
+    return true;
+  }
+  return false;
+}
+
+static bool upb_jsondec_literal(upb_jsondec *d, const char *lit) {
+  size_t len = strlen(lit);
+  if ((size_t)(d->end - d->ptr) < len || memcmp(d->ptr, lit, len) != 0) {
+    return false;
+  }
+  d->ptr += len;
+  return true;
+}
+
+static bool upb_jsondec_push(upb_jsondec *d) {
+  if (++d->depth > UPB_JSON_DECODE_MAXDEPTH) {
+    return upb_jsondec_err(d, "Nesting too deep");
+  }
+  return true;
+}
+
+/* Strings ********************************************************************/
+
+static int upb_jsondec_hexdigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static bool upb_jsondec_hex4(upb_jsondec *d, const char **ptr,
+                             uint32_t *val) {
+  const char *p = *ptr;
+  int i;
+
+  CHK(d->end - p >= 4 || upb_jsondec_err(d, "Truncated \\u escape"));
+  *val = 0;
+  for (i = 0; i < 4; i++) {
+    int digit = upb_jsondec_hexdigit(p[i]);
+    CHK(digit >= 0 || upb_jsondec_err(d, "Invalid \\u escape"));
+    *val = (*val << 4) | digit;
+  }
+  *ptr = p + 4;
+  return true;
+}
+
+static char *upb_jsondec_pututf8(uint32_t cp, char *out) {
+  if (cp < 0x80) {
+    *out++ = cp;
+  } else if (cp < 0x800) {
+    *out++ = 0xc0 | (cp >> 6);
+    *out++ = 0x80 | (cp & 0x3f);
+  } else if (cp < 0x10000) {
+    *out++ = 0xe0 | (cp >> 12);
+    *out++ = 0x80 | ((cp >> 6) & 0x3f);
+    *out++ = 0x80 | (cp & 0x3f);
+  } else {
+    *out++ = 0xf0 | (cp >> 18);
+    *out++ = 0x80 | ((cp >> 12) & 0x3f);
+    *out++ = 0x80 | ((cp >> 6) & 0x3f);
+    *out++ = 0x80 | (cp & 0x3f);
+  }
+  return out;
+}
+
+/* Unescapes the |len| bytes of string body at |from| into |to|, which must
+ * have room for |len| bytes (no escape expands).  Returns the end of the
+ * output. */
+static char *upb_jsondec_unescape(upb_jsondec *d, const char *from,
+                                  size_t len, char *to) {
+  const char *end = from + len;
+
+  while (from < end) {
+    const char *plain = upb_json_skipplain(from, end, false);
+    uint32_t cp;
+
+    memcpy(to, from, plain - from);
+    to += plain - from;
+    from = plain;
+    if (from == end) break;
+
+    /* The scan in upb_jsondec_string() guarantees a character follows. */
+    UPB_ASSERT(*from == '\\');
+    from += 2;
+    switch (from[-1]) {
+      case '"':  *to++ = '"'; break;
+      case '\\': *to++ = '\\'; break;
+      case '/':  *to++ = '/'; break;
+      case 'b':  *to++ = '\b'; break;
+      case 'f':  *to++ = '\f'; break;
+      case 'n':  *to++ = '\n'; break;
+      case 'r':  *to++ = '\r'; break;
+      case 't':  *to++ = '\t'; break;
+      case 'u':
+        if (!upb_jsondec_hex4(d, &from, &cp)) return NULL;
+        if (cp >= 0xd800 && cp <= 0xdbff && end - from >= 6 &&
+            from[0] == '\\' && from[1] == 'u') {
+          /* A surrogate pair encodes one code point. */
+          const char *p = from + 2;
+          uint32_t low;
+          if (!upb_jsondec_hex4(d, &p, &low)) return NULL;
+          if (low >= 0xdc00 && low <= 0xdfff) {
+            cp = 0x10000 + (((cp - 0xd800) << 10) | (low - 0xdc00));
+            from = p;
+          }
+        }
+        to = upb_jsondec_pututf8(cp, to);
+        break;
+      default:
+        upb_jsondec_err(d, "Invalid escape");
+        return NULL;
+    }
+  }
+
+  return to;
+}
+
+/* Parses a string, returning its unescaped contents.  When the string has no
+ * escapes and |copy| is false, the result points into the input. */
+static bool upb_jsondec_string(upb_jsondec *d, bool copy,
+                               upb_stringview *str) {
+  const char *start;
+  const char *p;
+  bool escaped = false;
+  char *buf;
+  char *buf_end;
+
+  CHK(upb_jsondec_consume(d, '"'));
+  start = p = d->ptr;
+
+  for (;;) {
+    p = upb_json_skipplain(p, d->end, false);
+    CHK(p < d->end || upb_jsondec_err(d, "Unterminated string"));
+    if (*p == '"') break;
+    /* A backslash: skip it and the character it escapes.  Neither byte of
+     * the remainder of a \uXXXX escape can be special. */
+    CHK(d->end - p >= 2 || upb_jsondec_err(d, "Unterminated string"));
+    escaped = true;
+    p += 2;
+  }
+
+  d->ptr = p + 1;
+
+  if (!escaped && !copy) {
+    *str = upb_stringview_make(start, p - start);
+    return true;
+  } else if (p == start) {
+    *str = upb_stringview_make(NULL, 0);
+    return true;
+  }
+
+  buf = upb_malloc(d->alloc, p - start);
+  CHK(buf || upb_jsondec_oom(d));
+  if (escaped) {
+    buf_end = upb_jsondec_unescape(d, start, p - start, buf);
+    CHK(buf_end);
+  } else {
+    memcpy(buf, start, p - start);
+    buf_end = buf + (p - start);
+  }
+
+  *str = upb_stringview_make(buf, buf_end - buf);
+  return true;
+}
+
+/* Decodes the base64 in |str| into new memory in the arena. */
+static bool upb_jsondec_base64(upb_jsondec *d, upb_stringview *str) {
+  const char *from = str->data;
+  size_t len = str->size;
+  size_t n;
+  char *out;
+  char *to;
+
+  if (len % 4 != 0) {
+    return upb_jsondec_err(d, "Base64 input is not a multiple of 4");
+  } else if (len == 0) {
+    return true;
+  }
+
+  out = upb_malloc(d->alloc, len / 4 * 3);
+  CHK(out || upb_jsondec_oom(d));
+
+  n = upb_json_b64decode(from, len, out);
+  to = out + n / 4 * 3;
+  from += n;
+  len -= n;
+
+  /* upb_json_b64decode() stops at the first group with padding (which may
+   * only be the last one) or an invalid character. */
+  if (len > 0) {
+    int32_t a = upb_json_b64table[(unsigned char)from[0]];
+    int32_t b = upb_json_b64table[(unsigned char)from[1]];
+    int32_t c = upb_json_b64table[(unsigned char)from[2]];
+    uint32_t val;
+
+    if (len != 4 || a < 0 || b < 0 || from[3] != '=' ||
+        (c < 0 && from[2] != '=')) {
+      return upb_jsondec_err(d, "Invalid base64");
+    }
+
+    val = ((uint32_t)a << 18) | ((uint32_t)b << 12);
+    *to++ = val >> 16;
+    if (c >= 0) {
+      val |= (uint32_t)c << 6;
+      *to++ = (val >> 8) & 0xff;
+    }
+  }
+
+  *str = upb_stringview_make(out, to - out);
+  return true;
+}
+
+/* Numbers ********************************************************************/
+
+/* Returns the text of a number, which may be quoted. */
+static bool upb_jsondec_numbertext(upb_jsondec *d, upb_stringview *text,
+                                   bool *quoted) {
+  const char *start;
+
+  if (upb_jsondec_peek(d) == '"') {
+    *quoted = true;
+    return upb_jsondec_string(d, false, text);
+  }
+
+  *quoted = false;
+  start = d->ptr;
+  while (d->ptr < d->end) {
+    char c = *d->ptr;
+    if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' ||
+        c == 'e' || c == 'E') {
+      d->ptr++;
+    } else {
+      break;
+    }
+  }
+
+  CHK(d->ptr > start || upb_jsondec_err(d, "Expected a number"));
+  *text = upb_stringview_make(start, d->ptr - start);
+  return true;
+}
+
+/* Parses a number into |out|, which has type |type|.  Accepts the same forms
+ * as the handlers-based parser: quoted or unquoted, and for integer types,
+ * any unquoted double with an integral value in range. */
+static bool upb_jsondec_number(upb_jsondec *d, upb_fieldtype_t type,
+                               void *out) {
+  upb_stringview text;
+  bool quoted;
+  double val;
+  double dummy;
+  double inf = 1.0 / 0.0;  /* C89 does not have an INFINITY macro. */
+
+  CHK(upb_jsondec_numbertext(d, &text, &quoted));
+
+  switch (type) {
+    case UPB_TYPE_ENUM:
+    case UPB_TYPE_INT32: {
+      int64_t i64;
+      if (upb_json_parseint64(text.data, text.size, &i64)) {
+        int32_t i32 = (int32_t)i64;
+        CHK(i64 <= INT32_MAX && i64 >= INT32_MIN);
+        memcpy(out, &i32, sizeof(i32));
+        return true;
+      }
+      break;
+    }
+    case UPB_TYPE_UINT32: {
+      uint64_t u64;
+      if (upb_json_parseuint64(text.data, text.size, &u64)) {
+        uint32_t u32 = (uint32_t)u64;
+        CHK(u64 <= UINT32_MAX);
+        memcpy(out, &u32, sizeof(u32));
+        return true;
+      }
+      break;
+    }
+    case UPB_TYPE_INT64: {
+      int64_t i64;
+      if (upb_json_parseint64(text.data, text.size, &i64)) {
+        memcpy(out, &i64, sizeof(i64));
+        return true;
+      }
+      break;
+    }
+    case UPB_TYPE_UINT64: {
+      uint64_t u64;
+      if (upb_json_parseuint64(text.data, text.size, &u64)) {
+        memcpy(out, &u64, sizeof(u64));
+        return true;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  if (type != UPB_TYPE_DOUBLE && type != UPB_TYPE_FLOAT && quoted) {
+    /* Quoted numbers for integer types are not allowed to be in double form. */
+    return false;
+  }
+
+  CHK(upb_json_parsedouble(text.data, text.size, &val));
+
+  switch (type) {
+#define CASE(capitaltype, ctype, min, max)                         \
+    case UPB_TYPE_ ## capitaltype: {                               \
+      ctype v;                                                     \
+      CHK(modf(val, &dummy) == 0 && val >= min && val < max);      \
+      v = (ctype)val;                                              \
+      memcpy(out, &v, sizeof(v));                                  \
+      return true;                                                 \
+    }
+    /* |max| is exclusive, and a power of two so that it is exact. */
+    case UPB_TYPE_ENUM:
+    CASE(INT32, int32_t, -2147483648.0, 2147483648.0);
+    CASE(INT64, int64_t, -9223372036854775808.0, 9223372036854775808.0);
+    CASE(UINT32, uint32_t, 0, 4294967296.0);
+    CASE(UINT64, uint64_t, 0, 18446744073709551616.0);
+#undef CASE
+
+    case UPB_TYPE_DOUBLE:
+      memcpy(out, &val, sizeof(val));
+      return true;
+    case UPB_TYPE_FLOAT: {
+      float f = val;
+      CHK(!((val > FLT_MAX || val < -FLT_MAX) && val != inf && val != -inf));
+      memcpy(out, &f, sizeof(f));
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+/* Fields *********************************************************************/
+
+static upb_array *upb_jsondec_getorcreatearr(upb_jsondec *d, char *msg,
+                                             const upb_fielddef *f,
+                                             const upb_msglayout_field *field) {
+  upb_array **arrp = (upb_array**)&msg[field->offset];
+
+  if (!*arrp) {
+    *arrp = upb_array_new(upb_fielddef_type(f), upb_msg_arena(msg));
+    if (!*arrp) {
+      upb_jsondec_oom(d);
+    }
+  }
+
+  return *arrp;
+}
+
+static upb_map *upb_jsondec_getorcreatemap(upb_jsondec *d, char *msg,
+                                           const upb_fielddef *key_f,
+                                           const upb_fielddef *val_f,
+                                           const upb_msglayout_field *field) {
+  upb_map **mapp = (upb_map**)&msg[field->offset];
+
+  if (!*mapp) {
+    *mapp = upb_map_new(upb_fielddef_type(key_f), upb_fielddef_type(val_f),
+                        upb_msg_arena(msg));
+    if (!*mapp) {
+      upb_jsondec_oom(d);
+    }
+  }
+
+  return *mapp;
+}
+
+/* Returns a slot for one more element at the end of |arr| (without counting
+ * it in |len| yet). */
+static void *upb_jsondec_arrayslot(upb_array *arr) {
+  if (arr->len == arr->size &&
+      !upb_array_realloc(arr, UPB_MAX(arr->size * 2, 8))) {
+    return NULL;
+  }
+  return (char*)arr->data + arr->len * arr->element_size;
+}
+
+static void upb_jsondec_setpresent(char *msg,
+                                   const upb_msglayout_field *field) {
+  if (field->presence < 0) {
+    uint32_t number = field->number;
+    memcpy(msg + ~field->presence, &number, sizeof(number));
+  } else if (field->presence > 0) {
+    int32_t hasbit = field->presence;
+    msg[hasbit / 8] |= (1 << (hasbit % 8));
+  }
+}
+
+/* Parses a single value of field |f| into |slot|.  For message fields, |slot|
+ * holds the submessage pointer, which is created if it is NULL. */
+static bool upb_jsondec_value(upb_jsondec *d, char *msg, const upb_fielddef *f,
+                              const upb_msglayout *l,
+                              const upb_msglayout_field *field, void *slot) {
+  upb_fieldtype_t type = upb_fielddef_type(f);
+
+  switch (type) {
+    case UPB_TYPE_BOOL: {
+      bool val;
+      upb_jsondec_skipws(d);
+      if (upb_jsondec_literal(d, "true")) {
+        val = true;
+      } else if (upb_jsondec_literal(d, "false")) {
+        val = false;
+      } else {
+        return upb_jsondec_err(d, "Expected true or false");
+      }
+      memcpy(slot, &val, sizeof(val));
+      return true;
+    }
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES: {
+      upb_stringview str;
+      if (type == UPB_TYPE_BYTES) {
+        /* Bytes are always copied, since they must be decoded. */
+        CHK(upb_jsondec_string(d, false, &str));
+        CHK(upb_jsondec_base64(d, &str));
+      } else {
+        CHK(upb_jsondec_string(d, d->options & UPB_JSON_DECODE_COPYSTRINGS,
+                               &str));
+        /* Checked after unescaping, so escapes must also form valid UTF-8. */
+        CHK(!(d->options & UPB_JSON_DECODE_VALIDATEUTF8) ||
+            upb_utf8_isvalid(str.data, str.size) ||
+            upb_jsondec_err(d, "Invalid UTF-8 in string"));
+      }
+      memcpy(slot, &str, sizeof(str));
+      return true;
+    }
+    case UPB_TYPE_MESSAGE: {
+      const upb_msgdef *subm = upb_fielddef_msgsubdef(f);
+      const upb_msglayout *subl = l->submsgs[field->submsg_index];
+      char *submsg = *(char**)slot;
+
+      if (upb_json_hasspecialmapping(subm) && !upb_json_isany(subm)) {
+        upb_status_seterrf(d->status, "%s is not supported",
+                           upb_msgdef_fullname(subm));
+        return false;
+      }
+
+      if (submsg && upb_islazymsg(submsg)) {
+        /* Merging into a submessage UPB_DECODE_LAZY left unparsed. */
+        submsg = upb_decode_lazy((void**)slot, subl);
+        CHK(submsg || upb_jsondec_err(d, "Couldn't parse lazy submessage"));
+      }
+
+      if (!submsg) {
+        submsg = upb_msg_new(subl, upb_msg_arena(msg));
+        CHK(submsg || upb_jsondec_oom(d));
+        *(char**)slot = submsg;
+      }
+
+      return upb_json_isany(subm) ? upb_jsondec_any(d, submsg, subm, subl)
+                                  : upb_jsondec_object(d, submsg, subm, subl,
+                                                       false);
+    }
+    case UPB_TYPE_ENUM:
+      if (upb_jsondec_peek(d) == '"') {
+        upb_stringview name;
+        int32_t val;
+        CHK(upb_jsondec_string(d, false, &name));
+        if (!upb_enumdef_ntoi(upb_fielddef_enumsubdef(f), name.data, name.size,
+                              &val)) {
+          upb_status_seterrf(d->status, "Enum value unknown: '%.*s'",
+                             (int)name.size, name.data);
+          return false;
+        }
+        memcpy(slot, &val, sizeof(val));
+        return true;
+      }
+      /* Fallthrough. */
+    default:
+      if (!upb_jsondec_number(d, type, slot)) {
+        upb_status_seterrf(d->status, "Invalid value for field %s",
+                           upb_fielddef_name(f));
+        return false;
+      }
+      return true;
+  }
+}
+
+/* Parses a key of map field |f|, which JSON always quotes, as the type of
+ * |key_f|. */
+static bool upb_jsondec_mapkey(upb_jsondec *d, const upb_fielddef *f,
+                               const upb_fielddef *key_f, upb_msgval *key) {
+  upb_stringview str;
+
+  if (upb_jsondec_peek(d) != '"') {
+    return upb_jsondec_err(d, "Expected a string");
+  }
+
+  switch (upb_fielddef_type(key_f)) {
+    case UPB_TYPE_STRING:
+      /* upb_map_set() copies string keys. */
+      CHK(upb_jsondec_string(d, false, &str));
+      CHK(!(d->options & UPB_JSON_DECODE_VALIDATEUTF8) ||
+          upb_utf8_isvalid(str.data, str.size) ||
+          upb_jsondec_err(d, "Invalid UTF-8 in string"));
+      *key = upb_msgval_str(str);
+      return true;
+    case UPB_TYPE_BOOL:
+      CHK(upb_jsondec_string(d, false, &str));
+      if (str.size == 4 && memcmp(str.data, "true", 4) == 0) {
+        *key = upb_msgval_bool(true);
+      } else if (str.size == 5 && memcmp(str.data, "false", 5) == 0) {
+        *key = upb_msgval_bool(false);
+      } else {
+        return upb_jsondec_err(d, "Expected true or false");
+      }
+      return true;
+    default:
+      if (!upb_jsondec_number(d, upb_fielddef_type(key_f), key)) {
+        upb_status_seterrf(d->status, "Invalid key for map field %s",
+                           upb_fielddef_name(f));
+        return false;
+      }
+      return true;
+  }
+}
+
+/* Parses a JSON object of "key": value members into map field |f|. */
+static bool upb_jsondec_map(upb_jsondec *d, char *msg, const upb_fielddef *f,
+                            const upb_msglayout *l,
+                            const upb_msglayout_field *field) {
+  const upb_msgdef *entry = upb_fielddef_msgsubdef(f);
+  const upb_fielddef *key_f = upb_msgdef_itof(entry, UPB_MAPENTRY_KEY);
+  const upb_fielddef *val_f = upb_msgdef_itof(entry, UPB_MAPENTRY_VALUE);
+  const upb_msglayout *entryl = l->submsgs[field->submsg_index];
+  const upb_msglayout_field *key_field;
+  const upb_msglayout_field *val_field;
+  upb_map *map = upb_jsondec_getorcreatemap(d, msg, key_f, val_f, field);
+
+  CHK(map);
+  upb_mapentry_fields(entryl, &key_field, &val_field);
+  CHK(upb_jsondec_consume(d, '{'));
+  CHK(upb_jsondec_push(d));
+
+  if (upb_jsondec_peek(d) != '}') {
+    do {
+      upb_msgval key;
+      upb_msgval val;
+
+      CHK(upb_jsondec_mapkey(d, f, key_f, &key));
+      CHK(upb_jsondec_consume(d, ':'));
+      /* Message values are created by upb_jsondec_value(). */
+      memset(&val, 0, sizeof(val));
+      CHK(upb_jsondec_value(d, msg, val_f, entryl, val_field, &val));
+      CHK(upb_map_set(map, key, val, NULL) || upb_jsondec_oom(d));
+    } while (upb_jsondec_more(d));
+  }
+
+  d->depth--;
+  return upb_jsondec_consume(d, '}');
+}
+
+static bool upb_jsondec_field(upb_jsondec *d, char *msg, const upb_fielddef *f,
+                              const upb_msglayout *l) {
+  const upb_msglayout_field *field = &l->fields[upb_fielddef_index(f)];
+
+  upb_jsondec_skipws(d);
+  if (upb_jsondec_literal(d, "null")) {
+    /* Same as leaving the field unset. */
+    return true;
+  }
+
+  if (upb_fielddef_ismap(f)) {
+    return upb_jsondec_map(d, msg, f, l, field);
+  } else if (upb_fielddef_isseq(f)) {
+    upb_array *arr = upb_jsondec_getorcreatearr(d, msg, f, field);
+
+    CHK(arr);
+    arr->dirty = true;
+    CHK(upb_jsondec_consume(d, '['));
+    CHK(upb_jsondec_push(d));
+
+    if (upb_jsondec_peek(d) != ']') {
+      do {
+        void *slot = upb_jsondec_arrayslot(arr);
+        CHK(slot || upb_jsondec_oom(d));
+        if (upb_fielddef_issubmsg(f)) {
+          /* A freshly reserved slot is uninitialized memory. */
+          *(void**)slot = NULL;
+        }
+        CHK(upb_jsondec_value(d, msg, f, l, field, slot));
+        arr->len++;
+      } while (upb_jsondec_more(d));
+    }
+
+    d->depth--;
+    return upb_jsondec_consume(d, ']');
+  } else {
+    void *slot = msg + field->offset;
+    if (field->presence < 0 && upb_fielddef_issubmsg(f)) {
+      /* The slot is shared with the rest of the oneof: unless this field is
+       * the one that is set it doesn't hold a message. */
+      uint32_t oneof_case;
+      memcpy(&oneof_case, msg + ~field->presence, sizeof(oneof_case));
+      if (oneof_case != field->number) {
+        *(void**)slot = NULL;
+      }
+    }
+    CHK(upb_jsondec_value(d, msg, f, l, field, slot));
+    upb_jsondec_setpresent(msg, field);
+    return true;
+  }
+}
+
+/* Skips over any JSON value, for unknown fields. */
+static bool upb_jsondec_skipvalue(upb_jsondec *d) {
+  upb_stringview str;
+  int c = upb_jsondec_peek(d);
+
+  switch (c) {
+    case '"':
+      return upb_jsondec_string(d, false, &str);
+    case '{':
+    case '[': {
+      char close = c == '{' ? '}' : ']';
+      d->ptr++;
+      CHK(upb_jsondec_push(d));
+      if (upb_jsondec_peek(d) != close) {
+        do {
+          if (c == '{') {
+            CHK(upb_jsondec_string(d, false, &str));
+            CHK(upb_jsondec_consume(d, ':'));
+          }
+          CHK(upb_jsondec_skipvalue(d));
+        } while (upb_jsondec_more(d));
+      }
+      d->depth--;
+      return upb_jsondec_consume(d, close);
+    }
+    case 't':
+    case 'f':
+    case 'n':
+      if (upb_jsondec_literal(d, "true") || upb_jsondec_literal(d, "false") ||
+          upb_jsondec_literal(d, "null")) {
+        return true;
+      }
+      return upb_jsondec_err(d, "Invalid value");
+    default: {
+      bool quoted;
+      double val;
+      CHK(upb_jsondec_numbertext(d, &str, &quoted));
+      if (!upb_json_parsedouble(str.data, str.size, &val)) {
+        return upb_jsondec_err(d, "Invalid number");
+      }
+      return true;
+    }
+  }
+}
+
+/* Returns true if |name| is the "@type" member of an Any. */
+static bool upb_jsondec_istype(upb_stringview name) {
+  return name.size == 5 && memcmp(name.data, "@type", 5) == 0;
+}
+
+/* Parses an object into |msg|.  If |inany|, |msg| is the message embedded in
+ * an Any and the object's "@type" member is skipped. */
+static bool upb_jsondec_object(upb_jsondec *d, char *msg, const upb_msgdef *m,
+                               const upb_msglayout *l, bool inany) {
+  const upb_strtable *names = upb_msgfactory_getnametable(d->factory, m);
+
+  CHK(names || upb_jsondec_oom(d));
+  upb_msg_invalidatesize(msg);
+  CHK(upb_jsondec_consume(d, '{'));
+  CHK(upb_jsondec_push(d));
+
+  if (upb_jsondec_peek(d) != '}') {
+    do {
+      upb_stringview name;
+      upb_value v;
+
+      CHK(upb_jsondec_string(d, false, &name));
+      CHK(upb_jsondec_consume(d, ':'));
+
+      if (upb_strtable_lookup2(names, name.data, name.size, &v)) {
+        CHK(upb_jsondec_field(d, msg, upb_value_getconstptr(v), l));
+      } else if ((inany && upb_jsondec_istype(name)) ||
+                 (d->options & UPB_JSON_DECODE_IGNOREUNKNOWN)) {
+        CHK(upb_jsondec_skipvalue(d));
+      } else {
+        upb_status_seterrf(d->status, "No such field: %.*s",
+                           (int)name.size, name.data);
+        return false;
+      }
+    } while (upb_jsondec_more(d));
+  }
+
+  d->depth--;
+  return upb_jsondec_consume(d, '}');
+}
+
+/* Sets string field |number| of |msg|, which is type_url or value of a
+ * google.protobuf.Any. */
+static void upb_jsondec_setanyfield(char *msg, const upb_msglayout *l,
+                                    const upb_msgdef *m, uint32_t number,
+                                    upb_stringview val) {
+  const upb_fielddef *f = upb_msgdef_itof(m, number);
+  const upb_msglayout_field *field = &l->fields[upb_fielddef_index(f)];
+  memcpy(msg + field->offset, &val, sizeof(val));
+  upb_jsondec_setpresent(msg, field);
+}
+
+/* Parses a google.protobuf.Any.  Its "@type" may come after the fields it
+ * describes, so we first scan the object for it, then parse the object again
+ * as the embedded message and encode that into the value field. */
+static bool upb_jsondec_any(upb_jsondec *d, char *msg, const upb_msgdef *m,
+                            const upb_msglayout *l) {
+  const char *start;
+  int depth = d->depth;
+  upb_stringview url = upb_stringview_make(NULL, 0);
+  upb_stringview value;
+  size_t members = 0;
+  const upb_msglayout *subl;
+  const upb_msgdef *subm;
+  upb_arena *arena = upb_msg_arena(msg);
+  upb_msg *submsg;
+
+  upb_msg_invalidatesize(msg);
+  upb_jsondec_skipws(d);
+  start = d->ptr;
+  CHK(upb_jsondec_consume(d, '{'));
+  CHK(upb_jsondec_push(d));
+
+  if (upb_jsondec_peek(d) != '}') {
+    do {
+      upb_stringview name;
+      CHK(upb_jsondec_string(d, false, &name));
+      CHK(upb_jsondec_consume(d, ':'));
+      members++;
+      if (upb_jsondec_istype(name)) {
+        CHK(upb_jsondec_string(d, d->options & UPB_JSON_DECODE_COPYSTRINGS,
+                               &url));
+        break;
+      }
+      CHK(upb_jsondec_skipvalue(d));
+    } while (upb_jsondec_more(d));
+  }
+
+  if (members == 0) {
+    /* The empty Any. */
+    d->depth--;
+    return upb_jsondec_consume(d, '}');
+  } else if (!url.data) {
+    return upb_jsondec_err(d, "Any is missing @type");
+  }
+
+  subm = upb_msgfactory_getanytype(d->factory, url.data, url.size, &subl);
+  if (!subm) {
+    upb_status_seterrf(d->status, "Unknown type URL: %.*s", (int)url.size,
+                       url.data);
+    return false;
+  } else if (upb_json_hasspecialmapping(subm)) {
+    upb_status_seterrf(d->status, "%s is not supported",
+                       upb_msgdef_fullname(subm));
+    return false;
+  }
+
+  submsg = upb_msg_new(subl, arena);
+  CHK(submsg || upb_jsondec_oom(d));
+  d->ptr = start;
+  d->depth = depth;
+  CHK(upb_jsondec_object(d, submsg, subm, subl, true));
+
+  value.data = upb_encode(submsg, subl, arena, &value.size);
+  CHK(value.data || upb_jsondec_oom(d));
+
+  upb_jsondec_setanyfield(msg, l, m, 1, url);
+  upb_jsondec_setanyfield(msg, l, m, 2, value);
+  return true;
+}
+
+bool upb_json_decode(upb_stringview buf, upb_msg *msg, const upb_msgdef *m,
+                     upb_msgfactory *factory, int options,
+                     upb_status *status) {
+  upb_jsondec d;
+
+  d.ptr = buf.data;
+  d.end = buf.data + buf.size;
+  d.factory = factory;
+  d.alloc = upb_arena_alloc(upb_msg_arena(msg));
+  d.options = options;
+  d.depth = 0;
+  d.status = status;
+
+  if (upb_json_isany(m)) {
+    CHK(upb_jsondec_any(&d, msg, m, upb_msgfactory_getlayout(factory, m)));
+  } else if (upb_json_hasspecialmapping(m)) {
+    upb_status_seterrf(status, "%s is not supported", upb_msgdef_fullname(m));
+    return false;
+  } else {
+    CHK(upb_jsondec_object(&d, msg, m, upb_msgfactory_getlayout(factory, m),
+                           false));
+  }
+
+  if (upb_jsondec_peek(&d) != -1) {
+    return upb_jsondec_err(&d, "Unexpected data after the message");
+  }
+
+  return true;
+}
+
+#undef CHK
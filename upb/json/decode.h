@@ -0,0 +1,54 @@
+/*
+** upb_json_decode: parsing JSON directly into a upb_msg.
+**
+** Unlike upb::json::Parser, this does not go through upb_handlers: it writes
+** fields straight into the message using the upb_msglayout, the same way
+** upb_decode() does for binary protobuf.  The whole input must be available
+** up front.
+**
+** Well-known types with a special JSON mapping (google.protobuf.Timestamp,
+** the wrapper types, etc.) are not yet supported; messages that contain them
+** fail to parse.  Use upb::json::Parser for those.  The exception is
+** google.protobuf.Any, whose "@type" is resolved with
+** upb_msgfactory_getanytype(): its embedded message is parsed and stored
+** encoded in the value field.
+*/
+
+#ifndef UPB_JSON_DECODE_H_
+#define UPB_JSON_DECODE_H_
+
+#include "upb/msg.h"
+#include "upb/msgfactory.h"
+
+UPB_BEGIN_EXTERN_C
+
+/* Options for upb_json_decode(), which may be OR'd together. */
+typedef enum {
+  /* Fields whose names aren't in the message are an error.  This is the
+   * default. */
+  UPB_JSON_DECODE_STRICT = 0,
+
+  /* Fields whose names aren't in the message are skipped. */
+  UPB_JSON_DECODE_IGNOREUNKNOWN = 1 << 0,
+
+  /* Like UPB_DECODE_COPYSTRINGS: string and bytes fields are always copied
+   * into the message's arena.  Otherwise strings with no escapes point
+   * directly into the input buffer, which must outlive the message. */
+  UPB_JSON_DECODE_COPYSTRINGS = 1 << 1,
+
+  /* Like UPB_DECODE_VALIDATEUTF8: string fields must be valid UTF-8 once
+   * unescaped. */
+  UPB_JSON_DECODE_VALIDATEUTF8 = 1 << 2
+} upb_json_decodeopt;
+
+/* Parses the JSON object in |buf| into |msg|, which must be a message of type
+ * |m| created with the layout upb_msgfactory_getlayout(factory, m).  Fields
+ * may be named by either their JSON name or their proto name.  On failure,
+ * returns false and sets |status| (if non-NULL); |msg| may then be partially
+ * populated. */
+bool upb_json_decode(upb_stringview buf, upb_msg *msg, const upb_msgdef *m,
+                     upb_msgfactory *factory, int options, upb_status *status);
+
+UPB_END_EXTERN_C
+
+#endif  /* UPB_JSON_DECODE_H_ */
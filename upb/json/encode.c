@@ -0,0 +1,497 @@
+/*
+** upb_json_encode: walks a upb_msg's memory using its upb_msglayout and
+** appends the JSON to a buffer that grows in the arena.  Field presence
+** follows upb_encode(): hasbits for proto2, oneof cases, and non-zero values
+** for proto3.
+**
+** Formatting is shared with the handlers-based printer (number.c, base64.c),
+** so the output is the same.
+*/
+
+#include <string.h>
+
+#include "upb/json/base64.int.h"
+#include "upb/json/encode.h"
+#include "upb/json/encode.int.h"
+#include "upb/json/number.int.h"
+#include "upb/json/scan.int.h"
+#include "upb/json/wellknown.int.h"
+#include "upb/structs.int.h"
+
+/* Messages may nest this deeply. */
+#define UPB_JSON_ENCODE_MAXDEPTH 64
+
+#define CHK(x) if (!(x)) { return false; }
+
+static bool upb_jsonenc_message(upb_jsonenc *e, const char *msg,
+                                const upb_msglayout *l, const upb_msgdef *m);
+
+/* Returns true if we can print messages of type |m|. */
+static bool upb_jsonenc_supported(const upb_jsonenc *e, const upb_msgdef *m) {
+  return !upb_json_hasspecialmapping(m) || (e->factory && upb_json_isany(m));
+}
+
+bool upb_jsonenc_grow(upb_jsonenc *e, size_t bytes) {
+  size_t used = e->ptr - e->buf;
+  size_t old_size = e->end - e->buf;
+  size_t new_size = UPB_MAX(old_size, 128);
+  char *new_buf;
+
+  while (new_size - used < bytes) {
+    new_size *= 2;
+  }
+
+  new_buf = upb_realloc(e->alloc, e->buf, old_size, new_size);
+  CHK(new_buf);
+
+  e->buf = new_buf;
+  e->ptr = new_buf + used;
+  e->end = new_buf + new_size;
+  return true;
+}
+
+/* Values *********************************************************************/
+
+UPB_INLINE const char *upb_jsonenc_niceescape(char c) {
+  switch (c) {
+    case '"':  return "\\\"";
+    case '\\': return "\\\\";
+    case '\b': return "\\b";
+    case '\f': return "\\f";
+    case '\n': return "\\n";
+    case '\r': return "\\r";
+    case '\t': return "\\t";
+    default:   return NULL;
+  }
+}
+
+bool upb_jsonenc_string(upb_jsonenc *e, const char *ptr, size_t len) {
+  const char *end = ptr + len;
+
+  CHK(upb_jsonenc_putc(e, '"'));
+
+  while (ptr < end) {
+    const char *run = ptr;
+    ptr = upb_json_skipplain(ptr, end, true);
+    CHK(upb_jsonenc_put(e, run, ptr - run));
+
+    if (ptr < end) {
+      const char *escape = upb_jsonenc_niceescape(*ptr);
+      if (escape) {
+        CHK(upb_jsonenc_put(e, escape, 2));
+      } else {
+        static const char kHex[] = "0123456789abcdef";
+        unsigned char byte = (unsigned char)*ptr;
+        char buf[6];
+        memcpy(buf, "\\u00", 4);
+        buf[4] = kHex[byte >> 4];
+        buf[5] = kHex[byte & 0xf];
+        CHK(upb_jsonenc_put(e, buf, sizeof(buf)));
+      }
+      ptr++;
+    }
+  }
+
+  return upb_jsonenc_putc(e, '"');
+}
+
+bool upb_jsonenc_bytes(upb_jsonenc *e, upb_stringview val) {
+  CHK(upb_jsonenc_reserve(e, upb_json_b64encodedsize(val.size) + 2));
+  *e->ptr++ = '"';
+  e->ptr += upb_json_b64encode(val.data, val.size, e->ptr);
+  *e->ptr++ = '"';
+  return true;
+}
+
+#define FMT(func, val)                                       \
+  {                                                          \
+    size_t n;                                                \
+    CHK(upb_jsonenc_reserve(e, UPB_JSONENC_NUMBER_MAX));     \
+    n = func(val, e->ptr, UPB_JSONENC_NUMBER_MAX);           \
+    CHK(n != (size_t)-1);                                    \
+    e->ptr += n;                                             \
+    return true;                                             \
+  }
+
+bool upb_jsonenc_enum(upb_jsonenc *e, const upb_enumdef *enumdef,
+                      int32_t val) {
+  const char *name = upb_enumdef_iton(enumdef, val);
+
+  if (name) {
+    /* Enum value names are identifiers, so they need no escaping. */
+    size_t len = strlen(name);
+    CHK(upb_jsonenc_reserve(e, len + 2));
+    *e->ptr++ = '"';
+    memcpy(e->ptr, name, len);
+    e->ptr += len;
+    *e->ptr++ = '"';
+    return true;
+  }
+
+  FMT(upb_json_fmtint64, val);
+}
+
+/* Writes the value at |mem|, which has the type of field |f|. */
+static bool upb_jsonenc_value(upb_jsonenc *e, const upb_fielddef *f,
+                              const upb_msglayout *l,
+                              const upb_msglayout_field *field,
+                              const char *mem) {
+  switch (upb_fielddef_type(f)) {
+    case UPB_TYPE_BOOL: {
+      bool val;
+      memcpy(&val, mem, sizeof(val));
+      return val ? upb_jsonenc_put(e, "true", 4)
+                 : upb_jsonenc_put(e, "false", 5);
+    }
+    case UPB_TYPE_INT32: {
+      int32_t val;
+      memcpy(&val, mem, sizeof(val));
+      FMT(upb_json_fmtint64, val);
+    }
+    case UPB_TYPE_UINT32: {
+      uint32_t val;
+      memcpy(&val, mem, sizeof(val));
+      FMT(upb_json_fmtint64, val);
+    }
+    case UPB_TYPE_INT64: {
+      int64_t val;
+      memcpy(&val, mem, sizeof(val));
+      FMT(upb_json_fmtint64, val);
+    }
+    case UPB_TYPE_UINT64: {
+      uint64_t val;
+      memcpy(&val, mem, sizeof(val));
+      FMT(upb_json_fmtuint64, val);
+    }
+    case UPB_TYPE_FLOAT: {
+      float val;
+      memcpy(&val, mem, sizeof(val));
+      FMT(upb_json_fmtfloat, val);
+    }
+    case UPB_TYPE_DOUBLE: {
+      double val;
+      memcpy(&val, mem, sizeof(val));
+      FMT(upb_json_fmtdouble, val);
+    }
+    case UPB_TYPE_ENUM: {
+      int32_t val;
+      memcpy(&val, mem, sizeof(val));
+      return upb_jsonenc_enum(e, upb_fielddef_enumsubdef(f), val);
+    }
+    case UPB_TYPE_STRING: {
+      upb_stringview val;
+      memcpy(&val, mem, sizeof(val));
+      return upb_jsonenc_string(e, val.data, val.size);
+    }
+    case UPB_TYPE_BYTES: {
+      upb_stringview val;
+      memcpy(&val, mem, sizeof(val));
+      return upb_jsonenc_bytes(e, val);
+    }
+    case UPB_TYPE_MESSAGE: {
+      const upb_msgdef *subm = upb_fielddef_msgsubdef(f);
+      const char *submsg;
+      memcpy(&submsg, mem, sizeof(submsg));
+      CHK(upb_jsonenc_supported(e, subm));
+      if (upb_islazymsg(submsg)) {
+        /* Left unparsed by UPB_DECODE_LAZY; parse it in place. */
+        submsg = upb_decode_lazy((void**)mem, l->submsgs[field->submsg_index]);
+        CHK(submsg);
+      }
+      return upb_jsonenc_message(e, submsg, l->submsgs[field->submsg_index],
+                                 subm);
+    }
+  }
+  UPB_UNREACHABLE();
+}
+
+#undef FMT
+
+/* Fields *********************************************************************/
+
+/* Returns true if the singular value at |mem| is zero, the proto3 default.
+ * This only needs the layout, so unset fields cost no upb_fielddef calls. */
+static bool upb_jsonenc_iszero(const upb_msglayout_field *field,
+                               const char *mem) {
+  switch (field->descriptortype) {
+    case UPB_DESCRIPTOR_TYPE_BOOL:
+      return !*(const bool*)mem;
+    case UPB_DESCRIPTOR_TYPE_INT32:
+    case UPB_DESCRIPTOR_TYPE_UINT32:
+    case UPB_DESCRIPTOR_TYPE_SINT32:
+    case UPB_DESCRIPTOR_TYPE_FIXED32:
+    case UPB_DESCRIPTOR_TYPE_SFIXED32:
+    case UPB_DESCRIPTOR_TYPE_ENUM: {
+      uint32_t val;
+      memcpy(&val, mem, sizeof(val));
+      return val == 0;
+    }
+    case UPB_DESCRIPTOR_TYPE_INT64:
+    case UPB_DESCRIPTOR_TYPE_UINT64:
+    case UPB_DESCRIPTOR_TYPE_SINT64:
+    case UPB_DESCRIPTOR_TYPE_FIXED64:
+    case UPB_DESCRIPTOR_TYPE_SFIXED64: {
+      uint64_t val;
+      memcpy(&val, mem, sizeof(val));
+      return val == 0;
+    }
+    case UPB_DESCRIPTOR_TYPE_FLOAT: {
+      float val;
+      memcpy(&val, mem, sizeof(val));
+      return val == 0;
+    }
+    case UPB_DESCRIPTOR_TYPE_DOUBLE: {
+      double val;
+      memcpy(&val, mem, sizeof(val));
+      return val == 0;
+    }
+    case UPB_DESCRIPTOR_TYPE_STRING:
+    case UPB_DESCRIPTOR_TYPE_BYTES: {
+      upb_stringview val;
+      memcpy(&val, mem, sizeof(val));
+      return val.size == 0;
+    }
+    case UPB_DESCRIPTOR_TYPE_MESSAGE:
+    case UPB_DESCRIPTOR_TYPE_GROUP: {
+      const void *val;
+      memcpy(&val, mem, sizeof(val));
+      return val == NULL;
+    }
+  }
+  UPB_UNREACHABLE();
+}
+
+/* Returns true if field |field| of |msg|, which has layout |l|, should be
+ * printed, mirroring upb_encode(). */
+static bool upb_jsonenc_hasfield(const char *msg, const upb_msglayout *l,
+                                 const upb_msglayout_field *field) {
+  const char *mem = msg + field->offset;
+
+  if (upb_msglayout_ismap(l, field)) {
+    const upb_map *map;
+    memcpy(&map, mem, sizeof(map));
+    return map && upb_map_size(map) > 0;
+  } else if (field->label == UPB_LABEL_REPEATED) {
+    const upb_array *arr;
+    memcpy(&arr, mem, sizeof(arr));
+    return arr && arr->len > 0;
+  } else if ((field->descriptortype == UPB_DESCRIPTOR_TYPE_MESSAGE ||
+              field->descriptortype == UPB_DESCRIPTOR_TYPE_GROUP) &&
+             upb_jsonenc_iszero(field, mem)) {
+    /* No submessage was ever allocated, whatever the presence says. */
+    return false;
+  } else if (field->presence == 0) {
+    /* Proto3 presence: skip zero values. */
+    return !upb_jsonenc_iszero(field, mem);
+  } else if (field->presence > 0) {
+    /* Proto2 presence: hasbit. */
+    int32_t hasbit = field->presence;
+    return msg[hasbit / 8] & (1 << (hasbit % 8));
+  } else {
+    /* Field is in a oneof. */
+    uint32_t oneof_case;
+    memcpy(&oneof_case, msg + ~field->presence, sizeof(oneof_case));
+    return oneof_case == field->number;
+  }
+}
+
+/* Writes "name": for field |f|.  Field names are identifiers, so they need
+ * no escaping. */
+static bool upb_jsonenc_key(upb_jsonenc *e, const upb_fielddef *f) {
+  const char *name = upb_fielddef_name(f);
+  size_t len = strlen(name);
+
+  CHK(upb_jsonenc_reserve(e, len + 3));
+  *e->ptr++ = '"';
+
+  if (e->options & UPB_JSON_ENCODE_PRESERVEFIELDNAMES) {
+    memcpy(e->ptr, name, len);
+    e->ptr += len;
+  } else {
+    /* Same conversion as upb_fielddef_getjsonname(), which the JSON name can
+     * never be longer than. */
+    bool ucase_next = false;
+    for (; *name; name++) {
+      if (*name == '_') {
+        ucase_next = true;
+      } else if (ucase_next && *name >= 'a' && *name <= 'z') {
+        *e->ptr++ = *name - 'a' + 'A';
+        ucase_next = false;
+      } else {
+        *e->ptr++ = *name;
+        ucase_next = false;
+      }
+    }
+  }
+
+  *e->ptr++ = '"';
+  *e->ptr++ = ':';
+  return true;
+}
+
+/* Writes map field |f| as an object.  Keys are strings, or integers and
+ * bools printed inside quotes. */
+static bool upb_jsonenc_map(upb_jsonenc *e, const char *msg,
+                            const upb_fielddef *f, const upb_msglayout *l,
+                            const upb_msglayout_field *field) {
+  const upb_msgdef *entry = upb_fielddef_msgsubdef(f);
+  const upb_fielddef *key_f = upb_msgdef_itof(entry, UPB_MAPENTRY_KEY);
+  const upb_fielddef *val_f = upb_msgdef_itof(entry, UPB_MAPENTRY_VALUE);
+  const upb_msglayout *entryl = l->submsgs[field->submsg_index];
+  const upb_msglayout_field *key_field;
+  const upb_msglayout_field *val_field;
+  bool quote = upb_fielddef_type(key_f) != UPB_TYPE_STRING;
+  const upb_map *map;
+  upb_mapiter i;
+  bool first = true;
+
+  memcpy(&map, msg + field->offset, sizeof(map));
+  upb_mapentry_fields(entryl, &key_field, &val_field);
+  CHK(upb_jsonenc_putc(e, '{'));
+
+  for (upb_mapiter_begin(&i, map); !upb_mapiter_done(&i);
+       upb_mapiter_next(&i)) {
+    /* Every value is at the start of its upb_msgval. */
+    upb_msgval key = upb_mapiter_key(&i);
+    upb_msgval val = upb_mapiter_value(&i);
+
+    if (!first) CHK(upb_jsonenc_putc(e, ','));
+    first = false;
+    if (quote) CHK(upb_jsonenc_putc(e, '"'));
+    CHK(upb_jsonenc_value(e, key_f, entryl, key_field, (const char*)&key));
+    if (quote) CHK(upb_jsonenc_putc(e, '"'));
+    CHK(upb_jsonenc_putc(e, ':'));
+    CHK(upb_jsonenc_value(e, val_f, entryl, val_field, (const char*)&val));
+  }
+
+  return upb_jsonenc_putc(e, '}');
+}
+
+static bool upb_jsonenc_field(upb_jsonenc *e, const char *msg,
+                              const upb_fielddef *f, const upb_msglayout *l,
+                              const upb_msglayout_field *field) {
+  CHK(upb_jsonenc_key(e, f));
+
+  if (upb_fielddef_ismap(f)) {
+    return upb_jsonenc_map(e, msg, f, l, field);
+  } else if (field->label == UPB_LABEL_REPEATED) {
+    const upb_array *arr;
+    const char *ptr;
+    size_t i;
+
+    memcpy(&arr, msg + field->offset, sizeof(arr));
+    ptr = arr->data;
+    CHK(upb_jsonenc_putc(e, '['));
+    for (i = 0; i < arr->len; i++, ptr += arr->element_size) {
+      if (i > 0) CHK(upb_jsonenc_putc(e, ','));
+      CHK(upb_jsonenc_value(e, f, l, field, ptr));
+    }
+    return upb_jsonenc_putc(e, ']');
+  } else {
+    return upb_jsonenc_value(e, f, l, field, msg + field->offset);
+  }
+}
+
+/* Writes the members of |msg|, with a leading comma unless |first|. */
+static bool upb_jsonenc_fields(upb_jsonenc *e, const char *msg,
+                               const upb_msglayout *l, const upb_msgdef *m,
+                               bool first) {
+  int i;
+
+  /* Fields come out in layout order: submessages first, then by number. */
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *field = &l->fields[i];
+    const upb_fielddef *f;
+
+    if (!upb_jsonenc_hasfield(msg, l, field)) continue;
+
+    f = upb_msgdef_itof(m, field->number);
+    if (!first) CHK(upb_jsonenc_putc(e, ','));
+    first = false;
+    CHK(upb_jsonenc_field(e, msg, f, l, field));
+  }
+
+  return true;
+}
+
+/* Reads string field |number| of |msg|, which is type_url or value of a
+ * google.protobuf.Any. */
+static upb_stringview upb_jsonenc_anyfield(const char *msg,
+                                           const upb_msglayout *l,
+                                           const upb_msgdef *m,
+                                           uint32_t number) {
+  const upb_fielddef *f = upb_msgdef_itof(m, number);
+  upb_stringview ret;
+  memcpy(&ret, msg + l->fields[upb_fielddef_index(f)].offset, sizeof(ret));
+  return ret;
+}
+
+/* Writes a google.protobuf.Any as the embedded message's members plus
+ * "@type".  The embedded message is decoded into the output's arena. */
+static bool upb_jsonenc_any(upb_jsonenc *e, const char *msg,
+                            const upb_msglayout *l, const upb_msgdef *m) {
+  upb_stringview url = upb_jsonenc_anyfield(msg, l, m, 1);
+  upb_stringview value = upb_jsonenc_anyfield(msg, l, m, 2);
+  const upb_msglayout *subl;
+  const upb_msgdef *subm;
+  upb_msg *submsg;
+
+  if (url.size == 0 && value.size == 0) {
+    return true;  /* The empty Any prints as {}. */
+  }
+
+  subm = upb_msgfactory_getanytype(e->factory, url.data, url.size, &subl);
+  CHK(subm && !upb_json_hasspecialmapping(subm));
+  submsg = upb_msg_new(subl, e->arena);
+  CHK(submsg && upb_decode(value, submsg, subl));
+
+  CHK(upb_jsonenc_put(e, "\"@type\":", 8));
+  CHK(upb_jsonenc_string(e, url.data, url.size));
+  return upb_jsonenc_fields(e, submsg, subl, subm, false);
+}
+
+static bool upb_jsonenc_message(upb_jsonenc *e, const char *msg,
+                                const upb_msglayout *l, const upb_msgdef *m) {
+  CHK(++e->depth <= UPB_JSON_ENCODE_MAXDEPTH);
+  CHK(upb_jsonenc_putc(e, '{'));
+
+  if (e->factory && upb_json_isany(m)) {
+    CHK(upb_jsonenc_any(e, msg, l, m));
+  } else {
+    CHK(upb_jsonenc_fields(e, msg, l, m, true));
+  }
+
+  e->depth--;
+  return upb_jsonenc_putc(e, '}');
+}
+
+char *upb_json_encode(const upb_msg *msg, const upb_msglayout *l,
+                      const upb_msgdef *m, upb_arena *arena, int options,
+                      size_t *size) {
+  return upb_json_encode2(msg, l, m, NULL, arena, options, size);
+}
+
+char *upb_json_encode2(const upb_msg *msg, const upb_msglayout *l,
+                       const upb_msgdef *m, upb_msgfactory *factory,
+                       upb_arena *arena, int options, size_t *size) {
+  upb_jsonenc e;
+
+  e.alloc = upb_arena_alloc(arena);
+  e.arena = arena;
+  e.factory = factory;
+  e.buf = NULL;
+  e.ptr = NULL;
+  e.end = NULL;
+  e.options = options;
+  e.depth = 0;
+
+  if (!upb_jsonenc_supported(&e, m) || !upb_jsonenc_message(&e, msg, l, m)) {
+    *size = 0;
+    return NULL;
+  }
+
+  *size = e.ptr - e.buf;
+  return e.buf;
+}
+
+#undef CHK
@@ -0,0 +1,53 @@
+/*
+** upb_json_encode: printing a upb_msg as JSON.
+**
+** Unlike upb::json::Printer, this does not go through upb_handlers: it reads
+** fields straight out of the message using the upb_msglayout, the same way
+** upb_encode() does for binary protobuf.  The output is the same as the
+** printer's, except that fields come out in layout order (submessages first,
+** then by field number) rather than in the order they were parsed, and map
+** entries in the upb_map's iteration order.
+**
+** As with upb_json_decode(), well-known types with a special JSON mapping are
+** not yet supported, except that upb_json_encode2() prints
+** google.protobuf.Any.
+*/
+
+#ifndef UPB_JSON_ENCODE_H_
+#define UPB_JSON_ENCODE_H_
+
+#include "upb/def.h"
+#include "upb/msg.h"
+#include "upb/msgfactory.h"
+
+UPB_BEGIN_EXTERN_C
+
+/* Options for upb_json_encode(), which may be OR'd together. */
+typedef enum {
+  /* Fields are named by their JSON names (ie. {"myField":3}).  This is the
+   * default. */
+  UPB_JSON_ENCODE_JSONNAMES = 0,
+
+  /* Fields are named by their .proto names (ie. {"my_field":3}), like the
+   * printer's preserve_fieldnames option. */
+  UPB_JSON_ENCODE_PRESERVEFIELDNAMES = 1 << 0
+} upb_json_encodeopt;
+
+/* Serializes |msg|, a message of type |m| with layout |l|, as JSON into a
+ * buffer allocated from |arena|.  Returns the buffer and its length in
+ * |*size| (the output is not NUL-terminated), or NULL on failure. */
+char *upb_json_encode(const upb_msg *msg, const upb_msglayout *l,
+                      const upb_msgdef *m, upb_arena *arena, int options,
+                      size_t *size);
+
+/* Like upb_json_encode(), but also prints google.protobuf.Any: its type URL
+ * is resolved with upb_msgfactory_getanytype(factory, ...), and the embedded
+ * message is decoded into |arena| and printed with an "@type" member.  Fails
+ * if the URL doesn't resolve, or names a type with a special JSON mapping. */
+char *upb_json_encode2(const upb_msg *msg, const upb_msglayout *l,
+                       const upb_msgdef *m, upb_msgfactory *factory,
+                       upb_arena *arena, int options, size_t *size);
+
+UPB_END_EXTERN_C
+
+#endif  /* UPB_JSON_ENCODE_H_ */
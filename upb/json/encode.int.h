@@ -0,0 +1,69 @@
+/*
+** Appending JSON text to a buffer that grows in an arena, shared by
+** upb_json_encode() and upb_json_transcoder.  Values are formatted the same
+** way as by the handlers-based printer.
+*/
+
+#ifndef UPB_JSON_ENCODE_INT_H_
+#define UPB_JSON_ENCODE_INT_H_
+
+#include <string.h>
+#include "upb/def.h"
+#include "upb/msgfactory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  upb_alloc *alloc;
+  upb_arena *arena;  /* Backs |alloc|. */
+  upb_msgfactory *factory;  /* For google.protobuf.Any, or NULL. */
+  char *buf, *ptr, *end;
+  int options;
+  int depth;
+} upb_jsonenc;
+
+/* Grows the buffer so that at least |bytes| bytes can be written at e->ptr.
+ * Returns false if out of memory. */
+bool upb_jsonenc_grow(upb_jsonenc *e, size_t bytes);
+
+/* Ensures that at least |bytes| bytes can be written at e->ptr. */
+UPB_INLINE bool upb_jsonenc_reserve(upb_jsonenc *e, size_t bytes) {
+  return UPB_LIKELY((size_t)(e->end - e->ptr) >= bytes) ||
+         upb_jsonenc_grow(e, bytes);
+}
+
+UPB_INLINE bool upb_jsonenc_put(upb_jsonenc *e, const char *data, size_t len) {
+  if (!upb_jsonenc_reserve(e, len)) return false;
+  memcpy(e->ptr, data, len);
+  e->ptr += len;
+  return true;
+}
+
+UPB_INLINE bool upb_jsonenc_putc(upb_jsonenc *e, char c) {
+  if (!upb_jsonenc_reserve(e, 1)) return false;
+  *e->ptr++ = c;
+  return true;
+}
+
+/* Writes a quoted string, escaped as the printer does. */
+bool upb_jsonenc_string(upb_jsonenc *e, const char *ptr, size_t len);
+
+/* Writes quoted base64 for a bytes value. */
+bool upb_jsonenc_bytes(upb_jsonenc *e, upb_stringview val);
+
+/* Writes the quoted name of enum value |val|, or the number if |enumdef| has
+ * no value by that number. */
+bool upb_jsonenc_enum(upb_jsonenc *e, const upb_enumdef *enumdef,
+                      int32_t val);
+
+/* Numbers are written with one of the upb_json_fmt* functions, which need at
+ * most this much space. */
+#define UPB_JSONENC_NUMBER_MAX 32
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_JSON_ENCODE_INT_H_ */
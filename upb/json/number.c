@@ -0,0 +1,784 @@
+/*
+** Number formatting and parsing for JSON.  See number.int.h.
+*/
+
+#include "upb/json/number.int.h"
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHKLENGTH(x) if (!(x)) return -1;
+
+static const char neginf[] = "\"-Infinity\"";
+static const char inf[] = "\"Infinity\"";
+
+/* Formatting *****************************************************************/
+
+/* Integers are formatted two digits at a time from this table, and floating
+ * point values with the Grisu2 algorithm (Florian Loitsch, "Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010).
+ * Grisu2 always produces digits that round-trip, and in the vast majority of
+ * cases the shortest such digits.  None of this depends on the C locale. */
+
+static const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* Writes the decimal digits of |val| ending just before |end|, and returns a
+ * pointer to the first digit. */
+static char *fmt_digits(uint64_t val, char *end) {
+  while (val >= 100) {
+    unsigned i = (unsigned)(val % 100) * 2;
+    val /= 100;
+    *--end = kDigitPairs[i + 1];
+    *--end = kDigitPairs[i];
+  }
+  if (val >= 10) {
+    unsigned i = (unsigned)val * 2;
+    *--end = kDigitPairs[i + 1];
+    *--end = kDigitPairs[i];
+  } else {
+    *--end = '0' + (char)val;
+  }
+  return end;
+}
+
+size_t upb_json_fmtuint64(uint64_t val, char *buf, size_t length) {
+  char tmp[20];
+  char *end = tmp + sizeof(tmp);
+  char *start = fmt_digits(val, end);
+  size_t n = end - start;
+  CHKLENGTH(n < length);
+  memcpy(buf, start, n);
+  return n;
+}
+
+size_t upb_json_fmtint64(int64_t val, char *buf, size_t length) {
+  if (val < 0) {
+    size_t n;
+    CHKLENGTH(length > 1);
+    buf[0] = '-';
+    /* Negate in unsigned arithmetic so INT64_MIN works. */
+    n = upb_json_fmtuint64(0 - (uint64_t)val, buf + 1, length - 1);
+    CHKLENGTH(n != (size_t)-1);
+    return n + 1;
+  } else {
+    return upb_json_fmtuint64(val, buf, length);
+  }
+}
+
+/* A floating point value f * 2^e with a 64-bit significand. */
+typedef struct {
+  uint64_t f;
+  int e;
+} diyfp;
+
+static diyfp diyfp_make(uint64_t f, int e) {
+  diyfp ret;
+  ret.f = f;
+  ret.e = e;
+  return ret;
+}
+
+static diyfp diyfp_normalize(diyfp x) {
+  while (!(x.f & 0x8000000000000000ULL)) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+/* Returns the upper 64 bits of the 128-bit product, rounded. */
+static diyfp diyfp_mul(diyfp x, diyfp y) {
+  const uint64_t mask32 = 0xffffffffULL;
+  uint64_t a = x.f >> 32, b = x.f & mask32;
+  uint64_t c = y.f >> 32, d = y.f & mask32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t mid = (bd >> 32) + (ad & mask32) + (bc & mask32) + (1ULL << 31);
+  return diyfp_make(ac + (ad >> 32) + (bc >> 32) + (mid >> 32),
+                    x.e + y.e + 64);
+}
+
+/* Normalized 10^k for k = -348, -340, ..., 340, with binary exponents. */
+static const uint64_t kCachedPowersF[] = {
+  0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+  0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+  0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+  0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+  0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+  0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+  0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+  0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+  0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+  0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+  0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+  0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+  0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+  0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+  0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+  0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+  0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+  0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+  0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+  0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+  0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+  0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+  0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+  0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+  0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+  0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+  0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+  0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+  0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t kCachedPowersE[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t kPow10[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+  1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+  1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/* Returns a cached power c = 10^-k such that multiplying a diyfp with
+ * exponent |e| by it gives an exponent in [-60, -32]. */
+static diyfp cached_power(int e, int *k) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int ik = (int)dk;
+  unsigned index;
+  if (dk - ik > 0.0) ik++;
+  index = (unsigned)((ik >> 3) + 1);
+  *k = -(-348 + (int)index * 8);
+  return diyfp_make(kCachedPowersF[index], kCachedPowersE[index]);
+}
+
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w ||
+          wp_w - rest > rest + ten_kappa - wp_w)) {
+    buf[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+/* Generates the shortest digits of W that lie within (Mp - delta, Mp]. */
+static int grisu_digits(diyfp w, diyfp mp, uint64_t delta, char *buf,
+                        int *k) {
+  const diyfp one = diyfp_make(1ULL << -mp.e, mp.e);
+  const uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+  uint64_t p2 = mp.f & (one.f - 1);
+  int kappa = 1;
+  int len = 0;
+
+  while (kappa < 10 && p1 >= kPow10[kappa]) kappa++;
+
+  while (kappa > 0) {
+    uint32_t d = (uint32_t)(p1 / kPow10[kappa - 1]);
+    uint64_t rest;
+    p1 %= kPow10[kappa - 1];
+    if (d || len) buf[len++] = '0' + (char)d;
+    kappa--;
+    rest = ((uint64_t)p1 << -one.e) + p2;
+    if (rest <= delta) {
+      *k += kappa;
+      grisu_round(buf, len, delta, rest, kPow10[kappa] << -one.e, wp_w);
+      return len;
+    }
+  }
+
+  for (;;) {
+    char d;
+    p2 *= 10;
+    delta *= 10;
+    d = (char)(p2 >> -one.e);
+    if (d || len) buf[len++] = '0' + d;
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *k += kappa;
+      grisu_round(buf, len, delta, p2, one.f,
+                  -kappa < 20 ? wp_w * kPow10[-kappa] : 0);
+      return len;
+    }
+  }
+}
+
+/* Writes the digits of a positive, finite value with significand |f| and
+ * exponent |e| (value = f * 2^e) to |buf|, returning the digit count and
+ * setting |*k| so that value ~= digits * 10^k.  |hidden| is the implicit
+ * leading significand bit of the source format, used to detect the
+ * asymmetric rounding interval at powers of two. */
+static int grisu2(uint64_t f, int e, uint64_t hidden, char *buf, int *k) {
+  diyfp v = diyfp_make(f, e);
+  diyfp plus = diyfp_normalize(diyfp_make((f << 1) + 1, e - 1));
+  diyfp minus = (f == hidden) ? diyfp_make((f << 2) - 1, e - 2)
+                              : diyfp_make((f << 1) - 1, e - 1);
+  diyfp c;
+  diyfp w;
+
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  c = cached_power(plus.e, k);
+  w = diyfp_mul(diyfp_normalize(v), c);
+  plus = diyfp_mul(plus, c);
+  minus = diyfp_mul(minus, c);
+  minus.f++;
+  plus.f--;
+  return grisu_digits(w, plus, plus.f - minus.f, buf, k);
+}
+
+/* Formats |len| digits times 10^k the way JavaScript's Number.toString()
+ * does: plain decimal notation for 1e-7 < |v| < 1e21, exponent otherwise. */
+static size_t fmt_decimal(char *buf, int len, int k) {
+  int kk = len + k;  /* 10^(kk-1) <= v < 10^kk */
+
+  if (k >= 0 && kk <= 21) {
+    /* 1234e3 -> 1234000 */
+    memset(buf + len, '0', k);
+    return kk;
+  } else if (kk > 0 && kk <= 21) {
+    /* 1234e-2 -> 12.34 */
+    memmove(buf + kk + 1, buf + kk, len - kk);
+    buf[kk] = '.';
+    return len + 1;
+  } else if (kk > -6 && kk <= 0) {
+    /* 1234e-6 -> 0.001234 */
+    int offset = 2 - kk;
+    memmove(buf + offset, buf, len);
+    buf[0] = '0';
+    buf[1] = '.';
+    memset(buf + 2, '0', offset - 2);
+    return len + offset;
+  } else {
+    /* 1234e30 -> 1.234e+33 */
+    int exp = kk - 1;
+    char *end;
+    if (len > 1) {
+      memmove(buf + 2, buf + 1, len - 1);
+      buf[1] = '.';
+      len++;
+    }
+    end = buf + len;
+    *end++ = 'e';
+    *end++ = exp < 0 ? '-' : '+';
+    if (exp < 0) exp = -exp;
+    end += upb_json_fmtuint64(exp, end, 4);
+    return end - buf;
+  }
+}
+
+/* Formats a value given its IEEE 754 bit pattern and the number of mantissa
+ * and exponent bits of its format.  JSON has no literals for infinity and
+ * NaN, so like proto2::util::JsonFormat we print them as strings. */
+static size_t fmt_ieee(uint64_t bits, int mant_bits, int exp_bits,
+                       char *buf, size_t length) {
+  const uint64_t hidden = 1ULL << mant_bits;
+  const int exp_max = (1 << exp_bits) - 1;
+  const int exp_bias = exp_max >> 1;
+  uint64_t mant = bits & (hidden - 1);
+  int biased_exp = (int)(bits >> mant_bits) & exp_max;
+  bool neg = (bits >> (mant_bits + exp_bits)) & 1;
+  char tmp[32];
+  char *out = tmp;
+  size_t n;
+
+  if (biased_exp == exp_max) {
+    const char *str = mant ? "\"NaN\"" : neg ? neginf : inf;
+    n = strlen(str);
+    CHKLENGTH(length >= n);
+    memcpy(buf, str, n);
+    return n;
+  }
+
+  if (neg) *out++ = '-';
+
+  if (biased_exp == 0 && mant == 0) {
+    *out++ = '0';
+  } else {
+    int k;
+    int len;
+    if (biased_exp) {
+      len = grisu2(mant | hidden, biased_exp - exp_bias - mant_bits, hidden,
+                   out, &k);
+    } else {
+      /* Subnormal. */
+      len = grisu2(mant, 1 - exp_bias - mant_bits, hidden, out, &k);
+    }
+    out += fmt_decimal(out, len, k);
+  }
+
+  n = out - tmp;
+  CHKLENGTH(n < length);
+  memcpy(buf, tmp, n);
+  return n;
+}
+
+size_t upb_json_fmtdouble(double val, char *buf, size_t length) {
+  uint64_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return fmt_ieee(bits, 52, 11, buf, length);
+}
+
+size_t upb_json_fmtfloat(float val, char *buf, size_t length) {
+  uint32_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return fmt_ieee(bits, 23, 8, buf, length);
+}
+
+
+/* Parsing ********************************************************************/
+
+/* Doubles are parsed with the Clinger fast path when the digits and power of
+ * ten are both exact doubles, otherwise with the Eisel-Lemire algorithm
+ * (Daniel Lemire, "Number Parsing at a Gigabyte per Second", 2021): multiply
+ * the digits by a 64-bit approximation of the power of ten and round, unless
+ * the product is too close to a rounding boundary to be sure of the result.
+ * Those rare cases, subnormals, and inputs with more than 19 significant
+ * digits fall back to strtod(). */
+
+#define MAX_DIGITS 19  /* Any 19 decimal digits fit in a uint64_t. */
+#define MAX_EXP10 100000  /* Far beyond anything representable. */
+
+/* Powers of ten that are exact doubles, for the Clinger fast path. */
+static const double kExactPow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* The fast path does a single double multiply or divide, which is correctly
+ * rounded only if it is done in double (not extended) precision. */
+#if (defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0) || \
+    (defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ != 0)
+#define UPB_JSON_NO_CLINGER
+#endif
+
+static int clz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  while (!(x & 0x8000000000000000ULL)) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+/* Sets |*hi| and |*lo| to the 128-bit product of |x| and |y|. */
+static void mul128(uint64_t x, uint64_t y, uint64_t *hi, uint64_t *lo) {
+  const uint64_t mask32 = 0xffffffffULL;
+  uint64_t a = x >> 32, b = x & mask32;
+  uint64_t c = y >> 32, d = y & mask32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t mid = (bd >> 32) + (ad & mask32) + (bc & mask32);
+  *hi = ac + (ad >> 32) + (bc >> 32) + (mid >> 32);
+  *lo = (mid << 32) | (bd & mask32);
+}
+
+/* Computes the double nearest w * 10^q (w != 0) as a bit pattern, returning
+ * false if it cannot be sure of the rounding. */
+static bool eisel_lemire(uint64_t w, int q, uint64_t *bits) {
+  const uint64_t mant_mask = (1ULL << 52) - 1;
+  int index = (q + 348) >> 3;
+  int b = (q + 348) & 7;
+  uint64_t t, hi, lo, m, window, half;
+  int te, lz, s, biased;
+
+  /* 10^q ~= t * 2^te.  The cached power is rounded and the exact product with
+   * 10^b truncated, so |t| is within 1.5 units in its last place. */
+  t = kCachedPowersF[index];
+  te = kCachedPowersE[index];
+  if (b) {
+    mul128(t, kPow10[b], &hi, &lo);
+    lz = clz64(hi);
+    t = (hi << lz) | (lo >> (64 - lz));
+    te += 64 - lz;
+  }
+
+  lz = clz64(w);
+  mul128(w << lz, t, &hi, &lo);
+
+  /* The exact product differs from ours by less than 4 in |hi|.  The top 54
+   * bits of |hi| are the mantissa and a rounding bit; give up if the bits
+   * below the mantissa are too close to a halfway point. */
+  s = 9 + (int)(hi >> 63);
+  half = 1ULL << s;
+  window = hi & ((half << 1) - 1);
+  if (window > half - 8 && window < half + 8) return false;
+
+  m = (hi >> (s + 1)) + (window >= half);
+  te += s + 1 + 64 - lz;
+  if (m == (1ULL << 53)) {
+    m >>= 1;
+    te++;
+  }
+
+  biased = te + 52 + 1023;
+  if (biased >= 2047) {
+    *bits = 0x7ff0000000000000ULL;  /* Overflow: infinity. */
+  } else if (biased <= 0) {
+    return false;  /* Subnormal: rounds differently. */
+  } else {
+    *bits = ((uint64_t)biased << 52) | (m & mant_mask);
+  }
+  return true;
+}
+
+/* Parses with strtod(), which needs a NUL-terminated copy. */
+static bool parsedouble_slow(const char *buf, size_t len, double *val) {
+  char stackbuf[64];
+  char *copy = len < sizeof(stackbuf) ? stackbuf : upb_gmalloc(len + 1);
+  char *end;
+  bool ok;
+
+  if (!copy) return false;
+  memcpy(copy, buf, len);
+  copy[len] = '\0';
+  *val = strtod(copy, &end);
+  /* Could fail to consume everything if the locale's decimal point isn't
+   * '.'. */
+  ok = end == copy + len;
+  if (copy != stackbuf) upb_gfree(copy);
+  return ok;
+}
+
+bool upb_json_parseuint64(const char *buf, size_t len, uint64_t *val) {
+  const char *end = buf + len;
+  uint64_t ret = 0;
+
+  if (len == 0) return false;
+
+  for (; buf < end; buf++) {
+    unsigned d = (unsigned char)*buf - '0';
+    if (d > 9 || ret > (UINT64_MAX - d) / 10) return false;
+    ret = ret * 10 + d;
+  }
+
+  *val = ret;
+  return true;
+}
+
+bool upb_json_parseint64(const char *buf, size_t len, int64_t *val) {
+  bool neg = len > 0 && buf[0] == '-';
+  uint64_t u;
+
+  if (neg) {
+    buf++;
+    len--;
+  }
+
+  if (!upb_json_parseuint64(buf, len, &u)) return false;
+
+  if (neg) {
+    if (u > (uint64_t)INT64_MAX + 1) return false;
+    *val = u == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)u;
+  } else {
+    if (u > INT64_MAX) return false;
+    *val = u;
+  }
+  return true;
+}
+
+bool upb_json_parsedouble(const char *buf, size_t len, double *val) {
+  const char *ptr = buf;
+  const char *end = buf + len;
+  bool neg = false;
+  bool any_digits = false;
+  bool inexact = false;  /* Dropped nonzero digits or clamped the exponent. */
+  uint64_t w = 0;        /* The first MAX_DIGITS significant digits. */
+  int ndigits = 0;
+  int q = 0;             /* Value = w * 10^q (if !inexact). */
+  uint64_t bits;
+
+  if (len == 8 && memcmp(buf, "Infinity", 8) == 0) {
+    *val = 1.0 / 0.0;  /* C89 does not have an INFINITY macro. */
+    return true;
+  } else if (len == 9 && memcmp(buf, "-Infinity", 9) == 0) {
+    *val = -1.0 / 0.0;
+    return true;
+  } else if (len == 3 && memcmp(buf, "NaN", 3) == 0) {
+    *val = 0.0 / 0.0;
+    return true;
+  }
+
+  if (ptr < end && *ptr == '-') {
+    neg = true;
+    ptr++;
+  }
+
+  /* Integer and fraction digits.  A digit past MAX_DIGITS is dropped, which
+   * scales the value down by ten unless it was a fraction digit anyway. */
+  {
+    bool frac = false;
+    for (; ptr < end; ptr++) {
+      unsigned d = (unsigned char)*ptr - '0';
+      if (d > 9) {
+        if (*ptr != '.' || frac) break;
+        frac = true;
+        continue;
+      }
+      any_digits = true;
+      if (ndigits < MAX_DIGITS) {
+        w = w * 10 + d;
+        if (w) ndigits++;
+        if (frac) q--;
+      } else {
+        if (d) inexact = true;
+        if (!frac) q++;
+      }
+      if (q < -MAX_EXP10 || q > MAX_EXP10) return parsedouble_slow(buf, len, val);
+    }
+  }
+
+  if (!any_digits) return false;
+
+  if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+    bool exp_neg = false;
+    bool exp_digits = false;
+    int exp = 0;
+    ptr++;
+    if (ptr < end && (*ptr == '+' || *ptr == '-')) {
+      exp_neg = *ptr == '-';
+      ptr++;
+    }
+    for (; ptr < end; ptr++) {
+      unsigned d = (unsigned char)*ptr - '0';
+      if (d > 9) break;
+      exp_digits = true;
+      if (exp < MAX_EXP10) exp = exp * 10 + d;
+    }
+    if (!exp_digits) return false;
+    q += exp_neg ? -exp : exp;
+  }
+
+  if (ptr != end) return false;
+
+  if (inexact) {
+    return parsedouble_slow(buf, len, val);
+  }
+
+  if (w == 0) {
+    *val = neg ? -0.0 : 0.0;
+    return true;
+  }
+
+#ifndef UPB_JSON_NO_CLINGER
+  if (w <= (1ULL << 53) && q >= -22 && q <= 22) {
+    double d = (double)w;
+    d = q < 0 ? d / kExactPow10[-q] : d * kExactPow10[q];
+    *val = neg ? -d : d;
+    return true;
+  }
+#endif
+
+  if (q < -343) {
+    /* Less than 10^-324, which rounds to zero. */
+    *val = neg ? -0.0 : 0.0;
+    return true;
+  } else if (q > 308) {
+    return false;  /* Overflow. */
+  } else if (!eisel_lemire(w, q, &bits)) {
+    if (!parsedouble_slow(buf, len, val)) return false;
+    memcpy(&bits, val, sizeof(bits));
+    bits &= ~0x8000000000000000ULL;
+  }
+
+  /* Finite input that overflowed to infinity. */
+  if ((bits >> 52) == 0x7ff) return false;
+
+  if (neg) bits |= 0x8000000000000000ULL;
+  memcpy(val, &bits, sizeof(bits));
+  return true;
+}
+
+#undef MAX_DIGITS
+#undef MAX_EXP10
+
+
+/* Timestamps and durations ***************************************************/
+
+#define SECONDS_PER_DAY 86400
+
+/* Days between 0000-03-01, where the 400-year cycle of the calendar starts,
+ * and the epoch. */
+#define EPOCH_DAYS 719468
+
+/* Days in a 400-year cycle. */
+#define DAYS_PER_ERA 146097
+
+/* Floor division, for the days and eras before the epoch. */
+static int64_t floordiv(int64_t a, int64_t b) {
+  return (a >= 0 ? a : a - (b - 1)) / b;
+}
+
+/* Returns the day number (days since the epoch) of a date.  Years are
+ * counted from March, so that the leap day falls at the end of one. */
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+  int64_t era;
+  unsigned yoe, doy, doe;
+  y -= m <= 2;
+  era = floordiv(y, 400);
+  yoe = (unsigned)(y - era * 400);
+  doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * DAYS_PER_ERA + doe - EPOCH_DAYS;
+}
+
+/* The inverse of days_from_civil(). */
+static void civil_from_days(int64_t z, int64_t *y, unsigned *m, unsigned *d) {
+  int64_t era;
+  unsigned doe, yoe, doy, mp;
+  z += EPOCH_DAYS;
+  era = floordiv(z, DAYS_PER_ERA);
+  doe = (unsigned)(z - era * DAYS_PER_ERA);
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = yoe + era * 400 + (*m <= 2);
+}
+
+/* Writes the two digits of |val| < 100 at |p|. */
+static char *fmt_2digits(unsigned val, char *p) {
+  p[0] = kDigitPairs[val * 2];
+  p[1] = kDigitPairs[val * 2 + 1];
+  return p + 2;
+}
+
+/* Writes ".fraction" for 0 < |nanos| < 1e9, without trailing zeros, at |p|. */
+static char *fmt_nanos(uint32_t nanos, char *p) {
+  char *end = p + 10;
+  fmt_digits(nanos + 1000000000, end);  /* Leading "1" is overwritten. */
+  *p = '.';
+  while (end[-1] == '0') end--;
+  return end;
+}
+
+size_t upb_json_fmttimestamp(int64_t seconds, int32_t nanos, char *buf,
+                             size_t length) {
+  char tmp[31];
+  char *p = tmp;
+  int64_t days = floordiv(seconds, SECONDS_PER_DAY);
+  unsigned secs = (unsigned)(seconds - days * SECONDS_PER_DAY);
+  int64_t year;
+  unsigned month, day;
+
+  civil_from_days(days, &year, &month, &day);
+  UPB_ASSERT(year >= 1 && year <= 9999);
+  UPB_ASSERT(nanos >= 0 && nanos < 1000000000);
+
+  p = fmt_2digits((unsigned)year / 100, p);
+  p = fmt_2digits((unsigned)year % 100, p);
+  *p++ = '-';
+  p = fmt_2digits(month, p);
+  *p++ = '-';
+  p = fmt_2digits(day, p);
+  *p++ = 'T';
+  p = fmt_2digits(secs / 3600, p);
+  *p++ = ':';
+  p = fmt_2digits(secs / 60 % 60, p);
+  *p++ = ':';
+  p = fmt_2digits(secs % 60, p);
+  if (nanos != 0) p = fmt_nanos(nanos, p);
+  *p++ = 'Z';
+
+  CHKLENGTH((size_t)(p - tmp) <= length);
+  memcpy(buf, tmp, p - tmp);
+  return p - tmp;
+}
+
+size_t upb_json_fmtduration(int64_t seconds, int32_t nanos, char *buf,
+                            size_t length) {
+  char tmp[32];
+  char digits[20];
+  char *p = tmp;
+  char *start;
+  uint64_t abs_seconds;
+
+  UPB_ASSERT(nanos > -1000000000 && nanos < 1000000000);
+
+  if (seconds < 0 || nanos < 0) *p++ = '-';
+  /* Negate in unsigned arithmetic so INT64_MIN works. */
+  abs_seconds = seconds < 0 ? -(uint64_t)seconds : (uint64_t)seconds;
+  start = fmt_digits(abs_seconds, digits + sizeof(digits));
+  memcpy(p, start, digits + sizeof(digits) - start);
+  p += digits + sizeof(digits) - start;
+  if (nanos != 0) p = fmt_nanos(nanos < 0 ? -nanos : nanos, p);
+  *p++ = 's';
+
+  CHKLENGTH((size_t)(p - tmp) <= length);
+  memcpy(buf, tmp, p - tmp);
+  return p - tmp;
+}
+
+/* Parses the |n| decimal digits at |buf|, or returns -1 if they aren't. */
+static int parse_digits(const char *buf, int n) {
+  int ret = 0;
+  for (; n > 0; n--, buf++) {
+    unsigned d = (unsigned char)*buf - '0';
+    if (d > 9) return -1;
+    ret = ret * 10 + d;
+  }
+  return ret;
+}
+
+bool upb_json_parsedatetime(const char *buf, size_t len, int64_t *seconds) {
+  static const unsigned char kMonthDays[] = {
+    31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+  };
+  int year, month, day, hour, minute, second;
+
+  if (len != 19 || buf[4] != '-' || buf[7] != '-' || buf[10] != 'T' ||
+      buf[13] != ':' || buf[16] != ':') {
+    return false;
+  }
+
+  year = parse_digits(buf, 4);
+  month = parse_digits(buf + 5, 2);
+  day = parse_digits(buf + 8, 2);
+  hour = parse_digits(buf + 11, 2);
+  minute = parse_digits(buf + 14, 2);
+  second = parse_digits(buf + 17, 2);
+
+  if (year < 0 || month < 1 || month > 12 || day < 1 ||
+      day > kMonthDays[month - 1] || hour < 0 || hour > 23 || minute < 0 ||
+      minute > 59 || second < 0 || second > 59) {
+    return false;
+  }
+
+  /* February 29th of a common year. */
+  if (month == 2 && day == 29 &&
+      (year % 4 != 0 || (year % 100 == 0 && year % 400 != 0))) {
+    return false;
+  }
+
+  *seconds = days_from_civil(year, month, day) * SECONDS_PER_DAY +
+             hour * 3600 + minute * 60 + second;
+  return true;
+}
@@ -0,0 +1,78 @@
+/*
+** Number formatting and parsing, shared by the JSON parser and printer.
+**
+** This includes the seconds and nanos of Timestamp and Duration.  None of
+** these depend on the C locale or need NUL-terminated input, and the common
+** cases avoid libc entirely.
+*/
+
+#ifndef UPB_JSON_NUMBER_H_
+#define UPB_JSON_NUMBER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "upb/upb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Formatting *****************************************************************/
+
+/* Each of these writes the JSON text for |val| to |buf| (without a trailing
+ * NUL) and returns its length, or (size_t)-1 if |length| is too small.
+ * Doubles and floats are written with the shortest digits that round-trip (in
+ * all but a handful of cases); infinities and NaN are written as the quoted
+ * strings "Infinity", "-Infinity" and "NaN". */
+size_t upb_json_fmtint64(int64_t val, char *buf, size_t length);
+size_t upb_json_fmtuint64(uint64_t val, char *buf, size_t length);
+size_t upb_json_fmtdouble(double val, char *buf, size_t length);
+size_t upb_json_fmtfloat(float val, char *buf, size_t length);
+
+/* Parsing ********************************************************************/
+
+/* Each of these parses exactly the |len| bytes at |buf|, which need not be
+ * NUL-terminated, and returns false if they are not a valid number of that
+ * type.
+ *
+ * The integer parsers accept only an optional '-' followed by decimal digits,
+ * and fail if the value is out of range.  upb_json_parsedouble() also accepts
+ * a fraction and exponent, and "Infinity", "-Infinity" or "NaN".  It fails
+ * if a finite number is too large to represent; values too small to
+ * represent round to zero. */
+bool upb_json_parseint64(const char *buf, size_t len, int64_t *val);
+bool upb_json_parseuint64(const char *buf, size_t len, uint64_t *val);
+bool upb_json_parsedouble(const char *buf, size_t len, double *val);
+
+/* Timestamps and durations ***************************************************/
+
+/* These convert between seconds since the Unix epoch and the proleptic
+ * Gregorian calendar with plain arithmetic, so unlike gmtime() and mktime()
+ * they take no locks and don't depend on the local timezone. */
+
+/* Writes the RFC 3339 text of a google.protobuf.Timestamp, without quotes:
+ * "YYYY-MM-DDTHH:MM:SS", a fraction of up to nine digits with trailing zeros
+ * dropped if |nanos| is non-zero, then "Z".  |seconds| must be within years
+ * 0001 to 9999 and |nanos| in [0, 1e9).  Returns the length, or (size_t)-1
+ * if |length| is too small; 31 bytes is always enough. */
+size_t upb_json_fmttimestamp(int64_t seconds, int32_t nanos, char *buf,
+                             size_t length);
+
+/* Writes the text of a google.protobuf.Duration, without quotes: the seconds,
+ * a fraction as for timestamps, then "s".  The result is negative if either
+ * |seconds| or |nanos| is; the magnitude of |nanos| must be less than 1e9.
+ * Returns the length, or (size_t)-1 if |length| is too small; 32 bytes is
+ * always enough. */
+size_t upb_json_fmtduration(int64_t seconds, int32_t nanos, char *buf,
+                            size_t length);
+
+/* Parses exactly the |len| bytes "YYYY-MM-DDTHH:MM:SS" at |buf| as a UTC time
+ * and sets |*seconds| to the seconds since the epoch.  Returns false if the
+ * text is malformed or isn't a valid date and time (leap seconds included). */
+bool upb_json_parsedatetime(const char *buf, size_t len, int64_t *seconds);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_JSON_NUMBER_H_ */
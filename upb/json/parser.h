@@ -29,7 +29,7 @@ UPB_DECLARE_DERIVED_TYPE(upb::json::ParserMethod, upb::RefCounted,
  * constructed.  This hint may be an overestimate for some build configurations.
  * But if the parser library is upgraded without recompiling the application,
  * it may be an underestimate. */
-#define UPB_JSON_PARSER_SIZE 4160
+#define UPB_JSON_PARSER_SIZE 4192
 
 #ifdef __cplusplus
 
@@ -42,6 +42,22 @@ class upb::json::Parser {
 
   BytesSink* input();
 
+  /* Readies the parser for a new message, abandoning any input parsed so
+   * far.  Unlike upb::pb::Decoder, the parser does not start over by itself
+   * when a message ends, so this must be called between messages.  Its
+   * buffers are kept, so a parser that is reused this way stops allocating
+   * once it has seen its largest input. */
+  void Reset();
+
+  /* If true, string fields that are not valid UTF-8 (after unescaping) are a
+   * parse error.  The check is done as the string data is parsed.  Defaults
+   * to false.
+   *
+   * The parser does not yet combine escaped surrogate pairs like
+   * "\ud83d\ude00" into one code point, so strings containing them fail this
+   * check.  upb_json_decode() does not have this limitation. */
+  void set_validate_utf8(bool validate);
+
  private:
   UPB_DISALLOW_POD_OPS(Parser, upb::json::Parser)
 };
@@ -75,6 +91,8 @@ upb_json_parser* upb_json_parser_create(upb_env* e,
                                         upb_sink* output,
                                         bool ignore_json_unknown);
 upb_bytessink *upb_json_parser_input(upb_json_parser *p);
+void upb_json_parser_reset(upb_json_parser *p);
+void upb_json_parser_setvalidateutf8(upb_json_parser *p, bool validate);
 
 upb_json_parsermethod* upb_json_parsermethod_new(const upb_msgdef* md,
                                                  const void* owner);
@@ -99,6 +117,10 @@ inline Parser* Parser::Create(Environment* env, const ParserMethod* method,
 inline BytesSink* Parser::input() {
   return upb_json_parser_input(this);
 }
+inline void Parser::Reset() { upb_json_parser_reset(this); }
+inline void Parser::set_validate_utf8(bool validate) {
+  upb_json_parser_setvalidateutf8(this, validate);
+}
 
 inline const Handlers* ParserMethod::dest_handlers() const {
   return upb_json_parsermethod_desthandlers(this);
@@ -27,13 +27,11 @@
 #include <stdlib.h>
 #include <string.h>
 
-/* Need to define __USE_XOPEN before including time.h to make strptime work. */
-#ifndef __USE_XOPEN
-#define __USE_XOPEN
-#endif
-#include <time.h>
-
 #include "upb/json/parser.h"
+#include "upb/json/base64.int.h"
+#include "upb/json/number.int.h"
+#include "upb/json/scan.int.h"
+#include "upb/utf8.int.h"
 
 #define UPB_JSON_MAX_DEPTH 64
 
@@ -175,6 +173,13 @@ struct upb_json_parser {
   int multipart_state;
   upb_selector_t string_selector;
 
+  /* Streaming base64 decoding: a partial group of input carried over between
+   * parts of a bytes value, and whether we have seen its padding.  See details
+   * in parser.rl. */
+  char base64_buf[4];
+  size_t base64_len;
+  bool base64_padded;
+
   /* Input capture.  See details in parser.rl. */
   const char *capture;
 
@@ -184,9 +189,14 @@ struct upb_json_parser {
   /* Whether to proceed if unknown field is met. */
   bool ignore_json_unknown;
 
-  /* Cache for parsing timestamp due to base and zone are handled in different
-   * handlers. */
-  struct tm tm;
+  /* Whether string fields must be valid UTF-8, and our progress through the
+   * current one.  See details in parser.rl. */
+  bool validate_utf8;
+  upb_utf8state utf8state;
+
+  /* Seconds of the timestamp being parsed, kept from its date and time until
+   * its zone is seen, which is handled separately. */
+  int64_t timestamp_seconds;
 };
 
 struct upb_json_parsermethod {
@@ -258,85 +268,55 @@ static size_t saturating_multiply(size_t a, size_t b) {
 
 /* Base64 decoding ************************************************************/
 
-/* TODO(haberman): make this streaming. */
-
-static const signed char b64table[] = {
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      62/*+*/, -1,      -1,      -1,      63/*/ */,
-  52/*0*/, 53/*1*/, 54/*2*/, 55/*3*/, 56/*4*/, 57/*5*/, 58/*6*/, 59/*7*/,
-  60/*8*/, 61/*9*/, -1,      -1,      -1,      -1,      -1,      -1,
-  -1,       0/*A*/,  1/*B*/,  2/*C*/,  3/*D*/,  4/*E*/,  5/*F*/,  6/*G*/,
-  07/*H*/,  8/*I*/,  9/*J*/, 10/*K*/, 11/*L*/, 12/*M*/, 13/*N*/, 14/*O*/,
-  15/*P*/, 16/*Q*/, 17/*R*/, 18/*S*/, 19/*T*/, 20/*U*/, 21/*V*/, 22/*W*/,
-  23/*X*/, 24/*Y*/, 25/*Z*/, -1,      -1,      -1,      -1,      -1,
-  -1,      26/*a*/, 27/*b*/, 28/*c*/, 29/*d*/, 30/*e*/, 31/*f*/, 32/*g*/,
-  33/*h*/, 34/*i*/, 35/*j*/, 36/*k*/, 37/*l*/, 38/*m*/, 39/*n*/, 40/*o*/,
-  41/*p*/, 42/*q*/, 43/*r*/, 44/*s*/, 45/*t*/, 46/*u*/, 47/*v*/, 48/*w*/,
-  49/*x*/, 50/*y*/, 51/*z*/, -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1
-};
+/* Bytes values are decoded as they stream in, rather than accumulated first.
+ * Each part of the value is decoded up to its last complete group of four
+ * characters (in bulk, by upb_json_b64decode()), and any remainder is carried
+ * over in p->base64_buf until the next part or the end of the value. */
 
 /* Returns the table value sign-extended to 32 bits.  Knowing that the upper
  * bits will be 1 for unrecognized characters makes it easier to check for
  * this error condition later (see below). */
-int32_t b64lookup(unsigned char ch) { return b64table[ch]; }
+static uint32_t b64lookup(unsigned char ch) {
+  return (uint32_t)(int32_t)upb_json_b64table[ch];
+}
 
 /* Returns true if the given character is not a valid base64 character or
  * padding. */
-bool nonbase64(unsigned char ch) { return b64lookup(ch) == -1 && ch != '='; }
+static bool nonbase64(unsigned char ch) {
+  return upb_json_b64table[ch] == -1 && ch != '=';
+}
 
-static bool base64_push(upb_json_parser *p, upb_selector_t sel, const char *ptr,
-                        size_t len) {
-  const char *limit = ptr + len;
-  for (; ptr < limit; ptr += 4) {
-    uint32_t val;
-    char output[3];
-
-    if (limit - ptr < 4) {
-      upb_status_seterrf(&p->status,
-                         "Base64 input for bytes field not a multiple of 4: %s",
-                         upb_fielddef_name(p->top->f));
-      upb_env_reporterror(p->env, &p->status);
-      return false;
-    }
+static void base64_start(upb_json_parser *p) {
+  p->base64_len = 0;
+  p->base64_padded = false;
+}
 
-    val = b64lookup(ptr[0]) << 18 |
-          b64lookup(ptr[1]) << 12 |
-          b64lookup(ptr[2]) << 6  |
-          b64lookup(ptr[3]);
+/* Decodes one group of four characters the same way as upb_json_b64decode(),
+ * but also handles the final group of the value being padded. */
+static bool base64_group(upb_json_parser *p, upb_selector_t sel,
+                         const char *ptr) {
+  uint32_t val;
+  char output[3];
 
-    /* Test the upper bit; returns true if any of the characters returned -1. */
-    if (val & 0x80000000) {
-      goto otherchar;
-    }
+  if (p->base64_padded) {
+    /* Only the last group may be padded. */
+    goto badpadding;
+  }
+
+  val = b64lookup(ptr[0]) << 18 |
+        b64lookup(ptr[1]) << 12 |
+        b64lookup(ptr[2]) << 6  |
+        b64lookup(ptr[3]);
 
+  /* Test the upper bit; returns true if any of the characters returned -1. */
+  if (!(val & 0x80000000)) {
     output[0] = val >> 16;
     output[1] = (val >> 8) & 0xff;
     output[2] = val & 0xff;
     upb_sink_putstring(&p->top->sink, sel, output, 3, NULL);
+    return true;
   }
-  return true;
 
-otherchar:
   if (nonbase64(ptr[0]) || nonbase64(ptr[1]) || nonbase64(ptr[2]) ||
       nonbase64(ptr[3]) ) {
     upb_status_seterrf(&p->status,
@@ -345,9 +325,6 @@ otherchar:
     upb_env_reporterror(p->env, &p->status);
     return false;
   } if (ptr[2] == '=') {
-    uint32_t val;
-    char output;
-
     /* Last group contains only two input bytes, one output byte. */
     if (ptr[0] == '=' || ptr[1] == '=' || ptr[3] != '=') {
       goto badpadding;
@@ -357,13 +334,9 @@ otherchar:
           b64lookup(ptr[1]) << 12;
 
     UPB_ASSERT(!(val & 0x80000000));
-    output = val >> 16;
-    upb_sink_putstring(&p->top->sink, sel, &output, 1, NULL);
-    return true;
+    output[0] = val >> 16;
+    upb_sink_putstring(&p->top->sink, sel, output, 1, NULL);
   } else {
-    uint32_t val;
-    char output[2];
-
     /* Last group contains only three input bytes, two output bytes. */
     if (ptr[0] == '=' || ptr[1] == '=' || ptr[2] == '=') {
       goto badpadding;
@@ -376,9 +349,11 @@ otherchar:
     output[0] = val >> 16;
     output[1] = (val >> 8) & 0xff;
     upb_sink_putstring(&p->top->sink, sel, output, 2, NULL);
-    return true;
   }
 
+  p->base64_padded = true;
+  return true;
+
 badpadding:
   upb_status_seterrf(&p->status,
                      "Incorrect base64 padding for field: %s (%.*s)",
@@ -388,6 +363,63 @@ badpadding:
   return false;
 }
 
+/* Decodes the next |len| characters of the current bytes value. */
+static bool base64_push(upb_json_parser *p, upb_selector_t sel, const char *ptr,
+                        size_t len) {
+  const char *limit = ptr + len;
+
+  /* First complete the group carried over from the previous part, if any. */
+  if (p->base64_len > 0) {
+    size_t n = UPB_MIN(4 - p->base64_len, len);
+    memcpy(p->base64_buf + p->base64_len, ptr, n);
+    p->base64_len += n;
+    ptr += n;
+    if (p->base64_len < 4) {
+      return true;
+    }
+    p->base64_len = 0;
+    if (!base64_group(p, sel, p->base64_buf)) {
+      return false;
+    }
+  }
+
+  while (limit - ptr >= 4) {
+    char output[3072];
+    size_t n = UPB_MIN((size_t)(limit - ptr) & ~(size_t)3,
+                       sizeof(output) / 3 * 4);
+    size_t decoded = p->base64_padded ? 0 : upb_json_b64decode(ptr, n, output);
+
+    if (decoded > 0) {
+      upb_sink_putstring(&p->top->sink, sel, output, decoded / 4 * 3, NULL);
+      ptr += decoded;
+    }
+
+    if (decoded < n) {
+      /* Padding, an error, or something after padding (also an error). */
+      if (!base64_group(p, sel, ptr)) {
+        return false;
+      }
+      ptr += 4;
+    }
+  }
+
+  memcpy(p->base64_buf, ptr, limit - ptr);
+  p->base64_len = limit - ptr;
+  return true;
+}
+
+/* Checks that the bytes value we have been decoding ended on a group. */
+static bool base64_end(upb_json_parser *p) {
+  if (p->base64_len > 0) {
+    upb_status_seterrf(&p->status,
+                       "Base64 input for bytes field not a multiple of 4: %s",
+                       upb_fielddef_name(p->top->f));
+    upb_env_reporterror(p->env, &p->status);
+    return false;
+  }
+  return true;
+}
+
 
 /* Accumulate buffer **********************************************************/
 
@@ -495,7 +527,10 @@ static const char *accumulate_getptr(upb_json_parser *p, size_t *len) {
  *  1. we want to push the captured input directly to string handlers.
  *
  *  2. we need to accumulate all the parts into a contiguous buffer for further
- *     processing (field name lookup, string->number conversion, etc). */
+ *     processing (field name lookup, string->number conversion, etc).
+ *
+ *  3. we want to base64-decode the captured input and push the result to
+ *     string handlers (bytes fields). */
 
 /* This is the set of states for p->multipart_state. */
 enum {
@@ -508,7 +543,11 @@ enum {
 
   /* We are processing multipart data by pushing each part directly to the
    * current string handlers. */
-  MULTIPART_PUSHEAGERLY = 2
+  MULTIPART_PUSHEAGERLY = 2,
+
+  /* We are processing multipart data by base64-decoding each part and pushing
+   * the result to the current string handlers. */
+  MULTIPART_BASE64 = 3
 };
 
 /* Start a multi-part text value where we accumulate the data for processing at
@@ -520,12 +559,29 @@ static void multipart_startaccum(upb_json_parser *p) {
 }
 
 /* Start a multi-part text value where we immediately push text data to a string
- * value with the given selector. */
+ * value with the given selector.
+ *
+ * When validate_utf8 is set, the text data of a string field is also checked
+ * here as it is pushed.  Escapes have already been converted to UTF-8 by then,
+ * so they are checked too.  utf8state carries the check from part to part,
+ * and end_stringval_nontop() verifies that the string didn't end partway
+ * through a character. */
 static void multipart_start(upb_json_parser *p, upb_selector_t sel) {
   assert_accumulate_empty(p);
   UPB_ASSERT(p->multipart_state == MULTIPART_INACTIVE);
   p->multipart_state = MULTIPART_PUSHEAGERLY;
   p->string_selector = sel;
+  p->utf8state = UPB_UTF8_ACCEPT;
+}
+
+/* Start a multi-part text value that we base64-decode as it arrives, pushing
+ * the decoded data to a string value with the given selector. */
+static void multipart_startbase64(upb_json_parser *p, upb_selector_t sel) {
+  assert_accumulate_empty(p);
+  UPB_ASSERT(p->multipart_state == MULTIPART_INACTIVE);
+  p->multipart_state = MULTIPART_BASE64;
+  p->string_selector = sel;
+  base64_start(p);
 }
 
 static bool multipart_text(upb_json_parser *p, const char *buf, size_t len,
@@ -545,9 +601,23 @@ static bool multipart_text(upb_json_parser *p, const char *buf, size_t len,
 
     case MULTIPART_PUSHEAGERLY: {
       const upb_bufhandle *handle = can_alias ? p->handle : NULL;
+      if (p->validate_utf8) {
+        p->utf8state = upb_utf8_validate(p->utf8state, buf, len);
+        if (p->utf8state == UPB_UTF8_REJECT) {
+          upb_status_seterrmsg(&p->status, "Invalid UTF-8 in string");
+          upb_env_reporterror(p->env, &p->status);
+          return false;
+        }
+      }
       upb_sink_putstring(&p->top->sink, p->string_selector, buf, len, handle);
       break;
     }
+
+    case MULTIPART_BASE64:
+      if (!base64_push(p, p->string_selector, buf, len)) {
+        return false;
+      }
+      break;
   }
 
   return true;
@@ -687,8 +757,13 @@ static bool end_hex(upb_json_parser *p) {
   return multipart_text(p, utf8, length, false);
 }
 
-static void start_text(upb_json_parser *p, const char *ptr) {
+/* Called on the first byte of a run of plain string text.  Returns the last
+ * byte of the run within this buffer, so the state machine can skip straight
+ * past bytes that would only loop in the text state. */
+static const char *start_text(upb_json_parser *p, const char *ptr,
+                              const char *end) {
   capture_begin(p, ptr);
+  return upb_json_skipplain(ptr + 1, end, false) - 1;
 }
 
 static bool end_text(upb_json_parser *p, const char *ptr) {
@@ -760,57 +835,46 @@ static bool end_number(upb_json_parser *p, const char *ptr) {
   return true;
 }
 
-/* |buf| is NULL-terminated. |buf| itself will never include quotes;
- * |is_quoted| tells us whether this text originally appeared inside quotes. */
+/* |buf| itself will never include quotes; |is_quoted| tells us whether this
+ * text originally appeared inside quotes. */
 static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
-                                     bool is_quoted) {
-  size_t len = strlen(buf);
-  const char *bufend = buf + len;
-  char *end;
+                                     size_t len, bool is_quoted) {
   upb_fieldtype_t type = upb_fielddef_type(p->top->f);
   double val;
   double dummy;
   double inf = 1.0 / 0.0;  /* C89 does not have an INFINITY macro. */
 
-  errno = 0;
-
-  if (len == 0 || buf[0] == ' ') {
-    return false;
-  }
-
   /* For integer types, first try parsing with integer-specific routines.
    * If these succeed, they will be more accurate for int64/uint64 than
-   * strtod().
+   * parsing a double.
    */
   switch (type) {
     case UPB_TYPE_ENUM:
     case UPB_TYPE_INT32: {
-      long val = strtol(buf, &end, 0);
-      if (errno == ERANGE || end != bufend) {
+      int64_t val;
+      if (!upb_json_parseint64(buf, len, &val)) {
         break;
       } else if (val > INT32_MAX || val < INT32_MIN) {
         return false;
       } else {
-        upb_sink_putint32(&p->top->sink, parser_getsel(p), val);
+        upb_sink_putint32(&p->top->sink, parser_getsel(p), (int32_t)val);
         return true;
       }
     }
     case UPB_TYPE_UINT32: {
-      unsigned long val = strtoul(buf, &end, 0);
-      if (end != bufend) {
+      uint64_t val;
+      if (!upb_json_parseuint64(buf, len, &val)) {
         break;
-      } else if (val > UINT32_MAX || errno == ERANGE) {
+      } else if (val > UINT32_MAX) {
         return false;
       } else {
-        upb_sink_putuint32(&p->top->sink, parser_getsel(p), val);
+        upb_sink_putuint32(&p->top->sink, parser_getsel(p), (uint32_t)val);
         return true;
       }
     }
-    /* XXX: We can't handle [u]int64 properly on 32-bit machines because
-     * strto[u]ll isn't in C89. */
     case UPB_TYPE_INT64: {
-      long val = strtol(buf, &end, 0);
-      if (errno == ERANGE || end != bufend) {
+      int64_t val;
+      if (!upb_json_parseint64(buf, len, &val)) {
         break;
       } else {
         upb_sink_putint64(&p->top->sink, parser_getsel(p), val);
@@ -818,11 +882,9 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
       }
     }
     case UPB_TYPE_UINT64: {
-      unsigned long val = strtoul(p->accumulated, &end, 0);
-      if (end != bufend) {
+      uint64_t val;
+      if (!upb_json_parseuint64(buf, len, &val)) {
         break;
-      } else if (errno == ERANGE) {
-        return false;
       } else {
         upb_sink_putuint64(&p->top->sink, parser_getsel(p), val);
         return true;
@@ -837,22 +899,14 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
     return false;
   }
 
-  if (len == strlen("Infinity") && strcmp(buf, "Infinity") == 0) {
-    /* C89 does not have an INFINITY macro. */
-    val = inf;
-  } else if (len == strlen("-Infinity") && strcmp(buf, "-Infinity") == 0) {
-    val = -inf;
-  } else {
-    val = strtod(buf, &end);
-    if (errno == ERANGE || end != bufend) {
-      return false;
-    }
+  if (!upb_json_parsedouble(buf, len, &val)) {
+    return false;
   }
 
   switch (type) {
 #define CASE(capitaltype, smalltype, ctype, min, max)                     \
     case UPB_TYPE_ ## capitaltype: {                                      \
-      if (modf(val, &dummy) != 0 || val > max || val < min) {             \
+      if (modf(val, &dummy) != 0 || !(val >= min && val < max)) {        \
         return false;                                                     \
       } else {                                                            \
         upb_sink_put ## smalltype(&p->top->sink, parser_getsel(p),        \
@@ -861,11 +915,12 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
       }                                                                   \
       break;                                                              \
     }
+    /* |max| is exclusive, and a power of two so that it is exact. */
     case UPB_TYPE_ENUM:
-    CASE(INT32, int32, int32_t, INT32_MIN, INT32_MAX);
-    CASE(INT64, int64, int64_t, INT64_MIN, INT64_MAX);
-    CASE(UINT32, uint32, uint32_t, 0, UINT32_MAX);
-    CASE(UINT64, uint64, uint64_t, 0, UINT64_MAX);
+    CASE(INT32, int32, int32_t, -2147483648.0, 2147483648.0);
+    CASE(INT64, int64, int64_t, -9223372036854775808.0, 9223372036854775808.0);
+    CASE(UINT32, uint32, uint32_t, 0, 4294967296.0);
+    CASE(UINT64, uint64, uint64_t, 0, 18446744073709551616.0);
 #undef CASE
 
     case UPB_TYPE_DOUBLE:
@@ -887,19 +942,21 @@ static bool parse_number(upb_json_parser *p, bool is_quoted) {
   size_t len;
   const char *buf;
 
-  /* strtol() and friends unfortunately do not support specifying the length of
-   * the input string, so we need to force a copy into a NULL-terminated buffer. */
-  if (!multipart_text(p, "\0", 1, false)) {
-    return false;
+  /* This is a pointer straight into the input unless the number spanned
+   * buffers.  An empty string accumulates nothing at all. */
+  if (p->accumulated) {
+    buf = accumulate_getptr(p, &len);
+  } else {
+    buf = "";
+    len = 0;
   }
 
-  buf = accumulate_getptr(p, &len);
-
-  if (parse_number_from_buffer(p, buf, is_quoted)) {
+  if (parse_number_from_buffer(p, buf, len, is_quoted)) {
     multipart_end(p);
     return true;
   } else {
-    upb_status_seterrf(&p->status, "error parsing number: %s", buf);
+    upb_status_seterrf(&p->status, "error parsing number: %.*s", (int)len,
+                       buf);
     upb_env_reporterror(p->env, &p->status);
     multipart_end(p);
     return false;
@@ -1054,18 +1111,14 @@ static bool start_stringval(upb_json_parser *p) {
     inner->is_mapentry = false;
     p->top = inner;
 
+    /* We push data to the handlers as it is parsed, decoding it first for
+     * BYTES fields. */
     if (upb_fielddef_type(p->top->f) == UPB_TYPE_STRING) {
-      /* For STRING fields we push data directly to the handlers as it is
-       * parsed.  We don't do this yet for BYTES fields, because our base64
-       * decoder is not streaming.
-       *
-       * TODO(haberman): make base64 decoding streaming also. */
       multipart_start(p, getsel_for_handlertype(p, UPB_HANDLER_STRING));
-      return true;
     } else {
-      multipart_startaccum(p);
-      return true;
+      multipart_startbase64(p, getsel_for_handlertype(p, UPB_HANDLER_STRING));
     }
+    return true;
   } else if (upb_fielddef_type(p->top->f) != UPB_TYPE_BOOL &&
              upb_fielddef_type(p->top->f) != UPB_TYPE_MESSAGE) {
     /* No need to push a frame -- numeric values in quotes remain in the
@@ -1097,14 +1150,19 @@ static bool end_stringval_nontop(upb_json_parser *p) {
 
   switch (upb_fielddef_type(p->top->f)) {
     case UPB_TYPE_BYTES:
-      if (!base64_push(p, getsel_for_handlertype(p, UPB_HANDLER_STRING),
-                       p->accumulated, p->accumulated_len)) {
+      if (!base64_end(p)) {
         return false;
       }
       /* Fall through. */
 
     case UPB_TYPE_STRING: {
       upb_selector_t sel = getsel_for_handlertype(p, UPB_HANDLER_ENDSTR);
+      if (p->validate_utf8 && upb_fielddef_type(p->top->f) == UPB_TYPE_STRING &&
+          p->utf8state != UPB_UTF8_ACCEPT) {
+        upb_status_seterrmsg(&p->status, "Invalid UTF-8 in string");
+        upb_env_reporterror(p->env, &p->status);
+        return false;
+      }
       p->top--;
       upb_sink_endstr(&p->top->sink, sel);
       break;
@@ -1138,8 +1196,8 @@ static bool end_stringval_nontop(upb_json_parser *p) {
     case UPB_TYPE_UINT64:
     case UPB_TYPE_DOUBLE:
     case UPB_TYPE_FLOAT:
-      ok = parse_number(p, true);
-      break;
+      /* parse_number() ends the multipart text itself. */
+      return parse_number(p, true);
 
     default:
       UPB_ASSERT(false);
@@ -1298,7 +1356,7 @@ static bool end_timestamp_base(upb_json_parser *p, const char *ptr) {
   buf = accumulate_getptr(p, &len);
 
   /* Parse seconds */
-  if (strptime(buf, "%FT%H:%M:%S", &p->tm) == NULL) {
+  if (!upb_json_parsedatetime(buf, len, &p->timestamp_seconds)) {
     upb_status_seterrf(&p->status, "error parsing timestamp: %s", buf);
     upb_env_reporterror(p->env, &p->status);
     return false;
@@ -1318,14 +1376,10 @@ static void start_timestamp_fraction(upb_json_parser *p, const char *ptr) {
 static bool end_timestamp_fraction(upb_json_parser *p, const char *ptr) {
   size_t len;
   const char *buf;
-  char nanos_buf[12];
-  char *end;
-  double val = 0.0;
+  uint64_t val;
   int32_t nanos;
   const char *nanos_membername = "nanos";
 
-  memset(nanos_buf, 0, 12);
-
   if (!capture_end(p, ptr)) {
     return false;
   }
@@ -1339,19 +1393,17 @@ static bool end_timestamp_fraction(upb_json_parser *p, const char *ptr) {
     return false;
   }
 
-  /* Parse nanos */
-  nanos_buf[0] = '0';
-  memcpy(nanos_buf + 1, buf, len);
-  val = strtod(nanos_buf, &end);
-
-  if (errno == ERANGE || end != nanos_buf + len + 1) {
-    upb_status_seterrf(&p->status, "error parsing timestamp nanos: %s",
-                       nanos_buf);
+  /* Parse nanos: the digits after the '.', scaled up to nine of them. */
+  if (!upb_json_parseuint64(buf + 1, len - 1, &val)) {
+    upb_status_seterrf(&p->status, "error parsing timestamp nanos: %.*s",
+                       (int)len, buf);
     upb_env_reporterror(p->env, &p->status);
     return false;
   }
 
-  nanos = val * 1000000000;
+  for (nanos = (int32_t)val; len < 10; len++) {
+    nanos *= 10;
+  }
 
   /* Clean up previous environment */
   multipart_end(p);
@@ -1378,7 +1430,7 @@ static bool end_timestamp_zone(upb_json_parser *p, const char *ptr) {
   size_t len;
   const char *buf;
   int hours;
-  int64_t seconds;
+  int64_t seconds = p->timestamp_seconds;
   const char *seconds_membername = "seconds";
 
   if (!capture_end(p, ptr)) {
@@ -1388,22 +1440,16 @@ static bool end_timestamp_zone(upb_json_parser *p, const char *ptr) {
   buf = accumulate_getptr(p, &len);
 
   if (buf[0] != 'Z') {
-    if (sscanf(buf + 1, "%2d:00", &hours) != 1) {
-      upb_status_seterrf(&p->status, "error parsing timestamp offset");
-      upb_env_reporterror(p->env, &p->status);
-      return false;
-    }
+    /* The grammar only lets through "+hh:00" or "-hh:00". */
+    hours = (buf[1] - '0') * 10 + (buf[2] - '0');
 
     if (buf[0] == '+') {
       hours = -hours;
     }
 
-    p->tm.tm_hour += hours;
+    seconds += hours * 3600;
   }
 
-  /* Normalize tm */
-  seconds = mktime(&p->tm);
-
   /* Check timestamp boundary */
   if (seconds < -62135596800) {
     upb_status_seterrf(&p->status, "error parsing timestamp: "
@@ -1413,6 +1459,14 @@ static bool end_timestamp_zone(upb_json_parser *p, const char *ptr) {
     return false;
   }
 
+  if (seconds > 253402300799) {
+    upb_status_seterrf(&p->status, "error parsing timestamp: "
+                                   "maximum acceptable value is "
+                                   "9999-12-31T23:59:59Z");
+    upb_env_reporterror(p->env, &p->status);
+    return false;
+  }
+
   /* Clean up previous environment */
   multipart_end(p);
 
@@ -2129,7 +2183,7 @@ static bool is_structvalue_object(upb_json_parser *p) {
 
   text =
     /[^\\"]/+
-      >{ start_text(parser, p); }
+      >{ p = start_text(parser, p, pe); }
       %{ CHECK_RETURN_TOP(end_text(parser, p)); }
     ;
 
@@ -2397,6 +2451,7 @@ static void add_jsonname_table(upb_json_parsermethod *m, const upb_msgdef* md) {
     }
   }
 
+  upb_strtable_compact(t);
   upb_gfree(buf);
 }
 
@@ -2425,6 +2480,7 @@ upb_json_parser *upb_json_parser_create(upb_env *env,
   set_name_table(p, p->top);
 
   p->ignore_json_unknown = ignore_json_unknown;
+  p->validate_utf8 = false;
 
   /* If this fails, uncomment and increase the value in parser.h. */
   /* fprintf(stderr, "%zd\n", upb_env_bytesallocated(env) - size_before); */
@@ -2437,6 +2493,14 @@ upb_bytessink *upb_json_parser_input(upb_json_parser *p) {
   return &p->input_;
 }
 
+void upb_json_parser_reset(upb_json_parser *p) {
+  json_parser_reset(p);
+}
+
+void upb_json_parser_setvalidateutf8(upb_json_parser *p, bool validate) {
+  p->validate_utf8 = validate;
+}
+
 upb_json_parsermethod *upb_json_parsermethod_new(const upb_msgdef* md,
                                                  const void* owner) {
   static const struct upb_refcounted_vtbl vtbl = {visit_json_parsermethod,
@@ -1,19 +1,20 @@
 /*
-** This currently uses snprintf() to format primitives, and could be optimized
-** further.
+** This formats numbers with its own routines rather than snprintf(), which is
+** both slow and locale-dependent; see number.c.
 */
 
 #include "upb/json/printer.h"
+#include "upb/json/base64.int.h"
+#include "upb/json/number.int.h"
+#include "upb/json/scan.int.h"
 
 #include <string.h>
 #include <stdint.h>
-#include <time.h>
 
 struct upb_json_printer {
   upb_sink input_;
-  /* BytesSink closure. */
-  void *subc_;
-  upb_bytessink *output_;
+  /* Output goes through this buffer so that small writes are coalesced. */
+  upb_bytesbuf output_;
 
   /* We track the depth so that we know when to emit startstr/endstr on the
    * output. */
@@ -34,6 +35,10 @@ struct upb_json_printer {
    * printer_sethandlers_timestamp for more detail. */
   int64_t seconds;
   int32_t nanos;
+
+  /* Bytes of a bytes value still to be base64-encoded; see putbytes(). */
+  char base64_buf_[3];
+  size_t base64_len_;
 };
 
 /* StringPiece; a pointer plus a length. */
@@ -48,23 +53,33 @@ void freestrpc(void *ptr) {
   upb_gfree(pc);
 }
 
-/* Convert fielddef name to JSON name and return as a string piece. */
+/* Builds the complete key text for field |f|, ie. ,"fieldName": -- leading
+ * comma included, so that putkey() is a single print_data() call.  Field
+ * names are identifiers, so no escaping is needed. */
 strpc *newstrpc(upb_handlers *h, const upb_fielddef *f,
                 bool preserve_fieldnames) {
   /* TODO(haberman): handle malloc failure. */
   strpc *ret = upb_gmalloc(sizeof(*ret));
+  size_t len;
   if (preserve_fieldnames) {
-    ret->ptr = upb_gstrdup(upb_fielddef_name(f));
-    ret->len = strlen(ret->ptr);
+    const char *name = upb_fielddef_name(f);
+    len = strlen(name);
+    ret->ptr = upb_gmalloc(len + 4);
+    memcpy(ret->ptr + 2, name, len);
   } else {
-    size_t len;
-    ret->len = upb_fielddef_getjsonname(f, NULL, 0);
-    ret->ptr = upb_gmalloc(ret->len);
-    len = upb_fielddef_getjsonname(f, ret->ptr, ret->len);
-    UPB_ASSERT(len == ret->len);
-    ret->len--;  /* NULL */
+    /* getjsonname() counts the NULL, which takes the place of the closing
+     * quote. */
+    len = upb_fielddef_getjsonname(f, NULL, 0) - 1;
+    ret->ptr = upb_gmalloc(len + 4);
+    upb_fielddef_getjsonname(f, ret->ptr + 2, len + 1);
   }
 
+  ret->ptr[0] = ',';
+  ret->ptr[1] = '"';
+  ret->ptr[len + 2] = '"';
+  ret->ptr[len + 3] = ':';
+  ret->len = len + 4;
+
   upb_handlers_addcleanup(h, ret, freestrpc);
   return ret;
 }
@@ -74,8 +89,8 @@ strpc *newstrpc(upb_handlers *h, const upb_fielddef *f,
 static void print_data(
     upb_json_printer *p, const char *buf, unsigned int len) {
   /* TODO: Will need to change if we support pushback from the sink. */
-  size_t n = upb_bytessink_putbuf(p->output_, p->subc_, buf, len, NULL);
-  UPB_ASSERT(n == len);
+  bool ok = upb_bytesbuf_put(&p->output_, buf, len);
+  UPB_ASSERT(ok);
 }
 
 static void print_comma(upb_json_printer *p) {
@@ -87,15 +102,6 @@ static void print_comma(upb_json_printer *p) {
 
 /* Helpers that print properly formatted elements to the JSON output stream. */
 
-/* Used for escaping control chars in strings. */
-static const char kControlCharLimit = 0x20;
-
-UPB_INLINE bool is_json_escaped(char c) {
-  /* See RFC 4627. */
-  unsigned char uc = (unsigned char)c;
-  return uc < kControlCharLimit || uc == '"' || uc == '\\';
-}
-
 UPB_INLINE const char* json_nice_escape(char c) {
   switch (c) {
     case '"':  return "\\\"";
@@ -113,94 +119,43 @@ UPB_INLINE const char* json_nice_escape(char c) {
  * printed; this is so that the caller has the option of emitting the string
  * content in chunks. */
 static void putstring(upb_json_printer *p, const char *buf, unsigned int len) {
-  const char* unescaped_run = NULL;
-  unsigned int i;
-  for (i = 0; i < len; i++) {
-    char c = buf[i];
-    /* Handle escaping. */
-    if (is_json_escaped(c)) {
+  const char *ptr = buf;
+  const char *end = buf + len;
+
+  while (ptr < end) {
+    /* N.B. that we assume that the input encoding is equal to the output
+     * encoding (both UTF-8 for  now), so for chars >= 0x20 and != \, ", we
+     * can simply pass the bytes through.  Print each such run in one go. */
+    const char *run = ptr;
+    ptr = upb_json_skipplain(ptr, end, true);
+    if (ptr > run) {
+      print_data(p, run, ptr - run);
+    }
+
+    if (ptr < end) {
       /* Use a "nice" escape, like \n, if one exists for this character. */
-      const char* escape = json_nice_escape(c);
+      const char* escape = json_nice_escape(*ptr);
       /* If we don't have a specific 'nice' escape code, use a \uXXXX-style
        * escape. */
       char escape_buf[8];
       if (!escape) {
-        unsigned char byte = (unsigned char)c;
+        unsigned char byte = (unsigned char)*ptr;
         _upb_snprintf(escape_buf, sizeof(escape_buf), "\\u%04x", (int)byte);
         escape = escape_buf;
       }
-
-      /* N.B. that we assume that the input encoding is equal to the output
-       * encoding (both UTF-8 for  now), so for chars >= 0x20 and != \, ", we
-       * can simply pass the bytes through. */
-
-      /* If there's a current run of unescaped chars, print that run first. */
-      if (unescaped_run) {
-        print_data(p, unescaped_run, &buf[i] - unescaped_run);
-        unescaped_run = NULL;
-      }
-      /* Then print the escape code. */
       print_data(p, escape, strlen(escape));
-    } else {
-      /* Add to the current unescaped run of characters. */
-      if (unescaped_run == NULL) {
-        unescaped_run = &buf[i];
-      }
+      ptr++;
     }
   }
-
-  /* If the string ended in a run of unescaped characters, print that last run. */
-  if (unescaped_run) {
-    print_data(p, unescaped_run, &buf[len] - unescaped_run);
-  }
 }
 
 #define CHKLENGTH(x) if (!(x)) return -1;
 
-/* Helpers that format floating point values according to our custom formats.
- * Right now we use %.8g and %.17g for float/double, respectively, to match
- * proto2::util::JsonFormat's defaults.  May want to change this later. */
-
-const char neginf[] = "\"-Infinity\"";
-const char inf[] = "\"Infinity\"";
-
-static size_t fmt_double(double val, char* buf, size_t length) {
-  if (val == (1.0 / 0.0)) {
-    CHKLENGTH(length >= strlen(inf));
-    strcpy(buf, inf);
-    return strlen(inf);
-  } else if (val == (-1.0 / 0.0)) {
-    CHKLENGTH(length >= strlen(neginf));
-    strcpy(buf, neginf);
-    return strlen(neginf);
-  } else {
-    size_t n = _upb_snprintf(buf, length, "%.17g", val);
-    CHKLENGTH(n > 0 && n < length);
-    return n;
-  }
-}
-
-static size_t fmt_float(float val, char* buf, size_t length) {
-  size_t n = _upb_snprintf(buf, length, "%.8g", val);
-  CHKLENGTH(n > 0 && n < length);
-  return n;
-}
-
 static size_t fmt_bool(bool val, char* buf, size_t length) {
-  size_t n = _upb_snprintf(buf, length, "%s", (val ? "true" : "false"));
-  CHKLENGTH(n > 0 && n < length);
-  return n;
-}
-
-static size_t fmt_int64(long val, char* buf, size_t length) {
-  size_t n = _upb_snprintf(buf, length, "%ld", val);
-  CHKLENGTH(n > 0 && n < length);
-  return n;
-}
-
-static size_t fmt_uint64(unsigned long long val, char* buf, size_t length) {
-  size_t n = _upb_snprintf(buf, length, "%llu", val);
-  CHKLENGTH(n > 0 && n < length);
+  const char *str = val ? "true" : "false";
+  size_t n = strlen(str);
+  CHKLENGTH(n < length);
+  memcpy(buf, str, n);
   return n;
 }
 
@@ -209,10 +164,13 @@ static size_t fmt_uint64(unsigned long long val, char* buf, size_t length) {
 static bool putkey(void *closure, const void *handler_data) {
   upb_json_printer *p = closure;
   const strpc *key = handler_data;
-  print_comma(p);
-  print_data(p, "\"", 1);
-  putstring(p, key->ptr, key->len);
-  print_data(p, "\":", 2);
+  if (p->first_elem_[p->depth_]) {
+    /* Skip the comma. */
+    print_data(p, key->ptr + 1, key->len - 1);
+    p->first_elem_[p->depth_] = false;
+  } else {
+    print_data(p, key->ptr, key->len);
+  }
   return true;
 }
 
@@ -253,20 +211,20 @@ static bool putkey(void *closure, const void *handler_data) {
     return true;                                                             \
   }
 
-TYPE_HANDLERS(double,   fmt_double)
-TYPE_HANDLERS(float,    fmt_float)
+TYPE_HANDLERS(double,   upb_json_fmtdouble)
+TYPE_HANDLERS(float,    upb_json_fmtfloat)
 TYPE_HANDLERS(bool,     fmt_bool)
-TYPE_HANDLERS(int32_t,  fmt_int64)
-TYPE_HANDLERS(uint32_t, fmt_int64)
-TYPE_HANDLERS(int64_t,  fmt_int64)
-TYPE_HANDLERS(uint64_t, fmt_uint64)
+TYPE_HANDLERS(int32_t,  upb_json_fmtint64)
+TYPE_HANDLERS(uint32_t, upb_json_fmtint64)
+TYPE_HANDLERS(int64_t,  upb_json_fmtint64)
+TYPE_HANDLERS(uint64_t, upb_json_fmtuint64)
 
 /* double and float are not allowed to be map keys. */
 TYPE_HANDLERS_MAPKEY(bool,     fmt_bool)
-TYPE_HANDLERS_MAPKEY(int32_t,  fmt_int64)
-TYPE_HANDLERS_MAPKEY(uint32_t, fmt_int64)
-TYPE_HANDLERS_MAPKEY(int64_t,  fmt_int64)
-TYPE_HANDLERS_MAPKEY(uint64_t, fmt_uint64)
+TYPE_HANDLERS_MAPKEY(int32_t,  upb_json_fmtint64)
+TYPE_HANDLERS_MAPKEY(uint32_t, upb_json_fmtint64)
+TYPE_HANDLERS_MAPKEY(int64_t,  upb_json_fmtint64)
+TYPE_HANDLERS_MAPKEY(uint64_t, upb_json_fmtuint64)
 
 #undef TYPE_HANDLERS
 #undef TYPE_HANDLERS_MAPKEY
@@ -356,7 +314,7 @@ static bool printer_startmsg(void *closure, const void *handler_data) {
   upb_json_printer *p = closure;
   UPB_UNUSED(handler_data);
   if (p->depth_ == 0) {
-    upb_bytessink_start(p->output_, 0, &p->subc_);
+    upb_bytesbuf_start(&p->output_, 0);
   }
   start_frame(p);
   return true;
@@ -368,7 +326,7 @@ static bool printer_endmsg(void *closure, const void *handler_data, upb_status *
   UPB_UNUSED(s);
   end_frame(p);
   if (p->depth_ == 0) {
-    upb_bytessink_end(p->output_);
+    upb_bytesbuf_end(&p->output_);
   }
   return true;
 }
@@ -417,65 +375,50 @@ static size_t putstr(void *closure, const void *handler_data, const char *str,
 }
 
 /* This has to Base64 encode the bytes, because JSON has no "bytes" type. */
+/* Bytes values are base64-encoded as they arrive.  Bytes that don't make up a
+ * whole group of three are carried over to the next call in base64_buf_, and
+ * encoded with padding when the value ends. */
 static size_t putbytes(void *closure, const void *handler_data, const char *str,
                        size_t len, const upb_bufhandle *handle) {
   upb_json_printer *p = closure;
-
-  /* This is the regular base64, not the "web-safe" version. */
-  static const char base64[] =
-      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-  /* Base64-encode. */
-  char data[16000];
-  const char *limit = data + sizeof(data);
-  const unsigned char *from = (const unsigned char*)str;
-  char *to = data;
+  char data[16384];
   size_t remaining = len;
-  size_t bytes;
 
   UPB_UNUSED(handler_data);
   UPB_UNUSED(handle);
 
-  while (remaining > 2) {
-    /* TODO(haberman): handle encoded lengths > sizeof(data) */
-    UPB_ASSERT((limit - to) >= 4);
-
-    to[0] = base64[from[0] >> 2];
-    to[1] = base64[((from[0] & 0x3) << 4) | (from[1] >> 4)];
-    to[2] = base64[((from[1] & 0xf) << 2) | (from[2] >> 6)];
-    to[3] = base64[from[2] & 0x3f];
-
-    remaining -= 3;
-    to += 4;
-    from += 3;
+  if (p->base64_len_ > 0) {
+    size_t n = UPB_MIN(3 - p->base64_len_, len);
+    memcpy(p->base64_buf_ + p->base64_len_, str, n);
+    p->base64_len_ += n;
+    str += n;
+    remaining -= n;
+    if (p->base64_len_ < 3) return len;
+    print_data(p, data, upb_json_b64encode(p->base64_buf_, 3, data));
+    p->base64_len_ = 0;
   }
 
-  switch (remaining) {
-    case 2:
-      to[0] = base64[from[0] >> 2];
-      to[1] = base64[((from[0] & 0x3) << 4) | (from[1] >> 4)];
-      to[2] = base64[(from[1] & 0xf) << 2];
-      to[3] = '=';
-      to += 4;
-      from += 2;
-      break;
-    case 1:
-      to[0] = base64[from[0] >> 2];
-      to[1] = base64[((from[0] & 0x3) << 4)];
-      to[2] = '=';
-      to[3] = '=';
-      to += 4;
-      from += 1;
-      break;
+  while (remaining >= 3) {
+    size_t n = UPB_MIN(remaining / 3 * 3, sizeof(data) / 4 * 3);
+    print_data(p, data, upb_json_b64encode(str, n, data));
+    str += n;
+    remaining -= n;
   }
 
-  bytes = to - data;
-  print_data(p, "\"", 1);
-  putstring(p, data, bytes);
-  print_data(p, "\"", 1);
+  memcpy(p->base64_buf_, str, remaining);
+  p->base64_len_ = remaining;
   return len;
 }
 
+/* Encodes whatever putbytes() carried over, with padding. */
+static void flushbytes(upb_json_printer *p) {
+  if (p->base64_len_ > 0) {
+    char data[4];
+    print_data(p, data, upb_json_b64encode(p->base64_buf_, p->base64_len_, data));
+    p->base64_len_ = 0;
+  }
+}
+
 static void *scalar_startstr(void *closure, const void *handler_data,
                              size_t size_hint) {
   upb_json_printer *p = closure;
@@ -554,30 +497,42 @@ static bool mapvalue_endstr(void *closure, const void *handler_data) {
   return true;
 }
 
-static size_t scalar_bytes(void *closure, const void *handler_data,
-                           const char *str, size_t len,
-                           const upb_bufhandle *handle) {
-  CHK(putkey(closure, handler_data));
-  CHK(putbytes(closure, handler_data, str, len, handle));
-  return len;
+static void *scalar_startbytes(void *closure, const void *handler_data,
+                               size_t size_hint) {
+  upb_json_printer *p = closure;
+  p->base64_len_ = 0;
+  return scalar_startstr(closure, handler_data, size_hint);
 }
 
-static size_t repeated_bytes(void *closure, const void *handler_data,
-                             const char *str, size_t len,
-                             const upb_bufhandle *handle) {
+static void *repeated_startbytes(void *closure, const void *handler_data,
+                                 size_t size_hint) {
   upb_json_printer *p = closure;
-  print_comma(p);
-  CHK(putbytes(closure, handler_data, str, len, handle));
-  return len;
+  p->base64_len_ = 0;
+  return repeated_startstr(closure, handler_data, size_hint);
 }
 
-static size_t mapkey_bytes(void *closure, const void *handler_data,
-                           const char *str, size_t len,
-                           const upb_bufhandle *handle) {
+static void *mapkeyval_startbytes(void *closure, const void *handler_data,
+                                  size_t size_hint) {
   upb_json_printer *p = closure;
-  CHK(putbytes(closure, handler_data, str, len, handle));
-  print_data(p, ":", 1);
-  return len;
+  p->base64_len_ = 0;
+  return mapkeyval_startstr(closure, handler_data, size_hint);
+}
+
+/* Ends a scalar, repeated or map value bytes field. */
+static bool endbytes(void *closure, const void *handler_data) {
+  upb_json_printer *p = closure;
+  UPB_UNUSED(handler_data);
+  flushbytes(p);
+  print_data(p, "\"", 1);
+  return true;
+}
+
+static bool mapkey_endbytes(void *closure, const void *handler_data) {
+  upb_json_printer *p = closure;
+  UPB_UNUSED(handler_data);
+  flushbytes(p);
+  print_data(p, "\":", 2);
+  return true;
 }
 
 static void set_enum_hd(upb_handlers *h,
@@ -639,7 +594,9 @@ void printer_sethandlers_mapentry(const void *closure, bool preserve_fieldnames,
       upb_handlers_setendstr(h, key_field, mapkey_endstr, &empty_attr);
       break;
     case UPB_TYPE_BYTES:
-      upb_handlers_setstring(h, key_field, mapkey_bytes, &empty_attr);
+      upb_handlers_setstartstr(h, key_field, mapkeyval_startbytes, &empty_attr);
+      upb_handlers_setstring(h, key_field, putbytes, &empty_attr);
+      upb_handlers_setendstr(h, key_field, mapkey_endbytes, &empty_attr);
       break;
     default:
       UPB_ASSERT(false);
@@ -674,7 +631,10 @@ void printer_sethandlers_mapentry(const void *closure, bool preserve_fieldnames,
       upb_handlers_setendstr(h, value_field, mapvalue_endstr, &empty_attr);
       break;
     case UPB_TYPE_BYTES:
+      upb_handlers_setstartstr(h, value_field, mapkeyval_startbytes,
+                               &empty_attr);
       upb_handlers_setstring(h, value_field, putbytes, &empty_attr);
+      upb_handlers_setendstr(h, value_field, endbytes, &empty_attr);
       break;
     case UPB_TYPE_ENUM: {
       upb_handlerattr enum_attr = UPB_HANDLERATTR_INITIALIZER;
@@ -712,23 +672,18 @@ static bool printer_startdurationmsg(void *closure, const void *handler_data) {
   upb_json_printer *p = closure;
   UPB_UNUSED(handler_data);
   if (p->depth_ == 0) {
-    upb_bytessink_start(p->output_, 0, &p->subc_);
+    upb_bytesbuf_start(&p->output_, 0);
   }
   return true;
 }
 
-#define UPB_DURATION_MAX_JSON_LEN 23
-#define UPB_DURATION_MAX_NANO_LEN 9
+#define UPB_DURATION_MAX_JSON_LEN 32
 
 static bool printer_enddurationmsg(void *closure, const void *handler_data,
                                    upb_status *s) {
   upb_json_printer *p = closure;
   char buffer[UPB_DURATION_MAX_JSON_LEN];
-  size_t base_len;
-  size_t curr;
-  size_t i;
-
-  memset(buffer, 0, UPB_DURATION_MAX_JSON_LEN);
+  size_t n;
 
   if (p->seconds < -315576000000) {
     upb_status_seterrf(s, "error parsing duration: "
@@ -744,33 +699,23 @@ static bool printer_enddurationmsg(void *closure, const void *handler_data,
     return false;
   }
 
-  _upb_snprintf(buffer, sizeof(buffer), "%ld", (long)p->seconds);
-  base_len = strlen(buffer);
-
-  if (p->nanos != 0) {
-    char nanos_buffer[UPB_DURATION_MAX_NANO_LEN + 3];
-    _upb_snprintf(nanos_buffer, sizeof(nanos_buffer), "%.9f",
-                  p->nanos / 1000000000.0);
-    /* Remove trailing 0. */
-    for (i = UPB_DURATION_MAX_NANO_LEN + 2;
-         nanos_buffer[i] == '0'; i--) {
-      nanos_buffer[i] = 0;
-    }
-    strcpy(buffer + base_len, nanos_buffer + 1);
+  if (p->nanos <= -1000000000 || p->nanos >= 1000000000) {
+    upb_status_seterrf(s, "error serializing duration: "
+                          "nanos out of range");
+    return false;
   }
 
-  curr = strlen(buffer);
-  strcpy(buffer + curr, "s");
+  n = upb_json_fmtduration(p->seconds, p->nanos, buffer, sizeof(buffer));
 
   p->seconds = 0;
   p->nanos = 0;
 
   print_data(p, "\"", 1);
-  print_data(p, buffer, strlen(buffer));
+  print_data(p, buffer, n);
   print_data(p, "\"", 1);
 
   if (p->depth_ == 0) {
-    upb_bytessink_end(p->output_);
+    upb_bytesbuf_end(&p->output_);
   }
 
   UPB_UNUSED(handler_data);
@@ -781,24 +726,18 @@ static bool printer_starttimestampmsg(void *closure, const void *handler_data) {
   upb_json_printer *p = closure;
   UPB_UNUSED(handler_data);
   if (p->depth_ == 0) {
-    upb_bytessink_start(p->output_, 0, &p->subc_);
+    upb_bytesbuf_start(&p->output_, 0);
   }
   return true;
 }
 
 #define UPB_TIMESTAMP_MAX_JSON_LEN 31
-#define UPB_TIMESTAMP_BEFORE_NANO_LEN 19
-#define UPB_TIMESTAMP_MAX_NANO_LEN 9
 
 static bool printer_endtimestampmsg(void *closure, const void *handler_data,
                                     upb_status *s) {
   upb_json_printer *p = closure;
   char buffer[UPB_TIMESTAMP_MAX_JSON_LEN];
-  time_t time = p->seconds;
-  size_t curr;
-  size_t i;
-  size_t year_length =
-      strftime(buffer, UPB_TIMESTAMP_MAX_JSON_LEN, "%Y", gmtime(&time));
+  size_t n;
 
   if (p->seconds < -62135596800) {
     upb_status_seterrf(s, "error parsing timestamp: "
@@ -814,41 +753,26 @@ static bool printer_endtimestampmsg(void *closure, const void *handler_data,
     return false;
   }
 
-  /* strftime doesn't guarantee 4 digits for year. Prepend 0 by ourselves. */
-  for (i = 0; i < 4 - year_length; i++) {
-    buffer[i] = '0';
-  }
-
-  strftime(buffer + (4 - year_length), UPB_TIMESTAMP_MAX_JSON_LEN,
-           "%Y-%m-%dT%H:%M:%S", gmtime(&time));
-  if (p->nanos != 0) {
-    char nanos_buffer[UPB_TIMESTAMP_MAX_NANO_LEN + 3];
-    _upb_snprintf(nanos_buffer, sizeof(nanos_buffer), "%.9f",
-                  p->nanos / 1000000000.0);
-    /* Remove trailing 0. */
-    for (i = UPB_TIMESTAMP_MAX_NANO_LEN + 2;
-         nanos_buffer[i] == '0'; i--) {
-      nanos_buffer[i] = 0;
-    }
-    strcpy(buffer + UPB_TIMESTAMP_BEFORE_NANO_LEN, nanos_buffer + 1);
+  if (p->nanos < 0 || p->nanos >= 1000000000) {
+    upb_status_seterrf(s, "error serializing timestamp: "
+                          "nanos out of range");
+    return false;
   }
 
-  curr = strlen(buffer);
-  strcpy(buffer + curr, "Z");
+  n = upb_json_fmttimestamp(p->seconds, p->nanos, buffer, sizeof(buffer));
 
   p->seconds = 0;
   p->nanos = 0;
 
   print_data(p, "\"", 1);
-  print_data(p, buffer, strlen(buffer));
+  print_data(p, buffer, n);
   print_data(p, "\"", 1);
 
   if (p->depth_ == 0) {
-    upb_bytessink_end(p->output_);
+    upb_bytesbuf_end(&p->output_);
   }
 
   UPB_UNUSED(handler_data);
-  UPB_UNUSED(s);
   return true;
 }
 
@@ -980,13 +904,13 @@ void printer_sethandlers(const void *closure, upb_handlers *h) {
         }
         break;
       case UPB_TYPE_BYTES:
-        /* XXX: this doesn't support strings that span buffers yet. The base64
-         * encoder will need to be made resumable for this to work properly. */
         if (upb_fielddef_isseq(f)) {
-          upb_handlers_setstring(h, f, repeated_bytes, &empty_attr);
+          upb_handlers_setstartstr(h, f, repeated_startbytes, &empty_attr);
         } else {
-          upb_handlers_setstring(h, f, scalar_bytes, &name_attr);
+          upb_handlers_setstartstr(h, f, scalar_startbytes, &name_attr);
         }
+        upb_handlers_setstring(h, f, putbytes, &empty_attr);
+        upb_handlers_setendstr(h, f, endbytes, &empty_attr);
         break;
       case UPB_TYPE_MESSAGE:
         if (upb_fielddef_isseq(f)) {
@@ -1020,7 +944,9 @@ upb_json_printer *upb_json_printer_create(upb_env *e, const upb_handlers *h,
   upb_json_printer *p = upb_env_malloc(e, sizeof(upb_json_printer));
   if (!p) return NULL;
 
-  p->output_ = output;
+  if (!upb_bytesbuf_init(&p->output_, e, UPB_BYTESBUF_DEFAULTSIZE, output)) {
+    return NULL;
+  }
   json_printer_reset(p);
   upb_sink_reset(&p->input_, h, p);
   p->seconds = 0;
@@ -1036,9 +962,21 @@ upb_sink *upb_json_printer_input(upb_json_printer *p) {
   return &p->input_;
 }
 
+void upb_json_printer_reset(upb_json_printer *p) {
+  json_printer_reset(p);
+}
+
 const upb_handlers *upb_json_printer_newhandlers(const upb_msgdef *md,
                                                  bool preserve_fieldnames,
                                                  const void *owner) {
   return upb_handlers_newfrozen(
       md, owner, printer_sethandlers, &preserve_fieldnames);
 }
+
+upb_handlercache *upb_json_printer_newcache(bool preserve_fieldnames) {
+  /* The closure has to outlive the cache. */
+  static const bool preserve = true;
+  static const bool nopreserve = false;
+  return upb_handlercache_new(printer_sethandlers,
+                              preserve_fieldnames ? &preserve : &nopreserve);
+}
@@ -22,7 +22,7 @@ UPB_DECLARE_TYPE(upb::json::Printer, upb_json_printer)
 
 /* upb::json::Printer *********************************************************/
 
-#define UPB_JSON_PRINTER_SIZE 192
+#define UPB_JSON_PRINTER_SIZE 4448
 
 #ifdef __cplusplus
 
@@ -35,6 +35,10 @@ class upb::json::Printer {
   /* The input to the printer. */
   Sink* input();
 
+  /* Abandons the message being printed, if any, so that the printer can start
+   * on a new one.  Nothing is allocated, then or after. */
+  void Reset();
+
   /* Returns handlers for printing according to the specified schema.
    * If preserve_proto_fieldnames is true, the output JSON will use the
    * original .proto field names (ie. {"my_field":3}) instead of using
@@ -42,6 +46,11 @@ class upb::json::Printer {
   static reffed_ptr<const Handlers> NewHandlers(const upb::MessageDef* md,
                                                 bool preserve_proto_fieldnames);
 
+  /* Returns a new cache of the handlers NewHandlers() would return, so that
+   * a printer for a message type that has been printed before costs nothing
+   * to set up.  The caller owns the cache. */
+  static HandlerCache* NewCache(bool preserve_proto_fieldnames);
+
   static const size_t kSize = UPB_JSON_PRINTER_SIZE;
 
  private:
@@ -56,9 +65,11 @@ UPB_BEGIN_EXTERN_C
 upb_json_printer *upb_json_printer_create(upb_env *e, const upb_handlers *h,
                                           upb_bytessink *output);
 upb_sink *upb_json_printer_input(upb_json_printer *p);
+void upb_json_printer_reset(upb_json_printer *p);
 const upb_handlers *upb_json_printer_newhandlers(const upb_msgdef *md,
                                                  bool preserve_fieldnames,
                                                  const void *owner);
+upb_handlercache *upb_json_printer_newcache(bool preserve_fieldnames);
 
 UPB_END_EXTERN_C
 
@@ -71,12 +82,16 @@ inline Printer* Printer::Create(Environment* env, const upb::Handlers* handlers,
   return upb_json_printer_create(env, handlers, output);
 }
 inline Sink* Printer::input() { return upb_json_printer_input(this); }
+inline void Printer::Reset() { upb_json_printer_reset(this); }
 inline reffed_ptr<const Handlers> Printer::NewHandlers(
     const upb::MessageDef *md, bool preserve_proto_fieldnames) {
   const Handlers* h = upb_json_printer_newhandlers(
       md, preserve_proto_fieldnames, &h);
   return reffed_ptr<const Handlers>(h, &h);
 }
+inline HandlerCache* Printer::NewCache(bool preserve_proto_fieldnames) {
+  return upb_json_printer_newcache(preserve_proto_fieldnames);
+}
 }  /* namespace json */
 }  /* namespace upb */
 
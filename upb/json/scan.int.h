@@ -0,0 +1,98 @@
+/*
+** Fast scanning of JSON string bodies, shared by the parser and printer.
+**
+** Most string data is "plain": bytes that need no escaping or special
+** handling.  These routines skip over runs of plain bytes many at a time so
+** that the per-byte state machine (parser) or escape logic (printer) runs
+** only for the bytes that actually need it.
+*/
+
+#ifndef UPB_JSON_SCAN_H_
+#define UPB_JSON_SCAN_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "upb/upb.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returns true if |c| ends a run of plain string bytes: a quote or backslash,
+ * or if |ctrl| is set, a control character (which JSON output must escape). */
+UPB_INLINE bool upb_json_isspecial(char c, bool ctrl) {
+  unsigned char uc = (unsigned char)c;
+  return uc == '"' || uc == '\\' || (ctrl && uc < 0x20);
+}
+
+/* Returns a pointer to the first byte in [ptr, end) for which
+ * upb_json_isspecial() is true, or |end| if there is none. */
+UPB_INLINE const char *upb_json_skipplain(const char *ptr, const char *end,
+                                          bool ctrl) {
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i maxctrl = _mm_set1_epi8(0x1f);
+
+  while (end - ptr >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)ptr);
+    __m128i special =
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+    int mask;
+
+    if (ctrl) {
+      /* Unsigned v <= 0x1f iff min(v, 0x1f) == v. */
+      special = _mm_or_si128(special,
+                             _mm_cmpeq_epi8(_mm_min_epu8(v, maxctrl), v));
+    }
+
+    mask = _mm_movemask_epi8(special);
+    if (mask) {
+#if defined(__GNUC__) || defined(__clang__)
+      return ptr + __builtin_ctz(mask);
+#else
+      break;  /* Let the byte loop below find it. */
+#endif
+    }
+    ptr += 16;
+  }
+#else
+  /* Portable fallback: test eight bytes at a time, using the classic
+   * "does this word contain a byte equal to / less than n" bit tricks.  These
+   * are exact as to whether such a byte exists; the byte loop below finds
+   * which one it is. */
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+
+  while (end - ptr >= 8) {
+    uint64_t v, q, b, found;
+    memcpy(&v, ptr, 8);
+    q = v ^ (ones * '"');
+    b = v ^ (ones * '\\');
+    found = ((q - ones) & ~q) | ((b - ones) & ~b);
+    if (ctrl) {
+      found |= (v - ones * 0x20) & ~v;
+    }
+    if (found & highs) {
+      break;
+    }
+    ptr += 8;
+  }
+#endif
+
+  while (ptr < end && !upb_json_isspecial(*ptr, ctrl)) {
+    ptr++;
+  }
+
+  return ptr;
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_JSON_SCAN_H_ */
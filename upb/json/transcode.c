@@ -0,0 +1,863 @@
+/*
+** upb_json_transcoder: reads the wire format with per-message tables built
+** from the defs and appends JSON to a buffer that grows in the arena.  The
+** output mirrors the printer's handlers: fields in the order they arrive, each
+** key preceded by a comma unless it is the first, repeated fields as arrays
+** and maps as objects.
+**
+** Each open message keeps a bit per field (and per oneof) on a stack, to spot
+** input that can't be printed in one pass; see transcode.h.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "upb/decode.h"
+#include "upb/encode.h"
+#include "upb/json/decode.h"
+#include "upb/json/encode.h"
+#include "upb/json/encode.int.h"
+#include "upb/json/number.int.h"
+#include "upb/json/transcode.h"
+#include "upb/table.int.h"
+
+/* Messages may nest this deeply. */
+#define UPB_JSON_TRANSCODE_MAXDEPTH 64
+
+#define CHK(x) if (!(x)) { return false; }
+
+typedef enum {
+  UPB_JSONTC_PLAIN,
+  UPB_JSONTC_TIMESTAMP,
+  UPB_JSONTC_DURATION
+} upb_jsontc_kind;
+
+typedef struct upb_jsontc_msg upb_jsontc_msg;
+
+typedef struct {
+  uint32_t number;
+  uint8_t type;     /* upb_descriptortype_t */
+  bool repeated;
+  bool map;
+  uint16_t oneof;   /* One plus the index of the field's oneof, or 0. */
+  const char *key;  /* ,"name": */
+  size_t key_len;
+  const upb_jsontc_msg *sub;   /* For messages, groups and maps. */
+  const upb_enumdef *enumdef;  /* For enums. */
+} upb_jsontc_field;
+
+struct upb_jsontc_msg {
+  upb_jsontc_kind kind;
+  uint32_t field_count;
+  const upb_jsontc_field *fields;  /* Sorted by number. */
+  /* For 0 <= n < dense_count, dense[n] is one plus the index of field n in
+   * |fields|, or 0.  Larger numbers are found by binary search. */
+  uint32_t dense_count;
+  const uint16_t *dense;
+  /* Words of seen bits: one per field, then one per oneof. */
+  uint32_t seen_words;
+};
+
+struct upb_json_transcoder {
+  const upb_jsontc_msg *top;
+  const upb_msgdef *m;
+  const upb_msglayout *layout;
+  upb_msgfactory *factory;
+};
+
+
+/* Building the tables ********************************************************/
+
+typedef struct {
+  upb_alloc *alloc;
+  upb_msgfactory *factory;
+  upb_inttable msgs;  /* upb_msgdef* -> upb_jsontc_msg* */
+  int options;
+} upb_jsontc_builder;
+
+static int upb_jsontc_cmpfield(const void *a, const void *b) {
+  uint32_t x = ((const upb_jsontc_field*)a)->number;
+  uint32_t y = ((const upb_jsontc_field*)b)->number;
+  return x < y ? -1 : x > y;
+}
+
+/* Sets the precomputed ,"name": key of |field|. */
+static bool upb_jsontc_buildkey(upb_jsontc_builder *b, const upb_fielddef *f,
+                                upb_jsontc_field *field) {
+  char *key;
+  size_t len;
+
+  if (b->options & UPB_JSON_ENCODE_PRESERVEFIELDNAMES) {
+    const char *name = upb_fielddef_name(f);
+    len = strlen(name);
+    key = upb_malloc(b->alloc, len + 4);
+    CHK(key);
+    memcpy(key + 2, name, len);
+  } else {
+    /* getjsonname() counts the NULL, which takes the place of the closing
+     * quote. */
+    len = upb_fielddef_getjsonname(f, NULL, 0) - 1;
+    key = upb_malloc(b->alloc, len + 4);
+    CHK(key);
+    upb_fielddef_getjsonname(f, key + 2, len + 1);
+  }
+
+  key[0] = ',';
+  key[1] = '"';
+  key[len + 2] = '"';
+  key[len + 3] = ':';
+  field->key = key;
+  field->key_len = len + 4;
+  return true;
+}
+
+static const upb_jsontc_msg *upb_jsontc_build(upb_jsontc_builder *b,
+                                              const upb_msgdef *m) {
+  upb_jsontc_msg *ret;
+  upb_jsontc_field *fields;
+  uint16_t *dense;
+  upb_msg_field_iter it;
+  upb_value v;
+  uint32_t n = upb_msgdef_numfields(m);
+  uint32_t max = 0;
+  uint32_t i;
+
+  if (upb_inttable_lookupptr(&b->msgs, m, &v)) {
+    return upb_value_getptr(v);
+  }
+
+  ret = upb_malloc(b->alloc, sizeof(*ret));
+  fields = upb_malloc(b->alloc, UPB_MAX(n, 1) * sizeof(*fields));
+  /* Registered before building the fields, for recursive types. */
+  if (!ret || !fields ||
+      !upb_inttable_insertptr2(&b->msgs, m, upb_value_ptr(ret), b->alloc)) {
+    return NULL;
+  }
+
+  /* upb_json_transcoder_topb() needs the name tables, which mustn't be
+   * created lazily once the transcoder is shared between threads. */
+  if (!upb_msgdef_mapentry(m) && !upb_msgfactory_getnametable(b->factory, m)) {
+    return NULL;
+  }
+
+  i = 0;
+  for (upb_msg_field_begin(&it, m); !upb_msg_field_done(&it);
+       upb_msg_field_next(&it), i++) {
+    const upb_fielddef *f = upb_msg_iter_field(&it);
+    const upb_oneofdef *o = upb_fielddef_containingoneof(f);
+    upb_jsontc_field *field = &fields[i];
+
+    field->number = upb_fielddef_number(f);
+    field->type = upb_fielddef_descriptortype(f);
+    field->repeated = upb_fielddef_isseq(f);
+    field->map = upb_fielddef_ismap(f);
+    field->oneof = o ? upb_oneofdef_index(o) + 1 : 0;
+    field->sub = NULL;
+    field->enumdef = NULL;
+    if (!upb_jsontc_buildkey(b, f, field)) return NULL;
+
+    if (upb_fielddef_issubmsg(f)) {
+      field->sub = upb_jsontc_build(b, upb_fielddef_msgsubdef(f));
+      if (!field->sub) return NULL;
+    } else if (upb_fielddef_type(f) == UPB_TYPE_ENUM) {
+      field->enumdef = upb_fielddef_enumsubdef(f);
+    }
+
+    max = UPB_MAX(max, field->number);
+  }
+
+  qsort(fields, n, sizeof(*fields), upb_jsontc_cmpfield);
+
+  ret->dense_count = UPB_MIN(max, UPB_MSGLAYOUT_DENSEMAX(n)) + 1;
+  dense = upb_malloc(b->alloc, ret->dense_count * sizeof(*dense));
+  if (!dense) return NULL;
+  memset(dense, 0, ret->dense_count * sizeof(*dense));
+  for (i = 0; i < n; i++) {
+    if (fields[i].number < ret->dense_count) dense[fields[i].number] = i + 1;
+  }
+
+  ret->kind = upb_msgdef_timestamp(m)  ? UPB_JSONTC_TIMESTAMP
+              : upb_msgdef_duration(m) ? UPB_JSONTC_DURATION
+                                       : UPB_JSONTC_PLAIN;
+  ret->field_count = n;
+  ret->fields = fields;
+  ret->dense = dense;
+  ret->seen_words = (n + upb_msgdef_numoneofs(m) + 63) / 64;
+  return ret;
+}
+
+upb_json_transcoder *upb_json_transcoder_new(const upb_msgdef *m,
+                                             upb_msgfactory *factory,
+                                             int options, upb_arena *arena) {
+  upb_jsontc_builder b;
+  upb_json_transcoder *ret;
+
+  b.alloc = upb_arena_alloc(arena);
+  b.factory = factory;
+  b.options = options;
+  ret = upb_malloc(b.alloc, sizeof(*ret));
+  if (!ret || !upb_inttable_init2(&b.msgs, UPB_CTYPE_PTR, b.alloc)) {
+    return NULL;
+  }
+
+  ret->m = m;
+  ret->factory = factory;
+  ret->layout = upb_msgfactory_getlayout(factory, m);
+  ret->top = ret->layout ? upb_jsontc_build(&b, m) : NULL;
+  upb_inttable_uninit2(&b.msgs, b.alloc);
+
+  return ret->top ? ret : NULL;
+}
+
+
+/* Reading the wire format ****************************************************/
+
+typedef struct {
+  upb_jsonenc e;
+  const char *err;  /* If set, why transcoding failed; else out of memory. */
+  bool canonicalize;  /* Failed because the input must be re-encoded. */
+  uint64_t *seen;  /* A stack of the seen bits of each open message. */
+  size_t seen_top;
+  size_t seen_size;
+} upb_jsontc;
+
+static bool upb_jsontc_malformed(upb_jsontc *t) {
+  t->err = "Malformed protobuf input";
+  return false;
+}
+
+static bool upb_jsontc_varint(upb_jsontc *t, const char **ptr,
+                              const char *end, uint64_t *val) {
+  const char *p = *ptr;
+  uint64_t ret = 0;
+  int bitpos;
+
+  for (bitpos = 0; bitpos < 70 && p < end; bitpos += 7) {
+    uint8_t byte = *p++;
+    ret |= (uint64_t)(byte & 0x7f) << bitpos;
+    if (!(byte & 0x80)) {
+      *ptr = p;
+      *val = ret;
+      return true;
+    }
+  }
+
+  return upb_jsontc_malformed(t);
+}
+
+static bool upb_jsontc_fixed(upb_jsontc *t, const char **ptr,
+                             const char *end, void *val, size_t size) {
+  /* TODO(haberman): byte-swap for big endian. */
+  if ((size_t)(end - *ptr) < size) return upb_jsontc_malformed(t);
+  memcpy(val, *ptr, size);
+  *ptr += size;
+  return true;
+}
+
+static bool upb_jsontc_delimited(upb_jsontc *t, const char **ptr,
+                                 const char *end, upb_stringview *val) {
+  uint64_t len;
+  CHK(upb_jsontc_varint(t, ptr, end, &len));
+  if (len > (uint64_t)(end - *ptr)) return upb_jsontc_malformed(t);
+  *val = upb_stringview_make(*ptr, len);
+  *ptr += len;
+  return true;
+}
+
+/* Reads a field's tag, which must have a non-zero field number. */
+static bool upb_jsontc_tag(upb_jsontc *t, const char **ptr, const char *end,
+                           uint32_t *number, int *wire_type) {
+  uint64_t tag;
+  CHK(upb_jsontc_varint(t, ptr, end, &tag));
+  if (tag > UINT32_MAX || (tag >> 3) == 0) return upb_jsontc_malformed(t);
+  *number = tag >> 3;
+  *wire_type = tag & 7;
+  return true;
+}
+
+/* Reads a varint, fixed32 or fixed64 value as a uint64_t. */
+static bool upb_jsontc_rawscalar(upb_jsontc *t, int wire_type,
+                                 const char **ptr, const char *end,
+                                 uint64_t *val) {
+  switch (wire_type) {
+    case UPB_WIRE_TYPE_VARINT:
+      return upb_jsontc_varint(t, ptr, end, val);
+    case UPB_WIRE_TYPE_64BIT:
+      return upb_jsontc_fixed(t, ptr, end, val, 8);
+    case UPB_WIRE_TYPE_32BIT: {
+      uint32_t val32;
+      CHK(upb_jsontc_fixed(t, ptr, end, &val32, 4));
+      *val = val32;
+      return true;
+    }
+  }
+  return upb_jsontc_malformed(t);
+}
+
+/* Skips the value of a field that isn't printed. */
+static bool upb_jsontc_skip(upb_jsontc *t, uint32_t number, int wire_type,
+                            const char **ptr, const char *end) {
+  switch (wire_type) {
+    case UPB_WIRE_TYPE_VARINT:
+    case UPB_WIRE_TYPE_64BIT:
+    case UPB_WIRE_TYPE_32BIT: {
+      uint64_t val;
+      return upb_jsontc_rawscalar(t, wire_type, ptr, end, &val);
+    }
+    case UPB_WIRE_TYPE_DELIMITED: {
+      upb_stringview val;
+      return upb_jsontc_delimited(t, ptr, end, &val);
+    }
+    case UPB_WIRE_TYPE_START_GROUP: {
+      uint32_t sub_number;
+      int sub_wire_type;
+
+      if (++t->e.depth > UPB_JSON_TRANSCODE_MAXDEPTH) {
+        t->err = "Nesting too deep";
+        return false;
+      }
+
+      for (;;) {
+        if (*ptr == end) return upb_jsontc_malformed(t);
+        CHK(upb_jsontc_tag(t, ptr, end, &sub_number, &sub_wire_type));
+        if (sub_wire_type == UPB_WIRE_TYPE_END_GROUP) break;
+        CHK(upb_jsontc_skip(t, sub_number, sub_wire_type, ptr, end));
+      }
+
+      t->e.depth--;
+      if (sub_number != number) return upb_jsontc_malformed(t);
+      return true;
+    }
+  }
+  return upb_jsontc_malformed(t);
+}
+
+
+/* Writing JSON ***************************************************************/
+
+static bool upb_jsontc_message(upb_jsontc *t, const upb_jsontc_msg *m,
+                               const char **ptr, const char *end,
+                               uint32_t group);
+
+static const upb_jsontc_field *upb_jsontc_find(const upb_jsontc_msg *m,
+                                               uint32_t number) {
+  size_t lo = 0;
+  size_t hi = m->field_count;
+
+  if (number < m->dense_count) {
+    uint16_t i = m->dense[number];
+    return i ? &m->fields[i - 1] : NULL;
+  }
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (m->fields[mid].number < number) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo < m->field_count && m->fields[lo].number == number
+             ? &m->fields[lo]
+             : NULL;
+}
+
+/* Returns the wire type of a value of descriptor type |type|. */
+static int upb_jsontc_wiretype(uint8_t type) {
+  static const int8_t kWireTypes[] = {
+    -1,                           /* 0 */
+    UPB_WIRE_TYPE_64BIT,          /* DOUBLE */
+    UPB_WIRE_TYPE_32BIT,          /* FLOAT */
+    UPB_WIRE_TYPE_VARINT,         /* INT64 */
+    UPB_WIRE_TYPE_VARINT,         /* UINT64 */
+    UPB_WIRE_TYPE_VARINT,         /* INT32 */
+    UPB_WIRE_TYPE_64BIT,          /* FIXED64 */
+    UPB_WIRE_TYPE_32BIT,          /* FIXED32 */
+    UPB_WIRE_TYPE_VARINT,         /* BOOL */
+    UPB_WIRE_TYPE_DELIMITED,      /* STRING */
+    UPB_WIRE_TYPE_START_GROUP,    /* GROUP */
+    UPB_WIRE_TYPE_DELIMITED,      /* MESSAGE */
+    UPB_WIRE_TYPE_DELIMITED,      /* BYTES */
+    UPB_WIRE_TYPE_VARINT,         /* UINT32 */
+    UPB_WIRE_TYPE_VARINT,         /* ENUM */
+    UPB_WIRE_TYPE_32BIT,          /* SFIXED32 */
+    UPB_WIRE_TYPE_64BIT,          /* SFIXED64 */
+    UPB_WIRE_TYPE_VARINT,         /* SINT32 */
+    UPB_WIRE_TYPE_VARINT,         /* SINT64 */
+  };
+  return kWireTypes[type];
+}
+
+/* Returns true if values of field |f| are numbers, which may be packed. */
+static bool upb_jsontc_packable(const upb_jsontc_field *f) {
+  return upb_jsontc_wiretype(f->type) != UPB_WIRE_TYPE_DELIMITED &&
+         f->type != UPB_DESCRIPTOR_TYPE_GROUP;
+}
+
+/* Returns true if |wire_type| is one that field |f| can arrive with.  Fields
+ * that arrive with any other are skipped, like unknown fields. */
+static bool upb_jsontc_wiretypeok(const upb_jsontc_field *f, int wire_type) {
+  return wire_type == upb_jsontc_wiretype(f->type) ||
+         (f->repeated && wire_type == UPB_WIRE_TYPE_DELIMITED &&
+          upb_jsontc_packable(f));
+}
+
+/* Writes a number, bool or enum of descriptor type |type|, whose wire value
+ * is |val|. */
+static bool upb_jsontc_scalar(upb_jsontc *t, uint8_t type,
+                              const upb_enumdef *enumdef, uint64_t val) {
+  size_t n;
+
+  CHK(upb_jsonenc_reserve(&t->e, UPB_JSONENC_NUMBER_MAX));
+
+  switch (type) {
+    case UPB_DESCRIPTOR_TYPE_DOUBLE: {
+      double d;
+      memcpy(&d, &val, sizeof(d));
+      n = upb_json_fmtdouble(d, t->e.ptr, UPB_JSONENC_NUMBER_MAX);
+      break;
+    }
+    case UPB_DESCRIPTOR_TYPE_FLOAT: {
+      uint32_t val32 = (uint32_t)val;
+      float f;
+      memcpy(&f, &val32, sizeof(f));
+      n = upb_json_fmtfloat(f, t->e.ptr, UPB_JSONENC_NUMBER_MAX);
+      break;
+    }
+    case UPB_DESCRIPTOR_TYPE_INT64:
+    case UPB_DESCRIPTOR_TYPE_SFIXED64:
+      n = upb_json_fmtint64((int64_t)val, t->e.ptr, UPB_JSONENC_NUMBER_MAX);
+      break;
+    case UPB_DESCRIPTOR_TYPE_UINT64:
+    case UPB_DESCRIPTOR_TYPE_FIXED64:
+      n = upb_json_fmtuint64(val, t->e.ptr, UPB_JSONENC_NUMBER_MAX);
+      break;
+    case UPB_DESCRIPTOR_TYPE_INT32:
+    case UPB_DESCRIPTOR_TYPE_SFIXED32:
+      n = upb_json_fmtint64((int32_t)val, t->e.ptr, UPB_JSONENC_NUMBER_MAX);
+      break;
+    case UPB_DESCRIPTOR_TYPE_UINT32:
+    case UPB_DESCRIPTOR_TYPE_FIXED32:
+      n = upb_json_fmtint64((uint32_t)val, t->e.ptr, UPB_JSONENC_NUMBER_MAX);
+      break;
+    case UPB_DESCRIPTOR_TYPE_SINT32: {
+      uint32_t u = (uint32_t)val;
+      int32_t s = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+      n = upb_json_fmtint64(s, t->e.ptr, UPB_JSONENC_NUMBER_MAX);
+      break;
+    }
+    case UPB_DESCRIPTOR_TYPE_SINT64: {
+      int64_t s = (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+      n = upb_json_fmtint64(s, t->e.ptr, UPB_JSONENC_NUMBER_MAX);
+      break;
+    }
+    case UPB_DESCRIPTOR_TYPE_BOOL:
+      return val ? upb_jsonenc_put(&t->e, "true", 4)
+                 : upb_jsonenc_put(&t->e, "false", 5);
+    case UPB_DESCRIPTOR_TYPE_ENUM:
+      return upb_jsonenc_enum(&t->e, enumdef, (int32_t)val);
+    default:
+      UPB_UNREACHABLE();
+  }
+
+  CHK(n != (size_t)-1);
+  t->e.ptr += n;
+  return true;
+}
+
+/* Writes the JSON form of a google.protobuf.Timestamp or Duration. */
+static bool upb_jsontc_time(upb_jsontc *t, const upb_jsontc_msg *m,
+                            const char **ptr, const char *end,
+                            uint32_t group) {
+  char buf[32];
+  int64_t seconds = 0;
+  int32_t nanos = 0;
+  size_t n;
+
+  for (;;) {
+    uint32_t number;
+    int wire_type;
+
+    if (*ptr == end) {
+      if (group) return upb_jsontc_malformed(t);
+      break;
+    }
+
+    CHK(upb_jsontc_tag(t, ptr, end, &number, &wire_type));
+
+    if (wire_type == UPB_WIRE_TYPE_END_GROUP) {
+      if (number != group) return upb_jsontc_malformed(t);
+      break;
+    } else if (number <= 2 && wire_type == UPB_WIRE_TYPE_VARINT) {
+      uint64_t val;
+      CHK(upb_jsontc_varint(t, ptr, end, &val));
+      if (number == 1) {
+        seconds = (int64_t)val;
+      } else {
+        nanos = (int32_t)val;
+      }
+    } else {
+      CHK(upb_jsontc_skip(t, number, wire_type, ptr, end));
+    }
+  }
+
+  if (m->kind == UPB_JSONTC_TIMESTAMP) {
+    if (seconds < -62135596800 || seconds > 253402300799 || nanos < 0 ||
+        nanos >= 1000000000) {
+      t->err = "Timestamp out of range";
+      return false;
+    }
+    n = upb_json_fmttimestamp(seconds, nanos, buf, sizeof(buf));
+  } else {
+    if (seconds < -315576000000 || seconds > 315576000000 ||
+        nanos <= -1000000000 || nanos >= 1000000000) {
+      t->err = "Duration out of range";
+      return false;
+    }
+    n = upb_json_fmtduration(seconds, nanos, buf, sizeof(buf));
+  }
+
+  CHK(upb_jsonenc_reserve(&t->e, n + 2));
+  *t->e.ptr++ = '"';
+  memcpy(t->e.ptr, buf, n);
+  t->e.ptr += n;
+  *t->e.ptr++ = '"';
+  return true;
+}
+
+static bool upb_jsontc_mapentry(upb_jsontc *t, const upb_jsontc_msg *entry,
+                                upb_stringview data);
+
+/* Writes one value of field |f|, which arrived with |wire_type|.  For a map
+ * this is one "key":value entry. */
+static bool upb_jsontc_value(upb_jsontc *t, const upb_jsontc_field *f,
+                             int wire_type, const char **ptr,
+                             const char *end) {
+  switch (f->type) {
+    case UPB_DESCRIPTOR_TYPE_STRING:
+    case UPB_DESCRIPTOR_TYPE_BYTES: {
+      upb_stringview val;
+      CHK(upb_jsontc_delimited(t, ptr, end, &val));
+      return f->type == UPB_DESCRIPTOR_TYPE_STRING
+                 ? upb_jsonenc_string(&t->e, val.data, val.size)
+                 : upb_jsonenc_bytes(&t->e, val);
+    }
+    case UPB_DESCRIPTOR_TYPE_MESSAGE: {
+      upb_stringview val;
+      const char *p;
+      CHK(upb_jsontc_delimited(t, ptr, end, &val));
+      if (f->map) return upb_jsontc_mapentry(t, f->sub, val);
+      p = val.data;
+      return upb_jsontc_message(t, f->sub, &p, p + val.size, 0);
+    }
+    case UPB_DESCRIPTOR_TYPE_GROUP:
+      return upb_jsontc_message(t, f->sub, ptr, end, f->number);
+    default: {
+      uint64_t val;
+      CHK(upb_jsontc_rawscalar(t, wire_type, ptr, end, &val));
+      return upb_jsontc_scalar(t, f->type, f->enumdef, val);
+    }
+  }
+}
+
+/* Writes the value of field |f| when it isn't on the wire, as for a map entry
+ * without a value. */
+static bool upb_jsontc_default(upb_jsontc *t, const upb_jsontc_field *f) {
+  switch (f->type) {
+    case UPB_DESCRIPTOR_TYPE_STRING:
+    case UPB_DESCRIPTOR_TYPE_BYTES:
+      return upb_jsonenc_put(&t->e, "\"\"", 2);
+    case UPB_DESCRIPTOR_TYPE_MESSAGE:
+    case UPB_DESCRIPTOR_TYPE_GROUP: {
+      const char *empty = "";
+      return upb_jsontc_message(t, f->sub, &empty, empty, 0);
+    }
+    default:
+      return upb_jsontc_scalar(t, f->type, f->enumdef, 0);
+  }
+}
+
+/* Writes "key":value for a map entry, whose fields may come in any order (the
+ * last of each wins) or be missing. */
+static bool upb_jsontc_mapentry(upb_jsontc *t, const upb_jsontc_msg *entry,
+                                upb_stringview data) {
+  const upb_jsontc_field *key_f = &entry->fields[0];
+  const upb_jsontc_field *val_f = &entry->fields[1];
+  const char *ptr = data.data;
+  const char *end = data.data + data.size;
+  const char *key = NULL;
+  const char *val = NULL;
+  int key_wire_type = 0;
+  int val_wire_type = 0;
+
+  while (ptr < end) {
+    uint32_t number;
+    int wire_type;
+    CHK(upb_jsontc_tag(t, &ptr, end, &number, &wire_type));
+    if (number == key_f->number && upb_jsontc_wiretypeok(key_f, wire_type)) {
+      key = ptr;
+      key_wire_type = wire_type;
+    } else if (number == val_f->number &&
+               upb_jsontc_wiretypeok(val_f, wire_type)) {
+      val = ptr;
+      val_wire_type = wire_type;
+    }
+    CHK(upb_jsontc_skip(t, number, wire_type, &ptr, end));
+  }
+
+  /* Keys are strings, or integers and bools printed inside quotes. */
+  if (key_f->type == UPB_DESCRIPTOR_TYPE_STRING) {
+    if (key) {
+      CHK(upb_jsontc_value(t, key_f, key_wire_type, &key, end));
+    } else {
+      CHK(upb_jsonenc_put(&t->e, "\"\"", 2));
+    }
+  } else {
+    uint64_t raw = 0;
+    if (key) CHK(upb_jsontc_rawscalar(t, key_wire_type, &key, end, &raw));
+    CHK(upb_jsonenc_putc(&t->e, '"'));
+    CHK(upb_jsontc_scalar(t, key_f->type, NULL, raw));
+    CHK(upb_jsonenc_putc(&t->e, '"'));
+  }
+
+  CHK(upb_jsonenc_putc(&t->e, ':'));
+
+  if (val) {
+    return upb_jsontc_value(t, val_f, val_wire_type, &val, end);
+  } else {
+    return upb_jsontc_default(t, val_f);
+  }
+}
+
+/* Writes the elements of a repeated field that arrived in one tag: a whole
+ * packed run, or a single element. */
+static bool upb_jsontc_elements(upb_jsontc *t, const upb_jsontc_field *f,
+                                int wire_type, const char **ptr,
+                                const char *end, bool *first) {
+  if (wire_type == UPB_WIRE_TYPE_DELIMITED && upb_jsontc_packable(f)) {
+    upb_stringview packed;
+    const char *p;
+    const char *packed_end;
+    int elem_wire_type = upb_jsontc_wiretype(f->type);
+
+    CHK(upb_jsontc_delimited(t, ptr, end, &packed));
+    p = packed.data;
+    packed_end = packed.data + packed.size;
+
+    while (p < packed_end) {
+      if (!*first) CHK(upb_jsonenc_putc(&t->e, ','));
+      *first = false;
+      CHK(upb_jsontc_value(t, f, elem_wire_type, &p, packed_end));
+    }
+
+    return true;
+  }
+
+  if (!*first) CHK(upb_jsonenc_putc(&t->e, ','));
+  *first = false;
+  return upb_jsontc_value(t, f, wire_type, ptr, end);
+}
+
+/* Marks field |f| of the message whose bits start at seen[ofs] as printed.
+ * If it, or another field of its oneof, has been printed already, the input
+ * must be re-encoded before it can be printed. */
+static bool upb_jsontc_markseen(upb_jsontc *t, const upb_jsontc_msg *m,
+                                size_t ofs, const upb_jsontc_field *f) {
+  uint64_t *seen = &t->seen[ofs];
+  size_t bit = f - m->fields;
+
+  if (seen[bit / 64] & ((uint64_t)1 << (bit % 64))) goto canonicalize;
+  seen[bit / 64] |= (uint64_t)1 << (bit % 64);
+
+  if (f->oneof) {
+    bit = m->field_count + f->oneof - 1;
+    if (seen[bit / 64] & ((uint64_t)1 << (bit % 64))) goto canonicalize;
+    seen[bit / 64] |= (uint64_t)1 << (bit % 64);
+  }
+
+  return true;
+
+canonicalize:
+  t->canonicalize = true;
+  return false;
+}
+
+/* Pushes zeroed seen bits for message |m| and sets |*ofs| to where they
+ * start. */
+static bool upb_jsontc_pushseen(upb_jsontc *t, const upb_jsontc_msg *m,
+                                size_t *ofs) {
+  size_t words = m->seen_words;
+
+  if (t->seen_size - t->seen_top < words) {
+    size_t new_size = UPB_MAX(t->seen_size * 2, 16);
+    uint64_t *new_seen;
+    while (new_size - t->seen_top < words) new_size *= 2;
+    new_seen = upb_realloc(t->e.alloc, t->seen, t->seen_size * sizeof(*t->seen),
+                           new_size * sizeof(*t->seen));
+    CHK(new_seen);
+    t->seen = new_seen;
+    t->seen_size = new_size;
+  }
+
+  *ofs = t->seen_top;
+  memset(&t->seen[*ofs], 0, words * sizeof(*t->seen));
+  t->seen_top += words;
+  return true;
+}
+
+/* Writes message |m|, which runs to |end| or, for a group, to the END_GROUP
+ * tag numbered |group|. */
+static bool upb_jsontc_message(upb_jsontc *t, const upb_jsontc_msg *m,
+                               const char **ptr, const char *end,
+                               uint32_t group) {
+  const upb_jsontc_field *open = NULL;  /* Repeated field being printed. */
+  bool first = true;
+  bool first_elem = true;
+  size_t seen;
+
+  if (++t->e.depth > UPB_JSON_TRANSCODE_MAXDEPTH) {
+    t->err = "Nesting too deep";
+    return false;
+  }
+
+  if (m->kind != UPB_JSONTC_PLAIN) {
+    CHK(upb_jsontc_time(t, m, ptr, end, group));
+    t->e.depth--;
+    return true;
+  }
+
+  CHK(upb_jsontc_pushseen(t, m, &seen));
+  CHK(upb_jsonenc_putc(&t->e, '{'));
+
+  for (;;) {
+    const upb_jsontc_field *f;
+    uint32_t number;
+    int wire_type;
+
+    if (*ptr == end) {
+      if (group) return upb_jsontc_malformed(t);
+      break;
+    }
+
+    CHK(upb_jsontc_tag(t, ptr, end, &number, &wire_type));
+
+    if (wire_type == UPB_WIRE_TYPE_END_GROUP) {
+      if (number != group) return upb_jsontc_malformed(t);
+      break;
+    }
+
+    f = upb_jsontc_find(m, number);
+    if (!f || !upb_jsontc_wiretypeok(f, wire_type)) {
+      CHK(upb_jsontc_skip(t, number, wire_type, ptr, end));
+      continue;
+    }
+
+    if (f != open) {
+      if (open) CHK(upb_jsonenc_putc(&t->e, open->map ? '}' : ']'));
+      open = NULL;
+      CHK(upb_jsontc_markseen(t, m, seen, f));
+      CHK(upb_jsonenc_put(&t->e, f->key + first, f->key_len - first));
+      first = false;
+      if (f->repeated) {
+        CHK(upb_jsonenc_putc(&t->e, f->map ? '{' : '['));
+        open = f;
+        first_elem = true;
+      }
+    }
+
+    if (f->repeated) {
+      CHK(upb_jsontc_elements(t, f, wire_type, ptr, end, &first_elem));
+    } else {
+      CHK(upb_jsontc_value(t, f, wire_type, ptr, end));
+    }
+  }
+
+  if (open) CHK(upb_jsonenc_putc(&t->e, open->map ? '}' : ']'));
+  CHK(upb_jsonenc_putc(&t->e, '}'));
+
+  t->seen_top = seen;
+  t->e.depth--;
+  return true;
+}
+
+static bool upb_jsontc_run(upb_jsontc *t, const upb_jsontc_msg *m,
+                           upb_stringview pb) {
+  const char *ptr = pb.data;
+
+  t->e.ptr = t->e.buf;
+  t->e.depth = 0;
+  t->err = NULL;
+  t->canonicalize = false;
+  t->seen_top = 0;
+
+  return upb_jsontc_message(t, m, &ptr, pb.data + pb.size, 0);
+}
+
+char *upb_json_transcoder_tojson(const upb_json_transcoder *tc,
+                                 upb_stringview pb, upb_arena *arena,
+                                 size_t *size, upb_status *status) {
+  upb_jsontc t;
+  bool ok;
+
+  t.e.alloc = upb_arena_alloc(arena);
+  t.e.arena = arena;
+  t.e.factory = NULL;
+  t.e.buf = NULL;
+  t.e.ptr = NULL;
+  t.e.end = NULL;
+  t.e.options = 0;
+  t.seen = NULL;
+  t.seen_size = 0;
+
+  ok = upb_jsontc_run(&t, tc->top, pb);
+
+  if (!ok && t.canonicalize) {
+    /* Re-encoding writes each field once, with all of a repeated field's
+     * elements together, so the second run can't need this again. */
+    upb_msg *msg = upb_msg_new(tc->layout, arena);
+    if (!msg || !upb_decode(pb, msg, tc->layout)) {
+      upb_status_seterrmsg(status, "Malformed protobuf input");
+      return NULL;
+    }
+    pb.data = upb_encode(msg, tc->layout, arena, &pb.size);
+    if (!pb.data) {
+      upb_status_seterrmsg(status, "Out of memory");
+      return NULL;
+    }
+    ok = upb_jsontc_run(&t, tc->top, pb);
+  }
+
+  if (!ok) {
+    upb_status_seterrmsg(status, t.err ? t.err : "Out of memory");
+    return NULL;
+  }
+
+  *size = t.e.ptr - t.e.buf;
+  return t.e.buf;
+}
+
+
+/* JSON to binary *************************************************************/
+
+char *upb_json_transcoder_topb(const upb_json_transcoder *tc,
+                               upb_stringview json, upb_arena *arena,
+                               int options, size_t *size, upb_status *status) {
+  upb_msg *msg = upb_msg_new(tc->layout, arena);
+  char *ret;
+
+  if (!msg) {
+    upb_status_seterrmsg(status, "Out of memory");
+    return NULL;
+  }
+
+  if (!upb_json_decode(json, msg, tc->m, tc->factory, options, status)) {
+    return NULL;
+  }
+
+  ret = upb_encode(msg, tc->layout, arena, size);
+  if (!ret) upb_status_seterrmsg(status, "Out of memory");
+  return ret;
+}
+
+#undef CHK
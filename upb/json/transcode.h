@@ -0,0 +1,65 @@
+/*
+** upb_json_transcoder: converting between binary protobuf and JSON without
+** building a upb_msg in between (for binary to JSON) or going through
+** upb_handlers (both ways).
+**
+** The binary-to-JSON direction reads the wire format with tables built from
+** the defs and writes the JSON text directly: each field's quoted key is
+** computed once, and numbers and strings are formatted with the same code as
+** the printer, so the output is what a upb::pb::Decoder feeding a
+** upb::json::Printer gives for the same input, field for field.  Like the
+** printer, it maps google.protobuf.Timestamp and Duration to their string
+** forms and prints every other message, including the other well-known
+** types, as a plain object.
+**
+** A JSON object can't say that a repeated field continues after other fields,
+** or that a later value of a singular field replaces an earlier one, so input
+** like that (which no canonical encoder produces) is first decoded into a
+** upb_msg and re-encoded, then transcoded from there.
+**
+** JSON to binary is upb_json_decode() into a message from the arena followed
+** by upb_encode(), with the same limitations as upb_json_decode().
+*/
+
+#ifndef UPB_JSON_TRANSCODE_H_
+#define UPB_JSON_TRANSCODE_H_
+
+#include "upb/def.h"
+#include "upb/msg.h"
+#include "upb/msgfactory.h"
+
+UPB_BEGIN_EXTERN_C
+
+typedef struct upb_json_transcoder upb_json_transcoder;
+
+/* Builds a transcoder for messages of type |m| and every message type they
+ * refer to, allocating its tables from |arena|.  |options| are from
+ * upb_json_encodeopt in upb/json/encode.h and select how fields are named in
+ * the JSON output.  |factory| supplies the layouts for the fallbacks
+ * described above and for upb_json_transcoder_topb(); it and the defs must
+ * outlive the transcoder.  Returns NULL if out of memory.
+ *
+ * Everything the transcoder needs from |factory| is created here, so once
+ * built, a transcoder may be used from any number of threads at once, as long
+ * as nothing else is changing |factory|. */
+upb_json_transcoder *upb_json_transcoder_new(const upb_msgdef *m,
+                                             upb_msgfactory *factory,
+                                             int options, upb_arena *arena);
+
+/* Converts the binary message |pb| to JSON in a buffer from |arena|.  Returns
+ * the buffer and its length in |*size| (the output is not NUL-terminated).
+ * On failure returns NULL and sets |status| (if non-NULL). */
+char *upb_json_transcoder_tojson(const upb_json_transcoder *t,
+                                 upb_stringview pb, upb_arena *arena,
+                                 size_t *size, upb_status *status);
+
+/* Converts the JSON object |json| to binary protobuf in a buffer from |arena|,
+ * using upb_json_decode() |options|.  Returns the buffer and its length in
+ * |*size|.  On failure returns NULL and sets |status| (if non-NULL). */
+char *upb_json_transcoder_topb(const upb_json_transcoder *t,
+                               upb_stringview json, upb_arena *arena,
+                               int options, size_t *size, upb_status *status);
+
+UPB_END_EXTERN_C
+
+#endif  /* UPB_JSON_TRANSCODE_H_ */
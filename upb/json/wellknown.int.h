@@ -0,0 +1,54 @@
+/*
+** Recognizing the well-known types that have a special JSON mapping, shared
+** by upb_json_decode() and upb_json_encode().
+*/
+
+#ifndef UPB_JSON_WELLKNOWN_H_
+#define UPB_JSON_WELLKNOWN_H_
+
+#include <string.h>
+#include "upb/def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returns true if |m| is one of the google.protobuf types whose JSON form is
+ * not a plain object of its fields (Timestamp, the wrappers, etc). */
+UPB_INLINE bool upb_json_hasspecialmapping(const upb_msgdef *m) {
+  static const char *const kSpecial[] = {
+    "Any", "Duration", "FieldMask", "ListValue", "Struct", "Timestamp",
+    "Value", "BoolValue", "BytesValue", "DoubleValue", "FloatValue",
+    "Int32Value", "Int64Value", "StringValue", "UInt32Value", "UInt64Value"
+  };
+  const char *prefix = "google.protobuf.";
+  const char *name = upb_msgdef_fullname(m);
+  size_t i;
+
+  if (strncmp(name, prefix, strlen(prefix)) != 0) {
+    return false;
+  }
+
+  name += strlen(prefix);
+  for (i = 0; i < sizeof(kSpecial) / sizeof(kSpecial[0]); i++) {
+    if (strcmp(name, kSpecial[i]) == 0) return true;
+  }
+
+  return false;
+}
+
+/* Returns true if |m| is google.protobuf.Any.  Its JSON form is the object of
+ * the embedded message, with an extra "@type" member holding the type URL:
+ *
+ *   {"@type": "type.googleapis.com/pkg.MyMessage", "myField": 1}
+ *
+ * Its fields are type_url (1) and value (2), the embedded message in binary. */
+UPB_INLINE bool upb_json_isany(const upb_msgdef *m) {
+  return strcmp(upb_msgdef_fullname(m), "google.protobuf.Any") == 0;
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_JSON_WELLKNOWN_H_ */
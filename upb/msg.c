@@ -1,5 +1,6 @@
 
 #include "upb/msg.h"
+#include "upb/decode.h"
 #include "upb/structs.int.h"
 
 bool upb_fieldtype_mapkeyok(upb_fieldtype_t type) {
@@ -64,40 +65,6 @@ static uint8_t upb_msg_fieldsize(const upb_msglayout_field *field) {
   }
 }
 
-/* TODO(haberman): this is broken right now because upb_msgval can contain
- * a char* / size_t pair, which is too big for a upb_value.  To fix this
- * we'll probably need to dynamically allocate a upb_msgval and store a
- * pointer to that in the tables for extensions/maps. */
-static upb_value upb_toval(upb_msgval val) {
-  upb_value ret;
-  UPB_UNUSED(val);
-  memset(&ret, 0, sizeof(upb_value));  /* XXX */
-  return ret;
-}
-
-static upb_msgval upb_msgval_fromval(upb_value val) {
-  upb_msgval ret;
-  UPB_UNUSED(val);
-  memset(&ret, 0, sizeof(upb_msgval));  /* XXX */
-  return ret;
-}
-
-static upb_ctype_t upb_fieldtotabtype(upb_fieldtype_t type) {
-  switch (type) {
-    case UPB_TYPE_FLOAT: return UPB_CTYPE_FLOAT;
-    case UPB_TYPE_DOUBLE: return UPB_CTYPE_DOUBLE;
-    case UPB_TYPE_BOOL: return UPB_CTYPE_BOOL;
-    case UPB_TYPE_BYTES:
-    case UPB_TYPE_MESSAGE:
-    case UPB_TYPE_STRING: return UPB_CTYPE_CONSTPTR;
-    case UPB_TYPE_ENUM:
-    case UPB_TYPE_INT32: return UPB_CTYPE_INT32;
-    case UPB_TYPE_UINT32: return UPB_CTYPE_UINT32;
-    case UPB_TYPE_INT64: return UPB_CTYPE_INT64;
-    case UPB_TYPE_UINT64: return UPB_CTYPE_UINT64;
-    default: UPB_ASSERT(false); return 0;
-  }
-}
 
 
 /** upb_msg *******************************************************************/
@@ -116,19 +83,25 @@ typedef struct {
   /* TODO(haberman): use pointer tagging so we we are slim when known unknown
    * fields are not present. */
   upb_arena *arena;
-  char *unknown;
-  size_t unknown_len;
-  size_t unknown_size;
+  /* The unknown fields: |unknown_count| spans, in order, in an array with room
+   * for |unknown_size|.  |unknown_room| bytes after the last span are free,
+   * which is only ever the case if that span is in a chunk we copied it to. */
+  upb_stringview *unknown;
+  uint32_t unknown_count;
+  uint32_t unknown_size;
+  size_t unknown_len;  /* Total bytes in all spans. */
+  size_t unknown_room;
+  size_t size_cache;  /* See upb_msg_sizecache(). */
 } upb_msg_internal;
 
 /* Used when a message is extendable. */
 typedef struct {
-  upb_inttable *extdict;
+  upb_msgexts *exts;
   upb_msg_internal base;
 } upb_msg_internal_withext;
 
 static int upb_msg_internalsize(const upb_msglayout *l) {
-  return sizeof(upb_msg_internal) - l->extendable * sizeof(void *);
+  return sizeof(upb_msg_internal) + l->extendable * sizeof(void *);
 }
 
 static upb_msg_internal *upb_msg_getinternal(upb_msg *msg) {
@@ -145,25 +118,125 @@ static upb_msg_internal_withext *upb_msg_getinternalwithext(
   return VOIDPTR_AT(msg, -sizeof(upb_msg_internal_withext));
 }
 
-void upb_msg_addunknown(upb_msg *msg, const char *data, size_t len) {
-  upb_msg_internal* in = upb_msg_getinternal(msg);
-  if (len > in->unknown_size - in->unknown_len) {
+/* Unknown fields that are copied go into chunks of at least this many bytes,
+ * and later fields are appended to the last chunk while it has room. */
+#define UPB_MSG_UNKNOWNCHUNK 256
+
+/* Adds a span to the end of the list. */
+static bool upb_msg_addspan(upb_msg_internal *in, const char *data,
+                            size_t len) {
+  if (in->unknown_count == in->unknown_size) {
     upb_alloc *alloc = upb_arena_alloc(in->arena);
-    size_t need = in->unknown_size + len;
-    size_t newsize = UPB_MAX(in->unknown_size * 2, need);
-    in->unknown = upb_realloc(alloc, in->unknown, in->unknown_size, newsize);
-    in->unknown_size = newsize;
+    uint32_t new_size = UPB_MAX(in->unknown_size * 2, 4);
+    upb_stringview *spans = upb_realloc(alloc, in->unknown,
+                                        in->unknown_size * sizeof(*spans),
+                                        new_size * sizeof(*spans));
+    if (!spans) return false;
+    in->unknown = spans;
+    in->unknown_size = new_size;
   }
-  memcpy(in->unknown + in->unknown_len, data, len);
+
+  in->unknown[in->unknown_count++] = upb_stringview_make(data, len);
   in->unknown_len += len;
+  return true;
 }
 
-const char *upb_msg_getunknown(const upb_msg *msg, size_t *len) {
+bool upb_msg_addunknown(upb_msg *msg, const char *data, size_t len) {
+  upb_msg_internal* in = upb_msg_getinternal(msg);
+  char *chunk;
+  size_t size;
+
+  in->size_cache = 0;
+  if (len == 0) return true;
+
+  if (len <= in->unknown_room) {
+    upb_stringview *last = &in->unknown[in->unknown_count - 1];
+    memcpy((char*)last->data + last->size, data, len);
+    last->size += len;
+    in->unknown_len += len;
+    in->unknown_room -= len;
+    return true;
+  }
+
+  /* Chunks grow with the total, so that many small fields need few chunks. */
+  size = UPB_MAX(len, UPB_MAX(UPB_MSG_UNKNOWNCHUNK, in->unknown_len));
+  chunk = upb_malloc(upb_arena_alloc(in->arena), size);
+  if (!chunk || !upb_msg_addspan(in, chunk, len)) return false;
+  memcpy(chunk, data, len);
+  in->unknown_room = size - len;
+  return true;
+}
+
+bool upb_msg_addunknown_alias(upb_msg *msg, const char *data, size_t len) {
+  upb_msg_internal* in = upb_msg_getinternal(msg);
+
+  in->size_cache = 0;
+  if (len == 0) return true;
+
+  if (in->unknown_count > 0) {
+    upb_stringview *last = &in->unknown[in->unknown_count - 1];
+    if (last->data + last->size == data) {
+      /* Unknown fields next to each other in the input stay one span. */
+      last->size += len;
+      in->unknown_len += len;
+      return true;
+    }
+  }
+
+  in->unknown_room = 0;
+  return upb_msg_addspan(in, data, len);
+}
+
+const upb_stringview *upb_msg_getunknownspans(const upb_msg *msg,
+                                              size_t *count) {
   const upb_msg_internal* in = upb_msg_getinternal_const(msg);
-  *len = in->unknown_len;
+  *count = in->unknown_count;
   return in->unknown;
 }
 
+size_t upb_msg_unknownsize(const upb_msg *msg) {
+  return upb_msg_getinternal_const(msg)->unknown_len;
+}
+
+const char *upb_msg_getunknown(const upb_msg *msg, size_t *len) {
+  /* Gathering the spans into one doesn't change the message's value, so we
+   * do it even though the message is const. */
+  upb_msg_internal* in = upb_msg_getinternal((upb_msg*)msg);
+  *len = in->unknown_len;
+
+  if (in->unknown_count > 1) {
+    char *buf = upb_malloc(upb_arena_alloc(in->arena), in->unknown_len);
+    char *p = buf;
+    uint32_t i;
+
+    if (!buf) {
+      *len = 0;
+      return NULL;
+    }
+    for (i = 0; i < in->unknown_count; i++) {
+      memcpy(p, in->unknown[i].data, in->unknown[i].size);
+      p += in->unknown[i].size;
+    }
+    in->unknown[0] = upb_stringview_make(buf, in->unknown_len);
+    in->unknown_count = 1;
+    in->unknown_room = 0;
+  }
+
+  return in->unknown_count > 0 ? in->unknown[0].data : NULL;
+}
+
+size_t upb_msg_sizecache(const upb_msg *msg) {
+  return upb_msg_getinternal_const(msg)->size_cache;
+}
+
+void upb_msg_setsizecache(upb_msg *msg, size_t size) {
+  upb_msg_getinternal(msg)->size_cache = size;
+}
+
+void upb_msg_invalidatesize(upb_msg *msg) {
+  upb_msg_getinternal(msg)->size_cache = 0;
+}
+
 static const upb_msglayout_field *upb_msg_checkfield(int field_index,
                                                      const upb_msglayout *l) {
   UPB_ASSERT(field_index >= 0 && field_index < l->field_count);
@@ -185,17 +258,14 @@ static size_t upb_msg_sizeof(const upb_msglayout *l) {
   return l->size + upb_msg_internalsize(l);
 }
 
-upb_msg *upb_msg_new(const upb_msglayout *l, upb_arena *a) {
-  upb_alloc *alloc = upb_arena_alloc(a);
-  void *mem = upb_malloc(alloc, upb_msg_sizeof(l));
-  upb_msg_internal *in;
-  upb_msg *msg;
-
-  if (!mem) {
-    return NULL;
-  }
+size_t upb_msg_stride(const upb_msglayout *l) {
+  return (upb_msg_sizeof(l) + sizeof(void*) - 1) / sizeof(void*) *
+         sizeof(void*);
+}
 
-  msg = VOIDPTR_AT(mem, upb_msg_internalsize(l));
+upb_msg *upb_msg_init(void *mem, const upb_msglayout *l, upb_arena *a) {
+  upb_msg_internal *in;
+  upb_msg *msg = VOIDPTR_AT(mem, upb_msg_internalsize(l));
 
   /* Initialize normal members. */
   memset(msg, 0, l->size);
@@ -204,16 +274,30 @@ upb_msg *upb_msg_new(const upb_msglayout *l, upb_arena *a) {
   in = upb_msg_getinternal(msg);
   in->arena = a;
   in->unknown = NULL;
-  in->unknown_len = 0;
+  in->unknown_count = 0;
   in->unknown_size = 0;
+  in->unknown_len = 0;
+  in->unknown_room = 0;
+  in->size_cache = 0;
 
   if (l->extendable) {
-    upb_msg_getinternalwithext(msg, l)->extdict = NULL;
+    upb_msg_getinternalwithext(msg, l)->exts = NULL;
   }
 
   return msg;
 }
 
+upb_msg *upb_msg_new(const upb_msglayout *l, upb_arena *a) {
+  upb_alloc *alloc = upb_arena_alloc(a);
+  void *mem = upb_malloc(alloc, upb_msg_sizeof(l));
+
+  if (!mem) {
+    return NULL;
+  }
+
+  return upb_msg_init(mem, l, a);
+}
+
 upb_arena *upb_msg_arena(const upb_msg *msg) {
   return upb_msg_getinternal_const(msg)->arena;
 }
@@ -231,7 +315,7 @@ bool upb_msg_has(const upb_msg *msg,
   } else {
     /* Other fields are set when their hasbit is set. */
     uint32_t hasbit = field->presence;
-    return DEREF(msg, hasbit / 8, char) | (1 << (hasbit % 8));
+    return DEREF(msg, hasbit / 8, char) & (1 << (hasbit % 8));
   }
 }
 
@@ -239,7 +323,20 @@ upb_msgval upb_msg_get(const upb_msg *msg, int field_index,
                        const upb_msglayout *l) {
   const upb_msglayout_field *field = upb_msg_checkfield(field_index, l);
   int size = upb_msg_fieldsize(field);
-  return upb_msgval_read(msg, field->offset, size);
+  upb_msgval val = upb_msgval_read(msg, field->offset, size);
+
+  if (field->descriptortype == UPB_DESCRIPTOR_TYPE_MESSAGE &&
+      field->label != UPB_LABEL_REPEATED &&
+      (!upb_msg_inoneof(field) ||
+       *upb_msg_oneofcase(msg, field_index, l) == field->number) &&
+      upb_islazymsg(val.msg)) {
+    /* Left unparsed by UPB_DECODE_LAZY.  Parsing it doesn't change the
+     * message's value, so we do it in place despite |msg| being const. */
+    void **slot = VOIDPTR_AT(msg, field->offset);
+    val.msg = upb_decode_lazy(slot, l->submsgs[field->submsg_index]);
+  }
+
+  return val;
 }
 
 void upb_msg_set(upb_msg *msg, int field_index, upb_msgval val,
@@ -247,6 +344,238 @@ void upb_msg_set(upb_msg *msg, int field_index, upb_msgval val,
   const upb_msglayout_field *field = upb_msg_checkfield(field_index, l);
   int size = upb_msg_fieldsize(field);
   upb_msgval_write(msg, field->offset, val, size);
+  upb_msg_invalidatesize(msg);
+}
+
+bool upb_msg_clearfield(upb_msg *msg, int field_index,
+                        const upb_msglayout *l) {
+  const upb_msglayout_field *field = upb_msg_checkfield(field_index, l);
+
+  if (upb_msg_inoneof(field)) {
+    /* The slot belongs to whichever member of the oneof is set. */
+    uint32_t *oneofcase = upb_msg_oneofcase(msg, field_index, l);
+    if (*oneofcase != field->number) {
+      return true;
+    }
+    *oneofcase = 0;
+  } else if (field->presence > 0) {
+    DEREF(msg, field->presence / 8, char) &= ~(1 << (field->presence % 8));
+  }
+
+  memset(PTR_AT(msg, field->offset, char), 0, upb_msg_fieldsize(field));
+  upb_msg_invalidatesize(msg);
+  return true;
+}
+
+
+/** Extensions ****************************************************************/
+
+/* The extensions with a given field number, one per extendee.  Most numbers
+ * are only used by one, so the list is usually one long. */
+typedef struct upb_extreg_ent {
+  const upb_msglayout_ext *ext;
+  const struct upb_extreg_ent *next;
+} upb_extreg_ent;
+
+struct upb_extreg {
+  upb_arena *arena;
+  upb_inttable numbers;  /* Field number -> upb_extreg_ent*. */
+};
+
+upb_extreg *upb_extreg_new(upb_arena *a) {
+  upb_alloc *alloc = upb_arena_alloc(a);
+  upb_extreg *r = upb_malloc(alloc, sizeof(*r));
+
+  if (!r || !upb_inttable_init2(&r->numbers, UPB_CTYPE_CONSTPTR, alloc)) {
+    return NULL;
+  }
+
+  /* The table is freed with the arena, so it is never uninit'd. */
+  r->arena = a;
+  return r;
+}
+
+bool upb_extreg_add(upb_extreg *r, const upb_msglayout_ext *const *e,
+                    size_t n) {
+  upb_alloc *alloc = upb_arena_alloc(r->arena);
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    upb_extreg_ent *ent;
+    upb_value v;
+
+    UPB_ASSERT(e[i]->extendee->extendable);
+    CHECK_TRUE(!upb_extreg_get(r, e[i]->extendee, e[i]->field.number));
+
+    ent = upb_malloc(alloc, sizeof(*ent));
+    CHECK_TRUE(ent);
+    ent->ext = e[i];
+    ent->next = NULL;
+    if (upb_inttable_remove(&r->numbers, e[i]->field.number, &v)) {
+      ent->next = upb_value_getconstptr(v);
+    }
+    CHECK_TRUE(upb_inttable_insert2(&r->numbers, e[i]->field.number,
+                                    upb_value_constptr(ent), alloc));
+  }
+
+  return true;
+}
+
+const upb_msglayout_ext *upb_extreg_get(const upb_extreg *r,
+                                        const upb_msglayout *l,
+                                        uint32_t number) {
+  const upb_extreg_ent *ent;
+  upb_value v;
+
+  if (!upb_inttable_lookup32(&r->numbers, number, &v)) return NULL;
+  for (ent = upb_value_getconstptr(v); ent; ent = ent->next) {
+    if (ent->ext->extendee == l) return ent->ext;
+  }
+  return NULL;
+}
+
+const upb_msgexts *upb_msg_exts(const upb_msg *msg, const upb_msglayout *l) {
+  return upb_msg_getinternalwithext((upb_msg*)msg, l)->exts;
+}
+
+/* Returns the index of the first entry in |exts| whose field number is not
+ * less than |number|.  Extensions are usually added in order, so that is
+ * checked first. */
+static uint32_t upb_msgexts_lowerbound(const upb_msgexts *exts,
+                                       uint32_t number) {
+  uint32_t lo = 0, hi = exts->len;
+
+  if (hi == 0 || exts->ents[hi - 1].number < number) {
+    return hi;
+  }
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (exts->ents[mid].number < number) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Returns the holder of |e| in |msg|, or NULL if there is none. */
+static upb_msg *upb_msg_findext(const upb_msg *msg,
+                                const upb_msglayout_ext *e) {
+  const upb_msgexts *exts = upb_msg_exts(msg, e->extendee);
+  uint32_t i;
+
+  if (!exts) return NULL;
+  i = upb_msgexts_lowerbound(exts, e->field.number);
+  if (i == exts->len || exts->ents[i].number != e->field.number) {
+    return NULL;
+  }
+  return exts->ents[i].holder;
+}
+
+upb_msg *upb_msg_extholder(upb_msg *msg, const upb_msglayout_ext *e) {
+  upb_msg_internal_withext *in = upb_msg_getinternalwithext(msg, e->extendee);
+  upb_msgexts *exts = in->exts;
+  upb_arena *a = upb_msg_arena(msg);
+  upb_extholderlayout hl;
+  upb_msg *holder;
+  uint32_t i = 0;
+
+  if (exts) {
+    i = upb_msgexts_lowerbound(exts, e->field.number);
+    if (i < exts->len && exts->ents[i].number == e->field.number) {
+      UPB_ASSERT(upb_extholder_ext(exts->ents[i].holder) == e);
+      return exts->ents[i].holder;
+    }
+  }
+
+  if (!exts || exts->len == exts->size) {
+    /* Grown in the arena, which keeps the old array until it is freed. */
+    uint32_t size = exts ? exts->size * 2 : 4;
+    upb_msgexts *grown = upb_malloc(
+        upb_arena_alloc(a),
+        sizeof(upb_msgexts) + (size - 1) * sizeof(upb_msgext));
+    if (!grown) return NULL;
+    grown->len = 0;
+    grown->size = size;
+    if (exts) {
+      grown->len = exts->len;
+      memcpy(grown->ents, exts->ents, exts->len * sizeof(upb_msgext));
+    }
+    in->exts = exts = grown;
+  }
+
+  upb_extholder_layout(e, &hl);
+  holder = upb_msg_new(&hl.layout, a);
+  if (!holder) return NULL;
+  DEREF(holder, UPB_EXTHOLDER_EXT, const upb_msglayout_ext*) = e;
+
+  memmove(&exts->ents[i + 1], &exts->ents[i],
+          (exts->len - i) * sizeof(upb_msgext));
+  exts->ents[i].number = e->field.number;
+  exts->ents[i].holder = holder;
+  exts->len++;
+  upb_msg_invalidatesize(msg);
+  return holder;
+}
+
+/* Whether |holder| has a value, in the sense of upb_msg_hasext(). */
+static bool upb_extholder_isset(const upb_msg *holder) {
+  if (upb_extholder_ext(holder)->field.label == UPB_LABEL_REPEATED) {
+    const upb_array *arr =
+        DEREF(holder, UPB_EXTHOLDER_VALUE, const upb_array*);
+    return arr && arr->len > 0;
+  }
+  return DEREF(holder, 0, char) & (1 << 1);
+}
+
+bool upb_msg_hasext(const upb_msg *msg, const upb_msglayout_ext *e) {
+  const upb_msg *holder = upb_msg_findext(msg, e);
+  return holder && upb_extholder_isset(holder);
+}
+
+upb_msgval upb_msg_getext(const upb_msg *msg, const upb_msglayout_ext *e) {
+  const upb_msg *holder = upb_msg_findext(msg, e);
+  upb_extholderlayout hl;
+
+  if (!holder) {
+    upb_msgval ret;
+    memset(&ret, 0, sizeof(ret));
+    return ret;
+  }
+
+  upb_extholder_layout(e, &hl);
+  return upb_msg_get(holder, 0, &hl.layout);
+}
+
+bool upb_msg_setext(upb_msg *msg, const upb_msglayout_ext *e,
+                    upb_msgval val) {
+  upb_msg *holder = upb_msg_extholder(msg, e);
+  upb_extholderlayout hl;
+
+  CHECK_TRUE(holder);
+  upb_extholder_layout(e, &hl);
+  upb_msg_set(holder, 0, val, &hl.layout);
+  if (hl.field.presence) {
+    DEREF(holder, 0, char) |= 1 << 1;
+  }
+  upb_msg_invalidatesize(msg);
+  return true;
+}
+
+void upb_msg_clearext(upb_msg *msg, const upb_msglayout_ext *e) {
+  upb_msgexts *exts = upb_msg_getinternalwithext(msg, e->extendee)->exts;
+  uint32_t i;
+
+  if (!exts) return;
+  i = upb_msgexts_lowerbound(exts, e->field.number);
+  if (i < exts->len && exts->ents[i].number == e->field.number) {
+    exts->len--;
+    memmove(&exts->ents[i], &exts->ents[i + 1],
+            (exts->len - i) * sizeof(upb_msgext));
+    upb_msg_invalidatesize(msg);
+  }
 }
 
 
@@ -256,18 +585,20 @@ void upb_msg_set(upb_msg *msg, int field_index, upb_msgval val,
 
 upb_array *upb_array_new(upb_fieldtype_t type, upb_arena *a) {
   upb_alloc *alloc = upb_arena_alloc(a);
-  upb_array *ret = upb_malloc(alloc, sizeof(upb_array));
+  upb_array *ret =
+      upb_malloc(alloc, UPB_ARRAY_HEADERSIZE + UPB_ARRAY_INLINEBYTES);
 
   if (!ret) {
     return NULL;
   }
 
   ret->type = type;
-  ret->data = NULL;
-  ret->len = 0;
-  ret->size = 0;
   ret->element_size = upb_msgval_sizeof(type);
+  ret->data = (char*)ret + UPB_ARRAY_HEADERSIZE;
+  ret->len = 0;
+  ret->size = UPB_ARRAY_INLINEBYTES / ret->element_size;
   ret->arena = a;
+  ret->dirty = false;
 
   return ret;
 }
@@ -285,29 +616,48 @@ upb_msgval upb_array_get(const upb_array *arr, size_t i) {
   return upb_msgval_read(arr->data, i * arr->element_size, arr->element_size);
 }
 
+bool upb_array_realloc(upb_array *arr, size_t size) {
+  upb_alloc *alloc = upb_arena_alloc(arr->arena);
+  size_t old_bytes = arr->size * arr->element_size;
+  void *new_data;
+
+  UPB_ASSERT(size > arr->size);
+
+  if (upb_array_isinline(arr)) {
+    new_data = upb_malloc(alloc, size * arr->element_size);
+    if (new_data) memcpy(new_data, arr->data, arr->len * arr->element_size);
+  } else {
+    new_data = upb_realloc(alloc, arr->data, old_bytes,
+                           size * arr->element_size);
+  }
+
+  if (!new_data) {
+    return false;
+  }
+
+  arr->data = new_data;
+  arr->size = size;
+  return true;
+}
+
+/* Makes room for at least |size| elements. */
+static bool upb_array_makeroom(upb_array *arr, size_t size) {
+  if (size > arr->size) {
+    size_t new_size = UPB_MAX(arr->size * 2, 8);
+    while (new_size < size) new_size *= 2;
+    return upb_array_realloc(arr, new_size);
+  }
+
+  return true;
+}
+
 bool upb_array_set(upb_array *arr, size_t i, upb_msgval val) {
   UPB_ASSERT(i <= arr->len);
+  arr->dirty = true;
 
   if (i == arr->len) {
     /* Extending the array. */
-
-    if (i == arr->size) {
-      /* Need to reallocate. */
-      size_t new_size = UPB_MAX(arr->size * 2, 8);
-      size_t new_bytes = new_size * arr->element_size;
-      size_t old_bytes = arr->size * arr->element_size;
-      upb_alloc *alloc = upb_arena_alloc(arr->arena);
-      upb_msgval *new_data =
-          upb_realloc(alloc, arr->data, old_bytes, new_bytes);
-
-      if (!new_data) {
-        return false;
-      }
-
-      arr->data = new_data;
-      arr->size = new_size;
-    }
-
+    CHECK_TRUE(upb_array_makeroom(arr, i + 1));
     arr->len = i + 1;
   }
 
@@ -318,14 +668,14 @@ bool upb_array_set(upb_array *arr, size_t i, upb_msgval val) {
 
 /** upb_map *******************************************************************/
 
-struct upb_map {
-  upb_fieldtype_t key_type;
-  upb_fieldtype_t val_type;
-  /* We may want to optimize this to use inttable where possible, for greater
-   * efficiency and lower memory footprint. */
-  upb_strtable strtab;
-  upb_arena *arena;
-};
+#define UPB_MAP_MINSIZE_LG2 3
+
+/* How many keys upb_map_getbatch() has in flight at once. */
+#define UPB_MAP_BATCH 16
+
+static bool upb_map_isstrkey(upb_fieldtype_t type) {
+  return type == UPB_TYPE_STRING;
+}
 
 static void upb_map_tokey(upb_fieldtype_t type, upb_msgval *key,
                           const char **out_key, size_t *out_len) {
@@ -340,44 +690,151 @@ static void upb_map_tokey(upb_fieldtype_t type, upb_msgval *key,
     case UPB_TYPE_UINT32:
     case UPB_TYPE_INT64:
     case UPB_TYPE_UINT64:
-      /* Point to the key itself.  XXX: big-endian. */
-      *out_key = (const char*)key;
-      *out_len = upb_msgval_sizeof(type);
-      return;
     case UPB_TYPE_BYTES:
     case UPB_TYPE_DOUBLE:
     case UPB_TYPE_ENUM:
     case UPB_TYPE_FLOAT:
     case UPB_TYPE_MESSAGE:
-      break;  /* Cannot be a map key. */
+      break;  /* Not a string key. */
   }
   UPB_UNREACHABLE();
 }
 
-static upb_msgval upb_map_fromkey(upb_fieldtype_t type, const char *key,
-                                  size_t len) {
+static uint64_t upb_map_tointkey(upb_fieldtype_t type, upb_msgval key) {
   switch (type) {
+    case UPB_TYPE_BOOL: return key.b;
+    case UPB_TYPE_INT32: return (uint32_t)key.i32;
+    case UPB_TYPE_UINT32: return key.u32;
+    case UPB_TYPE_INT64: return (uint64_t)key.i64;
+    case UPB_TYPE_UINT64: return key.u64;
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+    case UPB_TYPE_DOUBLE:
+    case UPB_TYPE_ENUM:
+    case UPB_TYPE_FLOAT:
+    case UPB_TYPE_MESSAGE:
+      break;  /* Not an integer key. */
+  }
+  UPB_UNREACHABLE();
+}
+
+static upb_msgval upb_map_fromintkey(upb_fieldtype_t type, uint64_t key) {
+  switch (type) {
+    case UPB_TYPE_BOOL: return upb_msgval_bool(key != 0);
+    case UPB_TYPE_INT32: return upb_msgval_int32((int32_t)(uint32_t)key);
+    case UPB_TYPE_UINT32: return upb_msgval_uint32((uint32_t)key);
+    case UPB_TYPE_INT64: return upb_msgval_int64((int64_t)key);
+    case UPB_TYPE_UINT64: return upb_msgval_uint64(key);
     case UPB_TYPE_STRING:
-      return upb_msgval_makestr(key, len);
-    case UPB_TYPE_BOOL:
-    case UPB_TYPE_INT32:
-    case UPB_TYPE_UINT32:
-    case UPB_TYPE_INT64:
-    case UPB_TYPE_UINT64:
-      return upb_msgval_read(key, 0, upb_msgval_sizeof(type));
     case UPB_TYPE_BYTES:
     case UPB_TYPE_DOUBLE:
     case UPB_TYPE_ENUM:
     case UPB_TYPE_FLOAT:
     case UPB_TYPE_MESSAGE:
-      break;  /* Cannot be a map key. */
+      break;  /* Not an integer key. */
   }
   UPB_UNREACHABLE();
 }
 
+static size_t upb_map_capacity(const upb_map *map) {
+  return map->ents ? (size_t)1 << map->size_lg2 : 0;
+}
+
+/* Fibonacci hashing: the top bits of the product are well mixed even for
+ * sequential keys. */
+static size_t upb_map_slot(const upb_map *map, uint64_t key) {
+  return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - map->size_lg2));
+}
+
+/* Returns the entry for nonzero |key|, searching from its slot |i|, or
+ * NULL. */
+static upb_mapent *upb_map_probe(const upb_map *map, uint64_t key, size_t i) {
+  size_t mask = upb_map_capacity(map) - 1;
+
+  for ( ; ; i = (i + 1) & mask) {
+    if (map->ents[i].key == key) return &map->ents[i];
+    if (map->ents[i].key == 0) return NULL;
+  }
+}
+
+/* Returns the entry for nonzero |key|, or NULL. */
+static upb_mapent *upb_map_findent(const upb_map *map, uint64_t key) {
+  if (!map->ents) return NULL;
+  return upb_map_probe(map, key, upb_map_slot(map, key));
+}
+
+/* Adds nonzero |key|, which must not be present, to a table with room. */
+static void upb_map_addent(upb_map *map, uint64_t key, upb_msgval val) {
+  size_t mask = upb_map_capacity(map) - 1;
+  size_t i = upb_map_slot(map, key);
+
+  while (map->ents[i].key != 0) {
+    i = (i + 1) & mask;
+  }
+
+  map->ents[i].key = key;
+  map->ents[i].val = val;
+  map->count++;
+}
+
+/* Makes room for one more entry, keeping the table at most 3/4 full. */
+static bool upb_map_reserve(upb_map *map) {
+  size_t old_size = upb_map_capacity(map);
+  upb_alloc *alloc = upb_arena_alloc(map->arena);
+  upb_mapent *old = map->ents;
+  size_t new_size;
+  size_t i;
+
+  if ((map->count + 1) * 4 <= old_size * 3) {
+    return true;
+  }
+
+  new_size = old ? old_size * 2 : (size_t)1 << UPB_MAP_MINSIZE_LG2;
+  map->ents = upb_malloc(alloc, new_size * sizeof(*map->ents));
+  if (!map->ents) {
+    map->ents = old;
+    return false;
+  }
+
+  memset(map->ents, 0, new_size * sizeof(*map->ents));
+  map->size_lg2 = old ? map->size_lg2 + 1 : UPB_MAP_MINSIZE_LG2;
+  map->count = 0;
+
+  for (i = 0; i < old_size; i++) {
+    if (old[i].key != 0) {
+      upb_map_addent(map, old[i].key, old[i].val);
+    }
+  }
+
+  upb_free(alloc, old);
+  return true;
+}
+
+/* Empties slot |i|, moving later entries of the same probe run back so that
+ * no lookup can stop short of them. */
+static void upb_map_removeent(upb_map *map, size_t i) {
+  size_t mask = upb_map_capacity(map) - 1;
+  size_t j = i;
+
+  while (true) {
+    size_t home;
+    j = (j + 1) & mask;
+    if (map->ents[j].key == 0) break;
+    home = upb_map_slot(map, map->ents[j].key);
+    /* The entry at |j| may fill the hole at |i| if its home slot is not
+     * cyclically within (i, j]. */
+    if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+      map->ents[i] = map->ents[j];
+      i = j;
+    }
+  }
+
+  map->ents[i].key = 0;
+  map->count--;
+}
+
 upb_map *upb_map_new(upb_fieldtype_t ktype, upb_fieldtype_t vtype,
                      upb_arena *a) {
-  upb_ctype_t vtabtype = upb_fieldtotabtype(vtype);
   upb_alloc *alloc = upb_arena_alloc(a);
   upb_map *map = upb_malloc(alloc, sizeof(upb_map));
 
@@ -389,8 +846,14 @@ upb_map *upb_map_new(upb_fieldtype_t ktype, upb_fieldtype_t vtype,
   map->key_type = ktype;
   map->val_type = vtype;
   map->arena = a;
-
-  if (!upb_strtable_init2(&map->strtab, vtabtype, alloc)) {
+  map->ents = NULL;
+  map->size_lg2 = 0;
+  map->count = 0;
+  map->has_zero = false;
+  map->dirty = false;
+
+  if (upb_map_isstrkey(ktype) &&
+      !upb_strtable_init2(&map->strtab, UPB_CTYPE_PTR, alloc)) {
     return NULL;
   }
 
@@ -398,7 +861,10 @@ upb_map *upb_map_new(upb_fieldtype_t ktype, upb_fieldtype_t vtype,
 }
 
 size_t upb_map_size(const upb_map *map) {
-  return upb_strtable_count(&map->strtab);
+  if (upb_map_isstrkey(map->key_type)) {
+    return upb_strtable_count(&map->strtab);
+  }
+  return map->count + map->has_zero;
 }
 
 upb_fieldtype_t upb_map_keytype(const upb_map *map) {
@@ -415,10 +881,87 @@ bool upb_map_get(const upb_map *map, upb_msgval key, upb_msgval *val) {
   size_t key_len;
   bool ret;
 
+  if (!upb_map_isstrkey(map->key_type)) {
+    uint64_t k = upb_map_tointkey(map->key_type, key);
+    const upb_mapent *ent;
+
+    if (k == 0) {
+      if (map->has_zero) *val = map->zero_val;
+      return map->has_zero;
+    }
+
+    ent = upb_map_findent(map, k);
+    if (ent) *val = ent->val;
+    return ent != NULL;
+  }
+
   upb_map_tokey(map->key_type, &key, &key_str, &key_len);
   ret = upb_strtable_lookup2(&map->strtab, key_str, key_len, &tabval);
   if (ret) {
-    memcpy(val, &tabval, sizeof(tabval));
+    *val = *(upb_msgval*)upb_value_getptr(tabval);
+  }
+
+  return ret;
+}
+
+size_t upb_map_getbatch(const upb_map *map, const upb_msgval *keys, size_t n,
+                        upb_msgval *vals, bool *found) {
+  size_t ret = 0;
+  size_t base;
+
+  for (base = 0; base < n; base += UPB_MAP_BATCH) {
+    size_t m = UPB_MIN(n - base, UPB_MAP_BATCH);
+    size_t i;
+
+    if (upb_map_isstrkey(map->key_type)) {
+      const char *strs[UPB_MAP_BATCH];
+      size_t lens[UPB_MAP_BATCH];
+      upb_value cells[UPB_MAP_BATCH];
+
+      for (i = 0; i < m; i++) {
+        upb_msgval key = keys[base + i];
+        upb_map_tokey(map->key_type, &key, &strs[i], &lens[i]);
+      }
+      upb_strtable_lookupbatch(&map->strtab, strs, lens, m, cells,
+                               found + base);
+
+      /* Each value lives in a cell of its own. */
+      for (i = 0; i < m; i++) {
+        if (found[base + i]) UPB_PREFETCH(upb_value_getptr(cells[i]));
+      }
+      for (i = 0; i < m; i++) {
+        if (found[base + i]) {
+          vals[base + i] = *(upb_msgval*)upb_value_getptr(cells[i]);
+          ret++;
+        }
+      }
+    } else {
+      uint64_t ks[UPB_MAP_BATCH];
+      size_t slots[UPB_MAP_BATCH];
+
+      for (i = 0; i < m; i++) {
+        ks[i] = upb_map_tointkey(map->key_type, keys[base + i]);
+        if (ks[i] != 0 && map->ents) {
+          slots[i] = upb_map_slot(map, ks[i]);
+          UPB_PREFETCH(&map->ents[slots[i]]);
+        }
+      }
+
+      for (i = 0; i < m; i++) {
+        const upb_msgval *v = NULL;
+        if (ks[i] == 0) {
+          if (map->has_zero) v = &map->zero_val;
+        } else if (map->ents) {
+          const upb_mapent *ent = upb_map_probe(map, ks[i], slots[i]);
+          if (ent) v = &ent->val;
+        }
+        found[base + i] = v != NULL;
+        if (v) {
+          vals[base + i] = *v;
+          ret++;
+        }
+      }
+    }
   }
 
   return ret;
@@ -428,19 +971,52 @@ bool upb_map_set(upb_map *map, upb_msgval key, upb_msgval val,
                  upb_msgval *removed) {
   const char *key_str;
   size_t key_len;
-  upb_value tabval = upb_toval(val);
-  upb_value removedtabval;
+  upb_value tabval;
+  upb_msgval *cell;
   upb_alloc *a = upb_arena_alloc(map->arena);
 
+  map->dirty = true;
+
+  if (!upb_map_isstrkey(map->key_type)) {
+    uint64_t k = upb_map_tointkey(map->key_type, key);
+    upb_mapent *ent;
+
+    if (k == 0) {
+      if (map->has_zero && removed) *removed = map->zero_val;
+      map->has_zero = true;
+      map->zero_val = val;
+      return true;
+    }
+
+    /* Overwrite in place when the key is present. */
+    ent = upb_map_findent(map, k);
+    if (ent) {
+      if (removed) *removed = ent->val;
+      ent->val = val;
+      return true;
+    }
+
+    if (!upb_map_reserve(map)) return false;
+    upb_map_addent(map, k, val);
+    return true;
+  }
+
   upb_map_tokey(map->key_type, &key, &key_str, &key_len);
 
-  /* TODO(haberman): add overwrite operation to minimize number of lookups. */
-  if (upb_strtable_lookup2(&map->strtab, key_str, key_len, NULL)) {
-    upb_strtable_remove3(&map->strtab, key_str, key_len, &removedtabval, a);
-    memcpy(&removed, &removedtabval, sizeof(removed));
+  /* Values live in cells of their own, so a present key is overwritten in
+   * place. */
+  if (upb_strtable_lookup2(&map->strtab, key_str, key_len, &tabval)) {
+    cell = upb_value_getptr(tabval);
+    if (removed) *removed = *cell;
+    *cell = val;
+    return true;
   }
 
-  return upb_strtable_insert3(&map->strtab, key_str, key_len, tabval, a);
+  cell = upb_malloc(a, sizeof(*cell));
+  if (!cell) return false;
+  *cell = val;
+  return upb_strtable_insert3(&map->strtab, key_str, key_len,
+                              upb_value_ptr(cell), a);
 }
 
 bool upb_map_del(upb_map *map, upb_msgval key) {
@@ -448,6 +1024,24 @@ bool upb_map_del(upb_map *map, upb_msgval key) {
   size_t key_len;
   upb_alloc *a = upb_arena_alloc(map->arena);
 
+  map->dirty = true;
+
+  if (!upb_map_isstrkey(map->key_type)) {
+    uint64_t k = upb_map_tointkey(map->key_type, key);
+    upb_mapent *ent;
+
+    if (k == 0) {
+      bool had = map->has_zero;
+      map->has_zero = false;
+      return had;
+    }
+
+    ent = upb_map_findent(map, k);
+    if (!ent) return false;
+    upb_map_removeent(map, ent - map->ents);
+    return true;
+  }
+
   upb_map_tokey(map->key_type, &key, &key_str, &key_len);
   return upb_strtable_remove3(&map->strtab, key_str, key_len, NULL, a);
 }
@@ -455,18 +1049,35 @@ bool upb_map_del(upb_map *map, upb_msgval key) {
 
 /** upb_mapiter ***************************************************************/
 
-struct upb_mapiter {
-  upb_strtable_iter iter;
-  upb_fieldtype_t key_type;
-};
-
 size_t upb_mapiter_sizeof() {
   return sizeof(upb_mapiter);
 }
 
+/* Moves to the first entry at or after |i->index|, if any.  Checking against
+ * the current capacity keeps an iterator safe after the map grows. */
+static void upb_mapiter_skipempty(upb_mapiter *i) {
+  const upb_map *map = i->map;
+  size_t end = upb_map_capacity(map) + 1;
+
+  if (i->index == 0) {
+    if (map->has_zero) return;
+    i->index++;
+  }
+  while (i->index < end && map->ents[i->index - 1].key == 0) {
+    i->index++;
+  }
+}
+
 void upb_mapiter_begin(upb_mapiter *i, const upb_map *map) {
-  upb_strtable_begin(&i->iter, &map->strtab);
   i->key_type = map->key_type;
+  i->map = map;
+  i->index = 0;
+
+  if (upb_map_isstrkey(map->key_type)) {
+    upb_strtable_begin(&i->iter, &map->strtab);
+  } else {
+    upb_mapiter_skipempty(i);
+  }
 }
 
 upb_mapiter *upb_mapiter_new(const upb_map *t, upb_alloc *a) {
@@ -485,26 +1096,865 @@ void upb_mapiter_free(upb_mapiter *i, upb_alloc *a) {
 }
 
 void upb_mapiter_next(upb_mapiter *i) {
-  upb_strtable_next(&i->iter);
+  if (upb_map_isstrkey(i->key_type)) {
+    upb_strtable_next(&i->iter);
+  } else {
+    i->index++;
+    upb_mapiter_skipempty(i);
+  }
 }
 
 bool upb_mapiter_done(const upb_mapiter *i) {
-  return upb_strtable_done(&i->iter);
+  if (upb_map_isstrkey(i->key_type)) {
+    return upb_strtable_done(&i->iter);
+  }
+  return !i->map || i->index > upb_map_capacity(i->map);
 }
 
 upb_msgval upb_mapiter_key(const upb_mapiter *i) {
-  return upb_map_fromkey(i->key_type, upb_strtable_iter_key(&i->iter),
-                         upb_strtable_iter_keylength(&i->iter));
+  if (upb_map_isstrkey(i->key_type)) {
+    return upb_msgval_makestr(upb_strtable_iter_key(&i->iter),
+                              upb_strtable_iter_keylength(&i->iter));
+  }
+  return upb_map_fromintkey(
+      i->key_type, i->index == 0 ? 0 : i->map->ents[i->index - 1].key);
 }
 
 upb_msgval upb_mapiter_value(const upb_mapiter *i) {
-  return upb_msgval_fromval(upb_strtable_iter_value(&i->iter));
+  if (upb_map_isstrkey(i->key_type)) {
+    return *(upb_msgval*)upb_value_getptr(upb_strtable_iter_value(&i->iter));
+  }
+  return i->index == 0 ? i->map->zero_val : i->map->ents[i->index - 1].val;
 }
 
 void upb_mapiter_setdone(upb_mapiter *i) {
-  upb_strtable_iter_setdone(&i->iter);
+  if (upb_map_isstrkey(i->key_type)) {
+    upb_strtable_iter_setdone(&i->iter);
+  } else {
+    i->map = NULL;
+  }
 }
 
 bool upb_mapiter_isequal(const upb_mapiter *i1, const upb_mapiter *i2) {
-  return upb_strtable_iter_isequal(&i1->iter, &i2->iter);
+  if (upb_map_isstrkey(i1->key_type)) {
+    return upb_strtable_iter_isequal(&i1->iter, &i2->iter);
+  }
+  if (upb_mapiter_done(i1) && upb_mapiter_done(i2)) return true;
+  return i1->map == i2->map && i1->index == i2->index;
+}
+
+
+/** upb_msg_deepcopy(), upb_msg_merge(), upb_msg_clear() **********************/
+
+static bool upb_msg_fieldisstr(const upb_msglayout_field *f) {
+  return f->descriptortype == UPB_DESCRIPTOR_TYPE_STRING ||
+         f->descriptortype == UPB_DESCRIPTOR_TYPE_BYTES;
+}
+
+static bool upb_msg_fieldismsg(const upb_msglayout_field *f) {
+  return f->descriptortype == UPB_DESCRIPTOR_TYPE_MESSAGE ||
+         f->descriptortype == UPB_DESCRIPTOR_TYPE_GROUP;
+}
+
+/* Whether |msg| has a value for singular field |f|.  Fields without presence
+ * (proto3) count as set when they are nonzero, as when serializing. */
+static bool upb_msg_fieldpresent(const upb_msg *msg,
+                                 const upb_msglayout_field *f) {
+  if (f->presence > 0) {
+    return DEREF(msg, f->presence / 8, char) & (1 << (f->presence % 8));
+  } else if (f->presence < 0) {
+    return DEREF(msg, ~f->presence, uint32_t) == f->number;
+  } else if (upb_msg_fieldisstr(f)) {
+    const upb_stringview *str = PTR_AT(msg, f->offset, const upb_stringview);
+    return str->size > 0;
+  } else {
+    const char *p = PTR_AT(msg, f->offset, const char);
+    size_t size = upb_msg_fieldsize(f);
+    size_t i;
+    for (i = 0; i < size; i++) {
+      if (p[i]) return true;
+    }
+    return false;
+  }
+}
+
+static void upb_msg_setpresent(upb_msg *msg, const upb_msglayout_field *f) {
+  if (f->presence > 0) {
+    DEREF(msg, f->presence / 8, char) |= (1 << (f->presence % 8));
+  } else if (f->presence < 0) {
+    DEREF(msg, ~f->presence, uint32_t) = f->number;
+  }
+}
+
+static bool upb_msg_copystr(upb_stringview *str, upb_arena *a) {
+  char *data;
+
+  if (str->size == 0) {
+    return true;
+  }
+
+  data = upb_malloc(upb_arena_alloc(a), str->size);
+  CHECK_TRUE(data);
+  memcpy(data, str->data, str->size);
+  str->data = data;
+  return true;
+}
+
+/* Returns a copy in |a| of the lazy submessage |sub|.  Only the record and its
+ * bytes are copied; the copy is parsed into |a| when it is first read. */
+static void *upb_msg_copylazy(const void *sub, upb_arena *a) {
+  const upb_lazymsg *lazy = upb_getlazymsg(sub);
+  upb_lazymsg *ret = upb_malloc(upb_arena_alloc(a), sizeof(*ret));
+
+  if (!ret) {
+    return NULL;
+  }
+
+  *ret = *lazy;
+  ret->arena = a;
+  if (!upb_msg_copystr(&ret->data, a)) {
+    return NULL;
+  }
+
+  return (char*)ret + 1;
+}
+
+/* Appends the unknown fields of |src| to those of |dst|.  Spans are shared,
+ * like strings, if |share| is true. */
+static bool upb_msg_copyunknown(upb_msg *dst, const upb_msg *src,
+                                bool share) {
+  size_t count;
+  const upb_stringview *spans = upb_msg_getunknownspans(src, &count);
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    CHECK_TRUE(share ? upb_msg_addunknown_alias(dst, spans[i].data,
+                                                spans[i].size)
+                     : upb_msg_addunknown(dst, spans[i].data, spans[i].size));
+  }
+
+  return true;
+}
+
+static upb_msg *upb_msg_copy(const upb_msg *src, const upb_msglayout *l,
+                             upb_arena *a);
+
+/* Makes |*val|, a value of type |type| taken from a message, independent of
+ * that message: a submessage (of layout |subl|) is deep copied into |a|, and a
+ * string is copied into |a| unless |share|. */
+static bool upb_msgval_copy(upb_msgval *val, upb_fieldtype_t type,
+                            const upb_msglayout *subl, bool share,
+                            upb_arena *a) {
+  switch (type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      return share || upb_msg_copystr(&val->str, a);
+    case UPB_TYPE_MESSAGE:
+      if (!val->msg) {
+        return true;
+      } else if (upb_islazymsg(val->msg)) {
+        /* Parsing it yields the same message whichever slot it is in. */
+        if (!share) val->msg = upb_msg_copylazy(val->msg, a);
+      } else {
+        val->msg = upb_msg_copy(val->msg, subl, a);
+      }
+      return val->msg != NULL;
+    default:
+      return true;
+  }
+}
+
+/* Appends the elements of |src| to |dst|, making them independent of |src| as
+ * upb_msgval_copy() does.  Scalars are copied in a single memcpy(). */
+static bool upb_array_appendall(upb_array *dst, const upb_array *src,
+                                const upb_msglayout *subl, bool share) {
+  size_t start = dst->len;
+  size_t i;
+
+  UPB_ASSERT(dst->type == src->type);
+  CHECK_TRUE(upb_array_makeroom(dst, dst->len + src->len));
+  memcpy((char*)dst->data + start * dst->element_size, src->data,
+         src->len * src->element_size);
+  dst->len += src->len;
+
+  if (dst->type == UPB_TYPE_STRING || dst->type == UPB_TYPE_BYTES ||
+      dst->type == UPB_TYPE_MESSAGE) {
+    for (i = start; i < dst->len; i++) {
+      upb_msgval val = upb_array_get(dst, i);
+      CHECK_TRUE(upb_msgval_copy(&val, dst->type, subl, share, dst->arena));
+      upb_msgval_write(dst->data, i * dst->element_size, val,
+                       dst->element_size);
+    }
+  }
+
+  return true;
+}
+
+/* Adds the entries of |src| to |dst|, replacing those with the same keys.
+ * |entryl| is the layout of the map's entry message. */
+static bool upb_map_setall(upb_map *dst, const upb_map *src,
+                           const upb_msglayout *entryl, bool share) {
+  const upb_msglayout_field *key;
+  const upb_msglayout_field *val;
+  const upb_msglayout *subl;
+  upb_mapiter i;
+
+  upb_mapentry_fields(entryl, &key, &val);
+  subl = upb_msg_fieldismsg(val) ? entryl->submsgs[val->submsg_index] : NULL;
+
+  for (upb_mapiter_begin(&i, src); !upb_mapiter_done(&i);
+       upb_mapiter_next(&i)) {
+    upb_msgval v = upb_mapiter_value(&i);
+    /* The map keeps its own copy of string keys. */
+    CHECK_TRUE(upb_msgval_copy(&v, dst->val_type, subl, share, dst->arena));
+    CHECK_TRUE(upb_map_set(dst, upb_mapiter_key(&i), v, NULL));
+  }
+
+  return true;
+}
+
+static void upb_map_clear(upb_map *map) {
+  if (upb_map_isstrkey(map->key_type)) {
+    upb_strtable_clear(&map->strtab, upb_arena_alloc(map->arena));
+  } else if (map->ents) {
+    memset(map->ents, 0, upb_map_capacity(map) * sizeof(*map->ents));
+    map->count = 0;
+  }
+  map->has_zero = false;
+}
+
+/* Replaces the repeated field or map in slot |f| of |msg|, which was copied
+ * there from another message, with a copy of its own in |a|. */
+static bool upb_msg_copycontainer(upb_msg *msg, const upb_msglayout_field *f,
+                                  const upb_msglayout *l, bool share,
+                                  upb_arena *a) {
+  const upb_msglayout *subl =
+      upb_msg_fieldismsg(f) ? l->submsgs[f->submsg_index] : NULL;
+
+  if (upb_msglayout_ismap(l, f)) {
+    upb_map **map = PTR_AT(msg, f->offset, upb_map*);
+    upb_map *copy;
+    if (!*map) return true;
+    copy = upb_map_new((*map)->key_type, (*map)->val_type, a);
+    CHECK_TRUE(copy && upb_map_setall(copy, *map, subl, share));
+    *map = copy;
+  } else {
+    upb_array **arr = PTR_AT(msg, f->offset, upb_array*);
+    upb_array *copy;
+    if (!*arr) return true;
+    copy = upb_array_new((*arr)->type, a);
+    CHECK_TRUE(copy && upb_array_appendall(copy, *arr, subl, share));
+    *arr = copy;
+  }
+
+  return true;
+}
+
+/* Merges the extensions of |src| into |dst|, which have layout |l|. */
+static bool upb_msg_mergeexts(upb_msg *dst, const upb_msg *src,
+                              const upb_msglayout *l) {
+  const upb_msgexts *exts = upb_msg_exts(src, l);
+  uint32_t i;
+
+  for (i = 0; exts && i < exts->len; i++) {
+    const upb_msg *from = exts->ents[i].holder;
+    const upb_msglayout_ext *e = upb_extholder_ext(from);
+    upb_msg *to = upb_msg_extholder(dst, e);
+    upb_extholderlayout hl;
+
+    upb_extholder_layout(e, &hl);
+    CHECK_TRUE(to && upb_msg_merge(to, from, &hl.layout));
+  }
+
+  return true;
+}
+
+static upb_msg *upb_msg_copy(const upb_msg *src, const upb_msglayout *l,
+                             upb_arena *a) {
+  upb_msg *msg = upb_msg_new(l, a);
+  bool share = upb_msg_arena(src) == a;
+  int i;
+
+  if (!msg) {
+    return NULL;
+  }
+
+  /* Scalars, hasbits and oneof cases are done in one go; only fields that
+   * point outside the message need more work. */
+  memcpy(msg, src, l->size);
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *f = &l->fields[i];
+    upb_msgval val;
+
+    if (f->label == UPB_LABEL_REPEATED) {
+      if (!upb_msg_copycontainer(msg, f, l, share, a)) return NULL;
+      continue;
+    }
+
+    if (!upb_msg_fieldisstr(f) && !upb_msg_fieldismsg(f)) continue;
+    /* The slot of an inactive oneof member belongs to the active one. */
+    if (upb_msg_inoneof(f) && !upb_msg_fieldpresent(src, f)) continue;
+
+    val = upb_msgval_read(msg, f->offset, upb_msg_fieldsize(f));
+    if (!upb_msgval_copy(&val, upb_desctype_to_fieldtype[f->descriptortype],
+                         upb_msg_fieldismsg(f) ? l->submsgs[f->submsg_index]
+                                               : NULL,
+                         share, a)) {
+      return NULL;
+    }
+    upb_msgval_write(msg, f->offset, val, upb_msg_fieldsize(f));
+  }
+
+  if (!upb_msg_copyunknown(msg, src, share)) return NULL;
+  if (l->extendable && !upb_msg_mergeexts(msg, src, l)) return NULL;
+
+  return msg;
+}
+
+upb_msg *upb_msg_deepcopy(const upb_msg *msg, const upb_msglayout *l,
+                          upb_arena *a) {
+  return upb_msg_copy(msg, l, a);
+}
+
+/* Merges singular submessage field |f| of |src| into |dst|. */
+static bool upb_msg_mergesubmsg(upb_msg *dst, const upb_msg *src,
+                                const upb_msglayout_field *f,
+                                const upb_msglayout *l, bool share) {
+  const upb_msglayout *subl = l->submsgs[f->submsg_index];
+  void **slot = PTR_AT(dst, f->offset, void*);
+  const void *sub = DEREF(src, f->offset, const void*);
+
+  if (!sub) {
+    return true;
+  }
+
+  if (!*slot || (upb_msg_inoneof(f) && !upb_msg_fieldpresent(dst, f))) {
+    upb_msgval val;
+    val.msg = sub;
+    CHECK_TRUE(upb_msgval_copy(&val, UPB_TYPE_MESSAGE, subl, share,
+                               upb_msg_arena(dst)));
+    *slot = (void*)val.msg;
+    return true;
+  }
+
+  if (upb_islazymsg(*slot)) {
+    CHECK_TRUE(upb_decode_lazy(slot, subl));
+  }
+
+  if (upb_islazymsg(sub)) {
+    /* Parsing into an existing message merges into it. */
+    const upb_lazymsg *lazy = upb_getlazymsg(sub);
+    int options = lazy->options;
+    if (!share) options |= UPB_DECODE_COPYSTRINGS;
+    return upb_decode_lazyinto(lazy, *slot, subl, options);
+  }
+
+  return upb_msg_merge(*slot, sub, subl);
+}
+
+bool upb_msg_merge(upb_msg *dst, const upb_msg *src, const upb_msglayout *l) {
+  upb_arena *a = upb_msg_arena(dst);
+  bool share = upb_msg_arena(src) == a;
+  int i;
+
+  upb_msg_invalidatesize(dst);
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *f = &l->fields[i];
+    const upb_msglayout *subl =
+        upb_msg_fieldismsg(f) ? l->submsgs[f->submsg_index] : NULL;
+
+    if (upb_msglayout_ismap(l, f)) {
+      const upb_map *from = DEREF(src, f->offset, const upb_map*);
+      upb_map **to = PTR_AT(dst, f->offset, upb_map*);
+      if (!from || upb_map_size(from) == 0) continue;
+      if (!*to) *to = upb_map_new(from->key_type, from->val_type, a);
+      CHECK_TRUE(*to && upb_map_setall(*to, from, subl, share));
+    } else if (f->label == UPB_LABEL_REPEATED) {
+      const upb_array *from = DEREF(src, f->offset, const upb_array*);
+      upb_array **to = PTR_AT(dst, f->offset, upb_array*);
+      if (!from || from->len == 0) continue;
+      if (!*to) *to = upb_array_new(from->type, a);
+      CHECK_TRUE(*to && upb_array_appendall(*to, from, subl, share));
+    } else if (upb_msg_fieldpresent(src, f)) {
+      if (upb_msg_fieldismsg(f)) {
+        CHECK_TRUE(upb_msg_mergesubmsg(dst, src, f, l, share));
+      } else {
+        size_t size = upb_msg_fieldsize(f);
+        upb_msgval val = upb_msgval_read(src, f->offset, size);
+        if (upb_msg_fieldisstr(f) && !share) {
+          CHECK_TRUE(upb_msg_copystr(&val.str, a));
+        }
+        upb_msgval_write(dst, f->offset, val, size);
+      }
+      upb_msg_setpresent(dst, f);
+    }
+  }
+
+  if (!upb_msg_copyunknown(dst, src, share)) return false;
+  if (l->extendable && !upb_msg_mergeexts(dst, src, l)) return false;
+
+  return true;
+}
+
+void upb_msg_clear(upb_msg *msg, const upb_msglayout *l) {
+  int i;
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *f = &l->fields[i];
+
+    if (upb_msglayout_ismap(l, f)) {
+      upb_map *map = DEREF(msg, f->offset, upb_map*);
+      if (map) upb_map_clear(map);
+    } else if (f->label == UPB_LABEL_REPEATED) {
+      upb_array *arr = DEREF(msg, f->offset, upb_array*);
+      if (arr) arr->len = 0;
+    } else {
+      memset(PTR_AT(msg, f->offset, char), 0, upb_msg_fieldsize(f));
+      if (f->presence > 0) {
+        DEREF(msg, f->presence / 8, char) &= ~(1 << (f->presence % 8));
+      } else if (f->presence < 0) {
+        DEREF(msg, ~f->presence, uint32_t) = 0;
+      }
+    }
+  }
+
+  /* The span array is kept for the next message, but not the chunks, which
+   * other messages may share. */
+  upb_msg_getinternal(msg)->unknown_count = 0;
+  upb_msg_getinternal(msg)->unknown_len = 0;
+  upb_msg_getinternal(msg)->unknown_room = 0;
+  if (l->extendable) {
+    upb_msg_getinternalwithext(msg, l)->exts = NULL;
+  }
+  upb_msg_invalidatesize(msg);
+}
+
+
+/** upb_msg_equal(), upb_msg_hash() *******************************************/
+
+/* Both walk the layout and look only at fields that are present, so the bytes
+ * of unset fields (and of inactive oneof members) don't matter.  Scalars are
+ * compared and hashed by their bytes, which is what makes floats compare
+ * bitwise.  A NULL repeated field or map is the same as an empty one. */
+
+/* Returns the submessage in singular field |f| of |msg|, parsing it first if
+ * UPB_DECODE_LAZY left it unparsed, as upb_msg_get() does.  Returns false if
+ * that fails. */
+static bool upb_msg_getsubmsg(const upb_msg *msg, const upb_msglayout_field *f,
+                              const upb_msglayout *subl, const upb_msg **sub) {
+  void **slot = VOIDPTR_AT(msg, f->offset);
+
+  if (*slot && upb_islazymsg(*slot)) {
+    *sub = upb_decode_lazy(slot, subl);
+    return *sub != NULL;
+  }
+
+  *sub = *slot;
+  return true;
+}
+
+/* A memcmp() of a constant size, which the compiler can inline. */
+static bool upb_msg_scalarequal(const char *a, const char *b, size_t size) {
+  switch (size) {
+    case 1: return *a == *b;
+    case 4: return memcmp(a, b, 4) == 0;
+    default: return memcmp(a, b, 8) == 0;
+  }
+}
+
+static bool upb_msg_equalsub(const upb_msg *a, const upb_msg *b,
+                             const upb_msglayout *l, int options) {
+  if (!a || !b) return a == b;
+  return upb_msg_equal2(a, b, l, options);
+}
+
+static bool upb_msgval_equal(upb_msgval a, upb_msgval b, upb_fieldtype_t type,
+                             const upb_msglayout *subl, int options) {
+  switch (type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      return a.str.size == b.str.size &&
+             memcmp(a.str.data, b.str.data, a.str.size) == 0;
+    case UPB_TYPE_MESSAGE:
+      return upb_msg_equalsub(a.msg, b.msg, subl, options);
+    default:
+      return memcmp(&a, &b, upb_msgval_sizeof(type)) == 0;
+  }
+}
+
+static bool upb_array_equal(const upb_array *a, const upb_array *b,
+                            const upb_msglayout *subl, int options) {
+  size_t len = a ? a->len : 0;
+  size_t i;
+
+  if (len != (b ? b->len : 0)) return false;
+  if (len == 0) return true;
+
+  switch (a->type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+    case UPB_TYPE_MESSAGE:
+      for (i = 0; i < len; i++) {
+        CHECK_TRUE(upb_msgval_equal(upb_array_get(a, i), upb_array_get(b, i),
+                                    a->type, subl, options));
+      }
+      return true;
+    default:
+      return memcmp(a->data, b->data, len * a->element_size) == 0;
+  }
+}
+
+/* |entryl| is the layout of the map's entry message. */
+static bool upb_map_equal(const upb_map *a, const upb_map *b,
+                          const upb_msglayout *entryl, int options) {
+  const upb_msglayout_field *key;
+  const upb_msglayout_field *val;
+  const upb_msglayout *subl;
+  upb_mapiter i;
+
+  if ((a ? upb_map_size(a) : 0) != (b ? upb_map_size(b) : 0)) return false;
+  if (!a || upb_map_size(a) == 0) return true;
+
+  upb_mapentry_fields(entryl, &key, &val);
+  subl = upb_msg_fieldismsg(val) ? entryl->submsgs[val->submsg_index] : NULL;
+
+  /* Same size, so if every entry of |a| is in |b|, the reverse holds too. */
+  for (upb_mapiter_begin(&i, a); !upb_mapiter_done(&i);
+       upb_mapiter_next(&i)) {
+    upb_msgval bval;
+    CHECK_TRUE(upb_map_get(b, upb_mapiter_key(&i), &bval));
+    CHECK_TRUE(upb_msgval_equal(upb_mapiter_value(&i), bval, a->val_type, subl,
+                                options));
+  }
+
+  return true;
+}
+
+/* Compares the unknown fields of two messages as byte strings, whatever
+ * spans they happen to be split into. */
+static bool upb_msg_unknownequal(const upb_msg *a, const upb_msg *b) {
+  size_t count_a, count_b;
+  const upb_stringview *spans_a = upb_msg_getunknownspans(a, &count_a);
+  const upb_stringview *spans_b = upb_msg_getunknownspans(b, &count_b);
+  size_t ofs_a = 0, ofs_b = 0;
+
+  if (upb_msg_unknownsize(a) != upb_msg_unknownsize(b)) return false;
+
+  while (count_a > 0 && count_b > 0) {
+    size_t n = UPB_MIN(spans_a->size - ofs_a, spans_b->size - ofs_b);
+    CHECK_TRUE(memcmp(spans_a->data + ofs_a, spans_b->data + ofs_b, n) == 0);
+    ofs_a += n;
+    ofs_b += n;
+    if (ofs_a == spans_a->size) { spans_a++; count_a--; ofs_a = 0; }
+    if (ofs_b == spans_b->size) { spans_b++; count_b--; ofs_b = 0; }
+  }
+
+  return true;
+}
+
+bool upb_msg_equal(const upb_msg *a, const upb_msg *b,
+                   const upb_msglayout *l) {
+  return upb_msg_equal2(a, b, l, 0);
+}
+
+/* Compares the extensions of |a| and |b|, which have layout |l|.  A holder
+ * without a value is the same as no holder. */
+static bool upb_msg_extequal(const upb_msg *a, const upb_msg *b,
+                             const upb_msglayout *l, int options) {
+  const upb_msgexts *ea = upb_msg_exts(a, l);
+  const upb_msgexts *eb = upb_msg_exts(b, l);
+  uint32_t na = ea ? ea->len : 0;
+  uint32_t nb = eb ? eb->len : 0;
+  uint32_t i = 0, j = 0;
+
+  /* Both are sorted by field number, so they are walked side by side. */
+  while (true) {
+    const upb_msg *ha, *hb;
+    upb_extholderlayout hl;
+
+    while (i < na && !upb_extholder_isset(ea->ents[i].holder)) i++;
+    while (j < nb && !upb_extholder_isset(eb->ents[j].holder)) j++;
+    if (i == na || j == nb) break;
+
+    ha = ea->ents[i++].holder;
+    hb = eb->ents[j++].holder;
+    CHECK_TRUE(upb_extholder_ext(ha) == upb_extholder_ext(hb));
+    upb_extholder_layout(upb_extholder_ext(ha), &hl);
+    CHECK_TRUE(upb_msg_equal2(ha, hb, &hl.layout, options));
+  }
+
+  return i == na && j == nb;
+}
+
+bool upb_msg_equal2(const upb_msg *a, const upb_msg *b,
+                    const upb_msglayout *l, int options) {
+  int i;
+
+  if (a == b) return true;
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *f = &l->fields[i];
+    const upb_msglayout *subl =
+        upb_msg_fieldismsg(f) ? l->submsgs[f->submsg_index] : NULL;
+
+    if (upb_msglayout_ismap(l, f)) {
+      CHECK_TRUE(upb_map_equal(DEREF(a, f->offset, const upb_map*),
+                               DEREF(b, f->offset, const upb_map*), subl,
+                               options));
+    } else if (f->label == UPB_LABEL_REPEATED) {
+      CHECK_TRUE(upb_array_equal(DEREF(a, f->offset, const upb_array*),
+                                 DEREF(b, f->offset, const upb_array*), subl,
+                                 options));
+    } else {
+      bool present = upb_msg_fieldpresent(a, f);
+      CHECK_TRUE(present == upb_msg_fieldpresent(b, f));
+      if (!present) continue;
+
+      if (upb_msg_fieldismsg(f)) {
+        const upb_msg *sub_a, *sub_b;
+        CHECK_TRUE(upb_msg_getsubmsg(a, f, subl, &sub_a) &&
+                   upb_msg_getsubmsg(b, f, subl, &sub_b) &&
+                   upb_msg_equalsub(sub_a, sub_b, subl, options));
+      } else if (upb_msg_fieldisstr(f)) {
+        const upb_stringview *str_a = PTR_AT(a, f->offset, upb_stringview);
+        const upb_stringview *str_b = PTR_AT(b, f->offset, upb_stringview);
+        CHECK_TRUE(str_a->size == str_b->size &&
+                   memcmp(str_a->data, str_b->data, str_a->size) == 0);
+      } else {
+        CHECK_TRUE(upb_msg_scalarequal(PTR_AT(a, f->offset, char),
+                                       PTR_AT(b, f->offset, char),
+                                       upb_msg_fieldsize(f)));
+      }
+    }
+  }
+
+  if (l->extendable) CHECK_TRUE(upb_msg_extequal(a, b, l, options));
+
+  return (options & UPB_MSG_IGNOREUNKNOWN) || upb_msg_unknownequal(a, b);
+}
+
+/* Hashes a stream of bytes eight at a time, so how it is split into pieces
+ * doesn't change the result. */
+typedef struct {
+  uint64_t h;
+  char buf[8];  /* Bytes not yet mixed in. */
+  size_t n;     /* How many of them. */
+  uint64_t len;
+} upb_msghasher;
+
+static uint64_t upb_msghasher_mix(uint64_t h, const char *p) {
+  uint64_t word;
+  memcpy(&word, p, 8);
+  h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 32);
+}
+
+static void upb_msghasher_init(upb_msghasher *s, uint64_t seed) {
+  s->h = seed;
+  s->n = 0;
+  s->len = 0;
+}
+
+static void upb_msghasher_put(upb_msghasher *s, const void *data, size_t len) {
+  const char *p = data;
+  s->len += len;
+
+  if (s->n > 0) {
+    size_t n = UPB_MIN(len, 8 - s->n);
+    memcpy(s->buf + s->n, p, n);
+    s->n += n;
+    p += n;
+    len -= n;
+    if (s->n < 8) return;
+    s->h = upb_msghasher_mix(s->h, s->buf);
+    s->n = 0;
+  }
+
+  for ( ; len >= 8; p += 8, len -= 8) {
+    s->h = upb_msghasher_mix(s->h, p);
+  }
+
+  memcpy(s->buf, p, len);
+  s->n = len;
+}
+
+static void upb_msghasher_putu64(upb_msghasher *s, uint64_t val) {
+  if (s->n == 0) {
+    s->h = upb_msghasher_mix(s->h, (const char*)&val);
+    s->len += 8;
+  } else {
+    upb_msghasher_put(s, &val, 8);
+  }
+}
+
+static uint64_t upb_msghasher_finish(upb_msghasher *s) {
+  uint64_t h;
+  memset(s->buf + s->n, 0, 8 - s->n);
+  h = upb_msghasher_mix(s->h, s->buf) ^ s->len;
+  h = (h ^ (h >> 31)) * 0x94D049BB133111EBULL;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  return h ^ (h >> 32);
+}
+
+/* The bits of a scalar, zero-extended so that what follows it in the hash
+ * starts on a word. */
+static uint64_t upb_msg_scalarbits(const char *p, size_t size) {
+  uint32_t u32;
+  uint64_t u64;
+  switch (size) {
+    case 1: return (unsigned char)*p;
+    case 4: memcpy(&u32, p, 4); return u32;
+    default: memcpy(&u64, p, 8); return u64;
+  }
+}
+
+static void upb_msgval_hash(upb_msghasher *s, upb_msgval val,
+                            upb_fieldtype_t type, const upb_msglayout *subl,
+                            uint64_t seed, int options) {
+  switch (type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      upb_msghasher_putu64(s, val.str.size);
+      upb_msghasher_put(s, val.str.data, val.str.size);
+      return;
+    case UPB_TYPE_MESSAGE:
+      upb_msghasher_putu64(
+          s, val.msg ? upb_msg_hash2(val.msg, subl, seed, options) : 0);
+      return;
+    default:
+      upb_msghasher_putu64(
+          s, upb_msg_scalarbits((const char*)&val, upb_msgval_sizeof(type)));
+      return;
+  }
+}
+
+static void upb_array_hash(upb_msghasher *s, const upb_array *arr,
+                           const upb_msglayout *subl, uint64_t seed,
+                           int options) {
+  size_t i;
+
+  upb_msghasher_putu64(s, arr->len);
+
+  switch (arr->type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+    case UPB_TYPE_MESSAGE:
+      for (i = 0; i < arr->len; i++) {
+        upb_msgval_hash(s, upb_array_get(arr, i), arr->type, subl, seed,
+                        options);
+      }
+      return;
+    default:
+      upb_msghasher_put(s, arr->data, arr->len * arr->element_size);
+      return;
+  }
+}
+
+/* Entries are hashed separately and summed, so the order they come out of
+ * the map in doesn't matter. */
+static void upb_map_hash(upb_msghasher *s, const upb_map *map,
+                         const upb_msglayout *entryl, uint64_t seed,
+                         int options) {
+  const upb_msglayout_field *key;
+  const upb_msglayout_field *val;
+  const upb_msglayout *subl;
+  uint64_t sum = 0;
+  upb_mapiter i;
+
+  upb_mapentry_fields(entryl, &key, &val);
+  subl = upb_msg_fieldismsg(val) ? entryl->submsgs[val->submsg_index] : NULL;
+
+  for (upb_mapiter_begin(&i, map); !upb_mapiter_done(&i);
+       upb_mapiter_next(&i)) {
+    upb_msghasher entry;
+    upb_msghasher_init(&entry, seed);
+    upb_msgval_hash(&entry, upb_mapiter_key(&i), map->key_type, NULL, seed,
+                    options);
+    upb_msgval_hash(&entry, upb_mapiter_value(&i), map->val_type, subl, seed,
+                    options);
+    sum += upb_msghasher_finish(&entry);
+  }
+
+  upb_msghasher_putu64(s, upb_map_size(map));
+  upb_msghasher_putu64(s, sum);
+}
+
+uint64_t upb_msg_hash(const upb_msg *msg, const upb_msglayout *l,
+                      uint64_t seed) {
+  return upb_msg_hash2(msg, l, seed, 0);
+}
+
+uint64_t upb_msg_hash2(const upb_msg *msg, const upb_msglayout *l,
+                       uint64_t seed, int options) {
+  upb_msghasher s;
+  int i;
+
+  upb_msghasher_init(&s, seed);
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *f = &l->fields[i];
+    const upb_msglayout *subl =
+        upb_msg_fieldismsg(f) ? l->submsgs[f->submsg_index] : NULL;
+
+    if (upb_msglayout_ismap(l, f)) {
+      const upb_map *map = DEREF(msg, f->offset, const upb_map*);
+      if (!map || upb_map_size(map) == 0) continue;
+      upb_msghasher_putu64(&s, f->number);
+      upb_map_hash(&s, map, subl, seed, options);
+    } else if (f->label == UPB_LABEL_REPEATED) {
+      const upb_array *arr = DEREF(msg, f->offset, const upb_array*);
+      if (!arr || arr->len == 0) continue;
+      upb_msghasher_putu64(&s, f->number);
+      upb_array_hash(&s, arr, subl, seed, options);
+    } else if (upb_msg_fieldpresent(msg, f)) {
+      upb_msgval val;
+      upb_msghasher_putu64(&s, f->number);
+      if (upb_msg_fieldismsg(f)) {
+        if (!upb_msg_getsubmsg(msg, f, subl, &val.msg)) {
+          /* Unparseable, so it equals nothing and any hash will do. */
+          upb_stringview data =
+              upb_getlazymsg(DEREF(msg, f->offset, const void*))->data;
+          upb_msghasher_put(&s, data.data, data.size);
+          continue;
+        }
+      } else if (upb_msg_fieldisstr(f)) {
+        val.str = DEREF(msg, f->offset, upb_stringview);
+      } else {
+        upb_msghasher_putu64(
+            &s, upb_msg_scalarbits(PTR_AT(msg, f->offset, const char),
+                                   upb_msg_fieldsize(f)));
+        continue;
+      }
+      upb_msgval_hash(&s, val, upb_desctype_to_fieldtype[f->descriptortype],
+                      subl, seed, options);
+    }
+  }
+
+  if (l->extendable) {
+    const upb_msgexts *exts = upb_msg_exts(msg, l);
+    uint32_t i;
+
+    for (i = 0; exts && i < exts->len; i++) {
+      const upb_msg *holder = exts->ents[i].holder;
+      upb_extholderlayout hl;
+      if (!upb_extholder_isset(holder)) continue;
+      upb_extholder_layout(upb_extholder_ext(holder), &hl);
+      upb_msghasher_putu64(&s, upb_msg_hash2(holder, &hl.layout, seed,
+                                             options));
+    }
+  }
+
+  if (!(options & UPB_MSG_IGNOREUNKNOWN)) {
+    size_t count, j;
+    const upb_stringview *spans = upb_msg_getunknownspans(msg, &count);
+    upb_msghasher_putu64(&s, upb_msg_unknownsize(msg));
+    for (j = 0; j < count; j++) {
+      upb_msghasher_put(&s, spans[j].data, spans[j].size);
+    }
+  }
+
+  return upb_msghasher_finish(&s);
 }
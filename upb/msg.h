@@ -21,9 +21,7 @@
 #ifndef UPB_MSG_H_
 #define UPB_MSG_H_
 
-#include "upb/def.h"
-#include "upb/handlers.h"
-#include "upb/sink.h"
+#include "upb/upb.h"
 
 #ifdef __cplusplus
 
@@ -62,6 +60,14 @@ typedef struct {
   uint8_t label;
 } upb_msglayout_field;
 
+/* A parser specialized for one message type, which upbc generates on request
+ * (see upb_msglayout.parse).  Parses fields from *ptr into |msg| until it
+ * reaches |limit| or a field it leaves to upb_decode(), and sets *ptr to the
+ * start of that field.  |options| are the upb_decodeopt values of the parse.
+ * Returns false if the input is malformed. */
+typedef bool upb_msglayout_parsefunc(const char **ptr, const char *limit,
+                                     upb_msg *msg, int options);
+
 typedef struct upb_msglayout {
   const struct upb_msglayout *const* submsgs;
   const upb_msglayout_field *fields;
@@ -70,8 +76,71 @@ typedef struct upb_msglayout {
   uint16_t size;
   uint16_t field_count;
   bool extendable;
+  /* Dense field number -> field table, used by the decoder to resolve tags in
+   * constant time.  For 0 <= n < dense_count, dense[n] is one plus the index
+   * of field number n in |fields|, or 0 if there is no such field.  Numbers at
+   * or beyond dense_count fall back to a scan of |fields|.  Both upbc and
+   * upb_msgfactory cover field numbers up to UPB_MSGLAYOUT_DENSEMAX(field_count)
+   * but any size (including 0, with dense == NULL) is valid. */
+  uint16_t dense_count;
+  const uint16_t *dense;
+  /* True for the entry message of a map field.  Fields whose submessage is a
+   * map entry hold a upb_map*, not a upb_array*. */
+  bool mapentry;
+  /* If non-NULL, upb_decode() runs this before its own field loop, and again
+   * after each field that it had to decode itself.  Generated parsers handle
+   * the singular scalar and string fields of their message, storing them at
+   * constant offsets; everything else falls through to upb_decode().  Not
+   * used when decoding with a upb_decodemask. */
+  upb_msglayout_parsefunc *parse;
+  /* The hasbits of the required fields, as a mask over the first
+   * |required_size| bytes of the message (where the hasbits are).  With
+   * UPB_DECODE_CHECKREQUIRED, upb_decode() compares these bytes as each
+   * message ends instead of walking the message tree afterwards.  Both are
+   * 0 for a message without required fields. */
+  uint16_t required_size;
+  const uint8_t *required;
 } upb_msglayout;
 
+#define UPB_MSGLAYOUT_DENSEMAX(field_count) UPB_MAX(64, (field_count) * 4)
+
+
+/** upb_msglayout_ext *********************************************************/
+
+/* An extension: a field of |extendee| that is declared outside of it.  Like
+ * upb_msglayout, the members are public so that generated code can initialize
+ * them.  |field.offset|, |field.presence| and |field.submsg_index| are not
+ * used; |submsg| is the layout of a message or group extension's value.  The
+ * extendee's layout must have |extendable| set. */
+typedef struct {
+  const upb_msglayout *extendee;
+  upb_msglayout_field field;
+  const upb_msglayout *submsg;
+} upb_msglayout_ext;
+
+/* A upb_extreg tells upb_decode_ext() which extensions to parse.  A field of
+ * an extendable message that is neither one of its own nor a registered
+ * extension is kept as an unknown field, as usual. */
+typedef struct upb_extreg upb_extreg;
+
+/* Creates an empty registry in |a|, which it lives as long as.  Returns NULL
+ * if out of memory. */
+upb_extreg *upb_extreg_new(upb_arena *a);
+
+/* Registers the |n| extensions in |e|, which must outlive the registry.
+ * Returns false if out of memory, or if an extension has the same extendee
+ * and number as one already registered; the ones before it stay registered.
+ * A registry may be used by any number of threads at once, but not while
+ * extensions are being added to it. */
+bool upb_extreg_add(upb_extreg *r, const upb_msglayout_ext *const *e,
+                    size_t n);
+
+/* Returns the extension of |l| numbered |number|, or NULL if none is
+ * registered.  This is two hash lookups, however many extensions there are. */
+const upb_msglayout_ext *upb_extreg_get(const upb_extreg *r,
+                                        const upb_msglayout *l,
+                                        uint32_t number);
+
 
 /** upb_stringview ************************************************************/
 
@@ -154,15 +223,50 @@ upb_msg *upb_msg_new(const upb_msglayout *l, upb_arena *a);
 /* Returns the arena for the given message. */
 upb_arena *upb_msg_arena(const upb_msg *msg);
 
-void upb_msg_addunknown(upb_msg *msg, const char *data, size_t len);
+/* Unknown fields are kept as a list of spans of encoded fields, in the order
+ * they were added.  Copied fields are appended to arena chunks big enough to
+ * hold many of them, so adding small fields one at a time is cheap. */
+
+/* Copies |len| bytes of encoded fields to the end of |msg|'s unknown fields.
+ * Returns false if out of memory. */
+bool upb_msg_addunknown(upb_msg *msg, const char *data, size_t len);
+
+/* Like upb_msg_addunknown(), but the data is not copied: the caller must keep
+ * it alive and unmodified for as long as |msg| is in use.  Fields that
+ * directly follow the previous ones in memory extend the same span.  This is
+ * what upb_decode() does, unless given UPB_DECODE_COPYSTRINGS. */
+bool upb_msg_addunknown_alias(upb_msg *msg, const char *data, size_t len);
+
+/* Returns the unknown fields as an array of |*count| spans, to be written out
+ * one after the other. */
+const upb_stringview *upb_msg_getunknownspans(const upb_msg *msg,
+                                              size_t *count);
+
+/* Returns the total size of the unknown fields. */
+size_t upb_msg_unknownsize(const upb_msg *msg);
+
+/* Returns the unknown fields as one buffer of |*len| bytes, or NULL if there
+ * are none.  If they are in more than one span, they are first gathered into
+ * a single one in the message's arena; this is a mutation, so it is not safe
+ * concurrently with other reads of |msg|.  Returns NULL if that runs out of
+ * memory.  Prefer upb_msg_getunknownspans(), which never copies. */
 const char *upb_msg_getunknown(const upb_msg *msg, size_t *len);
 
+/* Discards the encoded size of |msg| cached by UPB_ENCODE_CACHESIZE (see
+ * encode.h).  The functions here do this for any message, array or map they
+ * change, but code that writes to a message directly, like the generated
+ * setters, must call this itself before encoding |msg| with that option
+ * again. */
+void upb_msg_invalidatesize(upb_msg *msg);
+
 /* Read-only message API.  Can be safely called by anyone. */
 
 /* Returns the value associated with this field:
  *   - for scalar fields (including strings), the value directly.
  *   - return upb_msg*, or upb_map* for msg/map.
  *     If the field is unset for these field types, returns NULL.
+ *   - for a submessage left unparsed by UPB_DECODE_LAZY, parses it first
+ *     (returning NULL if it doesn't parse) and keeps the result.
  *
  * TODO(haberman): should we let users store cached array/map/msg
  * pointers here for fields that are unset?  Could be useful for the
@@ -200,7 +304,88 @@ bool upb_msg_clearfield(upb_msg *msg,
                         int field_index,
                         const upb_msglayout *l);
 
-/* TODO(haberman): copyfrom()/mergefrom()? */
+/* The extensions of an extendable message are kept apart from its fields,
+ * sorted by field number, so any one of them is found by binary search.
+ * upb_decode_ext() parses them, and upb_encode() writes them out after the
+ * fields, in order.  The functions below that copy, merge, compare or hash
+ * messages include them.  The value of a message extension left unparsed by
+ * UPB_DECODE_LAZY is parsed when it is first read, as for a field. */
+
+/* Returns whether |msg| has a value for extension |e|.  For a repeated
+ * extension, this is whether it has any elements. */
+bool upb_msg_hasext(const upb_msg *msg, const upb_msglayout_ext *e);
+
+/* Returns the value of extension |e| in |msg|, like upb_msg_get() does for a
+ * field: zero if |msg| doesn't have it, or NULL for a repeated or message
+ * extension. */
+upb_msgval upb_msg_getext(const upb_msg *msg, const upb_msglayout_ext *e);
+
+/* Sets extension |e| of |msg| to |val|, with the same caveats as
+ * upb_msg_set().  The value of a repeated extension is its upb_array.
+ * Returns false if out of memory. */
+bool upb_msg_setext(upb_msg *msg, const upb_msglayout_ext *e, upb_msgval val);
+
+/* Removes extension |e| from |msg|, if it has it. */
+void upb_msg_clearext(upb_msg *msg, const upb_msglayout_ext *e);
+
+/* Resets every field of |msg| to its initial, unset state and drops its
+ * unknown fields and extensions.  Repeated fields and maps are emptied but
+ * keep their storage, so refilling |msg| reuses it instead of allocating
+ * again.  Submessages are detached rather than cleared, since other messages
+ * may point to them too. */
+void upb_msg_clear(upb_msg *msg, const upb_msglayout *l);
+
+/* Returns a copy of |msg|, allocated from |a|, that shares no mutable state
+ * with |msg|: every submessage, repeated field and map is copied too.  String
+ * data is shared if |a| is |msg|'s own arena (the copy then lives exactly as
+ * long as the original does) and copied into |a| otherwise.  Submessages left
+ * unparsed by UPB_DECODE_LAZY stay unparsed in the copy.  Returns NULL if out
+ * of memory. */
+upb_msg *upb_msg_deepcopy(const upb_msg *msg, const upb_msglayout *l,
+                          upb_arena *a);
+
+/* Merges |src| into |dst|, which both have layout |l|, the way parsing |src|'s
+ * serialized form into |dst| would: fields set in |src| overwrite those of
+ * |dst|, except that submessages are merged recursively, repeated fields are
+ * appended to and map entries are added or replaced.  Anything that has to
+ * be copied is allocated from |dst|'s arena, and strings are shared as in
+ * upb_msg_deepcopy().  Returns false if out of memory, or if a lazy
+ * submessage of either message fails to parse; |dst| may then be partly
+ * merged. */
+bool upb_msg_merge(upb_msg *dst, const upb_msg *src, const upb_msglayout *l);
+
+/* Options for upb_msg_equal2() and upb_msg_hash2(). */
+typedef enum {
+  /* Unknown fields are left out of the comparison or hash. */
+  UPB_MSG_IGNOREUNKNOWN = 1 << 0
+} upb_msgcmpopt;
+
+/* Returns true if |a| and |b|, which both have layout |l|, hold the same
+ * fields with the same values, without serializing either.  Map entries may
+ * be in any order, and a field that was never set is the same as an empty
+ * repeated field or map.  Scalars are compared bitwise, so a NaN equals
+ * itself and 0.0 differs from -0.0.  Unknown fields must match byte for
+ * byte.  Submessages left unparsed by UPB_DECODE_LAZY are parsed as by
+ * upb_msg_get(), with the same caveat about concurrent reads; one that fails
+ * to parse equals nothing. */
+bool upb_msg_equal(const upb_msg *a, const upb_msg *b,
+                   const upb_msglayout *l);
+
+/* Like upb_msg_equal(), but with options from upb_msgcmpopt. */
+bool upb_msg_equal2(const upb_msg *a, const upb_msg *b,
+                    const upb_msglayout *l, int options);
+
+/* Returns a hash of |msg|'s contents, such that messages that upb_msg_equal()
+ * considers equal hash the same for the same |seed|.  The value depends on
+ * the platform and may change between versions of upb, so it is for
+ * in-memory tables, not for storing. */
+uint64_t upb_msg_hash(const upb_msg *msg, const upb_msglayout *l,
+                      uint64_t seed);
+
+/* Like upb_msg_hash(), but with options from upb_msgcmpopt, which should be
+ * those given to upb_msg_equal2() for the same messages. */
+uint64_t upb_msg_hash2(const upb_msg *msg, const upb_msglayout *l,
+                       uint64_t seed, int options);
 
 
 /** upb_array *****************************************************************/
@@ -241,6 +426,13 @@ upb_fieldtype_t upb_map_keytype(const upb_map *map);
 upb_fieldtype_t upb_map_valuetype(const upb_map *map);
 bool upb_map_get(const upb_map *map, upb_msgval key, upb_msgval *val);
 
+/* Looks up the |n| keys in |keys| at once.  Sets found[i] to whether keys[i]
+ * is in the map and, if it is, vals[i] to its value; returns how many were
+ * found.  For maps too big to stay in cache this is faster than |n| calls to
+ * upb_map_get(), since the cache misses of the lookups overlap. */
+size_t upb_map_getbatch(const upb_map *map, const upb_msgval *keys, size_t n,
+                        upb_msgval *vals, bool *found);
+
 /* Write interface.  May only be called by the message's owner who can enforce
  * its memory management invariants. */
 
@@ -276,6 +468,36 @@ upb_msgval upb_mapiter_value(const upb_mapiter *i);
 void upb_mapiter_setdone(upb_mapiter *i);
 bool upb_mapiter_isequal(const upb_mapiter *i1, const upb_mapiter *i2);
 
+
+/** Interfaces for generated code *********************************************/
+
+/* These back the accessors that upbc generates; they are not meant to be
+ * called directly.  |ofs| is the offset of the field within |msg|. */
+
+/* Returns the array stored at |ofs|, creating it in |a| if it is NULL.
+ * Returns NULL if out of memory. */
+UPB_INLINE upb_array *_upb_msg_mutarray(upb_msg *msg, size_t ofs,
+                                        upb_fieldtype_t type, upb_arena *a) {
+  upb_array **arr = (upb_array**)((char*)msg + ofs);
+  if (!*arr) *arr = upb_array_new(type, a);
+  return *arr;
+}
+
+/* Like _upb_msg_mutarray(), but for a map. */
+UPB_INLINE upb_map *_upb_msg_mutmap(upb_msg *msg, size_t ofs,
+                                    upb_fieldtype_t ktype,
+                                    upb_fieldtype_t vtype, upb_arena *a) {
+  upb_map **map = (upb_map**)((char*)msg + ofs);
+  if (!*map) *map = upb_map_new(ktype, vtype, a);
+  return *map;
+}
+
+/* Appends |val| to |arr|, which may be NULL (from a failed
+ * _upb_msg_mutarray()).  Returns false if out of memory. */
+UPB_INLINE bool _upb_array_append(upb_array *arr, upb_msgval val) {
+  return arr && upb_array_set(arr, upb_array_size(arr), val);
+}
+
 UPB_END_EXTERN_C
 
 #endif /* UPB_MSG_H_ */
@@ -1,6 +1,11 @@
 
 #include "upb/msgfactory.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include "upb/handlers.h"
+#include "upb/structs.int.h"
+
 static bool is_power_of_two(size_t val) {
   return (val & (val - 1)) == 0;
 }
@@ -49,18 +54,139 @@ static uint8_t upb_msg_fielddefsize(const upb_fielddef *f) {
 /** upb_msglayout *************************************************************/
 
 static void upb_msglayout_free(upb_msglayout *l) {
+  upb_gfree((void*)l->required);
+  upb_gfree((void*)l->dense);
+  upb_gfree((void*)l->fields);
+  upb_gfree((void*)l->submsgs);
   upb_gfree(l);
 }
 
-static size_t upb_msglayout_place(upb_msglayout *l, size_t size) {
+/* Builds the dense field number -> field index table for the decoder. */
+static bool upb_msglayout_initdense(upb_msglayout *l) {
+  uint32_t max = UPB_MSGLAYOUT_DENSEMAX(l->field_count);
+  uint32_t count = 0;
+  uint16_t *dense;
+  int i;
+
+  for (i = 0; i < l->field_count; i++) {
+    uint32_t number = l->fields[i].number;
+    if (number <= max && number >= count) {
+      count = number + 1;
+    }
+  }
+
+  if (count == 0) {
+    return true;
+  }
+
+  dense = upb_gmalloc(count * sizeof(*dense));
+  if (!dense) {
+    return false;
+  }
+
+  memset(dense, 0, count * sizeof(*dense));
+  for (i = 0; i < l->field_count; i++) {
+    uint32_t number = l->fields[i].number;
+    if (number < count) {
+      dense[number] = i + 1;
+    }
+  }
+
+  l->dense_count = count;
+  l->dense = dense;
+  return true;
+}
+
+/* Builds the mask of the required fields' hasbits for the decoder. */
+static bool upb_msglayout_initrequired(upb_msglayout *l) {
+  uint16_t size = 0;
+  uint8_t *required;
+  int i;
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *f = &l->fields[i];
+    if (f->label == UPB_LABEL_REQUIRED && f->presence > 0) {
+      size = UPB_MAX(size, f->presence / 8 + 1);
+    }
+  }
+
+  if (size == 0) {
+    return true;
+  }
+
+  required = upb_gmalloc(size);
+  if (!required) {
+    return false;
+  }
+
+  memset(required, 0, size);
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_field *f = &l->fields[i];
+    if (f->label == UPB_LABEL_REQUIRED && f->presence > 0) {
+      required[f->presence / 8] |= 1 << (f->presence % 8);
+    }
+  }
+
+  l->required_size = size;
+  l->required = required;
+  return true;
+}
+
+static size_t upb_msglayout_place(upb_msglayout *l, size_t size,
+                                  size_t align) {
   size_t ret;
 
-  l->size = align_up(l->size, size);
+  l->size = align_up(l->size, align);
   ret = l->size;
   l->size += size;
   return ret;
 }
 
+/* Fields are at most 8-aligned; a upb_stringview only needs its members'
+ * alignment, not its full size. */
+static size_t upb_msglayout_align(size_t size) {
+  return UPB_MIN(size, 8);
+}
+
+/* One block of storage to be placed in the message: a field outside any
+ * oneof, or the case or data of a oneof. */
+typedef struct {
+  const upb_fielddef *f;  /* For fields and oneof data. */
+  const upb_oneofdef *o;  /* For oneof case and data. */
+  bool is_case;
+  bool hot;
+  size_t size;
+  size_t order;           /* Declaration order, to keep the sort stable. */
+} upb_msglayout_item;
+
+/* Hot items first, then by decreasing alignment, which leaves no padding
+ * between items of the same group. */
+static int upb_msglayout_cmpitems(const void *_a, const void *_b) {
+  const upb_msglayout_item *a = _a;
+  const upb_msglayout_item *b = _b;
+  size_t a_align = upb_msglayout_align(a->size);
+  size_t b_align = upb_msglayout_align(b->size);
+
+  if (a->hot != b->hot) {
+    return a->hot ? -1 : 1;
+  } else if (a_align != b_align) {
+    return a_align > b_align ? -1 : 1;
+  } else {
+    return a->order < b->order ? -1 : (a->order > b->order);
+  }
+}
+
+static const upb_inttable *upb_msgfactory_hotfields(const upb_msgfactory *f,
+                                                    const upb_msgdef *m);
+static bool upb_msgfactory_isextendable(const upb_msgfactory *f,
+                                        const upb_msgdef *m);
+
+static bool upb_msglayout_ishot(const upb_inttable *hot,
+                                const upb_fielddef *f) {
+  upb_value v;
+  return hot && upb_inttable_lookup32(hot, upb_fielddef_number(f), &v);
+}
+
 static bool upb_msglayout_init(const upb_msgdef *m,
                                upb_msglayout *l,
                                upb_msgfactory *factory) {
@@ -68,8 +194,13 @@ static bool upb_msglayout_init(const upb_msgdef *m,
   upb_msg_oneof_iter oit;
   size_t hasbit;
   size_t submsg_count = 0;
+  size_t item_count = 0;
+  size_t i;
+  int pass;
   const upb_msglayout **submsgs;
   upb_msglayout_field *fields;
+  upb_msglayout_item *items;
+  const upb_inttable *hot = upb_msgfactory_hotfields(factory, m);
 
   for (upb_msg_field_begin(&it, m);
        !upb_msg_field_done(&it);
@@ -84,12 +215,17 @@ static bool upb_msglayout_init(const upb_msgdef *m,
 
   fields = upb_gmalloc(upb_msgdef_numfields(m) * sizeof(*fields));
   submsgs = upb_gmalloc(submsg_count * sizeof(*submsgs));
+  /* At most one item per field, plus a case for each oneof. */
+  items = upb_gmalloc((upb_msgdef_numfields(m) + upb_msgdef_numoneofs(m)) *
+                      sizeof(*items));
 
   if ((!fields && upb_msgdef_numfields(m)) ||
-      (!submsgs && submsg_count)) {
+      (!submsgs && submsg_count) ||
+      (!items && upb_msgdef_numfields(m))) {
     /* OOM. */
     upb_gfree(fields);
     upb_gfree(submsgs);
+    upb_gfree(items);
     return false;
   }
 
@@ -97,18 +233,19 @@ static bool upb_msglayout_init(const upb_msgdef *m,
   l->fields = fields;
   l->submsgs = submsgs;
 
-  /* Allocate data offsets in three stages:
+  /* Allocate data offsets in two stages:
    *
-   * 1. hasbits.
-   * 2. regular fields.
-   * 3. oneof fields.
+   * 1. hasbits, hot fields' first, so they share a byte where possible.
+   * 2. fields and oneofs, hot ones first, each group sorted by decreasing
+   *    alignment so that the only padding is at the end of a group.
    *
-   * OPT: There is a lot of room for optimization here to minimize the size.
-   */
+   * Declaration order would leave a hole before every field that is more
+   * aligned than the one before it, and would spread the hot fields over the
+   * whole message. */
 
   /* Allocate hasbits and set basic field attributes. */
   submsg_count = 0;
-  for (upb_msg_field_begin(&it, m), hasbit = 0;
+  for (upb_msg_field_begin(&it, m);
        !upb_msg_field_done(&it);
        upb_msg_field_next(&it)) {
     const upb_fielddef* f = upb_msg_iter_field(&it);
@@ -117,6 +254,7 @@ static bool upb_msglayout_init(const upb_msgdef *m,
     field->number = upb_fielddef_number(f);
     field->descriptortype = upb_fielddef_descriptortype(f);
     field->label = upb_fielddef_label(f);
+    field->presence = 0;
 
     if (upb_fielddef_issubmsg(f)) {
       const upb_msglayout *sub_layout =
@@ -124,70 +262,116 @@ static bool upb_msglayout_init(const upb_msgdef *m,
       field->submsg_index = submsg_count++;
       submsgs[field->submsg_index] = sub_layout;
     }
+  }
 
-    if (upb_fielddef_haspresence(f) && !upb_fielddef_containingoneof(f)) {
-      field->presence = (hasbit++);
-    } else {
-      field->presence = 0;
+  /* Bit 0 is not used: a presence of 0 means the field has no hasbit. */
+  for (pass = 0, hasbit = 1; pass < 2; pass++) {
+    for (upb_msg_field_begin(&it, m);
+         !upb_msg_field_done(&it);
+         upb_msg_field_next(&it)) {
+      const upb_fielddef* f = upb_msg_iter_field(&it);
+      if (upb_fielddef_haspresence(f) && !upb_fielddef_containingoneof(f) &&
+          upb_msglayout_ishot(hot, f) == (pass == 0)) {
+        fields[upb_fielddef_index(f)].presence = (hasbit++);
+      }
     }
   }
 
   /* Account for space used by hasbits. */
-  l->size = div_round_up(hasbit, 8);
+  l->size = hasbit > 1 ? div_round_up(hasbit, 8) : 0;
 
-  /* Allocate non-oneof fields. */
+  /* Collect non-oneof fields. */
   for (upb_msg_field_begin(&it, m); !upb_msg_field_done(&it);
        upb_msg_field_next(&it)) {
     const upb_fielddef* f = upb_msg_iter_field(&it);
-    size_t field_size = upb_msg_fielddefsize(f);
-    size_t index = upb_fielddef_index(f);
+    upb_msglayout_item *item = &items[item_count];
 
     if (upb_fielddef_containingoneof(f)) {
       /* Oneofs are handled separately below. */
       continue;
     }
 
-    fields[index].offset = upb_msglayout_place(l, field_size);
+    item->f = f;
+    item->o = NULL;
+    item->is_case = false;
+    item->hot = upb_msglayout_ishot(hot, f);
+    item->size = upb_msg_fielddefsize(f);
+    item->order = item_count++;
   }
 
-  /* Allocate oneof fields.  Each oneof field consists of a uint32 for the case
-   * and space for the actual data. */
+  /* Collect oneofs.  Each oneof consists of a uint32 for the case and space
+   * for the actual data, which are placed independently.  A oneof is hot if
+   * any of its fields is. */
   for (upb_msg_oneof_begin(&oit, m); !upb_msg_oneof_done(&oit);
        upb_msg_oneof_next(&oit)) {
     const upb_oneofdef* o = upb_msg_iter_oneof(&oit);
+    upb_msglayout_item *item = &items[item_count];
     upb_oneof_iter fit;
 
-    size_t case_size = sizeof(uint32_t);  /* Could potentially optimize this. */
-    size_t field_size = 0;
-    uint32_t case_offset;
-    uint32_t data_offset;
+    item->f = NULL;
+    item->o = o;
+    item->is_case = false;
+    item->hot = false;
+    item->size = 0;
 
     /* Calculate field size: the max of all field sizes. */
     for (upb_oneof_begin(&fit, o);
          !upb_oneof_done(&fit);
          upb_oneof_next(&fit)) {
       const upb_fielddef* f = upb_oneof_iter_field(&fit);
-      field_size = UPB_MAX(field_size, upb_msg_fielddefsize(f));
+      item->size = UPB_MAX(item->size, upb_msg_fielddefsize(f));
+      item->hot = item->hot || upb_msglayout_ishot(hot, f);
     }
 
-    /* Align and allocate case offset. */
-    case_offset = upb_msglayout_place(l, case_size);
-    data_offset = upb_msglayout_place(l, field_size);
+    if (item->size == 0) {
+      /* Empty oneof: nothing to place. */
+      continue;
+    }
 
-    for (upb_oneof_begin(&fit, o);
+    item->order = item_count++;
+
+    items[item_count] = *item;
+    items[item_count].is_case = true;
+    /* Could potentially optimize the size of the case. */
+    items[item_count].size = sizeof(uint32_t);
+    items[item_count].order = item_count;
+    item_count++;
+  }
+
+  qsort(items, item_count, sizeof(*items), upb_msglayout_cmpitems);
+
+  for (i = 0; i < item_count; i++) {
+    const upb_msglayout_item *item = &items[i];
+    size_t offset = upb_msglayout_place(l, item->size,
+                                        upb_msglayout_align(item->size));
+    upb_oneof_iter fit;
+
+    if (item->f) {
+      fields[upb_fielddef_index(item->f)].offset = offset;
+      continue;
+    }
+
+    for (upb_oneof_begin(&fit, item->o);
          !upb_oneof_done(&fit);
          upb_oneof_next(&fit)) {
       const upb_fielddef* f = upb_oneof_iter_field(&fit);
-      fields[upb_fielddef_index(f)].offset = data_offset;
-      fields[upb_fielddef_index(f)].presence = ~case_offset;
+      if (item->is_case) {
+        fields[upb_fielddef_index(f)].presence = ~offset;
+      } else {
+        fields[upb_fielddef_index(f)].offset = offset;
+      }
     }
   }
 
+  upb_gfree(items);
+
   /* Size of the entire structure should be a multiple of its greatest
    * alignment.  TODO: track overall alignment for real? */
   l->size = align_up(l->size, 8);
+  l->mapentry = upb_msgdef_mapentry(m);
+  l->extendable = upb_msgfactory_isextendable(factory, m);
 
-  return true;
+  return upb_msglayout_initrequired(l) && upb_msglayout_initdense(l);
 }
 
 
@@ -196,35 +380,72 @@ static bool upb_msglayout_init(const upb_msgdef *m,
 struct upb_msgfactory {
   const upb_symtab *symtab;  /* We own a ref. */
   upb_inttable layouts;
+  upb_inttable nametables;
   upb_inttable mergehandlers;
+  upb_inttable hotfields;  /* upb_msgdef* -> upb_inttable* of field numbers. */
+  upb_inttable extendable;  /* upb_msgdef* -> true. */
+  upb_strtable anytypes;  /* Type URL -> upb_msgfactory_anytype*. */
 };
 
+typedef struct {
+  const upb_msgdef *m;
+  const upb_msglayout *l;
+} upb_msgfactory_anytype;
+
 upb_msgfactory *upb_msgfactory_new(const upb_symtab *symtab) {
   upb_msgfactory *ret = upb_gmalloc(sizeof(*ret));
 
   ret->symtab = symtab;
   upb_inttable_init(&ret->layouts, UPB_CTYPE_PTR);
+  upb_inttable_init(&ret->nametables, UPB_CTYPE_PTR);
   upb_inttable_init(&ret->mergehandlers, UPB_CTYPE_CONSTPTR);
+  upb_inttable_init(&ret->hotfields, UPB_CTYPE_PTR);
+  upb_inttable_init(&ret->extendable, UPB_CTYPE_BOOL);
+  upb_strtable_init(&ret->anytypes, UPB_CTYPE_PTR);
 
   return ret;
 }
 
 void upb_msgfactory_free(upb_msgfactory *f) {
   upb_inttable_iter i;
+  upb_strtable_iter si;
   upb_inttable_begin(&i, &f->layouts);
   for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
     upb_msglayout *l = upb_value_getptr(upb_inttable_iter_value(&i));
     upb_msglayout_free(l);
   }
 
+  upb_inttable_begin(&i, &f->nametables);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_strtable *t = upb_value_getptr(upb_inttable_iter_value(&i));
+    upb_strtable_uninit(t);
+    upb_gfree(t);
+  }
+
   upb_inttable_begin(&i, &f->mergehandlers);
   for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
     const upb_handlers *h = upb_value_getconstptr(upb_inttable_iter_value(&i));
     upb_handlers_unref(h, f);
   }
 
+  upb_inttable_begin(&i, &f->hotfields);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_inttable *t = upb_value_getptr(upb_inttable_iter_value(&i));
+    upb_inttable_uninit(t);
+    upb_gfree(t);
+  }
+
+  upb_strtable_begin(&si, &f->anytypes);
+  for(; !upb_strtable_done(&si); upb_strtable_next(&si)) {
+    upb_gfree(upb_value_getptr(upb_strtable_iter_value(&si)));
+  }
+
   upb_inttable_uninit(&f->layouts);
+  upb_inttable_uninit(&f->nametables);
   upb_inttable_uninit(&f->mergehandlers);
+  upb_inttable_uninit(&f->hotfields);
+  upb_inttable_uninit(&f->extendable);
+  upb_strtable_uninit(&f->anytypes);
   upb_gfree(f);
 }
 
@@ -232,11 +453,81 @@ const upb_symtab *upb_msgfactory_symtab(const upb_msgfactory *f) {
   return f->symtab;
 }
 
+bool upb_msgfactory_sethotfields(upb_msgfactory *f, const upb_msgdef *m,
+                                 const uint32_t *numbers, size_t n) {
+  upb_value v;
+  upb_inttable *t;
+  size_t i;
+  UPB_ASSERT(upb_symtab_lookupmsg(f->symtab, upb_msgdef_fullname(m)) == m);
+
+  if (upb_inttable_lookupptr(&f->layouts, m, &v)) {
+    /* Too late: the layout is already in use. */
+    return false;
+  }
+
+  t = upb_gmalloc(sizeof(*t));
+  if (!t || !upb_inttable_init(t, UPB_CTYPE_BOOL)) {
+    upb_gfree(t);
+    return false;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (!upb_inttable_lookup32(t, numbers[i], &v) &&
+        !upb_inttable_insert(t, numbers[i], upb_value_bool(true))) {
+      goto err;
+    }
+  }
+
+  if (upb_inttable_removeptr(&f->hotfields, m, &v)) {
+    upb_inttable *old = upb_value_getptr(v);
+    upb_inttable_uninit(old);
+    upb_gfree(old);
+  }
+
+  if (!upb_inttable_insertptr(&f->hotfields, m, upb_value_ptr(t))) {
+    goto err;
+  }
+
+  return true;
+
+err:
+  upb_inttable_uninit(t);
+  upb_gfree(t);
+  return false;
+}
+
+bool upb_msgfactory_setextendable(upb_msgfactory *f, const upb_msgdef *m) {
+  upb_value v;
+  UPB_ASSERT(upb_symtab_lookupmsg(f->symtab, upb_msgdef_fullname(m)) == m);
+
+  if (upb_inttable_lookupptr(&f->layouts, m, &v)) {
+    /* Too late: the layout is already in use. */
+    return false;
+  }
+
+  return upb_inttable_lookupptr(&f->extendable, m, &v) ||
+         upb_inttable_insertptr(&f->extendable, m, upb_value_bool(true));
+}
+
+static bool upb_msgfactory_isextendable(const upb_msgfactory *f,
+                                        const upb_msgdef *m) {
+  upb_value v;
+  return upb_inttable_lookupptr(&f->extendable, m, &v);
+}
+
+static const upb_inttable *upb_msgfactory_hotfields(const upb_msgfactory *f,
+                                                    const upb_msgdef *m) {
+  upb_value v;
+  if (upb_inttable_lookupptr(&f->hotfields, m, &v)) {
+    return upb_value_getptr(v);
+  }
+  return NULL;
+}
+
 const upb_msglayout *upb_msgfactory_getlayout(upb_msgfactory *f,
                                               const upb_msgdef *m) {
   upb_value v;
   UPB_ASSERT(upb_symtab_lookupmsg(f->symtab, upb_msgdef_fullname(m)) == m);
-  UPB_ASSERT(!upb_msgdef_mapentry(m));
 
   if (upb_inttable_lookupptr(&f->layouts, m, &v)) {
     UPB_ASSERT(upb_value_getptr(v));
@@ -253,3 +544,659 @@ const upb_msglayout *upb_msgfactory_getlayout(upb_msgfactory *f,
     return l;
   }
 }
+
+static bool upb_msgfactory_initnametable(upb_strtable *t,
+                                         const upb_msgdef *m) {
+  upb_msg_field_iter i;
+  /* Field names have no length limit, so this may need to grow. */
+  char *buf = NULL;
+  size_t len = 0;
+  bool ok = true;
+
+  for (upb_msg_field_begin(&i, m); ok && !upb_msg_field_done(&i);
+       upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    size_t field_len = upb_fielddef_getjsonname(f, buf, len);
+
+    if (field_len > len) {
+      char *new_buf = upb_grealloc(buf, len, field_len);
+      if (!new_buf) {
+        ok = false;
+        break;
+      }
+      buf = new_buf;
+      len = field_len;
+      upb_fielddef_getjsonname(f, buf, len);
+    }
+
+    ok = upb_strtable_insert(t, buf, upb_value_constptr(f));
+
+    if (ok && strcmp(buf, upb_fielddef_name(f)) != 0) {
+      ok = upb_strtable_insert(t, upb_fielddef_name(f), upb_value_constptr(f));
+    }
+  }
+
+  upb_gfree(buf);
+  return ok;
+}
+
+const upb_strtable *upb_msgfactory_getnametable(upb_msgfactory *f,
+                                                const upb_msgdef *m) {
+  upb_value v;
+  upb_strtable *t;
+  UPB_ASSERT(upb_symtab_lookupmsg(f->symtab, upb_msgdef_fullname(m)) == m);
+
+  if (upb_inttable_lookupptr(&f->nametables, m, &v)) {
+    return upb_value_getptr(v);
+  }
+
+  t = upb_gmalloc(sizeof(*t));
+  if (!t) {
+    return NULL;
+  } else if (!upb_strtable_init(t, UPB_CTYPE_CONSTPTR)) {
+    upb_gfree(t);
+    return NULL;
+  } else if (!upb_msgfactory_initnametable(t, m) ||
+             !upb_inttable_insertptr(&f->nametables, m, upb_value_ptr(t))) {
+    upb_strtable_uninit(t);
+    upb_gfree(t);
+    return NULL;
+  }
+
+  return t;
+}
+
+
+const upb_msgdef *upb_msgfactory_getanytype(upb_msgfactory *f,
+                                            const char *url, size_t len,
+                                            const upb_msglayout **l) {
+  upb_value v;
+  upb_msgfactory_anytype *ent;
+  const upb_msgdef *m;
+  const char *name = url + len;
+  char *buf;
+
+  if (upb_strtable_lookup2(&f->anytypes, url, len, &v)) {
+    ent = upb_value_getptr(v);
+    *l = ent->l;
+    return ent->m;
+  }
+
+  while (name > url && name[-1] != '/') {
+    name--;
+  }
+
+  /* upb_symtab_lookupmsg() wants a NUL-terminated name. */
+  buf = upb_gmalloc(url + len - name + 1);
+  if (!buf) {
+    return NULL;
+  }
+  memcpy(buf, name, url + len - name);
+  buf[url + len - name] = '\0';
+  m = upb_symtab_lookupmsg(f->symtab, buf);
+  upb_gfree(buf);
+
+  if (!m || !(*l = upb_msgfactory_getlayout(f, m))) {
+    return NULL;
+  }
+
+  if (upb_strtable_count(&f->anytypes) < UPB_MSGFACTORY_MAXANYTYPES &&
+      (ent = upb_gmalloc(sizeof(*ent))) != NULL) {
+    ent->m = m;
+    ent->l = *l;
+    if (!upb_strtable_insert2(&f->anytypes, url, len, upb_value_ptr(ent))) {
+      upb_gfree(ent);
+    }
+  }
+
+  return m;
+}
+
+/** upb_decodemask ************************************************************/
+
+static upb_decodemask *upb_decodemask_alloc(const upb_msglayout *l,
+                                            upb_alloc *alloc) {
+  size_t bytes = (l->field_count / 32 + 1) * sizeof(uint32_t);
+  upb_decodemask *mask = upb_malloc(alloc, sizeof(*mask));
+  if (!mask) return NULL;
+  mask->layout = l;
+  mask->fields = upb_malloc(alloc, bytes);
+  mask->submasks = NULL;
+  if (!mask->fields) return NULL;
+  memset(mask->fields, 0, bytes);
+  return mask;
+}
+
+static bool upb_decodemask_addpath(upb_decodemask *mask, const upb_msgdef *m,
+                                   const char *path, upb_alloc *alloc,
+                                   upb_status *status) {
+  while (true) {
+    const char *dot = strchr(path, '.');
+    size_t len = dot ? (size_t)(dot - path) : strlen(path);
+    const upb_fielddef *f = upb_msgdef_ntof(m, path, len);
+    const upb_msglayout *l = mask->layout;
+    int i;
+
+    if (!f) {
+      upb_status_seterrf(status, "No field '%.*s' in %s", (int)len, path,
+                         upb_msgdef_fullname(m));
+      return false;
+    }
+
+    i = upb_fielddef_index(f);
+
+    if (!dot) {
+      /* The whole field is kept, including any submessages. */
+      mask->fields[i / 32] |= 1U << (i % 32);
+      if (mask->submasks) mask->submasks[i] = NULL;
+      return true;
+    }
+
+    if (!upb_fielddef_issubmsg(f)) {
+      upb_status_seterrf(status, "Field '%.*s' in %s is not a message",
+                         (int)len, path, upb_msgdef_fullname(m));
+      return false;
+    }
+
+    if (upb_decodemask_keeps(mask, i) &&
+        (!mask->submasks || !mask->submasks[i])) {
+      return true;  /* Already kept whole. */
+    }
+
+    if (!mask->submasks) {
+      size_t bytes = l->field_count * sizeof(*mask->submasks);
+      mask->submasks = upb_malloc(alloc, bytes);
+      if (!mask->submasks) goto oom;
+      memset(mask->submasks, 0, bytes);
+    }
+
+    if (!mask->submasks[i]) {
+      const upb_msglayout *subl = l->submsgs[l->fields[i].submsg_index];
+      mask->submasks[i] = upb_decodemask_alloc(subl, alloc);
+      if (!mask->submasks[i]) goto oom;
+      mask->fields[i / 32] |= 1U << (i % 32);
+    }
+
+    mask = mask->submasks[i];
+    m = upb_fielddef_msgsubdef(f);
+    path = dot + 1;
+  }
+
+oom:
+  upb_status_seterrmsg(status, "Out of memory");
+  return false;
+}
+
+const upb_decodemask *upb_decodemask_new(const upb_msgdef *m,
+                                         upb_msgfactory *f,
+                                         const char *const *paths, size_t n,
+                                         upb_arena *a, upb_status *status) {
+  upb_alloc *alloc = upb_arena_alloc(a);
+  const upb_msglayout *l = upb_msgfactory_getlayout(f, m);
+  upb_decodemask *mask = l ? upb_decodemask_alloc(l, alloc) : NULL;
+  size_t i;
+
+  if (!mask) {
+    upb_status_seterrmsg(status, "Out of memory");
+    return NULL;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (!upb_decodemask_addpath(mask, m, paths[i], alloc, status)) {
+      return NULL;
+    }
+  }
+
+  return mask;
+}
+
+
+/** upb_msglayoutbundle *******************************************************/
+
+/* A bundle is a single 8-aligned buffer of native-endian data:
+ *
+ *   the header (struct upb_msglayoutbundle),
+ *   upb_msglayout[layout_count], sorted by message name,
+ *   bundle_entry[layout_count], one per layout,
+ *   each layout's fields, submessage slots, dense table and required mask,
+ *   8-aligned,
+ *   the message names, NUL-terminated.
+ *
+ * As serialized, the pointers in the layouts are all NULL and each
+ * submessage slot holds the index of the layout it refers to.  The entries
+ * give the offsets of every layout's arrays.  upb_msglayoutbundle_load()
+ * checks all offsets and indices first, including that every field lies
+ * inside its message, and then stores the real pointers, so loading touches
+ * only the header, the layouts and the submessage slots and allocates
+ * nothing.  The checksum only catches accidents: it is easily forged. */
+
+#define BUNDLE_MAGIC 0x6c627075  /* "upbl" */
+#define BUNDLE_LOADED 0x4c627075  /* "upbL", once loaded. */
+#define BUNDLE_VERSION 3
+
+struct upb_msglayoutbundle {
+  uint32_t magic;
+  uint32_t version;  /* BUNDLE_VERSION | sizeof(void*) << 8 */
+  uint32_t size;
+  uint32_t layout_count;
+  uint64_t checksum;  /* Of everything after the header. */
+};
+
+typedef struct {
+  uint32_t name;
+  uint32_t fields;
+  uint32_t submsgs;
+  uint32_t submsg_count;
+  uint32_t dense;
+  uint32_t required;
+} bundle_entry;
+
+static upb_msglayout *bundle_layouts(const upb_msglayoutbundle *b) {
+  return (upb_msglayout*)((char*)b + sizeof(*b));
+}
+
+static bundle_entry *bundle_entries(const upb_msglayoutbundle *b) {
+  return (bundle_entry*)(bundle_layouts(b) + b->layout_count);
+}
+
+static uint64_t bundle_checksum(const char *p, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i;
+  UPB_ASSERT(len % 8 == 0);
+  for (i = 0; i < len; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, sizeof(w));
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+  }
+  return h;
+}
+
+static int bundle_cmpmsgs(const void *_a, const void *_b) {
+  const upb_msgdef *a = *(const upb_msgdef**)_a;
+  const upb_msgdef *b = *(const upb_msgdef**)_b;
+  return strcmp(upb_msgdef_fullname(a), upb_msgdef_fullname(b));
+}
+
+/* Reserves |n| bytes at the end of the bundle and returns their offset, or 0
+ * if |n| is 0. */
+static size_t bundle_reserve(size_t *size, size_t n) {
+  size_t ret = *size;
+  if (n == 0) return 0;
+  *size = align_up(*size + n, 8);
+  return ret;
+}
+
+static size_t bundle_submsgcount(const upb_msgdef *m) {
+  upb_msg_field_iter it;
+  size_t ret = 0;
+  for (upb_msg_field_begin(&it, m); !upb_msg_field_done(&it);
+       upb_msg_field_next(&it)) {
+    if (upb_fielddef_issubmsg(upb_msg_iter_field(&it))) ret++;
+  }
+  return ret;
+}
+
+typedef struct {
+  upb_inttable index;  /* upb_msgdef* -> position in |defs|. */
+  const upb_msgdef **defs;
+  size_t count;
+  size_t size;
+} bundle_plan;
+
+static bool bundle_addmsg(bundle_plan *p, const upb_msgdef *m) {
+  if (upb_inttable_lookupptr(&p->index, m, NULL)) {
+    return true;
+  }
+
+  if (p->count == p->size) {
+    size_t newsize = UPB_MAX(p->size * 2, 8);
+    const upb_msgdef **defs = upb_grealloc(
+        p->defs, p->size * sizeof(*defs), newsize * sizeof(*defs));
+    if (!defs) return false;
+    p->defs = defs;
+    p->size = newsize;
+  }
+
+  p->defs[p->count++] = m;
+  return upb_inttable_insertptr(&p->index, m, upb_value_uint32(0));
+}
+
+/* Returns the size of the bundle for the messages in |p|, with the offsets of
+ * their arrays in |entries| if it is non-NULL. */
+static size_t bundle_plansize(upb_msgfactory *f, const bundle_plan *p,
+                              bundle_entry *entries) {
+  size_t size = align_up(sizeof(upb_msglayoutbundle) +
+                             p->count * (sizeof(upb_msglayout) +
+                                         sizeof(bundle_entry)),
+                         8);
+  size_t i;
+
+  for (i = 0; i < p->count; i++) {
+    const upb_msglayout *l = upb_msgfactory_getlayout(f, p->defs[i]);
+    size_t submsg_count = bundle_submsgcount(p->defs[i]);
+    bundle_entry e;
+
+    e.fields = bundle_reserve(&size,
+                              l->field_count * sizeof(upb_msglayout_field));
+    e.submsgs = bundle_reserve(&size, submsg_count * sizeof(void*));
+    e.submsg_count = submsg_count;
+    e.dense = bundle_reserve(&size, l->dense_count * sizeof(uint16_t));
+    e.required = bundle_reserve(&size, l->required_size);
+    e.name = bundle_reserve(&size, strlen(upb_msgdef_fullname(p->defs[i])) + 1);
+    if (entries) entries[i] = e;
+  }
+
+  return size;
+}
+
+char *upb_msgfactory_serialize(upb_msgfactory *f,
+                               const upb_msgdef *const*msgs, size_t n,
+                               upb_arena *a, size_t *size) {
+  bundle_plan p;
+  size_t total;
+  size_t i;
+  char *buf = NULL;
+  upb_msglayoutbundle *b;
+  upb_msglayout *layouts;
+  bundle_entry *entries;
+
+  p.defs = NULL;
+  p.count = 0;
+  p.size = 0;
+  if (!upb_inttable_init(&p.index, UPB_CTYPE_UINT32)) return NULL;
+
+  /* Collect |msgs| and every message they reach, then sort them by name so
+   * that upb_msglayoutbundle_lookup() can binary search. */
+  for (i = 0; i < n; i++) {
+    if (!bundle_addmsg(&p, msgs[i])) goto done;
+  }
+  for (i = 0; i < p.count; i++) {
+    upb_msg_field_iter it;
+    for (upb_msg_field_begin(&it, p.defs[i]); !upb_msg_field_done(&it);
+         upb_msg_field_next(&it)) {
+      const upb_fielddef *fd = upb_msg_iter_field(&it);
+      if (upb_fielddef_issubmsg(fd) &&
+          !bundle_addmsg(&p, upb_fielddef_msgsubdef(fd))) {
+        goto done;
+      }
+    }
+  }
+
+  qsort(p.defs, p.count, sizeof(*p.defs), bundle_cmpmsgs);
+  for (i = 0; i < p.count; i++) {
+    upb_inttable_replace(&p.index, (uintptr_t)p.defs[i], upb_value_uint32(i));
+  }
+
+  total = bundle_plansize(f, &p, NULL);
+  if (total > UINT32_MAX) goto done;
+  buf = upb_malloc(upb_arena_alloc(a), total);
+  if (!buf) goto done;
+  memset(buf, 0, total);
+
+  b = (upb_msglayoutbundle*)buf;
+  b->layout_count = p.count;
+  layouts = bundle_layouts(b);
+  entries = bundle_entries(b);
+  bundle_plansize(f, &p, entries);
+
+  for (i = 0; i < p.count; i++) {
+    const upb_msgdef *m = p.defs[i];
+    const upb_msglayout *l = upb_msgfactory_getlayout(f, m);
+    const bundle_entry *e = &entries[i];
+    const char *name = upb_msgdef_fullname(m);
+    upb_msg_field_iter it;
+
+    layouts[i].size = l->size;
+    layouts[i].field_count = l->field_count;
+    layouts[i].extendable = l->extendable;
+    layouts[i].dense_count = l->dense_count;
+    layouts[i].mapentry = l->mapentry;
+    layouts[i].required_size = l->required_size;
+
+    memcpy(buf + e->fields, l->fields,
+           l->field_count * sizeof(upb_msglayout_field));
+    memcpy(buf + e->dense, l->dense, l->dense_count * sizeof(uint16_t));
+    memcpy(buf + e->required, l->required, l->required_size);
+    memcpy(buf + e->name, name, strlen(name) + 1);
+
+    for (upb_msg_field_begin(&it, m); !upb_msg_field_done(&it);
+         upb_msg_field_next(&it)) {
+      const upb_fielddef *fd = upb_msg_iter_field(&it);
+      const upb_msglayout_field *field = &l->fields[upb_fielddef_index(fd)];
+      upb_value v;
+      uintptr_t slot;
+      bool ok;
+
+      if (!upb_fielddef_issubmsg(fd)) continue;
+      ok = upb_inttable_lookupptr(&p.index, upb_fielddef_msgsubdef(fd), &v);
+      UPB_ASSERT(ok);
+      slot = upb_value_getuint32(v);
+      memcpy(buf + e->submsgs + field->submsg_index * sizeof(void*), &slot,
+             sizeof(slot));
+    }
+  }
+
+  b->magic = BUNDLE_MAGIC;
+  b->version = BUNDLE_VERSION | sizeof(void*) << 8;
+  b->size = total;
+  b->checksum = bundle_checksum(buf + sizeof(*b), total - sizeof(*b));
+  *size = total;
+
+done:
+  upb_gfree(p.defs);
+  upb_inttable_uninit(&p.index);
+  return buf;
+}
+
+/* Checks that |count| elements of |elem_size| bytes at |ofs| lie inside the
+ * bundle, after the entries. */
+static bool bundle_checkrange(const upb_msglayoutbundle *b, uint32_t ofs,
+                              size_t count, size_t elem_size) {
+  size_t start = (char*)(bundle_entries(b) + b->layout_count) - (char*)b;
+  if (count == 0) return ofs == 0;
+  return ofs >= start && ofs % 8 == 0 && ofs <= b->size &&
+         count <= (b->size - ofs) / elem_size;
+}
+
+/* Checks that field |f| of |l| lies inside the message, with its hasbit or
+ * oneof case, so that upb_decode() and friends never write outside it. */
+static bool bundle_checkfield(const upb_msglayout *l,
+                              const upb_msglayout_field *f,
+                              const bundle_entry *e) {
+  size_t size;
+
+  if (f->descriptortype < UPB_DESCRIPTOR_TYPE_DOUBLE ||
+      f->descriptortype > UPB_DESCRIPTOR_TYPE_SINT64 ||
+      f->label < UPB_LABEL_OPTIONAL || f->label > UPB_LABEL_REPEATED) {
+    return false;
+  }
+
+  if ((f->descriptortype == UPB_DESCRIPTOR_TYPE_MESSAGE ||
+       f->descriptortype == UPB_DESCRIPTOR_TYPE_GROUP) &&
+      f->submsg_index >= e->submsg_count) {
+    return false;
+  }
+
+  size = f->label == UPB_LABEL_REPEATED
+             ? sizeof(void*)
+             : upb_msgval_sizeof2(
+                   upb_desctype_to_fieldtype[f->descriptortype]);
+  if (size > l->size || f->offset > l->size - size) return false;
+
+  if (f->presence > 0) {
+    return (size_t)f->presence / 8 < l->size;
+  } else if (f->presence < 0) {
+    size_t oneof_case = ~f->presence;
+    return l->size >= sizeof(uint32_t) &&
+           oneof_case <= l->size - sizeof(uint32_t);
+  }
+  return true;
+}
+
+/* Checks that the |count| |fields| of a map entry are a key and a value, as
+ * upb_mapentry_fields() and upb_map expect. */
+static bool bundle_checkmapentry(const upb_msglayout_field *fields,
+                                 size_t count) {
+  const upb_msglayout_field *key;
+  const upb_msglayout_field *val;
+
+  if (count != 2) return false;
+  key = &fields[fields[0].number == 1 ? 0 : 1];
+  val = &fields[fields[0].number == 1 ? 1 : 0];
+  if (key->number != 1 || val->number != 2 ||
+      key->label == UPB_LABEL_REPEATED || val->label == UPB_LABEL_REPEATED ||
+      val->descriptortype == UPB_DESCRIPTOR_TYPE_GROUP) {
+    return false;
+  }
+
+  switch (upb_desctype_to_fieldtype[key->descriptortype]) {
+    case UPB_TYPE_FLOAT:
+    case UPB_TYPE_DOUBLE:
+    case UPB_TYPE_BYTES:
+    case UPB_TYPE_MESSAGE:
+      return false;
+    default:
+      return true;
+  }
+}
+
+static bool bundle_check(const upb_msglayoutbundle *b) {
+  const upb_msglayout *layouts = bundle_layouts(b);
+  const bundle_entry *entries = bundle_entries(b);
+  const char *buf = (const char*)b;
+  const char *prev = NULL;
+  size_t i;
+  size_t j;
+
+  if (b->layout_count > (b->size - sizeof(*b)) /
+                            (sizeof(upb_msglayout) + sizeof(bundle_entry))) {
+    return false;
+  }
+
+  for (i = 0; i < b->layout_count; i++) {
+    const upb_msglayout *l = &layouts[i];
+    const bundle_entry *e = &entries[i];
+    const upb_msglayout_field *fields =
+        (const upb_msglayout_field*)(buf + e->fields);
+    const uint16_t *dense = (const uint16_t*)(buf + e->dense);
+    const char *name = buf + e->name;
+
+    if (!bundle_checkrange(b, e->fields, l->field_count, sizeof(*fields)) ||
+        !bundle_checkrange(b, e->submsgs, e->submsg_count, sizeof(void*)) ||
+        !bundle_checkrange(b, e->dense, l->dense_count, sizeof(*dense)) ||
+        !bundle_checkrange(b, e->required, l->required_size, 1) ||
+        l->required_size > l->size ||
+        !bundle_checkrange(b, e->name, 1, 1) ||
+        !memchr(name, '\0', b->size - e->name)) {
+      return false;
+    }
+
+    /* Names must be sorted for lookups, and unique. */
+    if (prev && strcmp(prev, name) >= 0) return false;
+    prev = name;
+
+    for (j = 0; j < l->field_count; j++) {
+      if (!bundle_checkfield(l, &fields[j], e)) return false;
+    }
+    if (l->mapentry && !bundle_checkmapentry(fields, l->field_count)) {
+      return false;
+    }
+
+    for (j = 0; j < e->submsg_count; j++) {
+      uintptr_t slot;
+      memcpy(&slot, buf + e->submsgs + j * sizeof(void*), sizeof(slot));
+      if (slot >= b->layout_count) return false;
+    }
+
+    for (j = 0; j < l->dense_count; j++) {
+      if (dense[j] > l->field_count) return false;
+    }
+  }
+
+  return true;
+}
+
+const upb_msglayoutbundle *upb_msglayoutbundle_load(void *buf, size_t size,
+                                                    upb_status *status) {
+  upb_msglayoutbundle *b = buf;
+  upb_msglayout *layouts;
+  const bundle_entry *entries;
+  char *p = buf;
+  size_t i;
+  size_t j;
+
+  if ((uintptr_t)buf % 8 != 0 || size < sizeof(*b)) {
+    upb_status_seterrmsg(status, "Not a layout bundle.");
+    return NULL;
+  }
+  if (b->magic == BUNDLE_LOADED) {
+    upb_status_seterrmsg(status, "Layout bundle is already loaded.");
+    return NULL;
+  }
+  if (b->magic != BUNDLE_MAGIC) {
+    upb_status_seterrmsg(status, "Not a layout bundle.");
+    return NULL;
+  }
+  if (b->version != (BUNDLE_VERSION | sizeof(void*) << 8)) {
+    upb_status_seterrmsg(status,
+                         "Layout bundle is for a different version or "
+                         "platform.");
+    return NULL;
+  }
+  if (b->size != size || size % 8 != 0 ||
+      b->checksum != bundle_checksum(p + sizeof(*b), size - sizeof(*b)) ||
+      !bundle_check(b)) {
+    upb_status_seterrmsg(status, "Layout bundle is corrupt.");
+    return NULL;
+  }
+
+  layouts = bundle_layouts(b);
+  entries = bundle_entries(b);
+  for (i = 0; i < b->layout_count; i++) {
+    upb_msglayout *l = &layouts[i];
+    const bundle_entry *e = &entries[i];
+    const upb_msglayout **submsgs = (const upb_msglayout**)(p + e->submsgs);
+
+    for (j = 0; j < e->submsg_count; j++) {
+      uintptr_t slot;
+      memcpy(&slot, &submsgs[j], sizeof(slot));
+      submsgs[j] = &layouts[slot];
+    }
+
+    l->fields = e->fields ? (const upb_msglayout_field*)(p + e->fields) : NULL;
+    l->submsgs = e->submsgs ? submsgs : NULL;
+    l->dense = e->dense ? (const uint16_t*)(p + e->dense) : NULL;
+    l->required = e->required ? (const uint8_t*)(p + e->required) : NULL;
+    l->parse = NULL;
+  }
+
+  b->magic = BUNDLE_LOADED;
+  return b;
+}
+
+size_t upb_msglayoutbundle_count(const upb_msglayoutbundle *b) {
+  return b->layout_count;
+}
+
+const upb_msglayout *upb_msglayoutbundle_lookup(const upb_msglayoutbundle *b,
+                                                const char *name) {
+  const upb_msglayout *layouts = bundle_layouts(b);
+  const bundle_entry *entries = bundle_entries(b);
+  size_t lo = 0;
+  size_t hi = b->layout_count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(name, (const char*)b + entries[mid].name);
+    if (cmp == 0) {
+      return &layouts[mid];
+    } else if (cmp < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+  return NULL;
+}
@@ -1,12 +1,21 @@
 
+#include "upb/decode.h"
 #include "upb/def.h"
 #include "upb/msg.h"
 
 #ifndef UPB_MSGFACTORY_H_
 #define UPB_MSGFACTORY_H_
 
+#ifdef __cplusplus
+namespace upb {
+class MessageFactory;
+}
+#endif
+
 UPB_DECLARE_TYPE(upb::MessageFactory, upb_msgfactory)
 
+UPB_BEGIN_EXTERN_C
+
 /** upb_msgfactory ************************************************************/
 
 /* A upb_msgfactory contains a cache of upb_msglayout, upb_handlers, and
@@ -23,11 +32,31 @@ void upb_msgfactory_free(upb_msgfactory *f);
 
 const upb_symtab *upb_msgfactory_symtab(const upb_msgfactory *f);
 
+/* Marks the fields of |m| numbered |numbers| as hot: upb_msgfactory_getlayout()
+ * will place them (and their hasbits) at the start of m's layout, so they
+ * share the first cache line.  Otherwise fields are grouped by alignment, to
+ * keep padding to a minimum.  Replaces any previous hint for |m|.  Numbers
+ * that aren't fields of |m| are ignored.
+ *
+ * Must be called before the layout for |m| is first created, or it returns
+ * false and has no effect.  Also returns false on OOM. */
+bool upb_msgfactory_sethotfields(upb_msgfactory *f, const upb_msgdef *m,
+                                 const uint32_t *numbers, size_t n);
+
+/* Makes the layout of |m| extendable, so that its messages can hold
+ * extensions (see upb_msglayout_ext).  Defs don't record extension ranges,
+ * so layouts are only extendable if asked for.  Like
+ * upb_msgfactory_sethotfields(), this must be called before the layout for
+ * |m| is first created, or it returns false and has no effect.  Also returns
+ * false on OOM. */
+bool upb_msgfactory_setextendable(upb_msgfactory *f, const upb_msgdef *m);
+
 /* The functions to get cached objects, lazily creating them on demand.  These
  * all require:
  *
  * - m is in upb_msgfactory_symtab(f)
- * - upb_msgdef_mapentry(m) == false (since map messages can't have layouts).
+ * - upb_msgdef_mapentry(m) == false for everything but getlayout(), which
+ *   also gives layouts for the entry messages of map fields.
  *
  * The returned objects will live for as long as the msgfactory does.
  *
@@ -36,5 +65,90 @@ const upb_symtab *upb_msgfactory_symtab(const upb_msgfactory *f);
 const upb_msglayout *upb_msgfactory_getlayout(upb_msgfactory *f,
                                               const upb_msgdef *m);
 
+/* Returns a table that maps both the name and the JSON name of each of m's
+ * fields to its upb_fielddef (as a constptr value), for text formats that
+ * refer to fields by name. */
+const upb_strtable *upb_msgfactory_getnametable(upb_msgfactory *f,
+                                                const upb_msgdef *m);
+
+/* Resolves |url|, the type URL of a google.protobuf.Any such as
+ * "type.googleapis.com/pkg.MyMessage", to the message in
+ * upb_msgfactory_symtab(f) named by the part after the last '/'.  Returns
+ * the msgdef and sets |*l| to its layout, or returns NULL if there is no such
+ * message (or on OOM).
+ *
+ * Results are cached by URL, up to UPB_MSGFACTORY_MAXANYTYPES of them, so
+ * resolving a URL seen before costs one hash lookup.  URLs past the limit
+ * still resolve, just without being cached. */
+#define UPB_MSGFACTORY_MAXANYTYPES 1024
+
+const upb_msgdef *upb_msgfactory_getanytype(upb_msgfactory *f,
+                                            const char *url, size_t len,
+                                            const upb_msglayout **l);
+
+/* Serializes the layouts of the |n| messages in |msgs|, and of every message
+ * they refer to, into a layout bundle allocated from |a|.  Returns the bundle
+ * and its length in |*size|, or NULL if out of memory.  The bundle can be
+ * written to a file or embedded in the program as a C array. */
+char *upb_msgfactory_serialize(upb_msgfactory *f,
+                               const upb_msgdef *const*msgs, size_t n,
+                               upb_arena *a, size_t *size);
+
+
+/** upb_decodemask ************************************************************/
+
+/* Compiles the |n| field paths in |paths| into a mask for messages of type
+ * |m|, which have the layout upb_msgfactory_getlayout(f, m).  A path is a
+ * dot-separated list of field names, like "header.route_key".  A path that
+ * ends at a submessage field keeps that whole submessage.  Paths through
+ * repeated and map fields apply to every element.
+ *
+ * The mask is allocated from |a| and may be used by any number of threads.
+ * On failure returns NULL and sets |status| (if non-NULL). */
+const upb_decodemask *upb_decodemask_new(const upb_msgdef *m,
+                                         upb_msgfactory *f,
+                                         const char *const *paths, size_t n,
+                                         upb_arena *a, upb_status *status);
+
+
+/** upb_msglayoutbundle *******************************************************/
+
+/* A layout bundle holds upb_msglayout objects for a set of messages in one
+ * flat buffer, so that a process can use upb_msg, upb_decode() and
+ * upb_encode() for those messages without loading any defs.
+ *
+ * Loading a bundle neither parses nor allocates: the layouts are used where
+ * they lie in the buffer, and only their pointers are filled in.  The buffer
+ * may be a writable private mapping of a file, e.g.
+ * mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0).  If it is
+ * loaded before forking, worker processes share its pages.
+ *
+ * A bundle is only valid for the same build of upb on the same platform. */
+typedef struct upb_msglayoutbundle upb_msglayoutbundle;
+
+/* Loads the bundle in |buf|, which must be 8-aligned and stay alive, and
+ * unmodified, for as long as its layouts are in use.  Loading stores
+ * pointers into |buf|, so a buffer can only be loaded once: loading it again
+ * fails with "Layout bundle is already loaded.", and a loaded buffer must
+ * not be saved as a bundle.  Fails, leaving |buf| untouched and setting
+ * |status|, if it is not a bundle from this build or is corrupt.
+ *
+ * Loading checks that every layout is self-consistent, with each field, its
+ * hasbit and its oneof case inside the message, so decoding with a bundle's
+ * layouts never writes outside a message.  It can't check that the layouts
+ * match the messages they are named after, so bundles should still only come
+ * from upb_msgfactory_serialize() of the right .proto files. */
+const upb_msglayoutbundle *upb_msglayoutbundle_load(void *buf, size_t size,
+                                                    upb_status *status);
+
+/* Returns the number of layouts in |b|. */
+size_t upb_msglayoutbundle_count(const upb_msglayoutbundle *b);
+
+/* Returns the layout of the message with full name |name|, or NULL if |b|
+ * has none. */
+const upb_msglayout *upb_msglayoutbundle_lookup(const upb_msglayoutbundle *b,
+                                                const char *name);
+
+UPB_END_EXTERN_C
 
 #endif /* UPB_MSGFACTORY_H_ */
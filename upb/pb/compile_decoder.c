@@ -13,6 +13,8 @@
 */
 
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include "upb/pb/decoder.int.h"
 #include "upb/pb/varint.int.h"
 
@@ -32,6 +34,7 @@ static void freegroup(upb_refcounted *r) {
   upb_pbdecoder_freejit(g);
 #endif
   upb_gfree(g->bytecode);
+  upb_gfree(g->stores);
   upb_gfree(g);
 }
 
@@ -53,6 +56,8 @@ mgroup *newgroup(const void *owner) {
   upb_inttable_init(&g->methods, UPB_CTYPE_PTR);
   g->bytecode = NULL;
   g->bytecode_end = NULL;
+  g->stores = NULL;
+  g->profile = NULL;
   return g;
 }
 
@@ -127,6 +132,93 @@ const upb_pbdecodermethod *upb_pbdecodermethod_new(
 }
 
 
+/* upb_pbcodeprofile **********************************************************/
+
+typedef struct {
+  uint64_t count;   /* Times the field was seen. */
+  uint64_t possum;  /* Sum of the positions it was seen at. */
+} fieldprofile;
+
+void upb_pbcodeprofile_init(upb_pbcodeprofile *p) {
+  upb_inttable_init(&p->msgs, UPB_CTYPE_PTR);
+}
+
+void upb_pbcodeprofile_uninit(upb_pbcodeprofile *p) {
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &p->msgs);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_inttable *fields = upb_value_getptr(upb_inttable_iter_value(&i));
+    upb_inttable_iter j;
+    upb_inttable_begin(&j, fields);
+    for(; !upb_inttable_done(&j); upb_inttable_next(&j)) {
+      upb_gfree(upb_value_getptr(upb_inttable_iter_value(&j)));
+    }
+    upb_inttable_uninit(fields);
+    upb_gfree(fields);
+  }
+  upb_inttable_uninit(&p->msgs);
+}
+
+static const fieldprofile *getfieldprofile(const upb_pbcodeprofile *p,
+                                           const upb_msgdef *m,
+                                           uint32_t fieldnum) {
+  upb_value v;
+  if (!upb_inttable_lookupptr(&p->msgs, m, &v) ||
+      !upb_inttable_lookup(upb_value_getptr(v), fieldnum, &v)) {
+    return NULL;
+  }
+  return upb_value_getptr(v);
+}
+
+uint64_t upb_pbcodeprofile_fieldcount(const upb_pbcodeprofile *p,
+                                      const upb_fielddef *f) {
+  const fieldprofile *fp = getfieldprofile(
+      p, upb_fielddef_containingtype(f), upb_fielddef_number(f));
+  return fp ? fp->count : 0;
+}
+
+/* Profiling is best-effort: if we run out of memory the field just isn't
+ * counted. */
+void upb_pbcodeprofile_record(upb_pbcodeprofile *p, const upb_msgdef *m,
+                              uint32_t fieldnum, uint32_t pos) {
+  upb_inttable *fields;
+  fieldprofile *fp;
+  upb_value v;
+
+  if (upb_inttable_lookupptr(&p->msgs, m, &v)) {
+    fields = upb_value_getptr(v);
+  } else {
+    fields = upb_gmalloc(sizeof(*fields));
+    if (!fields) return;
+    if (!upb_inttable_init(fields, UPB_CTYPE_PTR)) {
+      upb_gfree(fields);
+      return;
+    }
+    if (!upb_inttable_insertptr(&p->msgs, m, upb_value_ptr(fields))) {
+      upb_inttable_uninit(fields);
+      upb_gfree(fields);
+      return;
+    }
+  }
+
+  if (upb_inttable_lookup(fields, fieldnum, &v)) {
+    fp = upb_value_getptr(v);
+  } else {
+    fp = upb_gmalloc(sizeof(*fp));
+    if (!fp) return;
+    fp->count = 0;
+    fp->possum = 0;
+    if (!upb_inttable_insert(fields, fieldnum, upb_value_ptr(fp))) {
+      upb_gfree(fp);
+      return;
+    }
+  }
+
+  fp->count++;
+  fp->possum += pos;
+}
+
+
 /* bytecode compiler **********************************************************/
 
 /* Data used only at compilation time. */
@@ -139,14 +231,27 @@ typedef struct {
 
   /* For fields marked "lazy", parse them lazily or eagerly? */
   bool lazy;
+
+  /* Check that string fields are valid UTF-8? */
+  bool validate_utf8;
+
+  /* Send every field through OP_DISPATCH, so that it is profiled? */
+  bool profiling;
+
+  /* If non-NULL, the profile that gives the order to emit fields in. */
+  const upb_pbcodeprofile *field_order;
 } compiler;
 
-static compiler *newcompiler(mgroup *group, bool lazy) {
+static compiler *newcompiler(mgroup *group,
+                             const upb_pbdecodermethodopts *opts) {
   compiler *ret = upb_gmalloc(sizeof(*ret));
   int i;
 
   ret->group = group;
-  ret->lazy = lazy;
+  ret->lazy = opts->lazy;
+  ret->validate_utf8 = opts->validate_utf8;
+  ret->profiling = opts->profile != NULL;
+  ret->field_order = opts->field_order;
   for (i = 0; i < MAXLABEL; i++) {
     ret->fwd_labels[i] = EMPTYLABEL;
     ret->back_labels[i] = EMPTYLABEL;
@@ -166,6 +271,7 @@ static int instruction_len(uint32_t instr) {
     case OP_SETDISPATCH: return 1 + ptr_words;
     case OP_TAGN: return 3;
     case OP_SETBIGGROUPNUM: return 2;
+    case OP_PARSEARRAY: return 2;
     default: return 1;
   }
 }
@@ -309,6 +415,7 @@ static void putop(compiler *c, int op, ...) {
     case OP_ENDSUBMSG:
     case OP_STARTSTR:
     case OP_STRING:
+    case OP_STRINGUTF8:
     case OP_ENDSTR:
     case OP_PUSHTAGDELIM:
       put32(c, op | va_arg(ap, upb_selector_t) << 8);
@@ -317,6 +424,10 @@ static void putop(compiler *c, int op, ...) {
       put32(c, op);
       put32(c, va_arg(ap, int));
       break;
+    case OP_PARSEARRAY:
+      put32(c, op | va_arg(ap, upb_selector_t) << 8);
+      put32(c, va_arg(ap, int));
+      break;
     case OP_CALL: {
       const upb_pbdecodermethod *method = va_arg(ap, upb_pbdecodermethod *);
       put32(c, op | (method->code_base.ofs - (pcofs(c) + 1)) << 8);
@@ -371,7 +482,8 @@ const char *upb_pbdecoder_getopname(unsigned int op) {
     OP(ENDSUBMSG) OP(STARTSTR) OP(STRING) OP(ENDSTR) OP(CALL) OP(RET)
     OP(PUSHLENDELIM) OP(PUSHTAGDELIM) OP(SETDELIM) OP(CHECKDELIM)
     OP(BRANCH) OP(TAG1) OP(TAG2) OP(TAGN) OP(SETDISPATCH) OP(POP)
-    OP(SETBIGGROUPNUM) OP(DISPATCH) OP(HALT)
+    OP(SETBIGGROUPNUM) OP(DISPATCH) OP(HALT) OP(STRINGUTF8) OP(PARSEARRAY)
+    OP(STORE) OP(TAGPARSE) OP(STRFIELD)
   }
   return "<unknown op>";
 #undef OP
@@ -431,6 +543,7 @@ static void dumpbc(uint32_t *p, uint32_t *end, FILE *f) {
       case OP_ENDSUBMSG:
       case OP_STARTSTR:
       case OP_STRING:
+      case OP_STRINGUTF8:
       case OP_ENDSTR:
       case OP_PUSHTAGDELIM:
         fprintf(f, " %d", instr >> 8);
@@ -438,6 +551,9 @@ static void dumpbc(uint32_t *p, uint32_t *end, FILE *f) {
       case OP_SETBIGGROUPNUM:
         fprintf(f, " %d", *p++);
         break;
+      case OP_PARSEARRAY:
+        fprintf(f, " %d %s", instr >> 8, upb_pbdecoder_getopname(*p++));
+        break;
       case OP_CHECKDELIM:
       case OP_CALL:
       case OP_BRANCH:
@@ -479,6 +595,11 @@ static uint64_t get_encoded_tag(const upb_fielddef *f, int wire_type) {
 static void putchecktag(compiler *c, const upb_fielddef *f,
                         int wire_type, int dest) {
   uint64_t tag = get_encoded_tag(f, wire_type);
+  if (dest == LABEL_DISPATCH && c->profiling) {
+    /* Don't guess the next field; let dispatch() find (and count) it. */
+    putop(c, OP_DISPATCH);
+    return;
+  }
   switch (upb_value_size(tag)) {
     case 1:
       putop(c, OP_TAG1, dest, tag);
@@ -653,6 +774,9 @@ static void generate_msgfield(compiler *c, const upb_fielddef *f,
 static void generate_delimfield(compiler *c, const upb_fielddef *f,
                                 upb_pbdecodermethod *method) {
   const upb_handlers *h = upb_pbdecodermethod_desthandlers(method);
+  opcode string_op = (c->validate_utf8 &&
+                      upb_fielddef_type(f) == UPB_TYPE_STRING) ?
+                     OP_STRINGUTF8 : OP_STRING;
 
   label(c, LABEL_FIELD);
   if (upb_fielddef_isseq(f)) {
@@ -665,7 +789,7 @@ static void generate_delimfield(compiler *c, const upb_fielddef *f,
     putop(c, OP_PUSHLENDELIM);
     putop(c, OP_STARTSTR, getsel(f, UPB_HANDLER_STARTSTR));
     /* Need to emit even if no handler to skip past the string. */
-    putop(c, OP_STRING, getsel(f, UPB_HANDLER_STRING));
+    putop(c, string_op, getsel(f, UPB_HANDLER_STRING));
     putop(c, OP_POP);
     maybeput(c, OP_ENDSTR, h, f, UPB_HANDLER_ENDSTR);
     putop(c, OP_SETDELIM);
@@ -681,7 +805,7 @@ static void generate_delimfield(compiler *c, const upb_fielddef *f,
    dispatchtarget(c, method, f, UPB_WIRE_TYPE_DELIMITED);
     putop(c, OP_PUSHLENDELIM);
     putop(c, OP_STARTSTR, getsel(f, UPB_HANDLER_STARTSTR));
-    putop(c, OP_STRING, getsel(f, UPB_HANDLER_STRING));
+    putop(c, string_op, getsel(f, UPB_HANDLER_STRING));
     putop(c, OP_POP);
     maybeput(c, OP_ENDSTR, h, f, UPB_HANDLER_ENDSTR);
     putop(c, OP_SETDELIM);
@@ -713,13 +837,24 @@ static void generate_primitivefield(compiler *c, const upb_fielddef *f,
   sel = getsel(f, upb_handlers_getprimitivehandlertype(f));
   wire_type = upb_pb_native_wire_types[upb_fielddef_descriptortype(f)];
   if (upb_fielddef_isseq(f)) {
+    /* A packed run goes to the array handler, if there is one, a chunk at a
+     * time.  Non-packed values come one per tag, so they always go through
+     * the single-value handler, which calls the array handler if it has
+     * nothing else to do. */
+    upb_selector_t arraysel = getsel(
+        f, upb_handlers_getprimitivehandlertype(f) - UPB_HANDLER_INT32 +
+               UPB_HANDLER_INT32ARRAY);
     putop(c, OP_CHECKDELIM, LABEL_ENDMSG);
     putchecktag(c, f, UPB_WIRE_TYPE_DELIMITED, LABEL_DISPATCH);
    dispatchtarget(c, method, f, UPB_WIRE_TYPE_DELIMITED);
     putop(c, OP_PUSHLENDELIM);
     putop(c, OP_STARTSEQ, getsel(f, UPB_HANDLER_STARTSEQ));  /* Packed */
    label(c, LABEL_LOOPSTART);
-    putop(c, parse_type, sel);
+    if (upb_handlers_gethandler(h, arraysel)) {
+      putop(c, OP_PARSEARRAY, arraysel, parse_type);
+    } else {
+      putop(c, parse_type, sel);
+    }
     putop(c, OP_CHECKDELIM, LABEL_LOOPBREAK);
     putop(c, OP_BRANCH, -LABEL_LOOPSTART);
    dispatchtarget(c, method, f, wire_type);
@@ -742,12 +877,73 @@ static void generate_primitivefield(compiler *c, const upb_fielddef *f,
   }
 }
 
+static void generate_field(compiler *c, const upb_fielddef *f,
+                           upb_pbdecodermethod *method) {
+  const upb_handlers *h = upb_pbdecodermethod_desthandlers(method);
+  upb_fieldtype_t type = upb_fielddef_type(f);
+
+  if (type == UPB_TYPE_MESSAGE && !(haslazyhandlers(h, f) && c->lazy)) {
+    generate_msgfield(c, f, method);
+  } else if (type == UPB_TYPE_STRING || type == UPB_TYPE_BYTES ||
+             type == UPB_TYPE_MESSAGE) {
+    generate_delimfield(c, f, method);
+  } else {
+    generate_primitivefield(c, f, method);
+  }
+}
+
+typedef struct {
+  const upb_fielddef *f;
+  size_t index;  /* Position in field number order, to break ties. */
+  bool seen;
+  double pos;    /* Mean position in the message, if seen. */
+} orderedfield;
+
+static int cmp_orderedfield(const void *_a, const void *_b) {
+  const orderedfield *a = _a;
+  const orderedfield *b = _b;
+  if (a->seen != b->seen) return a->seen ? -1 : 1;
+  if (a->seen && a->pos != b->pos) return a->pos < b->pos ? -1 : 1;
+  return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+/* Returns the fields of |md| in the order c->field_order saw them in, with
+ * fields it never saw last.  The caller must free the array.  Returns NULL if
+ * out of memory. */
+static orderedfield *orderfields(const compiler *c, const upb_msgdef *md,
+                                 size_t *n) {
+  orderedfield *fields;
+  upb_msg_field_iter i;
+  size_t j = 0;
+
+  *n = upb_msgdef_numfields(md);
+  fields = upb_gmalloc(UPB_MAX(*n, 1) * sizeof(*fields));
+  if (!fields) return NULL;
+
+  for(upb_msg_field_begin(&i, md);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i), j++) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    const fieldprofile *fp =
+        getfieldprofile(c->field_order, md, upb_fielddef_number(f));
+    fields[j].f = f;
+    fields[j].index = j;
+    fields[j].seen = fp != NULL;
+    fields[j].pos = fp ? (double)fp->possum / fp->count : 0;
+  }
+
+  qsort(fields, *n, sizeof(*fields), cmp_orderedfield);
+  return fields;
+}
+
 /* Adds bytecode for parsing the given message to the given decoderplan,
  * while adding all dispatch targets to this message's dispatch table. */
 static void compile_method(compiler *c, upb_pbdecodermethod *method) {
   const upb_handlers *h;
   const upb_msgdef *md;
   uint32_t* start_pc;
+  orderedfield *fields;
+  size_t n;
   upb_msg_field_iter i;
   upb_value val;
 
@@ -765,19 +961,17 @@ static void compile_method(compiler *c, upb_pbdecodermethod *method) {
   putsel(c, OP_STARTMSG, UPB_STARTMSG_SELECTOR, h);
  label(c, LABEL_FIELD);
   start_pc = c->pc;
-  for(upb_msg_field_begin(&i, md);
-      !upb_msg_field_done(&i);
-      upb_msg_field_next(&i)) {
-    const upb_fielddef *f = upb_msg_iter_field(&i);
-    upb_fieldtype_t type = upb_fielddef_type(f);
-
-    if (type == UPB_TYPE_MESSAGE && !(haslazyhandlers(h, f) && c->lazy)) {
-      generate_msgfield(c, f, method);
-    } else if (type == UPB_TYPE_STRING || type == UPB_TYPE_BYTES ||
-               type == UPB_TYPE_MESSAGE) {
-      generate_delimfield(c, f, method);
-    } else {
-      generate_primitivefield(c, f, method);
+  if (c->field_order && (fields = orderfields(c, md, &n)) != NULL) {
+    size_t j;
+    for (j = 0; j < n; j++) {
+      generate_field(c, fields[j].f, method);
+    }
+    upb_gfree(fields);
+  } else {
+    for(upb_msg_field_begin(&i, md);
+        !upb_msg_field_done(&i);
+        upb_msg_field_next(&i)) {
+      generate_field(c, upb_msg_iter_field(&i), method);
     }
   }
 
@@ -850,8 +1044,134 @@ static void compile_methods(compiler *c) {
   }
 }
 
+static bool isparseop(uint32_t op) {
+  switch (op) {
+    case OP_PARSE_DOUBLE:
+    case OP_PARSE_FLOAT:
+    case OP_PARSE_INT64:
+    case OP_PARSE_UINT64:
+    case OP_PARSE_INT32:
+    case OP_PARSE_FIXED64:
+    case OP_PARSE_FIXED32:
+    case OP_PARSE_BOOL:
+    case OP_PARSE_UINT32:
+    case OP_PARSE_SFIXED32:
+    case OP_PARSE_SFIXED64:
+    case OP_PARSE_SINT32:
+    case OP_PARSE_SINT64:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static int cmp_codebase(const void *a, const void *b) {
+  uint32_t ofs_a = (*(upb_pbdecodermethod *const*)a)->code_base.ofs;
+  uint32_t ofs_b = (*(upb_pbdecodermethod *const*)b)->code_base.ofs;
+  return ofs_a < ofs_b ? -1 : ofs_a > ofs_b;
+}
+
+/* Rewrites each OP_PARSE_* whose handler is a plain store (see
+ * upb_msg_getscalarhandlerdata()) into an OP_STORE.  Each method's code is
+ * contiguous, so its code runs from its own base to the next method's.  The
+ * JIT already specializes these handlers itself, so this is only done for the
+ * interpreter.  It is purely an optimization: if we run out of memory the
+ * bytecode is left as it was. */
+static void specialize_stores(mgroup *g) {
+  size_t n = upb_inttable_count(&g->methods);
+  upb_pbdecodermethod **methods;
+  upb_inttable_iter iter;
+  uint32_t *pc;
+  size_t max = 0;
+  size_t count = 0;
+  size_t i;
+
+  for (pc = g->bytecode; pc < g->bytecode_end; pc += instruction_len(*pc)) {
+    if (isparseop(getop(*pc))) max++;
+  }
+  if (max == 0) return;
+
+  methods = upb_gmalloc(n * sizeof(*methods));
+  g->stores = upb_gmalloc(max * sizeof(*g->stores));
+  if (!methods || !g->stores) {
+    upb_gfree(methods);
+    upb_gfree(g->stores);
+    g->stores = NULL;
+    return;
+  }
+
+  i = 0;
+  upb_inttable_begin(&iter, &g->methods);
+  for(; !upb_inttable_done(&iter); upb_inttable_next(&iter)) {
+    methods[i++] = upb_value_getptr(upb_inttable_iter_value(&iter));
+  }
+  qsort(methods, n, sizeof(*methods), cmp_codebase);
+
+  for (i = 0; i < n; i++) {
+    const upb_handlers *h = methods[i]->dest_handlers_;
+    uint32_t *end = i + 1 < n ? g->bytecode + methods[i + 1]->code_base.ofs
+                              : g->bytecode_end;
+    pc = g->bytecode + methods[i]->code_base.ofs;
+    for (; pc < end; pc += instruction_len(*pc)) {
+      upb_selector_t sel = *pc >> 8;
+      upb_pbdecoder_store *st = &g->stores[count];
+      upb_fieldtype_t type;
+      size_t offset;
+      int32_t hasbit;
+
+      /* The index has to fit in the 24-bit arg. */
+      if (!isparseop(getop(*pc)) || count >= (1 << 24) ||
+          !upb_msg_getscalarhandlerdata(h, sel, &type, &offset, &hasbit) ||
+          offset > UINT32_MAX) {
+        continue;
+      }
+
+      st->offset = offset;
+      st->hasbyte = hasbit > 0 ? hasbit / 8 : 0;
+      st->hasmask = hasbit > 0 ? 1 << (hasbit % 8) : 0;
+      st->parse_type = getop(*pc);
+      st->sel = sel;
+      *pc = OP_STORE | count++ << 8;
+    }
+  }
+
+  upb_gfree(methods);
+}
+
+static bool isvalueop(uint32_t instr) {
+  return isparseop(getop(instr)) || getop(instr) == OP_STORE;
+}
+
+static bool isstringop(uint32_t instr) {
+  return getop(instr) == OP_STRING || getop(instr) == OP_STRINGUTF8;
+}
+
+/* Fuses the sequences of ops that make up most fields into the
+ * superinstructions OP_TAGPARSE and OP_STRFIELD (see decoder.int.h), by
+ * rewriting the opcode of the first op of each.  Runs after
+ * specialize_stores(), so that OP_STOREs are fused too.  Like it, this is only
+ * done for the interpreter. */
+static void specialize_superinstructions(mgroup *g) {
+  uint32_t *pc;
+
+  for (pc = g->bytecode; pc + 2 < g->bytecode_end;
+       pc += instruction_len(*pc)) {
+    if (getop(pc[0]) == OP_TAG1 && isvalueop(pc[1]) &&
+        getop(pc[2]) == OP_CHECKDELIM) {
+      pc[0] = (pc[0] & ~0xffU) | OP_TAGPARSE;
+    } else if (getop(pc[0]) == OP_STARTSTR && isstringop(pc[1]) &&
+               getop(pc[2]) == OP_POP) {
+      pc[0] = (pc[0] & ~0xffU) | OP_STRFIELD;
+    }
+  }
+}
+
 static void set_bytecode_handlers(mgroup *g) {
   upb_inttable_iter i;
+
+  specialize_stores(g);
+  specialize_superinstructions(g);
+
   upb_inttable_begin(&i, &g->methods);
   for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
     upb_pbdecodermethod *m = upb_value_getptr(upb_inttable_iter_value(&i));
@@ -870,9 +1190,19 @@ static void set_bytecode_handlers(mgroup *g) {
 
 #ifdef UPB_USE_JIT_X64
 
+/* The JIT has no counterpart to OP_PARSEARRAY, so groups that use array
+ * handlers stay in bytecode. */
+static bool hasarrayops(const mgroup *g) {
+  const uint32_t *pc;
+  for (pc = g->bytecode; pc < g->bytecode_end; pc += instruction_len(*pc)) {
+    if (getop(*pc) == OP_PARSEARRAY) return true;
+  }
+  return false;
+}
+
 static void sethandlers(mgroup *g, bool allowjit) {
   g->jit_code = NULL;
-  if (allowjit) {
+  if (allowjit && !hasarrayops(g)) {
     /* Compile byte-code into machine code, create handlers. */
     upb_pbdecoder_jit(g);
   } else {
@@ -891,19 +1221,33 @@ static void sethandlers(mgroup *g, bool allowjit) {
 #endif  /* UPB_USE_JIT_X64 */
 
 
+/* Sets the input handlers of a group whose bytecode is complete, and freezes
+ * it.  Nothing changes the group after this.  Freezing it makes refs on the
+ * group and its methods thread-safe, so the methods can be shared between
+ * threads. */
+static void freezegroup(mgroup *g, bool allowjit) {
+  upb_refcounted *r = mgroup_upcast_mutable(g);
+  bool ok;
+
+  sethandlers(g, allowjit);
+  ok = upb_refcounted_freeze(&r, 1, NULL, UPB_MAX_HANDLER_DEPTH);
+  UPB_ASSERT(ok);
+}
+
 /* TODO(haberman): allow this to be constructed for an arbitrary set of dest
  * handlers and other mgroups (but verify we have a transitive closure). */
-const mgroup *mgroup_new(const upb_handlers *dest, bool allowjit, bool lazy,
+const mgroup *mgroup_new(const upb_pbdecodermethodopts *opts, bool allowjit,
                          const void *owner) {
   mgroup *g;
   compiler *c;
 
   UPB_UNUSED(allowjit);
-  UPB_ASSERT(upb_handlers_isfrozen(dest));
+  UPB_ASSERT(upb_handlers_isfrozen(opts->handlers));
 
   g = newgroup(owner);
-  c = newcompiler(g, lazy);
-  find_methods(c, dest);
+  g->profile = opts->profile;
+  c = newcompiler(g, opts);
+  find_methods(c, opts->handlers);
 
   /* We compile in two passes:
    * 1. all messages are assigned relative offsets from the beginning of the
@@ -932,34 +1276,130 @@ const mgroup *mgroup_new(const upb_handlers *dest, bool allowjit, bool lazy,
   }
 #endif
 
-  sethandlers(g, allowjit);
+  freezegroup(g, allowjit);
   return g;
 }
 
 
 /* upb_pbcodecache ************************************************************/
 
+/* The cache is a list of compiled mgroups, newest first.  Entries are only
+ * ever prepended, and neither an entry nor its (frozen) mgroup changes once it
+ * is published, so lookups walk the list without taking the lock.  The lock
+ * is only held to compile and publish a new entry, which ensures that each
+ * entry is compiled once even if many threads miss on it at the same time. */
+typedef struct cacheentry {
+  const mgroup *group;
+  upb_pbdecodermethodopts opts;  /* The handlers are only the first ones. */
+  struct cacheentry *next;
+} cacheentry;
+
+#ifdef UPB_THREAD_UNSAFE /*---------------------------------------------------*/
+
+static void *cache_head(void *const*head) { return *head; }
+static void cache_publish(void **head, void *e) { *head = e; }
+static void cache_lock(int *lock) { UPB_UNUSED(lock); }
+static void cache_unlock(int *lock) { UPB_UNUSED(lock); }
+
+#elif defined(__GNUC__) || defined(__clang__) /*------------------------------*/
+
+static void *cache_head(void *const*head) {
+  void *ret = *(void *const volatile *)head;
+  __sync_synchronize();  /* Don't read the entry before it is published. */
+  return ret;
+}
+
+static void cache_publish(void **head, void *e) {
+  /* Only called with the lock held, so the swap always succeeds.  It is a full
+   * barrier, so the entry is complete before it becomes visible. */
+  bool ok = __sync_bool_compare_and_swap(head, *head, e);
+  UPB_ASSERT(ok);
+}
+
+static void cache_lock(int *lock) {
+  while (__sync_lock_test_and_set(lock, 1)) {
+    while (*(volatile int *)lock) {}
+  }
+}
+
+static void cache_unlock(int *lock) { __sync_lock_release(lock); }
+
+#elif defined(WIN32) /*-------------------------------------------------------*/
+
+#include <Windows.h>
+
+static void *cache_head(void *const*head) {
+  void *ret = *(void *const volatile *)head;
+  MemoryBarrier();
+  return ret;
+}
+
+static void cache_publish(void **head, void *e) {
+  InterlockedExchangePointer(head, e);
+}
+
+static void cache_lock(int *lock) {
+  while (InterlockedExchange((volatile LONG *)lock, 1)) {
+    while (*(volatile int *)lock) {}
+  }
+}
+
+static void cache_unlock(int *lock) {
+  InterlockedExchange((volatile LONG *)lock, 0);
+}
+
+#else
+#error Atomic primitives not defined for your platform/CPU.  \
+       Implement them or compile with UPB_THREAD_UNSAFE.
+#endif
+
+/* Returns the method for |opts| if a group in the entries from |e| up to (but
+ * not including) |end| has one, otherwise NULL. */
+static const upb_pbdecodermethod *cache_find(
+    const cacheentry *e, const cacheentry *end,
+    const upb_pbdecodermethodopts *opts) {
+  for (; e != end; e = e->next) {
+    upb_value v;
+    if (e->opts.lazy == opts->lazy &&
+        e->opts.validate_utf8 == opts->validate_utf8 &&
+        e->opts.profile == opts->profile &&
+        e->opts.field_order == opts->field_order &&
+        upb_inttable_lookupptr(&e->group->methods, opts->handlers, &v)) {
+      return upb_value_getptr(v);
+    }
+  }
+  return NULL;
+}
+
 void upb_pbcodecache_init(upb_pbcodecache *c) {
-  upb_inttable_init(&c->groups, UPB_CTYPE_CONSTPTR);
   c->allow_jit_ = true;
+  c->entries = NULL;
+  c->lock = 0;
 }
 
 void upb_pbcodecache_uninit(upb_pbcodecache *c) {
-  upb_inttable_iter i;
-  upb_inttable_begin(&i, &c->groups);
-  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
-    const mgroup *group = upb_value_getconstptr(upb_inttable_iter_value(&i));
-    mgroup_unref(group, c);
+  cacheentry *e = c->entries;
+  while (e) {
+    cacheentry *next = e->next;
+    mgroup_unref(e->group, c);
+    upb_gfree(e);
+    e = next;
   }
-  upb_inttable_uninit(&c->groups);
 }
 
 bool upb_pbcodecache_allowjit(const upb_pbcodecache *c) {
   return c->allow_jit_;
 }
 
+/* The JIT has no counterpart to OP_STRINGUTF8 and doesn't profile, so those
+ * methods are always bytecode. */
+static bool canjit(const upb_pbcodecache *c,
+                   const upb_pbdecodermethodopts *opts) {
+  return c->allow_jit_ && !opts->validate_utf8 && !opts->profile;
+}
+
 bool upb_pbcodecache_setallowjit(upb_pbcodecache *c, bool allow) {
-  if (upb_inttable_count(&c->groups) > 0)
+  if (cache_head(&c->entries) != NULL)
     return false;
   c->allow_jit_ = allow;
   return true;
@@ -967,19 +1407,427 @@ bool upb_pbcodecache_setallowjit(upb_pbcodecache *c, bool allow) {
 
 const upb_pbdecodermethod *upb_pbcodecache_getdecodermethod(
     upb_pbcodecache *c, const upb_pbdecodermethodopts *opts) {
-  upb_value v;
-  bool ok;
+  const upb_pbdecodermethod *ret;
+  cacheentry *head;
+  cacheentry *e;
+
+  /* Fast path: the method (or a group that contains it, since a group has a
+   * method for every handlers reachable from the ones it was compiled for) is
+   * already in the cache. */
+  head = cache_head(&c->entries);
+  ret = cache_find(head, NULL, opts);
+  if (ret) return ret;
+
+  cache_lock(&c->lock);
+
+  /* Another thread may have compiled it while we waited; only the entries it
+   * added need to be checked. */
+  ret = cache_find(c->entries, head, opts);
+
+  if (!ret && (e = upb_gmalloc(sizeof(*e))) != NULL) {
+    upb_value v;
+    bool ok;
+
+    e->group = mgroup_new(opts, canjit(c, opts), c);
+    e->opts = *opts;
+    e->next = c->entries;
+
+    ok = upb_inttable_lookupptr(&e->group->methods, opts->handlers, &v);
+    UPB_ASSERT(ok);
+    ret = upb_value_getptr(v);
+
+    cache_publish(&c->entries, e);
+  }
+
+  cache_unlock(&c->lock);
+  return ret;
+}
+
+
+/* serialized code ************************************************************/
+
+/* Serialized code is a flat array of native-endian 32-bit words:
+ *
+ *   magic, version | ptrsize << 8 | flags << 16,
+ *   fingerprint (2 words), checksum (2 words),
+ *   method count, bytecode length
+ *
+ * followed by, for each method:
+ *
+ *   code offset, dispatch entry count, (key, value lo, value hi) per entry
+ *
+ * followed by the bytecode itself, with the upb_inttable* operand of each
+ * OP_SETDISPATCH replaced by the index of the method that owns the table, and
+ * each OP_STORE and superinstruction turned back into the op it replaced.
+ *
+ * Methods are numbered in the order find_methods() reaches their handlers.
+ * The fingerprint is a hash of everything about the handlers and their
+ * msgdefs that the compiler looks at, taken in that same order, so a blob is
+ * only accepted for handlers that would have compiled to the same code.  The
+ * checksum covers the words after the header and catches truncation or
+ * corruption; blobs are otherwise trusted like the library's own output, so
+ * they should only come from upb_pbcodecache_serialize() in the same build. */
+
+#define BLOB_MAGIC 0x63627075  /* "upbc" */
+#define BLOB_VERSION 2
+#define BLOB_HEADER_WORDS 8
+#define BLOB_LAZY 1
+#define BLOB_VALIDATEUTF8 2
+#define BLOB_PROFILING 4
+
+/* The handlers of every method in a group, in serialization order. */
+typedef struct {
+  const upb_handlers **handlers;
+  size_t len;
+  size_t size;
+  upb_inttable index;  /* upb_handlers* -> position in handlers. */
+  uint64_t fingerprint;
+} codeplan;
+
+/* FNV-1a. */
+#define FPHASH_INIT 0xcbf29ce484222325ULL
+
+static uint64_t fphash(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static uint64_t fphash32(uint64_t h, uint32_t val) {
+  return fphash(h, &val, sizeof(val));
+}
+
+static uint64_t fphashstr(uint64_t h, const char *str) {
+  return fphash(h, str, strlen(str) + 1);
+}
+
+static bool plan_visit(codeplan *p, const upb_handlers *h) {
+  const upb_msgdef *md = upb_handlers_msgdef(h);
+  upb_msg_field_iter i;
+  uint64_t fp;
+
+  if (p->len == p->size) {
+    size_t oldsize = p->size;
+    size_t newsize = UPB_MAX(oldsize * 2, 8);
+    const upb_handlers **handlers =
+        upb_grealloc(p->handlers, oldsize * sizeof(*handlers),
+                     newsize * sizeof(*handlers));
+    if (!handlers) return false;
+    p->handlers = handlers;
+    p->size = newsize;
+  }
+
+  if (!upb_inttable_insertptr(&p->index, h, upb_value_uint32(p->len))) {
+    return false;
+  }
+  p->handlers[p->len++] = h;
+
+  fp = fphashstr(p->fingerprint, upb_msgdef_fullname(md));
+  fp = fphash32(fp, upb_handlers_gethandler(h, UPB_STARTMSG_SELECTOR) != NULL);
+  fp = fphash32(fp, upb_handlers_gethandler(h, UPB_ENDMSG_SELECTOR) != NULL);
+
+  for(upb_msg_field_begin(&i, md);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    const upb_handlers *sub_h = NULL;
+    upb_value v;
+    int type;
+
+    fp = fphashstr(fp, upb_fielddef_name(f));
+    fp = fphash32(fp, upb_fielddef_number(f));
+    fp = fphash32(fp, upb_fielddef_descriptortype(f));
+    fp = fphash32(fp, upb_fielddef_isseq(f));
+    fp = fphash32(fp, upb_fielddef_lazy(f));
+    for (type = 0; type < UPB_HANDLER_MAX; type++) {
+      upb_selector_t sel;
+      if (upb_handlers_getselector(f, type, &sel)) {
+        fp = fphash32(fp, type);
+        fp = fphash32(fp, sel);
+        fp = fphash32(fp, upb_handlers_gethandler(h, sel) != NULL);
+      }
+    }
 
-  /* Right now we build a new DecoderMethod every time.
-   * TODO(haberman): properly cache methods by their true key. */
-  const mgroup *g = mgroup_new(opts->handlers, c->allow_jit_, opts->lazy, c);
-  upb_inttable_push(&c->groups, upb_value_constptr(g));
+    if (upb_fielddef_type(f) == UPB_TYPE_MESSAGE) {
+      sub_h = upb_handlers_getsubhandlers(h, f);
+    }
+    if (!sub_h) {
+      p->fingerprint = fphash32(fp, 0xffffffff);
+      continue;
+    }
+    p->fingerprint = fp;
+    if (!upb_inttable_lookupptr(&p->index, sub_h, &v)) {
+      if (!plan_visit(p, sub_h)) return false;
+      upb_inttable_lookupptr(&p->index, sub_h, &v);
+    }
+    fp = fphash32(p->fingerprint, upb_value_getuint32(v));
+  }
+
+  p->fingerprint = fp;
+  return true;
+}
+
+static void plan_uninit(codeplan *p) {
+  upb_gfree(p->handlers);
+  upb_inttable_uninit(&p->index);
+}
 
-  ok = upb_inttable_lookupptr(&g->methods, opts->handlers, &v);
+static bool plan_init(codeplan *p, const upb_pbdecodermethodopts *opts) {
+  p->handlers = NULL;
+  p->len = 0;
+  p->size = 0;
+  p->fingerprint = FPHASH_INIT;
+  if (!upb_inttable_init(&p->index, UPB_CTYPE_UINT32)) return false;
+  if (!plan_visit(p, opts->handlers)) {
+    plan_uninit(p);
+    return false;
+  }
+  return true;
+}
+
+static upb_pbdecodermethod *plan_method(const codeplan *p, const mgroup *g,
+                                        size_t i) {
+  upb_value v;
+  bool ok = upb_inttable_lookupptr(&g->methods, p->handlers[i], &v);
   UPB_ASSERT(ok);
   return upb_value_getptr(v);
 }
 
+static uint32_t blob_flags(const upb_pbdecodermethodopts *opts) {
+  return (opts->lazy ? BLOB_LAZY : 0) |
+         (opts->validate_utf8 ? BLOB_VALIDATEUTF8 : 0) |
+         (opts->profile ? BLOB_PROFILING : 0);
+}
+
+char *upb_pbcodecache_serialize(const upb_pbdecodermethodopts *opts,
+                                upb_arena *arena, size_t *size) {
+  codeplan p;
+  const mgroup *g;
+  uint32_t *buf;
+  uint32_t *w;
+  uint32_t *code;
+  size_t codelen;
+  size_t words;
+  size_t i;
+  uint64_t checksum;
+
+  if (!plan_init(&p, opts)) return NULL;
+
+  g = mgroup_new(opts, false, &g);
+  codelen = g->bytecode_end - g->bytecode;
+  words = BLOB_HEADER_WORDS + codelen;
+  for (i = 0; i < p.len; i++) {
+    words += 2 + 3 * upb_inttable_count(&plan_method(&p, g, i)->dispatch);
+  }
+
+  buf = upb_malloc(upb_arena_alloc(arena), words * sizeof(uint32_t));
+  if (!buf) goto done;
+
+  w = buf + BLOB_HEADER_WORDS;
+  for (i = 0; i < p.len; i++) {
+    const upb_pbdecodermethod *m = plan_method(&p, g, i);
+    upb_inttable_iter iter;
+    *w++ = (const uint32_t*)m->code_base.ptr - g->bytecode;
+    *w++ = upb_inttable_count(&m->dispatch);
+    upb_inttable_begin(&iter, &m->dispatch);
+    for (; !upb_inttable_done(&iter); upb_inttable_next(&iter)) {
+      uint64_t val = upb_value_getuint64(upb_inttable_iter_value(&iter));
+      *w++ = upb_inttable_iter_key(&iter);
+      *w++ = (uint32_t)val;
+      *w++ = val >> 32;
+    }
+  }
+
+  code = w;
+  memcpy(code, g->bytecode, codelen * sizeof(uint32_t));
+  while (w < code + codelen) {
+    if (getop(*w) == OP_SETDISPATCH) {
+      const upb_inttable *dispatch;
+      const upb_pbdecodermethod *m;
+      upb_value v;
+      bool ok;
+      memcpy(&dispatch, w + 1, sizeof(dispatch));
+      m = (const void*)((const char*)dispatch -
+                        offsetof(upb_pbdecodermethod, dispatch));
+      ok = upb_inttable_lookupptr(&p.index, m->dest_handlers_, &v);
+      UPB_ASSERT(ok);
+      memset(w + 1, 0, ptr_words * sizeof(uint32_t));
+      w[1] = upb_value_getuint32(v);
+    } else if (getop(*w) == OP_STORE) {
+      /* Serialized code is not specialized; the loader does that again for
+       * the handlers it is loaded for. */
+      const upb_pbdecoder_store *st = &g->stores[*w >> 8];
+      *w = st->parse_type | st->sel << 8;
+    } else if (getop(*w) == OP_TAGPARSE) {
+      *w = (*w & ~0xffU) | OP_TAG1;
+    } else if (getop(*w) == OP_STRFIELD) {
+      *w = (*w & ~0xffU) | OP_STARTSTR;
+    }
+    w += instruction_len(*w);
+  }
+
+  checksum = fphash(FPHASH_INIT, buf + BLOB_HEADER_WORDS,
+                    (words - BLOB_HEADER_WORDS) * sizeof(uint32_t));
+  buf[0] = BLOB_MAGIC;
+  buf[1] = BLOB_VERSION | sizeof(void*) << 8 | blob_flags(opts) << 16;
+  buf[2] = (uint32_t)p.fingerprint;
+  buf[3] = p.fingerprint >> 32;
+  buf[4] = (uint32_t)checksum;
+  buf[5] = checksum >> 32;
+  buf[6] = p.len;
+  buf[7] = codelen;
+  *size = words * sizeof(uint32_t);
+
+done:
+  mgroup_unref(g, &g);
+  plan_uninit(&p);
+  return (char*)buf;
+}
+
+typedef struct {
+  const char *ptr;
+  const char *end;
+} blobreader;
+
+static bool readwords(blobreader *r, void *words, size_t n) {
+  size_t len = n * sizeof(uint32_t);
+  if ((size_t)(r->end - r->ptr) < len) return false;
+  memcpy(words, r->ptr, len);
+  r->ptr += len;
+  return true;
+}
+
+static uint64_t join64(uint32_t lo, uint32_t hi) {
+  return (uint64_t)hi << 32 | lo;
+}
+
+/* Builds the group serialized in |buf| for the methods in |p|, or returns
+ * NULL and sets |status|. */
+static mgroup *loadgroup(const codeplan *p, const upb_pbdecodermethodopts *opts,
+                         const char *buf, size_t size, bool allowjit,
+                         const void *owner, upb_status *status) {
+  blobreader r;
+  uint32_t hdr[BLOB_HEADER_WORDS];
+  mgroup *g;
+  uint32_t *pc;
+  size_t codelen;
+  size_t i;
+
+  r.ptr = buf;
+  r.end = buf + size;
+  if (!readwords(&r, hdr, BLOB_HEADER_WORDS) || hdr[0] != BLOB_MAGIC) {
+    upb_status_seterrmsg(status, "Not serialized decoder code.");
+    return NULL;
+  }
+  if (hdr[1] != (BLOB_VERSION | sizeof(void*) << 8 | blob_flags(opts) << 16)) {
+    upb_status_seterrmsg(status,
+                         "Serialized decoder code is for a different version, "
+                         "platform or set of options.");
+    return NULL;
+  }
+  if (join64(hdr[2], hdr[3]) != p->fingerprint || hdr[6] != p->len) {
+    upb_status_seterrmsg(status,
+                         "Serialized decoder code does not match handlers.");
+    return NULL;
+  }
+  if (size % sizeof(uint32_t) != 0 ||
+      join64(hdr[4], hdr[5]) !=
+          fphash(FPHASH_INIT, r.ptr, r.end - r.ptr)) {
+    upb_status_seterrmsg(status, "Serialized decoder code is corrupt.");
+    return NULL;
+  }
+
+  codelen = hdr[7];
+  g = newgroup(owner);
+  g->profile = opts->profile;
+  g->bytecode = upb_gmalloc(UPB_MAX(codelen, 1) * sizeof(uint32_t));
+  if (!g->bytecode) goto oom;
+  g->bytecode_end = g->bytecode + codelen;
+
+  for (i = 0; i < p->len; i++) {
+    upb_pbdecodermethod *m = newmethod(p->handlers[i], g);
+    uint32_t mhdr[2];
+    uint32_t j;
+    if (!readwords(&r, mhdr, 2) || mhdr[0] >= codelen) goto corrupt;
+    m->code_base.ofs = mhdr[0];
+    for (j = 0; j < mhdr[1]; j++) {
+      uint32_t entry[3];
+      if (!readwords(&r, entry, 3)) goto corrupt;
+      if (!upb_inttable_insert(&m->dispatch, entry[0],
+                               upb_value_uint64(join64(entry[1], entry[2])))) {
+        goto oom;
+      }
+    }
+    upb_inttable_compact(&m->dispatch);
+  }
+
+  if (!readwords(&r, g->bytecode, codelen) || r.ptr != r.end) goto corrupt;
+  for (pc = g->bytecode; pc < g->bytecode_end; pc += instruction_len(*pc)) {
+    uint32_t op = getop(*pc);
+    if (op == 0 || op > OP_MAX ||
+        instruction_len(*pc) > g->bytecode_end - pc ||
+        (op == OP_PARSEARRAY && !isparseop(pc[1]))) {
+      goto corrupt;
+    }
+    if (op == OP_SETDISPATCH) {
+      const upb_inttable *dispatch;
+      if (pc[1] >= p->len) goto corrupt;
+      dispatch = &plan_method(p, g, pc[1])->dispatch;
+      memcpy(pc + 1, &dispatch, sizeof(dispatch));
+    }
+  }
+
+  freezegroup(g, allowjit);
+  return g;
+
+corrupt:
+  upb_status_seterrmsg(status, "Serialized decoder code is corrupt.");
+  mgroup_unref(g, owner);
+  return NULL;
+
+oom:
+  upb_status_seterrmsg(status, "Out of memory.");
+  mgroup_unref(g, owner);
+  return NULL;
+}
+
+bool upb_pbcodecache_load(upb_pbcodecache *c,
+                          const upb_pbdecodermethodopts *opts,
+                          const char *buf, size_t size, upb_status *status) {
+  codeplan p;
+  const mgroup *g;
+  cacheentry *e;
+
+  if (!plan_init(&p, opts)) {
+    upb_status_seterrmsg(status, "Out of memory.");
+    return false;
+  }
+  g = loadgroup(&p, opts, buf, size, canjit(c, opts), c, status);
+  plan_uninit(&p);
+  if (!g) return false;
+
+  cache_lock(&c->lock);
+  if (cache_find(c->entries, NULL, opts)) {
+    /* Already compiled or loaded; keep what other threads may be using. */
+    mgroup_unref(g, c);
+  } else if ((e = upb_gmalloc(sizeof(*e))) != NULL) {
+    e->group = g;
+    e->opts = *opts;
+    e->next = c->entries;
+    cache_publish(&c->entries, e);
+  } else {
+    mgroup_unref(g, c);
+    g = NULL;
+  }
+  cache_unlock(&c->lock);
+
+  if (!g) upb_status_seterrmsg(status, "Out of memory.");
+  return g != NULL;
+}
+
 
 /* upb_pbdecodermethodopts ****************************************************/
 
@@ -987,8 +1835,26 @@ void upb_pbdecodermethodopts_init(upb_pbdecodermethodopts *opts,
                                   const upb_handlers *h) {
   opts->handlers = h;
   opts->lazy = false;
+  opts->validate_utf8 = false;
+  opts->profile = NULL;
+  opts->field_order = NULL;
 }
 
 void upb_pbdecodermethodopts_setlazy(upb_pbdecodermethodopts *opts, bool lazy) {
   opts->lazy = lazy;
 }
+
+void upb_pbdecodermethodopts_setvalidateutf8(upb_pbdecodermethodopts *opts,
+                                             bool validate) {
+  opts->validate_utf8 = validate;
+}
+
+void upb_pbdecodermethodopts_setprofile(upb_pbdecodermethodopts *opts,
+                                        upb_pbcodeprofile *profile) {
+  opts->profile = profile;
+}
+
+void upb_pbdecodermethodopts_setfieldorder(upb_pbdecodermethodopts *opts,
+                                           const upb_pbcodeprofile *profile) {
+  opts->field_order = profile;
+}
@@ -24,6 +24,15 @@
 
 #define CHECK_SUSPEND(x) if (!(x)) return upb_pbdecoder_suspend(d);
 
+#ifdef UPB_PBDECODER_STATS
+#define ADDSTAT(d, counter, n) ((d)->stats.counter += (n))
+#else
+#define ADDSTAT(d, counter, n) ((void)0)
+#endif
+
+/* The most values OP_PARSEARRAY passes to an array handler in one call. */
+#define ARRAY_CHUNK 64
+
 /* Error messages that are shared between the bytecode and JIT decoders. */
 const char *kPbDecoderStackOverflow = "Nesting too deep.";
 const char *kPbDecoderSubmessageTooLong =
@@ -31,6 +40,7 @@ const char *kPbDecoderSubmessageTooLong =
 
 /* Error messages shared within this file. */
 static const char *kUnterminatedVarint = "Unterminated varint.";
+static const char *kInvalidUtf8 = "Invalid UTF-8 in string field.";
 
 /* upb_pbdecoder **************************************************************/
 
@@ -61,6 +71,7 @@ static bool consumes_input(opcode op) {
     case OP_CALL:
     case OP_RET:
     case OP_BRANCH:
+    case OP_STRFIELD:  /* Checkpoints after its string itself. */
       return false;
     default:
       return true;
@@ -280,6 +291,7 @@ int32_t upb_pbdecoder_resume(upb_pbdecoder *d, void *p, const char *buf,
 /* Suspends the decoder at the last checkpoint, without saving any residual
  * bytes.  If there are any unconsumed bytes, returns a short byte count. */
 size_t upb_pbdecoder_suspend(upb_pbdecoder *d) {
+  ADDSTAT(d, suspends, 1);
   d->pc = d->last;
   if (d->checkpoint == d->residual) {
     /* Checkpoint was in residual buf; no user bytes were consumed. */
@@ -315,6 +327,7 @@ static size_t suspend_save(upb_pbdecoder *d) {
     }
     memcpy(d->residual_end, d->buf_param, d->size_param);
     d->residual_end += d->size_param;
+    ADDSTAT(d, residual_bytes, d->size_param);
   } else {
     /* Checkpoint was in user buf; old residual bytes not needed. */
     size_t save;
@@ -326,8 +339,11 @@ static size_t suspend_save(upb_pbdecoder *d) {
     memcpy(d->residual, d->ptr, save);
     d->residual_end = d->residual + save;
     d->bufstart_ofs = offset(d);
+    ADDSTAT(d, residual_bytes, save);
   }
 
+  ADDSTAT(d, residual_saves, 1);
+
   switchtobuf(d, d->residual, d->residual_end);
   return d->size_param;
 }
@@ -409,6 +425,7 @@ UPB_NOINLINE int32_t upb_pbdecoder_decode_varint_slow(upb_pbdecoder *d,
                                                       uint64_t *u64) {
   uint8_t byte = 0x80;
   int bitpos;
+  ADDSTAT(d, slow_varints, 1);
   *u64 = 0;
   for(bitpos = 0; bitpos < 70 && (byte & 0x80); bitpos += 7) {
     CHECK_RETURN(getbytes(d, &byte, 1));
@@ -533,6 +550,7 @@ UPB_NOINLINE int32_t upb_pbdecoder_checktag_slow(upb_pbdecoder *d,
     /* Advance past matched bytes. */
     int32_t ok = getbytes(d, &data, read);
     UPB_ASSERT(ok < 0);
+    ADDSTAT(d, tag_hits, 1);
     return DECODE_OK;
   } else if (read < bytes && memcmp(&data, &expected, read) == 0) {
     return suspend_save(d);
@@ -553,6 +571,7 @@ int32_t upb_pbdecoder_skipunknown(upb_pbdecoder *d, int32_t fieldnum,
     fieldnum = tag >> 3;
 
 have_tag:
+    ADDSTAT(d, unknown_fields, 1);
     if (fieldnum == 0) {
       seterr(d, "Saw invalid field number (0)");
       return upb_pbdecoder_suspend(d);
@@ -620,6 +639,7 @@ static void goto_endmsg(upb_pbdecoder *d) {
  * instruction for the end of message. */
 static int32_t dispatch(upb_pbdecoder *d) {
   upb_inttable *dispatch = d->top->dispatch;
+  upb_pbcodeprofile *profile = ((const mgroup*)d->method_->group)->profile;
   uint32_t tag;
   uint8_t wire_type;
   uint32_t fieldnum;
@@ -630,6 +650,13 @@ static int32_t dispatch(upb_pbdecoder *d) {
   CHECK_RETURN(decode_v32(d, &tag));
   wire_type = tag & 0x7;
   fieldnum = tag >> 3;
+  ADDSTAT(d, dispatches, 1);
+
+  /* Profiling methods send every field through here. */
+  if (profile && fieldnum != DISPATCH_ENDMSG) {
+    upb_pbcodeprofile_record(profile, upb_handlers_msgdef(d->top->sink.handlers),
+                             fieldnum, d->top->fieldpos++);
+  }
 
   /* Lookup tag.  Because of packed/non-packed compatibility, we have to
    * check the wire type against two possibilities. */
@@ -669,6 +696,114 @@ static int32_t dispatch(upb_pbdecoder *d) {
   return DECODE_OK;
 }
 
+/* Returns true if the current frame has a string handler for |sel|. */
+static bool hasstringhandler(const upb_pbdecoder *d, upb_selector_t sel) {
+  const upb_handlers *h = d->top->sink.handlers;
+  return h && upb_handlers_gethandler(h, sel);
+}
+
+/* Passes the string data in the current buffer to the string handler for
+ * |sel|.  If |utf8| is set, the string must also be valid UTF-8: the data is
+ * checked before the handler sees it, and d->utf8state carries the check
+ * across buffer seams.  Bytes the handler asks to skip are not checked. */
+UPB_FORCEINLINE static int32_t decode_putstr(upb_pbdecoder *d,
+                                             upb_selector_t sel,
+                                             const upb_bufhandle *handle,
+                                             bool utf8) {
+  uint32_t len = curbufleft(d);
+  upb_utf8state s = UPB_UTF8_ACCEPT;
+  const char *ptr = d->ptr;
+  size_t n;
+
+  if (d->delim_end == NULL && !utf8 && !hasstringhandler(d, sel)) {
+    /* Nobody is looking at the data and the string continues past this
+     * buffer, so skip the rest of it at once.  The caller can then fast
+     * forward over the remainder instead of feeding it to us. */
+    int32_t ret = skip(d, delim_remaining(d));
+    if (ret > 0) {
+      /* The skip covers the rest of the string, so once it is done we resume
+       * after OP_STRING rather than repeating it. */
+      d->last++;
+      d->pc = d->last;
+    }
+    return ret;
+  }
+
+  if (utf8) {
+    s = upb_utf8_validate(d->utf8state, ptr, len);
+    /* If the string's end is in this buffer, these are its last bytes. */
+    if (s == UPB_UTF8_REJECT || (s != UPB_UTF8_ACCEPT && d->delim_end)) {
+      seterr(d, kInvalidUtf8);
+      return upb_pbdecoder_suspend(d);
+    }
+  }
+
+  n = upb_sink_putstring(&d->top->sink, sel, ptr, len, handle);
+  if (n > len) {
+    if (n > delim_remaining(d)) {
+      seterr(d, "Tried to skip past end of string.");
+      return upb_pbdecoder_suspend(d);
+    } else {
+      int32_t ret = skip(d, n);
+      /* This shouldn't return DECODE_OK, because n > len. */
+      UPB_ASSERT(ret >= 0);
+      return ret;
+    }
+  }
+  if (utf8) {
+    d->utf8state = n < len ? upb_utf8_validate(d->utf8state, ptr, n) : s;
+  }
+  advance(d, n);
+  if (n < len || d->delim_end == NULL) {
+    /* We aren't finished with this string yet. */
+    d->pc--;  /* Repeat OP_STRING. */
+    if (n > 0) checkpoint(d);
+    return upb_pbdecoder_suspend(d);
+  }
+  return DECODE_OK;
+}
+
+/* Parses values of a packed field for its array handler.  Values are
+ * decoded into a local buffer for as long as the next one is sure to be in
+ * the current buffer (no value is longer than a maximal varint), so only the
+ * first can suspend.  This stops at the end of the packed run, since the
+ * current buffer ends there too. */
+static int32_t parsearray(upb_pbdecoder *d, upb_selector_t sel,
+                          uint32_t parse_type) {
+#define ARRAY_TYPE(type, wt, name, ctype, convfunc, wtype) \
+  case OP_PARSE_ ## type: { \
+    ctype vals[ARRAY_CHUNK]; \
+    size_t n = 0; \
+    do { \
+      wtype val; \
+      CHECK_RETURN(decode_ ## wt(d, &val)); \
+      vals[n++] = (convfunc)(val); \
+    } while (n < ARRAY_CHUNK && curbufleft(d) >= UPB_PB_VARINT_MAX_LEN); \
+    upb_sink_put ## name ## array(&d->top->sink, sel, vals, n); \
+    break; \
+  }
+
+  switch (parse_type) {
+    ARRAY_TYPE(INT32,    varint,  int32,  int32_t,  int32_t,      uint64_t)
+    ARRAY_TYPE(INT64,    varint,  int64,  int64_t,  int64_t,      uint64_t)
+    ARRAY_TYPE(UINT32,   varint,  uint32, uint32_t, uint32_t,     uint64_t)
+    ARRAY_TYPE(UINT64,   varint,  uint64, uint64_t, uint64_t,     uint64_t)
+    ARRAY_TYPE(FIXED32,  fixed32, uint32, uint32_t, uint32_t,     uint32_t)
+    ARRAY_TYPE(FIXED64,  fixed64, uint64, uint64_t, uint64_t,     uint64_t)
+    ARRAY_TYPE(SFIXED32, fixed32, int32,  int32_t,  int32_t,      uint32_t)
+    ARRAY_TYPE(SFIXED64, fixed64, int64,  int64_t,  int64_t,      uint64_t)
+    ARRAY_TYPE(BOOL,     varint,  bool,   bool,     bool,         uint64_t)
+    ARRAY_TYPE(DOUBLE,   fixed64, double, double,   as_double,    uint64_t)
+    ARRAY_TYPE(FLOAT,    fixed32, float,  float,    as_float,     uint32_t)
+    ARRAY_TYPE(SINT32,   varint,  int32,  int32_t,  upb_zzdec_32, uint64_t)
+    ARRAY_TYPE(SINT64,   varint,  int64,  int64_t,  upb_zzdec_64, uint64_t)
+    default: UPB_ASSERT(false); break;
+  }
+#undef ARRAY_TYPE
+
+  return DECODE_OK;
+}
+
 /* Callers know that the stack is more than one deep because the opcodes that
  * call this only occur after PUSH operations. */
 upb_pbdecoder_frame *outer_frame(upb_pbdecoder *d) {
@@ -679,13 +814,163 @@ upb_pbdecoder_frame *outer_frame(upb_pbdecoder *d) {
 
 /* The main decoding loop *****************************************************/
 
-/* The main decoder VM function.  Uses traditional bytecode dispatch loop with a
- * switch() statement. */
+/* Stores the value of a primitive field straight into the closure, for
+ * OP_STORE. */
+UPB_FORCEINLINE static int32_t decode_store(upb_pbdecoder *d,
+                                            const upb_pbdecoder_store *st) {
+#define STORE_TYPE(type, wt, ctype, convfunc, wtype) \
+  case OP_PARSE_ ## type: { \
+    wtype val; \
+    CHECK_RETURN(decode_ ## wt(d, &val)); \
+    *(ctype*)&m[st->offset] = (convfunc)(val); \
+    break; \
+  }
+
+  uint8_t *m = d->top->sink.closure;
+  switch (st->parse_type) {
+    STORE_TYPE(INT32,    varint,  int32_t,  int32_t,      uint64_t)
+    STORE_TYPE(INT64,    varint,  int64_t,  int64_t,      uint64_t)
+    STORE_TYPE(UINT32,   varint,  uint32_t, uint32_t,     uint64_t)
+    STORE_TYPE(UINT64,   varint,  uint64_t, uint64_t,     uint64_t)
+    STORE_TYPE(FIXED32,  fixed32, uint32_t, uint32_t,     uint32_t)
+    STORE_TYPE(FIXED64,  fixed64, uint64_t, uint64_t,     uint64_t)
+    STORE_TYPE(SFIXED32, fixed32, int32_t,  int32_t,      uint32_t)
+    STORE_TYPE(SFIXED64, fixed64, int64_t,  int64_t,      uint64_t)
+    STORE_TYPE(BOOL,     varint,  bool,     bool,         uint64_t)
+    STORE_TYPE(DOUBLE,   fixed64, double,   as_double,    uint64_t)
+    STORE_TYPE(FLOAT,    fixed32, float,    as_float,     uint32_t)
+    STORE_TYPE(SINT32,   varint,  int32_t,  upb_zzdec_32, uint64_t)
+    STORE_TYPE(SINT64,   varint,  int64_t,  upb_zzdec_64, uint64_t)
+    default: UPB_ASSERT(false); break;
+  }
+  if (st->hasmask) m[st->hasbyte] |= st->hasmask;
+#undef STORE_TYPE
+
+  return DECODE_OK;
+}
+
+/* Parses one value with the OP_PARSE_* or OP_STORE |instruction|, for
+ * OP_TAGPARSE. */
+UPB_FORCEINLINE static int32_t decode_value(upb_pbdecoder *d,
+                                            const mgroup *group,
+                                            uint32_t instruction) {
+#define VALUE_TYPE(type, wt, name, convfunc, ctype) \
+  case OP_PARSE_ ## type: { \
+    ctype val; \
+    CHECK_RETURN(decode_ ## wt(d, &val)); \
+    upb_sink_put ## name(&d->top->sink, arg, (convfunc)(val)); \
+    break; \
+  }
+
+  uint32_t arg = instruction >> 8;
+  switch (getop(instruction)) {
+    VALUE_TYPE(INT32,    varint,  int32,  int32_t,      uint64_t)
+    VALUE_TYPE(INT64,    varint,  int64,  int64_t,      uint64_t)
+    VALUE_TYPE(UINT32,   varint,  uint32, uint32_t,     uint64_t)
+    VALUE_TYPE(UINT64,   varint,  uint64, uint64_t,     uint64_t)
+    VALUE_TYPE(FIXED32,  fixed32, uint32, uint32_t,     uint32_t)
+    VALUE_TYPE(FIXED64,  fixed64, uint64, uint64_t,     uint64_t)
+    VALUE_TYPE(SFIXED32, fixed32, int32,  int32_t,      uint32_t)
+    VALUE_TYPE(SFIXED64, fixed64, int64,  int64_t,      uint64_t)
+    VALUE_TYPE(BOOL,     varint,  bool,   bool,         uint64_t)
+    VALUE_TYPE(DOUBLE,   fixed64, double, as_double,    uint64_t)
+    VALUE_TYPE(FLOAT,    fixed32, float,  as_float,     uint32_t)
+    VALUE_TYPE(SINT32,   varint,  int32,  upb_zzdec_32, uint64_t)
+    VALUE_TYPE(SINT64,   varint,  int64,  upb_zzdec_64, uint64_t)
+    case OP_STORE:
+      return decode_store(d, &group->stores[arg]);
+    default: UPB_ASSERT(false); break;
+  }
+#undef VALUE_TYPE
+
+  return DECODE_OK;
+}
+
+/* The interpreter dispatches with computed goto where the compiler has it
+ * (GCC and Clang): each op ends by jumping through a table straight to the
+ * code for the next one.  That gives every op an indirect branch of its own
+ * to predict, instead of all of them sharing the one at the top of a switch()
+ * loop.  Define UPB_PBDECODER_SWITCH to use the switch() loop anyway; the ops
+ * are the same code either way. */
+#if defined(__GNUC__) && !defined(UPB_PBDECODER_SWITCH)
+#define UPB_PBDECODER_THREADED
+#endif
+
+/* The main decoder VM function. */
 size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
                       const upb_bufhandle* handle) {
+  int32_t instruction;
+  opcode op;
+  uint32_t arg;
+  int32_t longofs;
 
+#ifdef UPB_DUMP_BYTECODE
+#define VMDUMP() \
+    fprintf(stderr, "s_ofs=%d buf_ofs=%d data_rem=%d buf_rem=%d delim_rem=%d " \
+                    "%x %s (%d)\n", \
+            (int)offset(d), \
+            (int)(d->ptr - d->buf), \
+            (int)(d->data_end - d->ptr), \
+            (int)(d->end - d->ptr), \
+            (int)((d->top->end_ofs - d->bufstart_ofs) - (d->ptr - d->buf)), \
+            (int)(d->pc - 1 - group->bytecode), \
+            upb_pbdecoder_getopname(op), \
+            arg)
+#else
+#define VMDUMP() ((void)0)
+#endif
+
+#define VMFETCH() \
+    d->last = d->pc; \
+    instruction = *d->pc++; \
+    op = getop(instruction); \
+    arg = instruction >> 8; \
+    longofs = arg; \
+    UPB_ASSERT(op <= OP_LAST); \
+    UPB_ASSERT(d->ptr != d->residual_end); \
+    VMDUMP()
+
+#ifdef UPB_PBDECODER_THREADED
+#define VMCASE(op, code) \
+  vm_ ## op: { code; if (consumes_input(op)) checkpoint(d); VMNEXT(); }
+#define VMNEXT() do { \
+    VMFETCH(); \
+    __extension__ ({ goto *vm_ops[op]; }); \
+  } while (0)
+#define VMLABEL(op) __extension__ &&vm_ ## op
+
+  /* Indexed by opcode.  Keep in sync with the list in decoder.int.h. */
+  static const void *const vm_ops[] = {
+    VMLABEL(OP_HALT),  /* 0 is not an opcode. */
+    VMLABEL(OP_PARSE_DOUBLE), VMLABEL(OP_PARSE_FLOAT),
+    VMLABEL(OP_PARSE_INT64), VMLABEL(OP_PARSE_UINT64),
+    VMLABEL(OP_PARSE_INT32), VMLABEL(OP_PARSE_FIXED64),
+    VMLABEL(OP_PARSE_FIXED32), VMLABEL(OP_PARSE_BOOL),
+    VMLABEL(OP_STARTMSG), VMLABEL(OP_ENDMSG),
+    VMLABEL(OP_STARTSEQ), VMLABEL(OP_ENDSEQ),
+    VMLABEL(OP_PARSE_UINT32), VMLABEL(OP_STARTSUBMSG),
+    VMLABEL(OP_PARSE_SFIXED32), VMLABEL(OP_PARSE_SFIXED64),
+    VMLABEL(OP_PARSE_SINT32), VMLABEL(OP_PARSE_SINT64),
+    VMLABEL(OP_ENDSUBMSG), VMLABEL(OP_STARTSTR),
+    VMLABEL(OP_STRING), VMLABEL(OP_ENDSTR),
+    VMLABEL(OP_PUSHTAGDELIM), VMLABEL(OP_PUSHLENDELIM),
+    VMLABEL(OP_POP), VMLABEL(OP_SETDELIM),
+    VMLABEL(OP_SETBIGGROUPNUM), VMLABEL(OP_CHECKDELIM),
+    VMLABEL(OP_CALL), VMLABEL(OP_RET),
+    VMLABEL(OP_BRANCH), VMLABEL(OP_TAG1),
+    VMLABEL(OP_TAG2), VMLABEL(OP_TAGN),
+    VMLABEL(OP_SETDISPATCH), VMLABEL(OP_DISPATCH),
+    VMLABEL(OP_HALT), VMLABEL(OP_STRINGUTF8),
+    VMLABEL(OP_PARSEARRAY), VMLABEL(OP_STORE),
+    VMLABEL(OP_TAGPARSE), VMLABEL(OP_STRFIELD)
+  };
+  UPB_ASSERT(sizeof(vm_ops) / sizeof(vm_ops[0]) == OP_LAST + 1);
+#else
 #define VMCASE(op, code) \
-  case op: { code; if (consumes_input(op)) checkpoint(d); break; }
+  case op: { code; if (consumes_input(op)) checkpoint(d); VMNEXT(); }
+#define VMNEXT() break
+#endif
+
 #define PRIMITIVE_OP(type, wt, name, convfunc, ctype) \
   VMCASE(OP_PARSE_ ## type, { \
     ctype val; \
@@ -693,32 +978,15 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
     upb_sink_put ## name(&d->top->sink, arg, (convfunc)(val)); \
   })
 
+  UPB_UNUSED(group);
+
+#ifdef UPB_PBDECODER_THREADED
+  VMNEXT();
+#else
   while(1) {
-    int32_t instruction;
-    opcode op;
-    uint32_t arg;
-    int32_t longofs;
-
-    d->last = d->pc;
-    instruction = *d->pc++;
-    op = getop(instruction);
-    arg = instruction >> 8;
-    longofs = arg;
-    UPB_ASSERT(d->ptr != d->residual_end);
-    UPB_UNUSED(group);
-#ifdef UPB_DUMP_BYTECODE
-    fprintf(stderr, "s_ofs=%d buf_ofs=%d data_rem=%d buf_rem=%d delim_rem=%d "
-                    "%x %s (%d)\n",
-            (int)offset(d),
-            (int)(d->ptr - d->buf),
-            (int)(d->data_end - d->ptr),
-            (int)(d->end - d->ptr),
-            (int)((d->top->end_ofs - d->bufstart_ofs) - (d->ptr - d->buf)),
-            (int)(d->pc - 1 - group->bytecode),
-            upb_pbdecoder_getopname(op),
-            arg);
-#endif
+    VMFETCH();
     switch (op) {
+#endif
       /* Technically, we are losing data if we see a 32-bit varint that is not
        * properly sign-extended.  We could detect this and error about the data
        * loss, but proto2 does not do this, so we pass. */
@@ -736,8 +1004,13 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
       PRIMITIVE_OP(SINT32,   varint,  int32,  upb_zzdec_32, uint64_t)
       PRIMITIVE_OP(SINT64,   varint,  int64,  upb_zzdec_64, uint64_t)
 
+      VMCASE(OP_STORE,
+        CHECK_RETURN(decode_store(d, &group->stores[arg]));
+      )
+
       VMCASE(OP_SETDISPATCH,
         d->top->base = d->pc - 1;
+        d->top->fieldpos = 0;
         memcpy(&d->top->dispatch, d->pc, sizeof(void*));
         d->pc += sizeof(void*) / sizeof(uint32_t);
       )
@@ -765,31 +1038,16 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
         uint32_t len = delim_remaining(d);
         upb_pbdecoder_frame *outer = outer_frame(d);
         CHECK_SUSPEND(upb_sink_startstr(&outer->sink, arg, len, &d->top->sink));
+        d->utf8state = UPB_UTF8_ACCEPT;
         if (len == 0) {
           d->pc++;  /* Skip OP_STRING. */
         }
       )
       VMCASE(OP_STRING,
-        uint32_t len = curbufleft(d);
-        size_t n = upb_sink_putstring(&d->top->sink, arg, d->ptr, len, handle);
-        if (n > len) {
-          if (n > delim_remaining(d)) {
-            seterr(d, "Tried to skip past end of string.");
-            return upb_pbdecoder_suspend(d);
-          } else {
-            int32_t ret = skip(d, n);
-            /* This shouldn't return DECODE_OK, because n > len. */
-            UPB_ASSERT(ret >= 0);
-            return ret;
-          }
-        }
-        advance(d, n);
-        if (n < len || d->delim_end == NULL) {
-          /* We aren't finished with this string yet. */
-          d->pc--;  /* Repeat OP_STRING. */
-          if (n > 0) checkpoint(d);
-          return upb_pbdecoder_suspend(d);
-        }
+        CHECK_RETURN(decode_putstr(d, arg, handle, false));
+      )
+      VMCASE(OP_STRINGUTF8,
+        CHECK_RETURN(decode_putstr(d, arg, handle, true));
       )
       VMCASE(OP_ENDSTR,
         CHECK_SUSPEND(upb_sink_endstr(&d->top->sink, arg));
@@ -797,6 +1055,9 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
       VMCASE(OP_PUSHTAGDELIM,
         CHECK_SUSPEND(pushtagdelim(d, arg));
       )
+      VMCASE(OP_PARSEARRAY,
+        CHECK_RETURN(parsearray(d, arg, *d->pc++));
+      )
       VMCASE(OP_SETBIGGROUPNUM,
         d->top->groupnum = *d->pc++;
       )
@@ -838,6 +1099,7 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
         expected = (arg >> 8) & 0xff;
         if (*d->ptr == expected) {
           advance(d, 1);
+          ADDSTAT(d, tag_hits, 1);
         } else {
           int8_t shortofs;
          badtag:
@@ -846,7 +1108,7 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
             CHECK_RETURN(dispatch(d));
           } else {
             d->pc += shortofs;
-            break; /* Avoid checkpoint(). */
+            VMNEXT(); /* Avoid checkpoint(). */
           }
         }
       )
@@ -859,6 +1121,7 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
           memcpy(&actual, d->ptr, 2);
           if (expected == actual) {
             advance(d, 2);
+            ADDSTAT(d, tag_hits, 1);
           } else {
             goto badtag;
           }
@@ -883,11 +1146,63 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
       VMCASE(OP_HALT, {
         return d->size_param;
       })
+
+      /* Superinstructions; see decoder.int.h. */
+      VMCASE(OP_TAGPARSE,
+        uint8_t expected;
+        CHECK_SUSPEND(curbufleft(d) > 0);
+        expected = (arg >> 8) & 0xff;
+        if (*d->ptr != expected) goto badtag;
+        advance(d, 1);
+        ADDSTAT(d, tag_hits, 1);
+        /* There is no checkpoint between the tag and the value, so if the
+         * value is cut short we come back to the tag. */
+        CHECK_RETURN(decode_value(d, group, *d->pc++));
+        instruction = *d->pc++;
+        UPB_ASSERT(getop(instruction) == OP_CHECKDELIM);
+        UPB_ASSERT(!(d->delim_end && d->ptr > d->delim_end));
+        if (d->ptr == d->delim_end)
+          d->pc += instruction >> 8;
+      )
+      VMCASE(OP_STRFIELD,
+        uint32_t len = delim_remaining(d);
+        upb_pbdecoder_frame *outer = outer_frame(d);
+        CHECK_SUSPEND(upb_sink_startstr(&outer->sink, arg, len, &d->top->sink));
+        d->utf8state = UPB_UTF8_ACCEPT;
+        /* The string has started, so from here on a suspend must resume at
+         * the op we are on, just as if each op were run separately. */
+        d->last = d->pc;
+        instruction = *d->pc++;
+        if (len > 0) {
+          CHECK_RETURN(decode_putstr(d, instruction >> 8, handle,
+                                     getop(instruction) == OP_STRINGUTF8));
+          checkpoint(d);
+        }
+        UPB_ASSERT(getop(*d->pc) == OP_POP);
+        d->pc++;
+        decoder_pop(d);
+        if (getop(*d->pc) == OP_ENDSTR) {
+          d->last = d->pc;
+          instruction = *d->pc++;
+          CHECK_SUSPEND(upb_sink_endstr(&d->top->sink, instruction >> 8));
+        }
+      )
+#ifndef UPB_PBDECODER_THREADED
     }
   }
+#endif
+
+#undef VMDUMP
+#undef VMFETCH
+#undef VMCASE
+#undef VMNEXT
+#undef VMLABEL
+#undef PRIMITIVE_OP
 }
 
 
+
+
 /* BytesHandler handlers ******************************************************/
 
 void *upb_pbdecoder_startbc(void *closure, const void *pc, size_t size_hint) {
@@ -956,6 +1271,7 @@ bool upb_pbdecoder_end(void *closure, const void *handler_data) {
       UPB_ASSERT(getop(*d->pc) == OP_TAG1 ||
              getop(*d->pc) == OP_TAG2 ||
              getop(*d->pc) == OP_TAGN ||
+             getop(*d->pc) == OP_TAGPARSE ||
              getop(*d->pc) == OP_DISPATCH);
       d->pc = p;
     }
@@ -981,6 +1297,75 @@ size_t upb_pbdecoder_decode(void *decoder, const void *group, const char *buf,
 }
 
 
+/* Statistics *****************************************************************/
+
+#ifdef UPB_PBDECODER_STATS
+
+#define NUM_STATS (sizeof(upb_pbdecoderstats) / sizeof(uint64_t))
+
+/* The counters of every decoder whose env has been destroyed. */
+static upb_pbdecoderstats global_stats;
+
+#ifdef UPB_THREAD_UNSAFE /*---------------------------------------------------*/
+
+static void atomic_add64(uint64_t *a, uint64_t n) { *a += n; }
+static uint64_t atomic_load64(uint64_t *a) { return *a; }
+
+#elif defined(__GNUC__) || defined(__clang__) /*------------------------------*/
+
+static void atomic_add64(uint64_t *a, uint64_t n) { __sync_fetch_and_add(a, n); }
+static uint64_t atomic_load64(uint64_t *a) { return __sync_fetch_and_add(a, 0); }
+
+#elif defined(WIN32) /*-------------------------------------------------------*/
+
+#include <Windows.h>
+
+static void atomic_add64(uint64_t *a, uint64_t n) {
+  InterlockedExchangeAdd64((volatile LONG64*)a, n);
+}
+static uint64_t atomic_load64(uint64_t *a) {
+  return InterlockedCompareExchange64((volatile LONG64*)a, 0, 0);
+}
+
+#else
+#error Atomic primitives not defined for your platform/CPU.  \
+       Implement them or compile with UPB_THREAD_UNSAFE.
+#endif
+
+static void addglobalstats(void *ud) {
+  const uint64_t *stats = (const uint64_t*)&((upb_pbdecoder*)ud)->stats;
+  uint64_t *global = (uint64_t*)&global_stats;
+  size_t i;
+  for (i = 0; i < NUM_STATS; i++) {
+    atomic_add64(&global[i], stats[i]);
+  }
+}
+
+#endif  /* UPB_PBDECODER_STATS */
+
+void upb_pbdecoder_getstats(const upb_pbdecoder *d, upb_pbdecoderstats *stats) {
+#ifdef UPB_PBDECODER_STATS
+  *stats = d->stats;
+#else
+  UPB_UNUSED(d);
+  memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void upb_pbdecoder_getglobalstats(upb_pbdecoderstats *stats) {
+#ifdef UPB_PBDECODER_STATS
+  uint64_t *global = (uint64_t*)&global_stats;
+  uint64_t *out = (uint64_t*)stats;
+  size_t i;
+  for (i = 0; i < NUM_STATS; i++) {
+    out[i] = atomic_load64(&global[i]);
+  }
+#else
+  memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+
 /* Public API *****************************************************************/
 
 void upb_pbdecoder_reset(upb_pbdecoder *d) {
@@ -1014,6 +1399,13 @@ upb_pbdecoder *upb_pbdecoder_create(upb_env *e, const upb_pbdecodermethod *m,
   d->stack_size = default_max_nesting;
   d->status = NULL;
 
+#ifdef UPB_PBDECODER_STATS
+  memset(&d->stats, 0, sizeof(d->stats));
+  if (!upb_env_addcleanup(e, addglobalstats, d)) {
+    return NULL;
+  }
+#endif
+
   upb_pbdecoder_reset(d);
   upb_bytessink_reset(&d->input_, &m->input_handler_, d);
 
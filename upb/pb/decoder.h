@@ -21,6 +21,7 @@
 namespace upb {
 namespace pb {
 class CodeCache;
+class CodeProfile;
 class Decoder;
 class DecoderMethod;
 class DecoderMethodOptions;
@@ -29,6 +30,7 @@ class DecoderMethodOptions;
 #endif
 
 UPB_DECLARE_TYPE(upb::pb::CodeCache, upb_pbcodecache)
+UPB_DECLARE_TYPE(upb::pb::CodeProfile, upb_pbcodeprofile)
 UPB_DECLARE_TYPE(upb::pb::Decoder, upb_pbdecoder)
 UPB_DECLARE_TYPE(upb::pb::DecoderMethodOptions, upb_pbdecodermethodopts)
 
@@ -57,11 +59,57 @@ class upb::pb::DecoderMethodOptions {
    * them?  The caller should set this iff the lazy handlers expect data that is
    * in protobuf binary format and the caller wishes to lazy parse it. */
   void set_lazy(bool lazy);
+
+  /* Should the decoder fail on string fields that are not valid UTF-8?  The
+   * check is done as the string data is parsed, before it is passed to the
+   * string handler.  Methods that validate are never JIT-compiled. */
+  void set_validate_utf8(bool validate);
+
+  /* Should decoders using this method record the order fields arrive in?
+   * Each field is looked up in the dispatch table rather than expected after
+   * the previous one, and is counted in |profile|, which must outlive the
+   * method.  This is slower, so it is meant for decoding a representative
+   * sample of input; pass the profile to set_field_order() afterwards.
+   * Profiling methods are never JIT-compiled, and must only be used by one
+   * thread at a time. */
+  void set_profile(CodeProfile* profile);
+
+  /* Should fields be expected in the order they arrived in while |profile| was
+   * recorded, rather than in field number order?  The decoder checks for the
+   * field it expects next before it falls back to a table lookup, so this
+   * makes the check hit more often for input whose fields are in a stable but
+   * different order.  The profile is only read when the code is compiled. */
+  void set_field_order(const CodeProfile* profile);
 #else
 struct upb_pbdecodermethodopts {
 #endif
   const upb_handlers *handlers;
   bool lazy;
+  bool validate_utf8;
+  upb_pbcodeprofile *profile;
+  const upb_pbcodeprofile *field_order;
+};
+
+#ifdef __cplusplus
+
+/* Statistics about the order that fields arrive in, recorded by decoders using
+ * a method compiled with DecoderMethodOptions::set_profile(). */
+class upb::pb::CodeProfile {
+ public:
+  CodeProfile();
+  ~CodeProfile();
+
+  /* How many times field |f| was seen.  Consecutive elements of a repeated
+   * field count once. */
+  uint64_t field_count(const FieldDef* f) const;
+
+ private:
+  UPB_DISALLOW_COPY_AND_ASSIGN(CodeProfile)
+#else
+struct upb_pbcodeprofile {
+#endif
+  /* upb_msgdef* -> upb_inttable* of field number -> statistics. */
+  upb_inttable msgs;
 };
 
 #ifdef __cplusplus
@@ -94,11 +142,47 @@ class upb::pb::DecoderMethod {
 
 #endif
 
+/* Counters of where a decoder spends its time, for finding schemas and
+ * producers that keep it off its fast paths.  They are only kept if upb is
+ * built with UPB_PBDECODER_STATS defined (for example with
+ * "make USER_CPPFLAGS=-DUPB_PBDECODER_STATS"); otherwise they read as zero and
+ * cost nothing.  The JIT only updates the counters in the slow paths it
+ * shares with the bytecode decoder, so with the JIT most tag checks go
+ * uncounted.  A value that is split across buffers may be counted more than
+ * once, since the decoder retries it when the rest arrives. */
+typedef struct {
+  /* Tags that matched the field the code expected next. */
+  uint64_t tag_hits;
+
+  /* Tags that had to be looked up in the dispatch table instead. */
+  uint64_t dispatches;
+
+  /* Unknown fields (and ENDGROUP tags) skipped. */
+  uint64_t unknown_fields;
+
+  /* Varints too long, or too close to the end of the buffer, for the fast
+   * path. */
+  uint64_t slow_varints;
+
+  /* Times the decoder stopped before the end of a buffer, either because of
+   * an error or because a handler asked it to. */
+  uint64_t suspends;
+
+  /* Times a value was split across buffers, so its start was copied to the
+   * residual buffer to wait for the rest, and the number of bytes copied. */
+  uint64_t residual_saves;
+  uint64_t residual_bytes;
+} upb_pbdecoderstats;
+
 /* Preallocation hint: decoder won't allocate more bytes than this when first
  * constructed.  This hint may be an overestimate for some build configurations.
  * But if the decoder library is upgraded without recompiling the application,
  * it may be an underestimate. */
+#ifdef UPB_PBDECODER_STATS
+#define UPB_PB_DECODER_SIZE 4544
+#else
 #define UPB_PB_DECODER_SIZE 4416
+#endif
 
 #ifdef __cplusplus
 
@@ -139,8 +223,19 @@ class upb::pb::Decoder {
   size_t max_nesting() const;
   bool set_max_nesting(size_t max);
 
+  /* Abandons any input decoded so far, so that the decoder can start on a new
+   * message.  Its stacks are kept, so a decoder that is reused this way does
+   * not allocate again. */
   void Reset();
 
+  /* Copies this decoder's counters into |stats|.  They count everything it
+   * has decoded since it was created, across calls to Reset(). */
+  void GetStats(upb_pbdecoderstats* stats) const;
+
+  /* Copies the sum of the counters of every decoder whose Environment has
+   * been destroyed into |stats|.  Thread-safe. */
+  static void GetGlobalStats(upb_pbdecoderstats* stats);
+
   static const size_t kSize = UPB_PB_DECODER_SIZE;
 
  private:
@@ -154,7 +249,12 @@ class upb::pb::Decoder {
 /* A class for caching protobuf processing code, whether bytecode for the
  * interpreted decoder or machine code for the JIT.
  *
- * This class is not thread-safe.
+ * GetDecoderMethod() is thread-safe, so one cache can be shared by all the
+ * threads of a process: code is compiled once per set of handlers and options
+ * no matter how many threads ask for it, and lookups of code that is already
+ * compiled take no locks.  The returned DecoderMethods may be used (and
+ * ref'd) from any thread.  Construction, set_allow_jit() and destruction are
+ * not thread-safe.
  *
  * TODO(haberman): move this to be heap allocated for ABI stability. */
 class upb::pb::CodeCache {
@@ -182,9 +282,30 @@ class upb::pb::CodeCache {
    * statically bound to the destination handlers if possible, which can allow
    * more efficient decoding.  However the returned method may or may not
    * actually be statically bound.  But in all cases, the returned method can
-   * push data to the given handlers. */
+   * push data to the given handlers.
+   *
+   * The cache owns the method, which lives as long as the cache does unless
+   * the caller takes a ref on it.  Returns NULL if out of memory. */
   const DecoderMethod *GetDecoderMethod(const DecoderMethodOptions& opts);
 
+  /* Compiles the bytecode for |opts| and serializes it into a buffer allocated
+   * from |arena|, so a later process can Load() it instead of compiling.
+   * Returns the buffer and its length in |*size|, or NULL if out of memory.
+   * The buffer can be written to a file or embedded in the program as a C
+   * array.  It is only valid for the same build of upb on the same
+   * platform. */
+  static char *Serialize(const DecoderMethodOptions& opts, Arena* arena,
+                         size_t* size);
+
+  /* Adds the code serialized by Serialize() to the cache, so that
+   * GetDecoderMethod() for the same options (or for any sub-handlers) returns
+   * it without compiling.  Fails and sets |status| if the code was serialized
+   * for handlers, msgdefs or options that don't match |opts| (as verified by a
+   * fingerprint of everything the compiler looks at), or for another build.
+   * The machine code is still generated here if the JIT is allowed. */
+  bool Load(const DecoderMethodOptions& opts, const char* buf, size_t size,
+            Status* status);
+
   /* If/when someone needs to explicitly create a dynamically-bound
    * DecoderMethod*, we can add a method to get it here. */
 
@@ -195,8 +316,11 @@ struct upb_pbcodecache {
 #endif
   bool allow_jit_;
 
-  /* Array of mgroups. */
-  upb_inttable groups;
+  /* Lock-free list of compiled mgroups; see compile_decoder.c. */
+  void *entries;
+
+  /* Spinlock, held while compiling a new entry. */
+  int lock;
 };
 
 UPB_BEGIN_EXTERN_C
@@ -210,10 +334,23 @@ uint64_t upb_pbdecoder_bytesparsed(const upb_pbdecoder *d);
 size_t upb_pbdecoder_maxnesting(const upb_pbdecoder *d);
 bool upb_pbdecoder_setmaxnesting(upb_pbdecoder *d, size_t max);
 void upb_pbdecoder_reset(upb_pbdecoder *d);
+void upb_pbdecoder_getstats(const upb_pbdecoder *d, upb_pbdecoderstats *stats);
+void upb_pbdecoder_getglobalstats(upb_pbdecoderstats *stats);
 
 void upb_pbdecodermethodopts_init(upb_pbdecodermethodopts *opts,
                                   const upb_handlers *h);
 void upb_pbdecodermethodopts_setlazy(upb_pbdecodermethodopts *opts, bool lazy);
+void upb_pbdecodermethodopts_setvalidateutf8(upb_pbdecodermethodopts *opts,
+                                             bool validate);
+void upb_pbdecodermethodopts_setprofile(upb_pbdecodermethodopts *opts,
+                                        upb_pbcodeprofile *profile);
+void upb_pbdecodermethodopts_setfieldorder(upb_pbdecodermethodopts *opts,
+                                           const upb_pbcodeprofile *profile);
+
+void upb_pbcodeprofile_init(upb_pbcodeprofile *p);
+void upb_pbcodeprofile_uninit(upb_pbcodeprofile *p);
+uint64_t upb_pbcodeprofile_fieldcount(const upb_pbcodeprofile *p,
+                                      const upb_fielddef *f);
 
 
 /* Include refcounted methods like upb_pbdecodermethod_ref(). */
@@ -233,6 +370,11 @@ bool upb_pbcodecache_allowjit(const upb_pbcodecache *c);
 bool upb_pbcodecache_setallowjit(upb_pbcodecache *c, bool allow);
 const upb_pbdecodermethod *upb_pbcodecache_getdecodermethod(
     upb_pbcodecache *c, const upb_pbdecodermethodopts *opts);
+char *upb_pbcodecache_serialize(const upb_pbdecodermethodopts *opts,
+                                upb_arena *arena, size_t *size);
+bool upb_pbcodecache_load(upb_pbcodecache *c,
+                          const upb_pbdecodermethodopts *opts,
+                          const char *buf, size_t size, upb_status *status);
 
 UPB_END_EXTERN_C
 
@@ -263,6 +405,13 @@ inline bool Decoder::set_max_nesting(size_t max) {
   return upb_pbdecoder_setmaxnesting(this, max);
 }
 inline void Decoder::Reset() { upb_pbdecoder_reset(this); }
+inline void Decoder::GetStats(upb_pbdecoderstats* stats) const {
+  upb_pbdecoder_getstats(this, stats);
+}
+/* static */
+inline void Decoder::GetGlobalStats(upb_pbdecoderstats* stats) {
+  upb_pbdecoder_getglobalstats(stats);
+}
 
 inline DecoderMethodOptions::DecoderMethodOptions(const Handlers* h) {
   upb_pbdecodermethodopts_init(this, h);
@@ -270,6 +419,25 @@ inline DecoderMethodOptions::DecoderMethodOptions(const Handlers* h) {
 inline void DecoderMethodOptions::set_lazy(bool lazy) {
   upb_pbdecodermethodopts_setlazy(this, lazy);
 }
+inline void DecoderMethodOptions::set_validate_utf8(bool validate) {
+  upb_pbdecodermethodopts_setvalidateutf8(this, validate);
+}
+inline void DecoderMethodOptions::set_profile(CodeProfile* profile) {
+  upb_pbdecodermethodopts_setprofile(this, profile);
+}
+inline void DecoderMethodOptions::set_field_order(const CodeProfile* profile) {
+  upb_pbdecodermethodopts_setfieldorder(this, profile);
+}
+
+inline CodeProfile::CodeProfile() {
+  upb_pbcodeprofile_init(this);
+}
+inline CodeProfile::~CodeProfile() {
+  upb_pbcodeprofile_uninit(this);
+}
+inline uint64_t CodeProfile::field_count(const FieldDef* f) const {
+  return upb_pbcodeprofile_fieldcount(this, f);
+}
 
 inline const Handlers* DecoderMethod::dest_handlers() const {
   return upb_pbdecodermethod_desthandlers(this);
@@ -303,6 +471,15 @@ inline const DecoderMethod *CodeCache::GetDecoderMethod(
     const DecoderMethodOptions& opts) {
   return upb_pbcodecache_getdecodermethod(this, &opts);
 }
+/* static */
+inline char *CodeCache::Serialize(const DecoderMethodOptions& opts,
+                                  Arena* arena, size_t* size) {
+  return upb_pbcodecache_serialize(&opts, arena, size);
+}
+inline bool CodeCache::Load(const DecoderMethodOptions& opts, const char* buf,
+                            size_t size, Status* status) {
+  return upb_pbcodecache_load(this, &opts, buf, size, status);
+}
 
 }  /* namespace pb */
 }  /* namespace upb */
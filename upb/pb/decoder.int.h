@@ -11,6 +11,7 @@
 #include "upb/sink.h"
 #include "upb/structdefs.int.h"
 #include "upb/table.int.h"
+#include "upb/utf8.int.h"
 
 /* C++ names are not actually used since this type isn't exposed to users. */
 #ifdef __cplusplus
@@ -77,13 +78,51 @@ typedef enum {
 
   OP_DISPATCH       = 36,  /* No arg. */
 
-  OP_HALT           = 37   /* No arg. */
+  OP_HALT           = 37,  /* No arg. */
+
+  OP_STRINGUTF8     = 38,  /* Like OP_STRING, but validates UTF-8. */
+
+  OP_PARSEARRAY     = 39,  /* two words: */
+                           /*   | array selector (24) | opc (8) | */
+                           /*   |   OP_PARSE_* opcode (32)      | */
+                           /* Parses one or more values of a packed field,
+                            * as many as are in the buffer up to a limit, and
+                            * passes them to the array handler together. */
+
+  /* Like OP_PARSE_*, but stores the value straight into the closure instead
+   * of calling a handler.  Arg is an index into the group's stores.  The
+   * compiler never emits this; it only appears once a group's bytecode has
+   * been specialized for the interpreter, so OP_MAX doesn't count it. */
+  OP_STORE          = 40,
+
+  /* Superinstructions, which run a common sequence of ops without
+   * dispatching each one.  Like OP_STORE, these only appear once a group's
+   * bytecode has been specialized for the interpreter.  Only the first op of
+   * the sequence is rewritten; the ops after it stay where they were, as its
+   * operands, so jumps into the middle of the sequence still work. */
+  OP_TAGPARSE       = 41,  /* OP_TAG1, then OP_PARSE_* or OP_STORE, then
+                            * OP_CHECKDELIM. */
+  OP_STRFIELD       = 42   /* OP_STARTSTR, then OP_STRING or OP_STRINGUTF8,
+                            * then OP_POP, then OP_ENDSTR if there is one. */
 } opcode;
 
-#define OP_MAX OP_HALT
+#define OP_MAX OP_PARSEARRAY
+#define OP_LAST OP_STRFIELD  /* Counting the interpreter's own opcodes. */
 
 UPB_INLINE opcode getop(uint32_t instr) { return instr & 0xff; }
 
+/* A primitive field whose handler only stores the value at a fixed offset
+ * into the closure, as upb_msg_setscalarhandler() handlers do.  The
+ * interpreter does the store itself for these with OP_STORE, which saves an
+ * indirect call per value. */
+typedef struct {
+  uint32_t offset;
+  uint32_t hasbyte;
+  uint8_t hasmask;     /* 0 if the field has no hasbit. */
+  uint8_t parse_type;  /* The OP_PARSE_* opcode this replaces. */
+  upb_selector_t sel;
+} upb_pbdecoder_store;
+
 /* Method group; represents a set of decoder methods that had their code
  * emitted together, and must therefore be freed together.  Immutable once
  * created.  It is possible we may want to expose this to users at some point.
@@ -112,6 +151,14 @@ struct mgroup {
   uint32_t *bytecode;
   uint32_t *bytecode_end;
 
+  /* The operands of the OP_STORE instructions in our bytecode, if any.  Owned
+   * by us. */
+  upb_pbdecoder_store *stores;
+
+  /* Where decoders using our methods record the fields they see, if the
+   * methods were compiled for profiling.  Not owned. */
+  upb_pbcodeprofile *profile;
+
 #ifdef UPB_USE_JIT_X64
   /* JIT-generated machine code, if any. */
   upb_string_handlerfunc *jit_code;
@@ -156,6 +203,11 @@ typedef struct {
    * A positive number indicates a known group.
    * A negative number indicates an unknown group. */
   int32_t groupnum;
+
+  /* How many fields of this message have been dispatched so far.  Only kept
+   * up to date by the bytecode decoder for profiling methods. */
+  uint32_t fieldpos;
+
   upb_inttable *dispatch;  /* Not used by the JIT. */
 } upb_pbdecoder_frame;
 
@@ -227,6 +279,9 @@ struct upb_pbdecoder {
    * user buffer. */
   size_t skip;
 
+  /* Progress through the string being parsed, for OP_STRINGUTF8. */
+  upb_utf8state utf8state;
+
   /* Stores the user buffer passed to our decode function. */
   const char *buf_param;
   size_t size_param;
@@ -239,6 +294,10 @@ struct upb_pbdecoder {
 
   upb_status *status;
 
+#ifdef UPB_PBDECODER_STATS
+  upb_pbdecoderstats stats;
+#endif
+
 #ifdef UPB_USE_JIT_X64
   /* Used momentarily by the generated code to store a value while a user
    * function is called. */
@@ -271,6 +330,11 @@ void upb_pbdecoder_seterr(upb_pbdecoder *d, const char *msg);
 extern const char *kPbDecoderStackOverflow;
 extern const char *kPbDecoderSubmessageTooLong;
 
+/* Records that field |fieldnum| of |m| was seen at position |pos| (counting
+ * from zero) of a message, for methods compiled with a profile. */
+void upb_pbcodeprofile_record(upb_pbcodeprofile *p, const upb_msgdef *m,
+                              uint32_t fieldnum, uint32_t pos);
+
 /* Access to decoderplan members needed by the decoder. */
 const char *upb_pbdecoder_getopname(unsigned int op);
 
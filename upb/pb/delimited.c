@@ -0,0 +1,291 @@
+/*
+** upb_delimreader and upb_delimwriter.
+*/
+
+#include "upb/pb/delimited.h"
+
+#include <string.h>
+
+#include "upb/encode.h"
+
+struct upb_delimreader {
+  upb_env *env;
+  const upb_msglayout *layout;
+  int options;
+  upb_delimreader_func *func;
+  void *closure;
+
+  upb_byteshandler input_handler_;
+  upb_bytessink input_;
+
+  upb_arena arena;
+  size_t max_size;
+
+  /* The length prefix read so far, and how many bits of it we have. */
+  uint64_t prefix;
+  int shift;
+
+  /* Whether we have read the prefix of the current message, and its size. */
+  bool in_body;
+  size_t size;
+
+  /* The part of the current message we have buffered, if it is split across
+   * input buffers. */
+  char *buf;
+  size_t buf_len;
+  size_t buf_size;
+
+  upb_status status;
+};
+
+struct upb_delimwriter {
+  upb_env *env;
+  upb_bytesbuf output_;
+  bool started;
+
+  /* For messages too large for |output_|'s buffer. */
+  char *buf;
+  size_t buf_size;
+};
+
+static bool reader_seterr(upb_delimreader *r, const char *msg) {
+  upb_status_seterrmsg(&r->status, msg);
+  upb_env_reporterror(r->env, &r->status);
+  return false;
+}
+
+static void reader_uninit(void *ud) {
+  upb_arena_uninit(ud);
+}
+
+/* Decodes one message and passes it on.  Sets *stop if the callback asked us
+ * to. */
+static bool reader_decode(upb_delimreader *r, const char *data, size_t n,
+                          bool *stop) {
+  upb_msg *msg;
+
+  upb_arena_reset(&r->arena);
+  msg = upb_msg_new(r->layout, &r->arena);
+  if (!msg) {
+    return reader_seterr(r, "Out of memory allocating message.");
+  }
+
+  if (!upb_decode2(upb_stringview_make(data, n), msg, r->layout,
+                   r->options)) {
+    return reader_seterr(r, "Failed to parse message.");
+  }
+
+  r->in_body = false;
+  *stop = !r->func(r->closure, msg);
+  return true;
+}
+
+static bool reader_reserve(upb_delimreader *r, size_t need) {
+  void *mem;
+  size_t new_size;
+
+  if (need <= r->buf_size) return true;
+
+  new_size = UPB_MAX(need, r->buf_size * 2);
+  mem = upb_env_realloc(r->env, r->buf, r->buf_size, new_size);
+  if (!mem) {
+    return reader_seterr(r, "Out of memory allocating buffer.");
+  }
+
+  r->buf = mem;
+  r->buf_size = new_size;
+  return true;
+}
+
+static void *reader_start(void *closure, const void *hd, size_t size_hint) {
+  UPB_UNUSED(hd);
+  UPB_UNUSED(size_hint);
+  return closure;
+}
+
+static size_t reader_putbuf(void *closure, const void *hd, const char *buf,
+                            size_t len, const upb_bufhandle *handle) {
+  upb_delimreader *r = closure;
+  const char *ptr = buf;
+  const char *end = buf + len;
+  bool stop = false;
+  UPB_UNUSED(hd);
+  UPB_UNUSED(handle);
+
+  if (!upb_ok(&r->status)) return 0;
+
+  while (!stop) {
+    if (!r->in_body) {
+      unsigned char byte;
+
+      if (ptr == end) break;
+      byte = *ptr++;
+
+      if (r->shift >= 64) {
+        reader_seterr(r, "Malformed length prefix.");
+        return ptr - buf;
+      }
+      r->prefix |= (uint64_t)(byte & 0x7f) << r->shift;
+      r->shift += 7;
+      if (byte & 0x80) continue;
+
+      if (r->prefix > r->max_size) {
+        reader_seterr(r, "Message larger than the maximum size.");
+        return ptr - buf;
+      }
+
+      r->in_body = true;
+      r->size = r->prefix;
+      r->prefix = 0;
+      r->shift = 0;
+    }
+
+    if (r->buf_len == 0 && (size_t)(end - ptr) >= r->size) {
+      /* The common case: the whole message is in this buffer. */
+      if (!reader_decode(r, ptr, r->size, &stop)) return ptr - buf;
+      ptr += r->size;
+    } else {
+      size_t n = UPB_MIN(r->size - r->buf_len, (size_t)(end - ptr));
+
+      if (n == 0) break;
+      if (!reader_reserve(r, r->size)) return ptr - buf;
+      memcpy(r->buf + r->buf_len, ptr, n);
+      r->buf_len += n;
+      ptr += n;
+
+      if (r->buf_len == r->size) {
+        r->buf_len = 0;
+        if (!reader_decode(r, r->buf, r->size, &stop)) return ptr - buf;
+      }
+    }
+  }
+
+  return ptr - buf;
+}
+
+static bool reader_end(void *closure, const void *hd) {
+  upb_delimreader *r = closure;
+  UPB_UNUSED(hd);
+
+  if (!upb_ok(&r->status)) return false;
+
+  if (r->in_body || r->shift > 0) {
+    return reader_seterr(r, "Stream ended in the middle of a message.");
+  }
+
+  return true;
+}
+
+
+/* Public API *****************************************************************/
+
+upb_delimreader *upb_delimreader_create(upb_env *env, const upb_msglayout *l,
+                                        int options,
+                                        upb_delimreader_func *func,
+                                        void *closure) {
+  upb_delimreader *r = upb_env_malloc(env, sizeof(upb_delimreader));
+  if (!r) return NULL;
+
+  /* Our arena gets its blocks from where the environment's arena does, and
+   * keeps all of them across resets: after the largest message so far, the
+   * next one allocates nothing. */
+  upb_arena_init2(&r->arena, NULL, 0, upb_env_arena(env)->block_alloc);
+  upb_arena_setmaxretained(&r->arena, SIZE_MAX);
+  if (!upb_env_addcleanup(env, reader_uninit, &r->arena)) {
+    upb_arena_uninit(&r->arena);
+    return NULL;
+  }
+
+  r->env = env;
+  r->layout = l;
+  r->options = options;
+  r->func = func;
+  r->closure = closure;
+  r->max_size = INT32_MAX;
+  r->buf = NULL;
+  r->buf_size = 0;
+
+  upb_byteshandler_init(&r->input_handler_);
+  upb_byteshandler_setstartstr(&r->input_handler_, reader_start, NULL);
+  upb_byteshandler_setstring(&r->input_handler_, reader_putbuf, NULL);
+  upb_byteshandler_setendstr(&r->input_handler_, reader_end, NULL);
+  upb_bytessink_reset(&r->input_, &r->input_handler_, r);
+
+  upb_delimreader_reset(r);
+  return r;
+}
+
+upb_bytessink *upb_delimreader_input(upb_delimreader *r) {
+  return &r->input_;
+}
+
+upb_arena *upb_delimreader_arena(upb_delimreader *r) { return &r->arena; }
+
+void upb_delimreader_setmaxsize(upb_delimreader *r, size_t size) {
+  r->max_size = size;
+}
+
+void upb_delimreader_reset(upb_delimreader *r) {
+  r->prefix = 0;
+  r->shift = 0;
+  r->in_body = false;
+  r->size = 0;
+  r->buf_len = 0;
+  upb_status_clear(&r->status);
+}
+
+upb_delimwriter *upb_delimwriter_create(upb_env *env, upb_bytessink *output) {
+  upb_delimwriter *w = upb_env_malloc(env, sizeof(upb_delimwriter));
+  if (!w) return NULL;
+
+  if (!upb_bytesbuf_init(&w->output_, env, UPB_BYTESBUF_DEFAULTSIZE,
+                         output)) {
+    return NULL;
+  }
+
+  w->env = env;
+  w->started = false;
+  w->buf = NULL;
+  w->buf_size = 0;
+  return w;
+}
+
+bool upb_delimwriter_put(upb_delimwriter *w, const upb_msg *msg,
+                         const upb_msglayout *l) {
+  upb_bytesbuf *b = &w->output_;
+  size_t n;
+
+  if (!w->started) {
+    if (!upb_bytesbuf_start(b, 0)) return false;
+    w->started = true;
+  }
+
+  /* Encode in place if the message fits in what is left of the buffer, or
+   * else in an empty buffer. */
+  n = upb_encode_delimited_tobuf(msg, l, b->ptr, b->end - b->ptr);
+  if (n <= (size_t)(b->end - b->ptr)) {
+    b->ptr += n;
+    return true;
+  } else if (n <= (size_t)(b->end - b->buf)) {
+    if (!upb_bytesbuf_flush(b)) return false;
+    b->ptr += upb_encode_delimited_tobuf(msg, l, b->ptr, b->end - b->ptr);
+    return true;
+  }
+
+  /* Too large for the buffer: encode it on the side, and it goes straight
+   * through to the output. */
+  if (n > w->buf_size) {
+    void *mem = upb_env_realloc(w->env, w->buf, w->buf_size, n);
+    if (!mem) return false;
+    w->buf = mem;
+    w->buf_size = n;
+  }
+  upb_encode_delimited_tobuf(msg, l, w->buf, n);
+  return upb_bytesbuf_put(b, w->buf, n);
+}
+
+bool upb_delimwriter_end(upb_delimwriter *w) {
+  if (!w->started && !upb_bytesbuf_start(&w->output_, 0)) return false;
+  w->started = false;
+  return upb_bytesbuf_end(&w->output_);
+}
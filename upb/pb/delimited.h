@@ -0,0 +1,82 @@
+/*
+** Streams of length-delimited messages: each message is preceded by its size
+** as a varint, as written by protobuf's writeDelimitedTo().
+**
+** upb_delimreader splits the data pushed to its input sink into messages and
+** upb_decode()s each one.  A message that lies entirely in one input buffer is
+** decoded where it is; only a message split across buffers is copied, into a
+** buffer the reader keeps for the next one.  All messages are decoded into one
+** arena, which is reset before each message, so a long stream settles into
+** allocating nothing at all.
+**
+** upb_delimwriter does the reverse, upb_encode()ing each message (with its
+** prefix) straight into the output buffer of a upb_bytesbuf.
+*/
+
+#ifndef UPB_PB_DELIMITED_H_
+#define UPB_PB_DELIMITED_H_
+
+#include "upb/decode.h"
+#include "upb/sink.h"
+
+UPB_BEGIN_EXTERN_C
+
+/* upb_delimreader ************************************************************/
+
+typedef struct upb_delimreader upb_delimreader;
+
+/* Called with each message of the stream.  The message, and any string data
+ * in it that aliases the input, is only valid until the callback returns.
+ * Returning false stops the reader after this message: the input sink's
+ * putbuf returns the number of bytes up to the end of the message, and the
+ * caller may push the rest of the buffer later to carry on. */
+typedef bool upb_delimreader_func(void *closure, upb_msg *msg);
+
+/* Creates a reader that decodes messages of layout |l| with upb_decode2()
+ * |options| and passes each one to |func|.  Malformed input, or a message
+ * that fails to parse, is reported to |env| and stops the stream. */
+upb_delimreader *upb_delimreader_create(upb_env *env, const upb_msglayout *l,
+                                        int options,
+                                        upb_delimreader_func *func,
+                                        void *closure);
+
+/* The sink to push the stream to.  Ending it in the middle of a message is an
+ * error. */
+upb_bytessink *upb_delimreader_input(upb_delimreader *r);
+
+/* The arena that messages are decoded into.  By default it keeps every block
+ * between messages; cap that with upb_arena_setmaxretained() if one huge
+ * message should not pin its memory for the rest of the stream. */
+upb_arena *upb_delimreader_arena(upb_delimreader *r);
+
+/* Messages larger than |size| bytes are an error.  Defaults to INT32_MAX, the
+ * largest message protobuf can encode. */
+void upb_delimreader_setmaxsize(upb_delimreader *r, size_t size);
+
+/* Abandons any partial message and clears any error, so that the reader can
+ * start on a new stream. */
+void upb_delimreader_reset(upb_delimreader *r);
+
+
+/* upb_delimwriter ************************************************************/
+
+typedef struct upb_delimwriter upb_delimwriter;
+
+/* Creates a writer that writes to |output|.  Writes are collected in a buffer
+ * of UPB_BYTESBUF_DEFAULTSIZE bytes, so many small messages cost few calls
+ * into |output|. */
+upb_delimwriter *upb_delimwriter_create(upb_env *env, upb_bytessink *output);
+
+/* Appends |msg|, which has layout |l|, to the stream.  The first message of a
+ * stream starts the output sink.  Returns false if out of memory or if the
+ * output did not accept the data. */
+bool upb_delimwriter_put(upb_delimwriter *w, const upb_msg *msg,
+                         const upb_msglayout *l);
+
+/* Flushes the buffer and ends the output.  The next message starts a new
+ * stream. */
+bool upb_delimwriter_end(upb_delimwriter *w);
+
+UPB_END_EXTERN_C
+
+#endif  /* UPB_PB_DELIMITED_H_ */
@@ -47,6 +47,11 @@
 ** So for now, we implement (1) only.  If we wish to optimize later, we should
 ** be able to do it without affecting users.
 **
+** There is one way around buffering: if the caller can write the same message
+** twice, the first pass can measure every length (see
+** upb_pb_encoder_measure()).  The second pass then writes each length as soon
+** as its region starts, and streams everything else straight to the output.
+**
 ** The strategy is to buffer the segments of data that do *not* depend on
 ** unknown lengths in one buffer, and keep a separate buffer of segment pointers
 ** and lengths.  When the top-level submessage ends, we can go beginning to end,
@@ -90,16 +95,26 @@ typedef struct {
   uint32_t seglen;  /* Length of the segment. */
 } upb_pb_encoder_segment;
 
+/* How the encoder gets the length of each delimited region. */
+typedef enum {
+  /* Buffer the region until it ends, as described above. */
+  UPB_PB_ENCODER_BUFFER,
+
+  /* Write nothing; just record the length of each region. */
+  UPB_PB_ENCODER_MEASURE,
+
+  /* Take each length from the ones recorded by the last UPB_PB_ENCODER_MEASURE
+   * pass, and write everything as soon as it is encoded. */
+  UPB_PB_ENCODER_STREAM
+} upb_pb_encoder_mode;
+
 struct upb_pb_encoder {
   upb_env *env;
 
-  /* Our input and output. */
+  /* Our input and output.  The output is buffered, so that the many small
+   * runs we emit (top-level fields, length prefixes) are coalesced. */
   upb_sink input_;
-  upb_bytessink *output_;
-
-  /* The "subclosure" -- used as the inner closure as part of the bytessink
-   * protocol. */
-  void *subc;
+  upb_bytesbuf output_;
 
   /* The output buffer and limit, and our current write position.  "buf"
    * initially points to "initbuf", but is dynamically allocated if we need to
@@ -119,6 +134,26 @@ struct upb_pb_encoder {
 
   /* Depth of startmsg/endmsg calls. */
   int depth;
+
+  upb_pb_encoder_mode mode;
+
+  /* The number of bytes of the current message that have been committed. */
+  size_t pos;
+
+  /* When measuring or streaming, the length of every delimited region of the
+   * message, in the order the regions start.  While a region is open, its
+   * entry holds a position instead: where it starts (when measuring) or where
+   * it must end (when streaming). */
+  size_t *sizes;
+  size_t sizecount, sizecap;
+
+  /* When streaming, the entry of "sizes" for the next region to start. */
+  size_t nextsize;
+
+  /* When measuring or streaming, the "sizes" entries of the open regions.
+   * Allocated when the first region starts, so that an encoder that only
+   * buffers stays within UPB_PB_ENCODER_SIZE. */
+  size_t *knownstack, *knowntop;
 };
 
 /* low-level buffering ********************************************************/
@@ -127,8 +162,8 @@ struct upb_pb_encoder {
 
 /* TODO(haberman): handle pushback */
 static void putbuf(upb_pb_encoder *e, const char *buf, size_t len) {
-  size_t n = upb_bytessink_putbuf(e->output_, e->subc, buf, len, NULL);
-  UPB_ASSERT(n == len);
+  bool ok = upb_bytesbuf_put(&e->output_, buf, len);
+  UPB_ASSERT(ok);
 }
 
 static upb_pb_encoder_segment *top(upb_pb_encoder *e) {
@@ -176,12 +211,12 @@ static void encoder_advance(upb_pb_encoder *e, size_t bytes) {
  * bytes if possible and necessary, returning false if this failed. */
 static bool commit(upb_pb_encoder *e) {
   if (!e->top) {
-    /* We aren't inside a delimited region.  Flush our accumulated bytes to
-     * the output.
-     *
-     * TODO(haberman): in the future we may want to delay flushing for
-     * efficiency reasons. */
-    putbuf(e, e->buf, e->ptr - e->buf);
+    /* We aren't buffering a delimited region.  Flush our accumulated bytes to
+     * the output, which buffers them further. */
+    e->pos += e->ptr - e->buf;
+    if (e->mode != UPB_PB_ENCODER_MEASURE) {
+      putbuf(e, e->buf, e->ptr - e->buf);
+    }
     e->ptr = e->buf;
   }
 
@@ -210,10 +245,85 @@ static void accumulate(upb_pb_encoder *e) {
   e->runbegin = e->ptr;
 }
 
+/* Call to indicate the start of a delimited region when measuring or
+ * streaming.  Everything before it must have been committed. */
+static bool start_known(upb_pb_encoder *e) {
+  size_t i;
+
+  if (!e->knownstack) {
+    e->knownstack = upb_env_malloc(
+        e->env, UPB_PBENCODER_MAX_NESTING * sizeof(*e->knownstack));
+    if (e->knownstack == NULL) {
+      return false;
+    }
+    e->knowntop = e->knownstack;
+  }
+
+  if (e->knowntop == e->knownstack + UPB_PBENCODER_MAX_NESTING) {
+    return false;
+  }
+
+  if (e->mode == UPB_PB_ENCODER_MEASURE) {
+    if (e->sizecount == e->sizecap) {
+      size_t new_cap = UPB_MAX(e->sizecap * 2, 16);
+      size_t *new_sizes =
+          upb_env_realloc(e->env, e->sizes, e->sizecap * sizeof(*e->sizes),
+                          new_cap * sizeof(*e->sizes));
+      if (new_sizes == NULL) {
+        return false;
+      }
+      e->sizes = new_sizes;
+      e->sizecap = new_cap;
+    }
+    i = e->sizecount++;
+    e->sizes[i] = e->pos;
+  } else {
+    /* The message must be the one that was measured. */
+    if (e->nextsize == e->sizecount) {
+      return false;
+    }
+    i = e->nextsize++;
+    if (!reserve(e, UPB_PB_VARINT_MAX_LEN)) {
+      return false;
+    }
+    encoder_advance(e, upb_vencode64(e->sizes[i], e->ptr));
+    commit(e);
+    e->sizes[i] += e->pos;
+  }
+
+  *e->knowntop++ = i;
+  return true;
+}
+
+/* Call to indicate the end of a delimited region when measuring or
+ * streaming. */
+static bool end_known(upb_pb_encoder *e) {
+  size_t i;
+
+  commit(e);
+  UPB_ASSERT(e->knowntop > e->knownstack);
+  i = *--e->knowntop;
+
+  if (e->mode == UPB_PB_ENCODER_MEASURE) {
+    e->sizes[i] = e->pos - e->sizes[i];
+    e->pos += upb_varint_size(e->sizes[i]);
+    return true;
+  } else {
+    /* A region that isn't the length that was measured means that this isn't
+     * the message that was measured.  What has already been written is
+     * garbage. */
+    return e->pos == e->sizes[i];
+  }
+}
+
 /* Call to indicate the start of delimited region for which the full length is
  * not yet known.  All data will be buffered until the length is known.
  * Delimited regions may be nested; their lengths will all be tracked properly. */
 static bool start_delim(upb_pb_encoder *e) {
+  if (e->mode != UPB_PB_ENCODER_BUFFER) {
+    return start_known(e);
+  }
+
   if (e->top) {
     /* We are already buffering, advance to the next segment and push it on the
      * stack. */
@@ -259,6 +369,11 @@ static bool start_delim(upb_pb_encoder *e) {
  * regions, we can now emit all of the buffered data we accumulated. */
 static bool end_delim(upb_pb_encoder *e) {
   size_t msglen;
+
+  if (e->mode != UPB_PB_ENCODER_BUFFER) {
+    return end_known(e);
+  }
+
   accumulate(e);
   msglen = top(e)->msglen;
 
@@ -354,7 +469,13 @@ static bool startmsg(void *c, const void *hd) {
   upb_pb_encoder *e = c;
   UPB_UNUSED(hd);
   if (e->depth++ == 0) {
-    upb_bytessink_start(e->output_, 0, &e->subc);
+    e->pos = 0;
+    e->nextsize = 0;
+    if (e->mode == UPB_PB_ENCODER_MEASURE) {
+      e->sizecount = 0;
+    } else {
+      upb_bytesbuf_start(&e->output_, 0);
+    }
   }
   return true;
 }
@@ -362,9 +483,26 @@ static bool startmsg(void *c, const void *hd) {
 static bool endmsg(void *c, const void *hd, upb_status *status) {
   upb_pb_encoder *e = c;
   UPB_UNUSED(hd);
-  UPB_UNUSED(status);
   if (--e->depth == 0) {
-    upb_bytessink_end(e->output_);
+    commit(e);
+    switch (e->mode) {
+      case UPB_PB_ENCODER_MEASURE:
+        /* The lengths are for the next message. */
+        e->mode = UPB_PB_ENCODER_STREAM;
+        return true;
+      case UPB_PB_ENCODER_STREAM:
+        e->mode = UPB_PB_ENCODER_BUFFER;
+        upb_bytesbuf_end(&e->output_);
+        if (e->nextsize != e->sizecount) {
+          upb_status_seterrmsg(status,
+                               "encoded message differs from measured one");
+          return false;
+        }
+        return true;
+      case UPB_PB_ENCODER_BUFFER:
+        upb_bytesbuf_end(&e->output_);
+        return true;
+    }
   }
   return true;
 }
@@ -400,8 +538,18 @@ static void *encode_startstr(void *c, const void *hd, size_t size_hint) {
 
 static size_t encode_strbuf(void *c, const void *hd, const char *buf,
                             size_t len, const upb_bufhandle *h) {
+  upb_pb_encoder *e = c;
   UPB_UNUSED(hd);
   UPB_UNUSED(h);
+  if (!e->top) {
+    /* Not buffering, so the data can go straight to the output. */
+    commit(e);
+    e->pos += len;
+    if (e->mode != UPB_PB_ENCODER_MEASURE) {
+      putbuf(e, buf, len);
+    }
+    return len;
+  }
   return encode_bytes(c, buf, len) ? len : 0;
 }
 
@@ -411,7 +559,7 @@ static size_t encode_strbuf(void *c, const void *hd, const char *buf,
   }                                                                      \
   static bool encode_packed_##type(void *e, const void *hd, ctype val) { \
     UPB_UNUSED(hd);                                                      \
-    return encode(e, (convert)(val));                                    \
+    return encode(e, (convert)(val)) && commit(e);                       \
   }
 
 T(double,   double,   dbl2uint64,   encode_fixed64)
@@ -518,9 +666,12 @@ static void newhandlers_callback(const void *closure, upb_handlers *h) {
 }
 
 void upb_pb_encoder_reset(upb_pb_encoder *e) {
+  e->ptr = e->buf;
   e->segptr = NULL;
   e->top = NULL;
   e->depth = 0;
+  e->mode = UPB_PB_ENCODER_BUFFER;
+  e->knowntop = e->knownstack;
 }
 
 
@@ -531,6 +682,10 @@ const upb_handlers *upb_pb_encoder_newhandlers(const upb_msgdef *m,
   return upb_handlers_newfrozen(m, owner, newhandlers_callback, NULL);
 }
 
+upb_handlercache *upb_pb_encoder_newcache() {
+  return upb_handlercache_new(newhandlers_callback, NULL);
+}
+
 upb_pb_encoder *upb_pb_encoder_create(upb_env *env, const upb_handlers *h,
                                       upb_bytessink *output) {
   const size_t initial_bufsize = 256;
@@ -547,22 +702,25 @@ upb_pb_encoder *upb_pb_encoder_create(upb_env *env, const upb_handlers *h,
   e->buf = upb_env_malloc(env, initial_bufsize);
   e->segbuf = upb_env_malloc(env, initial_segbufsize * sizeof(*e->segbuf));
   e->stack = upb_env_malloc(env, stack_size * sizeof(*e->stack));
+  e->knownstack = NULL;
 
-  if (!e->buf || !e->segbuf || !e->stack) {
+  if (!e->buf || !e->segbuf || !e->stack ||
+      !upb_bytesbuf_init(&e->output_, env, UPB_BYTESBUF_DEFAULTSIZE,
+                         output)) {
     return NULL;
   }
 
   e->limit = e->buf + initial_bufsize;
   e->seglimit = e->segbuf + initial_segbufsize;
   e->stacklimit = e->stack + stack_size;
+  e->sizes = NULL;
+  e->sizecount = 0;
+  e->sizecap = 0;
 
   upb_pb_encoder_reset(e);
   upb_sink_reset(&e->input_, h, e);
 
   e->env = env;
-  e->output_ = output;
-  e->subc = output->closure;
-  e->ptr = e->buf;
 
   /* If this fails, increase the value in encoder.h. */
   UPB_ASSERT_DEBUGVAR(upb_env_bytesallocated(env) - size_before <=
@@ -571,3 +729,8 @@ upb_pb_encoder *upb_pb_encoder_create(upb_env *env, const upb_handlers *h,
 }
 
 upb_sink *upb_pb_encoder_input(upb_pb_encoder *e) { return &e->input_; }
+
+void upb_pb_encoder_measure(upb_pb_encoder *e) {
+  UPB_ASSERT(e->depth == 0);
+  e->mode = UPB_PB_ENCODER_MEASURE;
+}
@@ -6,7 +6,9 @@
 **
 ** This encoder implementation does not have any access to any out-of-band or
 ** precomputed lengths for submessages, so it must buffer submessages internally
-** before it can emit the first byte.
+** before it can emit the first byte.  The exception is a message the caller
+** can write twice, once to measure it and once to stream it (see Measure()
+** below).
 */
 
 #ifndef UPB_ENCODER_H_
@@ -32,7 +34,7 @@ UPB_DECLARE_TYPE(upb::pb::Encoder, upb_pb_encoder)
  * constructed.  This hint may be an overestimate for some build configurations.
  * But if the decoder library is upgraded without recompiling the application,
  * it may be an underestimate. */
-#define UPB_PB_ENCODER_SIZE 768
+#define UPB_PB_ENCODER_SIZE 5088
 
 #ifdef __cplusplus
 
@@ -46,9 +48,29 @@ class upb::pb::Encoder {
   /* The input to the encoder. */
   Sink* input();
 
+  /* Abandons the message being encoded, if any, so that the encoder can
+   * start on a new one.  Its buffers are kept, so an encoder that is reused
+   * this way stops allocating once it has seen its largest message.  Any
+   * lengths recorded by Measure() are dropped. */
+  void Reset();
+
+  /* Makes the next message written to input() a measuring pass: nothing is
+   * written, but the length of every submessage, string and packed field is
+   * recorded.  The message written after that must be the same one.  It is
+   * then encoded without buffering anything but the length prefixes, so its
+   * output starts right away and memory use doesn't grow with its size.
+   *
+   * If the second message isn't the same, its output isn't valid and one of
+   * its handlers fails.  Must not be called in the middle of a message. */
+  void Measure();
+
   /* Creates a new set of handlers for this MessageDef. */
   static reffed_ptr<const Handlers> NewHandlers(const MessageDef* msg);
 
+  /* Returns a new cache of the handlers NewHandlers() would return.  The
+   * caller owns the cache. */
+  static HandlerCache* NewCache();
+
   static const size_t kSize = UPB_PB_ENCODER_SIZE;
 
  private:
@@ -61,9 +83,12 @@ UPB_BEGIN_EXTERN_C
 
 const upb_handlers *upb_pb_encoder_newhandlers(const upb_msgdef *m,
                                                const void *owner);
+upb_handlercache *upb_pb_encoder_newcache();
 upb_sink *upb_pb_encoder_input(upb_pb_encoder *p);
+void upb_pb_encoder_reset(upb_pb_encoder *e);
 upb_pb_encoder* upb_pb_encoder_create(upb_env* e, const upb_handlers* h,
                                       upb_bytessink* output);
+void upb_pb_encoder_measure(upb_pb_encoder *e);
 
 UPB_END_EXTERN_C
 
@@ -78,11 +103,20 @@ inline Encoder* Encoder::Create(Environment* env, const Handlers* handlers,
 inline Sink* Encoder::input() {
   return upb_pb_encoder_input(this);
 }
+inline void Encoder::Reset() {
+  upb_pb_encoder_reset(this);
+}
+inline void Encoder::Measure() {
+  upb_pb_encoder_measure(this);
+}
 inline reffed_ptr<const Handlers> Encoder::NewHandlers(
     const upb::MessageDef *md) {
   const Handlers* h = upb_pb_encoder_newhandlers(md, &h);
   return reffed_ptr<const Handlers>(h, &h);
 }
+inline HandlerCache* Encoder::NewCache() {
+  return upb_pb_encoder_newcache();
+}
 }  /* namespace pb */
 }  /* namespace upb */
 
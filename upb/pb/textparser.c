@@ -0,0 +1,899 @@
+/*
+** upb::pb::TextParser
+**
+** A hand-written parser in two layers.  The lexer finds whitespace, comments,
+** punctuation, strings and "tokens" (identifiers and numbers) in the input,
+** and can stop in the middle of any of them when a buffer ends.  The grammar
+** layer is a small state machine driven by what the lexer finds, plus a stack
+** of the messages we are in.
+**
+** The only input the lexer ever copies is a token that is split across two
+** buffers.  Strings are never copied: runs of plain bytes are pushed to the
+** string handler straight from the input, and escapes are decoded and pushed
+** on their own.
+*/
+
+#include "upb/pb/textparser.h"
+
+#include <string.h>
+
+#include "upb/json/number.int.h"
+#include "upb/json/scan.int.h"
+
+#define UPB_TEXTPARSER_MAX_DEPTH 64
+
+typedef struct {
+  upb_sink sink;
+  const upb_msgdef *m;
+
+  /* The field of the enclosing message whose value this message is, the
+   * character that closes it ('}' or '>'), and whether that value was part of
+   * a "[...]" list.  NULL, 0 and false for the top-level message. */
+  const upb_fielddef *f;
+  char close;
+  bool in_list;
+
+  /* The repeated field whose sequence is open in this message, if any.
+   * Elements of a repeated field need not be adjacent in text format; each
+   * run of them becomes its own sequence, as in the protobuf decoder. */
+  const upb_fielddef *seqf;
+  upb_sink seqsink;
+} upb_textparser_frame;
+
+/* What the lexer is in the middle of (p->lex). */
+enum {
+  LEX_NONE,
+  LEX_COMMENT,
+  LEX_TOKEN,
+  LEX_STRING,
+  LEX_ESCAPE
+};
+
+/* What the grammar expects next (p->state). */
+enum {
+  /* A field name, or the end of the current message. */
+  STATE_FIELD,
+
+  /* The ':' after a field name, or for a message field the value itself. */
+  STATE_SEPARATOR,
+
+  /* A value. */
+  STATE_VALUE,
+
+  /* The first value of a "[...]" list, or the ']' of an empty one. */
+  STATE_LIST_FIRST,
+
+  /* The ',' or ']' after a value in a list. */
+  STATE_LIST_NEXT,
+
+  /* An optional ',' or ';' after a field's value, or the next field. */
+  STATE_AFTER_VALUE,
+
+  /* Another string literal, which continues the same string value. */
+  STATE_STRING_NEXT
+};
+
+struct upb_textparser {
+  upb_env *env;
+  upb_byteshandler input_handler_;
+  upb_bytessink input_;
+
+  upb_textparser_frame stack[UPB_TEXTPARSER_MAX_DEPTH];
+  upb_textparser_frame *top;
+  upb_textparser_frame *limit;
+
+  upb_status status;
+
+  int state;
+
+  /* The field whose value comes next, whether we are in a "[...]" list of its
+   * values, and whether a '-' came before the value. */
+  const upb_fielddef *f;
+  bool in_list;
+  bool negative;
+
+  int lex;
+
+  /* The handle for the current buffer. */
+  const upb_bufhandle *handle;
+
+  /* The string value being parsed: the quote character of the current
+   * literal, and the sink and selector for its data. */
+  char quote;
+  upb_sink strsink;
+  upb_selector_t strsel;
+
+  /* The escape sequence being parsed: 0 just after the backslash, otherwise
+   * 'o', 'x', 'u' or 'U' for the kind of numeric escape, with its value and
+   * number of digits so far. */
+  char esc;
+  uint32_t esc_val;
+  int esc_digits;
+
+  /* The start of a token that the previous buffer ended in the middle of. */
+  char *token_buf;
+  size_t token_len;
+  size_t token_size;
+};
+
+static upb_selector_t textsel(const upb_fielddef *f, upb_handlertype_t type) {
+  upb_selector_t sel;
+  bool ok = upb_handlers_getselector(f, type, &sel);
+  UPB_ASSERT(ok);
+  return sel;
+}
+
+static bool texterr(upb_textparser *p, const char *msg) {
+  upb_status_seterrmsg(&p->status, msg);
+  upb_env_reporterror(p->env, &p->status);
+  return false;
+}
+
+static bool seterr_token(upb_textparser *p, const char *msg, const char *tok,
+                         size_t len) {
+  upb_status_seterrf(&p->status, "%s: '%.*s'", msg, (int)len, tok);
+  upb_env_reporterror(p->env, &p->status);
+  return false;
+}
+
+/* The sink that values of p->f go to. */
+static upb_sink *valuesink(upb_textparser *p) {
+  return upb_fielddef_isseq(p->f) ? &p->top->seqsink : &p->top->sink;
+}
+
+static void textendseq(upb_textparser_frame *frame) {
+  if (frame->seqf) {
+    upb_sink_endseq(&frame->sink, textsel(frame->seqf, UPB_HANDLER_ENDSEQ));
+    frame->seqf = NULL;
+  }
+}
+
+static void after_value(upb_textparser *p) {
+  p->negative = false;
+  p->state = p->in_list ? STATE_LIST_NEXT : STATE_AFTER_VALUE;
+}
+
+static bool isvaluestate(upb_textparser *p) {
+  return p->state == STATE_VALUE || p->state == STATE_LIST_FIRST;
+}
+
+
+/* Numbers ********************************************************************/
+
+static bool isdigit_(char c) { return c >= '0' && c <= '9'; }
+
+static bool isalpha_(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+/* Returns true if |tok| is |lit| in any case. */
+static bool ieq(const char *tok, size_t len, const char *lit) {
+  size_t i;
+  if (len != strlen(lit)) return false;
+  for (i = 0; i < len; i++) {
+    char c = tok[i];
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    if (c != lit[i]) return false;
+  }
+  return true;
+}
+
+static bool ishex(const char *tok, size_t len) {
+  return len > 2 && tok[0] == '0' && (tok[1] == 'x' || tok[1] == 'X');
+}
+
+/* Parses a decimal, hex ("0x...") or octal ("0...") integer. */
+static bool parseuint(const char *tok, size_t len, uint64_t *val) {
+  const char *end = tok + len;
+  uint64_t ret = 0;
+
+  if (ishex(tok, len)) {
+    for (tok += 2; tok < end; tok++) {
+      char c = *tok;
+      unsigned d;
+      if (isdigit_(c)) {
+        d = c - '0';
+      } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        d = (c | 0x20) - 'a' + 10;
+      } else {
+        return false;
+      }
+      if (ret > UINT64_MAX >> 4) return false;
+      ret = ret << 4 | d;
+    }
+  } else if (len > 1 && tok[0] == '0') {
+    for (tok++; tok < end; tok++) {
+      unsigned d = (unsigned char)*tok - '0';
+      if (d > 7 || ret > UINT64_MAX >> 3) return false;
+      ret = ret << 3 | d;
+    }
+  } else {
+    return upb_json_parseuint64(tok, len, val);
+  }
+
+  *val = ret;
+  return true;
+}
+
+static bool parsedouble(const char *tok, size_t len, double *val) {
+  uint64_t u;
+
+  if (ieq(tok, len, "inf") || ieq(tok, len, "infinity")) {
+    *val = 1.0 / 0.0;
+    return true;
+  } else if (ieq(tok, len, "nan")) {
+    *val = 0.0 / 0.0;
+    return true;
+  } else if (ishex(tok, len)) {
+    if (!parseuint(tok, len, &u)) return false;
+    *val = (double)u;
+    return true;
+  }
+
+  /* A float literal may end in 'f', as in "1.5f". */
+  if (len > 1 && (tok[len - 1] == 'f' || tok[len - 1] == 'F')) {
+    len--;
+  }
+
+  return isdigit_(tok[0]) || tok[0] == '.'
+             ? upb_json_parsedouble(tok, len, val)
+             : false;
+}
+
+static bool putint(upb_textparser *p, upb_sink *sink, upb_selector_t sel,
+                   const char *tok, size_t len) {
+  uint64_t u;
+  bool neg = p->negative;
+
+  if (!parseuint(tok, len, &u)) {
+    return seterr_token(p, "Invalid integer", tok, len);
+  }
+
+  switch (upb_fielddef_type(p->f)) {
+    case UPB_TYPE_INT32:
+    case UPB_TYPE_ENUM:
+      if (u > (neg ? (uint64_t)INT32_MAX + 1 : INT32_MAX)) break;
+      upb_sink_putint32(sink, sel, neg ? (int32_t)(0 - u) : (int32_t)u);
+      return true;
+    case UPB_TYPE_INT64:
+      if (u > (neg ? (uint64_t)INT64_MAX + 1 : INT64_MAX)) break;
+      upb_sink_putint64(sink, sel, neg ? (int64_t)(0 - u) : (int64_t)u);
+      return true;
+    case UPB_TYPE_UINT32:
+      if (u > UINT32_MAX || (neg && u != 0)) break;
+      upb_sink_putuint32(sink, sel, (uint32_t)u);
+      return true;
+    case UPB_TYPE_UINT64:
+      if (neg && u != 0) break;
+      upb_sink_putuint64(sink, sel, u);
+      return true;
+    default:
+      UPB_ASSERT(false);
+  }
+
+  return seterr_token(p, "Integer out of range", tok, len);
+}
+
+/* Parses |tok| as the value of p->f, which is not a string or message. */
+static bool putscalar(upb_textparser *p, const char *tok, size_t len) {
+  upb_sink *sink = valuesink(p);
+  upb_selector_t sel;
+
+  if (upb_fielddef_isstring(p->f)) {
+    return seterr_token(p, "Expected a string literal", tok, len);
+  } else if (upb_fielddef_issubmsg(p->f)) {
+    return seterr_token(p, "Expected a message", tok, len);
+  }
+
+  sel = textsel(p->f, upb_handlers_getprimitivehandlertype(p->f));
+
+  switch (upb_fielddef_type(p->f)) {
+    case UPB_TYPE_INT32:
+    case UPB_TYPE_INT64:
+    case UPB_TYPE_UINT32:
+    case UPB_TYPE_UINT64:
+      return putint(p, sink, sel, tok, len);
+    case UPB_TYPE_ENUM: {
+      int32_t num;
+      if (isdigit_(tok[0])) {
+        return putint(p, sink, sel, tok, len);
+      }
+      if (p->negative ||
+          !upb_enumdef_ntoi(upb_fielddef_enumsubdef(p->f), tok, len, &num)) {
+        return seterr_token(p, "Invalid enum value", tok, len);
+      }
+      upb_sink_putint32(sink, sel, num);
+      return true;
+    }
+    case UPB_TYPE_FLOAT:
+    case UPB_TYPE_DOUBLE: {
+      double val;
+      if (!parsedouble(tok, len, &val)) {
+        return seterr_token(p, "Invalid number", tok, len);
+      }
+      if (p->negative) val = -val;
+      if (upb_fielddef_type(p->f) == UPB_TYPE_FLOAT) {
+        upb_sink_putfloat(sink, sel, (float)val);
+      } else {
+        upb_sink_putdouble(sink, sel, val);
+      }
+      return true;
+    }
+    case UPB_TYPE_BOOL:
+      if (!p->negative) {
+        if (ieq(tok, len, "true") || ieq(tok, len, "t") ||
+            (len == 1 && tok[0] == '1')) {
+          upb_sink_putbool(sink, sel, true);
+          return true;
+        } else if (ieq(tok, len, "false") || ieq(tok, len, "f") ||
+                   (len == 1 && tok[0] == '0')) {
+          upb_sink_putbool(sink, sel, false);
+          return true;
+        }
+      }
+      return seterr_token(p, "Invalid boolean", tok, len);
+    default:
+      break;
+  }
+
+  UPB_UNREACHABLE();
+}
+
+
+/* Grammar ********************************************************************/
+
+static const upb_fielddef *findfield(const upb_msgdef *m, const char *name,
+                                     size_t len) {
+  const upb_fielddef *f = upb_msgdef_ntof(m, name, len);
+  char lower[128];
+  size_t i;
+
+  if (f || len > sizeof(lower)) return f;
+
+  /* Groups are written with the name of their type, which is the field name
+   * with the first letter of each word capitalized. */
+  for (i = 0; i < len; i++) {
+    char c = name[i];
+    lower[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+  }
+  f = upb_msgdef_ntof(m, lower, len);
+  return f && upb_fielddef_istagdelim(f) ? f : NULL;
+}
+
+static bool startfield(upb_textparser *p, const char *name, size_t len) {
+  upb_textparser_frame *frame = p->top;
+  const upb_fielddef *f;
+
+  if (!isalpha_(name[0]) || !(f = findfield(frame->m, name, len))) {
+    return seterr_token(p, "No such field", name, len);
+  }
+
+  if (frame->seqf != f) {
+    textendseq(frame);
+    if (upb_fielddef_isseq(f)) {
+      upb_sink_startseq(&frame->sink, textsel(f, UPB_HANDLER_STARTSEQ),
+                        &frame->seqsink);
+      frame->seqf = f;
+    }
+  }
+
+  p->f = f;
+  p->state = STATE_SEPARATOR;
+  return true;
+}
+
+static bool startsubmsg(upb_textparser *p, char close) {
+  upb_textparser_frame *inner = p->top + 1;
+
+  if (!upb_fielddef_issubmsg(p->f) || p->negative) {
+    return texterr(p, "Unexpected '{'");
+  } else if (inner == p->limit) {
+    return texterr(p, "Nesting too deep");
+  }
+
+  upb_sink_startsubmsg(valuesink(p), textsel(p->f, UPB_HANDLER_STARTSUBMSG),
+                       &inner->sink);
+  inner->m = upb_fielddef_msgsubdef(p->f);
+  inner->f = p->f;
+  inner->close = close;
+  inner->in_list = p->in_list;
+  inner->seqf = NULL;
+  upb_sink_startmsg(&inner->sink);
+
+  p->top = inner;
+  p->in_list = false;
+  p->state = STATE_FIELD;
+  return true;
+}
+
+static void endsubmsg(upb_textparser *p) {
+  upb_textparser_frame *frame = p->top;
+  upb_status s = UPB_STATUS_INIT;
+
+  textendseq(frame);
+  upb_sink_endmsg(&frame->sink, &s);
+
+  p->top--;
+  p->f = frame->f;
+  p->in_list = frame->in_list;
+  upb_sink_endsubmsg(valuesink(p), textsel(p->f, UPB_HANDLER_ENDSUBMSG));
+  after_value(p);
+}
+
+static bool startstr(upb_textparser *p, char quote) {
+  upb_fieldtype_t type = upb_fielddef_type(p->f);
+
+  if ((type != UPB_TYPE_STRING && type != UPB_TYPE_BYTES) || p->negative) {
+    return texterr(p, "Unexpected string literal");
+  }
+
+  upb_sink_startstr(valuesink(p), textsel(p->f, UPB_HANDLER_STARTSTR), 0,
+                    &p->strsink);
+  p->strsel = textsel(p->f, UPB_HANDLER_STRING);
+  p->quote = quote;
+  p->lex = LEX_STRING;
+  return true;
+}
+
+static void endstr(upb_textparser *p) {
+  upb_sink_endstr(valuesink(p), textsel(p->f, UPB_HANDLER_ENDSTR));
+  after_value(p);
+}
+
+/* Handles a complete identifier or number. */
+static bool ontoken(upb_textparser *p, const char *tok, size_t len) {
+  switch (p->state) {
+    case STATE_FIELD:
+    case STATE_AFTER_VALUE:
+      return startfield(p, tok, len);
+    case STATE_VALUE:
+    case STATE_LIST_FIRST:
+      if (!putscalar(p, tok, len)) return false;
+      after_value(p);
+      return true;
+    default:
+      return seterr_token(p, "Unexpected token", tok, len);
+  }
+}
+
+/* Handles a punctuation character. */
+static bool onpunct(upb_textparser *p, char c) {
+  switch (c) {
+    case ':':
+      if (p->state != STATE_SEPARATOR) break;
+      p->state = STATE_VALUE;
+      return true;
+    case '{':
+    case '<':
+      if (p->state != STATE_SEPARATOR && !isvaluestate(p)) break;
+      return startsubmsg(p, c == '{' ? '}' : '>');
+    case '}':
+    case '>':
+      if ((p->state != STATE_FIELD && p->state != STATE_AFTER_VALUE) ||
+          p->top->close != c) {
+        break;
+      }
+      endsubmsg(p);
+      return true;
+    case '[':
+      if (p->state == STATE_FIELD || p->state == STATE_AFTER_VALUE) {
+        return texterr(p, "Extensions and Any fields are not supported");
+      } else if ((p->state == STATE_SEPARATOR && upb_fielddef_issubmsg(p->f)) ||
+                 p->state == STATE_VALUE) {
+        if (!upb_fielddef_isseq(p->f) || p->in_list || p->negative) break;
+        p->in_list = true;
+        p->state = STATE_LIST_FIRST;
+        return true;
+      }
+      break;
+    case ']':
+      if (p->state != STATE_LIST_FIRST && p->state != STATE_LIST_NEXT) break;
+      p->in_list = false;
+      after_value(p);
+      return true;
+    case ',':
+      if (p->state == STATE_LIST_NEXT) {
+        p->state = STATE_VALUE;
+        return true;
+      }
+      /* Fallthrough. */
+    case ';':
+      if (p->state != STATE_AFTER_VALUE) break;
+      p->state = STATE_FIELD;
+      return true;
+    case '-':
+      if (!isvaluestate(p) || p->negative) break;
+      p->negative = true;
+      return true;
+  }
+
+  upb_status_seterrf(&p->status, "Unexpected '%c'", c);
+  upb_env_reporterror(p->env, &p->status);
+  return false;
+}
+
+
+/* Lexer **********************************************************************/
+
+/* Each of these takes the unparsed part of the buffer and returns a pointer
+ * past what it parsed, or NULL if there was an error. */
+
+static bool istokenchar(char c) {
+  return isdigit_(c) || isalpha_(c) || c == '.';
+}
+
+static bool isspace_(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' ||
+         c == '\v';
+}
+
+static bool token_append(upb_textparser *p, const char *buf, size_t len) {
+  if (p->token_len + len > p->token_size) {
+    size_t new_size = UPB_MAX(p->token_size, 64);
+    void *mem;
+    while (new_size < p->token_len + len) new_size *= 2;
+    mem = upb_env_realloc(p->env, p->token_buf, p->token_size, new_size);
+    if (!mem) return texterr(p, "Out of memory allocating buffer.");
+    p->token_buf = mem;
+    p->token_size = new_size;
+  }
+  memcpy(p->token_buf + p->token_len, buf, len);
+  p->token_len += len;
+  return true;
+}
+
+static const char *lex_token(upb_textparser *p, const char *ptr,
+                             const char *end) {
+  const char *start = ptr;
+  const char *tok;
+  size_t len;
+
+  for (; ptr < end; ptr++) {
+    char c = *ptr;
+    if (!istokenchar(c)) {
+      /* The sign of an exponent, as in "1e-5". */
+      char first = p->token_len ? p->token_buf[0] : *start;
+      char prev = ptr > start ? ptr[-1] : p->token_len
+                                              ? p->token_buf[p->token_len - 1]
+                                              : 0;
+      if ((c != '-' && c != '+') || (prev != 'e' && prev != 'E') ||
+          !(isdigit_(first) || first == '.')) {
+        break;
+      }
+    }
+  }
+
+  if (ptr == end) {
+    return token_append(p, start, ptr - start) ? ptr : NULL;
+  }
+
+  p->lex = LEX_NONE;
+  tok = start;
+  len = ptr - start;
+  if (p->token_len) {
+    if (!token_append(p, start, len)) return NULL;
+    tok = p->token_buf;
+    len = p->token_len;
+    p->token_len = 0;
+  }
+
+  return ontoken(p, tok, len) ? ptr : NULL;
+}
+
+static void putstrdata(upb_textparser *p, const char *buf, size_t len,
+                       const upb_bufhandle *handle) {
+  if (len > 0) {
+    upb_sink_putstring(&p->strsink, p->strsel, buf, len, handle);
+  }
+}
+
+static const char *lex_string(upb_textparser *p, const char *ptr,
+                              const char *end) {
+  const char *run = ptr;
+
+  if (p->quote == '"') {
+    ptr = upb_json_skipplain(ptr, end, false);
+  } else {
+    while (ptr < end && *ptr != '\'' && *ptr != '\\') ptr++;
+  }
+
+  putstrdata(p, run, ptr - run, p->handle);
+  if (ptr == end) return ptr;
+
+  p->lex = *ptr == '\\' ? LEX_ESCAPE : LEX_NONE;
+  if (p->lex == LEX_ESCAPE) {
+    p->esc = 0;
+  } else {
+    p->state = STATE_STRING_NEXT;
+  }
+  return ptr + 1;
+}
+
+/* Pushes the value of the numeric escape that just ended. */
+static bool endescape(upb_textparser *p) {
+  char buf[4];
+  uint32_t cp = p->esc_val;
+  size_t n;
+
+  if (p->esc == 'o' || p->esc == 'x') {
+    if (p->esc_digits == 0 || cp > 0xff) {
+      return texterr(p, "Invalid escape sequence");
+    }
+    buf[0] = (char)cp;
+    n = 1;
+  } else {
+    if (p->esc_digits != (p->esc == 'u' ? 4 : 8) || cp > 0x10ffff) {
+      return texterr(p, "Invalid escape sequence");
+    }
+    if (cp < 0x80) {
+      buf[0] = (char)cp;
+      n = 1;
+    } else if (cp < 0x800) {
+      buf[0] = (char)(0xc0 | (cp >> 6));
+      buf[1] = (char)(0x80 | (cp & 0x3f));
+      n = 2;
+    } else if (cp < 0x10000) {
+      buf[0] = (char)(0xe0 | (cp >> 12));
+      buf[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+      buf[2] = (char)(0x80 | (cp & 0x3f));
+      n = 3;
+    } else {
+      buf[0] = (char)(0xf0 | (cp >> 18));
+      buf[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+      buf[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+      buf[3] = (char)(0x80 | (cp & 0x3f));
+      n = 4;
+    }
+  }
+
+  putstrdata(p, buf, n, NULL);
+  p->lex = LEX_STRING;
+  return true;
+}
+
+static const char *lex_escape(upb_textparser *p, const char *ptr,
+                              const char *end) {
+  for (; ptr < end; ptr++) {
+    char c = *ptr;
+    unsigned d;
+    int max;
+
+    if (p->esc == 0) {
+      char ch = c;
+      p->esc_val = 0;
+      p->esc_digits = 0;
+      switch (c) {
+        case 'n': ch = '\n'; break;
+        case 'r': ch = '\r'; break;
+        case 't': ch = '\t'; break;
+        case 'a': ch = '\a'; break;
+        case 'b': ch = '\b'; break;
+        case 'f': ch = '\f'; break;
+        case 'v': ch = '\v'; break;
+        case '\\': case '\'': case '"': case '?': break;
+        case 'x': case 'X': p->esc = 'x'; break;
+        case 'u': case 'U': p->esc = c; break;
+        default:
+          if (c < '0' || c > '7') {
+            texterr(p, "Invalid escape sequence");
+            return NULL;
+          }
+          p->esc = 'o';
+          p->esc_val = c - '0';
+          p->esc_digits = 1;
+      }
+      if (p->esc == 0) {
+        putstrdata(p, &ch, 1, NULL);
+        p->lex = LEX_STRING;
+        return ptr + 1;
+      }
+      continue;
+    }
+
+    if (p->esc == 'o') {
+      d = (unsigned char)c - '0';
+      if (d > 7) d = 16;
+      max = 3;
+    } else {
+      if (isdigit_(c)) {
+        d = c - '0';
+      } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        d = (c | 0x20) - 'a' + 10;
+      } else {
+        d = 16;
+      }
+      max = p->esc == 'x' ? 2 : p->esc == 'u' ? 4 : 8;
+    }
+
+    if (d == 16) {
+      /* |c| is not part of the escape. */
+      return endescape(p) ? ptr : NULL;
+    }
+
+    p->esc_val = p->esc_val * (p->esc == 'o' ? 8 : 16) + d;
+    if (++p->esc_digits == max) {
+      return endescape(p) ? ptr + 1 : NULL;
+    }
+  }
+
+  return ptr;
+}
+
+static const char *lex_next(upb_textparser *p, const char *ptr,
+                            const char *end) {
+  char c;
+
+  while (ptr < end && isspace_(*ptr)) ptr++;
+  if (ptr == end) return ptr;
+  c = *ptr;
+
+  if (c == '#') {
+    p->lex = LEX_COMMENT;
+    return ptr + 1;
+  }
+
+  if (p->state == STATE_STRING_NEXT) {
+    if (c == '"' || c == '\'') {
+      p->quote = c;
+      p->lex = LEX_STRING;
+      return ptr + 1;
+    }
+    endstr(p);
+  }
+
+  if (istokenchar(c)) {
+    p->lex = LEX_TOKEN;
+    return ptr;
+  } else if (c == '"' || c == '\'') {
+    if (!isvaluestate(p)) {
+      texterr(p, "Unexpected string literal");
+      return NULL;
+    }
+    return startstr(p, c) ? ptr + 1 : NULL;
+  } else {
+    return onpunct(p, c) ? ptr + 1 : NULL;
+  }
+}
+
+
+/* Input handlers *************************************************************/
+
+static void *textparser_start(void *closure, const void *hd,
+                              size_t size_hint) {
+  upb_textparser *p = closure;
+  UPB_UNUSED(hd);
+  UPB_UNUSED(size_hint);
+  upb_sink_startmsg(&p->top->sink);
+  return p;
+}
+
+static size_t textparser_parse(void *closure, const void *hd, const char *buf,
+                               size_t size, const upb_bufhandle *handle) {
+  upb_textparser *p = closure;
+  const char *ptr = buf;
+  const char *end = buf + size;
+  UPB_UNUSED(hd);
+
+  if (!upb_ok(&p->status)) return 0;
+  p->handle = handle;
+
+  while (ptr < end) {
+    const char *next;
+
+    switch (p->lex) {
+      case LEX_COMMENT:
+        next = memchr(ptr, '\n', end - ptr);
+        if (next) {
+          next++;
+          p->lex = LEX_NONE;
+        } else {
+          next = end;
+        }
+        break;
+      case LEX_TOKEN:
+        next = lex_token(p, ptr, end);
+        break;
+      case LEX_STRING:
+        next = lex_string(p, ptr, end);
+        break;
+      case LEX_ESCAPE:
+        next = lex_escape(p, ptr, end);
+        break;
+      default:
+        next = lex_next(p, ptr, end);
+        break;
+    }
+
+    if (!next) return ptr - buf;
+    ptr = next;
+  }
+
+  return size;
+}
+
+static bool textparser_end(void *closure, const void *hd) {
+  upb_textparser *p = closure;
+  UPB_UNUSED(hd);
+
+  if (!upb_ok(&p->status)) return false;
+
+  if (p->lex == LEX_TOKEN) {
+    const char *tok = p->token_buf;
+    size_t len = p->token_len;
+    p->lex = LEX_NONE;
+    p->token_len = 0;
+    if (!ontoken(p, tok, len)) return false;
+  } else if (p->lex == LEX_STRING || p->lex == LEX_ESCAPE) {
+    return texterr(p, "Unterminated string literal");
+  }
+
+  if (p->state == STATE_STRING_NEXT) {
+    endstr(p);
+  }
+
+  if (p->top != p->stack ||
+      (p->state != STATE_FIELD && p->state != STATE_AFTER_VALUE)) {
+    return texterr(p, "Unexpected end of input");
+  }
+
+  textendseq(p->top);
+  upb_sink_endmsg(&p->top->sink, &p->status);
+  p->lex = LEX_NONE;
+  p->state = STATE_FIELD;
+  return upb_ok(&p->status);
+}
+
+static void textparser_reset(upb_textparser *p) {
+  p->top = p->stack;
+  p->top->seqf = NULL;
+  p->state = STATE_FIELD;
+  p->f = NULL;
+  p->in_list = false;
+  p->negative = false;
+  p->lex = LEX_NONE;
+  p->token_len = 0;
+  upb_status_clear(&p->status);
+}
+
+
+/* Public API *****************************************************************/
+
+upb_textparser *upb_textparser_create(upb_env *env, upb_sink *output) {
+#ifndef NDEBUG
+  const size_t size_before = upb_env_bytesallocated(env);
+#endif
+  upb_textparser *p = upb_env_malloc(env, sizeof(upb_textparser));
+  if (!p) return NULL;
+
+  p->env = env;
+  p->limit = p->stack + UPB_TEXTPARSER_MAX_DEPTH;
+  p->token_buf = NULL;
+  p->token_size = 0;
+
+  upb_byteshandler_init(&p->input_handler_);
+  upb_byteshandler_setstartstr(&p->input_handler_, textparser_start, NULL);
+  upb_byteshandler_setstring(&p->input_handler_, textparser_parse, NULL);
+  upb_byteshandler_setendstr(&p->input_handler_, textparser_end, NULL);
+  upb_bytessink_reset(&p->input_, &p->input_handler_, p);
+
+  textparser_reset(p);
+  upb_sink_reset(&p->top->sink, output->handlers, output->closure);
+  p->top->m = upb_handlers_msgdef(output->handlers);
+  p->top->f = NULL;
+  p->top->close = 0;
+  p->top->in_list = false;
+
+  /* If this fails, uncomment and increase the value in textparser.h. */
+  /* fprintf(stderr, "%zd\n", upb_env_bytesallocated(env) - size_before); */
+  UPB_ASSERT_DEBUGVAR(upb_env_bytesallocated(env) - size_before <=
+                      UPB_TEXTPARSER_SIZE);
+  return p;
+}
+
+upb_bytessink *upb_textparser_input(upb_textparser *p) {
+  return &p->input_;
+}
+
+void upb_textparser_reset(upb_textparser *p) {
+  textparser_reset(p);
+}
@@ -0,0 +1,86 @@
+/*
+** upb::pb::TextParser (upb_textparser)
+**
+** Parses protobuf text format, pushing the results to a sink, as
+** upb::json::Parser does for JSON.
+**
+** Tokens are read straight out of the input buffers; only a token that
+** straddles two buffers is copied.  String data is pushed to the sink as it
+** is scanned, so a long string costs no buffering at all.  Numbers are parsed
+** with the routines the JSON parser uses, so programs that use this parser
+** must also link upb.json.
+**
+** Not supported: extensions and expanded google.protobuf.Any ("[name]"), and
+** unknown fields, all of which are parse errors.
+*/
+
+#ifndef UPB_TEXTPARSER_H_
+#define UPB_TEXTPARSER_H_
+
+#include "upb/sink.h"
+
+#ifdef __cplusplus
+namespace upb {
+namespace pb {
+class TextParser;
+}  /* namespace pb */
+}  /* namespace upb */
+#endif
+
+UPB_DECLARE_TYPE(upb::pb::TextParser, upb_textparser)
+
+/* Preallocation hint: parser won't allocate more bytes than this when first
+ * constructed.  This hint may be an overestimate for some build configurations.
+ * But if the parser library is upgraded without recompiling the application,
+ * it may be an underestimate. */
+#define UPB_TEXTPARSER_SIZE 4800
+
+#ifdef __cplusplus
+
+/* Parses an incoming BytesStream, pushing the results to the destination
+ * sink.  Any handlers for the message type of |output| will do; unlike the
+ * JSON parser there is no ParserMethod to build first. */
+class upb::pb::TextParser {
+ public:
+  static TextParser* Create(Environment* env, Sink* output);
+
+  BytesSink* input();
+
+  /* Abandons the message being parsed, if any, and clears any error.  A
+   * message that was parsed to the end leaves the parser ready for the next
+   * one by itself.  The buffer for tokens that span input buffers is kept,
+   * so a reused parser stops allocating once it has seen its longest such
+   * token. */
+  void Reset();
+
+ private:
+  UPB_DISALLOW_POD_OPS(TextParser, upb::pb::TextParser)
+};
+
+#endif
+
+UPB_BEGIN_EXTERN_C
+
+upb_textparser *upb_textparser_create(upb_env *env, upb_sink *output);
+upb_bytessink *upb_textparser_input(upb_textparser *p);
+void upb_textparser_reset(upb_textparser *p);
+
+UPB_END_EXTERN_C
+
+#ifdef __cplusplus
+
+namespace upb {
+namespace pb {
+inline TextParser* TextParser::Create(Environment* env, Sink* output) {
+  return upb_textparser_create(env, output);
+}
+inline BytesSink* TextParser::input() {
+  return upb_textparser_input(this);
+}
+inline void TextParser::Reset() { upb_textparser_reset(this); }
+}  /* namespace pb */
+}  /* namespace upb */
+
+#endif
+
+#endif  /* UPB_TEXTPARSER_H_ */
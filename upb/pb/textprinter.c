@@ -1,27 +1,23 @@
 /*
  * upb::pb::TextPrinter
  *
- * OPT: This is not optimized at all.  It uses printf() which parses the format
- * string every time, and it allocates memory for every put.
+ * Integers, names and escapes are formatted by hand straight into the output
+ * buffer.  Only floating-point values go through snprintf(), since matching
+ * its "%.*g" rounding is not worth reimplementing.
  */
 
 #include "upb/pb/textprinter.h"
 
-#include <ctype.h>
 #include <float.h>
-#include <inttypes.h>
-#include <stdarg.h>
-#include <stdio.h>
 #include <string.h>
 
 #include "upb/sink.h"
 
 struct upb_textprinter {
   upb_sink input_;
-  upb_bytessink *output_;
+  upb_bytesbuf output_;
   int indent_depth_;
   bool single_line_;
-  void *subc;
 };
 
 #define CHECK(x) if ((x) < 0) goto err;
@@ -31,92 +27,127 @@ static const char *shortname(const char *longname) {
   return last ? last + 1 : longname;
 }
 
+static int putraw(upb_textprinter *p, const char *str, size_t len) {
+  return upb_bytesbuf_put(&p->output_, str, len) ? 0 : -1;
+}
+
 static int indent(upb_textprinter *p) {
   int i;
   if (!p->single_line_)
     for (i = 0; i < p->indent_depth_; i++)
-      upb_bytessink_putbuf(p->output_, p->subc, "  ", 2, NULL);
+      CHECK(putraw(p, "  ", 2));
   return 0;
+err:
+  return -1;
 }
 
 static int endfield(upb_textprinter *p) {
-  const char ch = (p->single_line_ ? ' ' : '\n');
-  upb_bytessink_putbuf(p->output_, p->subc, &ch, 1, NULL);
+  return putraw(p, p->single_line_ ? " " : "\n", 1);
+}
+
+/* Writes the field name and the ": " that follows it. */
+static int putname(upb_textprinter *p, const upb_fielddef *f) {
+  const char *name = upb_fielddef_name(f);
+  CHECK(putraw(p, name, strlen(name)));
+  CHECK(putraw(p, ": ", 2));
   return 0;
+err:
+  return -1;
+}
+
+/* Writes the decimal digits of |val| so that they end at |end|, and returns
+ * where they start. */
+static char *fmtuint64(uint64_t val, char *end) {
+  do {
+    *--end = '0' + (val % 10);
+    val /= 10;
+  } while (val);
+  return end;
+}
+
+static int putuint64(upb_textprinter *p, uint64_t val) {
+  char buf[20];
+  char *end = buf + sizeof(buf);
+  char *start = fmtuint64(val, end);
+  return putraw(p, start, end - start);
+}
+
+static int putint64(upb_textprinter *p, int64_t val) {
+  char buf[20];
+  char *end = buf + sizeof(buf);
+  char *start;
+  bool neg = val < 0;
+  /* Negate in unsigned arithmetic, so that INT64_MIN works. */
+  start = fmtuint64(neg ? 0 - (uint64_t)val : (uint64_t)val, end);
+  if (neg) *--start = '-';
+  return putraw(p, start, end - start);
 }
 
+static int putfp(upb_textprinter *p, double val, int digits) {
+  char buf[32];
+  int n = _upb_snprintf(buf, sizeof(buf), "%.*g", digits, val);
+  UPB_ASSERT(n > 0 && (size_t)n < sizeof(buf));
+  return putraw(p, buf, n);
+}
+
+/* How putescaped() writes each byte: 0 if it needs no escape, the letter of
+ * a two-character escape like \n, or 'o' for an octal escape like \001.  'u'
+ * marks bytes >= 0x80, which are octal-escaped unless we preserve UTF-8.
+ *
+ * Based on CEscapeInternal() from Google's protobuf release.  Printable means
+ * isprint() in the C locale. */
+static const char kEscapes[256] = {
+  'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 't', 'n', 'o', 'o', 'r', 'o', 'o',
+  'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o', 'o',
+    0,   0, '"',   0,   0,   0,   0,'\'',   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,'\\',   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0, 'o',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u'
+};
+
 static int putescaped(upb_textprinter *p, const char *buf, size_t len,
                       bool preserve_utf8) {
-  /* Based on CEscapeInternal() from Google's protobuf release. */
-  char dstbuf[4096], *dst = dstbuf, *dstend = dstbuf + sizeof(dstbuf);
   const char *end = buf + len;
+  const char *run = buf;
 
-  /* I think hex is prettier and more useful, but proto2 uses octal; should
-   * investigate whether it can parse hex also. */
-  const bool use_hex = false;
-  bool last_hex_escape = false; /* true if last output char was \xNN */
-
+  /* Proto2 escapes with octal rather than hex, which spares us from having to
+   * escape a hex digit that follows a \xNN. */
   for (; buf < end; buf++) {
-    bool is_hex_escape;
-
-    if (dstend - dst < 4) {
-      upb_bytessink_putbuf(p->output_, p->subc, dstbuf, dst - dstbuf, NULL);
-      dst = dstbuf;
-    }
-
-    is_hex_escape = false;
-    switch (*buf) {
-      case '\n': *(dst++) = '\\'; *(dst++) = 'n';  break;
-      case '\r': *(dst++) = '\\'; *(dst++) = 'r';  break;
-      case '\t': *(dst++) = '\\'; *(dst++) = 't';  break;
-      case '\"': *(dst++) = '\\'; *(dst++) = '\"'; break;
-      case '\'': *(dst++) = '\\'; *(dst++) = '\''; break;
-      case '\\': *(dst++) = '\\'; *(dst++) = '\\'; break;
-      default:
-        /* Note that if we emit \xNN and the buf character after that is a hex
-         * digit then that digit must be escaped too to prevent it being
-         * interpreted as part of the character code by C. */
-        if ((!preserve_utf8 || (uint8_t)*buf < 0x80) &&
-            (!isprint(*buf) || (last_hex_escape && isxdigit(*buf)))) {
-          sprintf(dst, (use_hex ? "\\x%02x" : "\\%03o"), (uint8_t)*buf);
-          is_hex_escape = use_hex;
-          dst += 4;
-        } else {
-          *(dst++) = *buf; break;
-        }
+    unsigned char byte = (unsigned char)*buf;
+    char escape = kEscapes[byte];
+    char dst[4];
+
+    if (!escape || (escape == 'u' && preserve_utf8)) continue;
+
+    /* Flush the run of bytes that need no escaping. */
+    CHECK(putraw(p, run, buf - run));
+    run = buf + 1;
+
+    dst[0] = '\\';
+    if (escape == 'o' || escape == 'u') {
+      dst[1] = '0' + (byte >> 6);
+      dst[2] = '0' + ((byte >> 3) & 7);
+      dst[3] = '0' + (byte & 7);
+      CHECK(putraw(p, dst, 4));
+    } else {
+      dst[1] = escape;
+      CHECK(putraw(p, dst, 2));
     }
-    last_hex_escape = is_hex_escape;
   }
-  /* Flush remaining data. */
-  upb_bytessink_putbuf(p->output_, p->subc, dstbuf, dst - dstbuf, NULL);
-  return 0;
-}
 
-bool putf(upb_textprinter *p, const char *fmt, ...) {
-  va_list args;
-  va_list args_copy;
-  char *str;
-  int written;
-  int len;
-  bool ok;
-
-  va_start(args, fmt);
-
-  /* Run once to get the length of the string. */
-  _upb_va_copy(args_copy, args);
-  len = _upb_vsnprintf(NULL, 0, fmt, args_copy);
-  va_end(args_copy);
-
-  /* + 1 for NULL terminator (vsprintf() requires it even if we don't). */
-  str = upb_gmalloc(len + 1);
-  if (!str) return false;
-  written = vsprintf(str, fmt, args);
-  va_end(args);
-  UPB_ASSERT(written == len);
-
-  ok = upb_bytessink_putbuf(p->output_, p->subc, str, len, NULL);
-  upb_gfree(str);
-  return ok;
+  return putraw(p, run, end - run);
+err:
+  return -1;
 }
 
 
@@ -126,7 +157,7 @@ static bool textprinter_startmsg(void *c, const void *hd) {
   upb_textprinter *p = c;
   UPB_UNUSED(hd);
   if (p->indent_depth_ == 0) {
-    upb_bytessink_start(p->output_, 0, &p->subc);
+    upb_bytesbuf_start(&p->output_, 0);
   }
   return true;
 }
@@ -136,45 +167,32 @@ static bool textprinter_endmsg(void *c, const void *hd, upb_status *s) {
   UPB_UNUSED(hd);
   UPB_UNUSED(s);
   if (p->indent_depth_ == 0) {
-    upb_bytessink_end(p->output_);
+    upb_bytesbuf_end(&p->output_);
   }
   return true;
 }
 
-#define TYPE(name, ctype, fmt) \
+#define TYPE(name, ctype, put)                                                 \
   static bool textprinter_put ## name(void *closure, const void *handler_data, \
                                       ctype val) {                             \
     upb_textprinter *p = closure;                                              \
     const upb_fielddef *f = handler_data;                                      \
     CHECK(indent(p));                                                          \
-    putf(p, "%s: " fmt, upb_fielddef_name(f), val);                            \
+    CHECK(putname(p, f));                                                      \
+    CHECK(put);                                                                \
     CHECK(endfield(p));                                                        \
     return true;                                                               \
   err:                                                                         \
     return false;                                                              \
 }
 
-static bool textprinter_putbool(void *closure, const void *handler_data,
-                                bool val) {
-  upb_textprinter *p = closure;
-  const upb_fielddef *f = handler_data;
-  CHECK(indent(p));
-  putf(p, "%s: %s", upb_fielddef_name(f), val ? "true" : "false");
-  CHECK(endfield(p));
-  return true;
-err:
-  return false;
-}
-
-#define STRINGIFY_HELPER(x) #x
-#define STRINGIFY_MACROVAL(x) STRINGIFY_HELPER(x)
-
-TYPE(int32,  int32_t,  "%" PRId32)
-TYPE(int64,  int64_t,  "%" PRId64)
-TYPE(uint32, uint32_t, "%" PRIu32)
-TYPE(uint64, uint64_t, "%" PRIu64)
-TYPE(float,  float,    "%." STRINGIFY_MACROVAL(FLT_DIG) "g")
-TYPE(double, double,   "%." STRINGIFY_MACROVAL(DBL_DIG) "g")
+TYPE(int32,  int32_t,  putint64(p, val))
+TYPE(int64,  int64_t,  putint64(p, val))
+TYPE(uint32, uint32_t, putuint64(p, val))
+TYPE(uint64, uint64_t, putuint64(p, val))
+TYPE(float,  float,    putfp(p, val, FLT_DIG))
+TYPE(double, double,   putfp(p, val, DBL_DIG))
+TYPE(bool,   bool,     val ? putraw(p, "true", 4) : putraw(p, "false", 5))
 
 #undef TYPE
 
@@ -186,14 +204,17 @@ static bool textprinter_putenum(void *closure, const void *handler_data,
   const upb_enumdef *enum_def = upb_downcast_enumdef(upb_fielddef_subdef(f));
   const char *label = upb_enumdef_iton(enum_def, val);
   if (label) {
-    indent(p);
-    putf(p, "%s: %s", upb_fielddef_name(f), label);
-    endfield(p);
+    CHECK(indent(p));
+    CHECK(putname(p, f));
+    CHECK(putraw(p, label, strlen(label)));
+    CHECK(endfield(p));
   } else {
     if (!textprinter_putint32(closure, handler_data, val))
       return false;
   }
   return true;
+err:
+  return false;
 }
 
 static void *textprinter_startstr(void *closure, const void *handler_data,
@@ -201,17 +222,22 @@ static void *textprinter_startstr(void *closure, const void *handler_data,
   upb_textprinter *p = closure;
   const upb_fielddef *f = handler_data;
   UPB_UNUSED(size_hint);
-  indent(p);
-  putf(p, "%s: \"", upb_fielddef_name(f));
+  CHECK(indent(p));
+  CHECK(putname(p, f));
+  CHECK(putraw(p, "\"", 1));
   return p;
+err:
+  return UPB_BREAK;
 }
 
 static bool textprinter_endstr(void *closure, const void *handler_data) {
   upb_textprinter *p = closure;
   UPB_UNUSED(handler_data);
-  putf(p, "\"");
-  endfield(p);
+  CHECK(putraw(p, "\"", 1));
+  CHECK(endfield(p));
   return true;
+err:
+  return false;
 }
 
 static size_t textprinter_putstr(void *closure, const void *hd, const char *buf,
@@ -229,7 +255,8 @@ static void *textprinter_startsubmsg(void *closure, const void *handler_data) {
   upb_textprinter *p = closure;
   const char *name = handler_data;
   CHECK(indent(p));
-  putf(p, "%s {%c", name, p->single_line_ ? ' ' : '\n');
+  CHECK(putraw(p, name, strlen(name)));
+  CHECK(putraw(p, p->single_line_ ? " { " : " {\n", 3));
   p->indent_depth_++;
   return p;
 err:
@@ -241,7 +268,7 @@ static bool textprinter_endsubmsg(void *closure, const void *handler_data) {
   UPB_UNUSED(handler_data);
   p->indent_depth_--;
   CHECK(indent(p));
-  upb_bytessink_putbuf(p->output_, p->subc, "}", 1, NULL);
+  CHECK(putraw(p, "}", 1));
   CHECK(endfield(p));
   return true;
 err:
@@ -320,7 +347,10 @@ upb_textprinter *upb_textprinter_create(upb_env *env, const upb_handlers *h,
   upb_textprinter *p = upb_env_malloc(env, sizeof(upb_textprinter));
   if (!p) return NULL;
 
-  p->output_ = output;
+  if (!upb_bytesbuf_init(&p->output_, env, UPB_BYTESBUF_DEFAULTSIZE,
+                         output)) {
+    return NULL;
+  }
   upb_sink_reset(&p->input_, h, p);
   textprinter_reset(p, false);
 
@@ -332,8 +362,16 @@ const upb_handlers *upb_textprinter_newhandlers(const upb_msgdef *m,
   return upb_handlers_newfrozen(m, owner, &onmreg, NULL);
 }
 
+upb_handlercache *upb_textprinter_newcache() {
+  return upb_handlercache_new(&onmreg, NULL);
+}
+
 upb_sink *upb_textprinter_input(upb_textprinter *p) { return &p->input_; }
 
 void upb_textprinter_setsingleline(upb_textprinter *p, bool single_line) {
   p->single_line_ = single_line;
 }
+
+void upb_textprinter_reset(upb_textprinter *p) {
+  textprinter_reset(p, p->single_line_);
+}
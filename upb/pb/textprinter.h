@@ -32,9 +32,16 @@ class upb::pb::TextPrinter {
 
   Sink* input();
 
-  /* If handler caching becomes a requirement we can add a code cache as in
-   * decoder.h */
+  /* Abandons the message being printed, if any, so that the printer can start
+   * on a new one.  Single-line mode is kept.  Nothing is allocated, then or
+   * after. */
+  void Reset();
+
   static reffed_ptr<const Handlers> NewHandlers(const MessageDef* md);
+
+  /* Returns a new cache of the handlers NewHandlers() would return.  The
+   * caller owns the cache. */
+  static HandlerCache* NewCache();
 };
 
 #endif
@@ -46,9 +53,11 @@ upb_textprinter *upb_textprinter_create(upb_env *env, const upb_handlers *h,
                                         upb_bytessink *output);
 void upb_textprinter_setsingleline(upb_textprinter *p, bool single_line);
 upb_sink *upb_textprinter_input(upb_textprinter *p);
+void upb_textprinter_reset(upb_textprinter *p);
 
 const upb_handlers *upb_textprinter_newhandlers(const upb_msgdef *m,
                                                 const void *owner);
+upb_handlercache *upb_textprinter_newcache();
 
 UPB_END_EXTERN_C
 
@@ -67,11 +76,15 @@ inline void TextPrinter::SetSingleLineMode(bool single_line) {
 inline Sink* TextPrinter::input() {
   return upb_textprinter_input(this);
 }
+inline void TextPrinter::Reset() { upb_textprinter_reset(this); }
 inline reffed_ptr<const Handlers> TextPrinter::NewHandlers(
     const MessageDef *md) {
   const Handlers* h = upb_textprinter_newhandlers(md, &h);
   return reffed_ptr<const Handlers>(h, &h);
 }
+inline HandlerCache* TextPrinter::NewCache() {
+  return upb_textprinter_newcache();
+}
 }  /* namespace pb */
 }  /* namespace upb */
 
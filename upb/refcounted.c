@@ -30,20 +30,36 @@ const void *UPB_UNTRACKED_REF = &untracked_val;
 
 static void atomic_inc(uint32_t *a) { (*a)++; }
 static bool atomic_dec(uint32_t *a) { return --(*a) == 0; }
+#ifdef UPB_DEBUG_REFS
+static bool atomic_trylock(uint32_t *l) { UPB_UNUSED(l); return true; }
+static void atomic_unlock(uint32_t *l) { UPB_UNUSED(l); }
+#endif
 
 #elif defined(__GNUC__) || defined(__clang__) /*------------------------------*/
 
 static void atomic_inc(uint32_t *a) { __sync_fetch_and_add(a, 1); }
 static bool atomic_dec(uint32_t *a) { return __sync_sub_and_fetch(a, 1) == 0; }
+#ifdef UPB_DEBUG_REFS
+static bool atomic_trylock(uint32_t *l) {
+  return __sync_lock_test_and_set(l, 1) == 0;
+}
+static void atomic_unlock(uint32_t *l) { __sync_lock_release(l); }
+#endif
 
 #elif defined(WIN32) /*-------------------------------------------------------*/
 
 #include <Windows.h>
 
-static void atomic_inc(upb_atomic_t *a) { InterlockedIncrement(&a->val); }
-static bool atomic_dec(upb_atomic_t *a) {
-  return InterlockedDecrement(&a->val) == 0;
+static void atomic_inc(uint32_t *a) { InterlockedIncrement((LONG*)a); }
+static bool atomic_dec(uint32_t *a) {
+  return InterlockedDecrement((LONG*)a) == 0;
 }
+#ifdef UPB_DEBUG_REFS
+static bool atomic_trylock(uint32_t *l) {
+  return InterlockedExchange((LONG*)l, 1) == 0;
+}
+static void atomic_unlock(uint32_t *l) { InterlockedExchange((LONG*)l, 0); }
+#endif
 
 #else
 #error Atomic primitives not defined for your platform/CPU.  \
@@ -76,19 +92,29 @@ static bool unrefgroup(uint32_t *group) {
 
 #ifdef UPB_DEBUG_REFS
 
-#ifdef UPB_THREAD_UNSAFE
+/* Each object's tracking tables are guarded by one of a fixed set of
+ * spinlocks, picked by the object's address, so that threads ref'ing
+ * different objects don't contend.  Nothing holds two of these locks at once,
+ * so they can't deadlock.  The sections they guard are a table operation or
+ * two, which is why spinning is good enough. */
+#define UPB_DEBUGREFS_LOCKS 64
 
-static void upb_lock() {}
-static void upb_unlock() {}
+static uint32_t debugrefs_locks[UPB_DEBUGREFS_LOCKS];
 
-#else
+static uint32_t *tracklock(const upb_refcounted *r) {
+  /* Objects are larger than 64 bytes, so the low bits carry little. */
+  uintptr_t h = (uintptr_t)r >> 6;
+  return &debugrefs_locks[(h ^ (h >> 6)) % UPB_DEBUGREFS_LOCKS];
+}
 
-/* User must define functions that lock/unlock a global mutex and link this
- * file against them. */
-void upb_lock();
-void upb_unlock();
+static void lock(const upb_refcounted *r) {
+  uint32_t *l = tracklock(r);
+  while (!atomic_trylock(l)) {}
+}
 
-#endif
+static void unlock(const upb_refcounted *r) {
+  atomic_unlock(tracklock(r));
+}
 
 /* UPB_DEBUG_REFS mode counts on being able to malloc() memory in some
  * code-paths that can normally never fail, like upb_refcounted_ref().  Since
@@ -137,7 +163,7 @@ static void track(const upb_refcounted *r, const void *owner, bool ref2) {
   UPB_ASSERT(owner);
   if (owner == UPB_UNTRACKED_REF) return;
 
-  upb_lock();
+  lock(r);
   if (upb_inttable_lookupptr(r->refs, owner, &v)) {
     trackedref *ref = upb_value_getptr(v);
     /* Since we allow multiple ref2's for the same to/from pair without
@@ -148,20 +174,23 @@ static void track(const upb_refcounted *r, const void *owner, bool ref2) {
     UPB_ASSERT(ref2);
     UPB_ASSERT(ref->is_ref2);
     ref->count++;
+    unlock(r);
   } else {
     trackedref *ref = trackedref_new(ref2);
     upb_inttable_insertptr2(r->refs, owner, upb_value_ptr(ref),
                             &upb_alloc_debugrefs);
+    unlock(r);
     if (ref2) {
       /* We know this cast is safe when it is a ref2, because it's coming from
        * another refcounted object. */
       const upb_refcounted *from = owner;
+      lock(from);
       UPB_ASSERT(!upb_inttable_lookupptr(from->ref2s, r, NULL));
       upb_inttable_insertptr2(from->ref2s, r, upb_value_ptr(NULL),
                               &upb_alloc_debugrefs);
+      unlock(from);
     }
   }
-  upb_unlock();
 }
 
 static void untrack(const upb_refcounted *r, const void *owner, bool ref2) {
@@ -172,7 +201,7 @@ static void untrack(const upb_refcounted *r, const void *owner, bool ref2) {
   UPB_ASSERT(owner);
   if (owner == UPB_UNTRACKED_REF) return;
 
-  upb_lock();
+  lock(r);
   found = upb_inttable_lookupptr(r->refs, owner, &v);
   /* This assert will fail if an owner attempts to release a ref it didn't have. */
   UPB_ASSERT(found);
@@ -181,15 +210,21 @@ static void untrack(const upb_refcounted *r, const void *owner, bool ref2) {
   if (--ref->count == 0) {
     free(ref);
     upb_inttable_removeptr(r->refs, owner, NULL);
+    unlock(r);
     if (ref2) {
       /* We know this cast is safe when it is a ref2, because it's coming from
        * another refcounted object. */
       const upb_refcounted *from = owner;
-      bool removed = upb_inttable_removeptr(from->ref2s, r, NULL);
+      bool removed;
+      lock(from);
+      removed = upb_inttable_removeptr(from->ref2s, r, NULL);
+      unlock(from);
       UPB_ASSERT(removed);
+      UPB_UNUSED(removed);
     }
+  } else {
+    unlock(r);
   }
-  upb_unlock();
 }
 
 static void checkref(const upb_refcounted *r, const void *owner, bool ref2) {
@@ -197,38 +232,46 @@ static void checkref(const upb_refcounted *r, const void *owner, bool ref2) {
   bool found;
   trackedref *ref;
 
-  upb_lock();
+  lock(r);
   found = upb_inttable_lookupptr(r->refs, owner, &v);
   UPB_ASSERT(found);
   ref = upb_value_getptr(v);
   UPB_ASSERT(ref->is_ref2 == ref2);
-  upb_unlock();
+  unlock(r);
 }
 
 /* Populates the given UPB_CTYPE_INT32 inttable with counts of ref2's that
- * originate from the given owner. */
+ * originate from the given owner.  Only the owner adds or removes these
+ * ref2's, and it isn't doing so while being visited, so we can take the
+ * targets from its table first and then look up the counts one at a time. */
 static void getref2s(const upb_refcounted *owner, upb_inttable *tab) {
   upb_inttable_iter i;
 
-  upb_lock();
+  lock(owner);
   upb_inttable_begin(&i, owner->ref2s);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_refcounted *to = (upb_refcounted*)upb_inttable_iter_key(&i);
+    upb_inttable_insertptr2(tab, to, upb_value_int32(0),
+                            &upb_alloc_debugrefs);
+  }
+  unlock(owner);
+
+  upb_inttable_begin(&i, tab);
   for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
     upb_value v;
-    upb_value count;
     trackedref *ref;
     bool found;
 
     upb_refcounted *to = (upb_refcounted*)upb_inttable_iter_key(&i);
 
     /* To get the count we need to look in the target's table. */
+    lock(to);
     found = upb_inttable_lookupptr(to->refs, owner, &v);
     UPB_ASSERT(found);
     ref = upb_value_getptr(v);
-    count = upb_value_int32(ref->count);
-
-    upb_inttable_insertptr2(tab, to, count, &upb_alloc_debugrefs);
+    upb_inttable_replace(tab, (uintptr_t)to, upb_value_int32(ref->count));
+    unlock(to);
   }
-  upb_unlock();
 }
 
 typedef struct {
@@ -335,15 +378,58 @@ static void visit(const upb_refcounted *r, upb_refcounted_visit *v,
  * inconsistent), which adds to the fun. */
 
 /* The state used by the freeze operation (shared across many functions). */
+
+/* After our analysis phase all nodes will be either GRAY or WHITE. */
+
+typedef enum {
+  BLACK = 0,  /* Object has not been seen. */
+  GRAY,   /* Object has been found via a refgroup but may not be reachable. */
+  GREEN,  /* Object is reachable and is currently on the Tarjan stack. */
+  WHITE   /* Object is reachable and has been assigned a group (SCC). */
+} color_t;
+
+/* The attributes of an object we have seen (any color but BLACK).  The
+ * object's freeze_slot is its index in tarjan.nodes. */
+typedef struct {
+  const upb_refcounted *obj;
+  color_t color;
+  uint32_t index;    /* GREEN only. */
+  uint32_t lowlink;  /* GREEN only. */
+  uint32_t group;    /* WHITE only: index in tarjan.groups. */
+} tarjan_node;
+
+/* An object whose subobjects we are in the middle of visiting.  Its
+ * subobjects are edges [next, end) of tarjan.edges, still to be visited. */
+typedef struct {
+  uint32_t node;
+  size_t begin;
+  size_t next;
+  size_t end;
+} tarjan_frame;
+
+/* A new group (SCC).  Its refcount is malloc'd since it outlives the freeze,
+ * and its leader is set when the first object is moved into it. */
+typedef struct {
+  uint32_t *count;
+  upb_refcounted *leader;
+} tarjan_group;
+
 typedef struct {
-  int depth;
   int maxdepth;
-  uint64_t index;
-  /* Maps upb_refcounted* -> attributes (color, etc).  attr layout varies by
-   * color. */
-  upb_inttable objattr;
-  upb_inttable stack;   /* stack of upb_refcounted* for Tarjan's algorithm. */
-  upb_inttable groups;  /* array of uint32_t*, malloc'd refcounts for new groups */
+  uint32_t index;
+  /* Everything below is allocated from |arena|, which is freed in one go at
+   * the end.  Arrays are grown by doubling. */
+  upb_arena arena;
+  tarjan_node *nodes;
+  size_t node_count, node_size;
+  uint32_t *stack;  /* Stack of node indexes for Tarjan's algorithm. */
+  size_t stack_count, stack_size;
+  tarjan_frame *frames;  /* The DFS stack, in place of the C stack. */
+  size_t frame_count, frame_size;
+  const upb_refcounted **edges;
+  size_t edge_count, edge_size;
+  tarjan_group *groups;
+  size_t group_count, group_size;
   upb_status *status;
   jmp_buf err;
 } tarjan;
@@ -354,163 +440,171 @@ static void release_ref2(const upb_refcounted *obj,
 
 /* Node attributes -----------------------------------------------------------*/
 
-/* After our analysis phase all nodes will be either GRAY or WHITE. */
-
-typedef enum {
-  BLACK = 0,  /* Object has not been seen. */
-  GRAY,   /* Object has been found via a refgroup but may not be reachable. */
-  GREEN,  /* Object is reachable and is currently on the Tarjan stack. */
-  WHITE   /* Object is reachable and has been assigned a group (SCC). */
-} color_t;
-
 UPB_NORETURN static void err(tarjan *t) { longjmp(t->err, 1); }
 UPB_NORETURN static void oom(tarjan *t) {
   upb_status_seterrmsg(t->status, "out of memory");
   err(t);
 }
 
-static uint64_t trygetattr(const tarjan *t, const upb_refcounted *r) {
-  upb_value v;
-  return upb_inttable_lookupptr(&t->objattr, r, &v) ?
-      upb_value_getuint64(v) : 0;
-}
-
-static uint64_t getattr(const tarjan *t, const upb_refcounted *r) {
-  upb_value v;
-  bool found = upb_inttable_lookupptr(&t->objattr, r, &v);
-  UPB_ASSERT(found);
-  return upb_value_getuint64(v);
+/* Makes room for |n| elements of |elem_size| bytes in the array |*p|, of
+ * capacity |*size|. */
+static void tarjan_reserve(tarjan *t, void *p, size_t *size, size_t elem_size,
+                           size_t n) {
+  void **ptr = p;
+  size_t new_size;
+  void *new_ptr;
+
+  if (n <= *size) return;
+  new_size = UPB_MAX(*size * 2, 64);
+  while (new_size < n) new_size *= 2;
+  if (new_size > SIZE_MAX / elem_size) oom(t);
+  new_ptr = upb_realloc(upb_arena_alloc(&t->arena), *ptr, *size * elem_size,
+                        new_size * elem_size);
+  if (!new_ptr) oom(t);
+  *ptr = new_ptr;
+  *size = new_size;
+}
+
+static tarjan_node *trygetnode(const tarjan *t, const upb_refcounted *r) {
+  /* freeze_slot may be left over from an earlier freeze, or be garbage. */
+  uint32_t slot = r->freeze_slot;
+  if (slot < t->node_count && t->nodes[slot].obj == r) {
+    return &t->nodes[slot];
+  }
+  return NULL;
 }
 
-static void setattr(tarjan *t, const upb_refcounted *r, uint64_t attr) {
-  upb_inttable_removeptr(&t->objattr, r, NULL);
-  upb_inttable_insertptr(&t->objattr, r, upb_value_uint64(attr));
+static tarjan_node *getnode(const tarjan *t, const upb_refcounted *r) {
+  tarjan_node *node = trygetnode(t, r);
+  UPB_ASSERT(node);
+  return node;
 }
 
-static color_t color(tarjan *t, const upb_refcounted *r) {
-  return trygetattr(t, r) & 0x3;  /* Color is always stored in the low 2 bits. */
+static color_t color(const tarjan *t, const upb_refcounted *r) {
+  tarjan_node *node = trygetnode(t, r);
+  return node ? node->color : BLACK;
 }
 
 static void set_gray(tarjan *t, const upb_refcounted *r) {
+  tarjan_node *node;
   UPB_ASSERT(color(t, r) == BLACK);
-  setattr(t, r, GRAY);
+  if (t->node_count == UINT32_MAX) {
+    upb_status_seterrmsg(t->status, "too many objects to freeze");
+    err(t);
+  }
+  tarjan_reserve(t, &t->nodes, &t->node_size, sizeof(*t->nodes),
+                 t->node_count + 1);
+  ((upb_refcounted*)r)->freeze_slot = t->node_count;
+  node = &t->nodes[t->node_count++];
+  node->obj = r;
+  node->color = GRAY;
 }
 
 /* Pushes an obj onto the Tarjan stack and sets it to GREEN. */
 static void push(tarjan *t, const upb_refcounted *r) {
-  UPB_ASSERT(color(t, r) == BLACK || color(t, r) == GRAY);
-  /* This defines the attr layout for the GREEN state.  "index" and "lowlink"
-   * get 31 bits, which is plenty (limit of 2B objects frozen at a time). */
-  setattr(t, r, GREEN | (t->index << 2) | (t->index << 33));
+  tarjan_node *node = getnode(t, r);
+  UPB_ASSERT(node->color == GRAY);
+  node->color = GREEN;
+  node->index = t->index;
+  node->lowlink = t->index;
   if (++t->index == 0x80000000) {
     upb_status_seterrmsg(t->status, "too many objects to freeze");
     err(t);
   }
-  upb_inttable_push(&t->stack, upb_value_ptr((void*)r));
+  tarjan_reserve(t, &t->stack, &t->stack_size, sizeof(*t->stack),
+                 t->stack_count + 1);
+  t->stack[t->stack_count++] = r->freeze_slot;
 }
 
-/* Pops an obj from the Tarjan stack and sets it to WHITE, with a ptr to its
- * SCC group. */
-static upb_refcounted *pop(tarjan *t) {
-  upb_refcounted *r = upb_value_getptr(upb_inttable_pop(&t->stack));
-  UPB_ASSERT(color(t, r) == GREEN);
-  /* This defines the attr layout for nodes in the WHITE state.
-   * Top of group stack is [group, NULL]; we point at group. */
-  setattr(t, r, WHITE | (upb_inttable_count(&t->groups) - 2) << 8);
-  return r;
+/* Pops an obj from the Tarjan stack and sets it to WHITE, with its SCC group
+ * being the newest one. */
+static const upb_refcounted *pop(tarjan *t) {
+  tarjan_node *node;
+  UPB_ASSERT(t->stack_count > 0);
+  node = &t->nodes[t->stack[--t->stack_count]];
+  UPB_ASSERT(node->color == GREEN);
+  node->color = WHITE;
+  node->group = t->group_count - 1;
+  return node->obj;
 }
 
 static void tarjan_newgroup(tarjan *t) {
-  uint32_t *group = upb_gmalloc(sizeof(*group));
-  if (!group) oom(t);
-  /* Push group and empty group leader (we'll fill in leader later). */
-  if (!upb_inttable_push(&t->groups, upb_value_ptr(group)) ||
-      !upb_inttable_push(&t->groups, upb_value_ptr(NULL))) {
-    upb_gfree(group);
-    oom(t);
-  }
-  *group = 0;
+  tarjan_group *g;
+  tarjan_reserve(t, &t->groups, &t->group_size, sizeof(*t->groups),
+                 t->group_count + 1);
+  g = &t->groups[t->group_count];
+  g->count = upb_gmalloc(sizeof(*g->count));
+  if (!g->count) oom(t);
+  *g->count = 0;
+  g->leader = NULL;
+  t->group_count++;
 }
 
 static uint32_t idx(tarjan *t, const upb_refcounted *r) {
-  UPB_ASSERT(color(t, r) == GREEN);
-  return (getattr(t, r) >> 2) & 0x7FFFFFFF;
+  tarjan_node *node = getnode(t, r);
+  UPB_ASSERT(node->color == GREEN);
+  return node->index;
 }
 
 static uint32_t lowlink(tarjan *t, const upb_refcounted *r) {
-  if (color(t, r) == GREEN) {
-    return getattr(t, r) >> 33;
+  tarjan_node *node = trygetnode(t, r);
+  if (node && node->color == GREEN) {
+    return node->lowlink;
   } else {
     return UINT32_MAX;
   }
 }
 
 static void set_lowlink(tarjan *t, const upb_refcounted *r, uint32_t lowlink) {
-  UPB_ASSERT(color(t, r) == GREEN);
-  setattr(t, r, ((uint64_t)lowlink << 33) | (getattr(t, r) & 0x1FFFFFFFF));
+  tarjan_node *node = getnode(t, r);
+  UPB_ASSERT(node->color == GREEN);
+  node->lowlink = lowlink;
 }
 
 static uint32_t *group(tarjan *t, upb_refcounted *r) {
-  uint64_t groupnum;
-  upb_value v;
-  bool found;
-
-  UPB_ASSERT(color(t, r) == WHITE);
-  groupnum = getattr(t, r) >> 8;
-  found = upb_inttable_lookup(&t->groups, groupnum, &v);
-  UPB_ASSERT(found);
-  return upb_value_getptr(v);
+  tarjan_node *node = getnode(t, r);
+  UPB_ASSERT(node->color == WHITE);
+  return t->groups[node->group].count;
 }
 
 /* If the group leader for this object's group has not previously been set,
  * the given object is assigned to be its leader. */
 static upb_refcounted *groupleader(tarjan *t, upb_refcounted *r) {
-  uint64_t leader_slot;
-  upb_value v;
-  bool found;
-
-  UPB_ASSERT(color(t, r) == WHITE);
-  leader_slot = (getattr(t, r) >> 8) + 1;
-  found = upb_inttable_lookup(&t->groups, leader_slot, &v);
-  UPB_ASSERT(found);
-  if (upb_value_getptr(v)) {
-    return upb_value_getptr(v);
-  } else {
-    upb_inttable_remove(&t->groups, leader_slot, NULL);
-    upb_inttable_insert(&t->groups, leader_slot, upb_value_ptr(r));
-    return r;
+  tarjan_node *node = getnode(t, r);
+  tarjan_group *g;
+  UPB_ASSERT(node->color == WHITE);
+  g = &t->groups[node->group];
+  if (!g->leader) {
+    g->leader = r;
   }
+  return g->leader;
 }
 
 
 /* Tarjan's algorithm --------------------------------------------------------*/
 
 /* See:
- *   http://en.wikipedia.org/wiki/Tarjan%27s_strongly_connected_components_algorithm */
-static void do_tarjan(const upb_refcounted *obj, tarjan *t);
-
-static void tarjan_visit(const upb_refcounted *obj,
-                         const upb_refcounted *subobj,
-                         void *closure) {
+ *   http://en.wikipedia.org/wiki/Tarjan%27s_strongly_connected_components_algorithm
+ *
+ * The DFS is iterative, so graphs of any depth up to maxdepth only use heap
+ * memory.  Since visit() can't be suspended part way through, each object's
+ * subobjects are all collected onto |edges| when it is pushed onto |frames|,
+ * and are then visited one at a time. */
+
+static void tarjan_collect(const upb_refcounted *obj,
+                           const upb_refcounted *subobj,
+                           void *closure) {
   tarjan *t = closure;
-  if (++t->depth > t->maxdepth) {
-    upb_status_seterrf(t->status, "graph too deep to freeze (%d)", t->maxdepth);
-    err(t);
-  } else if (subobj->is_frozen || color(t, subobj) == WHITE) {
-    /* Do nothing: we don't want to visit or color already-frozen nodes,
-     * and WHITE nodes have already been assigned a SCC. */
-  } else if (color(t, subobj) < GREEN) {
-    /* Subdef has not yet been visited; recurse on it. */
-    do_tarjan(subobj, t);
-    set_lowlink(t, obj, UPB_MIN(lowlink(t, obj), lowlink(t, subobj)));
-  } else if (color(t, subobj) == GREEN) {
-    /* Subdef is in the stack and hence in the current SCC. */
-    set_lowlink(t, obj, UPB_MIN(lowlink(t, obj), idx(t, subobj)));
-  }
-  --t->depth;
+  UPB_UNUSED(obj);
+  tarjan_reserve(t, &t->edges, &t->edge_size, sizeof(*t->edges),
+                 t->edge_count + 1);
+  t->edges[t->edge_count++] = subobj;
 }
 
-static void do_tarjan(const upb_refcounted *obj, tarjan *t) {
+/* Starts visiting |obj|. */
+static void tarjan_enter(tarjan *t, const upb_refcounted *obj) {
+  tarjan_frame *frame;
+
   if (color(t, obj) == BLACK) {
     /* We haven't seen this object's group; mark the whole group GRAY. */
     const upb_refcounted *o = obj;
@@ -518,12 +612,66 @@ static void do_tarjan(const upb_refcounted *obj, tarjan *t) {
   }
 
   push(t, obj);
-  visit(obj, tarjan_visit, t);
+  tarjan_reserve(t, &t->frames, &t->frame_size, sizeof(*t->frames),
+                 t->frame_count + 1);
+  frame = &t->frames[t->frame_count++];
+  frame->node = obj->freeze_slot;
+  frame->begin = t->edge_count;
+  visit(obj, tarjan_collect, t);
+  frame->next = frame->begin;
+  frame->end = t->edge_count;
+}
+
+/* Finishes visiting the object on top of |frames|. */
+static void tarjan_leave(tarjan *t) {
+  tarjan_frame *frame = &t->frames[--t->frame_count];
+  const upb_refcounted *obj = t->nodes[frame->node].obj;
+
+  t->edge_count = frame->begin;
   if (lowlink(t, obj) == idx(t, obj)) {
     tarjan_newgroup(t);
     while (pop(t) != obj)
       ;
   }
+
+  if (t->frame_count > 0) {
+    tarjan_frame *parent_frame = &t->frames[t->frame_count - 1];
+    const upb_refcounted *parent = t->nodes[parent_frame->node].obj;
+    set_lowlink(t, parent, UPB_MIN(lowlink(t, parent), lowlink(t, obj)));
+  }
+}
+
+static void do_tarjan(const upb_refcounted *root, tarjan *t) {
+  tarjan_enter(t, root);
+
+  while (t->frame_count > 0) {
+    tarjan_frame *frame = &t->frames[t->frame_count - 1];
+    const upb_refcounted *obj = t->nodes[frame->node].obj;
+    const upb_refcounted *subobj;
+
+    if (frame->next == frame->end) {
+      tarjan_leave(t);
+      continue;
+    }
+
+    subobj = t->edges[frame->next++];
+
+    if ((int)t->frame_count > t->maxdepth) {
+      upb_status_seterrf(t->status, "graph too deep to freeze (%d)",
+                         t->maxdepth);
+      err(t);
+    } else if (subobj->is_frozen || color(t, subobj) == WHITE) {
+      /* Do nothing: we don't want to visit or color already-frozen nodes,
+       * and WHITE nodes have already been assigned a SCC. */
+    } else if (color(t, subobj) < GREEN) {
+      /* Subdef has not yet been visited; descend into it.  tarjan_leave()
+       * updates our lowlink when it is done. */
+      tarjan_enter(t, subobj);
+    } else if (color(t, subobj) == GREEN) {
+      /* Subdef is in the stack and hence in the current SCC. */
+      set_lowlink(t, obj, UPB_MIN(lowlink(t, obj), idx(t, subobj)));
+    }
+  }
 }
 
 
@@ -544,20 +692,17 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
                    int maxdepth) {
   volatile bool ret = false;
   int i;
-  upb_inttable_iter iter;
+  size_t j;
 
   /* We run in two passes so that we can allocate all memory before performing
    * any mutation of the input -- this allows us to leave the input unchanged
    * in the case of memory allocation failure. */
   tarjan t;
-  t.index = 0;
-  t.depth = 0;
+  memset(&t, 0, sizeof(t));
   t.maxdepth = maxdepth;
   t.status = s;
-  if (!upb_inttable_init(&t.objattr, UPB_CTYPE_UINT64)) goto err1;
-  if (!upb_inttable_init(&t.stack, UPB_CTYPE_PTR)) goto err2;
-  if (!upb_inttable_init(&t.groups, UPB_CTYPE_PTR)) goto err3;
-  if (setjmp(t.err) != 0) goto err4;
+  upb_arena_init(&t.arena);
+  if (setjmp(t.err) != 0) goto err;
 
 
   for (i = 0; i < n; i++) {
@@ -571,24 +716,23 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
   ret = true;
 
   /* The transformation that follows requires care.  The preconditions are:
-   * - all objects in attr map are WHITE or GRAY, and are in mutable groups
+   * - all objects in t.nodes are WHITE or GRAY, and are in mutable groups
    *   (groups of all mutable objs)
    * - no ref2(to, from) refs have incremented count(to) if both "to" and
-   *   "from" are in our attr map (this follows from invariants (2) and (3)) */
+   *   "from" are in t.nodes (this follows from invariants (2) and (3)) */
 
   /* Pass 1: we remove WHITE objects from their mutable groups, and add them to
    * new groups  according to the SCC's we computed.  These new groups will
    * consist of only frozen objects.  None will be immediately collectible,
    * because WHITE objects are by definition reachable from one of "roots",
    * which the caller must own refs on. */
-  upb_inttable_begin(&iter, &t.objattr);
-  for(; !upb_inttable_done(&iter); upb_inttable_next(&iter)) {
-    upb_refcounted *obj = (upb_refcounted*)upb_inttable_iter_key(&iter);
+  for (j = 0; j < t.node_count; j++) {
+    upb_refcounted *obj = (upb_refcounted*)t.nodes[j].obj;
     /* Since removal from a singly-linked list requires access to the object's
      * predecessor, we consider obj->next instead of obj for moving.  With the
      * while() loop we guarantee that we will visit every node's predecessor.
      * Proof:
-     *  1. every node's predecessor is in our attr map.
+     *  1. every node's predecessor is in t.nodes.
      *  2. though the loop body may change a node's predecessor, it will only
      *     change it to be the node we are currently operating on, so with a
      *     while() loop we guarantee ourselves the chance to remove each node. */
@@ -633,10 +777,8 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
   /* Pass 2: GRAY and WHITE objects "obj" with ref2(to, obj) references must
    * increment count(to) if group(obj) != group(to) (which could now be the
    * case if "to" was just frozen). */
-  upb_inttable_begin(&iter, &t.objattr);
-  for(; !upb_inttable_done(&iter); upb_inttable_next(&iter)) {
-    upb_refcounted *obj = (upb_refcounted*)upb_inttable_iter_key(&iter);
-    visit(obj, crossref, &t);
+  for (j = 0; j < t.node_count; j++) {
+    visit(t.nodes[j].obj, crossref, &t);
   }
 
   /* Pass 3: GRAY objects are collected if their group's refcount dropped to
@@ -647,9 +789,8 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
    * It is important that we do this last, since the GRAY object's free()
    * function could call unref2() on just-frozen objects, which will decrement
    * refs that were added in pass 2. */
-  upb_inttable_begin(&iter, &t.objattr);
-  for(; !upb_inttable_done(&iter); upb_inttable_next(&iter)) {
-    upb_refcounted *obj = (upb_refcounted*)upb_inttable_iter_key(&iter);
+  for (j = 0; j < t.node_count; j++) {
+    upb_refcounted *obj = (upb_refcounted*)t.nodes[j].obj;
     if (obj->group == NULL || *obj->group == 0) {
       if (obj->group) {
         upb_refcounted *o;
@@ -673,18 +814,13 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
     }
   }
 
-err4:
+err:
   if (!ret) {
-    upb_inttable_begin(&iter, &t.groups);
-    for(; !upb_inttable_done(&iter); upb_inttable_next(&iter))
-      upb_gfree(upb_value_getptr(upb_inttable_iter_value(&iter)));
+    for (j = 0; j < t.group_count; j++) {
+      upb_gfree(t.groups[j].count);
+    }
   }
-  upb_inttable_uninit(&t.groups);
-err3:
-  upb_inttable_uninit(&t.stack);
-err2:
-  upb_inttable_uninit(&t.objattr);
-err1:
+  upb_arena_uninit(&t.arena);
   return ret;
 }
 
@@ -695,21 +831,37 @@ static bool merged(const upb_refcounted *r, const upb_refcounted *r2) {
   return r->group == r2->group;
 }
 
+/* Returns true if the group of |a| has no more objects than that of |b|, in
+ * time proportional to the smaller of the two. */
+static bool notlarger(const upb_refcounted *a, const upb_refcounted *b) {
+  const upb_refcounted *pa = a->next;
+  const upb_refcounted *pb = b->next;
+  while (pa != a && pb != b) {
+    pa = pa->next;
+    pb = pb->next;
+  }
+  return pa == a;
+}
+
 static void merge(upb_refcounted *r, upb_refcounted *from) {
   upb_refcounted *base;
   upb_refcounted *tmp;
 
   if (merged(r, from)) return;
+
+  /* Relabel the smaller group, so that building a group of n objects one at a
+   * time costs O(n log n) rather than O(n^2). */
+  if (!notlarger(from, r)) {
+    tmp = r;
+    r = from;
+    from = tmp;
+  }
+
   *r->group += *from->group;
   upb_gfree(from->group);
   base = from;
 
-  /* Set all refcount pointers in the "from" chain to the merged refcount.
-   *
-   * TODO(haberman): this linear algorithm can result in an overall O(n^2) bound
-   * if the user continuously extends a group by one object.  Prevent this by
-   * using one of the techniques in this paper:
-   *     http://bioinfo.ict.ac.cn/~dbu/AlgorithmCourses/Lectures/Union-Find-Tarjan.pdf */
+  /* Set all refcount pointers in the "from" chain to the merged refcount. */
   do { from->group = r->group; } while ((from = from->next) != base);
 
   /* Merge the two circularly linked lists by swapping their next pointers. */
@@ -794,14 +946,14 @@ bool upb_refcounted_isfrozen(const upb_refcounted *r) {
 void upb_refcounted_ref(const upb_refcounted *r, const void *owner) {
   track(r, owner, false);
   if (!r->is_frozen)
-    ((upb_refcounted*)r)->individual_count++;
+    atomic_inc(&((upb_refcounted*)r)->individual_count);
   refgroup(r->group);
 }
 
 void upb_refcounted_unref(const upb_refcounted *r, const void *owner) {
   untrack(r, owner, false);
   if (!r->is_frozen)
-    ((upb_refcounted*)r)->individual_count--;
+    atomic_dec(&((upb_refcounted*)r)->individual_count);
   unref(r);
 }
 
@@ -23,9 +23,10 @@
  * Valgrind attribute ref leaks to the code that took the leaked ref, not
  * the code that originally created the object.
  *
- * Enabling this requires the application to define upb_lock()/upb_unlock()
- * functions that acquire/release a global mutex (or #define UPB_THREAD_UNSAFE).
- * For this reason we don't enable it by default, even in debug builds.
+ * The tracking tables are guarded by spinlocks picked by object address, so
+ * threads sharing frozen defs only contend when they ref the same object (or
+ * objects unlucky enough to share a lock).  It still costs a table operation
+ * per ref/unref, so we don't enable it by default, even in debug builds.
  */
 
 /* #define UPB_DEBUG_REFS */
@@ -93,6 +94,10 @@ struct upb_refcounted {
    * in the group. */
   uint32_t individual_count;
 
+  /* Used only by upb_refcounted_freeze(), to find the object's state in an
+   * array instead of a hash table. */
+  uint32_t freeze_slot;
+
   bool is_frozen;
 
 #ifdef UPB_DEBUG_REFS
@@ -104,10 +109,10 @@ struct upb_refcounted {
 #ifdef UPB_DEBUG_REFS
 extern upb_alloc upb_alloc_debugrefs;
 #define UPB_REFCOUNT_INIT(vtbl, refs, ref2s) \
-    {&static_refcount, NULL, vtbl, 0, true, refs, ref2s}
+    {&static_refcount, NULL, vtbl, 0, 0, true, refs, ref2s}
 #else
 #define UPB_REFCOUNT_INIT(vtbl, refs, ref2s) \
-    {&static_refcount, NULL, vtbl, 0, true}
+    {&static_refcount, NULL, vtbl, 0, 0, true}
 #endif
 
 UPB_BEGIN_EXTERN_C
@@ -87,3 +87,71 @@ const char *upb_bufsink_getdata(const upb_bufsink *sink, size_t *len) {
   *len = sink->len;
   return sink->ptr;
 }
+
+bool upb_bytesbuf_init(upb_bytesbuf *b, upb_env *env, size_t size,
+                       upb_bytessink *output) {
+  UPB_ASSERT(size > 0);
+  b->buf = upb_env_malloc(env, size);
+  if (!b->buf) return false;
+  b->ptr = b->buf;
+  b->end = b->buf + size;
+  b->output = output;
+  b->subc = output->closure;
+  return true;
+}
+
+bool upb_bytesbuf_start(upb_bytesbuf *b, size_t size_hint) {
+  b->ptr = b->buf;
+  return upb_bytessink_start(b->output, size_hint, &b->subc);
+}
+
+bool upb_bytesbuf_flush(upb_bytesbuf *b) {
+  size_t len = b->ptr - b->buf;
+  if (len == 0) return true;
+  b->ptr = b->buf;
+  return upb_bytessink_putbuf(b->output, b->subc, b->buf, len, NULL) >= len;
+}
+
+bool upb_bytesbuf_end(upb_bytesbuf *b) {
+  bool ok = upb_bytesbuf_flush(b);
+  return upb_bytessink_end(b->output) && ok;
+}
+
+bool upb_bytesbuf_putslow(upb_bytesbuf *b, const char *data, size_t len) {
+  if (!upb_bytesbuf_flush(b)) return false;
+  if (len > (size_t)(b->end - b->buf)) {
+    /* Too big to be worth copying. */
+    return upb_bytessink_putbuf(b->output, b->subc, data, len, NULL) >= len;
+  }
+  memcpy(b->ptr, data, len);
+  b->ptr += len;
+  return true;
+}
+
+static void *upb_bytesbuf_startstr(void *_b, const void *hd,
+                                   size_t size_hint) {
+  upb_bytesbuf *b = _b;
+  UPB_UNUSED(hd);
+  return upb_bytesbuf_start(b, size_hint) ? b : NULL;
+}
+
+static size_t upb_bytesbuf_string(void *_b, const void *hd, const char *ptr,
+                                  size_t len, const upb_bufhandle *handle) {
+  UPB_UNUSED(hd);
+  UPB_UNUSED(handle);
+  return upb_bytesbuf_put(_b, ptr, len) ? len : 0;
+}
+
+static bool upb_bytesbuf_endstr(void *_b, const void *hd) {
+  UPB_UNUSED(hd);
+  return upb_bytesbuf_end(_b);
+}
+
+upb_bytessink *upb_bytesbuf_input(upb_bytesbuf *b) {
+  upb_byteshandler_init(&b->handler);
+  upb_byteshandler_setstartstr(&b->handler, upb_bytesbuf_startstr, NULL);
+  upb_byteshandler_setstring(&b->handler, upb_bytesbuf_string, NULL);
+  upb_byteshandler_setendstr(&b->handler, upb_bytesbuf_endstr, NULL);
+  upb_bytessink_reset(&b->input, &b->handler, b);
+  return &b->input;
+}
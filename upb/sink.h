@@ -223,6 +223,67 @@ void upb_bufsink_free(upb_bufsink *sink);
 upb_bytessink *upb_bufsink_sink(upb_bufsink *sink);
 const char *upb_bufsink_getdata(const upb_bufsink *sink, size_t *len);
 
+/* upb_bytesbuf: coalesces small writes to a upb_bytessink.
+ *
+ * Printers emit their output a few bytes at a time (a quote, a comma, a
+ * number), and each upb_bytessink_putbuf() is an indirect call into a sink
+ * that may be expensive.  A upb_bytesbuf collects writes in a block and passes
+ * them downstream only when the block fills or when the string ends.  Writes
+ * that don't fit in an empty block go straight through.
+ *
+ * Code that owns the buffer writes to it with the inline upb_bytesbuf_put().
+ * To put a buffer in front of an existing sink without changing the code that
+ * writes to it, pass upb_bytesbuf_input() in place of the original sink. */
+
+/* A block size that suits most sinks.  The block comes from the upb_env, so
+ * objects that embed a upb_bytesbuf must count it in their UPB_*_SIZE. */
+#define UPB_BYTESBUF_DEFAULTSIZE 4096
+
+typedef struct {
+  char *buf, *ptr, *end;
+
+  /* Where the data goes, and the closure returned by its startstr handler. */
+  upb_bytessink *output;
+  void *subc;
+
+  /* For upb_bytesbuf_input(). */
+  upb_byteshandler handler;
+  upb_bytessink input;
+} upb_bytesbuf;
+
+/* Allocates a block of |size| bytes from |env| for writes to |output|.
+ * Returns false if the block could not be allocated. */
+bool upb_bytesbuf_init(upb_bytesbuf *b, upb_env *env, size_t size,
+                       upb_bytessink *output);
+
+/* Starts a string on the output (upb_bytessink_start()) and empties the
+ * buffer. */
+bool upb_bytesbuf_start(upb_bytesbuf *b, size_t size_hint);
+
+/* Passes everything buffered so far downstream.  Returns false if the output
+ * did not accept all of it. */
+bool upb_bytesbuf_flush(upb_bytesbuf *b);
+
+/* Flushes, then ends the string on the output (upb_bytessink_end()). */
+bool upb_bytesbuf_end(upb_bytesbuf *b);
+
+/* A sink whose data is buffered by |b| on its way to b->output. */
+upb_bytessink *upb_bytesbuf_input(upb_bytesbuf *b);
+
+/* Slow path of upb_bytesbuf_put(), for when |len| bytes don't fit. */
+bool upb_bytesbuf_putslow(upb_bytesbuf *b, const char *data, size_t len);
+
+/* Appends |len| bytes; returns false if a flush this caused failed. */
+UPB_INLINE bool upb_bytesbuf_put(upb_bytesbuf *b, const char *data,
+                                 size_t len) {
+  if (UPB_LIKELY(len <= (size_t)(b->end - b->ptr))) {
+    memcpy(b->ptr, data, len);
+    b->ptr += len;
+    return true;
+  }
+  return upb_bytesbuf_putslow(b, data, len);
+}
+
 /* Inline definitions. */
 
 UPB_INLINE void upb_bytessink_reset(upb_bytessink *s, const upb_byteshandler *h,
@@ -296,6 +357,30 @@ PUTVAL(double, double)
 PUTVAL(bool,   bool)
 #undef PUTVAL
 
+/* Delivers |n| consecutive values of a repeated field to its array handler
+ * (see upb_handlers_setint32array() and friends). */
+#define PUTARRAY(type, ctype)                                                  \
+  UPB_INLINE bool upb_sink_put##type##array(upb_sink *s, upb_selector_t sel,   \
+                                            const ctype *vals, size_t n) {     \
+    typedef upb_##type##array_handlerfunc functype;                            \
+    functype *func;                                                            \
+    const void *hd;                                                            \
+    if (!s->handlers) return true;                                             \
+    func = (functype *)upb_handlers_gethandler(s->handlers, sel);              \
+    if (!func) return true;                                                    \
+    hd = upb_handlers_gethandlerdata(s->handlers, sel);                        \
+    return func(s->closure, hd, vals, n);                                      \
+  }
+
+PUTARRAY(int32,  int32_t)
+PUTARRAY(int64,  int64_t)
+PUTARRAY(uint32, uint32_t)
+PUTARRAY(uint64, uint64_t)
+PUTARRAY(float,  float)
+PUTARRAY(double, double)
+PUTARRAY(bool,   bool)
+#undef PUTARRAY
+
 UPB_INLINE void upb_sink_reset(upb_sink *s, const upb_handlers *h, void *c) {
   s->handlers = h;
   s->closure = c;
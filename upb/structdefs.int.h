@@ -41,10 +41,14 @@ struct upb_def {
    * us to easily determine which defs were passed into the function's
    * current invocation. */
   bool came_from_user;
+
+  /* True if fullname is in the name pool of |file|, so it is not ours to
+   * free. */
+  bool name_interned;
 };
 
 #define UPB_DEF_INIT(name, type, vtbl, refs, ref2s) \
-    { UPB_REFCOUNT_INIT(vtbl, refs, ref2s), name, NULL, type, false }
+    { UPB_REFCOUNT_INIT(vtbl, refs, ref2s), name, NULL, type, false, false }
 
 
 /* upb_fielddef ***************************************************************/
@@ -157,6 +161,7 @@ struct upb_oneofdef {
   upb_strtable ntof;
   upb_inttable itof;
   const upb_msgdef *parent;
+  bool name_interned;  /* As in upb_def. */
 };
 
 extern const struct upb_refcounted_vtbl upb_oneofdef_vtbl;
@@ -184,6 +189,10 @@ struct upb_filedef {
 
   upb_inttable defs;
   upb_inttable deps;
+
+  /* Holds the names of the defs, fields and oneofs in this file once it is
+   * added to a symtab, or NULL before. */
+  char *names;
 };
 
 extern const struct upb_refcounted_vtbl upb_filedef_vtbl;
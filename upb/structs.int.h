@@ -5,6 +5,18 @@
 #ifndef UPB_STRUCTS_H_
 #define UPB_STRUCTS_H_
 
+#include "upb/decode.h"
+#include "upb/table.int.h"
+
+/* Every array is allocated with UPB_ARRAY_INLINEBYTES bytes of storage right
+ * after it, which |data| points to until the elements outgrow it.  Most
+ * repeated fields hold only a few elements, so this saves them an allocation
+ * and keeps them next to the array.  Define it as 0 to always allocate the
+ * elements separately. */
+#ifndef UPB_ARRAY_INLINEBYTES
+#define UPB_ARRAY_INLINEBYTES 32
+#endif
+
 struct upb_array {
   upb_fieldtype_t type;
   uint8_t element_size;
@@ -12,7 +24,216 @@ struct upb_array {
   size_t len;   /* Measured in elements. */
   size_t size;  /* Measured in elements. */
   upb_arena *arena;
+  bool dirty;   /* Changed since its message's size was cached. */
 };
 
-#endif  /* UPB_STRUCTS_H_ */
+/* The inline storage starts here, aligned for any element type. */
+#define UPB_ARRAY_HEADERSIZE \
+  ((sizeof(upb_array) + sizeof(upb_msgval) - 1) / sizeof(upb_msgval) * \
+   sizeof(upb_msgval))
+
+UPB_INLINE bool upb_array_isinline(const upb_array *arr) {
+  return arr->data == (char*)arr + UPB_ARRAY_HEADERSIZE;
+}
+
+/* Moves the elements to storage for |size| elements, which must be more than
+ * arr->size.  Storage outside the array is reallocated in place if the arena
+ * can; inline storage is copied out of.  Returns false if out of memory.
+ * Defined in msg.c. */
+bool upb_array_realloc(upb_array *arr, size_t size);
+
+/* Maps with integer or bool keys keep their entries inline in an
+ * open-addressing table, keyed by the key's bits as a uint64_t.  A key of 0
+ * marks an empty slot, so the entry for key 0 (or false) is stored apart.
+ * String keys go in a upb_strtable whose values point to a upb_msgval, since
+ * a upb_msgval may not fit in a upb_value. */
+typedef struct {
+  uint64_t key;
+  upb_msgval val;
+} upb_mapent;
+
+struct upb_map {
+  upb_fieldtype_t key_type;
+  upb_fieldtype_t val_type;
+  upb_arena *arena;
+
+  /* For string keys. */
+  upb_strtable strtab;
+
+  /* For all other keys.  |ents| has 1 << size_lg2 slots, or is NULL. */
+  upb_mapent *ents;
+  uint8_t size_lg2;
+  size_t count;          /* Entries in |ents|. */
+  bool has_zero;
+  upb_msgval zero_val;
+  bool dirty;  /* Changed since its message's size was cached. */
+};
+
+struct upb_mapiter {
+  upb_fieldtype_t key_type;
+
+  /* For string keys. */
+  upb_strtable_iter iter;
+
+  /* For other keys: 0 is the entry for key 0, and i + 1 is slot i. */
+  const upb_map *map;
+  size_t index;
+};
+
+struct upb_decodemask {
+  const upb_msglayout *layout;
+
+  /* Bit i is set if field i of |layout| is kept. */
+  uint32_t *fields;
+
+  /* For each kept submessage field, the mask for its submessages, or NULL to
+   * keep them whole.  NULL if no field has one. */
+  struct upb_decodemask **submasks;
+};
 
+UPB_INLINE bool upb_decodemask_keeps(const upb_decodemask *mask, int i) {
+  return (mask->fields[i / 32] >> (i % 32)) & 1;
+}
+
+/* Returns true if field |f| of layout |l| is a map, whose slot holds a
+ * upb_map* rather than a upb_array*. */
+UPB_INLINE bool upb_msglayout_ismap(const upb_msglayout *l,
+                                    const upb_msglayout_field *f) {
+  return f->label == UPB_LABEL_REPEATED &&
+         f->descriptortype == UPB_DESCRIPTOR_TYPE_MESSAGE &&
+         l->submsgs[f->submsg_index]->mapentry;
+}
+
+/* Finds the key (number 1) and value (number 2) fields of map entry layout
+ * |l|.  Their order in |l->fields| depends on the types. */
+UPB_INLINE void upb_mapentry_fields(const upb_msglayout *l,
+                                    const upb_msglayout_field **key,
+                                    const upb_msglayout_field **val) {
+  UPB_ASSERT(l->mapentry && l->field_count == 2);
+  if (l->fields[0].number == 1) {
+    *key = &l->fields[0];
+    *val = &l->fields[1];
+  } else {
+    *key = &l->fields[1];
+    *val = &l->fields[0];
+  }
+}
+
+/* A singular submessage that upb_decode2() left unparsed because of
+ * UPB_DECODE_LAZY.  The submessage slot holds a pointer to one of these with
+ * the low bit set; upb_decode_lazy() parses it and stores the real message in
+ * the slot instead.  Code that reads submessage slots directly must check for
+ * this first. */
+typedef struct {
+  upb_stringview data;  /* Outlives the message, like aliased strings. */
+  upb_arena *arena;     /* The parent message's arena. */
+  int options;          /* upb_decodeopt flags for parsing |data|. */
+  const struct upb_decodemask *mask;  /* May be NULL. */
+  size_t max_nesting;   /* Nesting left for |data|, counting itself. */
+  const upb_extreg *extreg;  /* May be NULL. */
+} upb_lazymsg;
+
+UPB_INLINE bool upb_islazymsg(const void *submsg) {
+  return (uintptr_t)submsg & 1;
+}
+
+UPB_INLINE const upb_lazymsg *upb_getlazymsg(const void *submsg) {
+  UPB_ASSERT(upb_islazymsg(submsg));
+  return (const upb_lazymsg*)((uintptr_t)submsg - 1);
+}
+
+/* Parses the lazy submessage in |*slot|, which has layout |l|, and replaces it
+ * with the result.  Returns the message, or NULL (leaving |*slot| alone) if
+ * the data doesn't parse or we run out of memory.  Defined in decode.c. */
+void *upb_decode_lazy(void **slot, const upb_msglayout *l);
+
+/* Parses the data of |lazy| into |msg|, which has layout |l|, with |options|
+ * in place of the recorded ones.  Defined in decode.c. */
+bool upb_decode_lazyinto(const upb_lazymsg *lazy, upb_msg *msg,
+                         const upb_msglayout *l, int options);
+
+/* The encoded size of |msg| plus one, as cached by UPB_ENCODE_CACHESIZE, or 0
+ * if none is cached.  upb_msg_invalidatesize() and everything else in msg.c
+ * that changes a message resets it to 0.  Arrays and maps don't know which
+ * message they belong to, so they have a |dirty| flag for the encoder to
+ * check instead.  Defined in msg.c. */
+size_t upb_msg_sizecache(const upb_msg *msg);
+void upb_msg_setsizecache(upb_msg *msg, size_t size);
+
+/* For allocating several messages of one layout in a single block, which
+ * keeps them next to each other in memory: the block holds one message every
+ * upb_msg_stride(l) bytes, and upb_msg_init() makes a message of the one at
+ * |mem|.  Defined in msg.c. */
+size_t upb_msg_stride(const upb_msglayout *l);
+upb_msg *upb_msg_init(void *mem, const upb_msglayout *l, upb_arena *a);
+
+/* The value of an extension lives in a small message of its own, a holder,
+ * whose layout has the extension as its only field and which points back to
+ * the extension.  A singular extension gets a hasbit, since extensions have
+ * presence.  That way the code that decodes, encodes, merges and compares
+ * fields does the same for extensions.  Defined in msg.c. */
+#define UPB_EXTHOLDER_VALUE 8  /* Offset of the value; byte 0 has the hasbit. */
+#define UPB_EXTHOLDER_EXT 24   /* Offset of the upb_msglayout_ext*. */
+#define UPB_EXTHOLDER_SIZE 32
+
+/* Points into itself, so it must not be copied. */
+typedef struct {
+  upb_msglayout layout;
+  upb_msglayout_field field;
+} upb_extholderlayout;
+
+/* Fills in |l| as the layout of the holders of |e|.  This runs for every
+ * extension parsed, written or read, so it is inline, and sets one member at
+ * a time: at -Os a memset and struct copy become string moves, which cost
+ * more here than the rest of the work. */
+UPB_INLINE void upb_extholder_layout(const upb_msglayout_ext *e,
+                                     upb_extholderlayout *l) {
+  l->field.number = e->field.number;
+  l->field.offset = UPB_EXTHOLDER_VALUE;
+  l->field.presence = e->field.label == UPB_LABEL_REPEATED ? 0 : 1;
+  l->field.submsg_index = 0;
+  l->field.descriptortype = e->field.descriptortype;
+  l->field.label = e->field.label;
+  l->layout.submsgs = &e->submsg;
+  l->layout.fields = &l->field;
+  l->layout.size = UPB_EXTHOLDER_SIZE;
+  l->layout.field_count = 1;
+  l->layout.extendable = false;
+  l->layout.dense_count = 0;
+  l->layout.dense = NULL;
+  l->layout.mapentry = false;
+  l->layout.parse = NULL;
+  l->layout.required_size = 0;
+  l->layout.required = NULL;
+}
+
+UPB_INLINE const upb_msglayout_ext *upb_extholder_ext(const upb_msg *holder) {
+  return *(const upb_msglayout_ext *const*)((const char*)holder +
+                                            UPB_EXTHOLDER_EXT);
+}
+
+/* An extendable message keeps its holders in an array sorted by field number,
+ * so they are found by binary search and written out in order.  Messages
+ * rarely have more than a few extensions, and for those an array costs less
+ * to build and to search than a hash table.  The numbers are copied into the
+ * array so that searching it doesn't touch the holders. */
+typedef struct {
+  uint32_t number;
+  upb_msg *holder;
+} upb_msgext;
+
+typedef struct {
+  uint32_t len;
+  uint32_t size;
+  upb_msgext ents[1];  /* Dynamically sized: |size| long. */
+} upb_msgexts;
+
+/* Returns the extensions of |msg|, which has extendable layout |l|, or NULL
+ * if it has never had one. */
+const upb_msgexts *upb_msg_exts(const upb_msg *msg, const upb_msglayout *l);
+
+/* Returns the holder of |e| in |msg|, adding an empty one if there is none,
+ * or NULL if out of memory. */
+upb_msg *upb_msg_extholder(upb_msg *msg, const upb_msglayout_ext *e);
+
+#endif  /* UPB_STRUCTS_H_ */
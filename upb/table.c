@@ -22,6 +22,12 @@ static void upb_check_alloc(upb_table *t, upb_alloc *a) {
 
 static const double MAX_LOAD = 0.85;
 
+/* How many hash seeds upb_strtable_compact2() tries per table size. */
+static const uint32_t MAX_SEEDS = 256;
+
+/* How many keys the batch lookups have in flight at once. */
+#define LOOKUP_BATCH 16
+
 /* The minimum utilization of the array part of a mixed hash/array table.  This
  * is a speed/memory-usage tradeoff (though it's not straightforward because of
  * cache effects).  The lower this is, the more memory we'll use. */
@@ -80,7 +86,7 @@ static lookupkey_t intkey(uintptr_t key) {
   return k;
 }
 
-typedef uint32_t hashfunc_t(upb_tabkey key);
+typedef uint32_t hashfunc_t(const upb_table *t, upb_tabkey key);
 typedef bool eqlfunc_t(upb_tabkey k1, lookupkey_t k2);
 
 /* Base table (shared code) ***************************************************/
@@ -134,12 +140,9 @@ static upb_tabent *getentry_mutable(upb_table *t, uint32_t hash) {
   return (upb_tabent*)upb_getentry(t, hash);
 }
 
-static const upb_tabent *findentry(const upb_table *t, lookupkey_t key,
-                                   uint32_t hash, eqlfunc_t *eql) {
-  const upb_tabent *e;
-
-  if (t->size_lg2 == 0) return NULL;
-  e = upb_getentry(t, hash);
+/* Searches the chain that starts at |e|, the main position of |key|. */
+static const upb_tabent *findchain(const upb_tabent *e, lookupkey_t key,
+                                   eqlfunc_t *eql) {
   if (upb_tabent_isempty(e)) return NULL;
   while (1) {
     if (eql(e->key, key)) return e;
@@ -147,6 +150,12 @@ static const upb_tabent *findentry(const upb_table *t, lookupkey_t key,
   }
 }
 
+static const upb_tabent *findentry(const upb_table *t, lookupkey_t key,
+                                   uint32_t hash, eqlfunc_t *eql) {
+  if (t->size_lg2 == 0) return NULL;
+  return findchain(upb_getentry(t, hash), key, eql);
+}
+
 static upb_tabent *findentry_mutable(upb_table *t, lookupkey_t key,
                                      uint32_t hash, eqlfunc_t *eql) {
   return (upb_tabent*)findentry(t, key, hash, eql);
@@ -186,7 +195,7 @@ static void insert(upb_table *t, lookupkey_t key, upb_tabkey tabkey,
     /* Collision. */
     upb_tabent *new_e = emptyent(t);
     /* Head of collider's chain. */
-    upb_tabent *chain = getentry_mutable(t, hashfunc(mainpos_e->key));
+    upb_tabent *chain = getentry_mutable(t, hashfunc(t, mainpos_e->key));
     if (chain == mainpos_e) {
       /* Existing ent is in its main posisiton (it has the same hash as us, and
        * is the head of our chain).  Insert to new ent and append to this chain. */
@@ -274,14 +283,22 @@ static upb_tabkey strcopy(lookupkey_t k2, upb_alloc *a) {
   char *str = upb_malloc(a, k2.str.len + sizeof(uint32_t) + 1);
   if (str == NULL) return 0;
   memcpy(str, &len, sizeof(uint32_t));
-  memcpy(str + sizeof(uint32_t), k2.str.str, k2.str.len + 1);
+  /* The key need not be NUL-terminated (or, if empty, be anything at all), so
+   * the NUL is added here. */
+  if (len > 0) memcpy(str + sizeof(uint32_t), k2.str.str, len);
+  str[sizeof(uint32_t) + len] = '\0';
   return (uintptr_t)str;
 }
 
-static uint32_t strhash(upb_tabkey key) {
+static uint32_t upb_strtable_hash(const upb_strtable *t, const char *key,
+                                  size_t len) {
+  return t->murmurhash ? MurmurHash2(key, len, 0) : upb_hash(key, len, t->seed);
+}
+
+static uint32_t strhash(const upb_table *t, upb_tabkey key) {
   uint32_t len;
   char *str = upb_tabstr(key, &len);
-  return MurmurHash2(str, len, 0);
+  return upb_strtable_hash((const upb_strtable*)t, str, len);
 }
 
 static bool streql(upb_tabkey k1, lookupkey_t k2) {
@@ -291,6 +308,8 @@ static bool streql(upb_tabkey k1, lookupkey_t k2) {
 }
 
 bool upb_strtable_init2(upb_strtable *t, upb_ctype_t ctype, upb_alloc *a) {
+  t->murmurhash = false;
+  t->seed = 0;
   return init(&t->t, ctype, 2, a);
 }
 
@@ -301,12 +320,30 @@ void upb_strtable_uninit2(upb_strtable *t, upb_alloc *a) {
   uninit(&t->t, a);
 }
 
-bool upb_strtable_resize(upb_strtable *t, size_t size_lg2, upb_alloc *a) {
+void upb_strtable_clear(upb_strtable *t, upb_alloc *a) {
+  size_t i;
+  upb_check_alloc(&t->t, a);
+  UPB_ASSERT(!t->murmurhash);
+  for (i = 0; i < upb_table_size(&t->t); i++)
+    upb_free(a, (void*)t->t.entries[i].key);
+  if (t->t.entries) {
+    memset(mutable_entries(&t->t), 0,
+           upb_table_size(&t->t) * sizeof(upb_tabent));
+  }
+  t->t.count = 0;
+}
+
+/* Moves every entry of |t| into a new table of 2^size_lg2 entries that hashes
+ * with |seed|. */
+static bool strtable_rebuild(upb_strtable *t, size_t size_lg2, uint32_t seed,
+                             upb_alloc *a) {
   upb_strtable new_table;
   upb_strtable_iter i;
 
   upb_check_alloc(&t->t, a);
 
+  new_table.murmurhash = false;
+  new_table.seed = seed;
   if (!init(&new_table.t, t->t.ctype, size_lg2, a))
     return false;
   upb_strtable_begin(&i, t);
@@ -323,6 +360,74 @@ bool upb_strtable_resize(upb_strtable *t, size_t size_lg2, upb_alloc *a) {
   return true;
 }
 
+bool upb_strtable_resize(upb_strtable *t, size_t size_lg2, upb_alloc *a) {
+  return strtable_rebuild(t, size_lg2, t->seed, a);
+}
+
+/* Returns how many keys of |t| would not be in their main position of a table
+ * of 2^size_lg2 entries hashed with |seed|.  Stops counting once it passes
+ * |max|.  |used| must have room for a flag per entry. */
+static size_t strtable_collisions(const upb_strtable *t, uint8_t size_lg2,
+                                  uint32_t seed, size_t max, bool *used) {
+  size_t mask = ((size_t)1 << size_lg2) - 1;
+  size_t collisions = 0;
+  upb_strtable_iter i;
+
+  memset(used, 0, (mask + 1) * sizeof(*used));
+  upb_strtable_begin(&i, t);
+  for ( ; !upb_strtable_done(&i); upb_strtable_next(&i)) {
+    size_t slot = upb_hash(upb_strtable_iter_key(&i),
+                           upb_strtable_iter_keylength(&i), seed) & mask;
+    if (used[slot] && ++collisions > max) break;
+    used[slot] = true;
+  }
+  return collisions;
+}
+
+void upb_strtable_compact2(upb_strtable *t, upb_alloc *a) {
+  size_t count = upb_strtable_count(t);
+  uint8_t size_lg2 = 1;
+  uint8_t best_lg2;
+  uint32_t best_seed = 0;
+  size_t best = SIZE_MAX;
+  uint32_t seed;
+  bool *used;
+
+  upb_check_alloc(&t->t, a);
+  UPB_ASSERT(!t->murmurhash);
+
+  /* The smallest size that inserting |count| entries would have grown to. */
+  while ((double)count / ((size_t)1 << size_lg2) > MAX_LOAD) size_lg2++;
+  best_lg2 = size_lg2;
+
+  used = upb_malloc(a, ((size_t)2 << size_lg2) * sizeof(*used));
+  if (!used) return;
+
+  /* A seed that gives every key a slot of its own makes every lookup a single
+   * probe.  One is easy to find for the small tables of most messages; bigger
+   * ones may need a table twice the size, and failing that we settle for the
+   * fewest collisions. */
+  for (seed = 0; seed < MAX_SEEDS && best > 0; seed++) {
+    size_t n = strtable_collisions(t, size_lg2, seed, best, used);
+    if (n < best) {
+      best = n;
+      best_seed = seed;
+    }
+  }
+  for (seed = 0; seed < MAX_SEEDS && best > 0; seed++) {
+    if (strtable_collisions(t, size_lg2 + 1, seed, 0, used) == 0) {
+      best = 0;
+      best_lg2 = size_lg2 + 1;
+      best_seed = seed;
+    }
+  }
+
+  upb_free(a, used);
+  if (best_lg2 != t->t.size_lg2 || best_seed != t->seed) {
+    strtable_rebuild(t, best_lg2, best_seed, a);
+  }
+}
+
 bool upb_strtable_insert3(upb_strtable *t, const char *k, size_t len,
                           upb_value v, upb_alloc *a) {
   lookupkey_t key;
@@ -330,6 +435,7 @@ bool upb_strtable_insert3(upb_strtable *t, const char *k, size_t len,
   uint32_t hash;
 
   upb_check_alloc(&t->t, a);
+  UPB_ASSERT(!t->murmurhash);
 
   if (isfull(&t->t)) {
     /* Need to resize.  New table of double the size, add old elements to it. */
@@ -342,21 +448,63 @@ bool upb_strtable_insert3(upb_strtable *t, const char *k, size_t len,
   tabkey = strcopy(key, a);
   if (tabkey == 0) return false;
 
-  hash = MurmurHash2(key.str.str, key.str.len, 0);
+  hash = upb_strtable_hash(t, key.str.str, key.str.len);
   insert(&t->t, key, tabkey, v, hash, &strhash, &streql);
   return true;
 }
 
 bool upb_strtable_lookup2(const upb_strtable *t, const char *key, size_t len,
                           upb_value *v) {
-  uint32_t hash = MurmurHash2(key, len, 0);
+  uint32_t hash = upb_strtable_hash(t, key, len);
   return lookup(&t->t, strkey2(key, len), v, hash, &streql);
 }
 
+size_t upb_strtable_lookupbatch(const upb_strtable *t, const char *const *keys,
+                                const size_t *lens, size_t n, upb_value *vals,
+                                bool *found) {
+  const upb_tabent *ents[LOOKUP_BATCH];
+  size_t ret = 0;
+  size_t base;
+
+  for (base = 0; base < n; base += LOOKUP_BATCH) {
+    size_t m = UPB_MIN(n - base, LOOKUP_BATCH);
+    size_t i;
+
+    if (t->t.size_lg2 == 0) {
+      for (i = 0; i < m; i++) found[base + i] = false;
+      continue;
+    }
+
+    for (i = 0; i < m; i++) {
+      uint32_t hash = upb_strtable_hash(t, keys[base + i], lens[base + i]);
+      ents[i] = upb_getentry(&t->t, hash);
+      UPB_PREFETCH(ents[i]);
+    }
+
+    /* The key strings are one more miss away. */
+    for (i = 0; i < m; i++) {
+      if (!upb_tabent_isempty(ents[i])) UPB_PREFETCH((const char*)ents[i]->key);
+    }
+
+    for (i = 0; i < m; i++) {
+      const upb_tabent *e =
+          findchain(ents[i], strkey2(keys[base + i], lens[base + i]), &streql);
+      found[base + i] = e != NULL;
+      if (e) {
+        _upb_value_setval(&vals[base + i], e->val.val, t->t.ctype);
+        ret++;
+      }
+    }
+  }
+
+  return ret;
+}
+
 bool upb_strtable_remove3(upb_strtable *t, const char *key, size_t len,
                          upb_value *val, upb_alloc *alloc) {
-  uint32_t hash = MurmurHash2(key, len, 0);
+  uint32_t hash = upb_strtable_hash(t, key, len);
   upb_tabkey tabkey;
+  UPB_ASSERT(!t->murmurhash);
   if (rm(&t->t, strkey2(key, len), val, &tabkey, hash, &streql)) {
     upb_free(alloc, (void*)tabkey);
     return true;
@@ -419,7 +567,10 @@ bool upb_strtable_iter_isequal(const upb_strtable_iter *i1,
 /* For inttables we use a hybrid structure where small keys are kept in an
  * array and large keys are put in the hash table. */
 
-static uint32_t inthash(upb_tabkey key) { return upb_inthash(key); }
+static uint32_t inthash(const upb_table *t, upb_tabkey key) {
+  UPB_UNUSED(t);
+  return upb_inthash(key);
+}
 
 static bool inteql(upb_tabkey k1, lookupkey_t k2) {
   return k1 == k2.num;
@@ -429,9 +580,135 @@ static upb_tabval *mutable_array(upb_inttable *t) {
   return (upb_tabval*)t->array;
 }
 
+/* Compact hash parts, see upb_tabent32. */
+
+static const upb_tabent32 *ents32(const upb_inttable *t) {
+  return (const upb_tabent32*)t->t.entries;
+}
+
+static upb_tabent32 *mutable_ents32(upb_inttable *t) {
+  return (upb_tabent32*)t->t.entries;
+}
+
+/* The main position of |key|, which must fit in 32 bits. */
+static upb_tabent32 *getentry32(upb_inttable *t, uintptr_t key) {
+  return &mutable_ents32(t)[upb_inthash(key) & t->t.mask];
+}
+
+static upb_tabent32 *findentry32(upb_inttable *t, uintptr_t key) {
+  upb_tabent32 *e;
+
+  if ((uint32_t)key != key) return NULL;
+  e = getentry32(t, key);
+  if (e->key == 0) return NULL;
+  while (e->key != key) {
+    if (e->next == 0) return NULL;
+    e = &mutable_ents32(t)[e->next - 1];
+  }
+  return e;
+}
+
+/* Like rm(), for a compact hash part. */
+static bool rm32(upb_inttable *t, uintptr_t key, upb_value *val) {
+  upb_tabent32 *ents = mutable_ents32(t);
+  upb_tabent32 *chain;
+  upb_tabent32 *e;
+
+  if ((uint32_t)key != key) return false;
+  chain = getentry32(t, key);
+  if (chain->key == 0) return false;
+
+  if (chain->key == key) {
+    /* Element to remove is at the head of its chain. */
+    e = chain;
+    if (val) _upb_value_setval(val, e->val.val, t->t.ctype);
+    if (chain->next) {
+      upb_tabent32 *move = &ents[chain->next - 1];
+      *chain = *move;
+      move->key = 0;  /* Make the slot empty. */
+    } else {
+      chain->key = 0;  /* Make the slot empty. */
+    }
+  } else {
+    while (chain->next && ents[chain->next - 1].key != key) {
+      chain = &ents[chain->next - 1];
+    }
+    if (!chain->next) return false;
+    e = &ents[chain->next - 1];
+    if (val) _upb_value_setval(val, e->val.val, t->t.ctype);
+    e->key = 0;  /* Make the slot empty. */
+    chain->next = e->next;
+  }
+
+  t->t.count--;
+  return true;
+}
+
+/* Switches the hash part to upb_tabent32 if that is smaller and every key in
+ * it fits.  Leaves it alone if out of memory. */
+static void inttable_shrinkents(upb_inttable *t, upb_alloc *a) {
+  const upb_tabent *old = t->t.entries;
+  size_t size = upb_table_size(&t->t);
+  upb_tabent32 *ents;
+  size_t i;
+
+  if (sizeof(upb_tabent32) >= sizeof(upb_tabent) || t->t.count == 0) return;
+
+  for (i = 0; i < size; i++) {
+    if ((uint32_t)old[i].key != old[i].key) return;
+  }
+
+  ents = upb_malloc(a, size * sizeof(*ents));
+  if (!ents) return;
+
+  for (i = 0; i < size; i++) {
+    ents[i].key = (uint32_t)old[i].key;
+    ents[i].next = old[i].next ? (uint32_t)(old[i].next - old) + 1 : 0;
+    ents[i].val = old[i].val;
+  }
+
+  uninit(&t->t, a);
+  t->t.entries = (const upb_tabent*)ents;
+  t->entries32 = true;
+}
+
+/* Switches a compact hash part back to upb_tabent, for inserting into. */
+static bool inttable_expandents(upb_inttable *t, upb_alloc *a) {
+  const upb_tabent32 *old = ents32(t);
+  size_t size = upb_table_size(&t->t);
+  upb_tabent *ents = upb_malloc(a, size * sizeof(*ents));
+  size_t i;
+
+  if (!ents) return false;
+
+  for (i = 0; i < size; i++) {
+    ents[i].key = old[i].key;
+    ents[i].next = old[i].next ? &ents[old[i].next - 1] : NULL;
+    ents[i].val = old[i].val;
+  }
+
+  uninit(&t->t, a);
+  t->t.entries = ents;
+  t->entries32 = false;
+  return true;
+}
+
+/* Like next(), for either kind of hash part. */
+static size_t int_next(const upb_inttable *t, size_t i) {
+  if (!t->entries32) return next(&t->t, i);
+  do {
+    if (++i >= upb_table_size(&t->t))
+      return SIZE_MAX;
+  } while (ents32(t)[i].key == 0);
+  return i;
+}
+
 static upb_tabval *inttable_val(upb_inttable *t, uintptr_t key) {
   if (key < t->array_size) {
     return upb_arrhas(t->array[key]) ? &(mutable_array(t)[key]) : NULL;
+  } else if (t->entries32) {
+    upb_tabent32 *e = findentry32(t, key);
+    return e ? &e->val : NULL;
   } else {
     upb_tabent *e =
         findentry_mutable(&t->t, intkey(key), upb_inthash(key), &inteql);
@@ -469,6 +746,7 @@ bool upb_inttable_sizedinit(upb_inttable *t, upb_ctype_t ctype,
   size_t array_bytes;
 
   if (!init(&t->t, ctype, hsize_lg2, a)) return false;
+  t->entries32 = false;
   /* Always make the array part at least 1 long, so that we know key 0
    * won't be in the hash part, which simplifies things. */
   t->array_size = UPB_MAX(1, asize);
@@ -506,6 +784,9 @@ bool upb_inttable_insert2(upb_inttable *t, uintptr_t key, upb_value val,
     t->array_count++;
     mutable_array(t)[key].val = val.val;
   } else {
+    if (t->entries32 && !inttable_expandents(t, a)) {
+      return false;
+    }
     if (isfull(&t->t)) {
       /* Need to resize the hash part, but we re-use the array part. */
       size_t i;
@@ -543,6 +824,41 @@ bool upb_inttable_lookup(const upb_inttable *t, uintptr_t key, upb_value *v) {
   return true;
 }
 
+size_t upb_inttable_lookupbatch(const upb_inttable *t, const uintptr_t *keys,
+                                size_t n, upb_value *vals, bool *found) {
+  size_t ret = 0;
+  size_t base;
+
+  for (base = 0; base < n; base += LOOKUP_BATCH) {
+    size_t m = UPB_MIN(n - base, LOOKUP_BATCH);
+    size_t i;
+
+    for (i = 0; i < m; i++) {
+      uintptr_t key = keys[base + i];
+      if (key < t->array_size) {
+        UPB_PREFETCH(&t->array[key]);
+      } else if (t->entries32) {
+        if ((uint32_t)key == key) {
+          UPB_PREFETCH(getentry32((upb_inttable*)t, key));
+        }
+      } else if (t->t.size_lg2 != 0) {
+        UPB_PREFETCH(upb_getentry(&t->t, upb_inthash(key)));
+      }
+    }
+
+    for (i = 0; i < m; i++) {
+      const upb_tabval *v = inttable_val_const(t, keys[base + i]);
+      found[base + i] = v != NULL;
+      if (v) {
+        _upb_value_setval(&vals[base + i], v->val, t->t.ctype);
+        ret++;
+      }
+    }
+  }
+
+  return ret;
+}
+
 bool upb_inttable_replace(upb_inttable *t, uintptr_t key, upb_value val) {
   upb_tabval *table_v = inttable_val(t, key);
   if (!table_v) return false;
@@ -564,6 +880,8 @@ bool upb_inttable_remove(upb_inttable *t, uintptr_t key, upb_value *val) {
     } else {
       success = false;
     }
+  } else if (t->entries32) {
+    success = rm32(t, key, val);
   } else {
     success = rm(&t->t, intkey(key), val, NULL, upb_inthash(key), &inteql);
   }
@@ -605,6 +923,11 @@ void upb_inttable_compact2(upb_inttable *t, upb_alloc *a) {
   /* The max key in each bucket. */
   uintptr_t max[UPB_MAXARRSIZE + 1] = {0};
 
+  /* Keys that can't be in the array part however dense the table is.
+   * log2ceil() would put them in the top bucket, and the array would have
+   * to reach the largest of them. */
+  size_t too_large = 0;
+
   upb_inttable_iter i;
   size_t arr_count;
   int size_lg2;
@@ -615,14 +938,19 @@ void upb_inttable_compact2(upb_inttable *t, upb_alloc *a) {
   upb_inttable_begin(&i, t);
   for (; !upb_inttable_done(&i); upb_inttable_next(&i)) {
     uintptr_t key = upb_inttable_iter_key(&i);
-    int bucket = log2ceil(key);
+    int bucket;
+    if (key > (1 << UPB_MAXARRSIZE)) {
+      too_large++;
+      continue;
+    }
+    bucket = log2ceil(key);
     max[bucket] = UPB_MAX(max[bucket], key);
     counts[bucket]++;
   }
 
   /* Find the largest power of two that satisfies the MIN_DENSITY
    * definition (while actually having some keys). */
-  arr_count = upb_inttable_count(t);
+  arr_count = upb_inttable_count(t) - too_large;
 
   for (size_lg2 = ARRAY_SIZE(counts) - 1; size_lg2 > 0; size_lg2--) {
     if (counts[size_lg2] == 0) {
@@ -642,7 +970,10 @@ void upb_inttable_compact2(upb_inttable *t, upb_alloc *a) {
     size_t arr_size = max[size_lg2] + 1;  /* +1 so arr[max] will fit. */
     size_t hash_count = upb_inttable_count(t) - arr_count;
     size_t hash_size = hash_count ? (hash_count / MAX_LOAD) + 1 : 0;
-    size_t hashsize_lg2 = log2ceil(hash_size);
+    size_t hashsize_lg2 = 0;
+
+    /* Not log2ceil(), which stops at the largest array part. */
+    while (((size_t)1 << hashsize_lg2) < hash_size) hashsize_lg2++;
 
     upb_inttable_sizedinit(&new_t, t->t.ctype, arr_size, hashsize_lg2, a);
     upb_inttable_begin(&i, t);
@@ -652,6 +983,7 @@ void upb_inttable_compact2(upb_inttable *t, upb_alloc *a) {
     }
     UPB_ASSERT(new_t.array_size == arr_size);
     UPB_ASSERT(new_t.t.size_lg2 == hashsize_lg2);
+    inttable_shrinkents(&new_t, a);
   }
   upb_inttable_uninit2(t, a);
   *t = new_t;
@@ -659,9 +991,16 @@ void upb_inttable_compact2(upb_inttable *t, upb_alloc *a) {
 
 /* Iteration. */
 
-static const upb_tabent *int_tabent(const upb_inttable_iter *i) {
+static uintptr_t int_tabkey(const upb_inttable_iter *i) {
   UPB_ASSERT(!i->array_part);
-  return &i->t->t.entries[i->index];
+  return i->t->entries32 ? ents32(i->t)[i->index].key
+                         : i->t->t.entries[i->index].key;
+}
+
+static upb_tabval int_tabval(const upb_inttable_iter *i) {
+  UPB_ASSERT(!i->array_part);
+  return i->t->entries32 ? ents32(i->t)[i->index].val
+                         : i->t->t.entries[i->index].val;
 }
 
 static upb_tabval int_arrent(const upb_inttable_iter *i) {
@@ -685,9 +1024,9 @@ void upb_inttable_next(upb_inttable_iter *iter) {
       }
     }
     iter->array_part = false;
-    iter->index = begin(&t->t);
+    iter->index = int_next(t, -1);
   } else {
-    iter->index = next(&t->t, iter->index);
+    iter->index = int_next(t, iter->index);
   }
 }
 
@@ -696,20 +1035,19 @@ bool upb_inttable_done(const upb_inttable_iter *i) {
     return i->index >= i->t->array_size ||
            !upb_arrhas(int_arrent(i));
   } else {
-    return i->index >= upb_table_size(&i->t->t) ||
-           upb_tabent_isempty(int_tabent(i));
+    return i->index >= upb_table_size(&i->t->t) || int_tabkey(i) == 0;
   }
 }
 
 uintptr_t upb_inttable_iter_key(const upb_inttable_iter *i) {
   UPB_ASSERT(!upb_inttable_done(i));
-  return i->array_part ? i->index : int_tabent(i)->key;
+  return i->array_part ? i->index : int_tabkey(i);
 }
 
 upb_value upb_inttable_iter_value(const upb_inttable_iter *i) {
   UPB_ASSERT(!upb_inttable_done(i));
   return _upb_value_val(
-      i->array_part ? i->t->array[i->index].val : int_tabent(i)->val.val,
+      i->array_part ? i->t->array[i->index].val : int_tabval(i).val,
       i->t->t.ctype);
 }
 
@@ -726,6 +1064,84 @@ bool upb_inttable_iter_isequal(const upb_inttable_iter *i1,
          i1->array_part == i2->array_part;
 }
 
+/* -----------------------------------------------------------------------------
+ * upb_hash(), after Wang Yi's wyhash (released as public domain).
+ * Keys of up to 16 bytes, which covers nearly every field and enum value name,
+ * are read as two possibly-overlapping words and finished with one multiply;
+ * longer keys take 16 bytes per multiply.  Like MurmurHash2 below, it does
+ * not produce the same results on little-endian and big-endian machines. */
+
+static const uint64_t upb_hash_secret[] = {
+  0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+  0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+/* Returns the high and low halves of the 128-bit product a*b, xor'd
+ * together. */
+static uint64_t upb_hash_mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  __extension__ typedef unsigned __int128 upb_uint128;
+  upb_uint128 r = (upb_uint128)a * b;
+  return (uint64_t)(r >> 64) ^ (uint64_t)r;
+#else
+  uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t lo = t + (rm1 << 32);
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+  return hi ^ lo;
+#endif
+}
+
+static uint64_t upb_hash_read8(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t upb_hash_read4(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t upb_hash(const void *key, size_t len, uint64_t seed) {
+  const uint64_t *s = upb_hash_secret;
+  const uint8_t *p = key;
+  uint64_t a, b, h;
+
+  seed ^= upb_hash_mix(seed ^ s[0], s[1]);
+
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t mid = (len >> 3) << 2;
+      a = (upb_hash_read4(p) << 32) | upb_hash_read4(p + mid);
+      b = (upb_hash_read4(p + len - 4) << 32) |
+          upb_hash_read4(p + len - 4 - mid);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    while (i > 16) {
+      seed = upb_hash_mix(upb_hash_read8(p) ^ s[1],
+                          upb_hash_read8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = upb_hash_read8(p + i - 16);
+    b = upb_hash_read8(p + i - 8);
+  }
+
+  a ^= s[1];
+  b ^= seed;
+  h = upb_hash_mix(a ^ s[0] ^ len, upb_hash_mix(a, b) ^ s[1]);
+  return (uint32_t)(h ^ (h >> 32));
+}
+
 #ifdef UPB_UNALIGNED_READS_OK
 /* -----------------------------------------------------------------------------
  * MurmurHash2, by Austin Appleby (released as public domain).
@@ -6,8 +6,8 @@
 ** (strtable) hash tables.
 **
 ** The table uses chained scatter with Brent's variation (inspired by the Lua
-** implementation of hash tables).  The hash function for strings is Austin
-** Appleby's "MurmurHash."
+** implementation of hash tables).  Strings are hashed with upb_hash(), a
+** wyhash-style multiply-mix hash that takes in eight bytes per step.
 **
 ** The inttable uses uintptr_t as its key, which guarantees it can be used to
 ** store pointers or integers of at least 32 bits (upb isn't really useful on
@@ -301,23 +301,53 @@ typedef struct {
 
 typedef struct {
   upb_table t;
+
+  /* Static tables generated before the switch to upb_hash() were laid out
+   * with MurmurHash2(), so lookups in them must keep using it.  Only
+   * UPB_STRTABLE_INIT sets this; such tables are never modified. */
+  bool murmurhash;
+
+  /* Seed for upb_hash(), chosen by upb_strtable_compact2(). */
+  uint32_t seed;
 } upb_strtable;
 
+/* For tables laid out by upb_hash(), which is what tools/dump_cinit.lua now
+ * emits. */
+#define UPB_STRTABLE_INIT2(count, mask, ctype, size_lg2, entries, seed) \
+  {UPB_TABLE_INIT(count, mask, ctype, size_lg2, entries), false, seed}
+
+/* For tables laid out by MurmurHash2(), as in older generated code.  The
+ * seed is unused by such tables. */
 #define UPB_STRTABLE_INIT(count, mask, ctype, size_lg2, entries) \
-  {UPB_TABLE_INIT(count, mask, ctype, size_lg2, entries)}
+  {UPB_TABLE_INIT(count, mask, ctype, size_lg2, entries), true, 0}
 
 #define UPB_EMPTY_STRTABLE_INIT(ctype)                           \
-  UPB_STRTABLE_INIT(0, 0, ctype, 0, NULL)
+  UPB_STRTABLE_INIT2(0, 0, ctype, 0, NULL, 0)
 
 typedef struct {
   upb_table t;              /* For entries that don't fit in the array part. */
   const upb_tabval *array;  /* Array part of the table. See const note above. */
   size_t array_size;        /* Array part size. */
   size_t array_count;       /* Array part number of elements. */
+
+  /* If true, t.entries actually points to upb_tabent32 entries.  Set by
+   * upb_inttable_compact2(); the entries go back to upb_tabent on insert. */
+  bool entries32;
 } upb_inttable;
 
+/* A hash table entry for an inttable whose hash-part keys all fit in 32 bits,
+ * which is 16 bytes instead of 24 on 64-bit hosts.  The chains are the ones of
+ * the upb_tabent array it replaces, entry for entry, with |next| holding the
+ * index of the next entry plus one (0 ends the chain).  Values stay 64 bits,
+ * since most inttables hold pointers. */
+typedef struct {
+  uint32_t key;
+  uint32_t next;
+  upb_tabval val;
+} upb_tabent32;
+
 #define UPB_INTTABLE_INIT(count, mask, ctype, size_lg2, ent, a, asize, acount) \
-  {UPB_TABLE_INIT(count, mask, ctype, size_lg2, ent), a, asize, acount}
+  {UPB_TABLE_INIT(count, mask, ctype, size_lg2, ent), a, asize, acount, false}
 
 #define UPB_EMPTY_INTTABLE_INIT(ctype) \
   UPB_INTTABLE_INIT(0, 0, ctype, 0, NULL, NULL, 0, 0)
@@ -336,7 +366,11 @@ UPB_INLINE bool upb_tabent_isempty(const upb_tabent *e) {
   return e->key == 0;
 }
 
-/* Used by some of the unit tests for generic hashing functionality. */
+/* The string hash.  Also used by some of the unit tests for generic hashing
+ * functionality. */
+uint32_t upb_hash(const void *p, size_t len, uint64_t seed);
+
+/* The string hash before upb_hash(); see upb_strtable.murmurhash. */
 uint32_t MurmurHash2(const void * key, size_t len, uint32_t seed);
 
 UPB_INLINE uintptr_t upb_intkey(uintptr_t key) {
@@ -362,6 +396,10 @@ bool upb_strtable_init2(upb_strtable *table, upb_ctype_t ctype, upb_alloc *a);
 void upb_inttable_uninit2(upb_inttable *table, upb_alloc *a);
 void upb_strtable_uninit2(upb_strtable *table, upb_alloc *a);
 
+/* Removes every entry from |table|, freeing the keys with |a|.  The table
+ * keeps its size, so refilling it does not allocate until it grows past it. */
+void upb_strtable_clear(upb_strtable *table, upb_alloc *a);
+
 UPB_INLINE bool upb_inttable_init(upb_inttable *table, upb_ctype_t ctype) {
   return upb_inttable_init2(table, ctype, &upb_alloc_global);
 }
@@ -431,6 +469,18 @@ UPB_INLINE bool upb_strtable_lookup(const upb_strtable *t, const char *key,
   return upb_strtable_lookup2(t, key, strlen(key), v);
 }
 
+/* Looks up the |n| keys in |keys| (and, for strtables, |lens|), setting
+ * found[i] to whether keys[i] is in the table and, if it is, vals[i] to its
+ * value.  Returns how many were found.  All of a group of keys are hashed and
+ * their entries fetched before any is compared, so the cache misses of
+ * separate lookups overlap instead of following one another.  This pays off
+ * for tables too big to stay in cache. */
+size_t upb_inttable_lookupbatch(const upb_inttable *t, const uintptr_t *keys,
+                                size_t n, upb_value *vals, bool *found);
+size_t upb_strtable_lookupbatch(const upb_strtable *t, const char *const *keys,
+                                const size_t *lens, size_t n, upb_value *vals,
+                                bool *found);
+
 /* Removes an item from the table.  Returns true if the remove was successful,
  * and stores the removed item in *val if non-NULL. */
 bool upb_inttable_remove(upb_inttable *t, uintptr_t key, upb_value *val);
@@ -476,13 +526,27 @@ UPB_INLINE bool upb_inttable_insertptr(upb_inttable *t, const void *key,
 
 /* Optimizes the table for the current set of entries, for both memory use and
  * lookup time.  Client should call this after all entries have been inserted;
- * inserting more entries is legal, but will likely require a table resize. */
+ * inserting more entries is legal, but will likely require a table resize.
+ * If every key outside the array part fits in 32 bits, the hash part switches
+ * to upb_tabent32. */
 void upb_inttable_compact2(upb_inttable *t, upb_alloc *a);
 
 UPB_INLINE void upb_inttable_compact(upb_inttable *t) {
   upb_inttable_compact2(t, &upb_alloc_global);
 }
 
+/* Like upb_inttable_compact2(), for a table that won't change again.  Picks
+ * the hash seed and size so that, where it can, every key sits alone in its
+ * main position and every lookup is a single probe.  The table is at most
+ * twice the size it would otherwise have; if no seed works at either size, it
+ * uses the seed with the fewest collisions.  Leaves the table as it was if
+ * out of memory. */
+void upb_strtable_compact2(upb_strtable *t, upb_alloc *a);
+
+UPB_INLINE void upb_strtable_compact(upb_strtable *t) {
+  upb_strtable_compact2(t, &upb_alloc_global);
+}
+
 /* A special-case inlinable version of the lookup routine for 32-bit
  * integers. */
 UPB_INLINE bool upb_inttable_lookup32(const upb_inttable *t, uint32_t key,
@@ -496,6 +560,17 @@ UPB_INLINE bool upb_inttable_lookup32(const upb_inttable *t, uint32_t key,
     } else {
       return false;
     }
+  } else if (t->entries32) {
+    const upb_tabent32 *ents = (const upb_tabent32*)t->t.entries;
+    const upb_tabent32 *e = &ents[upb_inthash(key) & t->t.mask];
+    while (true) {
+      if (e->key == key) {
+        _upb_value_setval(v, e->val.val, t->t.ctype);
+        return true;
+      }
+      if (e->next == 0) return false;
+      e = &ents[e->next - 1];
+    }
   } else {
     const upb_tabent *e;
     if (t->t.entries == NULL) return false;
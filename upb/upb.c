@@ -137,16 +137,106 @@ static void upb_arena_addblock(upb_arena *a, void *ptr, size_t size,
 }
 
 
+/* Bytes of blocks on the list at |block| that came from the block
+ * allocator. */
+static size_t upb_arena_ownedbytes(const mem_block *block) {
+  size_t bytes = 0;
+
+  for (; block; block = block->next) {
+    if (block->owned) {
+      bytes += block->size;
+    }
+  }
+
+  return bytes;
+}
+
+static void upb_arena_countblockbytes(upb_arenastats *stats, size_t bytes) {
+  stats->block_bytes += bytes;
+  stats->peak_block_bytes = UPB_MAX(stats->peak_block_bytes,
+                                    stats->block_bytes);
+}
+
+/* Counts an allocation of |size| bytes in a->stats.  For a realloc, |ptr| and
+ * |oldsize| are the old allocation, which was grown where it was if
+ * |inplace|. */
+static void upb_arena_countalloc(upb_arena *a, const void *ptr,
+                                 size_t oldsize, size_t size, bool inplace) {
+  upb_arenastats *stats = a->stats;
+  size_t padding = align_up_max(size) - size;
+
+  if (ptr) {
+    stats->reallocs++;
+    stats->bytes_requested += size - UPB_MIN(size, oldsize);
+    if (inplace) {
+      /* The old padding is now either data or part of the new padding.  This
+       * may subtract, which unsigned arithmetic gets right. */
+      stats->bytes_wasted += padding - (align_up_max(oldsize) - oldsize);
+    } else {
+      stats->bytes_wasted += padding + align_up_max(oldsize);
+    }
+  } else {
+    stats->allocs++;
+    stats->bytes_requested += size;
+    stats->bytes_wasted += padding;
+  }
+
+  stats->peak_bytes_allocated = UPB_MAX(stats->peak_bytes_allocated,
+                                        a->bytes_allocated);
+}
+
+/* Takes a block retained by upb_arena_reset() that can hold |size| bytes, or
+ * returns NULL if there is none. */
+static mem_block *upb_arena_reuseblock(upb_arena *a, size_t size) {
+  mem_block **link = (mem_block**)&a->free_head;
+
+  while (*link) {
+    mem_block *block = *link;
+
+    if (block->size - align_up_max(sizeof(mem_block)) >= size) {
+      *link = block->next;
+      a->bytes_retained -= block->size;
+      upb_arena_addblock(a, block, block->size, true);
+      return block;
+    }
+
+    link = &block->next;
+  }
+
+  return NULL;
+}
+
 static mem_block *upb_arena_allocblock(upb_arena *a, size_t size) {
   size_t block_size = UPB_MAX(size, a->next_block_size) + sizeof(mem_block);
-  mem_block *block = upb_malloc(a->block_alloc, block_size);
+  upb_arenastats *stats = a->stats;
+  mem_block *head = a->block_head;
+  mem_block *block = upb_arena_reuseblock(a, size);
 
-  if (!block) {
-    return NULL;
+  if (block) {
+    if (stats) {
+      stats->blocks_reused++;
+    }
+  } else {
+    block = upb_malloc(a->block_alloc, block_size);
+
+    if (!block) {
+      return NULL;
+    }
+
+    upb_arena_addblock(a, block, block_size, true);
+    a->next_block_size = UPB_MIN(block_size * 2, a->max_block_size);
+
+    if (stats) {
+      stats->blocks++;
+      upb_arena_countblockbytes(stats, block_size);
+    }
   }
 
-  upb_arena_addblock(a, block, block_size, true);
-  a->next_block_size = UPB_MIN(block_size * 2, a->max_block_size);
+  /* Only the head block is allocated from, so the rest of the old head is
+   * never used. */
+  if (stats && head) {
+    stats->bytes_wasted += head->size - head->used;
+  }
 
   return block;
 }
@@ -155,6 +245,7 @@ static void *upb_arena_doalloc(upb_alloc *alloc, void *ptr, size_t oldsize,
                                size_t size) {
   upb_arena *a = (upb_arena*)alloc;  /* upb_alloc is initial member. */
   mem_block *block = a->block_head;
+  size_t requested = size;
   void *ret;
 
   if (size == 0) {
@@ -163,7 +254,22 @@ static void *upb_arena_doalloc(upb_alloc *alloc, void *ptr, size_t oldsize,
 
   size = align_up_max(size);
 
-  /* TODO(haberman): special-case if this is a realloc of the last alloc? */
+  /* If this is a realloc of the most recent allocation, try to resize it in
+   * place.  This makes repeated growth of a single buffer (like an array or
+   * an encoder output buffer) cheap and wasteless. */
+  if (ptr && block) {
+    size_t old_aligned = align_up_max(oldsize);
+    char *last = (char*)block + block->used - old_aligned;
+
+    if (ptr == last && block->size - (block->used - old_aligned) >= size) {
+      block->used = block->used - old_aligned + size;
+      a->bytes_allocated += size - UPB_MIN(size, old_aligned);
+      if (a->stats) {
+        upb_arena_countalloc(a, ptr, oldsize, requested, true);
+      }
+      return ptr;
+    }
+  }
 
   if (!block || block->size - block->used < size) {
     /* Slow path: have to allocate a new block. */
@@ -184,6 +290,9 @@ static void *upb_arena_doalloc(upb_alloc *alloc, void *ptr, size_t oldsize,
   /* TODO(haberman): ASAN unpoison. */
 
   a->bytes_allocated += size;
+  if (a->stats) {
+    upb_arena_countalloc(a, ptr, oldsize, requested, false);
+  }
   return ret;
 }
 
@@ -197,6 +306,11 @@ void upb_arena_init(upb_arena *a) {
   a->max_block_size = 16384;
   a->cleanup_head = NULL;
   a->block_head = NULL;
+  a->free_head = NULL;
+  a->max_retained = 16384;
+  a->bytes_retained = 0;
+  a->bytes_freed = 0;
+  a->stats = NULL;
 }
 
 void upb_arena_init2(upb_arena *a, void *mem, size_t size, upb_alloc *alloc) {
@@ -211,30 +325,107 @@ void upb_arena_init2(upb_arena *a, void *mem, size_t size, upb_alloc *alloc) {
   }
 }
 
-void upb_arena_uninit(upb_arena *a) {
+static void upb_arena_runcleanups(upb_arena *a) {
   cleanup_ent *ent = a->cleanup_head;
-  mem_block *block = a->block_head;
 
   while (ent) {
     ent->cleanup(ent->ud);
     ent = ent->next;
   }
 
-  /* Must do this after running cleanup functions, because this will delete
-   * the memory we store our cleanup entries in! */
+  a->cleanup_head = NULL;
+}
+
+static void upb_arena_freeblocks(upb_arena *a, mem_block *block) {
   while (block) {
     mem_block *next = block->next;
 
     if (block->owned) {
+      if (a->stats) {
+        a->stats->block_bytes -= block->size;
+      }
       upb_free(a->block_alloc, block);
     }
 
     block = next;
   }
+}
+
+void upb_arena_uninit(upb_arena *a) {
+  /* Must free blocks after running cleanup functions, because this will delete
+   * the memory we store our cleanup entries in! */
+  upb_arena_runcleanups(a);
+  upb_arena_freeblocks(a, a->block_head);
+  upb_arena_freeblocks(a, a->free_head);
 
   /* Protect against multiple-uninit. */
-  a->cleanup_head = NULL;
   a->block_head = NULL;
+  a->free_head = NULL;
+  a->bytes_retained = 0;
+}
+
+void upb_arena_reset(upb_arena *a) {
+  mem_block *block = a->block_head;
+  mem_block *unused = a->free_head;
+  mem_block *initial = NULL;
+
+  upb_arena_runcleanups(a);
+  a->block_head = NULL;
+  a->free_head = NULL;
+  a->bytes_retained = 0;
+
+  if (a->stats) {
+    a->stats->resets++;
+  }
+
+  /* Newer blocks are larger, so walking from the head retains the biggest
+   * blocks that fit under the cap.  Blocks retained by a previous reset but
+   * not reused come last.  The caller's initial block is always kept, since
+   * we cannot free it. */
+  while (block || unused) {
+    mem_block *next;
+
+    if (!block) {
+      block = unused;
+      unused = NULL;
+    }
+
+    next = block->next;
+
+    if (!block->owned) {
+      initial = block;
+    } else if (a->bytes_retained + block->size <= a->max_retained) {
+      block->next = a->free_head;
+      a->free_head = block;
+      a->bytes_retained += block->size;
+    } else {
+      a->bytes_freed += block->size;
+      if (a->stats) {
+        a->stats->block_bytes -= block->size;
+      }
+      upb_free(a->block_alloc, block);
+    }
+
+    block = next;
+  }
+
+  if (initial) {
+    upb_arena_addblock(a, initial, initial->size, false);
+  }
+
+  a->bytes_allocated = 0;
+}
+
+void upb_arena_setnextblocksize(upb_arena *a, size_t size) {
+  a->next_block_size = size;
+}
+
+void upb_arena_setmaxblocksize(upb_arena *a, size_t size) {
+  a->max_block_size = size;
+}
+
+void upb_arena_setmaxretained(upb_arena *a, size_t size) {
+  a->max_retained = size;
 }
 
 bool upb_arena_addcleanup(upb_arena *a, upb_cleanup_func *func, void *ud) {
@@ -248,6 +439,10 @@ bool upb_arena_addcleanup(upb_arena *a, upb_cleanup_func *func, void *ud) {
   ent->next = a->cleanup_head;
   a->cleanup_head = ent;
 
+  if (a->stats) {
+    a->stats->cleanups++;
+  }
+
   return true;
 }
 
@@ -255,6 +450,300 @@ size_t upb_arena_bytesallocated(const upb_arena *a) {
   return a->bytes_allocated;
 }
 
+bool upb_arena_fuse(upb_arena *a, upb_arena *from) {
+  mem_block *block = from->block_head;
+  mem_block *tail;
+  cleanup_ent *ent;
+
+  if (a == from) {
+    return true;
+  }
+
+  if (a->block_alloc != from->block_alloc) {
+    return false;
+  }
+
+  if (block) {
+    /* Find the end of |from|'s list; its initial block, if any, is last. */
+    for (tail = block; tail->next; tail = tail->next) {}
+
+    if (!tail->owned) {
+      return false;
+    }
+
+    /* The blocks now count against |a|'s stats. */
+    if (a->stats != from->stats) {
+      size_t bytes = upb_arena_ownedbytes(block);
+      if (from->stats) {
+        from->stats->block_bytes -= bytes;
+      }
+      if (a->stats) {
+        upb_arena_countblockbytes(a->stats, bytes);
+      }
+    }
+
+    /* Keep |a|'s current block at the head so it continues to be used. */
+    if (a->block_head) {
+      mem_block *head = a->block_head;
+      tail->next = head->next;
+      head->next = block;
+    } else {
+      a->block_head = block;
+    }
+  }
+
+  ent = from->cleanup_head;
+  if (ent) {
+    while (ent->next) {
+      ent = ent->next;
+    }
+    ent->next = a->cleanup_head;
+    a->cleanup_head = from->cleanup_head;
+  }
+
+  a->bytes_allocated += from->bytes_allocated;
+  if (a->stats) {
+    a->stats->peak_bytes_allocated = UPB_MAX(a->stats->peak_bytes_allocated,
+                                             a->bytes_allocated);
+  }
+
+  from->block_head = NULL;
+  from->cleanup_head = NULL;
+  from->bytes_allocated = 0;
+  return true;
+}
+
+size_t upb_arena_bytesretained(const upb_arena *a) {
+  return a->bytes_retained;
+}
+
+size_t upb_arena_bytesfreed(const upb_arena *a) {
+  return a->bytes_freed;
+}
+
+void upb_arena_setstats(upb_arena *a, upb_arenastats *stats) {
+  size_t bytes;
+
+  if (stats == a->stats) {
+    return;
+  }
+
+  bytes = upb_arena_ownedbytes(a->block_head) +
+          upb_arena_ownedbytes(a->free_head);
+
+  if (a->stats) {
+    a->stats->block_bytes -= bytes;
+  }
+
+  if (stats) {
+    upb_arena_countblockbytes(stats, bytes);
+  }
+
+  a->stats = stats;
+}
+
+upb_arenastats *upb_arena_stats(const upb_arena *a) {
+  return a->stats;
+}
+
+
+/* upb_arenapool **************************************************************/
+
+/* Every pool block is preceded by this header, which records its size class so
+ * we can find the right free list when it is freed. */
+typedef struct pool_block {
+  struct pool_block *next;
+  size_t cls;
+} pool_block;
+
+#define POOL_OVERSIZED ((size_t)-1)
+
+static size_t pool_hdrsize(void) {
+  return align_up_max(sizeof(pool_block));
+}
+
+/* Total size of blocks in class |cls|, header included: 512 bytes to 64k. */
+static size_t pool_classsize(size_t cls) {
+  return (size_t)512 << cls;
+}
+
+static pool_block *pool_hdr(void *ptr) {
+  return (pool_block*)((char*)ptr - pool_hdrsize());
+}
+
+/* Lock-free stack of remotely freed blocks.  There is a single consumer, which
+ * always takes the entire stack, so there is no ABA problem. */
+
+#ifdef UPB_THREAD_UNSAFE /*---------------------------------------------------*/
+
+static void pool_pushremote(void **head, pool_block *b) {
+  b->next = *head;
+  *head = b;
+}
+
+static pool_block *pool_takeremote(void **head) {
+  pool_block *ret = *head;
+  *head = NULL;
+  return ret;
+}
+
+#elif defined(__GNUC__) || defined(__clang__) /*------------------------------*/
+
+static void pool_pushremote(void **head, pool_block *b) {
+  void *old;
+  do {
+    old = *(void *volatile *)head;
+    b->next = old;
+  } while (!__sync_bool_compare_and_swap(head, old, b));
+}
+
+static pool_block *pool_takeremote(void **head) {
+  void *old;
+  do {
+    old = *(void *volatile *)head;
+  } while (old && !__sync_bool_compare_and_swap(head, old, NULL));
+  return old;
+}
+
+#elif defined(WIN32) /*-------------------------------------------------------*/
+
+#include <Windows.h>
+
+static void pool_pushremote(void **head, pool_block *b) {
+  void *old;
+  do {
+    old = *(void *volatile *)head;
+    b->next = old;
+  } while (InterlockedCompareExchangePointer(head, b, old) != old);
+}
+
+static pool_block *pool_takeremote(void **head) {
+  return InterlockedExchangePointer(head, NULL);
+}
+
+#else
+#error Atomic primitives not defined for your platform/CPU.  \
+       Implement them or compile with UPB_THREAD_UNSAFE.
+#endif
+
+/* Sorts remotely freed blocks into the free lists, releasing any that would
+ * put us over the cache limit. */
+static void pool_drain(upb_arenapool *p) {
+  pool_block *b = pool_takeremote(&p->remote);
+
+  while (b) {
+    pool_block *next = b->next;
+
+    if (b->cls == POOL_OVERSIZED ||
+        p->bytes_cached + pool_classsize(b->cls) > p->max_cached) {
+      upb_free(p->block_alloc, b);
+    } else {
+      b->next = p->free[b->cls];
+      p->free[b->cls] = b;
+      p->bytes_cached += pool_classsize(b->cls);
+    }
+
+    b = next;
+  }
+}
+
+static void *pool_get(upb_arenapool *p, size_t size) {
+  size_t total = size + pool_hdrsize();
+  size_t cls = 0;
+  pool_block *b;
+
+  while (cls < UPB_ARENAPOOL_CLASSES && pool_classsize(cls) < total) {
+    cls++;
+  }
+
+  if (cls == UPB_ARENAPOOL_CLASSES) {
+    b = upb_malloc(p->block_alloc, total);
+    cls = POOL_OVERSIZED;
+  } else {
+    if (!p->free[cls]) {
+      pool_drain(p);
+    }
+
+    b = p->free[cls];
+
+    if (b) {
+      p->free[cls] = b->next;
+      p->bytes_cached -= pool_classsize(cls);
+    } else {
+      b = upb_malloc(p->block_alloc, pool_classsize(cls));
+    }
+  }
+
+  if (!b) {
+    return NULL;
+  }
+
+  b->cls = cls;
+  return (char*)b + pool_hdrsize();
+}
+
+static void *upb_arenapool_doalloc(upb_alloc *alloc, void *ptr,
+                                   size_t oldsize, size_t size) {
+  upb_arenapool *p = (upb_arenapool*)alloc;  /* upb_alloc is initial member. */
+  void *ret = NULL;
+
+  if (size > 0) {
+    ret = pool_get(p, size);
+    if (!ret) {
+      return NULL;
+    }
+    if (ptr) {
+      memcpy(ret, ptr, UPB_MIN(oldsize, size));
+    }
+  }
+
+  if (ptr) {
+    /* Frees may come from any thread, so always go through the remote list. */
+    pool_pushremote(&p->remote, pool_hdr(ptr));
+  }
+
+  return ret;
+}
+
+void upb_arenapool_init(upb_arenapool *p, upb_alloc *alloc) {
+  size_t i;
+  p->alloc.func = &upb_arenapool_doalloc;
+  p->block_alloc = alloc ? alloc : &upb_alloc_global;
+  p->bytes_cached = 0;
+  p->max_cached = 1 << 20;
+  p->remote = NULL;
+
+  for (i = 0; i < UPB_ARENAPOOL_CLASSES; i++) {
+    p->free[i] = NULL;
+  }
+}
+
+void upb_arenapool_uninit(upb_arenapool *p) {
+  size_t i;
+
+  pool_drain(p);
+
+  for (i = 0; i < UPB_ARENAPOOL_CLASSES; i++) {
+    pool_block *b = p->free[i];
+    while (b) {
+      pool_block *next = b->next;
+      upb_free(p->block_alloc, b);
+      b = next;
+    }
+    p->free[i] = NULL;
+  }
+
+  p->bytes_cached = 0;
+}
+
+void upb_arenapool_setmaxcached(upb_arenapool *p, size_t size) {
+  p->max_cached = size;
+}
+
+size_t upb_arenapool_bytescached(const upb_arenapool *p) {
+  return p->bytes_cached;
+}
+
 
 /* Standard error functions ***************************************************/
 
@@ -12,11 +12,14 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 namespace upb {
 class Allocator;
 class Arena;
+class ArenaPool;
+class HugePool;
 class Environment;
 class ErrorSpace;
 class Status;
@@ -48,10 +51,12 @@ template <int N> class InlinedEnvironment;
 #define UPB_FORCEINLINE __inline__ __attribute__((always_inline))
 #define UPB_NOINLINE __attribute__((noinline))
 #define UPB_NORETURN __attribute__((__noreturn__))
+#define UPB_PREFETCH(addr) __builtin_prefetch(addr)
 #else  /* !defined(__GNUC__) */
 #define UPB_FORCEINLINE
 #define UPB_NOINLINE
 #define UPB_NORETURN
+#define UPB_PREFETCH(addr) (void)(addr)
 #endif
 
 #if __STDC_VERSION__ >= 199901L || __cplusplus >= 201103L
@@ -514,6 +519,42 @@ UPB_DECLARE_TYPE(upb::Arena, upb_arena)
 
 typedef void upb_cleanup_func(void *ud);
 
+/* Counters an arena keeps when given one with upb_arena_setstats().  Each
+ * counter only ever grows, except block_bytes.  One struct may be shared by
+ * any number of arenas used from the same thread, to add up the cost of a
+ * whole kind of work (one message type, say); zero it before first use. */
+typedef struct {
+  /* Successful allocations, and reallocations of a previous allocation. */
+  size_t allocs;
+  size_t reallocs;
+
+  /* Bytes asked for: the size of each allocation, and what each realloc
+   * grew by. */
+  size_t bytes_requested;
+
+  /* Block bytes that hold no caller data: alignment padding, the old copy
+   * of a realloc that had to move, and the end of a block left unused when
+   * an allocation did not fit and a new block was started. */
+  size_t bytes_wasted;
+
+  /* Blocks obtained from the block allocator, and blocks reused from those
+   * kept by upb_arena_reset(). */
+  size_t blocks;
+  size_t blocks_reused;
+
+  /* Bytes of blocks currently held from the block allocator, whether in use
+   * or kept for reuse, and the most that has ever been held at once. */
+  size_t block_bytes;
+  size_t peak_block_bytes;
+
+  /* The largest upb_arena_bytesallocated() has been. */
+  size_t peak_bytes_allocated;
+
+  /* Cleanup functions registered, and calls to upb_arena_reset(). */
+  size_t cleanups;
+  size_t resets;
+} upb_arenastats;
+
 #define UPB_ARENA_BLOCK_OVERHEAD (sizeof(size_t)*4)
 
 UPB_BEGIN_EXTERN_C
@@ -521,10 +562,17 @@ UPB_BEGIN_EXTERN_C
 void upb_arena_init(upb_arena *a);
 void upb_arena_init2(upb_arena *a, void *mem, size_t n, upb_alloc *alloc);
 void upb_arena_uninit(upb_arena *a);
+void upb_arena_reset(upb_arena *a);
 bool upb_arena_addcleanup(upb_arena *a, upb_cleanup_func *func, void *ud);
 size_t upb_arena_bytesallocated(const upb_arena *a);
+size_t upb_arena_bytesretained(const upb_arena *a);
+size_t upb_arena_bytesfreed(const upb_arena *a);
 void upb_arena_setnextblocksize(upb_arena *a, size_t size);
 void upb_arena_setmaxblocksize(upb_arena *a, size_t size);
+void upb_arena_setmaxretained(upb_arena *a, size_t size);
+bool upb_arena_fuse(upb_arena *a, upb_arena *from);
+void upb_arena_setstats(upb_arena *a, upb_arenastats *stats);
+upb_arenastats *upb_arena_stats(const upb_arena *a);
 UPB_INLINE upb_alloc *upb_arena_alloc(upb_arena *a) { return (upb_alloc*)a; }
 
 UPB_END_EXTERN_C
@@ -558,6 +606,24 @@ class upb::Arena {
    * larger. */
   void SetMaxBlockSize(size_t size) { upb_arena_setmaxblocksize(this, size); }
 
+  /* Runs all cleanup functions and discards everything allocated so far, but
+   * keeps up to MaxRetained bytes of blocks to satisfy future allocations
+   * instead of returning them to the block allocator.  Blocks beyond the cap
+   * are freed.  The arena can be used again immediately. */
+  void Reset() { upb_arena_reset(this); }
+
+  /* Sets the maximum number of block bytes Reset() will hold on to. */
+  void SetMaxRetained(size_t size) { upb_arena_setmaxretained(this, size); }
+
+  /* Moves everything allocated from |from| (and its cleanup functions) into
+   * this arena, so it lives until this arena is destroyed.  Nothing is copied:
+   * pointers into |from| remain valid.  Afterwards |from| is empty and can be
+   * reused or destroyed.
+   *
+   * Both arenas must use the same block allocator, and |from| must not have a
+   * caller-supplied initial block in use; returns false otherwise. */
+  bool Fuse(Arena* from) { return upb_arena_fuse(this, from); }
+
   /* Allows this arena to be used as a generic allocator.
    *
    * The arena does not need free() calls so when using Arena as an allocator
@@ -571,12 +637,26 @@ class upb::Arena {
     return upb_arena_addcleanup(this, func, ud);
   }
 
-  /* Total number of bytes that have been allocated.  It is undefined what
+  /* Total number of bytes that have been allocated since construction or the
+   * last Reset().  It is undefined what
    * Realloc() does to this counter. */
   size_t BytesAllocated() const {
     return upb_arena_bytesallocated(this);
   }
 
+  /* Bytes of block memory currently held by the arena for reuse after a
+   * Reset(), and total bytes of blocks Reset() has returned to the block
+   * allocator. */
+  size_t BytesRetained() const { return upb_arena_bytesretained(this); }
+  size_t BytesFreed() const { return upb_arena_bytesfreed(this); }
+
+  /* Starts adding this arena's activity to |stats|, or stops if it is NULL.
+   * Off by default, and nearly free when off.  Blocks the arena already holds
+   * are moved from the old stats' block_bytes to the new one's.  |stats| must
+   * outlive the arena or be replaced first. */
+  void SetStats(upb_arenastats* stats) { upb_arena_setstats(this, stats); }
+  upb_arenastats* Stats() const { return upb_arena_stats(this); }
+
  private:
   UPB_DISALLOW_COPY_AND_ASSIGN(Arena)
 
@@ -601,12 +681,193 @@ struct upb_arena {
   /* Cleanup entries.  Pointer to a cleanup_ent, defined in env.c */
   void *cleanup_head;
 
+  /* Blocks retained by upb_arena_reset() for reuse, and the cap on their
+   * total size. */
+  void *free_head;
+  size_t max_retained;
+  size_t bytes_retained;
+  size_t bytes_freed;
+
+  /* Where to count our activity, or NULL. */
+  upb_arenastats *stats;
+
   /* For future expansion, since the size of this struct is exposed to users. */
-  void *future1;
   void *future2;
 };
 
 
+/* upb::ArenaPool *************************************************************/
+
+/* upb::ArenaPool is a block allocator that caches freed blocks for reuse, so
+ * that arenas created and destroyed at a high rate do not go to the underlying
+ * allocator.  Pass its allocator() as the block allocator of arenas (see
+ * upb::Arena's constructor); the pool must outlive those arenas.
+ *
+ * A pool is meant to be owned by one thread, typically one pool per thread.
+ * Allocation and destruction of the pool must happen on the owning thread, but
+ * blocks may be freed from any thread.  So an arena can be created on one
+ * thread, handed (along with everything allocated in it) to another thread,
+ * and destroyed there; its blocks find their way back to the original pool.
+ * Unless compiled with UPB_THREAD_UNSAFE, that hand-back is lock-free. */
+UPB_DECLARE_TYPE(upb::ArenaPool, upb_arenapool)
+
+#define UPB_ARENAPOOL_CLASSES 8
+
+UPB_BEGIN_EXTERN_C
+
+void upb_arenapool_init(upb_arenapool *p, upb_alloc *alloc);
+void upb_arenapool_uninit(upb_arenapool *p);
+void upb_arenapool_setmaxcached(upb_arenapool *p, size_t size);
+size_t upb_arenapool_bytescached(const upb_arenapool *p);
+UPB_INLINE upb_alloc *upb_arenapool_alloc(upb_arenapool *p) {
+  return (upb_alloc*)p;
+}
+
+UPB_END_EXTERN_C
+
+#ifdef __cplusplus
+
+class upb::ArenaPool {
+ public:
+  /* Blocks are obtained from |a|, or the global allocator if NULL. */
+  explicit ArenaPool(Allocator* a = NULL) { upb_arenapool_init(this, a); }
+  ~ArenaPool() { upb_arenapool_uninit(this); }
+
+  /* Sets the maximum number of bytes of free blocks to keep cached.  Blocks
+   * freed beyond this are returned to the underlying allocator. */
+  void SetMaxCached(size_t size) { upb_arenapool_setmaxcached(this, size); }
+
+  /* Bytes of free blocks currently cached on the owning thread. */
+  size_t BytesCached() const { return upb_arenapool_bytescached(this); }
+
+  Allocator* allocator() { return upb_arenapool_alloc(this); }
+
+ private:
+  UPB_DISALLOW_COPY_AND_ASSIGN(ArenaPool)
+
+#else
+struct upb_arenapool {
+#endif  /* __cplusplus */
+  /* We implement the allocator interface.
+   * This must be the first member of upb_arenapool! */
+  upb_alloc alloc;
+
+  upb_alloc *block_alloc;
+
+  /* Free lists of cached blocks, one per power-of-two size class.  Only
+   * touched by the owning thread. */
+  void *free[UPB_ARENAPOOL_CLASSES];
+  size_t bytes_cached;
+  size_t max_cached;
+
+  /* Blocks freed but not yet sorted into the free lists.  Pushed to by any
+   * thread, drained by the owning thread. */
+  void *remote;
+};
+
+
+
+/* upb::HugePool **************************************************************/
+
+/* upb::HugePool is a block allocator for the arenas of large decodes.  Its
+ * blocks are backed by 2MB huge pages placed on the NUMA node of the thread
+ * that allocates them, so an arena's memory is local to the thread filling it
+ * and takes one TLB entry per 2MB instead of one per 4k page.
+ *
+ * Pages come from MAP_HUGETLB when the system has huge pages reserved, and
+ * otherwise from a 2MB-aligned mapping marked for transparent huge pages.
+ * Freed single-page blocks are cached on their node for reuse.  Requests too
+ * small to be worth a huge page, and all requests on systems without mmap(),
+ * go to a fallback allocator.
+ *
+ * For each arena block to fill exactly one huge page, use blocks of
+ * UPB_HUGEPOOL_ARENABLOCK bytes:
+ *
+ *   upb::HugePool pool;
+ *   upb::Arena arena(NULL, 0, pool.allocator());
+ *   arena.SetNextBlockSize(UPB_HUGEPOOL_ARENABLOCK);
+ *   arena.SetMaxBlockSize(UPB_HUGEPOOL_ARENABLOCK);
+ *
+ * Unlike upb::ArenaPool, a pool may be shared by any number of threads: each
+ * node's cache is guarded by a spinlock (none under UPB_THREAD_UNSAFE), taken
+ * once per huge page.  The pool must outlive the arenas that use it. */
+UPB_DECLARE_TYPE(upb::HugePool, upb_hugepool)
+
+#define UPB_HUGEPAGE_SIZE ((size_t)2 << 20)
+
+/* Nodes beyond this share the caches (and placement) of lower ones. */
+#define UPB_HUGEPOOL_NODES 8
+
+/* Bytes at the start of each block that the pool keeps for itself. */
+#define UPB_HUGEPOOL_OVERHEAD 64
+
+/* The upb_arena block size that makes each block exactly one huge page. */
+#define UPB_HUGEPOOL_ARENABLOCK \
+  (UPB_HUGEPAGE_SIZE - UPB_HUGEPOOL_OVERHEAD - UPB_ARENA_BLOCK_OVERHEAD)
+
+/* Cached free pages of one node.  Internal to upb_hugepool. */
+typedef struct {
+  void *free;
+  size_t bytes_cached;
+  size_t bytes_mapped;
+  int lock;
+} upb_hugepool_node;
+
+UPB_BEGIN_EXTERN_C
+
+void upb_hugepool_init(upb_hugepool *p, upb_alloc *fallback);
+void upb_hugepool_uninit(upb_hugepool *p);
+void upb_hugepool_setminsize(upb_hugepool *p, size_t size);
+void upb_hugepool_setmaxcached(upb_hugepool *p, size_t size);
+size_t upb_hugepool_bytesmapped(upb_hugepool *p);
+size_t upb_hugepool_bytescached(upb_hugepool *p);
+UPB_INLINE upb_alloc *upb_hugepool_alloc(upb_hugepool *p) {
+  return (upb_alloc*)p;
+}
+
+UPB_END_EXTERN_C
+
+#ifdef __cplusplus
+
+class upb::HugePool {
+ public:
+  /* Small blocks are obtained from |a|, or the global allocator if NULL. */
+  explicit HugePool(Allocator* a = NULL) { upb_hugepool_init(this, a); }
+  ~HugePool() { upb_hugepool_uninit(this); }
+
+  /* Sets the smallest request (pool overhead included) that gets huge pages;
+   * smaller ones go to the fallback allocator.  Defaults to half a huge page.
+   * Requests are rounded up to a whole number of huge pages. */
+  void SetMinSize(size_t size) { upb_hugepool_setminsize(this, size); }
+
+  /* Sets the maximum number of bytes of free pages to keep cached on each
+   * node.  Pages freed beyond this are unmapped. */
+  void SetMaxCached(size_t size) { upb_hugepool_setmaxcached(this, size); }
+
+  /* Bytes currently mapped, in use or cached, over all nodes. */
+  size_t BytesMapped() { return upb_hugepool_bytesmapped(this); }
+
+  /* Bytes of free pages currently cached, over all nodes. */
+  size_t BytesCached() { return upb_hugepool_bytescached(this); }
+
+  Allocator* allocator() { return upb_hugepool_alloc(this); }
+
+ private:
+  UPB_DISALLOW_COPY_AND_ASSIGN(HugePool)
+
+#else
+struct upb_hugepool {
+#endif  /* __cplusplus */
+  /* We implement the allocator interface.
+   * This must be the first member of upb_hugepool! */
+  upb_alloc alloc;
+
+  upb_alloc *fallback;
+  size_t min_size;
+  size_t max_cached;
+  upb_hugepool_node nodes[UPB_HUGEPOOL_NODES];
+};
+
 /* upb::Environment ***********************************************************/
 
 /* A upb::Environment provides a means for injecting malloc and an
@@ -734,5 +995,63 @@ template <int N> class upb::InlinedEnvironment : public upb::Environment {
 #endif  /* __cplusplus */
 
 
+/** Field types ***************************************************************/
+
+/* The types a field can have.  Note that this list is not identical to the
+ * types defined in descriptor.proto, which gives INT32 and SINT32 separate
+ * types (upb/def.h distinguishes the two with upb_intfmt_t). */
+typedef enum {
+  /* Types stored in 1 byte. */
+  UPB_TYPE_BOOL     = 1,
+  /* Types stored in 4 bytes. */
+  UPB_TYPE_FLOAT    = 2,
+  UPB_TYPE_INT32    = 3,
+  UPB_TYPE_UINT32   = 4,
+  UPB_TYPE_ENUM     = 5,  /* Enum values are int32. */
+  /* Types stored as pointers (probably 4 or 8 bytes). */
+  UPB_TYPE_STRING   = 6,
+  UPB_TYPE_BYTES    = 7,
+  UPB_TYPE_MESSAGE  = 8,
+  /* Types stored as 8 bytes. */
+  UPB_TYPE_DOUBLE   = 9,
+  UPB_TYPE_INT64    = 10,
+  UPB_TYPE_UINT64   = 11
+} upb_fieldtype_t;
+
+/* The repeated-ness of each field; this matches descriptor.proto. */
+typedef enum {
+  UPB_LABEL_OPTIONAL = 1,
+  UPB_LABEL_REQUIRED = 2,
+  UPB_LABEL_REPEATED = 3
+} upb_label_t;
+
+/* Descriptor types, as defined in descriptor.proto. */
+typedef enum {
+  UPB_DESCRIPTOR_TYPE_DOUBLE   = 1,
+  UPB_DESCRIPTOR_TYPE_FLOAT    = 2,
+  UPB_DESCRIPTOR_TYPE_INT64    = 3,
+  UPB_DESCRIPTOR_TYPE_UINT64   = 4,
+  UPB_DESCRIPTOR_TYPE_INT32    = 5,
+  UPB_DESCRIPTOR_TYPE_FIXED64  = 6,
+  UPB_DESCRIPTOR_TYPE_FIXED32  = 7,
+  UPB_DESCRIPTOR_TYPE_BOOL     = 8,
+  UPB_DESCRIPTOR_TYPE_STRING   = 9,
+  UPB_DESCRIPTOR_TYPE_GROUP    = 10,
+  UPB_DESCRIPTOR_TYPE_MESSAGE  = 11,
+  UPB_DESCRIPTOR_TYPE_BYTES    = 12,
+  UPB_DESCRIPTOR_TYPE_UINT32   = 13,
+  UPB_DESCRIPTOR_TYPE_ENUM     = 14,
+  UPB_DESCRIPTOR_TYPE_SFIXED32 = 15,
+  UPB_DESCRIPTOR_TYPE_SFIXED64 = 16,
+  UPB_DESCRIPTOR_TYPE_SINT32   = 17,
+  UPB_DESCRIPTOR_TYPE_SINT64   = 18
+} upb_descriptortype_t;
+
+UPB_BEGIN_EXTERN_C
+
+/* Maps descriptor type -> upb field type.  */
+extern const uint8_t upb_desctype_to_fieldtype[];
+
+UPB_END_EXTERN_C
 
 #endif  /* UPB_H_ */
@@ -0,0 +1,120 @@
+/*
+** UTF-8 validation.
+**
+** A non-ACCEPT state records how many continuation bytes are still needed
+** and the range the next one must fall in (only the first continuation byte
+** after a lead byte has a range other than 0x80..0xBF):
+**
+**   bits 0-7: continuation bytes remaining (1-3)
+**   bits 8-15: lowest allowed value of the next byte
+**   bits 16-23: highest allowed value of the next byte
+**
+** The lower bound is never zero, so a pending state is never confused with
+** UPB_UTF8_ACCEPT.
+*/
+
+#include "upb/utf8.int.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define UPB_UTF8_PENDING(need, lo, hi) \
+    ((upb_utf8state)(need) | ((upb_utf8state)(lo) << 8) | \
+     ((upb_utf8state)(hi) << 16))
+
+/* Returns a pointer to the first byte in [ptr, end) with its high bit set, or
+ * |end| if there is none. */
+static const unsigned char *skipascii(const unsigned char *ptr,
+                                      const unsigned char *end) {
+#ifdef __SSE2__
+  while (end - ptr >= 16) {
+    int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ptr));
+    if (mask) {
+#if defined(__GNUC__) || defined(__clang__)
+      return ptr + __builtin_ctz(mask);
+#else
+      break;  /* Let the byte loop below find it. */
+#endif
+    }
+    ptr += 16;
+  }
+#else
+  while (end - ptr >= 8) {
+    uint64_t v;
+    memcpy(&v, ptr, 8);
+    if (v & 0x8080808080808080ULL) {
+      break;
+    }
+    ptr += 8;
+  }
+#endif
+
+  while (ptr < end && *ptr < 0x80) {
+    ptr++;
+  }
+
+  return ptr;
+}
+
+upb_utf8state upb_utf8_validate(upb_utf8state s, const char *ptr, size_t len) {
+  const unsigned char *p = (const unsigned char*)ptr;
+  const unsigned char *end = p + len;
+  unsigned int need, lo, hi;
+
+  if (s == UPB_UTF8_REJECT) {
+    return s;
+  }
+
+  need = s & 0xff;
+  lo = (s >> 8) & 0xff;
+  hi = (s >> 16) & 0xff;
+
+  while (p < end) {
+    unsigned char c;
+
+    if (need > 0) {
+      c = *p++;
+      if (c < lo || c > hi) {
+        return UPB_UTF8_REJECT;
+      }
+      need--;
+      lo = 0x80;
+      hi = 0xbf;
+      continue;
+    }
+
+    p = skipascii(p, end);
+    if (p == end) {
+      break;
+    }
+
+    /* Lead byte of a multi-byte character.  C0, C1 and F5..FF can only
+     * begin overlong or out-of-range encodings; E0, ED, F0 and F4 restrict
+     * the next byte to rule out overlongs, surrogates and > U+10FFFF. */
+    c = *p++;
+    lo = 0x80;
+    hi = 0xbf;
+    if (c < 0xc2) {
+      return UPB_UTF8_REJECT;
+    } else if (c < 0xe0) {
+      need = 1;
+    } else if (c < 0xf0) {
+      need = 2;
+      if (c == 0xe0) lo = 0xa0;
+      if (c == 0xed) hi = 0x9f;
+    } else if (c < 0xf5) {
+      need = 3;
+      if (c == 0xf0) lo = 0x90;
+      if (c == 0xf4) hi = 0x8f;
+    } else {
+      return UPB_UTF8_REJECT;
+    }
+  }
+
+  return need == 0 ? UPB_UTF8_ACCEPT : UPB_UTF8_PENDING(need, lo, hi);
+}
+
+#undef UPB_UTF8_PENDING
@@ -0,0 +1,51 @@
+/*
+** UTF-8 validation, shared by the decoders.
+**
+** This header is INTERNAL-ONLY!  Its interfaces are not public or stable!
+**
+** The validator is incremental so that it can be used by the streaming
+** decoders, which may see a string split across any number of buffers: the
+** caller threads a upb_utf8state from one call to the next, starting from
+** UPB_UTF8_ACCEPT.  The input is valid iff the state after the last call is
+** UPB_UTF8_ACCEPT.  Runs of ASCII, by far the most common case, are skipped
+** many bytes at a time.
+**
+** "Valid" means well-formed as defined by RFC 3629: no overlong encodings,
+** no surrogates (U+D800..U+DFFF) and nothing above U+10FFFF.
+*/
+
+#ifndef UPB_UTF8_H_
+#define UPB_UTF8_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "upb/upb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t upb_utf8state;
+
+/* At a character boundary, with everything seen so far valid. */
+#define UPB_UTF8_ACCEPT 0
+
+/* Invalid input has been seen.  This state is sticky. */
+#define UPB_UTF8_REJECT 0xffffffffU
+
+/* Validates the next |len| bytes of a string, given the state after the
+ * previous bytes, and returns the new state.  Any state other than
+ * UPB_UTF8_ACCEPT or UPB_UTF8_REJECT means the data so far ends partway
+ * through a multi-byte character. */
+upb_utf8state upb_utf8_validate(upb_utf8state s, const char *ptr, size_t len);
+
+/* Returns true if [ptr, ptr + len) is a complete, valid UTF-8 string. */
+UPB_INLINE bool upb_utf8_isvalid(const char *ptr, size_t len) {
+  return upb_utf8_validate(UPB_UTF8_ACCEPT, ptr, len) == UPB_UTF8_ACCEPT;
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_UTF8_H_ */